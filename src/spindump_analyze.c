@@ -28,6 +28,7 @@
 #include "spindump_connections.h"
 #include "spindump_connections_set.h"
 #include "spindump_connections_set_iterator.h"
+#include "spindump_table.h"
 #include "spindump_analyze.h"
 #include "spindump_analyze_ip.h"
 #include "spindump_analyze_tcp.h"
@@ -64,6 +65,18 @@ spindump_analyze_process_raw(struct spindump_analyze* state,
 static int
 spindump_analyze_connectionspecifichandlerstillinuse(struct spindump_analyze* state,
                                                      spindump_handler_mask mask);
+static void
+spindump_analyze_rebuilddispatch(struct spindump_analyze* state);
+static int
+spindump_analyze_batchkey(enum spindump_capture_linktype linktype,
+                          const struct spindump_packet* packet,
+                          uint32_t* key);
+static int
+spindump_analyze_process_pakcounters(struct spindump_connection* connection,
+                                     const int fromResponder,
+                                     const struct spindump_packet* packet,
+                                     unsigned int ipPacketLength,
+                                     uint8_t ecnFlags);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -195,6 +208,7 @@ spindump_analyze_registerhandler(struct spindump_analyze* state,
   state->handlers[state->nHandlers].handlerData = handlerData;
   spindump_deepdeepdebugf("registered %uth handler %lx for %u", state->nHandlers, (unsigned long)handler, eventmask);
   state->nHandlers++;
+  spindump_analyze_rebuilddispatch(state);
 }
 
 //
@@ -290,6 +304,7 @@ spindump_analyze_unregisterhandler(struct spindump_analyze* state,
           handlerPtr = &state->handlers[i];
         }
       }
+      spindump_analyze_rebuilddispatch(state);
       
       //
       // Done. Return.
@@ -332,7 +347,44 @@ spindump_analyze_connectionspecifichandlerstillinuse(struct spindump_analyze* st
   
   return(0);
 }
-                                   
+
+//
+// Recompute, for each event, the list of handlers subscribed to
+// it. This is done whenever handlers are registered or
+// de-registered, so that running the handlers of an event does not
+// need to look at the handlers that are not interested in it.
+//
+
+static void
+spindump_analyze_rebuilddispatch(struct spindump_analyze* state) {
+  spindump_assert(state != 0);
+  state->subscribedEvents = 0;
+  for (unsigned int e = 0; e < spindump_analyze_nevents; e++) {
+    spindump_analyze_event event = ((spindump_analyze_event)1) << e;
+    struct spindump_analyze_dispatch* dispatch = &state->dispatch[e];
+    dispatch->nHandlers = 0;
+    for (unsigned int i = 0; i < state->nHandlers; i++) {
+      if ((state->handlers[i].eventmask & event) != 0) {
+        dispatch->handlers[dispatch->nHandlers++] = (uint8_t)i;
+      }
+    }
+    if (dispatch->nHandlers > 0) state->subscribedEvents |= event;
+  }
+}
+
+//
+// Does any handler want to hear about (any of) the given event(s)?
+// Callers can use this to avoid preparing for an event that nobody
+// would see.
+//
+
+int
+spindump_analyze_hashandlers(struct spindump_analyze* state,
+                             spindump_analyze_event event) {
+  spindump_assert(state != 0);
+  return((state->subscribedEvents & event) != 0);
+}
+
 //
 // Run all the handlers for a specific event
 //
@@ -359,31 +411,77 @@ spindump_analyze_process_handlers(struct spindump_analyze* state,
                       (unsigned long)packet);
   spindump_assert(state != 0);
   spindump_assert(packet == 0 || spindump_packet_isvalid(packet));
+  state->stats->analyzerEvents++;
   
   //
-  // Scan through the registered handlers and execute them if they
-  // match this event
+  // Find the handlers that are subscribed to this event. Events are
+  // normally single bits, and have a precomputed list. For a
+  // combination of events, collect the handlers that match any of
+  // them.
   //
+
+  if ((state->subscribedEvents & event) == 0) return;
+  const struct spindump_analyze_dispatch* dispatch;
+  struct spindump_analyze_dispatch combined;
+  if ((event & (event - 1)) == 0) {
+    dispatch = &state->dispatch[__builtin_ctz(event)];
+  } else {
+    combined.nHandlers = 0;
+    for (unsigned int i = 0; i < state->nHandlers; i++) {
+      if ((state->handlers[i].eventmask & event) != 0) {
+        combined.handlers[combined.nHandlers++] = (uint8_t)i;
+      }
+    }
+    dispatch = &combined;
+  }
+  state->stats->analyzerEventsDelivered++;
   
-  for (unsigned int i = 0; i < state->nHandlers; i++) {
+  //
+  // The handlers of an aggregate may read it, so bring it up to date
+  // first. This also delivers its held RTT events, before this one.
+  //
+
+  if (state->table->rollup.first != 0 && spindump_connections_isaggregate(connection)) {
+    spindump_connectionstable_rollup_fold(state->table,state);
+  }
+  
+  //
+  // Execute the handlers
+  //
+  
+  for (unsigned int j = 0; j < dispatch->nHandlers; j++) {
+    unsigned int i = dispatch->handlers[j];
     struct spindump_analyze_handler* handler = &state->handlers[i];
-    if ((handler->eventmask & event) != 0) {
-      spindump_assert(spindump_analyze_max_handlers == spindump_connection_max_handlers);
-      spindump_assert(i < spindump_connection_max_handlers);
-      state->stats->analyzerHandlerCalls++;
-      spindump_deepdebugf("calling %uth handler %x (%lx)",
-                          state->stats->analyzerHandlerCalls,
-                          handler->eventmask,
-                          (unsigned long)handler->function);
-      (*(handler->function))(state,
-                             handler->handlerData,
-                             &connection->handlerConnectionDatas[i],
-                             event,
-                             timestamp,
-                             fromResponder,
-                             ipPacketLength,
-                             packet,
-                             connection);
+    spindump_assert((handler->eventmask & event) != 0);
+    spindump_assert(spindump_analyze_max_handlers == spindump_connection_max_handlers);
+    spindump_assert(i < spindump_connection_max_handlers);
+    state->stats->analyzerHandlerCalls++;
+    spindump_deepdebugf("calling %uth handler %x (%lx)",
+                        state->stats->analyzerHandlerCalls,
+                        handler->eventmask,
+                        (unsigned long)handler->function);
+    
+    //
+    // The handler data of a connection lives in its cold part. If
+    // the connection does not have one yet, only allocate it if
+    // the handler actually stores something.
+    //
+    
+    void* newHandlerConnectionData = 0;
+    void** handlerConnectionData =
+      connection->cold != 0 ? &connection->cold->handlerConnectionDatas[i] : &newHandlerConnectionData;
+    (*(handler->function))(state,
+                           handler->handlerData,
+                           handlerConnectionData,
+                           event,
+                           timestamp,
+                           fromResponder,
+                           ipPacketLength,
+                           packet,
+                           connection);
+    if (newHandlerConnectionData != 0) {
+      struct spindump_connection_cold* cold = spindump_connections_getcold(connection,state->table);
+      if (cold != 0) cold->handlerConnectionDatas[i] = newHandlerConnectionData;
     }
   }
   
@@ -524,6 +622,213 @@ spindump_analyze_process(struct spindump_analyze* state,
   }
 }
 
+//
+// Process a batch of packets. This is equivalent to calling
+// spindump_analyze_process for each packet in turn, but the headers
+// of all the packets are first decoded to find the address/port
+// index buckets of their connections, and these buckets and the
+// connections in them are fetched into the cache before the packets
+// are processed. Packets of a large table then wait for memory once
+// per batch rather than once per packet. Small tables stay in the
+// cache anyway, so for them the packets are just processed in turn.
+//
+// The connections that the packets belong to are placed in the
+// connections array, if it is not null.
+//
+
+void
+spindump_analyze_process_batch(struct spindump_analyze* state,
+                               enum spindump_capture_linktype linktype,
+                               struct spindump_packet* packets,
+                               unsigned int nPackets,
+                               struct spindump_connection** connections) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(state != 0);
+  spindump_assert(state->table != 0);
+  spindump_assert(packets != 0);
+  spindump_assert(nPackets <= spindump_analyze_maxbatch);
+
+  //
+  // Decode the headers, and start fetching the bucket of each
+  // packet. Then the first entry in each bucket, which is part of a
+  // connection, and the beginning of that connection.
+  //
+
+  const struct spindump_connectionstable_index* index = &state->table->tupleIndex;
+  if (index->nEntries >= spindump_analyze_prefetchmin) {
+    struct spindump_connection_hashentry* entries[spindump_analyze_maxbatch];
+    uint32_t keys[spindump_analyze_maxbatch];
+    int haveKey[spindump_analyze_maxbatch];
+    for (unsigned int i = 0; i < nPackets; i++) {
+      haveKey[i] = spindump_analyze_batchkey(linktype,&packets[i],&keys[i]);
+      if (haveKey[i]) spindump_connectionstable_index_prefetch(index,keys[i]);
+    }
+    for (unsigned int i = 0; i < nPackets; i++) {
+      entries[i] = haveKey[i] ? spindump_connectionstable_index_bucket(index,keys[i]) : 0;
+      if (entries[i] != 0) spindump_prefetch(entries[i]);
+    }
+    for (unsigned int i = 0; i < nPackets; i++) {
+      if (entries[i] != 0) spindump_prefetch(entries[i]->connection);
+    }
+  }
+
+  //
+  // Process the packets
+  //
+
+  for (unsigned int i = 0; i < nPackets; i++) {
+    struct spindump_connection* connection = 0;
+    spindump_analyze_process(state,linktype,&packets[i],&connection);
+    if (connections != 0) connections[i] = connection;
+  }
+}
+
+//
+// Find the address/port index key under which the connection of a
+// TCP, UDP, or SCTP packet would be found. Returns 1 if the key could
+// be determined, and 0 otherwise. UDP packets are keyed as plain UDP
+// connections, even if they turn out to be DNS, COAP, or QUIC.
+//
+
+static int
+spindump_analyze_batchkey(enum spindump_capture_linktype linktype,
+                          const struct spindump_packet* packet,
+                          uint32_t* key) {
+  struct spindump_analyze_flow flow;
+  if (!spindump_analyze_decodeflow(linktype,packet,&flow)) return(0);
+  if (flow.sourcePort == 0) return(0);
+  enum spindump_connection_type type;
+  switch (flow.protocol) {
+  case IPPROTO_TCP: type = spindump_connection_transport_tcp; break;
+  case IPPROTO_UDP: type = spindump_connection_transport_udp; break;
+  case IPPROTO_SCTP: type = spindump_connection_transport_sctp; break;
+  default: return(0);
+  }
+  spindump_compactaddress source;
+  spindump_compactaddress destination;
+  memset(&source,0,sizeof(source));
+  memset(&destination,0,sizeof(destination));
+  source.family = destination.family = (flow.addressLength == 4 ? AF_INET : AF_INET6);
+  memcpy(source.words,flow.source,flow.addressLength);
+  memcpy(destination.words,flow.destination,flow.addressLength);
+  spindump_port sourcePort = (spindump_port)((flow.sourcePort[0] << 8) | flow.sourcePort[1]);
+  spindump_port destinationPort = (spindump_port)((flow.destinationPort[0] << 8) | flow.destinationPort[1]);
+  *key = spindump_connectionstable_index_hostkey(type,&source,sourcePort,&destination,destinationPort);
+  return(1);
+}
+
+//
+// Find the addresses, protocol, ports, and transport header of a
+// packet, without analyzing it further. Only the fixed IP header is
+// looked at, so for IPv6 packets with extension headers the protocol
+// is that of the first extension header. Returns 1 if the packet is
+// an IPv4 or IPv6 packet, and 0 otherwise.
+//
+
+int
+spindump_analyze_decodeflow(enum spindump_capture_linktype linktype,
+                            const struct spindump_packet* packet,
+                            struct spindump_analyze_flow* flow) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(packet != 0);
+  spindump_assert(flow != 0);
+  const unsigned char* contents = packet->contents;
+  unsigned int caplen = packet->caplen;
+  if (contents == 0) return(0);
+
+  //
+  // Skip the link layer
+  //
+
+  unsigned int position = 0;
+  switch (linktype) {
+  case spindump_capture_linktype_null:
+    position = spindump_null_header_size;
+    break;
+  case spindump_capture_linktype_ethernet:
+    if (caplen < spindump_ethernet_header_size) return(0);
+    {
+      struct spindump_ethernet ethernet;
+      spindump_protocols_ethernet_header_decode(contents,&ethernet);
+      if (ethernet.ether_type != spindump_ethertype_ip &&
+          ethernet.ether_type != spindump_ethertype_ip6) return(0);
+    }
+    position = spindump_ethernet_header_size;
+    break;
+  case spindump_capture_linktype_linux_sll:
+    position = spindump_linux_sll_header_size;
+    break;
+  case spindump_capture_linktype_raw:
+    position = 0;
+    break;
+  default:
+    return(0);
+  }
+  if (caplen <= position) return(0);
+
+  //
+  // Find the addresses, protocol, and transport header
+  //
+
+  unsigned int transport;
+  int fragment;
+  switch (contents[position] >> 4) {
+  case 4:
+    {
+      if (caplen < position + 20) return(0);
+      unsigned int headerLength = (contents[position] & 0x0f) * 4U;
+      uint16_t offset;
+      memcpy(&offset,&contents[position + 6],sizeof(offset));
+      offset = ntohs(offset);
+      fragment = ((offset & SPINDUMP_IP_OFFMASK) != 0);
+      flow->protocol = contents[position + 9];
+      flow->source = &contents[position + 12];
+      flow->destination = &contents[position + 16];
+      flow->addressLength = 4;
+      transport = position + headerLength;
+    }
+    break;
+  case 6:
+    if (caplen < position + 40) return(0);
+    fragment = 0;
+    flow->protocol = contents[position + 6];
+    flow->source = &contents[position + 8];
+    flow->destination = &contents[position + 24];
+    flow->addressLength = 16;
+    transport = position + 40;
+    break;
+  default:
+    return(0);
+  }
+
+  //
+  // Find the ports
+  //
+
+  if ((flow->protocol == IPPROTO_TCP || flow->protocol == IPPROTO_UDP || flow->protocol == IPPROTO_SCTP) &&
+      !fragment &&
+      caplen >= transport + 4) {
+    flow->sourcePort = &contents[transport];
+    flow->destinationPort = &contents[transport + 2];
+    flow->transport = &contents[transport];
+    flow->transportLength = caplen - transport;
+  } else {
+    flow->sourcePort = 0;
+    flow->destinationPort = 0;
+    flow->transport = 0;
+    flow->transportLength = 0;
+  }
+  return(1);
+}
+
 //
 // Process a packet when the datalink layer is the BSD null/loop layer.
 // This layer has just a 4-byte number indicating the packet type.
@@ -784,41 +1089,16 @@ spindump_analyze_process_raw(struct spindump_analyze* state,
 }
 
 //
-// Mark the reception of a packet belonging to a connection, increase
-// statistics.
-//
-// If fromResponder = 1, the sending party is the server of the
-// connection, if fromResponder = 0, it is the client.
+// Update the packet, byte, and ECN counters of a connection for a
+// packet. Returns 1 if the packet was marked CE, otherwise 0.
 //
 
-void
-spindump_analyze_process_pakstats(struct spindump_analyze* state,
-                                  struct spindump_connection* connection,
-                                  const struct timeval* timestamp,
-                                  const int fromResponder,
-                                  struct spindump_packet* packet,
-                                  unsigned int ipPacketLength,
-                                  uint8_t ecnFlags) {
-
-  //
-  // Checks
-  //
-
-  spindump_assert(state != 0);
-  spindump_assert(connection != 0);
-  spindump_assert(spindump_isbool(fromResponder));
-  spindump_assert(packet != 0);
-  spindump_assert(packet == 0 || spindump_packet_isvalid(packet));
-  spindump_assert(ecnFlags <= 3);
-  spindump_deepdeepdebugf("pakstats got a packet of length %u for a connection of type %s",
-                          ipPacketLength,
-                          spindump_connection_type_to_string(connection->type));
-  
-  //
-  // Update the statistics based on whether the packet was from side1
-  // or side2.
-  //
-
+static int
+spindump_analyze_process_pakcounters(struct spindump_connection* connection,
+                                     const int fromResponder,
+                                     const struct spindump_packet* packet,
+                                     unsigned int ipPacketLength,
+                                     uint8_t ecnFlags) {
   if (fromResponder) {
     connection->latestPacketFromSide2 = packet->timestamp;
     connection->packetsFromSide2++;
@@ -830,7 +1110,6 @@ spindump_analyze_process_pakstats(struct spindump_analyze* state,
   }
   
   int ecnCe = 0;
-  
   switch (ecnFlags) {
   case 0x1:
     if (fromResponder) {
@@ -863,6 +1142,55 @@ spindump_analyze_process_pakstats(struct spindump_analyze* state,
     //
     break;
   }
+  return(ecnCe);
+}
+
+//
+// Mark the reception of a packet belonging to a connection, increase
+// statistics.
+//
+// If fromResponder = 1, the sending party is the server of the
+// connection, if fromResponder = 0, it is the client.
+//
+
+void
+spindump_analyze_process_pakstats(struct spindump_analyze* state,
+                                  struct spindump_connection* connection,
+                                  const struct timeval* timestamp,
+                                  const int fromResponder,
+                                  struct spindump_packet* packet,
+                                  unsigned int ipPacketLength,
+                                  uint8_t ecnFlags) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(state != 0);
+  spindump_assert(connection != 0);
+  spindump_assert(spindump_isbool(fromResponder));
+  spindump_assert(packet != 0);
+  spindump_assert(packet == 0 || spindump_packet_isvalid(packet));
+  spindump_assert(ecnFlags <= 3);
+  spindump_deepdeepdebugf("pakstats got a packet of length %u for a connection of type %s",
+                          ipPacketLength,
+                          spindump_connection_type_to_string(connection->type));
+  
+  //
+  // If the packet is counted directly for an aggregate, bring the
+  // aggregate up to date first
+  //
+
+  if (state->table->rollup.first != 0 && spindump_connections_isaggregate(connection)) {
+    spindump_connectionstable_rollup_fold(state->table,state);
+  }
+  
+  //
+  // Update the statistics based on whether the packet was from side1
+  // or side2.
+  //
+
+  int ecnCe = spindump_analyze_process_pakcounters(connection,fromResponder,packet,ipPacketLength,ecnFlags);
   
   //
   // Call some handlers, if any, for the new measurements
@@ -907,16 +1235,64 @@ spindump_analyze_process_pakstats(struct spindump_analyze* state,
   
   //
   // Loop through any possible aggregated connections this connection
-  // belongs to, and report the same measurement udpates there.
+  // belongs to, and report the same measurement udpates there. If
+  // aggregate updates are deferred, the packet is only counted
+  // locally, unless the aggregates need to see it right away. In
+  // that case the earlier deferred packets are folded in first. If
+  // the aggregates are shared with other worker threads, the updates
+  // are logged, to be applied later in the order of the packets.
   //
 
+  if (connection->aggregates.first == 0) return;
   struct spindump_connection_set_iterator iter;
+  if (state->table->shared.lock != 0) {
+    int handled = (packet->analyzerHandlerCalls != state->stats->analyzerHandlerCalls);
+    for (spindump_connection_set_iterator_initialize(&connection->aggregates,&iter);
+         !spindump_connection_set_iterator_end(&iter);
+         ) {
+      spindump_connectionstable_shared_packet(state->table,
+                                              spindump_connection_set_iterator_next(&iter),
+                                              timestamp,
+                                              &packet->timestamp,
+                                              fromResponder,
+                                              ipPacketLength,
+                                              ecnFlags,
+                                              handled);
+    }
+    return;
+  }
+  if (spindump_connectionstable_rollup_defer(state->table,
+                                             connection,
+                                             &packet->timestamp,
+                                             fromResponder,
+                                             ipPacketLength,
+                                             ecnFlags)) {
+    return;
+  }
+  spindump_connectionstable_rollup_fold(state->table,state);
+
+  //
+  // If no handler wants to hear about packets, the aggregates only
+  // need their counters updated, and the recursion with its event
+  // dispatching can be skipped.
+  //
+
+  int packetEvents = spindump_analyze_hashandlers(state,
+                                                  spindump_analyze_event_newpacket |
+                                                  spindump_analyze_event_firstresponsepacket |
+                                                  spindump_analyze_event_initiatorecnce |
+                                                  spindump_analyze_event_responderecnce);
   for (spindump_connection_set_iterator_initialize(&connection->aggregates,&iter);
        !spindump_connection_set_iterator_end(&iter);
        ) {
 
     struct spindump_connection* aggregate = spindump_connection_set_iterator_next(&iter);
     spindump_assert(aggregate != 0);
+    if (!packetEvents) {
+      spindump_assert(aggregate->aggregates.first == 0);
+      spindump_analyze_process_pakcounters(aggregate,fromResponder,packet,ipPacketLength,ecnFlags);
+      continue;
+    }
     spindump_deepdeepdebugf("pakstats recursing to an aggregate for a packet of length %u", ipPacketLength);
     spindump_analyze_process_pakstats(state,
                                       aggregate,
@@ -33,6 +33,8 @@
 //
 
 #define spindump_analyze_max_handlers 32
+#define spindump_analyze_maxbatch     64   // packets, at most in one spindump_analyze_process_batch
+#define spindump_analyze_prefetchmin  4096 // connections, below which the table is assumed to be in cache
 
 //
 // Data types ---------------------------------------------------------------------------------
@@ -64,6 +66,7 @@ typedef uint32_t spindump_analyze_event;
 #define spindump_analyze_event_periodic                        4194304
 
 #define spindump_analyze_event_alllegal                        8388607
+#define spindump_analyze_nevents                                    23
 
 struct spindump_analyze;
 struct spindump_event;
@@ -89,6 +92,35 @@ struct spindump_analyze_handler {
   char padding[2];                                 // unused
 };
 
+//
+// For each event, the handlers that are subscribed to it, as indexes
+// to the analyzer's table of handlers, in the order of that table.
+//
+
+struct spindump_analyze_dispatch {
+  unsigned int nHandlers;                          // the number of handlers subscribed to the event
+  uint8_t handlers[spindump_analyze_max_handlers]; // indexes of the subscribed handlers
+};
+
+//
+// The addresses, protocol, and ports of a packet, as pointers to the
+// packet contents. The ports and the transport header are not set
+// for protocols other than TCP, UDP, and SCTP, or for non-first
+// fragments.
+//
+
+struct spindump_analyze_flow {
+  const unsigned char* source;                     // source address
+  const unsigned char* destination;                // destination address
+  const unsigned char* sourcePort;                 // source port, or 0 if not known
+  const unsigned char* destinationPort;            // destination port, or 0 if not known
+  const unsigned char* transport;                  // transport header, or 0 if not known
+  unsigned int transportLength;                    // captured bytes from the transport header on
+  unsigned int addressLength;                      // 4 for IPv4, 16 for IPv6
+  uint8_t protocol;                                // IP protocol number
+  char padding[7];                                 // unused
+};
+
 struct spindump_analyze {
   int showRelativeTime;                            // Whether reports are in absolute or relative time
   unsigned long long firstEventTime;               // The time of the first event reported in this Spindump run
@@ -98,6 +130,9 @@ struct spindump_analyze {
   unsigned int padding;                            // unused
   struct spindump_analyze_handler
     handlers[spindump_analyze_max_handlers];       // the registered handlers
+  struct spindump_analyze_dispatch
+    dispatch[spindump_analyze_nevents];            // the handlers of each event, rebuilt on (un)registration
+  spindump_analyze_event subscribedEvents;         // the events that have at least one handler
 };
 
 //
@@ -125,6 +160,9 @@ spindump_analyze_unregisterhandler(struct spindump_analyze* state,
                                    struct spindump_connection* connection,
                                    spindump_analyze_handler handler,
                                    void* handlerData);
+int
+spindump_analyze_hashandlers(struct spindump_analyze* state,
+                             spindump_analyze_event event);
 struct spindump_stats*
 spindump_analyze_getstats(struct spindump_analyze* state);
 void
@@ -133,6 +171,16 @@ spindump_analyze_process(struct spindump_analyze* state,
                          struct spindump_packet* packet,
                          struct spindump_connection** p_connection);
 void
+spindump_analyze_process_batch(struct spindump_analyze* state,
+                               enum spindump_capture_linktype linktype,
+                               struct spindump_packet* packets,
+                               unsigned int nPackets,
+                               struct spindump_connection** connections);
+int
+spindump_analyze_decodeflow(enum spindump_capture_linktype linktype,
+                            const struct spindump_packet* packet,
+                            struct spindump_analyze_flow* flow);
+void
 spindump_analyze_processevent(struct spindump_analyze* state,
                               const struct spindump_event* event,
                               struct spindump_connection** p_connection);
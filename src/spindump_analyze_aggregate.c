@@ -70,32 +70,34 @@ spindump_analyze_process_aggregate(struct spindump_analyze* state,
   //
   
   spindump_address source;
+  spindump_compactaddress compactSource;
   spindump_analyze_getsource(packet,ipVersion,ipHeaderPosition,&source);
+  spindump_compactaddress_fromaddress(&source,&compactSource);
   int fromResponder;
   switch (connection->type) {
   case spindump_connection_aggregate_hostpair:
-    fromResponder = spindump_address_equal(&source,
-                                           &connection->u.aggregatehostpair.side1peerAddress);
+    fromResponder = spindump_compactaddress_equal(&compactSource,
+                                                  &connection->u.aggregatehostpair.side1peerAddress);
     break;
   case spindump_connection_aggregate_hostnetwork:
-    fromResponder = spindump_address_equal(&source,
-                                           &connection->u.aggregatehostnetwork.side1peerAddress);
+    fromResponder = spindump_compactaddress_equal(&compactSource,
+                                                  &connection->u.aggregatehostnetwork.side1peerAddress);
     break;
   case spindump_connection_aggregate_networknetwork:
-    fromResponder = spindump_address_innetwork(&source,
-                                               &connection->u.aggregatenetworknetwork.side1Network);
+    fromResponder = spindump_compactaddress_innetwork(&compactSource,
+                                                      &connection->u.aggregatenetworknetwork.side1Network);
     break;
   case spindump_connection_aggregate_hostmultinet:
-    fromResponder = spindump_address_equal(&source,
-                                           &connection->u.aggregatehostmultinet.side1peerAddress);
+    fromResponder = spindump_compactaddress_equal(&compactSource,
+                                                  &connection->u.aggregatehostmultinet.side1peerAddress);
     break;
   case spindump_connection_aggregate_networkmultinet:
-    fromResponder = spindump_address_innetwork(&source,
-                                               &connection->u.aggregatenetworkmultinet.side1Network);
+    fromResponder = spindump_compactaddress_innetwork(&compactSource,
+                                                      &connection->u.aggregatenetworkmultinet.side1Network);
     break;
   case spindump_connection_aggregate_multicastgroup:
-    fromResponder = spindump_address_equal(&source,
-                                           &connection->u.aggregatemulticastgroup.group);
+    fromResponder = spindump_compactaddress_equal(&compactSource,
+                                                  &connection->u.aggregatemulticastgroup.group);
     break;
   case spindump_connection_transport_udp:
   case spindump_connection_transport_tcp:
@@ -158,10 +158,10 @@ spindump_analyze_coap_markmidsent(struct spindump_connection* connection,
   spindump_assert(t != 0);
 
   if (fromResponder) {
-    spindump_messageidtracker_add(&connection->u.coap.side2MIDs,t,mid);
+    spindump_messageidtracker_add(&connection->cold->u.coap.side2MIDs,t,mid);
     spindump_deepdebugf("responder sent MID %u", mid);
   } else {
-    spindump_messageidtracker_add(&connection->u.coap.side1MIDs,t,mid);
+    spindump_messageidtracker_add(&connection->cold->u.coap.side1MIDs,t,mid);
     spindump_deepdebugf("initiator sent MID %u", mid);
   }
 }
@@ -205,7 +205,7 @@ spindump_analyze_coap_markmidreceived(struct spindump_analyze* state,
 
   if (fromResponder) {
 
-    ackto = spindump_messageidtracker_ackto(&connection->u.coap.side1MIDs,mid);
+    ackto = spindump_messageidtracker_ackto(&connection->cold->u.coap.side1MIDs,mid);
 
     if (ackto != 0) {
 
@@ -233,7 +233,7 @@ spindump_analyze_coap_markmidreceived(struct spindump_analyze* state,
 
   } else {
 
-    ackto = spindump_messageidtracker_ackto(&connection->u.coap.side2MIDs,mid);
+    ackto = spindump_messageidtracker_ackto(&connection->cold->u.coap.side2MIDs,mid);
 
     if (ackto != 0) {
 
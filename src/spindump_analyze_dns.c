@@ -100,13 +100,13 @@ spindump_analyze_dns_isprobablednspacket(const unsigned char* payload,
 // string need not be freed, but it will not survive the next call to
 // this same function.
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 static const char*
 spindump_analyzer_dns_parsename(const char* dnspayload,
                                 unsigned int dnspayloadsize) {
-  static char buf[200];
+  static _Thread_local char buf[200];
   memset(buf,0,sizeof(buf));
   if (dnspayloadsize == 0) {
     spindump_deepdebugf("DNS payload size 0 is not allowed, failing");
@@ -152,10 +152,10 @@ spindump_analyzer_dns_markmidsent(struct spindump_connection* connection,
   spindump_assert(t != 0);
 
   if (fromResponder) {
-    spindump_messageidtracker_add(&connection->u.dns.side2MIDs,t,mid);
+    spindump_messageidtracker_add(&connection->cold->u.dns.side2MIDs,t,mid);
     spindump_deepdebugf("responder sent MID %u", mid);
   } else {
-    spindump_messageidtracker_add(&connection->u.dns.side1MIDs,t,mid);
+    spindump_messageidtracker_add(&connection->cold->u.dns.side1MIDs,t,mid);
     spindump_deepdebugf("initiator sent MID %u", mid);
   }
 }
@@ -187,7 +187,7 @@ spindump_analyzer_dns_markmidreceived(struct spindump_analyze* state,
 
   if (fromResponder) {
 
-    ackto = spindump_messageidtracker_ackto(&connection->u.dns.side1MIDs,mid);
+    ackto = spindump_messageidtracker_ackto(&connection->cold->u.dns.side1MIDs,mid);
 
     if (ackto != 0) {
 
@@ -215,7 +215,7 @@ spindump_analyzer_dns_markmidreceived(struct spindump_analyze* state,
 
   } else {
 
-    ackto = spindump_messageidtracker_ackto(&connection->u.dns.side2MIDs,mid);
+    ackto = spindump_messageidtracker_ackto(&connection->cold->u.dns.side2MIDs,mid);
 
     if (ackto != 0) {
 
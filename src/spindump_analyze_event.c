@@ -63,6 +63,10 @@ spindump_analyze_processevent_periodic(struct spindump_analyze* state,
                                        const struct spindump_event* event,
                                        struct spindump_connection** p_connection);
 static void
+spindump_analyze_processevent_periodic_histogram(struct spindump_analyze* state,
+                                                 struct spindump_connection* connection,
+                                                 const struct spindump_histogram* histogram);
+static void
 spindump_analyze_processevent_spin_flip(struct spindump_analyze* state,
                                         const struct spindump_event* event,
                                         struct spindump_connection** p_connection);
@@ -828,6 +832,35 @@ spindump_analyze_processevent_periodic(struct spindump_analyze* state,
                                          &sent,
                                          &rcvd,
                                          "remote update");
+  spindump_analyze_processevent_periodic_histogram(state,*p_connection,&event->u.periodic.histRight);
+}
+
+//
+// Merge the RTT histogram from a "periodic" event to the right RTT
+// histograms of a connection, both the cumulative one and that of
+// the current period, and to those of the aggregate connections it
+// belongs to. As each event carries the measurements of one period,
+// histograms from any number of probes and periods can be added
+// together.
+//
+
+static void
+spindump_analyze_processevent_periodic_histogram(struct spindump_analyze* state,
+                                                 struct spindump_connection* connection,
+                                                 const struct spindump_histogram* histogram) {
+  if (histogram->count == 0) return;
+  struct spindump_connection_cold* cold = spindump_connections_getcold(connection,state->table);
+  if (cold == 0) return;
+  spindump_histogram_merge(&cold->rightRTT.histogram,histogram);
+  spindump_histogram_merge(&cold->rightRTTPeriod,histogram);
+  struct spindump_connection_set_iterator iter;
+  for (spindump_connection_set_iterator_initialize(&connection->aggregates,&iter);
+       !spindump_connection_set_iterator_end(&iter);
+       ) {
+    struct spindump_connection* aggregate = spindump_connection_set_iterator_next(&iter);
+    spindump_assert(aggregate != 0);
+    spindump_analyze_processevent_periodic_histogram(state,aggregate,histogram);
+  }
 }
 
 //
@@ -1248,6 +1281,13 @@ spindump_analyze_event_updateinfo(struct spindump_analyze* state,
   spindump_assert(connection != 0);
   spindump_assert(event != 0);
 
+  //
+  // The counters are replaced below, so fold any deferred updates
+  // into the aggregates first
+  //
+
+  spindump_connectionstable_rollup_fold(state->table,state);
+  
   //
   // Update timestamps
   //
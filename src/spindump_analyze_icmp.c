@@ -226,7 +226,7 @@ spindump_analyze_process_icmp(struct spindump_analyze* state,
       spindump_deepdeepdebugf("looking for ICMP SEQ match of %u",
                               peerSeq);
       const struct timeval* ackto =
-        spindump_messageidtracker_ackto(&connection->u.icmp.side1Seqs,peerSeq);
+        spindump_messageidtracker_ackto(&connection->cold->u.icmp.side1Seqs,peerSeq);
       if (ackto != 0) {
         spindump_deepdeepdebugf("found ackto for sequence %u", peerSeq);
         spindump_connections_newrttmeasurement(state,
@@ -246,7 +246,7 @@ spindump_analyze_process_icmp(struct spindump_analyze* state,
 
     } else {
 
-      spindump_messageidtracker_add(&connection->u.icmp.side1Seqs,&packet->timestamp,peerSeq);
+      spindump_messageidtracker_add(&connection->cold->u.icmp.side1Seqs,&packet->timestamp,peerSeq);
       fromResponder = 0;
 
     }
@@ -473,7 +473,7 @@ spindump_analyze_process_icmp6(struct spindump_analyze* state,
       spindump_deepdeepdebugf("looking for ICMPv6 SEQ match of %u",
                               peerSeq);
       const struct timeval* ackto =
-        spindump_messageidtracker_ackto(&connection->u.icmp.side1Seqs,peerSeq);
+        spindump_messageidtracker_ackto(&connection->cold->u.icmp.side1Seqs,peerSeq);
       
       if (ackto != 0) {
         spindump_deepdeepdebugf("found ackto for sequence %u", peerSeq);
@@ -494,7 +494,7 @@ spindump_analyze_process_icmp6(struct spindump_analyze* state,
 
     } else {
       
-      spindump_messageidtracker_add(&connection->u.icmp.side1Seqs,&packet->timestamp,peerSeq);
+      spindump_messageidtracker_add(&connection->cold->u.icmp.side1Seqs,&packet->timestamp,peerSeq);
       fromResponder = 0;
       
     }
@@ -28,6 +28,7 @@
 #include "spindump_connections.h"
 #include "spindump_connections_set.h"
 #include "spindump_connections_set_iterator.h"
+#include "spindump_table.h"
 #include "spindump_analyze.h"
 #include "spindump_analyze_ip.h"
 #include "spindump_analyze_tcp.h"
@@ -529,19 +530,23 @@ spindump_analyze_ip_otherippayload(struct spindump_analyze* state,
   // and note the reception of an unmatching packet.
   //
 
-  unsigned int i;
   spindump_address source;
   spindump_address destination;
 
+  spindump_compactaddress compactSource;
+  spindump_compactaddress compactDestination;
+
   spindump_analyze_getsource(packet,ipVersion,ipHeaderPosition,&source);
   spindump_analyze_getdestination(packet,ipVersion,ipHeaderPosition,&destination);
+  spindump_compactaddress_fromaddress(&source,&compactSource);
+  spindump_compactaddress_fromaddress(&destination,&compactDestination);
 
-  for (i = 0; i < state->table->nConnections; i++) {
+  unsigned int nCandidates =
+    spindump_connectionstable_prefixes_candidates(&state->table->prefixes,&compactSource,&compactDestination);
+  for (unsigned int i = 0; i < nCandidates; i++) {
 
-    struct spindump_connection* connection = state->table->connections[i];
-    if (connection != 0 &&
-        spindump_connections_isaggregate_simple(connection) &&
-        spindump_connections_matches_aggregate_srcdst(&source,&destination,connection)) {
+    struct spindump_connection* connection = state->table->prefixes.candidates[i];
+    if (spindump_connections_matches_aggregate_srcdst(&compactSource,&compactDestination,connection)) {
 
       //
       // Found a matching connection! Report it there.
@@ -571,7 +576,7 @@ spindump_analyze_ip_otherippayload(struct spindump_analyze* state,
   }
 
   struct spindump_connection* connection =
-    spindump_connections_match_multinet(&source,&destination,state->table);
+    spindump_connections_match_multinet(&compactSource,&compactDestination,state->table);
   if (connection) {
     spindump_analyze_process_aggregate(state,
                                        connection,
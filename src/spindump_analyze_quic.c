@@ -22,6 +22,7 @@
 
 #include "spindump_util.h"
 #include "spindump_connections.h"
+#include "spindump_table.h"
 #include "spindump_analyze.h"
 #include "spindump_analyze_quic.h"
 #include "spindump_analyze_quic_parser.h"
@@ -354,6 +355,7 @@ spindump_analyze_process_quic(struct spindump_analyze* state,
         connection->u.quic.peer1ConnectionID = destinationCid;
         spindump_deepdebugf("changed peer 1 connection id to %s",
                             spindump_connection_quicconnectionid_tostring(&connection->u.quic.peer1ConnectionID,tempid,sizeof(tempid)));
+        spindump_connectionstable_reindexconnection(connection,state->table);
 
       }
 
@@ -371,6 +373,7 @@ spindump_analyze_process_quic(struct spindump_analyze* state,
         connection->u.quic.peer2ConnectionID = sourceCid;
         spindump_deepdebugf("changed peer 2 connection id to %s",
                             spindump_connection_quicconnectionid_tostring(&connection->u.quic.peer2ConnectionID,tempid,sizeof(tempid)));
+        spindump_connectionstable_reindexconnection(connection,state->table);
 
       }
 
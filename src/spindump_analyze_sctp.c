@@ -57,6 +57,10 @@ spindump_analyze_process_sctp_markackreceived_hb(struct spindump_analyze* state,
                                                  int fromResponder,
                                                  const unsigned int ipPacketLength,
                                                  struct timeval* t);
+static void
+spindump_analyze_process_sctp_unknown(struct spindump_analyze* state,
+                                      uint64_t negativeKey,
+                                      unsigned int nUntracked);
 static const char*
 spindump_analyze_sctp_chunk_type_to_string(enum spindump_sctp_chunk_type type);
 
@@ -109,10 +113,10 @@ spindump_analyze_process_sctp_marktsnsent(struct spindump_connection* connection
   spindump_assert(spindump_isbool(fromResponder));
   spindump_assert(t != 0);
   if (fromResponder) {
-    spindump_tsntracker_add(&connection->u.sctp.side2Seqs,t,tsn);
+    spindump_tsntracker_add(&connection->cold->u.sctp.side2Seqs,t,tsn);
     spindump_deepdebugf("responder sent TSN %u", tsn);
   } else {
-    spindump_tsntracker_add(&connection->u.sctp.side1Seqs,t,tsn);
+    spindump_tsntracker_add(&connection->cold->u.sctp.side1Seqs,t,tsn);
     spindump_deepdebugf("initiator sent TSN %u", tsn);
   }
 }
@@ -143,9 +147,9 @@ spindump_analyze_process_sctp_markackreceived_data(struct spindump_analyze* stat
   spindump_assert(t != 0);
 
   if (fromResponder) {
-    ackto = spindump_tsntracker_ackto(&connection->u.sctp.side1Seqs,ackTsn,&sentTsn);
+    ackto = spindump_tsntracker_ackto(&connection->cold->u.sctp.side1Seqs,ackTsn,&sentTsn);
   } else {
-    ackto = spindump_tsntracker_ackto(&connection->u.sctp.side2Seqs,ackTsn,&sentTsn);
+    ackto = spindump_tsntracker_ackto(&connection->cold->u.sctp.side2Seqs,ackTsn,&sentTsn);
   }
 
   spindump_deepdebugf("spindump_analyze_process_sctp_markackreceived_data, fromResponder: %d", fromResponder);
@@ -285,6 +289,24 @@ spindump_analyze_process_sctp_markackreceived_hb(struct spindump_analyze* state,
 
 }
 
+//
+// Count a packet that does not belong to any tracked connection, and
+// add its flow to the negative cache if it was not there yet, so that
+// further packets of the flow are ignored without a search.
+//
+
+static void
+spindump_analyze_process_sctp_unknown(struct spindump_analyze* state,
+                                      uint64_t negativeKey,
+                                      unsigned int nUntracked) {
+  state->stats->unknownSctpConnection++;
+  if (nUntracked > 0) {
+    state->stats->unknownConnectionCached++;
+  } else {
+    spindump_connectionstable_negative_insert(&state->table->negative,negativeKey);
+  }
+}
+
 //
 // This is the main function to process an incoming SCTP packet, parse
 // the packet as much as we can and process it appropriately. The
@@ -350,16 +372,24 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
   spindump_analyze_getdestination(packet,ipVersion,ipHeaderPosition,&destination);
   uint16_t side1port = sctp.sh_sport;
   uint16_t side2port = sctp.sh_dport;
-  int fromResponder;  // to be used in spindump_connections_searchconnection_sctp_either()
+  int fromResponder = 0;  // to be used in spindump_connections_searchconnection_sctp_either()
   int new = 0;
-
-  // search the connection
-  connection = spindump_connections_searchconnection_sctp_either(&source,
-                                                                 &destination,
-                                                                 side1port,
-                                                                 side2port,
-                                                                 state->table,
-                                                                 &fromResponder);
+  uint64_t negativeKey = spindump_connectionstable_negative_addresskey(spindump_connection_transport_sctp,
+                                                                       &source,
+                                                                       side1port,
+                                                                       &destination,
+                                                                       side2port);
+
+  // search the connection, unless the flow is known not to be tracked
+  unsigned int nUntracked = spindump_connectionstable_negative_lookup(&state->table->negative,negativeKey);
+  if (nUntracked == 0) {
+    connection = spindump_connections_searchconnection_sctp_either(&source,
+                                                                   &destination,
+                                                                   side1port,
+                                                                   side2port,
+                                                                   state->table,
+                                                                   &fromResponder);
+  }
 
   //
   // Parse all chunks
@@ -403,7 +433,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -427,7 +457,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -489,7 +519,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -514,7 +544,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -529,7 +559,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         if (connection == 0) {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -554,7 +584,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -575,12 +605,12 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
                                              timestamp,
                                              connection,
                                              spindump_connection_state_closed);
-            spindump_connections_markconnectiondeleted(connection);
+            spindump_connections_markconnectiondeleted(connection,state->table);
           }
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -601,12 +631,12 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
                                              timestamp,
                                              connection,
                                              spindump_connection_state_closed);
-            spindump_connections_markconnectiondeleted(connection);
+            spindump_connections_markconnectiondeleted(connection,state->table);
           }
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -627,12 +657,12 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
                                              timestamp,
                                              connection,
                                              spindump_connection_state_closed);
-            spindump_connections_markconnectiondeleted(connection);
+            spindump_connections_markconnectiondeleted(connection,state->table);
           }
 
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -652,7 +682,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
           
         } else {
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
@@ -676,7 +706,7 @@ spindump_analyze_process_sctp(struct spindump_analyze* state,
         } else {
 
 
-          state->stats->unknownSctpConnection++;
+          spindump_analyze_process_sctp_unknown(state,negativeKey,nUntracked);
           *p_connection = 0;
           return;
 
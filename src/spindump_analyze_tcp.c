@@ -45,10 +45,33 @@ spindump_analyze_process_tcp_markackreceived(struct spindump_analyze* state,
                                              int fromResponder,
                                              const unsigned int ipPacketLength,
                                              tcp_seq seq,
-                                             tcp_seq largest_sacked,
+                                             const struct spindump_tcp_sack* sack,
+                                             unsigned int nSackBlocks,
                                              tcp_ts ts_ecr,
                                              struct timeval* t,
                                              int* finset);
+static void
+spindump_analyze_process_tcp_unknown(struct spindump_analyze* state,
+                                     uint64_t negativeKey,
+                                     unsigned int nUntracked,
+                                     int searchedBoth);
+static struct spindump_connection*
+spindump_analyze_process_tcp_adopt(struct spindump_analyze* state,
+                                   struct spindump_packet* packet,
+                                   const spindump_address* source,
+                                   const spindump_address* destination,
+                                   spindump_port side1port,
+                                   spindump_port side2port,
+                                   unsigned int nUntracked);
+static struct spindump_connection*
+spindump_analyze_process_tcp_promote(struct spindump_analyze* state,
+                                     struct spindump_packet* packet,
+                                     const spindump_address* side1address,
+                                     spindump_port side1port,
+                                     const spindump_address* side2address,
+                                     spindump_port side2port,
+                                     int allowReverse,
+                                     int* fromResponder);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -78,10 +101,10 @@ spindump_analyze_process_tcp_markseqsent(struct spindump_connection* connection,
   spindump_assert(spindump_isbool(finset));
 
   if (fromResponder) {
-    spindump_seqtracker_add(&connection->u.tcp.side2Seqs,t,ts_val,seq,payloadlen,finset);
+    spindump_seqtracker_add(&connection->cold->u.tcp.side2Seqs,t,ts_val,seq,payloadlen,finset);
     spindump_deepdebugf("responder sent SEQ %u..%u (FIN=%u)", seq, seq + payloadlen, finset);
   } else {
-    spindump_seqtracker_add(&connection->u.tcp.side1Seqs,t,ts_val,seq,payloadlen,finset);
+    spindump_seqtracker_add(&connection->cold->u.tcp.side1Seqs,t,ts_val,seq,payloadlen,finset);
     spindump_deepdebugf("initiator sent SEQ %u..%u (FIN=%u)", seq, seq + payloadlen, finset);
   }
 }
@@ -91,8 +114,9 @@ spindump_analyze_process_tcp_markseqsent(struct spindump_connection* connection,
 //
 // If fromResponder = 1, the ACKing party is the server of the
 // connection, if fromResponder = 0, it is the client. Seq is the
-// sequence number from the other party that is being acked. Based on
-// this sequence one one can track RTT.
+// sequence number from the other party that is being acked, and sack
+// holds the nSackBlocks SACK blocks from the same packet, if any.
+// Based on these one can track RTT.
 //
 
 static void
@@ -102,7 +126,8 @@ spindump_analyze_process_tcp_markackreceived(struct spindump_analyze* state,
                                              int fromResponder,
                                              const unsigned int ipPacketLength,
                                              tcp_seq seq,
-                                             tcp_seq largest_sacked,
+                                             const struct spindump_tcp_sack* sack,
+                                             unsigned int nSackBlocks,
                                              tcp_ts ts_ecr,
                                              struct timeval* t,
                                              int* finset) {
@@ -119,7 +144,7 @@ spindump_analyze_process_tcp_markackreceived(struct spindump_analyze* state,
 
   if (fromResponder) {
 
-    ackto = spindump_seqtracker_ackto(&connection->u.tcp.side1Seqs,seq,largest_sacked,ts_ecr,t,&sentSeq,finset);
+    ackto = spindump_seqtracker_ackto(&connection->cold->u.tcp.side1Seqs,seq,sack,nSackBlocks,ts_ecr,t,&sentSeq,finset);
 
     if (ackto != 0) {
 
@@ -148,7 +173,7 @@ spindump_analyze_process_tcp_markackreceived(struct spindump_analyze* state,
 
   } else {
 
-    ackto = spindump_seqtracker_ackto(&connection->u.tcp.side2Seqs,seq,largest_sacked,ts_ecr,t,&sentSeq,finset);
+    ackto = spindump_seqtracker_ackto(&connection->cold->u.tcp.side2Seqs,seq,sack,nSackBlocks,ts_ecr,t,&sentSeq,finset);
 
     if (ackto != 0) {
 
@@ -177,6 +202,148 @@ spindump_analyze_process_tcp_markackreceived(struct spindump_analyze* state,
   }
 }
 
+//
+// Count a packet that does not belong to any tracked connection. If
+// the flow was not in the negative cache yet, and the search covered
+// both directions of the flow, add the flow to the cache so that its
+// further packets are ignored without a search.
+//
+
+static void
+spindump_analyze_process_tcp_unknown(struct spindump_analyze* state,
+                                     uint64_t negativeKey,
+                                     unsigned int nUntracked,
+                                     int searchedBoth) {
+  state->stats->unknownTcpConnection++;
+  if (nUntracked > 0) {
+    state->stats->unknownConnectionCached++;
+  } else if (searchedBoth) {
+    spindump_connectionstable_negative_insert(&state->table->negative,negativeKey);
+  }
+}
+
+//
+// Start tracking a TCP flow whose beginning was not seen, if it has
+// sent enough packets for the adoption policy. The connection is
+// created directly in the established state, with the sender of the
+// current packet as side 1. Returns the new connection, or 0 if the
+// flow is not adopted.
+//
+
+static struct spindump_connection*
+spindump_analyze_process_tcp_adopt(struct spindump_analyze* state,
+                                   struct spindump_packet* packet,
+                                   const spindump_address* source,
+                                   const spindump_address* destination,
+                                   spindump_port side1port,
+                                   spindump_port side2port,
+                                   unsigned int nUntracked) {
+  unsigned int adoptAfter = state->table->negative.adoptAfter;
+  if (adoptAfter == 0) return(0);
+  if ((nUntracked > 0 ? nUntracked : 1) < adoptAfter) return(0);
+  struct spindump_connection* connection =
+    spindump_connections_newconnection_tcp(source,
+                                           destination,
+                                           side1port,
+                                           side2port,
+                                           &packet->timestamp,
+                                           state->table);
+  if (connection == 0) return(0);
+  connection->state = spindump_connection_state_established;
+  state->stats->connections++;
+  state->stats->connectionsTcp++;
+  state->stats->connectionsAdopted++;
+  spindump_debugf("adopted TCP connection %u mid-stream", connection->id);
+  return(connection);
+}
+
+//
+// Turn a half-open connection into a real one, when the flow sends
+// something else than a SYN. The connection is created as if it had
+// been there since the first SYN, and the SYNs are counted for it
+// before the current packet is processed. Returns the new
+// connection, or 0 if the flow had no half-open connection. If
+// allowReverse is set, the packet may come from either side, and
+// fromResponder is set accordingly.
+//
+
+static struct spindump_connection*
+spindump_analyze_process_tcp_promote(struct spindump_analyze* state,
+                                     struct spindump_packet* packet,
+                                     const spindump_address* side1address,
+                                     spindump_port side1port,
+                                     const spindump_address* side2address,
+                                     spindump_port side2port,
+                                     int allowReverse,
+                                     int* fromResponder) {
+  if (state->table->halfOpen.nEntries == 0) return(0);
+  spindump_compactaddress side1compact;
+  spindump_compactaddress side2compact;
+  spindump_compactaddress_fromaddress(side1address,&side1compact);
+  spindump_compactaddress_fromaddress(side2address,&side2compact);
+  struct spindump_connectionstable_halfopenentry entry;
+  int reversed = 0;
+  if (!spindump_connectionstable_halfopen_take(&state->table->halfOpen,
+                                               &side1compact,side1port,
+                                               &side2compact,side2port,
+                                               allowReverse,
+                                               &entry,
+                                               &reversed)) {
+    return(0);
+  }
+  spindump_address initiator;
+  spindump_address responder;
+  spindump_compactaddress_toaddress(&entry.side1address,&initiator);
+  spindump_compactaddress_toaddress(&entry.side2address,&responder);
+  struct spindump_connection* connection =
+    spindump_connections_newconnection_tcp(&initiator,
+                                           &responder,
+                                           entry.side1port,
+                                           entry.side2port,
+                                           &entry.firstSyn,
+                                           state->table);
+  if (connection == 0) return(0);
+  state->stats->connections++;
+  state->stats->connectionsTcp++;
+  state->stats->halfOpenPromoted++;
+  spindump_debugf("promoted half-open TCP connection %u after %u SYNs", connection->id, entry.nSyns);
+
+  //
+  // Count the SYNs, as they would have been counted had the
+  // connection been created for the first one
+  //
+
+  struct spindump_packet synPacket = *packet;
+  for (unsigned int i = 0; i < entry.nSyns; i++) {
+    synPacket.timestamp = (i == 0 ? entry.firstSyn : entry.latestSyn);
+    synPacket.analyzerHandlerCalls = state->stats->analyzerHandlerCalls;
+    spindump_analyze_process_pakstats(state,connection,&synPacket.timestamp,0,&synPacket,entry.length,entry.ecnFlags);
+  }
+  spindump_analyze_process_tcp_markseqsent(connection,
+                                           0,
+                                           entry.isn,
+                                           1,
+                                           entry.tsVal,
+                                           &entry.latestSyn,
+                                           0);
+  spindump_analyze_process_handlers(state,
+                                    spindump_analyze_event_newconnection,
+                                    &entry.firstSyn,
+                                    0,
+                                    entry.length,
+                                    &synPacket,
+                                    connection);
+
+  //
+  // The handlers called so far were for the SYNs, not for the
+  // current packet
+  //
+
+  packet->analyzerHandlerCalls = state->stats->analyzerHandlerCalls;
+  *fromResponder = reversed;
+  return(connection);
+}
+
 //
 // This is the main function to process an incoming TCP packet, parse
 // the packet as much as we can and process it appropriately. The
@@ -241,7 +408,8 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
     *p_connection = 0;
     return;
   }
-  tcp_seq largest_sacked = 0; 
+  struct spindump_tcp_sack sack;
+  unsigned int nSackBlocks = 0;
   tcp_ts ts_val = 0;
   tcp_ts ts_ecr = 0; 
   if (tcpHeaderSize > spindump_tcp_header_length) {
@@ -272,9 +440,8 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
             *p_connection = 0; // should we discard connection or just cease option parsing?
             return;
           }
-          unsigned int n_blocks = (current.length - 2) / 8;
-          spindump_protocols_tcp_sack_decode(packet->contents + tcpHeaderPosition + options_pos + 2, &(current.data.sack), n_blocks);
-          largest_sacked = current.data.sack.blocks[0].right;
+          nSackBlocks = (current.length - 2) / 8;
+          spindump_protocols_tcp_sack_decode(packet->contents + tcpHeaderPosition + options_pos + 2, &sack, nSackBlocks);
         } else if (current.kind == SPINDUMP_TO_TS) {
           if (current.length != SPINDUMP_TSO_LENGTH) {
             state->stats->invalidTcpOptSize++; 
@@ -320,6 +487,12 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
   int finreceived = ((tcp.th_flags & SPINDUMP_TH_FIN) != 0);
   int ackedfin = 0;
   int new = 0;
+  uint64_t negativeKey = spindump_connectionstable_negative_addresskey(spindump_connection_transport_tcp,
+                                                                       &source,
+                                                                       side1port,
+                                                                       &destination,
+                                                                       side2port);
+  unsigned int nUntracked = 0;
 
   //
   // Debugs
@@ -354,6 +527,39 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
                                                            side2port,
                                                            state->table);
 
+    //
+    // If not found, and half-open connections are kept separately,
+    // only record the SYN until the flow answers
+    //
+
+    if (connection == 0 && state->table->halfOpen.maxEntries > 0) {
+      unsigned int nEvicted = 0;
+      spindump_compactaddress side1compact;
+      spindump_compactaddress side2compact;
+      spindump_compactaddress_fromaddress(&source,&side1compact);
+      spindump_compactaddress_fromaddress(&destination,&side2compact);
+      unsigned int nEntries = state->table->halfOpen.nEntries;
+      if (spindump_connectionstable_halfopen_add(&state->table->halfOpen,
+                                                 &side1compact,
+                                                 side1port,
+                                                 &side2compact,
+                                                 side2port,
+                                                 &packet->timestamp,
+                                                 seq,
+                                                 ts_val,
+                                                 ipPacketLength,
+                                                 ecnFlags,
+                                                 &nEvicted)) {
+        if (state->table->halfOpen.nEntries + nEvicted > nEntries) {
+          state->stats->halfOpenConnections++; // not a retransmitted SYN
+        }
+        state->stats->halfOpenEvicted += nEvicted;
+        spindump_connectionstable_negative_remove(&state->table->negative,negativeKey);
+        *p_connection = 0;
+        return;
+      }
+    }
+
     //
     // If not found, create a new one
     //
@@ -399,14 +605,28 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
     spindump_deepdebugf("case 2: SYN ACK (seq = %u, ack = %u)", seq, ack);
 
     //
-    // First, look for existing connection
+    // First, look for existing connection, unless the flow is known
+    // not to be tracked
     //
 
-    connection = spindump_connections_searchconnection_tcp(&destination,
-                                                           &source,
-                                                           side2port,
-                                                           side1port,
-                                                           state->table);
+    nUntracked = spindump_connectionstable_negative_lookup(&state->table->negative,negativeKey);
+    if (nUntracked == 0) {
+      connection = spindump_connections_searchconnection_tcp(&destination,
+                                                             &source,
+                                                             side2port,
+                                                             side1port,
+                                                             state->table);
+      if (connection == 0) {
+        connection = spindump_analyze_process_tcp_promote(state,
+                                                          packet,
+                                                          &destination,
+                                                          side2port,
+                                                          &source,
+                                                          side1port,
+                                                          0,
+                                                          &fromResponder);
+      }
+    }
 
     //
     // If found, change state and mark reception of an ACK. If not
@@ -437,14 +657,20 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
                                                    1,
                                                    ipPacketLength,
                                                    ack,
-                                                   largest_sacked,
+                                                   &sack,
+                                                   nSackBlocks,
                                                    ts_ecr,
                                                    &packet->timestamp,&ackedfin);
       *p_connection = connection;
 
     } else {
 
-      state->stats->unknownTcpConnection++;
+      //
+      // The search only covered the initiator-to-responder order, so
+      // a flow that is not found is not necessarily untracked
+      //
+
+      spindump_analyze_process_tcp_unknown(state,negativeKey,nUntracked,0);
 
     }
 
@@ -458,15 +684,29 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
     spindump_deepdebugf("case 3: FIN (seq = %u, ack = %u)", seq, ack);
 
     //
-    // First, look for existing connection
+    // First, look for existing connection, unless the flow is known
+    // not to be tracked
     //
 
-    connection = spindump_connections_searchconnection_tcp_either(&source,
-                                                                  &destination,
-                                                                  side1port,
-                                                                  side2port,
-                                                                  state->table,
-                                                                  &fromResponder);
+    nUntracked = spindump_connectionstable_negative_lookup(&state->table->negative,negativeKey);
+    if (nUntracked == 0) {
+      connection = spindump_connections_searchconnection_tcp_either(&source,
+                                                                    &destination,
+                                                                    side1port,
+                                                                    side2port,
+                                                                    state->table,
+                                                                    &fromResponder);
+      if (connection == 0) {
+        connection = spindump_analyze_process_tcp_promote(state,
+                                                          packet,
+                                                          &source,
+                                                          side1port,
+                                                          &destination,
+                                                          side2port,
+                                                          1,
+                                                          &fromResponder);
+      }
+    }
 
     //
     // If found, change state and mark reception of an ACK. If not
@@ -500,7 +740,8 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
                                                    fromResponder,
                                                    ipPacketLength,
                                                    ack,
-                                                   largest_sacked,
+                                                   &sack,
+                                                   nSackBlocks,
                                                    ts_ecr,
                                                    &packet->timestamp,&ackedfin);
       if (ackedfin) {
@@ -522,7 +763,7 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
       if (connection->u.tcp.finFromSide1 && connection->u.tcp.finFromSide2) {
         if (connection->state == spindump_connection_state_closing) {
           spindump_connections_changestate(state,packet,timestamp,connection,spindump_connection_state_closed);
-          spindump_connections_markconnectiondeleted(connection);
+          spindump_connections_markconnectiondeleted(connection,state->table);
         }
       }
       
@@ -530,7 +771,7 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
       
     } else {
       
-      state->stats->unknownTcpConnection++;
+      spindump_analyze_process_tcp_unknown(state,negativeKey,nUntracked,1);
       
     }
 
@@ -543,15 +784,29 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
     spindump_deepdebugf("case 5: RST (seq = %u, ack = %u)", seq, ack);
 
     //
-    // First, look for existing connection
+    // First, look for existing connection, unless the flow is known
+    // not to be tracked
     //
 
-    connection = spindump_connections_searchconnection_tcp_either(&source,
-                                                                  &destination,
-                                                                  side1port,
-                                                                  side2port,
-                                                                  state->table,
-                                                                  &fromResponder);
+    nUntracked = spindump_connectionstable_negative_lookup(&state->table->negative,negativeKey);
+    if (nUntracked == 0) {
+      connection = spindump_connections_searchconnection_tcp_either(&source,
+                                                                    &destination,
+                                                                    side1port,
+                                                                    side2port,
+                                                                    state->table,
+                                                                    &fromResponder);
+      if (connection == 0) {
+        connection = spindump_analyze_process_tcp_promote(state,
+                                                          packet,
+                                                          &source,
+                                                          side1port,
+                                                          &destination,
+                                                          side2port,
+                                                          1,
+                                                          &fromResponder);
+      }
+    }
 
     //
     // If found, delete connection and mark reception of an ACK. If not
@@ -567,18 +822,19 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
                                                    fromResponder,
                                                    ipPacketLength,
                                                    ack,
-                                                   largest_sacked,
+                                                   &sack,
+                                                   nSackBlocks,
                                                    ts_ecr,
                                                    &packet->timestamp,
                                                    &ackedfin);
       spindump_connections_changestate(state,packet,timestamp,connection,spindump_connection_state_closed);
-      spindump_connections_markconnectiondeleted(connection);
+      spindump_connections_markconnectiondeleted(connection,state->table);
 
       *p_connection = connection;
 
     } else {
 
-      state->stats->unknownTcpConnection++;
+      spindump_analyze_process_tcp_unknown(state,negativeKey,nUntracked,1);
 
     }
 
@@ -591,15 +847,45 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
     spindump_deepdebugf("case 6: OTHER (seq = %u, ack = %u)", seq, ack);
 
     //
-    // First, look for existing connection
+    // First, look for existing connection, unless the flow is known
+    // not to be tracked
     //
 
-    connection = spindump_connections_searchconnection_tcp_either(&source,
-                                                                  &destination,
-                                                                  side1port,
-                                                                  side2port,
-                                                                  state->table,
-                                                                  &fromResponder);
+    nUntracked = spindump_connectionstable_negative_lookup(&state->table->negative,negativeKey);
+    if (nUntracked == 0) {
+      connection = spindump_connections_searchconnection_tcp_either(&source,
+                                                                    &destination,
+                                                                    side1port,
+                                                                    side2port,
+                                                                    state->table,
+                                                                    &fromResponder);
+      if (connection == 0) {
+        connection = spindump_analyze_process_tcp_promote(state,
+                                                          packet,
+                                                          &source,
+                                                          side1port,
+                                                          &destination,
+                                                          side2port,
+                                                          1,
+                                                          &fromResponder);
+      }
+    }
+    
+    //
+    // If not found, start tracking the flow if it has been seen
+    // for long enough
+    //
+
+    if (connection == 0) {
+      connection = spindump_analyze_process_tcp_adopt(state,
+                                                      packet,
+                                                      &source,
+                                                      &destination,
+                                                      side1port,
+                                                      side2port,
+                                                      nUntracked);
+      if (connection != 0) new = 1;
+    }
     
     //
     // If found, mark reception of an ACK and sent SEQ. If not
@@ -621,7 +907,8 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
                                                    fromResponder,
                                                    ipPacketLength,
                                                    ack,
-                                                   largest_sacked,
+                                                   &sack,
+                                                   nSackBlocks,
                                                    ts_ecr,
                                                    &packet->timestamp,
                                                    &ackedfin);
@@ -644,7 +931,7 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
         if (connection->u.tcp.finFromSide1 && connection->u.tcp.finFromSide2) {
           if (connection->state == spindump_connection_state_closing) {
             spindump_connections_changestate(state,packet,timestamp,connection,spindump_connection_state_closed);
-            spindump_connections_markconnectiondeleted(connection);
+            spindump_connections_markconnectiondeleted(connection,state->table);
           }
         }
       }
@@ -658,7 +945,7 @@ spindump_analyze_process_tcp(struct spindump_analyze* state,
       
     } else {
 
-      state->stats->unknownTcpConnection++;
+      spindump_analyze_process_tcp_unknown(state,negativeKey,nUntracked,1);
       *p_connection = 0;
       return;
 
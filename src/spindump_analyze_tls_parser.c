@@ -65,12 +65,12 @@ spindump_analyze_tls_parser_parse_tlshandshakepacket_finalperhtype_tls(struct sp
 // "1.3".  The returned string need not be freed, but it will not
 // surive the next call to this function.
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_analyze_tls_parser_versiontostring(const spindump_tls_version version) {
-  static char buf[20];
+  static _Thread_local char buf[20];
   memset(buf,0,sizeof(buf));
   
   if (version == 0) {
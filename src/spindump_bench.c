@@ -0,0 +1,1505 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_connections_set.h"
+#include "spindump_table.h"
+#include "spindump_analyze.h"
+#include "spindump_rtt.h"
+#include "spindump_seq.h"
+#include "spindump_event.h"
+#include "spindump_event_parser_json.h"
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_bench_scan_defaultconnections 1000000
+#define spindump_bench_scan_rounds                   5
+#define spindump_bench_timers_seconds               10
+#define spindump_bench_slots_churn               10000
+#define spindump_bench_sets_members             100000
+#define spindump_bench_sets_removals             10000
+#define spindump_bench_rollup_members               64
+#define spindump_bench_rollup_packets         10000000
+#define spindump_bench_negative_connections     100000
+#define spindump_bench_negative_flows             4096
+#define spindump_bench_negative_packets       10000000
+#define spindump_bench_halfopen_syns            200000
+#define spindump_bench_prefixes_default         100000
+#define spindump_bench_prefixes_lookups        1000000
+#define spindump_bench_prefixes_scanlookups        200
+#define spindump_bench_prefixes_linelength         256
+#define spindump_bench_rtt_samples            10000000
+#define spindump_bench_rtt_filterpercentage        200
+#define spindump_bench_seq_segments            2000000
+#define spindump_bench_seq_segmentsize            1448
+#define spindump_bench_json_events               200000
+#define spindump_bench_json_rounds                    3
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static double
+spindump_bench_time(void);
+static struct spindump_connectionstable*
+spindump_bench_scan_maketable(unsigned int nConnections,
+                              size_t stride,
+                              unsigned int spread,
+                              unsigned char** p_buffer);
+static unsigned int
+spindump_bench_scan_once(struct spindump_connectionstable* table,
+                         const struct timeval* now);
+static double
+spindump_bench_scan_run(struct spindump_connectionstable* table);
+static void
+spindump_bench_scan(unsigned int nConnections);
+static void
+spindump_bench_timers(unsigned int nConnections);
+static uint32_t
+spindump_bench_random(uint32_t* seed);
+static void
+spindump_bench_slots(unsigned int nConnections);
+static void
+spindump_bench_sets(void);
+static void
+spindump_bench_rollup(void);
+static void
+spindump_bench_negative_address(unsigned int index,
+                                unsigned int net,
+                                spindump_address* address);
+static void
+spindump_bench_negative(void);
+static void
+spindump_bench_halfopen(void);
+static spindump_compactnetwork*
+spindump_bench_prefixes_make(unsigned int nPrefixes,
+                             uint32_t* seed);
+static spindump_compactnetwork*
+spindump_bench_prefixes_read(const char* file,
+                             unsigned int* p_nPrefixes);
+static int
+spindump_bench_prefixes_compare(const void* a,
+                                const void* b);
+static const spindump_compactnetwork*
+spindump_bench_prefixes_bsearch(const spindump_compactaddress* address,
+                                const spindump_compactnetwork* networks,
+                                unsigned int nNetworks);
+static void
+spindump_bench_prefixes(unsigned int nPrefixes,
+                        const char* file);
+static unsigned long
+spindump_bench_rtt_recompute(struct spindump_rtt* rtt,
+                             int filter,
+                             unsigned long* standardDeviation,
+                             unsigned long* filteredAvg);
+static double
+spindump_bench_rtt_run(const unsigned long long* samples,
+                       int recompute,
+                       int filter,
+                       unsigned long long* p_check);
+static void
+spindump_bench_rtt(void);
+static double
+spindump_bench_seq_run(unsigned int inFlight,
+                       unsigned int* p_samples);
+static void
+spindump_bench_seq(void);
+static char*
+spindump_bench_json_make(unsigned int nEvents,
+                         size_t* p_length);
+static void
+spindump_bench_json_callback(const struct spindump_event* event,
+                             void* data);
+static double
+spindump_bench_json_run(const char* text,
+                        int stream,
+                        unsigned long long* p_check);
+static void
+spindump_bench_json(void);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Return the current time in seconds, from a monotonic clock
+//
+
+static double
+spindump_bench_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+//
+// Create a table with a given number of established UDP
+// connections. If stride is 0, the connection objects come from the
+// table's pool as usual. Otherwise they are laid out in one buffer,
+// stride bytes apart, to emulate connection objects that hold their
+// cold state inline. Such a table must not be uninitialized with its
+// connections in it.
+//
+// The latest packets of the connections are spread evenly over the
+// given number of seconds before the time 1000, and the connections
+// are put in the table's timer wheel.
+//
+// The connections are filled in directly rather than through
+// spindump_connections_newconnection, as only the periodic work is
+// being measured here.
+//
+
+static struct spindump_connectionstable*
+spindump_bench_scan_maketable(unsigned int nConnections,
+                              size_t stride,
+                              unsigned int spread,
+                              unsigned char** p_buffer) {
+
+  struct spindump_connectionstable* table = spindump_connectionstable_initialize(1000000,0,0);
+  if (table == 0) exit(1);
+  *p_buffer = stride > 0 ? (unsigned char*)spindump_malloc(nConnections * stride) : 0;
+  if ((nConnections > table->maxNConnections && !spindump_connectionstable_grow(table,nConnections)) ||
+      (stride > 0 && *p_buffer == 0)) {
+    spindump_errorf("cannot allocate memory for %u connections", nConnections);
+    exit(1);
+  }
+
+  unsigned int size = spindump_connectionstable_pool_objectsize(spindump_connection_transport_udp);
+  for (unsigned int i = 0; i < nConnections; i++) {
+    struct spindump_connection* connection =
+      stride > 0 ?
+      (struct spindump_connection*)(*p_buffer + i * stride) :
+      spindump_connectionstable_pool_allocate(&table->pool,spindump_connection_transport_udp);
+    if (connection == 0) exit(1);
+    memset(connection,0,size);
+    struct timeval when;
+    when.tv_sec = 1000 - (spread > 0 ? (time_t)(i % spread) : 0);
+    when.tv_usec = 0;
+    connection->id = i;
+    connection->type = spindump_connection_transport_udp;
+    connection->state = spindump_connection_state_established;
+    connection->tableIndex = i;
+    connection->creationTime = when;
+    connection->latestPacketFromSide1 = when;
+    connection->latestPacketFromSide2 = when;
+    table->connections[i] = connection;
+    spindump_connectionstable_scheduleconnection(connection,table);
+  }
+  table->nConnections = nConnections;
+  return(table);
+}
+
+//
+// Go through the whole table and check each connection for timeouts,
+// the way the periodic check did before the timer wheel. Returns the
+// number of connections that would time out.
+//
+
+static unsigned int
+spindump_bench_scan_once(struct spindump_connectionstable* table,
+                         const struct timeval* now) {
+  unsigned int nExpired = 0;
+  for (unsigned int i = 0; i < table->nConnections; i++) {
+    struct spindump_connection* connection = table->connections[i];
+    if (connection == 0 || connection->manuallyCreated) continue;
+    unsigned long long lastAction = spindump_connections_lastaction(connection,now);
+    if ((connection->deleted &&
+         lastAction >= (unsigned long long)(spindump_connection_deleted_timeout)) ||
+        (spindump_connections_isestablishing(connection) &&
+         lastAction >= (unsigned long long)(spindump_connection_establishing_timeout)) ||
+        (lastAction >= (unsigned long long)(spindump_connection_inactive_timeout) &&
+         !connection->remote)) {
+      nExpired++;
+    }
+  }
+  return(nExpired);
+}
+
+//
+// Run the full timeout scan over a table a few times, and return the
+// fastest run in seconds. The clock only moves a few seconds forward,
+// so no connection times out during the runs.
+//
+
+static double
+spindump_bench_scan_run(struct spindump_connectionstable* table) {
+  double best = 0.0;
+  struct timeval now;
+  now.tv_sec = 1000;
+  now.tv_usec = 0;
+  for (unsigned int round = 0; round < spindump_bench_scan_rounds; round++) {
+    now.tv_sec++;
+    double start = spindump_bench_time();
+    if (spindump_bench_scan_once(table,&now) != 0) exit(1);
+    double elapsed = spindump_bench_time() - start;
+    if (round == 0 || elapsed < best) best = elapsed;
+  }
+  return(best);
+}
+
+//
+// Measure the full timeout scan of the connections table, with the
+// connection objects split into hot and cold parts, and with the cold
+// state emulated inline in each object, as it was before the split.
+//
+
+static void
+spindump_bench_scan(unsigned int nConnections) {
+
+  unsigned char* buffer;
+
+  //
+  // Split connections, from the pool
+  //
+
+  struct spindump_connectionstable* table = spindump_bench_scan_maketable(nConnections,0,0,&buffer);
+  double split = spindump_bench_scan_run(table);
+  spindump_connectionstable_uninitialize(table);
+
+  //
+  // Connections with their cold state inline
+  //
+
+  size_t stride =
+    spindump_connectionstable_pool_objectsize(spindump_connection_transport_udp) +
+    spindump_connectionstable_pool_coldobjectsize(spindump_connection_transport_udp);
+  table = spindump_bench_scan_maketable(nConnections,stride,0,&buffer);
+  double inlined = spindump_bench_scan_run(table);
+  table->nConnections = 0;
+  spindump_connectionstable_uninitialize(table);
+  spindump_free(buffer);
+
+  //
+  // Report
+  //
+
+  char label[100];
+  printf("timeout scan of %u connections:\n", nConnections);
+  snprintf(label,sizeof(label),"hot records, %u bytes each:",
+           spindump_connectionstable_pool_objectsize(spindump_connection_transport_udp));
+  printf("  %-40s %8.2f ms %8.1f ns/connection\n", label, split * 1000.0, split * 1000000000.0 / nConnections);
+  snprintf(label,sizeof(label),"cold state inline, %zu bytes each:", stride);
+  printf("  %-40s %8.2f ms %8.1f ns/connection\n", label, inlined * 1000.0, inlined * 1000000000.0 / nConnections);
+  printf("  %-40s %8.2fx\n", "speedup:", inlined / split);
+}
+
+//
+// Measure the periodic check with the timer wheel, with connections
+// whose latest packets are spread over the inactivity timeout, so that
+// an equal share of them times out every second. This is compared to
+// a full scan of the same table.
+//
+
+static void
+spindump_bench_timers(unsigned int nConnections) {
+
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  if (analyzer == 0) exit(1);
+  unsigned char* buffer;
+  unsigned int spread = spindump_connection_inactive_timeout / (1000 * 1000);
+  struct spindump_connectionstable* table = spindump_bench_scan_maketable(nConnections,0,spread,&buffer);
+
+  //
+  // Move the wheel to the current time first, then measure a number
+  // of seconds with both the full scan and the timer wheel
+  //
+
+  struct timeval now;
+  now.tv_sec = 1000;
+  now.tv_usec = 0;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  double scan = 0.0;
+  double wheel = 0.0;
+  unsigned int before = table->pool.classes[spindump_connection_transport_udp].nInUse;
+  for (unsigned int second = 0; second < spindump_bench_timers_seconds; second++) {
+    now.tv_sec++;
+    double start = spindump_bench_time();
+    (void)spindump_bench_scan_once(table,&now);
+    double middle = spindump_bench_time();
+    spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+    double end = spindump_bench_time();
+    scan += middle - start;
+    wheel += end - middle;
+  }
+  unsigned int expired = before - table->pool.classes[spindump_connection_transport_udp].nInUse;
+  spindump_connectionstable_uninitialize(table);
+  spindump_analyze_uninitialize(analyzer);
+
+  //
+  // Report
+  //
+
+  printf("periodic check of %u connections, %u timing out per second:\n",
+         nConnections, expired / spindump_bench_timers_seconds);
+  printf("  %-40s %8.2f ms/second\n", "full scan:", scan * 1000.0 / spindump_bench_timers_seconds);
+  printf("  %-40s %8.2f ms/second\n", "timer wheel:", wheel * 1000.0 / spindump_bench_timers_seconds);
+  printf("  %-40s %8.2fx\n", "speedup:", scan / wheel);
+}
+
+//
+// A simple deterministic pseudo-random number generator, so that the
+// benchmarks see the same prefixes and addresses on every run
+//
+
+static uint32_t
+spindump_bench_random(uint32_t* seed) {
+  *seed = *seed * 1664525U + 1013904223U;
+  return(*seed ^ (*seed >> 16));
+}
+
+//
+// Measure finding a position for a new connection in a full table of
+// connections, when one connection at a random position is deleted
+// and another one is created. The lowest free position is found by
+// scanning the table from the start, the way new connections used to
+// be placed, and from the free position bitmaps.
+//
+
+static void
+spindump_bench_slots(unsigned int nConnections) {
+
+  struct spindump_connection dummy;
+  struct spindump_connection** connections =
+    (struct spindump_connection**)spindump_malloc(nConnections * sizeof(struct spindump_connection*));
+  struct spindump_connectionstable_slots slots;
+  if (connections == 0 || !spindump_connectionstable_slots_initialize(&slots,nConnections)) {
+    spindump_errorf("cannot allocate memory for %u connections", nConnections);
+    exit(1);
+  }
+  for (unsigned int i = 0; i < nConnections; i++) connections[i] = &dummy;
+
+  double results[2];
+  unsigned long long checks[2];
+  for (int bitmap = 0; bitmap <= 1; bitmap++) {
+    uint32_t seed = 1;
+    checks[bitmap] = 0;
+    double start = spindump_bench_time();
+    for (unsigned int round = 0; round < spindump_bench_slots_churn; round++) {
+      unsigned int deleted = spindump_bench_random(&seed) % nConnections;
+      connections[deleted] = 0;
+      unsigned int position;
+      if (bitmap) {
+        spindump_connectionstable_slots_release(&slots,deleted);
+        position = spindump_connectionstable_slots_lowest(&slots);
+        spindump_connectionstable_slots_take(&slots,position);
+      } else {
+        for (position = 0; connections[position] != 0; position++);
+      }
+      connections[position] = &dummy;
+      checks[bitmap] += position;
+    }
+    results[bitmap] = spindump_bench_time() - start;
+  }
+  spindump_connectionstable_slots_uninitialize(&slots);
+  spindump_free(connections);
+  if (checks[0] != checks[1]) {
+    spindump_errorf("the free position searches disagree");
+    exit(1);
+  }
+
+  //
+  // Report
+  //
+
+  printf("new connection placement in a table of %u connections:\n", nConnections);
+  printf("  %-40s %8.1f ns/connection\n", "table scan:", results[0] * 1000000000.0 / spindump_bench_slots_churn);
+  printf("  %-40s %8.1f ns/connection\n", "free position bitmap:", results[1] * 1000000000.0 / spindump_bench_slots_churn);
+  printf("  %-40s %8.2fx\n", "speedup:", results[0] / results[1]);
+}
+
+//
+// Measure removing connections from a large aggregate, in random
+// order, the way connections of a busy network aggregate are
+// deleted. Removal is done from an array of the members by searching
+// and shifting, the way connection sets used to work, and by
+// removing the memberships from the connection sets.
+//
+
+static void
+spindump_bench_sets(void) {
+
+  unsigned int size = spindump_connectionstable_pool_objectsize(spindump_connection_transport_udp);
+  unsigned char* buffer = (unsigned char*)spindump_malloc(spindump_bench_sets_members * size);
+  struct spindump_connection** order =
+    (struct spindump_connection**)spindump_malloc(spindump_bench_sets_members * sizeof(struct spindump_connection*));
+  struct spindump_connection** array =
+    (struct spindump_connection**)spindump_malloc(spindump_bench_sets_members * sizeof(struct spindump_connection*));
+  struct spindump_connection* aggregate = (struct spindump_connection*)spindump_malloc(sizeof(struct spindump_connection));
+  if (buffer == 0 || order == 0 || array == 0 || aggregate == 0) {
+    spindump_errorf("cannot allocate memory for %u members", spindump_bench_sets_members);
+    exit(1);
+  }
+  memset(buffer,0,spindump_bench_sets_members * size);
+  memset(aggregate,0,sizeof(*aggregate));
+  aggregate->type = spindump_connection_aggregate_networknetwork;
+  struct spindump_connection_set* members = &aggregate->u.aggregatenetworknetwork.connections;
+
+  double results[2];
+  unsigned int remaining[2];
+  for (int linked = 0; linked <= 1; linked++) {
+
+    //
+    // Set up the members, in the array or in the sets
+    //
+
+    unsigned int nArray = 0;
+    spindump_connections_set_initialize(members);
+    for (unsigned int i = 0; i < spindump_bench_sets_members; i++) {
+      struct spindump_connection* connection = (struct spindump_connection*)(buffer + i * size);
+      connection->id = i;
+      spindump_connections_set_initialize(&connection->aggregates);
+      if (linked) spindump_connections_set_add(members,connection,&connection->aggregates,aggregate);
+      else array[nArray++] = connection;
+      order[i] = connection;
+    }
+
+    //
+    // Remove random members
+    //
+
+    uint32_t seed = 1;
+    unsigned int nOrder = spindump_bench_sets_members;
+    double start = spindump_bench_time();
+    for (unsigned int round = 0; round < spindump_bench_sets_removals; round++) {
+      unsigned int j = spindump_bench_random(&seed) % nOrder;
+      struct spindump_connection* connection = order[j];
+      order[j] = order[--nOrder];
+      if (linked) {
+        spindump_connections_set_uninitialize(&connection->aggregates,connection);
+      } else {
+        unsigned int i = 0;
+        while (array[i] != connection) i++;
+        for (; i + 1 < nArray; i++) array[i] = array[i+1];
+        nArray--;
+      }
+    }
+    results[linked] = spindump_bench_time() - start;
+    remaining[linked] = linked ? members->nConnections : nArray;
+    spindump_connections_set_uninitialize(members,aggregate);
+  }
+  spindump_free(aggregate);
+  spindump_free(array);
+  spindump_free(order);
+  spindump_free(buffer);
+  if (remaining[0] != remaining[1]) {
+    spindump_errorf("the member removals disagree");
+    exit(1);
+  }
+
+  //
+  // Report
+  //
+
+  printf("member removal from an aggregate of %u connections:\n", spindump_bench_sets_members);
+  printf("  %-40s %8.1f ns/connection\n", "array search:", results[0] * 1000000000.0 / spindump_bench_sets_removals);
+  printf("  %-40s %8.1f ns/connection\n", "linked memberships:", results[1] * 1000000000.0 / spindump_bench_sets_removals);
+  printf("  %-40s %8.2fx\n", "speedup:", results[0] / results[1]);
+}
+
+//
+// Benchmark the updates of overlapping aggregates, when the packets
+// of their members are counted in the aggregates right away, and when
+// the updates are deferred. The packets alternate between the
+// members and their sides, ten microseconds apart, and the periodic
+// check is run as in the main loop. The aggregates must end up with
+// the same numbers either way.
+//
+
+static void
+spindump_bench_rollup(void) {
+
+  double results[2];
+  spindump_counter_64bit checks[2][4];
+  for (int deferred = 0; deferred <= 1; deferred++) {
+
+    //
+    // Set up the aggregates and members
+    //
+
+    struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+    if (analyzer == 0) exit(1);
+    struct spindump_connectionstable* table = analyzer->table;
+    table->rollup.deferred = deferred;
+    struct timeval when;
+    when.tv_sec = 1000;
+    when.tv_usec = 0;
+    spindump_address host1;
+    spindump_address host2;
+    spindump_network networks[4];
+    spindump_address_fromstring(&host1,"10.1.1.1");
+    spindump_address_fromstring(&host2,"192.168.1.5");
+    spindump_network_fromstring(&networks[0],"10.0.0.0/8");
+    spindump_network_fromstring(&networks[1],"10.1.0.0/16");
+    spindump_network_fromstring(&networks[2],"192.168.0.0/16");
+    spindump_network_fromstring(&networks[3],"192.168.1.0/24");
+    struct spindump_connection* aggregates[4];
+    aggregates[0] = spindump_connections_newconnection_aggregate_networknetwork(0,&networks[0],&networks[2],&when,1,table);
+    aggregates[1] = spindump_connections_newconnection_aggregate_networknetwork(0,&networks[1],&networks[2],&when,1,table);
+    aggregates[2] = spindump_connections_newconnection_aggregate_networknetwork(0,&networks[1],&networks[3],&when,1,table);
+    aggregates[3] = spindump_connections_newconnection_aggregate_hostnetwork(&host1,&networks[3],&when,1,table);
+    struct spindump_connection* members[spindump_bench_rollup_members];
+    for (unsigned int i = 0; i < spindump_bench_rollup_members; i++) {
+      members[i] = spindump_connections_newconnection_udp(&host1,&host2,(spindump_port)(5000 + i),53,&when,table);
+      if (members[i] == 0 || members[i]->aggregates.nConnections != 4) {
+        spindump_errorf("cannot set up the aggregate members");
+        exit(1);
+      }
+    }
+
+    //
+    // Count the packets
+    //
+
+    struct spindump_packet packet;
+    memset(&packet,0,sizeof(packet));
+    packet.timestamp = when;
+    double start = spindump_bench_time();
+    for (unsigned int i = 0; i < spindump_bench_rollup_packets; i++) {
+      packet.timestamp.tv_usec += 10;
+      if (packet.timestamp.tv_usec >= 1000 * 1000) {
+        packet.timestamp.tv_sec++;
+        packet.timestamp.tv_usec -= 1000 * 1000;
+      }
+      spindump_connectionstable_periodiccheck(table,&packet.timestamp,analyzer,0);
+      spindump_analyze_process_pakstats(analyzer,
+                                        members[i % spindump_bench_rollup_members],
+                                        &packet.timestamp,
+                                        (i / spindump_bench_rollup_members) % 2,
+                                        &packet,
+                                        100 + i % 1000,
+                                        (uint8_t)(i % 3));
+    }
+    spindump_connectionstable_rollup_fold(table,analyzer);
+    results[deferred] = spindump_bench_time() - start;
+    checks[deferred][0] = aggregates[0]->packetsFromSide2;
+    checks[deferred][1] = aggregates[1]->bytesFromSide1.bytesInLastPeriod;
+    checks[deferred][2] = aggregates[2]->bytesFromSide2.bytesInThisPeriod;
+    checks[deferred][3] = aggregates[3]->ect1FromInitiator + aggregates[3]->bytesFromSide1.periods;
+    spindump_analyze_uninitialize(analyzer);
+  }
+  if (memcmp(checks[0],checks[1],sizeof(checks[0])) != 0) {
+    spindump_errorf("the deferred aggregate updates disagree");
+    exit(1);
+  }
+
+  //
+  // Report
+  //
+
+  printf("packets of %u members of 4 overlapping aggregates:\n", spindump_bench_rollup_members);
+  printf("  %-40s %8.1f ns/packet\n", "aggregates updated per packet:", results[0] * 1000000000.0 / spindump_bench_rollup_packets);
+  printf("  %-40s %8.1f ns/packet\n", "deferred updates:", results[1] * 1000000000.0 / spindump_bench_rollup_packets);
+  printf("  %-40s %8.2fx\n", "speedup:", results[0] / results[1]);
+}
+
+//
+// Make the address of a host, given its index and its network
+//
+
+static void
+spindump_bench_negative_address(unsigned int index,
+                                unsigned int net,
+                                spindump_address* address) {
+  char buf[30];
+  snprintf(buf,sizeof(buf),"%u.%u.%u.%u",net,(index >> 16) & 0xFF,(index >> 8) & 0xFF,index & 0xFF);
+  spindump_address_fromstring(address,buf);
+}
+
+//
+// Measure the handling of packets of TCP flows that are not tracked,
+// in a table of tracked connections: searching the table for each
+// packet, and finding the flow from the negative cache. The cost of
+// checking the cache for the packets of tracked connections is also
+// measured.
+//
+
+static void
+spindump_bench_negative(void) {
+
+  //
+  // Set up the tracked connections
+  //
+
+  struct spindump_connectionstable* table = spindump_connectionstable_initialize(1000000,0,0);
+  if (table == 0) exit(1);
+  struct timeval when;
+  when.tv_sec = 1000;
+  when.tv_usec = 0;
+  spindump_address server;
+  spindump_address_fromstring(&server,"192.0.2.1");
+  for (unsigned int i = 0; i < spindump_bench_negative_connections; i++) {
+    spindump_address client;
+    spindump_bench_negative_address(i,10,&client);
+    if (spindump_connections_newconnection_tcp(&client,&server,(spindump_port)(1024 + i % 1000),443,&when,table) == 0) {
+      spindump_errorf("cannot set up the tracked connections");
+      exit(1);
+    }
+  }
+
+  //
+  // Set up the untracked flows
+  //
+
+  spindump_address* clients =
+    (spindump_address*)spindump_malloc(spindump_bench_negative_flows * sizeof(spindump_address));
+  if (clients == 0) exit(1);
+  for (unsigned int i = 0; i < spindump_bench_negative_flows; i++) {
+    spindump_bench_negative_address(i * 7919,172,&clients[i]);
+    uint64_t key = spindump_connectionstable_negative_addresskey(spindump_connection_transport_tcp,
+                                                                 &clients[i],
+                                                                 (spindump_port)(2048 + i),
+                                                                 &server,
+                                                                 443);
+    spindump_connectionstable_negative_insert(&table->negative,key);
+  }
+
+  //
+  // Count the packets
+  //
+
+  double results[3];
+  unsigned int checks[3];
+  memset(checks,0,sizeof(checks));
+  for (int mode = 0; mode < 3; mode++) {
+    double start = spindump_bench_time();
+    for (unsigned int i = 0; i < spindump_bench_negative_packets; i++) {
+      unsigned int flow = (i * 2654435761U) % spindump_bench_negative_flows;
+      spindump_port port = (spindump_port)(2048 + flow);
+      if (mode == 0) {
+        int fromResponder;
+        struct spindump_connection* connection =
+          spindump_connections_searchconnection_tcp_either(&clients[flow],&server,port,443,table,&fromResponder);
+        if (connection == 0) checks[mode]++;
+      } else {
+        uint64_t key = spindump_connectionstable_negative_addresskey(spindump_connection_transport_tcp,
+                                                                     &clients[flow],
+                                                                     mode == 1 ? port : (spindump_port)(port + 1),
+                                                                     &server,
+                                                                     443);
+        if ((spindump_connectionstable_negative_lookup(&table->negative,key) > 0) == (mode == 1)) checks[mode]++;
+      }
+    }
+    results[mode] = spindump_bench_time() - start;
+  }
+  spindump_free(clients);
+  spindump_connectionstable_uninitialize(table);
+  if (checks[0] != spindump_bench_negative_packets ||
+      checks[1] != spindump_bench_negative_packets ||
+      checks[2] != spindump_bench_negative_packets) {
+    spindump_errorf("the negative cache lookups disagree");
+    exit(1);
+  }
+
+  //
+  // Report
+  //
+
+  printf("packets of %u untracked flows, with %u tracked connections:\n",
+         spindump_bench_negative_flows, spindump_bench_negative_connections);
+  printf("  %-40s %8.1f ns/packet\n", "table search:", results[0] * 1000000000.0 / spindump_bench_negative_packets);
+  printf("  %-40s %8.1f ns/packet\n", "negative cache:", results[1] * 1000000000.0 / spindump_bench_negative_packets);
+  printf("  %-40s %8.2fx\n", "speedup:", results[0] / results[1]);
+  printf("  %-40s %8.1f ns/packet\n", "cache check for other flows:", results[2] * 1000000000.0 / spindump_bench_negative_packets);
+}
+
+//
+// Measure a flood of SYNs from spoofed sources: creating a
+// connection for each SYN, and recording them as half-open
+// connections instead. The state kept for each SYN is also reported.
+//
+
+static void
+spindump_bench_halfopen(void) {
+
+  //
+  // Set up the sources
+  //
+
+  spindump_address server;
+  spindump_address_fromstring(&server,"192.0.2.1");
+  spindump_compactaddress compactServer;
+  spindump_compactaddress_fromaddress(&server,&compactServer);
+  spindump_address* clients =
+    (spindump_address*)spindump_malloc(spindump_bench_halfopen_syns * sizeof(spindump_address));
+  if (clients == 0) exit(1);
+  for (unsigned int i = 0; i < spindump_bench_halfopen_syns; i++) {
+    spindump_bench_negative_address(i,10,&clients[i]);
+  }
+  struct timeval when;
+  when.tv_sec = 1000;
+  when.tv_usec = 0;
+
+  //
+  // Send the SYNs
+  //
+
+  double results[2];
+  for (int mode = 0; mode < 2; mode++) {
+    struct spindump_connectionstable* table = spindump_connectionstable_initialize(1000000,0,0);
+    if (table == 0) exit(1);
+    table->halfOpen.maxEntries = spindump_bench_halfopen_syns;
+    double start = spindump_bench_time();
+    for (unsigned int i = 0; i < spindump_bench_halfopen_syns; i++) {
+      spindump_port port = (spindump_port)(1024 + i % 60000);
+      if (mode == 0) {
+        if (spindump_connections_searchconnection_tcp(&clients[i],&server,port,80,table) == 0 &&
+            spindump_connections_newconnection_tcp(&clients[i],&server,port,80,&when,table) == 0) {
+          spindump_errorf("cannot create a connection for a SYN");
+          exit(1);
+        }
+      } else {
+        spindump_compactaddress client;
+        unsigned int nEvicted;
+        spindump_compactaddress_fromaddress(&clients[i],&client);
+        if (spindump_connections_searchconnection_tcp(&clients[i],&server,port,80,table) == 0 &&
+            !spindump_connectionstable_halfopen_add(&table->halfOpen,&client,port,&compactServer,80,
+                                                    &when,i,0,60,0,&nEvicted)) {
+          spindump_errorf("cannot record a half-open connection for a SYN");
+          exit(1);
+        }
+      }
+    }
+    results[mode] = spindump_bench_time() - start;
+    if (mode == 1 && table->halfOpen.nEntries != spindump_bench_halfopen_syns) {
+      spindump_errorf("the half-open connections were not all recorded");
+      exit(1);
+    }
+    spindump_connectionstable_uninitialize(table);
+  }
+  spindump_free(clients);
+
+  //
+  // Report
+  //
+
+  unsigned long connectionSize = spindump_connectionstable_pool_objectsize(spindump_connection_transport_tcp);
+  unsigned long halfOpenSize = sizeof(struct spindump_connectionstable_halfopenentry) + sizeof(uint32_t);
+  printf("SYN flood of %u spoofed sources:\n", spindump_bench_halfopen_syns);
+  printf("  %-40s %8.1f ns/SYN %6lu bytes/SYN\n", "full connections:",
+         results[0] * 1000000000.0 / spindump_bench_halfopen_syns, connectionSize);
+  printf("  %-40s %8.1f ns/SYN %6lu bytes/SYN\n", "half-open connections:",
+         results[1] * 1000000000.0 / spindump_bench_halfopen_syns, halfOpenSize);
+  printf("  %-40s %8.2fx\n", "speedup:", results[0] / results[1]);
+}
+
+//
+// Create a given number of random prefixes, four out of five of them
+// IPv4 prefixes of 16 to 24 bits, and the rest IPv6 prefixes of 32 to
+// 48 bits
+//
+
+static spindump_compactnetwork*
+spindump_bench_prefixes_make(unsigned int nPrefixes,
+                             uint32_t* seed) {
+  spindump_compactnetwork* networks =
+    (spindump_compactnetwork*)spindump_malloc(nPrefixes * sizeof(spindump_compactnetwork));
+  if (networks == 0) {
+    spindump_errorf("cannot allocate memory for %u prefixes", nPrefixes);
+    exit(1);
+  }
+  memset(networks,0,nPrefixes * sizeof(spindump_compactnetwork));
+  for (unsigned int i = 0; i < nPrefixes; i++) {
+    spindump_compactnetwork* network = &networks[i];
+    if (i % 5 != 4) {
+      network->address.family = AF_INET;
+      network->address.words[0] = htonl(spindump_bench_random(seed));
+      network->length = 16 + spindump_bench_random(seed) % 9;
+    } else {
+      network->address.family = AF_INET6;
+      network->address.words[0] = htonl(0x20010000U | (spindump_bench_random(seed) & 0xFFFFU));
+      network->address.words[1] = htonl(spindump_bench_random(seed));
+      network->length = 32 + spindump_bench_random(seed) % 17;
+    }
+  }
+  return(networks);
+}
+
+//
+// Read prefixes from a file in the format of the --aggregate
+// option's network files, one network per line
+//
+
+static spindump_compactnetwork*
+spindump_bench_prefixes_read(const char* file,
+                             unsigned int* p_nPrefixes) {
+  FILE* input = fopen(file,"r");
+  if (input == 0) {
+    spindump_errorf("cannot open prefix file %s", file);
+    exit(1);
+  }
+  unsigned int nPrefixes = 0;
+  unsigned int maxPrefixes = 1024;
+  spindump_compactnetwork* networks =
+    (spindump_compactnetwork*)spindump_malloc(maxPrefixes * sizeof(spindump_compactnetwork));
+  char line[spindump_bench_prefixes_linelength];
+  while (networks != 0 && fgets(line,sizeof(line),input) != 0) {
+    line[strcspn(line,"\r\n")] = 0;
+    spindump_network network;
+    if (line[0] == 0 || !spindump_network_fromstring(&network,line)) continue;
+    if (nPrefixes == maxPrefixes) {
+      maxPrefixes *= 2;
+      spindump_compactnetwork* larger =
+        (spindump_compactnetwork*)spindump_malloc(maxPrefixes * sizeof(spindump_compactnetwork));
+      if (larger != 0) memcpy(larger,networks,nPrefixes * sizeof(spindump_compactnetwork));
+      spindump_free(networks);
+      networks = larger;
+      if (networks == 0) break;
+    }
+    spindump_compactnetwork_fromnetwork(&network,&networks[nPrefixes++]);
+  }
+  fclose(input);
+  if (networks == 0 || nPrefixes == 0) {
+    spindump_errorf("no prefixes read from %s", file);
+    exit(1);
+  }
+  *p_nPrefixes = nPrefixes;
+  return(networks);
+}
+
+//
+// Comparison function to sort prefixes by their addresses
+//
+
+static int
+spindump_bench_prefixes_compare(const void* a,
+                                const void* b) {
+  const spindump_compactnetwork* network1 = (const spindump_compactnetwork*)a;
+  const spindump_compactnetwork* network2 = (const spindump_compactnetwork*)b;
+  return(spindump_compactaddress_compare(&network1->address,&network2->address));
+}
+
+//
+// Binary search through sorted prefixes, the way multinet aggregate
+// networks were searched before the prefix tries
+//
+
+static const spindump_compactnetwork*
+spindump_bench_prefixes_bsearch(const spindump_compactaddress* address,
+                                const spindump_compactnetwork* networks,
+                                unsigned int nNetworks) {
+  while (nNetworks > 0) {
+    unsigned int half = nNetworks / 2;
+    const spindump_compactnetwork* network = &networks[half];
+    if (spindump_compactaddress_compare(address,&network->address) < 0) {
+      if (half == 0) return(0);
+      nNetworks = half;
+    } else if (spindump_compactaddress_innetwork(address,network)) {
+      return(network);
+    } else {
+      if (half + 1 >= nNetworks) return(0);
+      networks += half;
+      nNetworks -= half;
+    }
+  }
+  return(0);
+}
+
+//
+// Measure how fast the aggregates of a packet or a new connection
+// are found, with a given number of aggregate networks. The networks
+// are used in two ways: as the side 1 networks of network-network
+// aggregates, found by scanning the whole connections table before
+// the prefix tries, and as the side 2 networks of one multinet
+// aggregate, found by a binary search through sorted networks before
+// the prefix tries.
+//
+
+static void
+spindump_bench_prefixes(unsigned int nPrefixes,
+                        const char* file) {
+
+  uint32_t seed = 1;
+  spindump_compactnetwork* networks =
+    file != 0 ?
+    spindump_bench_prefixes_read(file,&nPrefixes) :
+    spindump_bench_prefixes_make(nPrefixes,&seed);
+
+  //
+  // Create the aggregates
+  //
+
+  struct timeval when;
+  when.tv_sec = 1000;
+  when.tv_usec = 0;
+  spindump_address host;
+  spindump_address_fromstring(&host,"192.0.2.1");
+  spindump_network any4;
+  spindump_network any6;
+  spindump_network_fromstring(&any4,"0.0.0.0/0");
+  spindump_network_fromstring(&any6,"::/0");
+  struct spindump_connectionstable* table = spindump_connectionstable_initialize(1000000,0,0);
+  if (table == 0) exit(1);
+  double start = spindump_bench_time();
+  struct spindump_connection* multinet =
+    spindump_connections_newconnection_aggregate_hostmultinet(&host,&host,&when,1,table);
+  if (multinet == 0) exit(1);
+  for (unsigned int i = 0; i < nPrefixes; i++) {
+    spindump_network network;
+    spindump_compactnetwork_tonetwork(&networks[i],&network);
+    struct spindump_connection* aggregate =
+      spindump_connections_newconnection_aggregate_networknetwork(0,
+                                                                  &network,
+                                                                  networks[i].address.family == AF_INET ? &any4 : &any6,
+                                                                  &when,
+                                                                  1,
+                                                                  table);
+    if (aggregate == 0) exit(1);
+    spindump_connections_newconnection_aggregate_addnetwork(multinet,&network,table);
+  }
+  double build = spindump_bench_time() - start;
+  qsort(networks,nPrefixes,sizeof(spindump_compactnetwork),spindump_bench_prefixes_compare);
+
+  //
+  // Create the addresses to look up: half of them in some prefix, and
+  // the others random
+  //
+
+  spindump_compactaddress* addresses =
+    (spindump_compactaddress*)spindump_malloc(spindump_bench_prefixes_lookups * sizeof(spindump_compactaddress));
+  if (addresses == 0) exit(1);
+  for (unsigned int i = 0; i < spindump_bench_prefixes_lookups; i++) {
+    spindump_compactaddress* address = &addresses[i];
+    *address = networks[spindump_bench_random(&seed) % nPrefixes].address;
+    unsigned int last = address->family == AF_INET ? 0 : 3;
+    if (i % 2 == 0) {
+      address->words[last] ^= htonl(spindump_bench_random(&seed) & 0xFFU);
+    } else {
+      address->words[0] = htonl(spindump_bench_random(&seed));
+    }
+  }
+  spindump_compactaddress local;
+  spindump_compactaddress_fromaddress(&host,&local);
+
+  //
+  // Network-network aggregates, by scanning the table and through the
+  // tries
+  //
+
+  unsigned int scanMatches = 0;
+  start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_prefixes_scanlookups; i++) {
+    for (unsigned int j = 0; j < table->nConnections; j++) {
+      struct spindump_connection* aggregate = table->connections[j];
+      if (aggregate != 0 &&
+          spindump_connections_isaggregate_simple(aggregate) &&
+          spindump_connections_matches_aggregate_srcdst(&addresses[i],&local,aggregate)) {
+        scanMatches++;
+      }
+    }
+  }
+  double scan = (spindump_bench_time() - start) / spindump_bench_prefixes_scanlookups;
+  unsigned int trieMatches = 0;
+  unsigned int checkMatches = 0;
+  start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_prefixes_lookups; i++) {
+    unsigned int nCandidates =
+      spindump_connectionstable_prefixes_candidates(&table->prefixes,&addresses[i],&local);
+    for (unsigned int j = 0; j < nCandidates; j++) {
+      if (spindump_connections_matches_aggregate_srcdst(&addresses[i],&local,table->prefixes.candidates[j])) {
+        trieMatches++;
+        if (i < spindump_bench_prefixes_scanlookups) checkMatches++;
+      }
+    }
+  }
+  double trie = (spindump_bench_time() - start) / spindump_bench_prefixes_lookups;
+  if (checkMatches != scanMatches) {
+    spindump_errorf("table scan found %u aggregates, prefix tries %u", scanMatches, checkMatches);
+    exit(1);
+  }
+
+  //
+  // Multinet aggregate networks, by binary search and through the
+  // tries
+  //
+
+  unsigned int searchMatches = 0;
+  start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_prefixes_lookups; i++) {
+    if (spindump_bench_prefixes_bsearch(&addresses[i],networks,nPrefixes) != 0) searchMatches++;
+  }
+  double search = (spindump_bench_time() - start) / spindump_bench_prefixes_lookups;
+  unsigned int multinetMatches = 0;
+  start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_prefixes_lookups; i++) {
+    if (spindump_connections_match_multinet(&addresses[i],&local,table) != 0) multinetMatches++;
+  }
+  double longest = (spindump_bench_time() - start) / spindump_bench_prefixes_lookups;
+  unsigned int nNodes = table->prefixes.nNodes;
+  spindump_connectionstable_uninitialize(table);
+  spindump_free(addresses);
+  spindump_free(networks);
+
+  //
+  // Report. The binary search may find fewer matches than the tries
+  // when the prefixes overlap.
+  //
+
+  printf("aggregate lookups with %u prefixes (%u trie nodes, built in %.2f ms):\n",
+         nPrefixes, nNodes, build * 1000.0);
+  printf("  %-40s %8.1f ns/lookup\n", "network aggregates, table scan:", scan * 1000000000.0);
+  printf("  %-40s %8.1f ns/lookup %u matches\n", "network aggregates, prefix trie:", trie * 1000000000.0, trieMatches);
+  printf("  %-40s %8.2fx\n", "speedup:", scan / trie);
+  printf("  %-40s %8.1f ns/lookup %u matches\n", "multinet networks, binary search:", search * 1000000000.0, searchMatches);
+  printf("  %-40s %8.1f ns/lookup %u matches\n", "multinet networks, prefix trie:", longest * 1000000000.0, multinetMatches);
+  printf("  %-40s %8.2fx\n", "speedup:", search / longest);
+}
+
+//
+// Calculate the moving average, standard deviation, and filtered
+// average of an RTT object the way it was done before the running
+// sums, by going through the recent values, once for the average,
+// once for the deviation, and once more for the filtered average
+//
+
+static unsigned long
+spindump_bench_rtt_recompute(struct spindump_rtt* rtt,
+                             int filter,
+                             unsigned long* standardDeviation,
+                             unsigned long* filteredAvg) {
+  unsigned long long sum = 0;
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+    if (rtt->recentRTTs[i] != spindump_rtt_infinite) {
+      sum += rtt->recentRTTs[i];
+      n++;
+    }
+  }
+  if (n == 0) return(spindump_rtt_infinite);
+  unsigned long long avg = sum / n;
+  unsigned long long devSum = 0;
+  for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+    unsigned long long val = rtt->recentRTTs[i];
+    if (val != spindump_rtt_infinite) {
+      unsigned long long diff = val > avg ? val - avg : avg - val;
+      devSum += diff * diff;
+    }
+  }
+  unsigned long dev = n > 1 ? (unsigned long)floor(sqrt((1.0/(n-1))*(double)devSum)) : 0;
+  unsigned long long fsum = sum;
+  unsigned int fn = n;
+  if (filter &&
+      rtt->lastMovingAvgRTT != spindump_rtt_infinite &&
+      rtt->lastStandardDeviation != spindump_rtt_infinite &&
+      n >= spindump_rtt_nminfilter) {
+    unsigned long limitdiff = (spindump_bench_rtt_filterpercentage * rtt->lastStandardDeviation) / 100;
+    fsum = 0;
+    fn = 0;
+    for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+      unsigned long val = rtt->recentRTTs[i];
+      if (val != spindump_rtt_infinite &&
+          (rtt->lastMovingAvgRTT <= limitdiff || val >= rtt->lastMovingAvgRTT - limitdiff) &&
+          val <= rtt->lastMovingAvgRTT + limitdiff) {
+        fsum += val;
+        fn++;
+      }
+    }
+  }
+  *standardDeviation = dev;
+  *filteredAvg = fn > 0 ? (unsigned long)(fsum / fn) : 0;
+  rtt->lastMovingAvgRTT = avg;
+  rtt->lastStandardDeviation = dev;
+  return((unsigned long)avg);
+}
+
+//
+// Feed the samples to an RTT object, and calculate the moving
+// average after each, either by going through the recent values or
+// from the running sums. Returns the time per sample, and sets
+// p_check to a checksum of the results.
+//
+
+static double
+spindump_bench_rtt_run(const unsigned long long* samples,
+                       int recompute,
+                       int filter,
+                       unsigned long long* p_check) {
+  struct spindump_rtt rtt;
+  unsigned long dev;
+  unsigned long filt = 0;
+  unsigned long long check = 0;
+  spindump_rtt_initialize(&rtt);
+  double start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_rtt_samples; i++) {
+    spindump_rtt_newmeasurement(&rtt,samples[i]);
+    if (recompute) {
+      check += spindump_bench_rtt_recompute(&rtt,filter,&dev,&filt) + dev + filt;
+    } else {
+      check += spindump_rtt_calculateLastMovingAvgRTT(&rtt,filter,spindump_bench_rtt_filterpercentage,&dev,&filt) + dev + filt;
+    }
+  }
+  *p_check = check;
+  return((spindump_bench_time() - start) / spindump_bench_rtt_samples);
+}
+
+//
+// Measure the cost of a new RTT sample with the moving average and
+// standard deviation computed after each sample, as when reporting
+// RTTs in average mode, with and without filtering exceptional
+// values
+//
+
+static void
+spindump_bench_rtt(void) {
+
+  unsigned long long* samples =
+    (unsigned long long*)spindump_malloc(spindump_bench_rtt_samples * sizeof(unsigned long long));
+  if (samples == 0) exit(1);
+  uint32_t seed = 1;
+  for (unsigned int i = 0; i < spindump_bench_rtt_samples; i++) {
+    samples[i] = 20000 + spindump_bench_random(&seed) % 10000;
+    if (i % 50 == 0) samples[i] *= 4;
+  }
+
+  //
+  // Only update the running sums and the smoothed RTT, as when not
+  // reporting averages
+  //
+
+  struct spindump_rtt rtt;
+  spindump_rtt_initialize(&rtt);
+  double start = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_rtt_samples; i++) {
+    spindump_rtt_newmeasurement(&rtt,samples[i]);
+  }
+  double sample = (spindump_bench_time() - start) / spindump_bench_rtt_samples;
+
+  //
+  // Averages
+  //
+
+  unsigned long long check1;
+  unsigned long long check2;
+  unsigned long long check3;
+  unsigned long long check4;
+  double recompute = spindump_bench_rtt_run(samples,1,0,&check1);
+  double running = spindump_bench_rtt_run(samples,0,0,&check2);
+  double recomputeFiltered = spindump_bench_rtt_run(samples,1,1,&check3);
+  double runningFiltered = spindump_bench_rtt_run(samples,0,1,&check4);
+  spindump_free(samples);
+
+  //
+  // Report
+  //
+
+  printf("rtt statistics over %u samples:\n", spindump_bench_rtt_samples);
+  printf("  %-40s %8.1f ns/sample\n", "new sample only:", sample * 1000000000.0);
+  printf("  %-40s %8.1f ns/sample\n", "average, recomputed:", recompute * 1000000000.0);
+  printf("  %-40s %8.1f ns/sample %s\n", "average, running sums:", running * 1000000000.0,
+         check1 == check2 ? "same results" : "DIFFERENT RESULTS");
+  printf("  %-40s %8.2fx\n", "speedup:", recompute / running);
+  printf("  %-40s %8.1f ns/sample\n", "filtered average, recomputed:", recomputeFiltered * 1000000000.0);
+  printf("  %-40s %8.1f ns/sample %s\n", "filtered average, running sums:", runningFiltered * 1000000000.0,
+         check3 == check4 ? "same results" : "DIFFERENT RESULTS");
+  printf("  %-40s %8.2fx\n", "speedup:", recomputeFiltered / runningFiltered);
+}
+
+//
+// Send segments of a bulk transfer through a TCP sequence number
+// tracker, with the given number of segments in flight, and each
+// segment acknowledged separately. Returns the time per segment (one
+// add and one ack), and sets p_samples to the number of ACKs that
+// gave an RTT sample.
+//
+
+static double
+spindump_bench_seq_run(unsigned int inFlight,
+                       unsigned int* p_samples) {
+  struct spindump_seqtracker tracker;
+  struct timeval t;
+  tcp_seq sentSeq;
+  int sentFin;
+  unsigned int samples = 0;
+  tcp_seq start = 0xfff00000;
+  spindump_seqtracker_initialize(&tracker);
+  double begin = spindump_bench_time();
+  for (unsigned int i = 0; i < spindump_bench_seq_segments + inFlight; i++) {
+    t.tv_sec = i / 1000000;
+    t.tv_usec = i % 1000000;
+    if (i < spindump_bench_seq_segments) {
+      spindump_seqtracker_add(&tracker,&t,0,start + i * spindump_bench_seq_segmentsize,spindump_bench_seq_segmentsize,0);
+    }
+    if (i >= inFlight) {
+      tcp_seq ack = start + (i - inFlight + 1) * spindump_bench_seq_segmentsize;
+      if (spindump_seqtracker_ackto(&tracker,ack,0,0,0,&t,&sentSeq,&sentFin) != 0) samples++;
+    }
+  }
+  double elapsed = spindump_bench_time() - begin;
+  spindump_seqtracker_uninitialize(&tracker);
+  *p_samples = samples;
+  return(elapsed / spindump_bench_seq_segments);
+}
+
+//
+// Measure the cost of tracking TCP segments and matching ACKs to
+// them, with different amounts of data in flight
+//
+
+static void
+spindump_bench_seq(void) {
+  static const unsigned int inFlights[] = { 10, 40, 200, 1000 };
+  printf("tcp sequence tracking over %u segments:\n", spindump_bench_seq_segments);
+  for (unsigned int i = 0; i < sizeof(inFlights) / sizeof(inFlights[0]); i++) {
+    unsigned int samples;
+    double perSegment = spindump_bench_seq_run(inFlights[i],&samples);
+    char label[50];
+    snprintf(label,sizeof(label),"%u segments in flight:",inFlights[i]);
+    printf("  %-40s %8.1f ns/segment %5.1f%% acks sampled\n",
+           label,
+           perSegment * 1000000000.0,
+           100.0 * samples / spindump_bench_seq_segments);
+  }
+}
+
+//
+// Make a JSON array of events of the kinds a probe typically
+// produces: connection events, RTT measurements, spin flips, and
+// periodic events with RTT histograms. Return the text, and set
+// *p_length to its length.
+//
+
+static char*
+spindump_bench_json_make(unsigned int nEvents,
+                         size_t* p_length) {
+  size_t size = (size_t)nEvents * 1024 + 3;
+  char* text = (char*)malloc(size);
+  if (text == 0) {
+    spindump_errorf("cannot allocate %lu bytes for JSON events", size);
+    exit(1);
+  }
+  spindump_network initiator;
+  spindump_network responder;
+  spindump_network_fromstring(&initiator,"10.0.6.137/32");
+  spindump_network_fromstring(&responder,"2001:db8::57/128");
+  static const enum spindump_event_type types[] = {
+    spindump_event_type_new_connection,
+    spindump_event_type_new_rtt_measurement,
+    spindump_event_type_new_rtt_measurement,
+    spindump_event_type_spin_flip,
+    spindump_event_type_periodic,
+    spindump_event_type_connection_delete
+  };
+  size_t length = 0;
+  text[length++] = '[';
+  for (unsigned int i = 0; i < nEvents; i++) {
+    struct spindump_event event;
+    char session[50];
+    snprintf(session,sizeof(session),"%08x-%08x (%u:443)",i * 2654435761U,i,49152 + i % 16384);
+    spindump_event_initialize(types[i % (sizeof(types) / sizeof(types[0]))],
+                              spindump_connection_transport_quic,
+                              spindump_connection_state_established,
+                              &initiator,
+                              &responder,
+                              session,
+                              1553000000000000ULL + i * 1000ULL,
+                              i % 1000,
+                              i % 900,
+                              (i % 1000) * 1200ULL,
+                              (i % 900) * 1300ULL,
+                              100000 + i % 5000,
+                              200000 + i % 7000,
+                              0,
+                              0,
+                              &event);
+    switch (event.eventType) {
+    case spindump_event_type_new_rtt_measurement:
+      event.u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
+      event.u.newRttMeasurement.direction = i % 2 ? spindump_direction_frominitiator : spindump_direction_fromresponder;
+      event.u.newRttMeasurement.rtt = 20000 + i % 10000;
+      event.u.newRttMeasurement.avgRtt = 25000;
+      event.u.newRttMeasurement.devRtt = 1200;
+      event.u.newRttMeasurement.filtAvgRtt = 24000;
+      event.u.newRttMeasurement.minRtt = 19000;
+      break;
+    case spindump_event_type_spin_flip:
+      event.u.spinFlip.direction = spindump_direction_frominitiator;
+      event.u.spinFlip.spin0to1 = (int)(i % 2);
+      break;
+    case spindump_event_type_periodic:
+      event.u.periodic.rttRight = 20000 + i % 10000;
+      event.u.periodic.avgRttRight = 25000;
+      event.u.periodic.devRttRight = 1200;
+      spindump_histogram_initialize(&event.u.periodic.histRight);
+      for (unsigned long value = 1; value <= 20; value++) {
+        spindump_histogram_record(&event.u.periodic.histRight,18000 + value * (i % 997));
+      }
+      break;
+    default:
+      break;
+    }
+    if (i > 0) text[length++] = ',';
+    size_t consumed;
+    if (!spindump_event_parser_json_print(&event,text + length,size - length - 2,&consumed)) {
+      spindump_errorf("cannot print JSON event");
+      exit(1);
+    }
+    length += strlen(text + length);
+  }
+  text[length++] = ']';
+  text[length] = 0;
+  *p_length = length;
+  return(text);
+}
+
+//
+// Callback for the parsed events; sum up the timestamps, so that the
+// parsers can be checked to agree
+//
+
+static void
+spindump_bench_json_callback(const struct spindump_event* event,
+                             void* data) {
+  unsigned long long* check = (unsigned long long*)data;
+  *check += event->timestamp + event->bytesFromSide1;
+}
+
+//
+// Parse the events with either the JSON value parser or the
+// streaming parser, and return the time taken
+//
+
+static double
+spindump_bench_json_run(const char* text,
+                        int stream,
+                        unsigned long long* p_check) {
+  const char* input = text;
+  *p_check = 0;
+  double start = spindump_bench_time();
+  int ans;
+  if (stream) {
+    ans = spindump_event_parser_json_streamparse(&input,spindump_bench_json_callback,p_check);
+  } else {
+    ans = spindump_event_parser_json_textparse(&input,spindump_bench_json_callback,p_check);
+  }
+  double elapsed = spindump_bench_time() - start;
+  if (!ans) {
+    spindump_errorf("cannot parse JSON events");
+    exit(1);
+  }
+  return(elapsed);
+}
+
+//
+// Compare the throughput of parsing JSON events by building JSON
+// value objects, and by streaming them directly into events
+//
+
+static void
+spindump_bench_json(void) {
+  size_t length;
+  char* text = spindump_bench_json_make(spindump_bench_json_events,&length);
+  double megabytes = (double)length / (1024.0 * 1024.0);
+  printf("json event parsing of %u events, %.1f MB:\n", spindump_bench_json_events, megabytes);
+  unsigned long long checks[2];
+  for (int stream = 0; stream <= 1; stream++) {
+    double best = 0;
+    for (unsigned int round = 0; round < spindump_bench_json_rounds; round++) {
+      double elapsed = spindump_bench_json_run(text,stream,&checks[stream]);
+      if (round == 0 || elapsed < best) best = elapsed;
+    }
+    printf("  %-40s %8.1f MB/s %8.0f events/ms\n",
+           stream ? "streaming parser:" : "json value parser:",
+           megabytes / best,
+           spindump_bench_json_events / (best * 1000.0));
+  }
+  if (checks[0] != checks[1]) {
+    spindump_errorf("the JSON parsers disagree");
+    exit(1);
+  }
+  free(text);
+}
+
+//
+// The main program
+//
+
+int main(int argc,char** argv) {
+
+  unsigned int nConnections = spindump_bench_scan_defaultconnections;
+  unsigned int nPrefixes = spindump_bench_prefixes_default;
+  const char* prefixFile = 0;
+
+  //
+  // Process arguments
+  //
+
+  argc--; argv++;
+  while (argc > 0) {
+
+    if (strcmp(argv[0],"--connections") == 0 && argc > 1) {
+
+      nConnections = (unsigned int)atoi(argv[1]);
+      if (nConnections == 0) {
+        spindump_errorf("expected a positive number of connections, got %s", argv[1]);
+        exit(1);
+      }
+      argc--; argv++;
+
+    } else if (strcmp(argv[0],"--prefixes") == 0 && argc > 1) {
+
+      nPrefixes = (unsigned int)atoi(argv[1]);
+      if (nPrefixes == 0) {
+        spindump_errorf("expected a positive number of prefixes, got %s", argv[1]);
+        exit(1);
+      }
+      argc--; argv++;
+
+    } else if (strcmp(argv[0],"--prefix-file") == 0 && argc > 1) {
+
+      prefixFile = argv[1];
+      argc--; argv++;
+
+    } else {
+
+      spindump_errorf("invalid argument: %s", argv[0]);
+      exit(1);
+
+    }
+
+    argc--; argv++;
+  }
+
+  //
+  // Run the benchmarks
+  //
+
+  spindump_bench_scan(nConnections);
+  spindump_bench_timers(nConnections);
+  spindump_bench_slots(nConnections);
+  spindump_bench_sets();
+  spindump_bench_rollup();
+  spindump_bench_negative();
+  spindump_bench_halfopen();
+  spindump_bench_prefixes(nPrefixes,prefixFile);
+  spindump_bench_rtt();
+  spindump_bench_seq();
+  spindump_bench_json();
+  exit(0);
+}
@@ -35,6 +35,7 @@
 #include "spindump_util.h"
 #include "spindump_protocols.h"
 #include "spindump_capture.h"
+#include "spindump_capture_afpacket.h"
 
 //
 // Function prototypes ------------------------------------------------------------------------
@@ -45,6 +46,15 @@ spindump_capture_initialize_aux(const char* interface,
                                 const char* file,
                                 const char* filter,
                                 unsigned int snaplen);
+static void
+spindump_capture_initialize_addresses(struct spindump_capture_state* state,
+                                      const char* interface);
+static void
+spindump_capture_nextpacket_aux(struct spindump_capture_state* state,
+                                struct spindump_packet** p_packet,
+                                int* p_more,
+                                int wait,
+                                struct spindump_stats* stats);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -226,22 +236,7 @@ spindump_capture_initialize_aux(const char* interface,
   // Find the properties for the device
   // 
 
-  if (interface != 0) {
-    
-    if (pcap_lookupnet(interface, &state->ourAddress, &state->ourNetmask, errbuf) == -1) {
-      spindump_warnf("couldn't get netmask for device %s: %s", interface, errbuf);
-      state->ourAddress = 0x7f000001;
-      state->ourNetmask = 0xff000000;
-    }
-  } else {
-    state->ourAddress = 0x7f000001;
-    state->ourNetmask = 0xff000000;
-  }
-  state->ourLocalBroadcastAddress = (state->ourAddress & state->ourNetmask) | (~(state->ourNetmask));
-  spindump_deepdebugf("our local address %08x netmask %08x broadcast %08x",
-                      state->ourAddress,
-                      state->ourNetmask,
-                      state->ourLocalBroadcastAddress);
+  spindump_capture_initialize_addresses(state,interface);
   
   //
   // Compile and apply the filter, if any
@@ -278,6 +273,76 @@ spindump_capture_initialize_aux(const char* interface,
   return(state);
 }
 
+//
+// Find our address, netmask, and local broadcast address on the
+// given interface, or use loopback addresses if there is no
+// interface or its addresses are not known.
+//
+
+static void
+spindump_capture_initialize_addresses(struct spindump_capture_state* state,
+                                      const char* interface) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  memset(errbuf,0,sizeof(errbuf));
+  if (interface != 0) {
+    
+    if (pcap_lookupnet(interface, &state->ourAddress, &state->ourNetmask, errbuf) == -1) {
+      spindump_warnf("couldn't get netmask for device %s: %s", interface, errbuf);
+      state->ourAddress = 0x7f000001;
+      state->ourNetmask = 0xff000000;
+    }
+  } else {
+    state->ourAddress = 0x7f000001;
+    state->ourNetmask = 0xff000000;
+  }
+  state->ourLocalBroadcastAddress = (state->ourAddress & state->ourNetmask) | (~(state->ourNetmask));
+  spindump_deepdebugf("our local address %08x netmask %08x broadcast %08x",
+                      state->ourAddress,
+                      state->ourNetmask,
+                      state->ourLocalBroadcastAddress);
+}
+
+//
+// Initialize a capture object to capture packets from a live
+// interface through an AF_PACKET socket and a TPACKET_V3 ring shared
+// with the kernel, rather than through PCAP. Packets are analyzed in
+// place in the ring, without copying. If fanoutGroup is non-zero,
+// the interface's traffic is split between all captures that use
+// the same group number. This is only available on Linux.
+//
+
+struct spindump_capture_state*
+spindump_capture_initialize_afpacket(const char* interface,
+                                     const char* filter,
+                                     unsigned int snaplen,
+                                     unsigned int fanoutGroup) {
+
+  spindump_debugf("opening AF_PACKET capture on interface %s...", interface);
+  if (((int)snaplen) < 0) {
+    spindump_errorf("snaplen %u is too high", snaplen);
+    return(0);
+  }
+  
+  unsigned int size = sizeof(struct spindump_capture_state);
+  struct spindump_capture_state* state = (struct spindump_capture_state*)spindump_malloc(size);
+  if (state == 0) {
+    spindump_errorf("cannot allocate capture state for %u bytes", size);
+    return(0);
+  }
+  memset(state,0,sizeof(*state));
+  state->backend = spindump_capture_backend_afpacket;
+  state->handle = 0;
+  state->waitable = 0;
+  spindump_capture_initialize_addresses(state,interface);
+  
+  if (!spindump_capture_afpacket_open(state,interface,filter,snaplen,fanoutGroup)) {
+    spindump_free(state);
+    return(0);
+  }
+  
+  return(state);
+}
+
 //
 // Initialize a capture object to read packets from a PCAP file
 //
@@ -324,6 +389,20 @@ spindump_capture_nextpacket(struct spindump_capture_state* state,
                             struct spindump_packet** p_packet,
                             int* p_more,
                             struct spindump_stats* stats) {
+  spindump_capture_nextpacket_aux(state,p_packet,p_more,1,stats);
+}
+
+//
+// Retrieve the next packet, and if wait is set and the capture is
+// waitable, wait a while for it to arrive
+//
+
+static void
+spindump_capture_nextpacket_aux(struct spindump_capture_state* state,
+                                struct spindump_packet** p_packet,
+                                int* p_more,
+                                int wait,
+                                struct spindump_stats* stats) {
   
   //
   // Check
@@ -334,6 +413,24 @@ spindump_capture_nextpacket(struct spindump_capture_state* state,
   spindump_assert(p_more != 0);
   spindump_assert(stats != 0);
 
+  //
+  // With an AF_PACKET ring, take the next packet from the ring. The
+  // previous packet is no longer needed, so its block can be
+  // released if all of its packets have been read.
+  //
+
+  if (state->backend == spindump_capture_backend_afpacket) {
+    struct spindump_packet* packet = &state->currentPacket;
+    if (spindump_capture_afpacket_next(&state->ring,packet,1)) {
+      *p_packet = packet;
+      stats->receivedFrames++;
+    } else {
+      *p_packet = 0;
+    }
+    *p_more = 1;
+    return;
+  }
+  
   //
   // Check if we have a capture object created by
   // spindump_capture_initialize_null, in that case we're not supposed
@@ -350,7 +447,7 @@ spindump_capture_nextpacket(struct spindump_capture_state* state,
   // Otherwise, wait for the next packet
   //
   
-  if (state->waitable) {
+  if (state->waitable && wait) {
     fd_set set = state->handleSet;
     struct timeval timeout = { .tv_sec = 0, .tv_usec = spindump_capture_wait_select };
     select(state->handleFD + 1, &set, NULL, NULL, &timeout);
@@ -403,6 +500,109 @@ spindump_capture_nextpacket(struct spindump_capture_state* state,
   }
 }
 
+//
+// Retrieve a batch of packets, up to maxPackets, into the given
+// array. The number of packets is placed in *p_nPackets, and may be
+// zero if no packets arrived within the wait time. Only the first
+// packet is waited for; the batch ends when no more packets are
+// immediately available.
+//
+// With an AF_PACKET ring, the packet contents point directly to the
+// ring, and remain valid until the next call to
+// spindump_capture_nextbatch, spindump_capture_nextpacket, or
+// spindump_capture_releasebatch. A batch never spans more than one
+// block of the ring. With PCAP, the packets are copied to buffers
+// held by the capture state, as PCAP only keeps the latest packet,
+// and they remain valid until the next call to
+// spindump_capture_nextbatch.
+//
+// If the end of the file or an error is reached, *p_more is set to
+// 0, but the packets read before it are still returned.
+//
+
+void
+spindump_capture_nextbatch(struct spindump_capture_state* state,
+                           struct spindump_packet* packets,
+                           unsigned int maxPackets,
+                           unsigned int* p_nPackets,
+                           int* p_more,
+                           struct spindump_stats* stats) {
+  
+  //
+  // Check
+  // 
+  
+  spindump_assert(state != 0);
+  spindump_assert(packets != 0);
+  spindump_assert(maxPackets > 0);
+  spindump_assert(p_nPackets != 0);
+  spindump_assert(p_more != 0);
+  spindump_assert(stats != 0);
+
+  //
+  // Take as many packets as there are in the current block of the ring
+  //
+  
+  if (state->backend == spindump_capture_backend_afpacket) {
+    unsigned int n = 0;
+    while (n < maxPackets &&
+           spindump_capture_afpacket_next(&state->ring,&packets[n],n == 0)) {
+      n++;
+    }
+    stats->receivedFrames += n;
+    *p_nPackets = n;
+    *p_more = 1;
+    return;
+  }
+
+  //
+  // Otherwise, get packets from PCAP one by one, copying each
+  //
+  
+  spindump_assert(maxPackets <= spindump_capture_maxbatch);
+  unsigned int n = 0;
+  *p_more = 1;
+  while (n < maxPackets && *p_more) {
+    
+    struct spindump_packet* packet = 0;
+    spindump_capture_nextpacket_aux(state,&packet,p_more,n == 0,stats);
+    if (packet == 0) break;
+    
+    struct spindump_capture_batchbuffer* slot = &state->batchBuffers[n];
+    packets[n] = *packet;
+    if (packet->caplen > 0 && packet->contents != 0) {
+      if (slot->bufferSize < packet->caplen) {
+        if (slot->buffer != 0) spindump_free(slot->buffer);
+        slot->bufferSize = spindump_max(packet->caplen,spindump_capture_minbuffersize);
+        slot->buffer = (unsigned char*)spindump_malloc(slot->bufferSize);
+        if (slot->buffer == 0) {
+          spindump_fatalf("cannot allocate capture packet buffer of %u bytes", slot->bufferSize);
+        }
+      }
+      memcpy(slot->buffer,packet->contents,packet->caplen);
+      packets[n].contents = slot->buffer;
+    }
+    n++;
+    
+  }
+  
+  *p_nPackets = n;
+}
+
+//
+// Tell the capture that the packets of the latest batch have been
+// processed. With an AF_PACKET ring, this gives the block they were
+// in back to the kernel, if all of its packets have been taken.
+//
+
+void
+spindump_capture_releasebatch(struct spindump_capture_state* state) {
+  spindump_assert(state != 0);
+  if (state->backend == spindump_capture_backend_afpacket) {
+    spindump_capture_afpacket_release(&state->ring);
+  }
+}
+
 //
 // Return the currently used data link layer type
 //
@@ -432,6 +632,14 @@ spindump_capture_uninitialize(struct spindump_capture_state* state) {
   if (state->handle != 0) {
     pcap_close(state->handle);
   }
+  if (state->backend == spindump_capture_backend_afpacket) {
+    spindump_capture_afpacket_close(&state->ring);
+  }
+  for (unsigned int i = 0; i < spindump_capture_maxbatch; i++) {
+    if (state->batchBuffers[i].buffer != 0) {
+      spindump_free(state->batchBuffers[i].buffer);
+    }
+  }
   memset(state,0,sizeof(*state));
   
   //
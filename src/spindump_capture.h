@@ -35,6 +35,12 @@
 #define spindump_capture_snaplen        128   // bytes
 #define spindump_capture_wait           1     // ms
 #define spindump_capture_wait_select    5000  // usec
+#define spindump_capture_ring_blocksize (1024 * 1024) // bytes, AF_PACKET ring block
+#define spindump_capture_ring_nblocks   32
+#define spindump_capture_ring_framesize 2048  // bytes, nominal frame size for the ring request
+#define spindump_capture_ring_timeout   10    // ms, after which a partly filled block is retired
+#define spindump_capture_maxbatch       64    // packets, at most in one spindump_capture_nextbatch
+#define spindump_capture_minbuffersize  256   // bytes, smallest buffer for a copied PCAP packet
 
 //
 // Capture data structures --------------------------------------------------------------------
@@ -47,7 +53,46 @@ enum spindump_capture_linktype {
   spindump_capture_linktype_raw
 };
 
+enum spindump_capture_backend {
+  spindump_capture_backend_pcap,
+  spindump_capture_backend_afpacket
+};
+
+//
+// The state of an AF_PACKET TPACKET_V3 receive ring, shared with the
+// kernel through mmap. The kernel fills in blocks of packets, and
+// hands a block over to us when it is full or the block timeout
+// expires. Packets are read from the block in place, and the block
+// is given back to the kernel when all of its packets have been
+// processed.
+//
+
+struct spindump_capture_ring {
+  int fd;
+  int loopback;                  // skip outgoing copies of packets, as they are seen twice
+  uint8_t* map;
+  size_t mapSize;
+  unsigned int blockSize;
+  unsigned int nBlocks;
+  unsigned int currentBlock;     // the next block to read, or the block being read
+  unsigned int packetsLeft;      // packets not yet returned from the block being read
+  int blockHeld;                 // the current block belongs to us, and needs to be released
+  unsigned int snaplen;
+  uint8_t* nextFrame;            // the next packet to return from the block being read
+};
+
+//
+// A buffer that holds a copy of one packet of a PCAP batch, as PCAP
+// only keeps the latest packet that it has returned.
+//
+
+struct spindump_capture_batchbuffer {
+  unsigned char* buffer;
+  unsigned int bufferSize;
+};
+
 struct spindump_capture_state {
+  enum spindump_capture_backend backend;
   pcap_t *handle;
   int waitable;
   int handleFD;
@@ -58,6 +103,8 @@ struct spindump_capture_state {
   uint32_t ourLocalBroadcastAddress;
   struct bpf_program compiledFilter;
   struct spindump_packet currentPacket;
+  struct spindump_capture_ring ring;
+  struct spindump_capture_batchbuffer batchBuffers[spindump_capture_maxbatch];
 };
 
 //
@@ -71,6 +118,11 @@ spindump_capture_initialize_live(const char* interface,
                                  const char* filter,
                                  unsigned int snaplen);
 struct spindump_capture_state*
+spindump_capture_initialize_afpacket(const char* interface,
+                                     const char* filter,
+                                     unsigned int snaplen,
+                                     unsigned int fanoutGroup);
+struct spindump_capture_state*
 spindump_capture_initialize_file(const char* file,
                                  const char* filter);
 struct spindump_capture_state*
@@ -83,6 +135,15 @@ spindump_capture_nextpacket(struct spindump_capture_state* state,
                             int* p_more,
                             struct spindump_stats* stats);
 void
+spindump_capture_nextbatch(struct spindump_capture_state* state,
+                           struct spindump_packet* packets,
+                           unsigned int maxPackets,
+                           unsigned int* p_nPackets,
+                           int* p_more,
+                           struct spindump_stats* stats);
+void
+spindump_capture_releasebatch(struct spindump_capture_state* state);
+void
 spindump_capture_uninitialize(struct spindump_capture_state* state);
 
 #endif // SPINDUMP_CAPTURE_H
@@ -0,0 +1,404 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pcap.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#endif
+#include "spindump_util.h"
+#include "spindump_capture.h"
+#include "spindump_capture_afpacket.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+#if defined(__linux__)
+static int
+spindump_capture_afpacket_setfilter(struct spindump_capture_ring* ring,
+                                    const char* filter,
+                                    int dlt,
+                                    unsigned int snaplen,
+                                    uint32_t netmask);
+static int
+spindump_capture_afpacket_setring(struct spindump_capture_ring* ring);
+#endif
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+#if defined(__linux__)
+
+//
+// Compile a PCAP filter expression, and attach it to the
+// socket. Filtering happens in the kernel before packets are placed
+// in the ring, and the filter also cuts the packets to the snaplen.
+//
+
+static int
+spindump_capture_afpacket_setfilter(struct spindump_capture_ring* ring,
+                                    const char* filter,
+                                    int dlt,
+                                    unsigned int snaplen,
+                                    uint32_t netmask) {
+  pcap_t* dead = pcap_open_dead(dlt,(int)snaplen);
+  if (dead == 0) {
+    spindump_errorf("cannot allocate memory for compiling the filter");
+    return(0);
+  }
+
+  struct bpf_program program;
+  memset(&program,0,sizeof(program));
+  spindump_deepdebugf("compiling filter %s...", filter);
+  if (pcap_compile(dead,&program,filter,1,netmask) == -1) {
+    spindump_errorf("couldn't parse filter %s: %s", filter, pcap_geterr(dead));
+    pcap_close(dead);
+    return(0);
+  }
+
+  int ans = 1;
+  if (program.bf_len > 0) {
+    struct sock_fprog code;
+    code.len = (unsigned short)program.bf_len;
+    code.filter = (struct sock_filter*)program.bf_insns;
+    if (setsockopt(ring->fd,SOL_SOCKET,SO_ATTACH_FILTER,&code,sizeof(code)) < 0) {
+      spindump_errorf("couldn't install filter %s: %s", filter, strerror(errno));
+      ans = 0;
+    }
+  }
+
+  pcap_freecode(&program);
+  pcap_close(dead);
+  return(ans);
+}
+
+//
+// Set up the TPACKET_V3 receive ring, and map it to our memory
+//
+
+static int
+spindump_capture_afpacket_setring(struct spindump_capture_ring* ring) {
+  int version = TPACKET_V3;
+  if (setsockopt(ring->fd,SOL_PACKET,PACKET_VERSION,&version,sizeof(version)) < 0) {
+    spindump_errorf("the packet socket does not support TPACKET_V3: %s", strerror(errno));
+    return(0);
+  }
+
+  struct tpacket_req3 request;
+  memset(&request,0,sizeof(request));
+  request.tp_block_size = spindump_capture_ring_blocksize;
+  request.tp_block_nr = spindump_capture_ring_nblocks;
+  request.tp_frame_size = spindump_capture_ring_framesize;
+  request.tp_frame_nr =
+    (spindump_capture_ring_blocksize / spindump_capture_ring_framesize) * spindump_capture_ring_nblocks;
+  request.tp_retire_blk_tov = spindump_capture_ring_timeout;
+  if (setsockopt(ring->fd,SOL_PACKET,PACKET_RX_RING,&request,sizeof(request)) < 0) {
+    spindump_errorf("couldn't set up a receive ring of %u blocks of %u bytes: %s",
+                    request.tp_block_nr, request.tp_block_size, strerror(errno));
+    return(0);
+  }
+
+  ring->blockSize = request.tp_block_size;
+  ring->nBlocks = request.tp_block_nr;
+  ring->mapSize = (size_t)ring->blockSize * (size_t)ring->nBlocks;
+  void* map = mmap(0,ring->mapSize,PROT_READ | PROT_WRITE,MAP_SHARED,ring->fd,0);
+  if (map == MAP_FAILED) {
+    spindump_errorf("couldn't map the receive ring of %lu bytes: %s",
+                    (unsigned long)ring->mapSize, strerror(errno));
+    ring->mapSize = 0;
+    return(0);
+  }
+  ring->map = (uint8_t*)map;
+  return(1);
+}
+
+#endif
+
+//
+// Open an AF_PACKET socket on the given interface, with a TPACKET_V3
+// ring. If fanoutGroup is non-zero, the socket joins the fanout group
+// of that number, and the interface's traffic is split by flow
+// between all sockets in the same group, such as those of other
+// spindump processes. The state's addresses are used in compiling
+// the filter, and need to have been set. Returns 1 upon success, and
+// 0 upon failure.
+//
+
+int
+spindump_capture_afpacket_open(struct spindump_capture_state* state,
+                               const char* interface,
+                               const char* filter,
+                               unsigned int snaplen,
+                               unsigned int fanoutGroup) {
+
+  struct spindump_capture_ring* ring = &state->ring;
+  memset(ring,0,sizeof(*ring));
+  ring->fd = -1;
+  ring->snaplen = snaplen;
+
+#if defined(__linux__)
+
+  //
+  // Find the interface and open the socket. The socket is opened with
+  // no protocol, so that it receives nothing until it is bound to the
+  // interface below; otherwise packets from all interfaces could get
+  // to the ring in the meantime.
+  //
+
+  unsigned int ifindex = if_nametoindex(interface);
+  if (ifindex == 0) {
+    spindump_errorf("couldn't find device %s: %s", interface, strerror(errno));
+    return(0);
+  }
+
+  ring->fd = socket(AF_PACKET,SOCK_RAW,0);
+  if (ring->fd < 0) {
+    spindump_errorf("couldn't open a packet socket for device %s: %s", interface, strerror(errno));
+    return(0);
+  }
+
+  //
+  // Determine what link layer headers we will see
+  //
+
+  struct ifreq ifr;
+  memset(&ifr,0,sizeof(ifr));
+  strncpy(ifr.ifr_name,interface,sizeof(ifr.ifr_name) - 1);
+  if (ioctl(ring->fd,SIOCGIFHWADDR,&ifr) < 0) {
+    spindump_errorf("couldn't get the link type of device %s: %s", interface, strerror(errno));
+    spindump_capture_afpacket_close(ring);
+    return(0);
+  }
+
+  int dlt;
+  switch (ifr.ifr_hwaddr.sa_family) {
+  case ARPHRD_LOOPBACK:
+    ring->loopback = 1;
+    state->linktype = spindump_capture_linktype_ethernet;
+    dlt = DLT_EN10MB;
+    break;
+  case ARPHRD_ETHER:
+    state->linktype = spindump_capture_linktype_ethernet;
+    dlt = DLT_EN10MB;
+    break;
+  case ARPHRD_NONE:
+    state->linktype = spindump_capture_linktype_raw;
+    dlt = DLT_RAW;
+    break;
+  default:
+    spindump_errorf("device %s link type %u not supported by the AF_PACKET capture",
+                    interface, ifr.ifr_hwaddr.sa_family);
+    spindump_capture_afpacket_close(ring);
+    return(0);
+  }
+
+  //
+  // Install the filter before binding, so that no unfiltered packets
+  // get to the ring
+  //
+
+  if (!spindump_capture_afpacket_setfilter(ring,
+                                           filter != 0 ? filter : "",
+                                           dlt,
+                                           snaplen,
+                                           state->ourNetmask) ||
+      !spindump_capture_afpacket_setring(ring)) {
+    spindump_capture_afpacket_close(ring);
+    return(0);
+  }
+
+  //
+  // Bind to the interface, which also starts the reception of all
+  // protocols, and join the fanout group, if any
+  //
+
+  struct sockaddr_ll address;
+  memset(&address,0,sizeof(address));
+  address.sll_family = AF_PACKET;
+  address.sll_protocol = htons(ETH_P_ALL);
+  address.sll_ifindex = (int)ifindex;
+  if (bind(ring->fd,(struct sockaddr*)&address,sizeof(address)) < 0) {
+    spindump_errorf("couldn't bind the packet socket to device %s: %s", interface, strerror(errno));
+    spindump_capture_afpacket_close(ring);
+    return(0);
+  }
+
+  if (fanoutGroup != 0) {
+    int fanout = (int)((fanoutGroup & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16));
+    if (setsockopt(ring->fd,SOL_PACKET,PACKET_FANOUT,&fanout,sizeof(fanout)) < 0) {
+      spindump_errorf("couldn't join fanout group %u on device %s: %s",
+                      fanoutGroup, interface, strerror(errno));
+      spindump_capture_afpacket_close(ring);
+      return(0);
+    }
+  }
+
+  spindump_debugf("AF_PACKET capture on %s initialized, %u blocks of %u bytes",
+                  interface, ring->nBlocks, ring->blockSize);
+  return(1);
+
+#else
+
+  spindump_errorf("AF_PACKET capture is not supported on this platform (device %s, group %u, filter %s)",
+                  interface, fanoutGroup, filter != 0 ? filter : "");
+  return(0);
+
+#endif
+}
+
+//
+// Get the next packet from the ring. The packet contents point to the
+// ring, and remain valid until the block they are in is released.
+//
+// If mayRelease is set, and all packets of the current block have
+// been returned, the block is released and packets are taken from
+// the next block, waiting for a short while for the kernel to fill
+// it if needed. Otherwise, only packets in the current block are
+// returned. Returns 1 if a packet was returned, and 0 if not.
+//
+
+int
+spindump_capture_afpacket_next(struct spindump_capture_ring* ring,
+                               struct spindump_packet* packet,
+                               int mayRelease) {
+
+#if defined(__linux__)
+
+  for (;;) {
+
+    //
+    // Move to the next block, if the current one has been read
+    //
+
+    if (ring->packetsLeft == 0) {
+      if (!mayRelease) return(0);
+      spindump_capture_afpacket_release(ring);
+      struct tpacket_block_desc* block =
+        (struct tpacket_block_desc*)(ring->map + (size_t)ring->currentBlock * ring->blockSize);
+      if ((__atomic_load_n(&block->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+        struct pollfd pfd;
+        pfd.fd = ring->fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        poll(&pfd,1,spindump_capture_wait_select / 1000);
+        if ((__atomic_load_n(&block->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+          return(0);
+        }
+      }
+      ring->blockHeld = 1;
+      ring->packetsLeft = block->hdr.bh1.num_pkts;
+      ring->nextFrame = (uint8_t*)block + block->hdr.bh1.offset_to_first_pkt;
+      continue;
+    }
+
+    //
+    // Take the next packet in the block. On loopback, the kernel
+    // delivers both the outgoing and incoming copy of each packet, so
+    // skip the outgoing ones, as PCAP does.
+    //
+
+    const struct tpacket3_hdr* frame = (const struct tpacket3_hdr*)ring->nextFrame;
+    ring->nextFrame += frame->tp_next_offset;
+    ring->packetsLeft--;
+    if (ring->loopback) {
+      const struct sockaddr_ll* link =
+        (const struct sockaddr_ll*)((const uint8_t*)frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+      if (link->sll_pkttype == PACKET_OUTGOING) continue;
+    }
+
+    memset(packet,0,sizeof(*packet));
+    packet->timestamp.tv_sec = (time_t)frame->tp_sec;
+    packet->timestamp.tv_usec = (suseconds_t)(frame->tp_nsec / 1000);
+    packet->contents = (const unsigned char*)frame + frame->tp_mac;
+    packet->etherlen = frame->tp_len;
+    packet->caplen = spindump_min(frame->tp_snaplen,ring->snaplen);
+    return(1);
+  }
+
+#else
+
+  spindump_assert(packet != 0);
+  spindump_assert(spindump_isbool(mayRelease));
+  return(0);
+
+#endif
+}
+
+//
+// Give the current block back to the kernel, if all of its packets
+// have been returned
+//
+
+void
+spindump_capture_afpacket_release(struct spindump_capture_ring* ring) {
+#if defined(__linux__)
+  if (!ring->blockHeld || ring->packetsLeft > 0) return;
+  struct tpacket_block_desc* block =
+    (struct tpacket_block_desc*)(ring->map + (size_t)ring->currentBlock * ring->blockSize);
+  __atomic_store_n(&block->hdr.bh1.block_status,TP_STATUS_KERNEL,__ATOMIC_RELEASE);
+  ring->blockHeld = 0;
+  ring->currentBlock = (ring->currentBlock + 1) % ring->nBlocks;
+#else
+  spindump_assert(!ring->blockHeld);
+#endif
+}
+
+//
+// Unmap the ring and close the socket
+//
+
+void
+spindump_capture_afpacket_close(struct spindump_capture_ring* ring) {
+#if defined(__linux__)
+  if (ring->fd >= 0) {
+    struct tpacket_stats_v3 kernelStats;
+    socklen_t length = sizeof(kernelStats);
+    memset(&kernelStats,0,sizeof(kernelStats));
+    if (getsockopt(ring->fd,SOL_PACKET,PACKET_STATISTICS,&kernelStats,&length) == 0) {
+      spindump_debugf("AF_PACKET capture received %u packets, dropped %u, ring full %u times",
+                      kernelStats.tp_packets, kernelStats.tp_drops, kernelStats.tp_freeze_q_cnt);
+    }
+  }
+  if (ring->map != 0) {
+    munmap(ring->map,ring->mapSize);
+  }
+#endif
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring,0,sizeof(*ring));
+  ring->fd = -1;
+}
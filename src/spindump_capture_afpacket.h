@@ -0,0 +1,49 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+#ifndef SPINDUMP_CAPTURE_AFPACKET_H
+#define SPINDUMP_CAPTURE_AFPACKET_H
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include "spindump_util.h"
+#include "spindump_packet.h"
+#include "spindump_capture.h"
+
+//
+// Internal API interface to this module ------------------------------------------------------
+//
+
+int
+spindump_capture_afpacket_open(struct spindump_capture_state* state,
+                               const char* interface,
+                               const char* filter,
+                               unsigned int snaplen,
+                               unsigned int fanoutGroup);
+int
+spindump_capture_afpacket_next(struct spindump_capture_ring* ring,
+                               struct spindump_packet* packet,
+                               int mayRelease);
+void
+spindump_capture_afpacket_release(struct spindump_capture_ring* ring);
+void
+spindump_capture_afpacket_close(struct spindump_capture_ring* ring);
+
+#endif // SPINDUMP_CAPTURE_AFPACKET_H
@@ -40,10 +40,6 @@
 // Function prototypes ------------------------------------------------------------------------
 //
 
-static struct spindump_connection*
-spindump_connections_search_network(const spindump_address *address,
-                                    const struct spindump_connection_network* networkv,
-                                    unsigned int networkc);
 static int
 spindump_connections_setisclosed(const struct spindump_connection_set* set);
 static int
@@ -82,17 +78,21 @@ spindump_connections_lastaction(struct spindump_connection* connection,
 //
 // Mark a connection for later deletion (e.g., based on being closed
 // in the protocol). It is not immediately dweleted, because there may
-// be still packets in flight related to the connection.
+// be still packets in flight related to the connection. The
+// connection will now time out sooner, so it is moved in the table's
+// timer wheel.
 //
 
 void
-spindump_connections_markconnectiondeleted(struct spindump_connection* connection) {
+spindump_connections_markconnectiondeleted(struct spindump_connection* connection,
+                                           struct spindump_connectionstable* table) {
   
   //
   // Do some checks & print debugs
   //
 
   spindump_assert(connection != 0);
+  spindump_assert(table != 0);
   spindump_debugf("marking connection %u deleted", connection->id);
   
   //
@@ -100,6 +100,7 @@ spindump_connections_markconnectiondeleted(struct spindump_connection* connectio
   //
   
   connection->deleted = 1;
+  spindump_connectionstable_scheduleconnection(connection,table);
 }
 
 //
@@ -111,8 +112,8 @@ spindump_connections_markconnectiondeleted(struct spindump_connection* connectio
 
 void
 spindump_connections_getaddresses(struct spindump_connection* connection,
-                                  spindump_address** p_side1address,
-                                  spindump_address** p_side2address) {
+                                  spindump_compactaddress** p_side1address,
+                                  spindump_compactaddress** p_side2address) {
 
   spindump_assert(connection != 0);
   spindump_assert(p_side1address != 0);
@@ -187,8 +188,8 @@ spindump_connections_getaddresses(struct spindump_connection* connection,
 
 void
 spindump_connections_getnetworks(struct spindump_connection* connection,
-                                 spindump_network* p_side1network,
-                                 spindump_network* p_side2network) {
+                                 spindump_compactnetwork* p_side1network,
+                                 spindump_compactnetwork* p_side2network) {
 
   spindump_assert(connection != 0);
   spindump_assert(p_side1network != 0);
@@ -196,39 +197,39 @@ spindump_connections_getnetworks(struct spindump_connection* connection,
   
   switch (connection->type) {
   case spindump_connection_transport_tcp:
-    spindump_network_fromaddress(&connection->u.tcp.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.tcp.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.tcp.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.tcp.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_sctp:
-    spindump_network_fromaddress(&connection->u.sctp.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.sctp.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.sctp.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.sctp.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_udp:
-    spindump_network_fromaddress(&connection->u.udp.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.udp.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.udp.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.udp.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_dns:
-    spindump_network_fromaddress(&connection->u.dns.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.dns.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.dns.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.dns.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_coap:
-    spindump_network_fromaddress(&connection->u.coap.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.coap.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.coap.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.coap.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_quic:
-    spindump_network_fromaddress(&connection->u.quic.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.quic.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.quic.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.quic.side2peerAddress,p_side2network);
     break;
   case spindump_connection_transport_icmp:
-    spindump_network_fromaddress(&connection->u.icmp.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.icmp.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.icmp.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.icmp.side2peerAddress,p_side2network);
     break;
   case spindump_connection_aggregate_hostpair:
-    spindump_network_fromaddress(&connection->u.aggregatehostpair.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.aggregatehostpair.side2peerAddress,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatehostpair.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatehostpair.side2peerAddress,p_side2network);
     break;
   case spindump_connection_aggregate_hostnetwork:
-    spindump_network_fromaddress(&connection->u.aggregatehostnetwork.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatehostnetwork.side1peerAddress,p_side1network);
     *p_side2network = connection->u.aggregatehostnetwork.side2Network;
     break;
   case spindump_connection_aggregate_networknetwork:
@@ -236,22 +237,22 @@ spindump_connections_getnetworks(struct spindump_connection* connection,
     *p_side2network = connection->u.aggregatenetworknetwork.side2Network;
     break;
   case spindump_connection_aggregate_hostmultinet:
-    spindump_network_fromaddress(&connection->u.aggregatehostmultinet.side1peerAddress,p_side1network);
-    spindump_network_fromaddress(&connection->u.aggregatehostmultinet.identifier,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatehostmultinet.side1peerAddress,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatehostmultinet.identifier,p_side2network);
     break;
   case spindump_connection_aggregate_networkmultinet:
     *p_side1network = connection->u.aggregatenetworkmultinet.side1Network;
-    spindump_network_fromaddress(&connection->u.aggregatenetworkmultinet.identifier,p_side2network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatenetworkmultinet.identifier,p_side2network);
     break;
   case spindump_connection_aggregate_multicastgroup:
-    spindump_network_fromempty(AF_INET,p_side1network);
-    spindump_network_fromaddress(&connection->u.aggregatemulticastgroup.group,p_side2network);
+    spindump_compactnetwork_fromempty(AF_INET,p_side1network);
+    spindump_compactnetwork_fromaddress(&connection->u.aggregatemulticastgroup.group,p_side2network);
     break;
   default:
     spindump_errorf("invalid connection type %u in spindump_connections_getaddresses",
                     connection->type);
-    spindump_network_fromempty(AF_INET,p_side1network);
-    spindump_network_fromempty(AF_INET,p_side2network);
+    spindump_compactnetwork_fromempty(AF_INET,p_side1network);
+    spindump_compactnetwork_fromempty(AF_INET,p_side2network);
     break;
   }
 }
@@ -397,45 +398,48 @@ spindump_connections_newrttmeasurement(struct spindump_analyze* state,
   //
   
   spindump_deepdeepdebugf("newrtt point 2 (uni %u right %u)", unidirectional, right);
+  struct spindump_connection_cold* cold = spindump_connections_getcold(connection,state->table);
+  if (cold == 0) return(0);
   if (unidirectional) {
     if (right) {
-      ret = spindump_rtt_newmeasurement(&connection->respToInitFullRTT,diff);
+      ret = spindump_rtt_newmeasurement(&cold->respToInitFullRTT,diff);
       spindump_debugf("due to %s new calculated full RTT from responder = %lu us for connection %u",
-                      why, connection->respToInitFullRTT.lastRTT, connection->id);
+                      why, cold->respToInitFullRTT.lastRTT, connection->id);
     } else {
-      ret = spindump_rtt_newmeasurement(&connection->initToRespFullRTT,diff);
+      ret = spindump_rtt_newmeasurement(&cold->initToRespFullRTT,diff);
       spindump_debugf("due to %s new calculated full RTT from initiator = %lu us for connection %u",
-                      why, connection->initToRespFullRTT.lastRTT, connection->id);
+                      why, cold->initToRespFullRTT.lastRTT, connection->id);
     }
   } else {
     if (right) {
-      ret = spindump_rtt_newmeasurement(&connection->rightRTT,diff);
+      ret = spindump_rtt_newmeasurement(&cold->rightRTT,diff);
+      spindump_histogram_record(&cold->rightRTTPeriod,cold->rightRTT.lastRTT);
       spindump_debugf("due to %s new calculated right RTT = %lu us for connection %u",
-                      why, connection->rightRTT.lastRTT, connection->id);
+                      why, cold->rightRTT.lastRTT, connection->id);
     } else {
-      ret = spindump_rtt_newmeasurement(&connection->leftRTT,diff);
+      ret = spindump_rtt_newmeasurement(&cold->leftRTT,diff);
       spindump_debugf("due to %s new calculated left RTT = %lu us for connection %u",
-                      why, connection->leftRTT.lastRTT, connection->id);
+                      why, cold->leftRTT.lastRTT, connection->id);
     }
   }
   
   //
-  // Call some handlers, if any, for the new measurements
+  // Call some handlers, if any, for the new measurements. If
+  // aggregate updates are deferred, events for an aggregate are
+  // held until the next fold.
   //
   
+  spindump_analyze_event event;
   if (unidirectional) {
-    spindump_analyze_process_handlers(state,
-                                      (right ? spindump_analyze_event_newrespinitfullrttmeasurement :
-                                       spindump_analyze_event_newinitrespfullrttmeasurement),
-                                      rcvd,
-                                      right,
-                                      ipPacketLength,
-                                      packet,
-                                      connection);
+    event = (right ? spindump_analyze_event_newrespinitfullrttmeasurement :
+             spindump_analyze_event_newinitrespfullrttmeasurement);
   } else {
+    event = (right ? spindump_analyze_event_newrightrttmeasurement :
+             spindump_analyze_event_newleftrttmeasurement);
+  }
+  if (!spindump_connectionstable_rollup_deferevent(state->table,connection,event,rcvd,ipPacketLength)) {
     spindump_analyze_process_handlers(state,
-                                      (right ? spindump_analyze_event_newrightrttmeasurement :
-                                       spindump_analyze_event_newleftrttmeasurement),
+                                      event,
                                       rcvd,
                                       right,
                                       ipPacketLength,
@@ -445,7 +449,10 @@ spindump_connections_newrttmeasurement(struct spindump_analyze* state,
   
   //
   // Loop through any possible aggregated connections this connection
-  // belongs to, and report the same measurement udpates there.
+  // belongs to, and report the same measurement udpates there. If
+  // the aggregates are shared with other worker threads, the
+  // measurements are logged, to be applied later in the order of the
+  // packets.
   //
 
   struct spindump_connection_set_iterator iter;
@@ -455,6 +462,19 @@ spindump_connections_newrttmeasurement(struct spindump_analyze* state,
 
     struct spindump_connection* aggregate = spindump_connection_set_iterator_next(&iter);
     spindump_assert(aggregate != 0);
+    if (state->table->shared.lock != 0) {
+      spindump_connectionstable_shared_rtt(state->table,
+                                           aggregate,
+                                           ipPacketLength,
+                                           right,
+                                           unidirectional,
+                                           sent,
+                                           rcvd,
+                                           why,
+                                           packet != 0 &&
+                                           packet->analyzerHandlerCalls != state->stats->analyzerHandlerCalls);
+      continue;
+    }
     spindump_connections_newrttmeasurement(state,
                                            packet,
                                            aggregate,
@@ -474,54 +494,17 @@ spindump_connections_newrttmeasurement(struct spindump_analyze* state,
   return(ret);
 }
 
-//
-// Binary-search a network matching an address and return the aggregate where
-// the network belongs to.
-//
-
-static struct spindump_connection*
-spindump_connections_search_network(const spindump_address *address,
-                                    const struct spindump_connection_network* networkv,
-                                    unsigned int networkc)
-{
-  const struct spindump_connection_network* nw;
-  unsigned int half;
-
-  if (networkc <= 0)
-    return(0);
-
-  half = networkc / 2;
-  nw = &networkv[half];
-
-  if (spindump_address_compare(address, &nw->side2Network.address) < 0) {
-    if (half <= 0)
-      return(0);
-    return spindump_connections_search_network(address, networkv, half);
-
-  } else if (spindump_address_innetwork(address, &nw->side2Network)) {
-    return nw->connection;
-
-  } else {
-    if (half + 1>= networkc)
-      return(0);
-    return spindump_connections_search_network(address, networkv + half, networkc - half);
-  }
-}
-
 //
 // Is a given set of connections all closed?
 //
 
 static int
 spindump_connections_setisclosed(const struct spindump_connection_set* set) {
-  unsigned int i;
-
-  for (i = 0; i < set->nConnections; i++) {
-    struct spindump_connection* other = set->set[i];
-    if (other != 0) {
-      if (!spindump_connections_isclosed(other)) {
-        return(0);
-      }
+  for (const struct spindump_connection_setentry* entry = set->first;
+       entry != 0;
+       entry = entry->next) {
+    if (!spindump_connections_isclosed(entry->connection)) {
+      return(0);
     }
   }
   return(1);
@@ -558,14 +541,11 @@ spindump_connections_isclosed(const struct spindump_connection* connection) {
 
 static int
 spindump_connections_setisestablishing(const struct spindump_connection_set* set) {
-  unsigned int i;
-
-  for (i = 0; i < set->nConnections; i++) {
-    struct spindump_connection* other = set->set[i];
-    if (other != 0) {
-      if (!spindump_connections_isestablishing(other)) {
-        return(0);
-      }
+  for (const struct spindump_connection_setentry* entry = set->first;
+       entry != 0;
+       entry = entry->next) {
+    if (!spindump_connections_isestablishing(entry->connection)) {
+      return(0);
     }
   }
   return(1);
@@ -637,6 +617,40 @@ spindump_connections_isaggregate_simple(const struct spindump_connection* connec
     connection->type != spindump_connection_aggregate_networkmultinet;
 }
 
+//
+// Return the cold part of a connection for reading. A connection
+// that does not yet have a cold part has not had any RTT
+// measurements, and we return an empty cold part for it. Callers
+// still may recalculate the RTT averages in the returned object, but
+// for an RTT without measurements that changes nothing.
+//
+
+struct spindump_connection_cold*
+spindump_connections_peekcold(struct spindump_connection* connection) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(connection != 0);
+  if (connection->cold != 0) return(connection->cold);
+
+  //
+  // Return an empty cold part. Each thread has its own copy, so that
+  // the lazy initialization does not race.
+  //
+
+  static _Thread_local struct spindump_connection_cold empty;
+  static _Thread_local int emptyInitialized = 0;
+  if (!emptyInitialized) {
+    memset(&empty,0,sizeof(empty));
+    spindump_rtt_initialize(&empty.leftRTT);
+    spindump_rtt_initialize(&empty.rightRTT);
+    emptyInitialized = 1;
+  }
+  return(&empty);
+}
+
 //
 // Return the set of connections that this aggregate connection
 // consists of.
@@ -655,11 +669,12 @@ spindump_connections_aggregateset(const struct spindump_connection* connection)
 
   //
   // In some cases we need to return an empty set. For that we have a
-  // static variable that we can return.
+  // static variable that we can return. Each thread has its own copy,
+  // so that the lazy initialization does not race.
   //
 
-  static struct spindump_connection_set empty;
-  static int emptyInitialized = 0;
+  static _Thread_local struct spindump_connection_set empty;
+  static _Thread_local int emptyInitialized = 0;
   if (!emptyInitialized) {
     spindump_connections_set_initialize(&empty);
     emptyInitialized = 1;
@@ -707,8 +722,8 @@ spindump_connections_matches_aggregate_connection(int seenMatch,
                                                   struct spindump_connection* connection,
                                                   struct spindump_connection* aggregate) {
 
-  spindump_address* side1address = 0;
-  spindump_address* side2address = 0;
+  spindump_compactaddress* side1address = 0;
+  spindump_compactaddress* side2address = 0;
   spindump_connections_getaddresses(connection,
                                     &side1address,
                                     &side2address);
@@ -724,22 +739,22 @@ spindump_connections_matches_aggregate_connection(int seenMatch,
 
   case spindump_connection_aggregate_hostpair:
     spindump_deepdebugf("comparing addresses");
-    spindump_deepdebugf("  side1address %s",spindump_address_tostring(side1address));
-    spindump_deepdebugf("  side2address %s",spindump_address_tostring(side2address));
+    spindump_deepdebugf("  side1address %s",spindump_compactaddress_tostring(side1address));
+    spindump_deepdebugf("  side2address %s",spindump_compactaddress_tostring(side2address));
     spindump_deepdebugf("  hostpair side1 address %s",
-                        spindump_address_tostring(&aggregate->u.aggregatehostpair.side1peerAddress));
+                        spindump_compactaddress_tostring(&aggregate->u.aggregatehostpair.side1peerAddress));
     spindump_deepdebugf("  hostpair side2 address %s",
-                        spindump_address_tostring(&aggregate->u.aggregatehostpair.side2peerAddress));
-    return((spindump_address_equal(side1address,&aggregate->u.aggregatehostpair.side1peerAddress) &&
-            spindump_address_equal(side2address,&aggregate->u.aggregatehostpair.side2peerAddress)) ||
-           (spindump_address_equal(side1address,&aggregate->u.aggregatehostpair.side2peerAddress) &&
-            spindump_address_equal(side2address,&aggregate->u.aggregatehostpair.side1peerAddress)));
+                        spindump_compactaddress_tostring(&aggregate->u.aggregatehostpair.side2peerAddress));
+    return((spindump_compactaddress_equal(side1address,&aggregate->u.aggregatehostpair.side1peerAddress) &&
+            spindump_compactaddress_equal(side2address,&aggregate->u.aggregatehostpair.side2peerAddress)) ||
+           (spindump_compactaddress_equal(side1address,&aggregate->u.aggregatehostpair.side2peerAddress) &&
+            spindump_compactaddress_equal(side2address,&aggregate->u.aggregatehostpair.side1peerAddress)));
 
   case spindump_connection_aggregate_hostnetwork:
-    return((spindump_address_equal(side1address,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
-            spindump_address_innetwork(side2address,&aggregate->u.aggregatehostnetwork.side2Network)) ||
-           (spindump_address_innetwork(side1address,&aggregate->u.aggregatehostnetwork.side2Network) &&
-            spindump_address_equal(side2address,&aggregate->u.aggregatehostnetwork.side1peerAddress)));
+    return((spindump_compactaddress_equal(side1address,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
+            spindump_compactaddress_innetwork(side2address,&aggregate->u.aggregatehostnetwork.side2Network)) ||
+           (spindump_compactaddress_innetwork(side1address,&aggregate->u.aggregatehostnetwork.side2Network) &&
+            spindump_compactaddress_equal(side2address,&aggregate->u.aggregatehostnetwork.side1peerAddress)));
 
   case spindump_connection_aggregate_networknetwork:
     spindump_deepdeepdebugf("networknetwork aggragate seen match %u default match %u",
@@ -749,17 +764,17 @@ spindump_connections_matches_aggregate_connection(int seenMatch,
       return(0);
     } else {
       int testval =
-        (spindump_address_innetwork(side1address,&aggregate->u.aggregatenetworknetwork.side1Network) &&
-         spindump_address_innetwork(side2address,&aggregate->u.aggregatenetworknetwork.side2Network)) ||
-        (spindump_address_innetwork(side1address,&aggregate->u.aggregatenetworknetwork.side2Network) &&
-         spindump_address_innetwork(side2address,&aggregate->u.aggregatenetworknetwork.side1Network));
+        (spindump_compactaddress_innetwork(side1address,&aggregate->u.aggregatenetworknetwork.side1Network) &&
+         spindump_compactaddress_innetwork(side2address,&aggregate->u.aggregatenetworknetwork.side2Network)) ||
+        (spindump_compactaddress_innetwork(side1address,&aggregate->u.aggregatenetworknetwork.side2Network) &&
+         spindump_compactaddress_innetwork(side2address,&aggregate->u.aggregatenetworknetwork.side1Network));
       spindump_deepdeepdebugf("return test val = %u", testval);
       return(testval);
     }
     
   case spindump_connection_aggregate_multicastgroup:
-    return(spindump_address_equal(side1address,&aggregate->u.aggregatemulticastgroup.group) ||
-           spindump_address_equal(side2address,&aggregate->u.aggregatemulticastgroup.group));
+    return(spindump_compactaddress_equal(side1address,&aggregate->u.aggregatemulticastgroup.group) ||
+           spindump_compactaddress_equal(side2address,&aggregate->u.aggregatemulticastgroup.group));
 
   case spindump_connection_transport_tcp:
   case spindump_connection_transport_sctp:
@@ -789,8 +804,8 @@ spindump_connections_matches_aggregate_connection(int seenMatch,
 //
 
 int
-spindump_connections_matches_aggregate_srcdst(const spindump_address* source,
-                                              const spindump_address* destination,
+spindump_connections_matches_aggregate_srcdst(const spindump_compactaddress* source,
+                                              const spindump_compactaddress* destination,
                                               struct spindump_connection* aggregate) {
   spindump_assert(aggregate != 0);
   spindump_assert(spindump_connections_isaggregate_simple(aggregate));
@@ -808,26 +823,26 @@ spindump_connections_matches_aggregate_srcdst(const spindump_address* source,
     return(0);
     
   case spindump_connection_aggregate_hostpair:
-    return((spindump_address_equal(source,&aggregate->u.aggregatehostpair.side1peerAddress) &&
-            spindump_address_equal(destination,&aggregate->u.aggregatehostpair.side2peerAddress)) ||
-           (spindump_address_equal(destination,&aggregate->u.aggregatehostpair.side1peerAddress) &&
-            spindump_address_equal(source,&aggregate->u.aggregatehostpair.side2peerAddress)));
+    return((spindump_compactaddress_equal(source,&aggregate->u.aggregatehostpair.side1peerAddress) &&
+            spindump_compactaddress_equal(destination,&aggregate->u.aggregatehostpair.side2peerAddress)) ||
+           (spindump_compactaddress_equal(destination,&aggregate->u.aggregatehostpair.side1peerAddress) &&
+            spindump_compactaddress_equal(source,&aggregate->u.aggregatehostpair.side2peerAddress)));
 
   case spindump_connection_aggregate_hostnetwork:
-    return((spindump_address_equal(source,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
-            spindump_address_innetwork(destination,&aggregate->u.aggregatehostnetwork.side2Network)) ||
-           (spindump_address_equal(destination,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
-            spindump_address_innetwork(source,&aggregate->u.aggregatehostnetwork.side2Network)));
+    return((spindump_compactaddress_equal(source,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
+            spindump_compactaddress_innetwork(destination,&aggregate->u.aggregatehostnetwork.side2Network)) ||
+           (spindump_compactaddress_equal(destination,&aggregate->u.aggregatehostnetwork.side1peerAddress) &&
+            spindump_compactaddress_innetwork(source,&aggregate->u.aggregatehostnetwork.side2Network)));
 
   case spindump_connection_aggregate_networknetwork:
-    return((spindump_address_innetwork(source,&aggregate->u.aggregatenetworknetwork.side1Network) &&
-            spindump_address_innetwork(destination,&aggregate->u.aggregatenetworknetwork.side2Network)) ||
-           (spindump_address_innetwork(destination,&aggregate->u.aggregatenetworknetwork.side1Network) &&
-            spindump_address_innetwork(source,&aggregate->u.aggregatenetworknetwork.side2Network)));
+    return((spindump_compactaddress_innetwork(source,&aggregate->u.aggregatenetworknetwork.side1Network) &&
+            spindump_compactaddress_innetwork(destination,&aggregate->u.aggregatenetworknetwork.side2Network)) ||
+           (spindump_compactaddress_innetwork(destination,&aggregate->u.aggregatenetworknetwork.side1Network) &&
+            spindump_compactaddress_innetwork(source,&aggregate->u.aggregatenetworknetwork.side2Network)));
 
   case spindump_connection_aggregate_multicastgroup:
-    return(spindump_address_equal(source,&aggregate->u.aggregatemulticastgroup.group) ||
-           spindump_address_equal(destination,&aggregate->u.aggregatemulticastgroup.group));
+    return(spindump_compactaddress_equal(source,&aggregate->u.aggregatemulticastgroup.group) ||
+           spindump_compactaddress_equal(destination,&aggregate->u.aggregatemulticastgroup.group));
 
   case spindump_connection_aggregate_hostmultinet:
   case spindump_connection_aggregate_networkmultinet:
@@ -843,73 +858,20 @@ spindump_connections_matches_aggregate_srcdst(const spindump_address* source,
 
 //
 // Match a connection against the side 2 networks of all hostmultnet or networkmultinet
-// type aggregates and return the matching aggregate, if any.
+// type aggregates and return the matching aggregate, if any. The
+// destination is looked up first, and then the source.
 //
 
 struct spindump_connection*
-spindump_connections_match_multinet(const spindump_address* source,
-                                    const spindump_address* destination,
+spindump_connections_match_multinet(const spindump_compactaddress* source,
+                                    const spindump_compactaddress* destination,
                                     struct spindump_connectionstable* table)
 {
   struct spindump_connection* aggregate;
 
-  aggregate = spindump_connections_search_network(destination, table->networks, table->nNetworks);
-
-  if (aggregate) {
-    switch (aggregate->type) {
-    case spindump_connection_aggregate_hostmultinet:
-      if (spindump_address_equal(source,&aggregate->u.aggregatehostmultinet.side1peerAddress))
-        return aggregate;
-      break;
-    case spindump_connection_aggregate_networkmultinet:
-      if (spindump_address_innetwork(source,&aggregate->u.aggregatenetworkmultinet.side1Network))
-        return aggregate;
-      break;
-    case spindump_connection_transport_tcp:
-    case spindump_connection_transport_udp:
-    case spindump_connection_transport_dns:
-    case spindump_connection_transport_coap:
-    case spindump_connection_transport_quic:
-    case spindump_connection_transport_icmp:
-    case spindump_connection_transport_sctp:
-    case spindump_connection_aggregate_hostpair:
-    case spindump_connection_aggregate_hostnetwork:
-    case spindump_connection_aggregate_networknetwork:
-    case spindump_connection_aggregate_multicastgroup:
-    default:
-      spindump_assert(0);
-    }
-  }
-
-  aggregate = spindump_connections_search_network(source, table->networks, table->nNetworks);
-
-  if (aggregate) {
-    switch (aggregate->type) {
-    case spindump_connection_aggregate_hostmultinet:
-      if (spindump_address_equal(destination,&aggregate->u.aggregatehostmultinet.side1peerAddress))
-        return aggregate;
-      break;
-    case spindump_connection_aggregate_networkmultinet:
-      if (spindump_address_innetwork(destination,&aggregate->u.aggregatenetworkmultinet.side1Network))
-        return aggregate;
-      break;
-    case spindump_connection_transport_tcp:
-    case spindump_connection_transport_udp:
-    case spindump_connection_transport_dns:
-    case spindump_connection_transport_coap:
-    case spindump_connection_transport_quic:
-    case spindump_connection_transport_icmp:
-    case spindump_connection_transport_sctp:
-    case spindump_connection_aggregate_hostpair:
-    case spindump_connection_aggregate_hostnetwork:
-    case spindump_connection_aggregate_networknetwork:
-    case spindump_connection_aggregate_multicastgroup:
-    default:
-      spindump_assert(0);
-    }
-  }
-
-  return (0);
+  aggregate = spindump_connectionstable_prefixes_multinet(&table->prefixes,destination,source);
+  if (aggregate) return(aggregate);
+  return(spindump_connectionstable_prefixes_multinet(&table->prefixes,source,destination));
 }
 
 //
@@ -930,6 +892,12 @@ spindump_connections_changeidentifiers(struct spindump_analyze* state,
   spindump_assert(connection != 0);
   spindump_deepdeepdebugf("spindump_connections_changeidentifiers");
   
+  //
+  // Update the table indexes to find the connection with the new identifiers
+  //
+  
+  spindump_connectionstable_reindexconnection(connection,state->table);
+  
   //
   // Let all interested handlers know about this change
   //
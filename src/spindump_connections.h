@@ -48,7 +48,8 @@ struct spindump_connection_set;
 //
 
 void
-spindump_connections_markconnectiondeleted(struct spindump_connection* connection);
+spindump_connections_markconnectiondeleted(struct spindump_connection* connection,
+                                           struct spindump_connectionstable* table);
 void
 spindump_connections_changeidentifiers(struct spindump_analyze* state,
                                        struct spindump_packet* packet,
@@ -61,7 +62,13 @@ spindump_connections_changestate(struct spindump_analyze* state,
                                  struct spindump_connection* connection,
                                  enum spindump_connection_state newState);
 void
-spindump_connections_delete(struct spindump_connection* connection);
+spindump_connections_delete(struct spindump_connection* connection,
+                            struct spindump_connectionstable* table);
+struct spindump_connection_cold*
+spindump_connections_getcold(struct spindump_connection* connection,
+                             struct spindump_connectionstable* table);
+struct spindump_connection_cold*
+spindump_connections_peekcold(struct spindump_connection* connection);
 struct spindump_connection*
 spindump_connections_newconnection(struct spindump_connectionstable* table,
                                    enum spindump_connection_type type,
@@ -157,6 +164,10 @@ spindump_connections_newconnection_aggregate_networkmultinet(const spindump_netw
                                                              const struct timeval* when,
                                                              int manuallyCreated,
                                                              struct spindump_connectionstable* table);
+void
+spindump_connections_newconnection_aggregate_addnetwork(struct spindump_connection* connection,
+                                                        const spindump_network* network,
+                                                        struct spindump_connectionstable* table);
 struct spindump_connection*
 spindump_connections_newconnection_aggregate_multicastgroup(const spindump_address* group,
                                                             const struct timeval* when,
@@ -307,12 +318,12 @@ spindump_connections_newrttmeasurement(struct spindump_analyze* state,
                                        const char* why);
 void
 spindump_connections_getaddresses(struct spindump_connection* connection,
-                                  spindump_address** p_side1address,
-                                  spindump_address** p_side2address);
+                                  spindump_compactaddress** p_side1address,
+                                  spindump_compactaddress** p_side2address);
 void
 spindump_connections_getnetworks(struct spindump_connection* connection,
-                                 spindump_network* p_side1network,
-                                 spindump_network* p_side2network);
+                                 spindump_compactnetwork* p_side1network,
+                                 spindump_compactnetwork* p_side2network);
 void
 spindump_connections_getports(struct spindump_connection* connection,
                               spindump_port* p_side1port,
@@ -340,12 +351,12 @@ spindump_connections_matches_aggregate_connection(int seenMatch,
                                                   struct spindump_connection* connection,
                                                   struct spindump_connection* aggregate);
 int
-spindump_connections_matches_aggregate_srcdst(const spindump_address* source,
-                                              const spindump_address* destination,
+spindump_connections_matches_aggregate_srcdst(const spindump_compactaddress* source,
+                                              const spindump_compactaddress* destination,
                                               struct spindump_connection* aggregate);
 struct spindump_connection*
-spindump_connections_match_multinet(const spindump_address* source,
-                                    const spindump_address* destination,
+spindump_connections_match_multinet(const spindump_compactaddress* source,
+                                    const spindump_compactaddress* destination,
                                     struct spindump_connectionstable* table);
 void
 spindump_connection_report(struct spindump_connection* connection,
@@ -22,6 +22,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
@@ -52,9 +53,20 @@ spindump_connections_newconnection_aux(struct spindump_connectionstable* table,
                                        enum spindump_connection_type type,
                                        const struct timeval* when,
                                        int manuallyCreated);
+static int
+spindump_connections_hastrackers(enum spindump_connection_type type);
+static void
+spindump_connections_cold_initialize(struct spindump_connection* connection,
+                                     struct spindump_connection_cold* cold);
+static void
+spindump_connections_cold_uninitialize(struct spindump_connection* connection,
+                                       struct spindump_connection_cold* cold);
 static void
 spindump_connections_newconnection_addtoaggregates(struct spindump_connection* connection,
                                                    struct spindump_connectionstable* table);
+static void
+spindump_connections_newconnection_admit(struct spindump_connection* connection,
+                                         struct spindump_connectionstable* table);
 //
 // Actual code --------------------------------------------------------------------------------
 //
@@ -74,17 +86,20 @@ spindump_connections_newconnection_aux(struct spindump_connectionstable* table,
                                        int manuallyCreated) {
 
   //
-  // Ensure connection fields are all set to 0s.
+  // Ensure connection fields are all set to 0s. The object only
+  // extends to the end of the union arm for this type.
   // 
   
-  memset(connection,0,sizeof(*connection));
+  memset(connection,0,spindump_connectionstable_pool_objectsize(type));
 
   //
-  // Generate a unique id for a connection, using a counter
+  // Generate a unique id for a connection, using a counter. The
+  // counter is shared by all analyzers, including those running in
+  // separate worker threads.
   // 
   
-  static unsigned int generatedIdCounter = 0;
-  connection->id = generatedIdCounter++;
+  static atomic_uint generatedIdCounter = 0;
+  connection->id = atomic_fetch_add_explicit(&generatedIdCounter,1,memory_order_relaxed);
   spindump_deepdeepdebugf("spindump_connections_newconnection_aux %u %s",
                           connection->id, spindump_connection_type_to_string(type));
   
@@ -102,55 +117,26 @@ spindump_connections_newconnection_aux(struct spindump_connectionstable* table,
   connection->packetsFromSide2 = 0;
   spindump_bandwidth_initialize(&connection->bytesFromSide1,table->bandwidthMeasurementPeriod);
   spindump_bandwidth_initialize(&connection->bytesFromSide2,table->bandwidthMeasurementPeriod);
-  spindump_rtt_initialize(&connection->leftRTT);
-  spindump_rtt_initialize(&connection->rightRTT);
   spindump_connections_set_initialize(&connection->aggregates);
   spindump_tags_copy(&connection->tags,&table->defaultTags);
   
   //
   // Do any initialization that is connection-type -dependent (e.g.,
-  // TCP connections need their sequence number trackers initialized
-  // properly).
+  // aggregates need their connection sets initialized properly). The
+  // protocol trackers are initialized along with the cold part of
+  // the connection.
   // 
   
   switch (type) {
 
   case spindump_connection_transport_tcp:
-    spindump_seqtracker_initialize(&connection->u.tcp.side1Seqs);
-    spindump_seqtracker_initialize(&connection->u.tcp.side2Seqs);
-    break;
-
   case spindump_connection_transport_sctp:
-    spindump_tsntracker_initialize(&connection->u.sctp.side1Seqs);
-    spindump_tsntracker_initialize(&connection->u.sctp.side2Seqs);
-    break;
-  
   case spindump_connection_transport_udp:
-    break;
-
   case spindump_connection_transport_dns:
-    spindump_messageidtracker_initialize(&connection->u.dns.side1MIDs);
-    spindump_messageidtracker_initialize(&connection->u.dns.side2MIDs);
-    break;
-
   case spindump_connection_transport_coap:
-    spindump_messageidtracker_initialize(&connection->u.coap.side1MIDs);
-    spindump_messageidtracker_initialize(&connection->u.coap.side2MIDs);
     break;
 
   case spindump_connection_transport_quic:
-    spindump_spintracker_initialize(&connection->u.quic.spinFromPeer1to2);
-    spindump_spintracker_initialize(&connection->u.quic.spinFromPeer2to1);
-    spindump_delaybittracker_initialize(&connection->u.quic.delaybitFromPeer1to2);
-    spindump_delaybittracker_initialize(&connection->u.quic.delaybitFromPeer2to1);
-    spindump_rtloss1tracker_initialize(&connection->u.quic.rtloss1FromPeer1to2);
-    spindump_rtloss1tracker_initialize(&connection->u.quic.rtloss1FromPeer2to1);
-    spindump_rtloss2tracker_initialize(&connection->u.quic.rtloss2FromPeer1to2);
-    spindump_rtloss2tracker_initialize(&connection->u.quic.rtloss2FromPeer2to1);
-    spindump_qrlosstracker_initialize(&connection->u.quic.qrFromPeer1to2);
-    spindump_qrlosstracker_initialize(&connection->u.quic.qrFromPeer2to1);
-    spindump_qllosstracker_initialize(&connection->u.quic.qlFromPeer1to2);
-    spindump_qllosstracker_initialize(&connection->u.quic.qlFromPeer2to1);
     connection->u.quic.side1initialPacket = *when;
     spindump_zerotime(&connection->u.quic.side2initialResponsePacket);
     connection->u.quic.initialRightRTT = spindump_rtt_infinite;
@@ -158,7 +144,6 @@ spindump_connections_newconnection_aux(struct spindump_connectionstable* table,
     break;
 
   case spindump_connection_transport_icmp:
-    spindump_messageidtracker_initialize(&connection->u.icmp.side1Seqs);
     break;
 
   case spindump_connection_aggregate_hostpair:
@@ -193,11 +178,183 @@ spindump_connections_newconnection_aux(struct spindump_connectionstable* table,
   }
 }
 
+//
+// Does a connection of a given type have protocol trackers in its
+// cold part?
+//
+
+static int
+spindump_connections_hastrackers(enum spindump_connection_type type) {
+  switch (type) {
+  case spindump_connection_transport_tcp:
+  case spindump_connection_transport_sctp:
+  case spindump_connection_transport_dns:
+  case spindump_connection_transport_coap:
+  case spindump_connection_transport_quic:
+  case spindump_connection_transport_icmp:
+    return(1);
+  default:
+    return(0);
+  }
+}
+
+//
+// Fill in a new cold part of a connection, i.e., initialize the RTT
+// calculations and the protocol trackers for the connection's type.
+//
+
+static void
+spindump_connections_cold_initialize(struct spindump_connection* connection,
+                                     struct spindump_connection_cold* cold) {
+
+  memset(cold,0,spindump_connectionstable_pool_coldobjectsize(connection->type));
+  spindump_rtt_initialize(&cold->leftRTT);
+  spindump_rtt_initialize(&cold->rightRTT);
+
+  switch (connection->type) {
+
+  case spindump_connection_transport_tcp:
+    spindump_seqtracker_initialize(&cold->u.tcp.side1Seqs);
+    spindump_seqtracker_initialize(&cold->u.tcp.side2Seqs);
+    break;
+
+  case spindump_connection_transport_sctp:
+    spindump_tsntracker_initialize(&cold->u.sctp.side1Seqs);
+    spindump_tsntracker_initialize(&cold->u.sctp.side2Seqs);
+    break;
+
+  case spindump_connection_transport_dns:
+    spindump_messageidtracker_initialize(&cold->u.dns.side1MIDs);
+    spindump_messageidtracker_initialize(&cold->u.dns.side2MIDs);
+    break;
+
+  case spindump_connection_transport_coap:
+    spindump_messageidtracker_initialize(&cold->u.coap.side1MIDs);
+    spindump_messageidtracker_initialize(&cold->u.coap.side2MIDs);
+    break;
+
+  case spindump_connection_transport_quic:
+    spindump_spintracker_initialize(&cold->u.quic.spinFromPeer1to2);
+    spindump_spintracker_initialize(&cold->u.quic.spinFromPeer2to1);
+    spindump_delaybittracker_initialize(&cold->u.quic.delaybitFromPeer1to2);
+    spindump_delaybittracker_initialize(&cold->u.quic.delaybitFromPeer2to1);
+    spindump_rtloss1tracker_initialize(&cold->u.quic.rtloss1FromPeer1to2);
+    spindump_rtloss1tracker_initialize(&cold->u.quic.rtloss1FromPeer2to1);
+    spindump_rtloss2tracker_initialize(&cold->u.quic.rtloss2FromPeer1to2);
+    spindump_rtloss2tracker_initialize(&cold->u.quic.rtloss2FromPeer2to1);
+    spindump_qrlosstracker_initialize(&cold->u.quic.qrFromPeer1to2);
+    spindump_qrlosstracker_initialize(&cold->u.quic.qrFromPeer2to1);
+    spindump_qllosstracker_initialize(&cold->u.quic.qlFromPeer1to2);
+    spindump_qllosstracker_initialize(&cold->u.quic.qlFromPeer2to1);
+    break;
+
+  case spindump_connection_transport_icmp:
+    spindump_messageidtracker_initialize(&cold->u.icmp.side1Seqs);
+    break;
+
+  default:
+    break;
+
+  }
+}
+
+//
+// Free up the resources held by the cold part of a connection
+//
+
+static void
+spindump_connections_cold_uninitialize(struct spindump_connection* connection,
+                                       struct spindump_connection_cold* cold) {
+
+  switch (connection->type) {
+
+  case spindump_connection_transport_tcp:
+    spindump_seqtracker_uninitialize(&cold->u.tcp.side1Seqs);
+    spindump_seqtracker_uninitialize(&cold->u.tcp.side2Seqs);
+    break;
+
+  case spindump_connection_transport_sctp:
+    spindump_tsntracker_uninitialize(&cold->u.sctp.side1Seqs);
+    spindump_tsntracker_uninitialize(&cold->u.sctp.side2Seqs);
+    break;
+
+  case spindump_connection_transport_dns:
+    spindump_messageidtracker_uninitialize(&cold->u.dns.side1MIDs);
+    spindump_messageidtracker_uninitialize(&cold->u.dns.side2MIDs);
+    break;
+
+  case spindump_connection_transport_coap:
+    spindump_messageidtracker_uninitialize(&cold->u.coap.side1MIDs);
+    spindump_messageidtracker_uninitialize(&cold->u.coap.side2MIDs);
+    break;
+
+  case spindump_connection_transport_icmp:
+    spindump_messageidtracker_uninitialize(&cold->u.icmp.side1Seqs);
+    break;
+
+  default:
+    break;
+
+  }
+}
+
+//
+// Return the cold part of a connection, allocating it from the pool
+// of the table if the connection does not yet have one. Returns 0 if
+// memory could not be allocated.
+//
+
+struct spindump_connection_cold*
+spindump_connections_getcold(struct spindump_connection* connection,
+                             struct spindump_connectionstable* table) {
+
+  spindump_assert(connection != 0);
+  spindump_assert(table != 0);
+  if (connection->cold != 0) return(connection->cold);
+
+  struct spindump_connection_cold* cold =
+    spindump_connectionstable_pool_allocatecold(&table->pool,connection->type);
+  if (cold == 0) {
+    spindump_errorf("cannot allocate memory for the cold part of a connection of size %u",
+                    spindump_connectionstable_pool_coldobjectsize(connection->type));
+    return(0);
+  }
+  spindump_connections_cold_initialize(connection,cold);
+  connection->cold = cold;
+  return(cold);
+}
+
+//
+// Remove the flow of a new TCP or SCTP connection from the negative
+// cache, so that the packets of the connection are no longer
+// ignored as belonging to an untracked flow.
+//
+
+static void
+spindump_connections_newconnection_admit(struct spindump_connection* connection,
+                                         struct spindump_connectionstable* table) {
+  struct spindump_connectionstable_negative* negative = &table->negative;
+  if (negative->generations[0].nEntries == 0 && negative->generations[1].nEntries == 0) return;
+  spindump_compactnetwork side1network;
+  spindump_compactnetwork side2network;
+  spindump_port side1port;
+  spindump_port side2port;
+  spindump_connections_getnetworks(connection,&side1network,&side2network);
+  spindump_connections_getports(connection,&side1port,&side2port);
+  spindump_connectionstable_negative_remove(negative,
+                                            spindump_connectionstable_negative_key(connection->type,
+                                                                                   &side1network.address,
+                                                                                   side1port,
+                                                                                   &side2network.address,
+                                                                                   side2port));
+}
+
 //
 // Add a new connection to any already existing aggregates it might
-// fall under. Search the table of connections to look for aggregate
-// connections that match this particular new connection's source and
-// destination address.
+// fall under. Search the table's prefix tries for aggregate
+// connections that may match this particular new connection's source
+// and destination address, and then check each of them, in the order
+// of the connections table.
 // 
 
 static void
@@ -207,94 +364,101 @@ spindump_connections_newconnection_addtoaggregates(struct spindump_connection* c
 
   spindump_debugf("looking at aggregates that the new connection %u might fit into",
                   connection->id);
-  int seenMatch = 0;
-  for (unsigned int i = 0; i < table->nConnections; i++) {
-    aggregate = table->connections[i];
-    if (aggregate != 0 &&
-        spindump_connections_isaggregate_simple(aggregate)) {
-
-      spindump_deepdebugf("testing aggregate %u (tags %s, %u of %u connections) seen match = %u",
-                          aggregate->id, aggregate->tags.string, i, table->nConnections, seenMatch);
-      
-      if (spindump_connections_matches_aggregate_connection(seenMatch,connection,aggregate)) {
-
-        //
-        // This aggregate matches the new connection. Add to a list of
-        // aggregates this connection belongs to.
-        // 
-
-        seenMatch = 1;
-        spindump_debugf("connection %u matches aggregate %u",
-                        connection->id, aggregate->id);
-        spindump_connections_set_add(&connection->aggregates,aggregate);
-        
-        //
-        // Add to the aggregate's list of what connections belong to it.
-        // 
-        
-        switch (aggregate->type) {
-          
-        case spindump_connection_aggregate_hostpair:
-          spindump_connections_set_add(&aggregate->u.aggregatehostpair.connections,connection);
-          break;
-          
-        case spindump_connection_aggregate_hostnetwork:
-          spindump_connections_set_add(&aggregate->u.aggregatehostnetwork.connections,connection);
-          break;
-          
-        case spindump_connection_aggregate_hostmultinet:
-          spindump_connections_set_add(&aggregate->u.aggregatehostmultinet.connections,connection);
-          break;
-          
-        case spindump_connection_aggregate_networknetwork:
-          spindump_connections_set_add(&aggregate->u.aggregatenetworknetwork.connections,connection);
-          break;
-          
-        case spindump_connection_aggregate_networkmultinet:
-          spindump_connections_set_add(&aggregate->u.aggregatenetworkmultinet.connections,connection);
-          break;
-          
-        case spindump_connection_aggregate_multicastgroup:
-          spindump_connections_set_add(&aggregate->u.aggregatemulticastgroup.connections,connection);
-          break;
-
-        case spindump_connection_transport_udp:
-        case spindump_connection_transport_tcp:
-        case spindump_connection_transport_sctp:
-        case spindump_connection_transport_quic:
-        case spindump_connection_transport_dns:
-        case spindump_connection_transport_coap:
-        case spindump_connection_transport_icmp:
-        default:
-          spindump_errorf("invalid connection type %u in spindump_connections_newconnection_addtoaggregates",
-                          aggregate->type);
-          break;
-          
-        }
-      }
-    }
-    
-  }
 
-  spindump_address* side1address = 0;
-  spindump_address* side2address = 0;
+  spindump_compactaddress* side1address = 0;
+  spindump_compactaddress* side2address = 0;
   spindump_connections_getaddresses(connection,
                                     &side1address,
                                     &side2address);
 
   if (side1address == 0 || side2address == 0) {
     spindump_deepdebugf("can't figure out addresses from connection %u", connection->id);
+    return;
+  }
 
-  } else if ((aggregate = spindump_connections_match_multinet(side1address,side2address,table))) {
+  spindump_connectionstable_shared_lock(table);
+  int seenMatch = 0;
+  unsigned int nCandidates =
+    spindump_connectionstable_prefixes_candidates(&table->prefixes,side1address,side2address);
+  for (unsigned int i = 0; i < nCandidates; i++) {
+    aggregate = table->prefixes.candidates[i];
+    spindump_deepdebugf("testing aggregate %u (tags %s, %u of %u candidates) seen match = %u",
+                        aggregate->id, aggregate->tags.string, i, nCandidates, seenMatch);
+    
+    if (spindump_connections_matches_aggregate_connection(seenMatch,connection,aggregate)) {
 
-    spindump_connections_set_add(&connection->aggregates,aggregate);
+      //
+      // This aggregate matches the new connection.
+      // 
+
+      seenMatch = 1;
+      spindump_debugf("connection %u matches aggregate %u",
+                      connection->id, aggregate->id);
+      
+      //
+      // Add to the aggregate's list of what connections belong to
+      // it, and the aggregate to the list of aggregates this
+      // connection belongs to.
+      // 
+      
+      switch (aggregate->type) {
+        
+      case spindump_connection_aggregate_hostpair:
+        spindump_connections_set_add(&aggregate->u.aggregatehostpair.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+        
+      case spindump_connection_aggregate_hostnetwork:
+        spindump_connections_set_add(&aggregate->u.aggregatehostnetwork.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+        
+      case spindump_connection_aggregate_hostmultinet:
+        spindump_connections_set_add(&aggregate->u.aggregatehostmultinet.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+        
+      case spindump_connection_aggregate_networknetwork:
+        spindump_connections_set_add(&aggregate->u.aggregatenetworknetwork.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+        
+      case spindump_connection_aggregate_networkmultinet:
+        spindump_connections_set_add(&aggregate->u.aggregatenetworkmultinet.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+        
+      case spindump_connection_aggregate_multicastgroup:
+        spindump_connections_set_add(&aggregate->u.aggregatemulticastgroup.connections,connection,
+                                     &connection->aggregates,aggregate);
+        break;
+
+      case spindump_connection_transport_udp:
+      case spindump_connection_transport_tcp:
+      case spindump_connection_transport_sctp:
+      case spindump_connection_transport_quic:
+      case spindump_connection_transport_dns:
+      case spindump_connection_transport_coap:
+      case spindump_connection_transport_icmp:
+      default:
+        spindump_errorf("invalid connection type %u in spindump_connections_newconnection_addtoaggregates",
+                        aggregate->type);
+        break;
+        
+      }
+    }
+  }
+
+  if ((aggregate = spindump_connections_match_multinet(side1address,side2address,table))) {
 
     switch (aggregate->type) {
     case spindump_connection_aggregate_hostmultinet:
-      spindump_connections_set_add(&aggregate->u.aggregatehostmultinet.connections,connection);
+      spindump_connections_set_add(&aggregate->u.aggregatehostmultinet.connections,connection,
+                                   &connection->aggregates,aggregate);
       break;
     case spindump_connection_aggregate_networkmultinet:
-      spindump_connections_set_add(&aggregate->u.aggregatenetworkmultinet.connections,connection);
+      spindump_connections_set_add(&aggregate->u.aggregatenetworkmultinet.connections,connection,
+                                   &connection->aggregates,aggregate);
       break;
     case spindump_connection_transport_tcp:
     case spindump_connection_transport_udp:
@@ -313,6 +477,7 @@ spindump_connections_newconnection_addtoaggregates(struct spindump_connection* c
       break;
     }
   }
+  spindump_connectionstable_shared_unlock(table);
 }
 
 //
@@ -321,6 +486,21 @@ spindump_connections_newconnection_addtoaggregates(struct spindump_connection* c
 // connection object.
 //
 
+void
+spindump_connections_newconnection_aggregate_addnetwork(struct spindump_connection* connection,
+                                                        const spindump_network* network,
+                                                        struct spindump_connectionstable* table) {
+  spindump_assert(connection != 0);
+  spindump_assert(connection->type == spindump_connection_aggregate_hostmultinet ||
+                  connection->type == spindump_connection_aggregate_networkmultinet);
+  spindump_assert(network != 0);
+  spindump_assert(table != 0);
+
+  spindump_compactnetwork compact;
+  spindump_compactnetwork_fromnetwork(network,&compact);
+  spindump_connectionstable_prefixes_add(&table->prefixes,&compact,connection);
+}
+
 //
 // This is the main function for creating a new connection. The
 // parameter table holds the object that keeps track of all
@@ -349,10 +529,10 @@ spindump_connections_newconnection(struct spindump_connectionstable* table,
   // Allocate the object
   // 
   
-  unsigned int size = sizeof(struct spindump_connection);
-  struct spindump_connection* connection = (struct spindump_connection*)spindump_malloc(size);
+  struct spindump_connection* connection = spindump_connectionstable_pool_allocate(&table->pool,type);
   if (connection == 0) {
-    spindump_errorf("cannot allocate memory for a connection of size %u", size);
+    spindump_errorf("cannot allocate memory for a connection of size %u",
+                    spindump_connectionstable_pool_objectsize(type));
     return(0);
   }
 
@@ -363,49 +543,25 @@ spindump_connections_newconnection(struct spindump_connectionstable* table,
   spindump_connections_newconnection_aux(table,connection,type,when,manuallyCreated);
   
   //
-  // Look for a place in the connections table
-  // 
-  
-  unsigned int i;
-  for (i = 0; i < table->nConnections; i++) {
-    if (table->connections[i] == 0) {
-      table->connections[i] = connection;
-      return(connection);
-    }
-  }
-
+  // Connection types with protocol trackers use them on the first
+  // packet already, so allocate their cold part right away
   //
-  // No reclaimed place, but maybe space between used space and allocated space?
-  // 
 
-  if (table->nConnections < table->maxNConnections) {
-    table->connections[table->nConnections++] = connection;
-    return(connection);
+  if (spindump_connections_hastrackers(type) &&
+      spindump_connections_getcold(connection,table) == 0) {
+    spindump_connectionstable_pool_release(&table->pool,connection);
+    return(0);
   }
-
+  
   //
-  // No space, need to reallocate table
+  // Put the connection in the connections table
   // 
   
-  table->maxNConnections *= 2;
-  unsigned int newtabsize = table->maxNConnections * sizeof(struct spindump_connection*);
-  struct spindump_connection** oldtable = table->connections;
-  struct spindump_connection** newtable = (struct spindump_connection**)spindump_malloc(newtabsize);
-  if (newtable == 0) {
-    spindump_errorf("cannot allocate memory for a connection table of size %u", newtabsize);
-    spindump_deepdebugf("free connection after an error");
-    spindump_free(connection);
+  if (!spindump_connectionstable_addconnection(table,connection)) {
+    spindump_deepdebugf("release connection after an error");
+    spindump_connections_delete(connection,table);
     return(0);
   }
-  table->connections = newtable;
-  memset(newtable,0,newtabsize);
-  for (i = 0; i < table->nConnections; i++) {
-    table->connections[i] = oldtable[i];
-  }
-  spindump_deepdebugf("free oldtable after a growth");
-  spindump_free(oldtable);
-  table->connections[table->nConnections++] = connection;
-  spindump_assert(table->nConnections < table->maxNConnections);
   return(connection);
   
 }
@@ -431,10 +587,12 @@ spindump_connections_newconnection_icmp(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.icmp.side1peerAddress = *side1address;
-  connection->u.icmp.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.icmp.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.icmp.side2peerAddress);
   connection->u.icmp.side1peerType = side1peerType;
   connection->u.icmp.side1peerId = side1peerId;
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new ICMP connection %u", connection->id);
@@ -463,10 +621,13 @@ spindump_connections_newconnection_tcp(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.tcp.side1peerAddress = *side1address;
-  connection->u.tcp.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.tcp.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.tcp.side2peerAddress);
   connection->u.tcp.side1peerPort = side1port;
   connection->u.tcp.side2peerPort = side2port;
+  spindump_connections_newconnection_admit(connection,table);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new TCP connection %u", connection->id);
@@ -497,14 +658,17 @@ spindump_connections_newconnection_sctp(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.sctp.side1peerAddress = *side1address;
-  connection->u.sctp.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.sctp.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.sctp.side2peerAddress);
   connection->u.sctp.side1peerPort = side1port;
   connection->u.sctp.side2peerPort = side2port;
   connection->u.sctp.side1Vtag = side1Vtag;  // VTag from INIT chunk
   connection->u.sctp.side2Vtag = 0;  // VTag from INIT ACK chunk will be stored here
   connection->u.sctp.side1HbCnt = 0;
   connection->u.sctp.side2HbCnt = 0;
+  spindump_connections_newconnection_admit(connection,table);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new SCTP connection %u", connection->id);
@@ -533,10 +697,12 @@ spindump_connections_newconnection_udp(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.udp.side1peerAddress = *side1address;
-  connection->u.udp.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.udp.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.udp.side2peerAddress);
   connection->u.udp.side1peerPort = side1port;
   connection->u.udp.side2peerPort = side2port;
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new UDP connection %u", connection->id);
@@ -565,10 +731,12 @@ spindump_connections_newconnection_dns(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.dns.side1peerAddress = *side1address;
-  connection->u.dns.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.dns.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.dns.side2peerAddress);
   connection->u.dns.side1peerPort = side1port;
   connection->u.dns.side2peerPort = side2port;
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new DNS connection %u", connection->id);
@@ -597,10 +765,12 @@ spindump_connections_newconnection_coap(const spindump_address* side1address,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.coap.side1peerAddress = *side1address;
-  connection->u.coap.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.coap.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.coap.side2peerAddress);
   connection->u.coap.side1peerPort = side1port;
   connection->u.coap.side2peerPort = side2port;
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new COAP connection %u", connection->id);
@@ -631,12 +801,14 @@ spindump_connections_newconnection_quic_5tuple(const spindump_address* side1addr
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.quic.side1peerAddress = *side1address;
-  connection->u.quic.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.quic.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.quic.side2peerAddress);
   connection->u.quic.side1peerPort = side1port;
   connection->u.quic.side2peerPort = side2port;
   memset(&connection->u.quic.peer1ConnectionID,0,sizeof(struct spindump_quic_connectionid));
   memset(&connection->u.quic.peer2ConnectionID,0,sizeof(struct spindump_quic_connectionid));
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new QUIC connection %u via a 5-tuple", connection->id);
@@ -671,12 +843,14 @@ spindump_connections_newconnection_quic_5tupleandcids(const spindump_address* si
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_establishing;
-  connection->u.quic.side1peerAddress = *side1address;
-  connection->u.quic.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.quic.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.quic.side2peerAddress);
   connection->u.quic.side1peerPort = side1port;
   connection->u.quic.side2peerPort = side2port;
   memcpy(&connection->u.quic.peer1ConnectionID,sourceCid,sizeof(struct spindump_quic_connectionid));
   memcpy(&connection->u.quic.peer2ConnectionID,destinationCid,sizeof(struct spindump_quic_connectionid));
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_connections_newconnection_addtoaggregates(connection,table);
   
   spindump_debugf("created a new QUIC connection %u via a 5-tuple and CIDs", connection->id);
@@ -704,8 +878,10 @@ spindump_connections_newconnection_aggregate_hostpair(const spindump_address* si
   if (connection == 0) return(0);
 
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatehostpair.side1peerAddress = *side1address;
-  connection->u.aggregatehostpair.side2peerAddress = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.aggregatehostpair.side1peerAddress);
+  spindump_compactaddress_fromaddress(side2address,&connection->u.aggregatehostpair.side2peerAddress);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   
   spindump_debugf("created a new host pair aggregate onnection %u", connection->id);
   return(connection);
@@ -732,8 +908,10 @@ spindump_connections_newconnection_aggregate_hostnetwork(const spindump_address*
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatehostnetwork.side1peerAddress = *side1address;
-  connection->u.aggregatehostnetwork.side2Network = *side2network;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.aggregatehostnetwork.side1peerAddress);
+  spindump_compactnetwork_fromnetwork(side2network,&connection->u.aggregatehostnetwork.side2Network);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   
   spindump_debugf("created a new host-network aggregate onnection %u", connection->id);
   return(connection);
@@ -762,9 +940,11 @@ spindump_connections_newconnection_aggregate_networknetwork(int defaultMatch,
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatenetworknetwork.side1Network = *side1network;
-  connection->u.aggregatenetworknetwork.side2Network = *side2network;
+  spindump_compactnetwork_fromnetwork(side1network,&connection->u.aggregatenetworknetwork.side1Network);
+  spindump_compactnetwork_fromnetwork(side2network,&connection->u.aggregatenetworknetwork.side2Network);
   connection->u.aggregatenetworknetwork.defaultMatch = defaultMatch;
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   
   spindump_debugf("created a new network-network aggregate onnection %u default match %u",
                   connection->id,
@@ -792,8 +972,10 @@ spindump_connections_newconnection_aggregate_hostmultinet(const spindump_address
   if (connection == 0) return(0);
 
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatehostmultinet.side1peerAddress = *side1address;
-  connection->u.aggregatehostmultinet.identifier = *identifier;
+  spindump_compactaddress_fromaddress(side1address,&connection->u.aggregatehostmultinet.side1peerAddress);
+  spindump_compactaddress_fromaddress(identifier,&connection->u.aggregatehostmultinet.identifier);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_debugf("created a new host-multinet aggregate onnection %u", connection->id);
   return(connection);
 }
@@ -818,8 +1000,10 @@ spindump_connections_newconnection_aggregate_networkmultinet(const spindump_netw
   if (connection == 0) return(0);
 
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatenetworkmultinet.side1Network = *side1network;
-  connection->u.aggregatenetworkmultinet.identifier = *identifier;
+  spindump_compactnetwork_fromnetwork(side1network,&connection->u.aggregatenetworkmultinet.side1Network);
+  spindump_compactaddress_fromaddress(identifier,&connection->u.aggregatenetworkmultinet.identifier);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   spindump_debugf("created a new network-multinet aggregate onnection %u", connection->id);
   return(connection);
 }
@@ -843,53 +1027,42 @@ spindump_connections_newconnection_aggregate_multicastgroup(const spindump_addre
   if (connection == 0) return(0);
   
   connection->state = spindump_connection_state_static;
-  connection->u.aggregatemulticastgroup.group = *group;
+  spindump_compactaddress_fromaddress(group,&connection->u.aggregatemulticastgroup.group);
+  spindump_connectionstable_indexconnection(connection,table);
+  spindump_connectionstable_scheduleconnection(connection,table);
   
   spindump_debugf("created a new multicast group aggregate onnection %u", connection->id);
   return(connection);
 }
 
 //
-// Delete a connection object. This causes the physical deallocation
-// of the object, and is typically called by a periodic cleanup
-// process, rather than directly after e.g., a TCP session closes.
+// Delete a connection object. This returns the object to the pool of
+// the table, and is typically called by a periodic cleanup process,
+// rather than directly after e.g., a TCP session closes.
 // 
 
 void
-spindump_connections_delete(struct spindump_connection* connection) {
+spindump_connections_delete(struct spindump_connection* connection,
+                            struct spindump_connectionstable* table) {
 
   spindump_assert(connection != 0);
+  spindump_assert(table != 0);
+  
+  if (connection->cold != 0) {
+    spindump_connections_cold_uninitialize(connection,connection->cold);
+    spindump_connectionstable_pool_releasecold(&table->pool,connection->type,connection->cold);
+    connection->cold = 0;
+  }
   
   switch (connection->type) {
     
   case spindump_connection_transport_tcp:
-    spindump_seqtracker_uninitialize(&connection->u.tcp.side1Seqs);
-    spindump_seqtracker_uninitialize(&connection->u.tcp.side2Seqs);
-    break;
-    
   case spindump_connection_transport_sctp:
-    spindump_tsntracker_uninitialize(&connection->u.sctp.side1Seqs);
-    spindump_tsntracker_uninitialize(&connection->u.sctp.side2Seqs);
-    break;
-
   case spindump_connection_transport_udp:
-    break;
-    
   case spindump_connection_transport_dns:
-    spindump_messageidtracker_uninitialize(&connection->u.dns.side1MIDs);
-    spindump_messageidtracker_uninitialize(&connection->u.dns.side2MIDs);
-    break;
-    
   case spindump_connection_transport_coap:
-    spindump_messageidtracker_uninitialize(&connection->u.coap.side1MIDs);
-    spindump_messageidtracker_uninitialize(&connection->u.coap.side2MIDs);
-    break;
-    
   case spindump_connection_transport_quic:
-    break;
-    
   case spindump_connection_transport_icmp:
-    spindump_messageidtracker_uninitialize(&connection->u.icmp.side1Seqs);
     break;
     
   case spindump_connection_aggregate_hostpair:
@@ -923,7 +1096,9 @@ spindump_connections_delete(struct spindump_connection* connection) {
     
   }
   
+  spindump_connectionstable_shared_lock(table);
   spindump_connections_set_uninitialize(&connection->aggregates,connection);
-  memset(connection,0x93,sizeof(*connection));
-  spindump_free(connection);
+  spindump_connectionstable_shared_unlock(table);
+  spindump_connectionstable_rollup_release(connection);
+  spindump_connectionstable_pool_release(&table->pool,connection);
 }
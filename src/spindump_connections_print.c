@@ -50,7 +50,7 @@ static const char*
 spindump_icmptype_tostring(u_int8_t type);
 static const char*
 spindump_connection_address_tostring(int anonymize,
-                                     spindump_address* address,
+                                     const spindump_compactaddress* compact,
                                      struct spindump_reverse_dns* querier);
 static void
 spindump_connection_addtobuf(char* buf,
@@ -59,6 +59,9 @@ spindump_connection_addtobuf(char* buf,
                              const char* value,
                              int compress);
 static void
+spindump_connection_report_rtt_grid(const struct spindump_rtt* rtt,
+                                    unsigned long grid[6][10]);
+static void
 spindump_connection_report_rtt_histogram(struct spindump_rtt* rtt,
                                          FILE* file);
 
@@ -456,7 +459,7 @@ spindump_connection_report_hostnetwork(struct spindump_connection* connection,
                                                &connection->u.aggregatehostnetwork.side1peerAddress,
                                                querier));
   fprintf(file,"  network:               %40s\n",
-          spindump_network_tostring(&connection->u.aggregatehostnetwork.side2Network));
+          spindump_compactnetwork_tostring(&connection->u.aggregatehostnetwork.side2Network));
   fprintf(file,"  aggregates:            %40s\n",
           spindump_connections_set_listids(&connection->u.aggregatehostnetwork.connections));
 }
@@ -471,9 +474,9 @@ spindump_connection_report_networknetwork(struct spindump_connection* connection
                                           int anonymize,
                                           struct spindump_reverse_dns* querier) {
   fprintf(file,"  network 1:             %40s\n",
-          spindump_network_tostring(&connection->u.aggregatenetworknetwork.side1Network));
+          spindump_compactnetwork_tostring(&connection->u.aggregatenetworknetwork.side1Network));
   fprintf(file,"  network 2:             %40s\n",
-          spindump_network_tostring(&connection->u.aggregatenetworknetwork.side2Network));
+          spindump_compactnetwork_tostring(&connection->u.aggregatenetworknetwork.side2Network));
   fprintf(file,"  aggregates:            %40s\n",
           spindump_connections_set_listids(&connection->u.aggregatenetworknetwork.connections));
 }
@@ -509,7 +512,7 @@ spindump_connection_report_networkmultinet(struct spindump_connection* connectio
                                            int anonymize,
                                            struct spindump_reverse_dns* querier) {
   fprintf(file,"  network 1:             %40s\n",
-          spindump_network_tostring(&connection->u.aggregatenetworkmultinet.side1Network));
+          spindump_compactnetwork_tostring(&connection->u.aggregatenetworkmultinet.side1Network));
   fprintf(file,"  identifier:            %40s\n",
           spindump_connection_address_tostring(0,
                                                &connection->u.aggregatenetworkmultinet.identifier,
@@ -528,7 +531,7 @@ spindump_connection_report_multicastgroup(struct spindump_connection* connection
                                           int anonymize,
                                           struct spindump_reverse_dns* querier) {
   fprintf(file,"  group:                 %40s\n",
-          spindump_address_tostring(&connection->u.aggregatemulticastgroup.group));
+          spindump_compactaddress_tostring(&connection->u.aggregatemulticastgroup.group));
   fprintf(file,"  aggregates:            %40s\n",
           spindump_connections_set_listids(&connection->u.aggregatemulticastgroup.connections));
 }
@@ -617,30 +620,31 @@ spindump_connection_report(struct spindump_connection* connection,
   fprintf(file,"  packets 2->1:            %38llu\n", connection->packetsFromSide2);
   fprintf(file,"  bytes 1->2:              %38llu\n", connection->bytesFromSide1.bytes);
   fprintf(file,"  bytes 2->1:              %38llu\n", connection->bytesFromSide2.bytes);
+  struct spindump_connection_cold* cold = spindump_connections_peekcold(connection);
   char rttbuf1[50];
   char rttbuf2[50];
   spindump_strlcpy(rttbuf1,
-                   spindump_rtt_tostring(connection->leftRTT.lastRTT),
+                   spindump_rtt_tostring(cold->leftRTT.lastRTT),
                    sizeof(rttbuf1));
   unsigned long dev;
   unsigned long filt;
-  unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->leftRTT,0,0,&dev,&filt);
+  unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->leftRTT,0,0,&dev,&filt);
   spindump_strlcpy(rttbuf2,
                    spindump_rtt_tostring(avg),
                    sizeof(rttbuf2));
   fprintf(file,"  last left RTT:           %38s\n", rttbuf1);
   fprintf(file,"  moving avg left RTT:     %38s\n", rttbuf2);
-  avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->rightRTT,0,0,&dev,&filt);
+  avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->rightRTT,0,0,&dev,&filt);
   spindump_strlcpy(rttbuf1,
-                   spindump_rtt_tostring(connection->rightRTT.lastRTT),
+                   spindump_rtt_tostring(cold->rightRTT.lastRTT),
                    sizeof(rttbuf1));
-  spindump_connection_report_rtt_histogram(&connection->leftRTT, file);
+  spindump_connection_report_rtt_histogram(&cold->leftRTT, file);
   spindump_strlcpy(rttbuf2,
                    spindump_rtt_tostring(avg),
                    sizeof(rttbuf2));
   fprintf(file,"  last right RTT:          %38s\n", rttbuf1);
   fprintf(file,"  moving avg right RTT:    %38s\n", rttbuf2);
-  spindump_connection_report_rtt_histogram(&connection->rightRTT, file);
+  spindump_connection_report_rtt_histogram(&cold->rightRTT, file);
 }
 
 //
@@ -650,16 +654,18 @@ spindump_connection_report(struct spindump_connection* connection,
 
 static const char*
 spindump_connection_address_tostring(int anonymize,
-                                     spindump_address* address,
+                                     const spindump_compactaddress* compact,
                                      struct spindump_reverse_dns* querier) {
+  spindump_address address;
+  spindump_compactaddress_toaddress(compact,&address);
   if (anonymize) {
-    return(spindump_address_tostring_anon(1,address));
+    return(spindump_address_tostring_anon(1,&address));
   } else {
-    const char* name = spindump_reverse_dns_query(address,querier);
+    const char* name = spindump_reverse_dns_query(&address,querier);
     if (name != 0) {
       return(name);
     } else {
-      return(spindump_address_tostring(address));
+      return(spindump_address_tostring(&address));
     }
   }
 }
@@ -668,7 +674,7 @@ spindump_connection_address_tostring(int anonymize,
 // Return a string representation of the addresses in a connection
 // object. The returned string need not be freed.
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
@@ -693,7 +699,7 @@ spindump_connection_addresses(struct spindump_connection* connection,
   // Reserve buffer space, check there's enough space to print
   //
   
-  static char buf[200];
+  static _Thread_local char buf[200];
   memset(buf,0,sizeof(buf));
   if (maxlen <= 2) {
     buf[0] = 0;
@@ -791,12 +797,12 @@ spindump_connection_addresses(struct spindump_connection* connection,
                      spindump_connection_address_tostring(anonymizeLeft,&connection->u.aggregatehostnetwork.side1peerAddress,querier),
                      sizeof(buf));
     spindump_strlcat(buf,middle,sizeof(buf));
-    spindump_strlcat(buf,spindump_network_tostring(&connection->u.aggregatehostnetwork.side2Network),sizeof(buf));
+    spindump_strlcat(buf,spindump_compactnetwork_tostring(&connection->u.aggregatehostnetwork.side2Network),sizeof(buf));
     break;
   case spindump_connection_aggregate_networknetwork:
-    spindump_strlcpy(buf,spindump_network_tostring(&connection->u.aggregatenetworknetwork.side1Network),sizeof(buf));
+    spindump_strlcpy(buf,spindump_compactnetwork_tostring(&connection->u.aggregatenetworknetwork.side1Network),sizeof(buf));
     spindump_strlcat(buf,middle,sizeof(buf));
-    spindump_strlcat(buf,spindump_network_tostring(&connection->u.aggregatenetworknetwork.side2Network),sizeof(buf));
+    spindump_strlcat(buf,spindump_compactnetwork_tostring(&connection->u.aggregatenetworknetwork.side2Network),sizeof(buf));
     break;
   case spindump_connection_aggregate_hostmultinet:
     spindump_strlcpy(buf,
@@ -808,14 +814,14 @@ spindump_connection_addresses(struct spindump_connection* connection,
                      sizeof(buf));
     break;
   case spindump_connection_aggregate_networkmultinet:
-    spindump_strlcpy(buf,spindump_network_tostring(&connection->u.aggregatenetworkmultinet.side1Network),sizeof(buf));
+    spindump_strlcpy(buf,spindump_compactnetwork_tostring(&connection->u.aggregatenetworkmultinet.side1Network),sizeof(buf));
     spindump_strlcat(buf,middle,sizeof(buf));
     spindump_strlcat(buf,
                      spindump_connection_address_tostring(anonymizeLeft,&connection->u.aggregatenetworkmultinet.identifier,querier),
                      sizeof(buf));
     break;
   case spindump_connection_aggregate_multicastgroup:
-    spindump_strlcpy(buf,spindump_address_tostring(&connection->u.aggregatemulticastgroup.group),sizeof(buf));
+    spindump_strlcpy(buf,spindump_compactaddress_tostring(&connection->u.aggregatemulticastgroup.group),sizeof(buf));
     break;
   default:
     spindump_errorf("invalid connection type");
@@ -1166,16 +1172,16 @@ spindump_connection_report_brief_notefieldval(struct spindump_connection* connec
     // Report spin status
     //
     
-    if (connection->u.quic.spinFromPeer1to2.totalSpins == 0 &&
-        connection->u.quic.spinFromPeer2to1.totalSpins == 0) {
+    if (connection->cold->u.quic.spinFromPeer1to2.totalSpins == 0 &&
+        connection->cold->u.quic.spinFromPeer2to1.totalSpins == 0) {
       spindump_deepdeepdebugf("report_brief_notefieldval point 5");
       spindump_connection_addtobuf(buf,bufsiz,"no spin","",1);
-    } else if (connection->u.quic.spinFromPeer1to2.totalSpins != 0 &&
-               connection->u.quic.spinFromPeer2to1.totalSpins == 0) {
+    } else if (connection->cold->u.quic.spinFromPeer1to2.totalSpins != 0 &&
+               connection->cold->u.quic.spinFromPeer2to1.totalSpins == 0) {
       spindump_deepdeepdebugf("report_brief_notefieldval point 6");
       spindump_connection_addtobuf(buf,bufsiz,"no R-spin","",1);
-    } else if (connection->u.quic.spinFromPeer1to2.totalSpins == 0 &&
-               connection->u.quic.spinFromPeer2to1.totalSpins != 0) {
+    } else if (connection->cold->u.quic.spinFromPeer1to2.totalSpins == 0 &&
+               connection->cold->u.quic.spinFromPeer2to1.totalSpins != 0) {
       spindump_deepdeepdebugf("report_brief_notefieldval point 7");
       spindump_connection_addtobuf(buf,bufsiz,"no I-spin","",1);
     } else {
@@ -1248,17 +1254,18 @@ spindump_connection_report_brief(struct spindump_connection* connection,
   memset(rttbuf1,0,sizeof(rttbuf1));
   memset(rttbuf2,0,sizeof(rttbuf2));
   spindump_deepdeepdebugf("report_brief point 2");
+  struct spindump_connection_cold* cold = spindump_connections_peekcold(connection);
   unsigned long filt;
   if (avg) {
     unsigned long devLeft;
-    unsigned long avgLeft = spindump_rtt_calculateLastMovingAvgRTT(&connection->leftRTT,0,0,&devLeft,&filt);
+    unsigned long avgLeft = spindump_rtt_calculateLastMovingAvgRTT(&cold->leftRTT,0,0,&devLeft,&filt);
     spindump_strlcpy(rttbuf1,spindump_rtt_tostring(avgLeft),sizeof(rttbuf1));
     unsigned long devRight;
-    unsigned long avgRight = spindump_rtt_calculateLastMovingAvgRTT(&connection->rightRTT,0,0,&devRight,&filt);
+    unsigned long avgRight = spindump_rtt_calculateLastMovingAvgRTT(&cold->rightRTT,0,0,&devRight,&filt);
     spindump_strlcpy(rttbuf2,spindump_rtt_tostring(avgRight),sizeof(rttbuf2));
   } else {
-    spindump_strlcpy(rttbuf1,spindump_rtt_tostring(connection->leftRTT.lastRTT),sizeof(rttbuf1));
-    spindump_strlcpy(rttbuf2,spindump_rtt_tostring(connection->rightRTT.lastRTT),sizeof(rttbuf2));
+    spindump_strlcpy(rttbuf1,spindump_rtt_tostring(cold->leftRTT.lastRTT),sizeof(rttbuf1));
+    spindump_strlcpy(rttbuf2,spindump_rtt_tostring(cold->rightRTT.lastRTT),sizeof(rttbuf2));
   }
   spindump_deepdeepdebugf("report_brief point 3");
   unsigned int addrsiz = spindump_connection_report_brief_variablesize(linelen);
@@ -1291,6 +1298,14 @@ spindump_connection_report_brief(struct spindump_connection* connection,
   spindump_deepdeepdebugf("notes field and everything pt 6 = %s", buf);
 }
 
+//
+// Report a connection to the periodic event handlers. The histogram
+// of the right RTTs of the period is emptied after the report, so
+// that the histograms in the periodic events cover the measurements
+// made in each period, and can be merged together by a collector.
+// The cumulative right RTT histogram is not affected.
+//
+
 void
 spindump_connection_periodicreport(struct spindump_connection* connection,
                                    struct spindump_connectionstable* table,
@@ -1308,6 +1323,41 @@ spindump_connection_periodicreport(struct spindump_connection* connection,
                                     0,
                                     0,
                                     connection);
+  struct spindump_connection_cold* cold = spindump_connections_peekcold(connection);
+  if (cold != 0) spindump_histogram_initialize(&cold->rightRTTPeriod);
+}
+
+//
+// Map the RTT histogram buckets to a decimal grid for printing. There
+// are 6 levels of delay intervals in the grid:
+//
+// level 0: 0, 100, 200 ... 900us
+// level 1: 1, 2, 3 ... 9ms
+// level 2: 10, 20, 30 ... 90ms
+// level 3: 100, 200, 300 .. 900ms
+// level 4: 1, 2, 3 ... 9s
+// level 5: 10, 20, 30 ... 90s
+//
+// Each bucket is counted in the cell its middle value falls in.
+//
+
+static void
+spindump_connection_report_rtt_grid(const struct spindump_rtt* rtt,
+                                    unsigned long grid[6][10]) {
+  memset(grid,0,6 * 10 * sizeof(grid[0][0]));
+  for (unsigned int bucket = 0; bucket < spindump_histogram_nbuckets; bucket++) {
+    if (rtt->histogram.buckets[bucket] == 0) continue;
+    unsigned long rttval = spindump_histogram_bucketvalue(bucket);
+    unsigned int level = 0;
+    unsigned long unit = 100;
+    while (level < 5 && rttval >= unit * 10) {
+      level++;
+      unit *= 10;
+    }
+    unsigned long bin = rttval / unit;
+    if (bin > 9) bin = 9;
+    grid[level][bin] += rtt->histogram.buckets[bucket];
+  }
 }
 
 //
@@ -1322,15 +1372,17 @@ spindump_connection_report_rtt_histogram(struct spindump_rtt* rtt,
   unsigned long max = 0;
   unsigned long sum = 0;
   char buff[256+1];
+  unsigned long grid[6][10];
   memset(buff, 0, sizeof(buff) * sizeof(char));
+  spindump_connection_report_rtt_grid(rtt,grid);
 
   //Search for the max number of RTT samples in an interval
   //Calculate the total number of RTT samples (sum)
   for (int i = 0; i < 5; ++i)
     for (int j = 0; j < 10; ++j) {
-      sum += rtt->rttHisto[i][j];
-      if (rtt->rttHisto[i][j] > max)
-        max = rtt->rttHisto[i][j];
+      sum += grid[i][j];
+      if (grid[i][j] > max)
+        max = grid[i][j];
     }
 
   if(sum < 10) //min 10 samples to plot histogram
@@ -1338,12 +1390,12 @@ spindump_connection_report_rtt_histogram(struct spindump_rtt* rtt,
 
   for (int i = 0; i < 5; ++i) {
     for (int j = 0; j < 10; ++j) {
-      if (rtt->rttHisto[i][j] == 0) {
+      if (grid[i][j] == 0) {
         strcat(buff, marker[0]);
         continue;
       }
 
-      double ratio = (double) rtt->rttHisto[i][j] / (double) max;
+      double ratio = (double) grid[i][j] / (double) max;
       if (ratio < 0.25)
         strcat(buff, marker[1]);
       else if (ratio < 0.5)
@@ -1367,14 +1419,8 @@ static void
 spindump_connection_report_rtt_histogram_json(struct spindump_rtt* rtt,
                                               FILE* file)
 {
-  /*unsigned int max = rtt->rttHisto[0][0];
-  //Search for the max RTT
-  for (int i = 0; i < 5; ++i)
-    for (int j = 0; j < 10; ++j)
-    if (rtt->rttHisto[i][j] > max)
-      max = rtt->rttHisto[i][j];
-  if(max == 0)
-    return;*/
+  unsigned long grid[6][10];
+  spindump_connection_report_rtt_grid(rtt,grid);
 
   char* ident="  ";
   fprintf(file,"%s[\n",ident);
@@ -1384,7 +1430,7 @@ spindump_connection_report_rtt_histogram_json(struct spindump_rtt* rtt,
     fprintf(file,"%s  [",ident);
     for (int j = 0; j < 10; ++j) {
       if (j>0) fprintf(file,",");
-      fprintf(file,"%lu",rtt->rttHisto[i][j]);
+      fprintf(file,"%lu",grid[i][j]);
     }
     fprintf(file,"]");
   }
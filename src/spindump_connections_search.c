@@ -45,6 +45,12 @@ static int
 spindump_connections_match(struct spindump_connection* connection,
                            struct spindump_connection_searchcriteria* criteria,
                            int* fromResponder);
+static void
+spindump_connections_search_bucket(struct spindump_connection_hashentry* entry,
+                                   uint32_t key,
+                                   struct spindump_connection_searchcriteria* criteria,
+                                   struct spindump_connection** found,
+                                   int* fromResponder);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -119,10 +125,10 @@ spindump_connections_match(struct spindump_connection* connection,
   // Source and destination addresses
   // 
   
-  spindump_address* side1address = 0;
-  spindump_address* side2address = 0;
-  spindump_network side1network;
-  spindump_network side2network;
+  spindump_compactaddress* side1address = 0;
+  spindump_compactaddress* side2address = 0;
+  spindump_compactnetwork side1network;
+  spindump_compactnetwork side2network;
   int portOrCidTestsRemain =
     ((criteria->matchPorts != spindump_connection_searchcriteria_srcdst_none) ||
      (criteria->matchQuicCids != spindump_connection_searchcriteria_srcdst_none));
@@ -138,7 +144,7 @@ spindump_connections_match(struct spindump_connection* connection,
       spindump_deepdebugf("match fails due to src address missing");
       return(0);
     }
-    if (!spindump_address_equal(side1address,&criteria->side1address)) {
+    if (!spindump_compactaddress_equal(side1address,&criteria->side1address)) {
       spindump_deepdebugf("match fails due to src address");
       return(0);
     }
@@ -152,7 +158,7 @@ spindump_connections_match(struct spindump_connection* connection,
       spindump_deepdebugf("match fails due to dst address missing");
       return(0);
     }
-    if (!spindump_address_equal(side2address,&criteria->side2address)) {
+    if (!spindump_compactaddress_equal(side2address,&criteria->side2address)) {
       spindump_deepdebugf("match fails due to dst address");
       return(0);
     }
@@ -166,18 +172,18 @@ spindump_connections_match(struct spindump_connection* connection,
       spindump_deepdebugf("match fails due to address missing");
       return(0);
     }
-    if (!spindump_address_equal(side1address,&criteria->side1address)) {
+    if (!spindump_compactaddress_equal(side1address,&criteria->side1address)) {
       spindump_deepdebugf("match fails due to src address %s",
-                          spindump_address_tostring(side1address));
+                          spindump_compactaddress_tostring(side1address));
       spindump_deepdebugf("vs. %s",
-                          spindump_address_tostring(side2address));
+                          spindump_compactaddress_tostring(side2address));
       return(0);
     }
-    if (!spindump_address_equal(side2address,&criteria->side2address)) {
+    if (!spindump_compactaddress_equal(side2address,&criteria->side2address)) {
       spindump_deepdebugf("match fails due to dst address %s",
-                          spindump_address_tostring(side1address));
+                          spindump_compactaddress_tostring(side1address));
       spindump_deepdebugf("vs. %s",
-                          spindump_address_tostring(side2address));
+                          spindump_compactaddress_tostring(side2address));
       return(0);
     }
     *fromResponder = 0;
@@ -190,9 +196,9 @@ spindump_connections_match(struct spindump_connection* connection,
       spindump_deepdebugf("match fails due to address missing");
       return(0);
     }
-    if (spindump_address_equal(side1address,&criteria->side1address) &&
-        spindump_address_equal(side2address,&criteria->side2address)) {
-      if (!spindump_address_equal(side1address,side2address) ||
+    if (spindump_compactaddress_equal(side1address,&criteria->side1address) &&
+        spindump_compactaddress_equal(side2address,&criteria->side2address)) {
+      if (!spindump_compactaddress_equal(side1address,side2address) ||
           !portOrCidTestsRemain) {
         *fromResponder = 0;
         fromResponderSet = 1;
@@ -200,9 +206,9 @@ spindump_connections_match(struct spindump_connection* connection,
       } else {
         spindump_deepdeepdebugf("address srcdst_both_allowreverse ok but cannot set direction yet");
       }
-    } else if (spindump_address_equal(side2address,&criteria->side1address) &&
-               spindump_address_equal(side1address,&criteria->side2address)) {
-      if (!spindump_address_equal(side1address,side2address) ||
+    } else if (spindump_compactaddress_equal(side2address,&criteria->side1address) &&
+               spindump_compactaddress_equal(side1address,&criteria->side2address)) {
+      if (!spindump_compactaddress_equal(side1address,side2address) ||
           !portOrCidTestsRemain) {
         *fromResponder = 1;
         fromResponderSet = 1;
@@ -218,16 +224,16 @@ spindump_connections_match(struct spindump_connection* connection,
     
   case spindump_connection_searchcriteria_srcdst_both_hostnetwork:
     spindump_connections_getnetworks(connection,&side1network,&side2network);
-    if (!spindump_network_ishost(&side1network)) {
+    if (!spindump_compactnetwork_ishost(&side1network)) {
       spindump_deepdeepdebugf("match fails because side1 is not a host");
       return(0);
     }
     side1address = &side1network.address;
-    if (!spindump_address_equal(side1address,&criteria->side1address)) {
+    if (!spindump_compactaddress_equal(side1address,&criteria->side1address)) {
       spindump_deepdeepdebugf("match fails because side1 is not equal");
       return(0);
     }
-    if (!spindump_network_equal(&side2network,&criteria->side2network)) {
+    if (!spindump_compactnetwork_equal(&side2network,&criteria->side2network)) {
       spindump_deepdeepdebugf("match fails because side 2 is not equal");  
       return(0);
     }
@@ -237,11 +243,11 @@ spindump_connections_match(struct spindump_connection* connection,
     
   case spindump_connection_searchcriteria_srcdst_both_networknetwork:
     spindump_connections_getnetworks(connection,&side1network,&side2network);
-    if (!spindump_network_equal(&side1network,&criteria->side1network)) {
+    if (!spindump_compactnetwork_equal(&side1network,&criteria->side1network)) {
       spindump_deepdeepdebugf("match fails because side1 network is not equal to criteria");  
       return(0);
     }
-    if (!spindump_network_equal(&side2network,&criteria->side2network)) {
+    if (!spindump_compactnetwork_equal(&side2network,&criteria->side2network)) {
       spindump_deepdeepdebugf("match fails because side2 network is not equal to criteria");  
       return(0);
     }
@@ -251,16 +257,16 @@ spindump_connections_match(struct spindump_connection* connection,
 
   case spindump_connection_searchcriteria_srcdst_both_networkhost:
     spindump_connections_getnetworks(connection,&side1network,&side2network);
-    if (!spindump_network_equal(&side1network,&criteria->side1network)) {
+    if (!spindump_compactnetwork_equal(&side1network,&criteria->side1network)) {
       spindump_deepdeepdebugf("match fails because side 1 is not equal");  
       return(0);
     }
-    if (!spindump_network_ishost(&side2network)) {
+    if (!spindump_compactnetwork_ishost(&side2network)) {
       spindump_deepdeepdebugf("match fails because side2 is not a host");
       return(0);
     }
     side2address = &side2network.address;
-    if (!spindump_address_equal(side2address,&criteria->side2address)) {
+    if (!spindump_compactaddress_equal(side2address,&criteria->side2address)) {
       spindump_deepdeepdebugf("match fails because side2 is not equal");
       return(0);
     }
@@ -467,7 +473,42 @@ spindump_connections_match(struct spindump_connection* connection,
 }
 
 //
-// Search for a connection based on given criteria
+// Check the entries of an index bucket that have been linked under a
+// given key, and see if any of them matches the search
+// criteria. Several connections may match, in which case the one
+// earliest in the connections table is selected, just as a linear
+// scan of the table would select it. The best connection found so far
+// is in *found, and is updated if a better one is found.
+//
+
+static void
+spindump_connections_search_bucket(struct spindump_connection_hashentry* entry,
+                                   uint32_t key,
+                                   struct spindump_connection_searchcriteria* criteria,
+                                   struct spindump_connection** found,
+                                   int* fromResponder) {
+  for (; entry != 0; entry = entry->next) {
+
+    if (entry->key != key) continue;
+    struct spindump_connection* connection = entry->connection;
+    if (*found != 0 && connection->tableIndex >= (*found)->tableIndex) continue;
+
+    spindump_deepdeepdebugf("search compares to connection %u", connection->id);
+
+    int candidateFromResponder = 0;
+    if (spindump_connections_match(connection,criteria,&candidateFromResponder)) {
+      *found = connection;
+      *fromResponder = candidateFromResponder;
+    }
+
+  }
+}
+
+//
+// Search for a connection based on given criteria. The table indexes
+// are used whenever the criteria are specific enough, either on
+// addresses and ports or on QUIC CIDs. Otherwise, the search falls
+// back to a linear scan of the table.
 //
 
 struct spindump_connection*
@@ -483,33 +524,91 @@ spindump_connections_search(struct spindump_connection_searchcriteria* criteria,
   spindump_assert(table != 0);
   spindump_assert(fromResponder != 0);
   
-  //
-  // Search the table
-  // 
-
-  for (unsigned i = 0; i < table->nConnections; i++) {
-    struct spindump_connection* connection = table->connections[i];
-    if (connection != 0) {
-
-      spindump_deepdeepdebugf("search compares to connection %u", connection->id);
+  struct spindump_connection* found = 0;
+  uint32_t key;
+  
+  if (spindump_connectionstable_index_criteriakey(criteria,&key)) {
+
+    //
+    // Search the address and port index
+    // 
+
+    spindump_connections_search_bucket(spindump_connectionstable_index_bucket(&table->tupleIndex,key),
+                                       key,
+                                       criteria,
+                                       &found,
+                                       fromResponder);
+
+  } else if (criteria->matchQuicCids != spindump_connection_searchcriteria_srcdst_none) {
+
+    //
+    // Search the CID index. Every QUIC connection is linked under
+    // both of its CIDs, so looking under the destination CID finds
+    // connections in both directions.
+    // 
+
+    struct spindump_quic_connectionid* cid =
+      (criteria->matchQuicCids == spindump_connection_searchcriteria_srcdst_sourceonly) ?
+      &criteria->side1connectionId : &criteria->side2connectionId;
+    key = spindump_connectionstable_index_cidkey(cid->id,cid->len);
+    spindump_connections_search_bucket(spindump_connectionstable_index_bucket(&table->cidIndex,key),
+                                       key,
+                                       criteria,
+                                       &found,
+                                       fromResponder);
+
+  } else if (criteria->matchPartialDestinationCid || criteria->matchPartialSourceCid) {
+
+    //
+    // Search the CID index with a CID of unknown length, by trying
+    // each length that some CID in the index has
+    // 
+
+    const unsigned char* partial =
+      criteria->matchPartialDestinationCid ? criteria->partialDestinationCid : criteria->partialSourceCid;
+    spindump_assert(partial != 0);
+    for (unsigned int length = 0; length <= spindump_connection_quic_cid_maxlen; length++) {
+      if (table->cidLengths[length] == 0) continue;
+      key = spindump_connectionstable_index_cidkey(partial,length);
+      spindump_connections_search_bucket(spindump_connectionstable_index_bucket(&table->cidIndex,key),
+                                         key,
+                                         criteria,
+                                         &found,
+                                         fromResponder);
+    }
 
-      if (spindump_connections_match(connection,criteria,fromResponder)) {
+  } else {
+    
+    //
+    // Search the table
+    // 
+    
+    for (unsigned i = 0; i < table->nConnections && found == 0; i++) {
+      struct spindump_connection* connection = table->connections[i];
+      if (connection != 0) {
+        
+        spindump_deepdeepdebugf("search compares to connection %u", connection->id);
+        
+        if (spindump_connections_match(connection,criteria,fromResponder)) {
+          found = connection;
+        }
         
-        spindump_debugf("found an existing %s connection %u",
-                        spindump_connection_type_to_string(connection->type),
-                        connection->id);
-        return(connection);
-
       }
-      
     }
+    
   }
 
   //
-  // Not found at all. Return null pointer.
+  // Return the found connection, or a null pointer if not found
   // 
   
-  return(0);
+  if (found != 0) {
+    spindump_debugf("found an existing %s connection %u",
+                    spindump_connection_type_to_string(found->type),
+                    found->id);
+  }
+  
+  return(found);
 }
 
 //
@@ -541,8 +640,8 @@ spindump_connections_searchconnection_icmp(const spindump_address* side1address,
   criteria.icmpId = side1peerId;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -578,8 +677,8 @@ spindump_connections_searchconnection_tcp(const spindump_address* side1address,
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -617,8 +716,8 @@ spindump_connections_searchconnection_tcp_either(const spindump_address* side1ad
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -652,8 +751,8 @@ spindump_connections_searchconnection_sctp(const spindump_address* side1address,
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -691,8 +790,8 @@ spindump_connections_searchconnection_sctp_either(const spindump_address* side1a
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -726,8 +825,8 @@ spindump_connections_searchconnection_udp(const spindump_address* side1address,
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -764,8 +863,8 @@ spindump_connections_searchconnection_udp_either(const spindump_address* side1ad
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -799,8 +898,8 @@ spindump_connections_searchconnection_dns(const spindump_address* side1address,
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -837,8 +936,8 @@ spindump_connections_searchconnection_dns_either(const spindump_address* side1ad
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -872,8 +971,8 @@ spindump_connections_searchconnection_coap(const spindump_address* side1address,
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -910,8 +1009,8 @@ spindump_connections_searchconnection_coap_either(const spindump_address* side1a
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -946,8 +1045,8 @@ spindump_connections_searchconnection_quic_5tuple(const spindump_address* side1a
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -1111,8 +1210,8 @@ spindump_connections_searchconnection_quic_5tuple_either(const spindump_address*
   criteria.side2port = side2port;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_allowreverse;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   return(spindump_connections_search(&criteria,
                                      table,
@@ -1160,26 +1259,48 @@ spindump_connections_searchconnection_quic_cids_either(struct spindump_quic_conn
 // connection ID; allow finding either direction object. Return the
 // found object, or 0 if not found.
 //
+// A connection whose destination CID matches is preferred over one
+// whose source CID matches, as if the two had been searched for one
+// after the other. Both are looked for in one pass through the CID
+// index, under the CID lengths that are in use.
+//
 
 struct spindump_connection*
 spindump_connections_searchconnection_quic_partialcid_either(const unsigned char* destinationCid,
                                                              struct spindump_connectionstable* table,
                                                              int* fromResponder) {
+  spindump_assert(destinationCid != 0);
+  spindump_assert(table != 0);
+  spindump_assert(fromResponder != 0);
+  
   spindump_deepdeepdebugf("searchconnection_quic_partialcid_either");
-  struct spindump_connection* connection =
-    spindump_connections_searchconnection_quic_partialcid(destinationCid,
-                                                          table);
-  if (connection != 0) {
-    *fromResponder = 0;
-    return(connection);
+  struct spindump_connection* found[2] = { 0, 0 }; // by destination CID and by source CID
+  for (unsigned int length = 0; length <= spindump_connection_quic_cid_maxlen; length++) {
+    if (table->cidLengths[length] == 0) continue;
+    uint32_t key = spindump_connectionstable_index_cidkey(destinationCid,length);
+    struct spindump_connection_hashentry* entry =
+      spindump_connectionstable_index_bucket(&table->cidIndex,key);
+    for (; entry != 0; entry = entry->next) {
+      if (entry->key != key || entry->length != length) continue;
+      struct spindump_connection* connection = entry->connection;
+      unsigned int side = (entry == &connection->cidEntries[1]) ? 0 : 1;
+      if (found[side] != 0 && connection->tableIndex >= found[side]->tableIndex) continue;
+      struct spindump_quic_connectionid* cid =
+        side == 0 ? &connection->u.quic.peer2ConnectionID : &connection->u.quic.peer1ConnectionID;
+      if (spindump_analyze_quic_partialquicidequal(destinationCid,cid)) {
+        found[side] = connection;
+      }
+    }
   }
   
-  connection = spindump_connections_searchconnection_quic_partialcid_source(destinationCid,
-                                                                            table);
+  if (found[0] != 0) {
+    *fromResponder = 0;
+    return(found[0]);
+  }
   
-  if (connection != 0) {
+  if (found[1] != 0) {
     *fromResponder = 1;
-    return(connection);
+    return(found[1]);
   }
   
   return(0);
@@ -1200,8 +1321,8 @@ spindump_connections_searchconnection_aggregate_hostpair(const spindump_address*
   criteria.type = spindump_connection_aggregate_hostpair;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -1225,8 +1346,8 @@ spindump_connections_searchconnection_aggregate_hostnetwork(const spindump_addre
   criteria.type = spindump_connection_aggregate_hostnetwork;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_hostnetwork;
-  criteria.side1address = *side1address;
-  criteria.side2network = *side2network;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactnetwork_fromnetwork(side2network,&criteria.side2network);
   
   int fromResponder;
   
@@ -1250,8 +1371,8 @@ spindump_connections_searchconnection_aggregate_networknetwork(const spindump_ne
   criteria.type = spindump_connection_aggregate_networknetwork;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_networknetwork;
-  criteria.side1network = *side1network;
-  criteria.side2network = *side2network;
+  spindump_compactnetwork_fromnetwork(side1network,&criteria.side1network);
+  spindump_compactnetwork_fromnetwork(side2network,&criteria.side2network);
   
   int fromResponder;
   
@@ -1275,8 +1396,8 @@ spindump_connections_searchconnection_aggregate_hostmultinet(const spindump_addr
   criteria.type = spindump_connection_aggregate_hostmultinet;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both;
-  criteria.side1address = *side1address;
-  criteria.side2address = *side2address;
+  spindump_compactaddress_fromaddress(side1address,&criteria.side1address);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -1300,8 +1421,8 @@ spindump_connections_searchconnection_aggregate_networkmultinet(const spindump_n
   criteria.type = spindump_connection_aggregate_networkmultinet;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_both_networkhost;
-  criteria.side1network = *side1network;
-  criteria.side2address = *side2address;
+  spindump_compactnetwork_fromnetwork(side1network,&criteria.side1network);
+  spindump_compactaddress_fromaddress(side2address,&criteria.side2address);
   
   int fromResponder;
   
@@ -1323,7 +1444,7 @@ spindump_connections_searchconnection_aggregate_multicastgroup(const spindump_ad
   criteria.type = spindump_connection_aggregate_multicastgroup;
   
   criteria.matchAddresses = spindump_connection_searchcriteria_srcdst_sourceonly;
-  criteria.side1address = *address;
+  spindump_compactaddress_fromaddress(address,&criteria.side1address);
   
   int fromResponder;
   
@@ -31,80 +31,47 @@
 //
 
 static void
-spindump_connections_set_unlinkfromset(struct spindump_connection* connection,
-                                       struct spindump_connection* otherConnection);
+spindump_connections_set_unlinkentry(struct spindump_connection_setentry* entry);
+static void
+spindump_connections_set_unlink(struct spindump_connection_setentry* entry);
 
 //
 // Actual code --------------------------------------------------------------------------------
 //
 
 //
-// Notify a given connection object that it is being removed from a
-// given set by another connection, and that consequently, the first
-// connection should remove any links it might have with the second
-// connection as well.
-// 
+// Take an entry out of the set it is in.
+//
 
 static void
-spindump_connections_set_unlinkfromset(struct spindump_connection* connection,
-                                       struct spindump_connection* otherConnection) {
-  spindump_assert(connection != 0);
-  spindump_assert(otherConnection != 0);
-  if (spindump_connections_set_inset(&connection->aggregates,otherConnection)) {
-    spindump_connections_set_remove(&connection->aggregates,otherConnection);
-  }
-  
-  switch (connection->type) {
-    
-  case spindump_connection_transport_udp:
-  case spindump_connection_transport_tcp:
-  case spindump_connection_transport_sctp:
-  case spindump_connection_transport_quic:
-  case spindump_connection_transport_dns:
-  case spindump_connection_transport_coap:
-  case spindump_connection_transport_icmp:
-    break;
-    
-  case spindump_connection_aggregate_hostpair:
-    if (spindump_connections_set_inset(&connection->u.aggregatehostpair.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatehostpair.connections,otherConnection);
-    }
-    break;
-    
-  case spindump_connection_aggregate_hostnetwork:
-    if (spindump_connections_set_inset(&connection->u.aggregatehostnetwork.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatehostnetwork.connections,otherConnection);
-    }
-    break;
-    
-  case spindump_connection_aggregate_networknetwork:
-    if (spindump_connections_set_inset(&connection->u.aggregatenetworknetwork.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatenetworknetwork.connections,otherConnection);
-    }
-    break;
-    
-  case spindump_connection_aggregate_hostmultinet:
-    if (spindump_connections_set_inset(&connection->u.aggregatehostmultinet.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatehostmultinet.connections,otherConnection);
-    }
-    break;
-    
-  case spindump_connection_aggregate_networkmultinet:
-    if (spindump_connections_set_inset(&connection->u.aggregatenetworkmultinet.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatenetworkmultinet.connections,otherConnection);
-    }
-    break;
-    
-  case spindump_connection_aggregate_multicastgroup:
-    if (spindump_connections_set_inset(&connection->u.aggregatemulticastgroup.connections,otherConnection)) {
-      spindump_connections_set_remove(&connection->u.aggregatemulticastgroup.connections,otherConnection);
-    }
-    break;
+spindump_connections_set_unlinkentry(struct spindump_connection_setentry* entry) {
+  struct spindump_connection_set* set = entry->set;
+  spindump_assert(set != 0);
+  spindump_assert(set->nConnections > 0);
+  if (entry->prev != 0) entry->prev->next = entry->next;
+  else set->first = entry->next;
+  if (entry->next != 0) entry->next->prev = entry->prev;
+  else set->last = entry->prev;
+  set->nConnections--;
+}
 
-  default:
-    spindump_errorf("invalid connection type");
-    break;
-  }
+//
+// Remove a membership, i.e., take the given entry and its other entry
+// out of their sets, and free them. This is the same as telling the
+// connection in the other set that it is no longer linked to the
+// connection of this entry.
+//
+
+static void
+spindump_connections_set_unlink(struct spindump_connection_setentry* entry) {
+  spindump_assert(entry != 0);
+  spindump_assert(entry->other != 0);
+  spindump_assert(entry->other->other == entry);
+  struct spindump_connection_setentry* other = entry->other;
+  spindump_connections_set_unlinkentry(entry);
+  spindump_connections_set_unlinkentry(other);
+  spindump_deepdebugf("free a membership in spindump_connections_set_unlink");
+  spindump_free(entry < other ? entry : other);
 }
 
 //
@@ -125,151 +92,109 @@ spindump_connections_set_initialize(struct spindump_connection_set* set) {
 //
 // De-initialize a connection set; only an initialized connection set can be
 // de-initialized. All resources dedicated to the set are freed. The set is in
-// the connection "owner".
+// the connection "owner", and the owner is removed from the sets of the
+// connections that were in this set.
 // 
 
 void
 spindump_connections_set_uninitialize(struct spindump_connection_set* set,
                                       struct spindump_connection* owner) {
   spindump_assert(set != 0);
-  if (set->maxNConnections > 0) {
-    unsigned int i;
-    for (i = 0; i < set->nConnections; i++) {
-      struct spindump_connection* connection = set->set[i];
-      spindump_assert(connection != 0);
-      spindump_connections_set_unlinkfromset(connection,owner);
-    }
-    spindump_deepdebugf("freeting the set table in spindump_connections_set_uninitialize");
-    spindump_free(set->set);
+  while (set->first != 0) {
+    spindump_assert(set->first->other->connection == owner);
+    spindump_connections_set_unlink(set->first);
   }
+  spindump_assert(set->nConnections == 0);
   memset(set,0,sizeof(*set));
 }
 
 //
 // Determine if a given connection is in the set.
+//
+// Note: This function goes through the set. It is meant for the small
+// sets of aggregates that a connection belongs to, and for checks;
+// adding and removing memberships does not need it.
 // 
 
 int
-spindump_connections_set_inset(struct spindump_connection_set* set,
-                               struct spindump_connection* connection) {
+spindump_connections_set_inset(const struct spindump_connection_set* set,
+                               const struct spindump_connection* connection) {
   spindump_assert(set != 0);
   spindump_assert(connection != 0);
-  for (unsigned int i = 0; i < set->nConnections; i++) {
-    if (set->set[i] == connection) return(1);
+  for (const struct spindump_connection_setentry* entry = set->first;
+       entry != 0;
+       entry = entry->next) {
+    if (entry->connection == connection) return(1);
   }
   return(0);
 }
 
 //
-// Add a new connection to the set.
+// Add a new membership: connection is added to set, which belongs to
+// owner, and owner is added to connectionSet, which belongs to
+// connection. For instance, a connection is added to the set of an
+// aggregate, and the aggregate to the set of aggregates of the
+// connection. The membership is removed from both sets when either
+// set is uninitialized.
 // 
 
 void
 spindump_connections_set_add(struct spindump_connection_set* set,
-                             struct spindump_connection* connection) {
+                             struct spindump_connection* connection,
+                             struct spindump_connection_set* connectionSet,
+                             struct spindump_connection* owner) {
   spindump_assert(set != 0);
   spindump_assert(connection != 0);
-  spindump_assert(!spindump_connections_set_inset(set,connection));
-  
-  if (set->set == 0) {
-
-    //
-    // Make the first allocation of the table
-    // 
-    
-    spindump_assert(set->nConnections == 0);
-    spindump_assert(set->maxNConnections == 0);
-    unsigned int defaultN = 10;
-    unsigned int size = defaultN * sizeof(struct spindump_connection*);
-    set->set = (struct spindump_connection**)spindump_malloc(size);
-    if (set->set == 0) {
-      spindump_fatalf("cannot allocate connection set of %u bytes", size);
-    }
-    memset(set->set,0,size);
-    set->maxNConnections = defaultN;
-    set->nConnections = 1;
-    set->set[0] = connection;
-
-  } else if (set->nConnections < set->maxNConnections) {
-
-    //
-    // Still space at the table, just add to it
-    // 
-    
-    set->set[set->nConnections++] = connection;
-    
-  } else {
-    
-    //
-    // Expand the already existing table
-    // 
-    
-    spindump_assert(set->maxNConnections > 0);
-    unsigned int newN = 2 * set->maxNConnections;
-    unsigned int size = newN * sizeof(struct spindump_connection*);
-    struct spindump_connection** newSet = (struct spindump_connection**)spindump_malloc(size);
-    if (newSet == 0) {
-      spindump_fatalf("cannot expand connection set to %u bytes", size);
-    }
-    memset(newSet,0,size);
-    memcpy(newSet,set->set,set->maxNConnections * sizeof(struct spindump_connection*));
-    set->maxNConnections = newN;
-    set->set = newSet;
-    set->set[set->nConnections++] = connection;
-    
+  spindump_assert(connectionSet != 0);
+  spindump_assert(owner != 0);
+  spindump_assert(set != connectionSet);
+  spindump_assert(!spindump_connections_set_inset(connectionSet,owner));
+
+  unsigned int size = 2 * sizeof(struct spindump_connection_setentry);
+  struct spindump_connection_setentry* entries = (struct spindump_connection_setentry*)spindump_malloc(size);
+  if (entries == 0) {
+    spindump_fatalf("cannot allocate connection set membership of %u bytes", size);
   }
-}
-
-//
-// Remove an item from a connection set
-// 
-
-void
-spindump_connections_set_remove(struct spindump_connection_set* set,
-                                struct spindump_connection* connection) {
-  spindump_assert(set != 0);
-  spindump_assert(connection != 0);
-  spindump_assert(set->nConnections > 0);
-  spindump_assert(set->maxNConnections > 0);
-  spindump_assert(set->set != 0);
   
-  for (unsigned int i = 0; i < set->nConnections; i++) {
-    if (set->set[i] == connection) {
-      for (unsigned int j = i+1; j < set->nConnections; j++) {
-        set->set[j-1] = set->set[j];
-      }
-      set->set[set->nConnections -1] = 0;
-      set->nConnections--;
-      return;
-    }
-  }
+  entries[0].connection = connection;
+  entries[0].set = set;
+  entries[0].other = &entries[1];
+  entries[1].connection = owner;
+  entries[1].set = connectionSet;
+  entries[1].other = &entries[0];
   
-  spindump_errorf("attempted to remove connection %u from a set that does not include that connection",
-                  connection->id);
+  for (unsigned int i = 0; i < 2; i++) {
+    struct spindump_connection_setentry* entry = &entries[i];
+    entry->next = 0;
+    entry->prev = entry->set->last;
+    if (entry->set->last != 0) entry->set->last->next = entry;
+    else entry->set->first = entry;
+    entry->set->last = entry;
+    entry->set->nConnections++;
+  }
 }
 
 //
 // Return a string listing (some maximum number of) connection IDs of
 // the connections in the set.
 // 
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
-spindump_connections_set_listids(struct spindump_connection_set* set) {
-  static char buf[200];
+spindump_connections_set_listids(const struct spindump_connection_set* set) {
+  static _Thread_local char buf[200];
   int seenone = 0;
   memset(buf,0,sizeof(buf));
-  for (unsigned int i = 0; i < set->nConnections; i++) {
-    struct spindump_connection* connection = set->set[i];
-    if (connection != 0) {
-      snprintf(buf+strlen(buf),
-               sizeof(buf)-1-strlen(buf),
-               "%s%u",
-               seenone ? "," : "",
-               connection->id);
-      seenone = 1;
-    }
+  for (const struct spindump_connection_setentry* entry = set->first;
+       entry != 0 && strlen(buf) < sizeof(buf)-1;
+       entry = entry->next) {
+    snprintf(buf+strlen(buf),
+             sizeof(buf)-1-strlen(buf),
+             "%s%u",
+             seenone ? "," : "",
+             entry->connection->id);
+    seenone = 1;
   }
   return(buf);
 }
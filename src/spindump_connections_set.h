@@ -45,15 +45,14 @@ void
 spindump_connections_set_uninitialize(struct spindump_connection_set* set,
                                       struct spindump_connection* owner);
 int
-spindump_connections_set_inset(struct spindump_connection_set* set,
-                               struct spindump_connection* connection);
+spindump_connections_set_inset(const struct spindump_connection_set* set,
+                               const struct spindump_connection* connection);
 void
 spindump_connections_set_add(struct spindump_connection_set* set,
-                             struct spindump_connection* connection);
-void
-spindump_connections_set_remove(struct spindump_connection_set* set,
-                                struct spindump_connection* connection);
+                             struct spindump_connection* connection,
+                             struct spindump_connection_set* connectionSet,
+                             struct spindump_connection* owner);
 const char*
-spindump_connections_set_listids(struct spindump_connection_set* set);
+spindump_connections_set_listids(const struct spindump_connection_set* set);
 
 #endif // SPINDUMP_CONNECTIONS_SET_H
@@ -37,8 +37,7 @@ spindump_connection_set_iterator_initialize(struct spindump_connection_set* set,
                                             struct spindump_connection_set_iterator* iter) {
   spindump_assert(set != 0);
   spindump_assert(iter != 0);
-  iter->set = set;
-  iter->iteration = 0;
+  iter->next = set->first;
 }
 
 //
@@ -48,7 +47,7 @@ spindump_connection_set_iterator_initialize(struct spindump_connection_set* set,
 int
 spindump_connection_set_iterator_end(struct spindump_connection_set_iterator* iter) {
   spindump_assert(iter != 0);
-  return(iter->iteration >= iter->set->nConnections);
+  return(iter->next == 0);
 }
 
 //
@@ -56,14 +55,17 @@ spindump_connection_set_iterator_end(struct spindump_connection_set_iterator* it
 // that connection.
 //
 // Note: This function must not be called if the iterator is already at
-// the end.
+// the end. The returned connection may be removed from the set before
+// the iterator is moved again.
 //
 
 struct spindump_connection*
 spindump_connection_set_iterator_next(struct spindump_connection_set_iterator* iter) {
   spindump_assert(iter != 0);
   spindump_assert(!spindump_connection_set_iterator_end(iter));
-  return(iter->set->set[iter->iteration++]);
+  struct spindump_connection_setentry* entry = iter->next;
+  iter->next = entry->next;
+  return(entry->connection);
 }
 
 //
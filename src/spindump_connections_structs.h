@@ -86,14 +86,149 @@ struct spindump_quic_connectionid {
   unsigned char padding[2]; // unused padding, to align the structure size properly
 };
 
+//
+// A set of connections, such as the connections that belong to an
+// aggregate, or the aggregates that a connection belongs to. Each
+// membership of a connection in an aggregate is one pair of entries,
+// allocated together: one entry is in the aggregate's set and refers
+// to the connection, and the other entry is in the connection's set
+// and refers to the aggregate. The entries of a set form a doubly
+// linked list in the order they were added, so that a membership can
+// be removed from both sets without searching either.
+//
+
+struct spindump_connection_setentry {
+  struct spindump_connection* connection;           // the connection that is in the set
+  struct spindump_connection_set* set;              // the set that this entry is in
+  struct spindump_connection_setentry* next;        // next entry in the same set
+  struct spindump_connection_setentry* prev;        // previous entry in the same set
+  struct spindump_connection_setentry* other;       // the other entry of the same membership
+};
+
 struct spindump_connection_set {
   unsigned int nConnections;
-  unsigned int maxNConnections;
-  struct spindump_connection** set;
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  struct spindump_connection_setentry* first;
+  struct spindump_connection_setentry* last;
+};
+
+struct spindump_connection_hashentry {
+  struct spindump_connection_hashentry* next;       // next entry in the same hash bucket
+  struct spindump_connection* connection;           // the connection that this entry belongs to
+  uint32_t key;                                     // hash key under which the entry is linked
+  uint16_t linked;                                  // is the entry currently linked to an index?
+  uint16_t length;                                  // identifier length the entry is linked under (CID index)
 };
 
 typedef uint64_t spindump_handler_mask;
 
+//
+// Updates not yet folded into aggregates, when aggregates are
+// updated in batches (see spindump_table_rollup.c). For a member
+// connection, these are the packet counters since the last fold. For
+// an aggregate, these are the RTT measurement events not yet
+// delivered to the handlers. The record is allocated on first need,
+// and a connection with pending updates is on the table's list of
+// pending connections.
+//
+
+#define spindump_connection_rollup_nevents 4
+
+struct spindump_connection_rollup {
+  struct spindump_connection* nextPending;          // next connection on the table's pending list
+  int pending;                                      // is the connection on the pending list?
+  int responded;                                    // have all aggregates seen packets from side 2?
+  unsigned long long earliest;                      // deltas must be from this time (us) or later
+  unsigned long long deadline;                      // and before this time (us), to stay in the same period
+  struct timeval firstPacketFromSide1;              // the first packet from side 1 since the last fold
+  struct timeval firstPacketFromSide2;              // the first packet from side 2 since the last fold
+  struct timeval latestPacketFromSide1;             // the latest packet from side 1 since the last fold
+  struct timeval latestPacketFromSide2;             // the latest packet from side 2 since the last fold
+  unsigned int packetsFromSide1;                    // packets from side 1 since the last fold
+  unsigned int packetsFromSide2;                    // packets from side 2 since the last fold
+  unsigned int bytesFromSide1;                      // bytes from side 1 since the last fold
+  unsigned int bytesFromSide2;                      // bytes from side 2 since the last fold
+  unsigned int ect0FromInitiator;                   // ECN ECT(0) counts since the last fold
+  unsigned int ect0FromResponder;                   // ECN ECT(0) counts since the last fold
+  unsigned int ect1FromInitiator;                   // ECN ECT(1) counts since the last fold
+  unsigned int ect1FromResponder;                   // ECN ECT(1) counts since the last fold
+  unsigned int events;                              // undelivered RTT events, one bit per kind
+  unsigned int eventLengths[spindump_connection_rollup_nevents]; // packet lengths of the latest events
+  struct timeval eventTimes[spindump_connection_rollup_nevents]; // times of the latest events
+};
+
+//
+// The cold part of a connection: state that is large and only needed
+// when a measurement is made, rather than on every packet or every
+// periodic scan of the table. The cold part is allocated on first
+// need. For the types that have protocol trackers (TCP, SCTP, DNS,
+// COAP, QUIC and ICMP) that is when the connection is created, as
+// the trackers are used on the very first packet. For UDP and
+// aggregates it is when the first RTT measurement or handler data
+// arrives, and many such connections never need one.
+//
+// Like the connection object itself, the cold part only extends to
+// the end of the union arm for the connection's type.
+//
+
+struct spindump_connection_cold {
+
+  struct spindump_rtt leftRTT;                      // left-side (side 1) RTT calculations
+  struct spindump_rtt rightRTT;                     // right-side (side 2) RTT calculations
+  struct spindump_rtt respToInitFullRTT;            // end-to-end RTT calculations observed from responder
+  struct spindump_rtt initToRespFullRTT;            // end-to-end RTT calculations observed from initiator
+  struct spindump_histogram rightRTTPeriod;         // right RTTs measured since the previous periodic report
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  void* handlerConnectionDatas
+        [spindump_connection_max_handlers];         // data store for registered handlers to add data to a connection
+
+  union {
+
+    struct {
+      struct spindump_seqtracker side1Seqs;         // when did we see sequence numbers from side1?
+      struct spindump_seqtracker side2Seqs;         // when did we see sequence numbers from side2?
+    } tcp;
+
+    struct {
+      struct spindump_tsntracker side1Seqs;         // when did we see sequence numbers from side1?
+      struct spindump_tsntracker side2Seqs;         // when did we see sequence numbers from side2?
+    } sctp;
+
+    struct {
+      struct spindump_messageidtracker side1MIDs;   // when did we see message IDs from side1?
+      struct spindump_messageidtracker side2MIDs;   // when did we see message IDs from side2?
+    } dns;
+
+    struct {
+      struct spindump_messageidtracker side1MIDs;   // when did we see message IDs from side1?
+      struct spindump_messageidtracker side2MIDs;   // when did we see message IDs from side2?
+    } coap;
+
+    struct {
+      struct spindump_spintracker spinFromPeer1to2; // tracking spin bit flips from side 1 to 2
+      struct spindump_spintracker spinFromPeer2to1; // tracking spin bit flips from side 2 to 1
+      struct spindump_delaybittracker delaybitFromPeer1to2; // tracking delay bit from side 1 to 2
+      struct spindump_delaybittracker delaybitFromPeer2to1; // tracking delay bit from side 2 to 1
+      struct spindump_rtloss1tracker rtloss1FromPeer1to2;   // tracking round trip loss (1 bit) from side 1 to 2
+      struct spindump_rtloss1tracker rtloss1FromPeer2to1;   // tracking round trip loss (1 bit) from side 2 to 1
+      struct spindump_rtloss2tracker rtloss2FromPeer1to2;   // tracking round trip loss (2 bits) from side 1 to 2
+      struct spindump_rtloss2tracker rtloss2FromPeer2to1;   // tracking round trip loss (2 bits) from side 2 to 1
+      struct spindump_qrlosstracker qrFromPeer1to2;         // tracking T.Italia QR from side 1 to 2
+      struct spindump_qrlosstracker qrFromPeer2to1;         // tracking T.Italia QR from side 2 to 1
+      struct spindump_qllosstracker qlFromPeer1to2;         // tracking Orange QL from side 1 to 2
+      struct spindump_qllosstracker qlFromPeer2to1;         // tracking Orange QL from side 2 to 1
+      struct spindump_qrloss qrLossesFrom1to2;        // T.Italia QR lossrate measured from side 1 to 2
+      struct spindump_qrloss qrLossesFrom2to1;        // T.Italia QR lossrate measured from side 2 to 1
+    } quic;
+
+    struct {
+      struct spindump_messageidtracker side1Seqs;   // latest sequence numbers from side1
+    } icmp;
+
+  } u;
+
+};
+
 struct spindump_connection {
 
   unsigned int id;                                  // sequentially allocated descriptive id for the connection
@@ -102,6 +237,13 @@ struct spindump_connection {
   int manuallyCreated;                              // was this entry created by management action or dynamically?
   int remote;                                       // was this entry created by a remote Spindump instance?
   int deleted;                                      // is the connection closed/deleted (but not yet removed)?
+  unsigned int tableIndex;                          // position of the connection in the connections table
+  unsigned int tableGeneration;                     // generation of the connection in the connections table
+  unsigned long long timerExpiry;                   // second at which the timeouts are next checked
+  struct spindump_connection* timerNext;            // next connection in the same timer wheel slot
+  struct spindump_connection** timerPrev;           // pointer to this connection in its slot, 0 if not scheduled
+  struct spindump_connection_hashentry tupleEntry;  // entry in the table's address/port index
+  struct spindump_connection_hashentry cidEntries[2]; // entries in the table's QUIC CID index (peer 1 and 2)
   spindump_tags tags;                               // tags associated with the connection
   uint8_t padding[4];                               // unused padding to align the next field properly
   struct timeval creationTime;                      // when did we see the first packet?
@@ -123,38 +265,30 @@ struct spindump_connection {
   float qLossesFrom2to1;                            // Square bit lossrate measured in DL
   float rLossesFrom1to2;                            // Retransmit bit lossrate measured in UL
   float rLossesFrom2to1;                            // Retransmit bit lossrate measured in DL
-  struct spindump_rtt leftRTT;                      // left-side (side 1) RTT calculations
-  struct spindump_rtt rightRTT;                     // right-side (side 2) RTT calculations
-  struct spindump_rtt respToInitFullRTT;            // end-to-end RTT calculations observed from responder
-  struct spindump_rtt initToRespFullRTT;            // end-to-end RTT calculations observed from initiator
   struct spindump_connection_set aggregates;        // aggregate connection sets where this connection belongs to
   spindump_handler_mask handlerMask;                // handler bit mask for connection-specific handlers
-  void* handlerConnectionDatas
-        [spindump_connection_max_handlers];         // data store for registered handlers to add data to a connection
+  struct spindump_connection_cold* cold;            // rarely accessed, larger state, 0 if not yet allocated
+  struct spindump_connection_rollup* rollup;        // updates not yet folded into aggregates, 0 if none
 
   union {
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
-      uint8_t padding[4];                           // unused
-      struct spindump_seqtracker side1Seqs;         // when did we see sequence numbers from side1?
-      struct spindump_seqtracker side2Seqs;         // when did we see sequence numbers from side2?
       int finFromSide1;                             // seen a FIN from side1?
       int finFromSide2;                             // seen a FIN from side2?
+      uint8_t padding[4];                           // unused
     } tcp;
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
       uint32_t side1Vtag;                           // Vtag of association for side1
       uint32_t side2Vtag;                           // Vtag of association for side2
-      struct spindump_tsntracker side1Seqs;         // when did we see sequence numbers from side1?
-      struct spindump_tsntracker side2Seqs;         // when did we see sequence numbers from side2?
       //uint8_t padding[4];                           // unused
       uint8_t side1HbCnt;                           // Number of HBs inflight seen from side 1
       struct timeval side1hbTime;                   // the time of the last HB seen from side 1
@@ -163,34 +297,30 @@ struct spindump_connection {
     } sctp;
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
       uint8_t padding[4];                           // unused padding to align the structure size properly
     } udp;
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
       uint8_t padding[4];                           // unused padding to align the next field properly
-      struct spindump_messageidtracker side1MIDs;   // when did we see message IDs from side1?
-      struct spindump_messageidtracker side2MIDs;   // when did we see message IDs from side2?
       char lastQueriedName[40];                     // the latest name that was queried
     } dns;
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
       int dtls;                                     // is DTLS/TLS in use?
       spindump_tls_version dtlsVersion;             // which DTLS/TLS version is in use
-      uint8_t padding[6];                           // unused padding to align the next field properly
-      struct spindump_messageidtracker side1MIDs;   // when did we see message IDs from side1?
-      struct spindump_messageidtracker side2MIDs;   // when did we see message IDs from side2?
+      uint8_t padding[6];                           // unused padding to align the structure size properly
     } coap;
 
     struct {
@@ -200,8 +330,8 @@ struct spindump_connection {
       spindump_quic_connectionid peer1ConnectionID; // source connection id of the initial packet
       struct
       spindump_quic_connectionid peer2ConnectionID; // source connection id of the initial response packet
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       spindump_port side1peerPort;                  // source port for the initial packe
       spindump_port side2peerPort;                  // destination port for the initial packet
       int attempted0Rtt;                            // whether connection attempted to use 0-RTT setup
@@ -209,66 +339,50 @@ struct spindump_connection {
       struct timeval side2initialResponsePacket;    // the time of the initial response packet from side 2
       unsigned long initialRightRTT;                // initial packet exchange RTT in us
       unsigned long initialLeftRTT;                 // initial packet exchange RTT in us (only available sometimes)
-      struct spindump_spintracker spinFromPeer1to2; // tracking spin bit flips from side 1 to 2
-      struct spindump_spintracker spinFromPeer2to1; // tracking spin bit flips from side 2 to 1
-      struct spindump_delaybittracker delaybitFromPeer1to2; // tracking delay bit from side 1 to 2
-      struct spindump_delaybittracker delaybitFromPeer2to1; // tracking delay bit from side 2 to 1
-      struct spindump_rtloss1tracker rtloss1FromPeer1to2;   // tracking round trip loss (1 bit) from side 1 to 2
-      struct spindump_rtloss1tracker rtloss1FromPeer2to1;   // tracking round trip loss (1 bit) from side 2 to 1
-      struct spindump_rtloss2tracker rtloss2FromPeer1to2;   // tracking round trip loss (2 bits) from side 1 to 2
-      struct spindump_rtloss2tracker rtloss2FromPeer2to1;   // tracking round trip loss (2 bits) from side 2 to 1
-      struct spindump_qrlosstracker qrFromPeer1to2;         // tracking T.Italia QR from side 1 to 2
-      struct spindump_qrlosstracker qrFromPeer2to1;         // tracking T.Italia QR from side 2 to 1
-      struct spindump_qllosstracker qlFromPeer1to2;         // tracking Orange QL from side 1 to 2
-      struct spindump_qllosstracker qlFromPeer2to1;         // tracking Orange QL from side 2 to 1
-      struct spindump_qrloss qrLossesFrom1to2;        // T.Italia QR lossrate measured from side 1 to 2
-      struct spindump_qrloss qrLossesFrom2to1;        // T.Italia QR lossrate measured from side 2 to 1
-      //uint8_t padding2[8];                          // unused padding to align the structure size properly
     } quic;
 
     struct {
-      spindump_address side1peerAddress;            // source address for the initial packet
-      spindump_address side2peerAddress;            // destination address for the initial packet
+      spindump_compactaddress side1peerAddress;     // source address for the initial packet
+      spindump_compactaddress side2peerAddress;     // destination address for the initial packet
       uint8_t side1peerType;                        // the ICMP type used in a request from side 1
       uint8_t padding1;                             // unused padding to align the next field properly
       uint16_t side1peerId;                         // the ICMP id used in a request from side 1
-      struct spindump_messageidtracker side1Seqs;   // latest sequence numbers from side1
-      uint8_t padding2[2];                          // unused padding to align the size of the structure properly
+      uint8_t padding2[4];                          // unused padding to align the size of the structure properly
     } icmp;
 
     struct {
-      spindump_address side1peerAddress;            // address of host on side 1
-      spindump_address side2peerAddress;            // address of host on side 2
+      spindump_compactaddress side1peerAddress;     // address of host on side 1
+      spindump_compactaddress side2peerAddress;     // address of host on side 2
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
     } aggregatehostpair;
 
     struct {
-      spindump_address side1peerAddress;            // address of host on side 1
-      spindump_network side2Network;                // network address on side 2
+      spindump_compactaddress side1peerAddress;     // address of host on side 1
+      spindump_compactnetwork side2Network;         // network address on side 2
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
     } aggregatehostnetwork;
 
     struct {
-      spindump_network side1Network;                // network address on side 1
-      spindump_network side2Network;                // network address on side 2
+      spindump_compactnetwork side1Network;         // network address on side 1
+      spindump_compactnetwork side2Network;         // network address on side 2
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
       int defaultMatch;                             // match only if no other aggregates match
     } aggregatenetworknetwork;
 
     struct {
-      spindump_address group;                       // multicast group address
+      spindump_compactaddress group;                // multicast group address
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
     } aggregatemulticastgroup;
 
     struct {
-      spindump_address side1peerAddress;            // address of host on side 1
-      spindump_address identifier;                  // random address used to identify the aggregate
+      spindump_compactaddress side1peerAddress;     // address of host on side 1
+      spindump_compactaddress identifier;           // random address used to identify the aggregate
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
     } aggregatehostmultinet;
 
     struct {
-      spindump_network side1Network;                // network address on side 1
-      spindump_address identifier;                  // random address used to identify the aggregate
+      spindump_compactnetwork side1Network;         // network address on side 1
+      spindump_compactaddress identifier;           // random address used to identify the aggregate
       struct spindump_connection_set connections;   // what actual connections fall under this aggregate
     } aggregatenetworkmultinet;
 
@@ -276,11 +390,6 @@ struct spindump_connection {
 
 };
 
-struct spindump_connection_network {
-     spindump_network side2Network;                 // network address on side 2
-     struct spindump_connection *connection;        // what aggregate connection this network belongs to
-};
-
 enum spindump_connection_searchcriteria_srcdst {
   spindump_connection_searchcriteria_srcdst_none = 0,
   spindump_connection_searchcriteria_srcdst_sourceonly = 1,
@@ -307,10 +416,10 @@ struct spindump_connection_searchcriteria {
 
   enum spindump_connection_searchcriteria_srcdst matchAddresses;
   uint8_t padding3[4]; // unused padding to align the next field properly
-  spindump_address side1address;
-  spindump_address side2address;
-  spindump_network side1network;
-  spindump_network side2network;
+  spindump_compactaddress side1address;
+  spindump_compactaddress side2address;
+  spindump_compactnetwork side1network;
+  spindump_compactnetwork side2network;
 
   enum spindump_connection_searchcriteria_srcdst matchPorts;
   spindump_port side1port;
@@ -180,11 +180,14 @@ spindump_event_equal(const struct spindump_event* event1,
     if (event1->u.newRttMeasurement.avgRtt != event2->u.newRttMeasurement.avgRtt) return(0);
     if (event1->u.newRttMeasurement.devRtt != event2->u.newRttMeasurement.devRtt) return(0);
     if (event1->u.newRttMeasurement.filtAvgRtt != event2->u.newRttMeasurement.filtAvgRtt) return(0);
+    if (event1->u.newRttMeasurement.smoothedRtt != event2->u.newRttMeasurement.smoothedRtt) return(0);
+    if (event1->u.newRttMeasurement.varRtt != event2->u.newRttMeasurement.varRtt) return(0);
     break;
   case spindump_event_type_periodic:
     if (event1->u.periodic.rttRight != event2->u.periodic.rttRight) return(0);
     if (event1->u.periodic.avgRttRight != event2->u.periodic.avgRttRight) return(0);
     if (event1->u.periodic.devRttRight != event2->u.periodic.devRttRight) return(0);
+    if (!spindump_histogram_equal(&event1->u.periodic.histRight,&event2->u.periodic.histRight)) return(0);
     break;
   case spindump_event_type_spin_flip:
     if (event1->u.spinFlip.direction != event2->u.spinFlip.direction) return(0);
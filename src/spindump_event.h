@@ -27,6 +27,7 @@
 #include "spindump_util.h"
 #include "spindump_tags.h"
 #include "spindump_connections_structs.h"
+#include "spindump_histogram.h"
 
 //
 // Data types ---------------------------------------------------------------------------------
@@ -90,12 +91,15 @@ struct spindump_event_new_rtt_measurement {
   unsigned long devRtt;
   unsigned long filtAvgRtt;
   unsigned long minRtt;
+  unsigned long smoothedRtt;
+  unsigned long varRtt;
 };
 
 struct spindump_event_periodic {
   unsigned long rttRight;
   unsigned long avgRttRight;
   unsigned long devRttRight;
+  struct spindump_histogram histRight;       // right RTTs measured since the previous periodic event
 };
 
 struct spindump_event_spin_flip {
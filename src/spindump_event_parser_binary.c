@@ -0,0 +1,1111 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2019 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+// 
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_event.h"
+#include "spindump_event_parser_binary.h"
+#include "spindump_connections.h"
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_event_parser_binary_fixedheaderlength 12 // type, connection type, state, flags, timestamp
+
+#define spindump_event_parser_binary_flag_tags       0x01
+#define spindump_event_parser_binary_flag_notes      0x02
+
+#define spindump_event_parser_binary_family_none        0
+#define spindump_event_parser_binary_family_ipv4        4
+#define spindump_event_parser_binary_family_ipv6        6
+
+#define spindump_event_parser_binary_session_empty      0 // ""
+#define spindump_event_parser_binary_session_raw        1 // any string, as is
+#define spindump_event_parser_binary_session_number     2 // "n", e.g., ICMP identifiers
+#define spindump_event_parser_binary_session_ports      3 // "p1:p2"
+#define spindump_event_parser_binary_session_cids       4 // "cid1-cid2 (p1:p2)", with cids in hex or "null"
+
+#define spindump_event_parser_binary_maxcidlength      32 // bytes
+#define spindump_event_parser_binary_nullcid         0xff // cid length value that stands for "null"
+#define spindump_event_parser_binary_maxsessionstring 256 // chars, enough for any packed session identifier
+
+//
+// Data types ---------------------------------------------------------------------------------
+//
+
+struct spindump_event_parser_binary_writer {
+  uint8_t* buffer;
+  size_t length;
+  size_t position;
+  int overflow;
+  uint8_t padding[4]; // unused padding to align the structure size properly
+};
+
+struct spindump_event_parser_binary_reader {
+  const uint8_t* buffer;
+  size_t length;
+  size_t position;
+  int error;
+  uint8_t padding[4]; // unused padding to align the structure size properly
+};
+
+struct spindump_event_parser_binary_session {
+  uint8_t kind;
+  uint8_t cidLength[2];
+  uint8_t cid[2][spindump_event_parser_binary_maxcidlength];
+  uint8_t padding[5]; // unused padding to align the next field properly
+  unsigned long long numbers[2];
+};
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static void
+spindump_event_parser_binary_putbyte(struct spindump_event_parser_binary_writer* writer,
+                                     uint8_t value);
+static void
+spindump_event_parser_binary_putbytes(struct spindump_event_parser_binary_writer* writer,
+                                      const uint8_t* data,
+                                      size_t length);
+static void
+spindump_event_parser_binary_putvarint(struct spindump_event_parser_binary_writer* writer,
+                                       unsigned long long value);
+static void
+spindump_event_parser_binary_putstring(struct spindump_event_parser_binary_writer* writer,
+                                       const char* string);
+static void
+spindump_event_parser_binary_putnetwork(struct spindump_event_parser_binary_writer* writer,
+                                        const spindump_network* network);
+static void
+spindump_event_parser_binary_putsession(struct spindump_event_parser_binary_writer* writer,
+                                        const char* session);
+static void
+spindump_event_parser_binary_puthistogram(struct spindump_event_parser_binary_writer* writer,
+                                          const struct spindump_histogram* histogram);
+static uint8_t
+spindump_event_parser_binary_getbyte(struct spindump_event_parser_binary_reader* reader);
+static void
+spindump_event_parser_binary_getbytes(struct spindump_event_parser_binary_reader* reader,
+                                      uint8_t* data,
+                                      size_t length);
+static unsigned long long
+spindump_event_parser_binary_getvarint(struct spindump_event_parser_binary_reader* reader);
+static unsigned long
+spindump_event_parser_binary_getulong(struct spindump_event_parser_binary_reader* reader);
+static void
+spindump_event_parser_binary_getstring(struct spindump_event_parser_binary_reader* reader,
+                                       char* string,
+                                       size_t size);
+static enum spindump_direction
+spindump_event_parser_binary_getdirection(struct spindump_event_parser_binary_reader* reader);
+static void
+spindump_event_parser_binary_getnetwork(struct spindump_event_parser_binary_reader* reader,
+                                        spindump_network* network);
+static void
+spindump_event_parser_binary_getsession(struct spindump_event_parser_binary_reader* reader,
+                                        char* session,
+                                        size_t size);
+static void
+spindump_event_parser_binary_gethistogram(struct spindump_event_parser_binary_reader* reader,
+                                          struct spindump_histogram* histogram);
+static int
+spindump_event_parser_binary_packsession(const char* session,
+                                         struct spindump_event_parser_binary_session* packed);
+static int
+spindump_event_parser_binary_packcid(const char* string,
+                                     size_t length,
+                                     uint8_t* cidLength,
+                                     uint8_t* cid);
+static void
+spindump_event_parser_binary_sessiontostring(const struct spindump_event_parser_binary_session* packed,
+                                             char* session,
+                                             size_t size);
+
+//
+// Variables and constants --------------------------------------------------------------------
+//
+
+static const uint8_t spindump_event_parser_binary_headerdata[spindump_event_parser_binary_headerlength] = {
+  0, 'S', 'P', 'D', spindump_event_parser_binary_version
+};
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Return the header that may start a binary event stream. Its length
+// is spindump_event_parser_binary_headerlength.
+//
+
+const uint8_t*
+spindump_event_parser_binary_header(void) {
+  return(spindump_event_parser_binary_headerdata);
+}
+
+//
+// Take a buffer of data in "buffer" (whose length is given in
+// "length") and parse one binary event record from it, placing the
+// result in the output parameter "event".
+//
+// If successful, return 1. If the buffer does not hold a complete
+// record, return 0, and upon parsing error return -1.
+//
+// In any case, set the output parameter "consumed" to the number of
+// bytes consumed from the buffer. Upon success this is the length of
+// the record, including its length prefix.
+//
+
+int
+spindump_event_parser_binary_parse(const uint8_t* buffer,
+                                   size_t length,
+                                   struct spindump_event* event,
+                                   size_t* consumed) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(buffer != 0);
+  spindump_assert(event != 0);
+  spindump_assert(consumed != 0);
+  *consumed = 0;
+
+  //
+  // Read the length prefix, at most two bytes, and see that the whole
+  // record is there
+  //
+
+  if (length == 0) return(0);
+  size_t prefixLength = 1;
+  size_t recordLength = buffer[0] & 0x7f;
+  if (buffer[0] & 0x80) {
+    if (length < 2) return(0);
+    if (buffer[1] & 0x80) {
+      spindump_errorf("binary event record length is too long");
+      return(-1);
+    }
+    prefixLength = 2;
+    recordLength |= ((size_t)buffer[1]) << 7;
+  }
+  if (recordLength < spindump_event_parser_binary_fixedheaderlength ||
+      recordLength > spindump_event_parser_binary_maxlength) {
+    spindump_errorf("binary event record length %lu is invalid", recordLength);
+    return(-1);
+  }
+  if (length - prefixLength < recordLength) return(0);
+  struct spindump_event_parser_binary_reader reader = {
+    .buffer = buffer + prefixLength,
+    .length = recordLength,
+    .position = 0,
+    .error = 0
+  };
+
+  //
+  // Fixed header
+  //
+
+  memset(event,0,sizeof(*event));
+  uint8_t eventType = spindump_event_parser_binary_getbyte(&reader);
+  uint8_t connectionType = spindump_event_parser_binary_getbyte(&reader);
+  uint8_t state = spindump_event_parser_binary_getbyte(&reader);
+  uint8_t flags = spindump_event_parser_binary_getbyte(&reader);
+  unsigned long long timestamp = 0;
+  for (unsigned int i = 0; i < 8; i++) {
+    timestamp = (timestamp << 8) | spindump_event_parser_binary_getbyte(&reader);
+  }
+  if (connectionType > spindump_connection_aggregate_networkmultinet ||
+      state > spindump_connection_state_static) {
+    spindump_errorf("binary event record has an invalid connection type %u or state %u", connectionType, state);
+    return(-1);
+  }
+  event->eventType = (enum spindump_event_type)eventType;
+  event->connectionType = (enum spindump_connection_type)connectionType;
+  event->state = (enum spindump_connection_state)state;
+  event->timestamp = timestamp;
+
+  //
+  // Addresses, session, counters, and the optional tags and notes
+  //
+
+  spindump_event_parser_binary_getnetwork(&reader,&event->initiatorAddress);
+  spindump_event_parser_binary_getnetwork(&reader,&event->responderAddress);
+  spindump_event_parser_binary_getsession(&reader,event->session,sizeof(event->session));
+  event->packetsFromSide1 = spindump_event_parser_binary_getvarint(&reader);
+  event->packetsFromSide2 = spindump_event_parser_binary_getvarint(&reader);
+  event->bytesFromSide1 = spindump_event_parser_binary_getvarint(&reader);
+  event->bytesFromSide2 = spindump_event_parser_binary_getvarint(&reader);
+  event->bandwidthFromSide1 = spindump_event_parser_binary_getvarint(&reader);
+  event->bandwidthFromSide2 = spindump_event_parser_binary_getvarint(&reader);
+  spindump_tags_initialize(&event->tags);
+  if (flags & spindump_event_parser_binary_flag_tags) {
+    spindump_event_parser_binary_getstring(&reader,event->tags.string,sizeof(event->tags.string));
+  }
+  if (flags & spindump_event_parser_binary_flag_notes) {
+    spindump_event_parser_binary_getstring(&reader,event->notes,sizeof(event->notes));
+  }
+
+  //
+  // The variable part that depends on which event we have
+  //
+
+  switch (event->eventType) {
+
+  case spindump_event_type_new_connection:
+  case spindump_event_type_change_connection:
+  case spindump_event_type_connection_delete:
+    break;
+
+  case spindump_event_type_new_rtt_measurement:
+    event->u.newRttMeasurement.measurement =
+      spindump_event_parser_binary_getbyte(&reader) ?
+      spindump_measurement_type_bidirectional : spindump_measurement_type_unidirectional;
+    event->u.newRttMeasurement.direction = spindump_event_parser_binary_getdirection(&reader);
+    event->u.newRttMeasurement.rtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.avgRtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.devRtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.filtAvgRtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.minRtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.smoothedRtt = spindump_event_parser_binary_getulong(&reader);
+    event->u.newRttMeasurement.varRtt = spindump_event_parser_binary_getulong(&reader);
+    break;
+
+  case spindump_event_type_periodic:
+    event->u.periodic.rttRight = spindump_event_parser_binary_getulong(&reader);
+    event->u.periodic.avgRttRight = spindump_event_parser_binary_getulong(&reader);
+    event->u.periodic.devRttRight = spindump_event_parser_binary_getulong(&reader);
+    spindump_event_parser_binary_gethistogram(&reader,&event->u.periodic.histRight);
+    break;
+
+  case spindump_event_type_spin_flip:
+    event->u.spinFlip.direction = spindump_event_parser_binary_getdirection(&reader);
+    event->u.spinFlip.spin0to1 = spindump_event_parser_binary_getbyte(&reader) != 0;
+    break;
+
+  case spindump_event_type_spin_value:
+    event->u.spinValue.direction = spindump_event_parser_binary_getdirection(&reader);
+    event->u.spinValue.value = spindump_event_parser_binary_getbyte(&reader);
+    break;
+
+  case spindump_event_type_ecn_congestion_event:
+    event->u.ecnCongestionEvent.direction = spindump_event_parser_binary_getdirection(&reader);
+    event->u.ecnCongestionEvent.ecn0 = spindump_event_parser_binary_getvarint(&reader);
+    event->u.ecnCongestionEvent.ecn1 = spindump_event_parser_binary_getvarint(&reader);
+    event->u.ecnCongestionEvent.ce = spindump_event_parser_binary_getvarint(&reader);
+    break;
+
+  case spindump_event_type_rtloss_measurement:
+    event->u.rtlossMeasurement.direction = spindump_event_parser_binary_getdirection(&reader);
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.rtlossMeasurement.avgLoss,
+                                           sizeof(event->u.rtlossMeasurement.avgLoss));
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.rtlossMeasurement.totLoss,
+                                           sizeof(event->u.rtlossMeasurement.totLoss));
+    break;
+
+  case spindump_event_type_qrloss_measurement:
+    event->u.qrlossMeasurement.direction = spindump_event_parser_binary_getdirection(&reader);
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qrlossMeasurement.avgLoss,
+                                           sizeof(event->u.qrlossMeasurement.avgLoss));
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qrlossMeasurement.totLoss,
+                                           sizeof(event->u.qrlossMeasurement.totLoss));
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qrlossMeasurement.avgRefLoss,
+                                           sizeof(event->u.qrlossMeasurement.avgRefLoss));
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qrlossMeasurement.totRefLoss,
+                                           sizeof(event->u.qrlossMeasurement.totRefLoss));
+    break;
+
+  case spindump_event_type_qlloss_measurement:
+    event->u.qllossMeasurement.direction = spindump_event_parser_binary_getdirection(&reader);
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qllossMeasurement.qLoss,
+                                           sizeof(event->u.qllossMeasurement.qLoss));
+    spindump_event_parser_binary_getstring(&reader,
+                                           event->u.qllossMeasurement.lLoss,
+                                           sizeof(event->u.qllossMeasurement.lLoss));
+    break;
+
+  case spindump_event_type_packet:
+    event->u.packet.direction = spindump_event_parser_binary_getdirection(&reader);
+    event->u.packet.length = spindump_event_parser_binary_getulong(&reader);
+    break;
+
+  default:
+    spindump_errorf("binary event record has an invalid event type %u", eventType);
+    return(-1);
+
+  }
+
+  //
+  // Check that the record was well formed, and all of it was used
+  //
+
+  if (reader.error) {
+    spindump_errorf("binary event record is malformed");
+    return(-1);
+  }
+  if (reader.position != reader.length) {
+    spindump_errorf("binary event record has %lu extra bytes", reader.length - reader.position);
+    return(-1);
+  }
+
+  //
+  // Done
+  //
+
+  *consumed = prefixLength + reader.length;
+  return(1);
+}
+
+//
+// Parse a stream of binary event records, such as the ones sent by
+// another Spindump instance with --format binary. The stream may
+// include the stream header, at the start or between records. Call
+// the callback for each parsed event.
+//
+// Return 1 if the whole stream could be parsed, and 0 otherwise.
+//
+
+int
+spindump_event_parser_binary_streamparse(const uint8_t* buffer,
+                                         size_t length,
+                                         spindump_event_parser_binary_callback callback,
+                                         void* data) {
+
+  spindump_assert(buffer != 0);
+  spindump_assert(callback != 0);
+
+  size_t position = 0;
+  while (position < length) {
+
+    //
+    // Skip a stream header, if there's one
+    //
+
+    if (buffer[position] == 0) {
+      if (length - position < spindump_event_parser_binary_headerlength ||
+          memcmp(buffer + position,
+                 spindump_event_parser_binary_headerdata,
+                 spindump_event_parser_binary_headerlength) != 0) {
+        spindump_errorf("invalid binary event stream header");
+        return(0);
+      }
+      position += spindump_event_parser_binary_headerlength;
+      continue;
+    }
+
+    //
+    // Parse a record
+    //
+
+    struct spindump_event event;
+    size_t consumed;
+    int ans = spindump_event_parser_binary_parse(buffer + position,length - position,&event,&consumed);
+    if (ans == 0) {
+      spindump_errorf("binary event stream ends in the middle of a record");
+      return(0);
+    } else if (ans < 0) {
+      return(0);
+    }
+    (*callback)(&event,data);
+    position += consumed;
+
+  }
+
+  return(1);
+}
+
+//
+// Take an event description in the input parameter "event", and
+// encode it as a binary Spindump event record. The record will be
+// placed in the buffer "buffer" whose length is at most "length".
+//
+// The record starts with its length, as a variable-length integer,
+// followed by a fixed header with the types, state, and timestamp,
+// and then by the addresses, session, counters, and the fields
+// specific to the event type. Counters and other numbers are
+// variable-length integers, seven bits per byte, least significant
+// bits first, with the high bit set on all but the last byte.
+//
+// If successful, in other words, if there was enough space in the
+// buffer, return 1, otherwise 0. Set the output parameter "consumed" to
+// the number of consumed bytes.
+//
+
+int
+spindump_event_parser_binary_print(const struct spindump_event* event,
+                                   uint8_t* buffer,
+                                   size_t length,
+                                   size_t* consumed) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(event != 0);
+  spindump_assert(buffer != 0);
+  spindump_assert(consumed != 0);
+  *consumed = 0;
+
+  //
+  // The record length is not known yet. Leave space for two bytes of
+  // length, as records are never longer than
+  // spindump_event_parser_binary_maxlength.
+  //
+
+  spindump_assert(spindump_event_parser_binary_maxlength < 128 * 128);
+  struct spindump_event_parser_binary_writer writer = {
+    .buffer = buffer,
+    .length = spindump_min(length,spindump_event_parser_binary_maxlength),
+    .position = 2,
+    .overflow = 0
+  };
+  if (writer.length < writer.position) return(0);
+
+  //
+  // Fixed header
+  //
+
+  uint8_t flags = 0;
+  if (event->tags.string[0] != 0) flags |= spindump_event_parser_binary_flag_tags;
+  if (event->notes[0] != 0) flags |= spindump_event_parser_binary_flag_notes;
+  spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->eventType);
+  spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->connectionType);
+  spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->state);
+  spindump_event_parser_binary_putbyte(&writer,flags);
+  for (int i = 7; i >= 0; i--) {
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)(event->timestamp >> (8 * i)));
+  }
+
+  //
+  // Addresses, session, counters, and the optional tags and notes
+  //
+
+  spindump_event_parser_binary_putnetwork(&writer,&event->initiatorAddress);
+  spindump_event_parser_binary_putnetwork(&writer,&event->responderAddress);
+  spindump_event_parser_binary_putsession(&writer,event->session);
+  spindump_event_parser_binary_putvarint(&writer,event->packetsFromSide1);
+  spindump_event_parser_binary_putvarint(&writer,event->packetsFromSide2);
+  spindump_event_parser_binary_putvarint(&writer,event->bytesFromSide1);
+  spindump_event_parser_binary_putvarint(&writer,event->bytesFromSide2);
+  spindump_event_parser_binary_putvarint(&writer,event->bandwidthFromSide1);
+  spindump_event_parser_binary_putvarint(&writer,event->bandwidthFromSide2);
+  if (flags & spindump_event_parser_binary_flag_tags) {
+    spindump_event_parser_binary_putstring(&writer,event->tags.string);
+  }
+  if (flags & spindump_event_parser_binary_flag_notes) {
+    spindump_event_parser_binary_putstring(&writer,event->notes);
+  }
+
+  //
+  // The variable part that depends on which event we have
+  //
+
+  switch (event->eventType) {
+
+  case spindump_event_type_new_connection:
+  case spindump_event_type_change_connection:
+  case spindump_event_type_connection_delete:
+    break;
+
+  case spindump_event_type_new_rtt_measurement:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.newRttMeasurement.measurement);
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.newRttMeasurement.direction);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.rtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.avgRtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.devRtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.filtAvgRtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.minRtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.smoothedRtt);
+    spindump_event_parser_binary_putvarint(&writer,event->u.newRttMeasurement.varRtt);
+    break;
+
+  case spindump_event_type_periodic:
+    spindump_event_parser_binary_putvarint(&writer,event->u.periodic.rttRight);
+    spindump_event_parser_binary_putvarint(&writer,event->u.periodic.avgRttRight);
+    spindump_event_parser_binary_putvarint(&writer,event->u.periodic.devRttRight);
+    spindump_event_parser_binary_puthistogram(&writer,&event->u.periodic.histRight);
+    break;
+
+  case spindump_event_type_spin_flip:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.spinFlip.direction);
+    spindump_event_parser_binary_putbyte(&writer,event->u.spinFlip.spin0to1 ? 1 : 0);
+    break;
+
+  case spindump_event_type_spin_value:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.spinValue.direction);
+    spindump_event_parser_binary_putbyte(&writer,event->u.spinValue.value);
+    break;
+
+  case spindump_event_type_ecn_congestion_event:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.ecnCongestionEvent.direction);
+    spindump_event_parser_binary_putvarint(&writer,event->u.ecnCongestionEvent.ecn0);
+    spindump_event_parser_binary_putvarint(&writer,event->u.ecnCongestionEvent.ecn1);
+    spindump_event_parser_binary_putvarint(&writer,event->u.ecnCongestionEvent.ce);
+    break;
+
+  case spindump_event_type_rtloss_measurement:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.rtlossMeasurement.direction);
+    spindump_event_parser_binary_putstring(&writer,event->u.rtlossMeasurement.avgLoss);
+    spindump_event_parser_binary_putstring(&writer,event->u.rtlossMeasurement.totLoss);
+    break;
+
+  case spindump_event_type_qrloss_measurement:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.qrlossMeasurement.direction);
+    spindump_event_parser_binary_putstring(&writer,event->u.qrlossMeasurement.avgLoss);
+    spindump_event_parser_binary_putstring(&writer,event->u.qrlossMeasurement.totLoss);
+    spindump_event_parser_binary_putstring(&writer,event->u.qrlossMeasurement.avgRefLoss);
+    spindump_event_parser_binary_putstring(&writer,event->u.qrlossMeasurement.totRefLoss);
+    break;
+
+  case spindump_event_type_qlloss_measurement:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.qllossMeasurement.direction);
+    spindump_event_parser_binary_putstring(&writer,event->u.qllossMeasurement.qLoss);
+    spindump_event_parser_binary_putstring(&writer,event->u.qllossMeasurement.lLoss);
+    break;
+
+  case spindump_event_type_packet:
+    spindump_event_parser_binary_putbyte(&writer,(uint8_t)event->u.packet.direction);
+    spindump_event_parser_binary_putvarint(&writer,event->u.packet.length);
+    break;
+
+  default:
+    spindump_errorf("unrecognised event type %u", event->eventType);
+    return(0);
+
+  }
+  if (writer.overflow) return(0);
+
+  //
+  // Fill in the length. If it fits in one byte, move the record one
+  // byte back.
+  //
+
+  size_t recordLength = writer.position - 2;
+  if (recordLength < 128) {
+    buffer[0] = (uint8_t)recordLength;
+    memmove(buffer + 1,buffer + 2,recordLength);
+    *consumed = 1 + recordLength;
+  } else {
+    buffer[0] = (uint8_t)(0x80 | (recordLength & 0x7f));
+    buffer[1] = (uint8_t)(recordLength >> 7);
+    *consumed = 2 + recordLength;
+  }
+  return(1);
+}
+
+//
+// Add a byte to the record being written
+//
+
+static void
+spindump_event_parser_binary_putbyte(struct spindump_event_parser_binary_writer* writer,
+                                     uint8_t value) {
+  if (writer->position >= writer->length) {
+    writer->overflow = 1;
+    return;
+  }
+  writer->buffer[writer->position++] = value;
+}
+
+//
+// Add a number of bytes to the record being written
+//
+
+static void
+spindump_event_parser_binary_putbytes(struct spindump_event_parser_binary_writer* writer,
+                                      const uint8_t* data,
+                                      size_t length) {
+  if (writer->length - writer->position < length) {
+    writer->overflow = 1;
+    return;
+  }
+  memcpy(writer->buffer + writer->position,data,length);
+  writer->position += length;
+}
+
+//
+// Add a variable-length integer to the record being written
+//
+
+static void
+spindump_event_parser_binary_putvarint(struct spindump_event_parser_binary_writer* writer,
+                                       unsigned long long value) {
+  while (value >= 0x80) {
+    spindump_event_parser_binary_putbyte(writer,(uint8_t)(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  spindump_event_parser_binary_putbyte(writer,(uint8_t)value);
+}
+
+//
+// Add a string, preceded by its length, to the record being written
+//
+
+static void
+spindump_event_parser_binary_putstring(struct spindump_event_parser_binary_writer* writer,
+                                       const char* string) {
+  size_t length = strlen(string);
+  spindump_event_parser_binary_putvarint(writer,length);
+  spindump_event_parser_binary_putbytes(writer,(const uint8_t*)string,length);
+}
+
+//
+// Add an address or network to the record being written: a family
+// (4 or 6), the prefix length, and the 4 or 16 bytes of the address.
+//
+
+static void
+spindump_event_parser_binary_putnetwork(struct spindump_event_parser_binary_writer* writer,
+                                        const spindump_network* network) {
+  spindump_compactaddress compact;
+  spindump_compactaddress_fromaddress(&network->address,&compact);
+  switch (compact.family) {
+  case AF_INET:
+    spindump_event_parser_binary_putbyte(writer,spindump_event_parser_binary_family_ipv4);
+    spindump_event_parser_binary_putbyte(writer,(uint8_t)network->length);
+    spindump_event_parser_binary_putbytes(writer,(const uint8_t*)compact.words,4);
+    break;
+  case AF_INET6:
+    spindump_event_parser_binary_putbyte(writer,spindump_event_parser_binary_family_ipv6);
+    spindump_event_parser_binary_putbyte(writer,(uint8_t)network->length);
+    spindump_event_parser_binary_putbytes(writer,(const uint8_t*)compact.words,16);
+    break;
+  default:
+    spindump_event_parser_binary_putbyte(writer,spindump_event_parser_binary_family_none);
+    break;
+  }
+}
+
+//
+// Add a session identifier to the record being written. The common
+// forms of session identifiers are packed as numbers and bytes
+// rather than as strings; others are written as they are.
+//
+
+static void
+spindump_event_parser_binary_putsession(struct spindump_event_parser_binary_writer* writer,
+                                        const char* session) {
+  struct spindump_event_parser_binary_session packed;
+  if (!spindump_event_parser_binary_packsession(session,&packed)) {
+    spindump_event_parser_binary_putbyte(writer,spindump_event_parser_binary_session_raw);
+    spindump_event_parser_binary_putstring(writer,session);
+    return;
+  }
+  spindump_event_parser_binary_putbyte(writer,packed.kind);
+  switch (packed.kind) {
+  case spindump_event_parser_binary_session_empty:
+    break;
+  case spindump_event_parser_binary_session_number:
+    spindump_event_parser_binary_putvarint(writer,packed.numbers[0]);
+    break;
+  case spindump_event_parser_binary_session_cids:
+    for (unsigned int i = 0; i < 2; i++) {
+      spindump_event_parser_binary_putbyte(writer,packed.cidLength[i]);
+      if (packed.cidLength[i] != spindump_event_parser_binary_nullcid) {
+        spindump_event_parser_binary_putbytes(writer,packed.cid[i],packed.cidLength[i]);
+      }
+    }
+    spindump_event_parser_binary_putvarint(writer,packed.numbers[0]);
+    spindump_event_parser_binary_putvarint(writer,packed.numbers[1]);
+    break;
+  case spindump_event_parser_binary_session_ports:
+    spindump_event_parser_binary_putvarint(writer,packed.numbers[0]);
+    spindump_event_parser_binary_putvarint(writer,packed.numbers[1]);
+    break;
+  default:
+    spindump_errorf("invalid packed session kind");
+    writer->overflow = 1;
+    break;
+  }
+}
+
+//
+// Add the non-empty buckets of a histogram to the record being
+// written, as bucket index and count pairs
+//
+
+static void
+spindump_event_parser_binary_puthistogram(struct spindump_event_parser_binary_writer* writer,
+                                          const struct spindump_histogram* histogram) {
+  unsigned int nonEmpty = 0;
+  for (unsigned int i = 0; i < spindump_histogram_nbuckets; i++) {
+    if (histogram->buckets[i] > 0) nonEmpty++;
+  }
+  spindump_event_parser_binary_putvarint(writer,nonEmpty);
+  for (unsigned int i = 0; i < spindump_histogram_nbuckets; i++) {
+    if (histogram->buckets[i] == 0) continue;
+    spindump_event_parser_binary_putbyte(writer,(uint8_t)i);
+    spindump_event_parser_binary_putvarint(writer,histogram->buckets[i]);
+  }
+}
+
+//
+// Read a byte from the record being parsed
+//
+
+static uint8_t
+spindump_event_parser_binary_getbyte(struct spindump_event_parser_binary_reader* reader) {
+  if (reader->position >= reader->length) {
+    reader->error = 1;
+    return(0);
+  }
+  return(reader->buffer[reader->position++]);
+}
+
+//
+// Read a number of bytes from the record being parsed
+//
+
+static void
+spindump_event_parser_binary_getbytes(struct spindump_event_parser_binary_reader* reader,
+                                      uint8_t* data,
+                                      size_t length) {
+  if (reader->length - reader->position < length) {
+    reader->error = 1;
+    memset(data,0,length);
+    return;
+  }
+  memcpy(data,reader->buffer + reader->position,length);
+  reader->position += length;
+}
+
+//
+// Read a variable-length integer from the record being parsed
+//
+
+static unsigned long long
+spindump_event_parser_binary_getvarint(struct spindump_event_parser_binary_reader* reader) {
+  unsigned long long value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = spindump_event_parser_binary_getbyte(reader);
+    if (reader->error) return(0);
+    value |= ((unsigned long long)(byte & 0x7f)) << shift;
+    if ((byte & 0x80) == 0) return(value);
+  }
+  reader->error = 1;
+  return(0);
+}
+
+//
+// Read a variable-length integer that needs to fit in an unsigned long
+//
+
+static unsigned long
+spindump_event_parser_binary_getulong(struct spindump_event_parser_binary_reader* reader) {
+  unsigned long long value = spindump_event_parser_binary_getvarint(reader);
+  if (value > (unsigned long long)(unsigned long)(-1)) {
+    reader->error = 1;
+    return(0);
+  }
+  return((unsigned long)value);
+}
+
+//
+// Read a string from the record being parsed, to a buffer of "size"
+// bytes. The string needs to fit, with its terminating zero.
+//
+
+static void
+spindump_event_parser_binary_getstring(struct spindump_event_parser_binary_reader* reader,
+                                       char* string,
+                                       size_t size) {
+  unsigned long long length = spindump_event_parser_binary_getvarint(reader);
+  if (reader->error || length >= size) {
+    reader->error = 1;
+    string[0] = 0;
+    return;
+  }
+  spindump_event_parser_binary_getbytes(reader,(uint8_t*)string,(size_t)length);
+  string[length] = 0;
+  if (strlen(string) != length) reader->error = 1;
+}
+
+//
+// Read a direction from the record being parsed
+//
+
+static enum spindump_direction
+spindump_event_parser_binary_getdirection(struct spindump_event_parser_binary_reader* reader) {
+  uint8_t value = spindump_event_parser_binary_getbyte(reader);
+  switch (value) {
+  case spindump_direction_frominitiator:
+    return(spindump_direction_frominitiator);
+  case spindump_direction_fromresponder:
+    return(spindump_direction_fromresponder);
+  default:
+    reader->error = 1;
+    return(spindump_direction_frominitiator);
+  }
+}
+
+//
+// Read an address or network from the record being parsed
+//
+
+static void
+spindump_event_parser_binary_getnetwork(struct spindump_event_parser_binary_reader* reader,
+                                        spindump_network* network) {
+  spindump_compactaddress compact;
+  memset(&compact,0,sizeof(compact));
+  memset(network,0,sizeof(*network));
+  uint8_t family = spindump_event_parser_binary_getbyte(reader);
+  switch (family) {
+  case spindump_event_parser_binary_family_none:
+    return;
+  case spindump_event_parser_binary_family_ipv4:
+    compact.family = AF_INET;
+    network->length = spindump_event_parser_binary_getbyte(reader);
+    spindump_event_parser_binary_getbytes(reader,(uint8_t*)compact.words,4);
+    if (network->length > 32) reader->error = 1;
+    break;
+  case spindump_event_parser_binary_family_ipv6:
+    compact.family = AF_INET6;
+    network->length = spindump_event_parser_binary_getbyte(reader);
+    spindump_event_parser_binary_getbytes(reader,(uint8_t*)compact.words,16);
+    if (network->length > 128) reader->error = 1;
+    break;
+  default:
+    reader->error = 1;
+    return;
+  }
+  spindump_compactaddress_toaddress(&compact,&network->address);
+}
+
+//
+// Read a session identifier from the record being parsed, to a buffer
+// of "size" bytes
+//
+
+static void
+spindump_event_parser_binary_getsession(struct spindump_event_parser_binary_reader* reader,
+                                        char* session,
+                                        size_t size) {
+  struct spindump_event_parser_binary_session packed;
+  memset(&packed,0,sizeof(packed));
+  session[0] = 0;
+  packed.kind = spindump_event_parser_binary_getbyte(reader);
+  switch (packed.kind) {
+  case spindump_event_parser_binary_session_empty:
+    return;
+  case spindump_event_parser_binary_session_raw:
+    spindump_event_parser_binary_getstring(reader,session,size);
+    return;
+  case spindump_event_parser_binary_session_number:
+    packed.numbers[0] = spindump_event_parser_binary_getvarint(reader);
+    break;
+  case spindump_event_parser_binary_session_cids:
+    for (unsigned int i = 0; i < 2; i++) {
+      packed.cidLength[i] = spindump_event_parser_binary_getbyte(reader);
+      if (packed.cidLength[i] == spindump_event_parser_binary_nullcid) continue;
+      if (packed.cidLength[i] > spindump_event_parser_binary_maxcidlength) {
+        reader->error = 1;
+        return;
+      }
+      spindump_event_parser_binary_getbytes(reader,packed.cid[i],packed.cidLength[i]);
+    }
+    packed.numbers[0] = spindump_event_parser_binary_getvarint(reader);
+    packed.numbers[1] = spindump_event_parser_binary_getvarint(reader);
+    break;
+  case spindump_event_parser_binary_session_ports:
+    packed.numbers[0] = spindump_event_parser_binary_getvarint(reader);
+    packed.numbers[1] = spindump_event_parser_binary_getvarint(reader);
+    break;
+  default:
+    reader->error = 1;
+    return;
+  }
+  if (reader->error) return;
+  char rendered[spindump_event_parser_binary_maxsessionstring];
+  spindump_event_parser_binary_sessiontostring(&packed,rendered,sizeof(rendered));
+  if (strlen(rendered) >= size) {
+    reader->error = 1;
+    return;
+  }
+  strcpy(session,rendered);
+}
+
+//
+// Read the histogram bucket and count pairs from the record being
+// parsed. The buckets need to be in increasing order.
+//
+
+static void
+spindump_event_parser_binary_gethistogram(struct spindump_event_parser_binary_reader* reader,
+                                          struct spindump_histogram* histogram) {
+  spindump_histogram_initialize(histogram);
+  unsigned long long nonEmpty = spindump_event_parser_binary_getvarint(reader);
+  if (nonEmpty > spindump_histogram_nbuckets) {
+    reader->error = 1;
+    return;
+  }
+  int previous = -1;
+  unsigned long long total = 0;
+  for (unsigned int i = 0; i < nonEmpty && !reader->error; i++) {
+    uint8_t bucket = spindump_event_parser_binary_getbyte(reader);
+    unsigned long long count = spindump_event_parser_binary_getvarint(reader);
+    total += count;
+    if ((int)bucket <= previous ||
+        bucket >= spindump_histogram_nbuckets ||
+        count == 0 ||
+        total > 0xffffffffULL) {
+      reader->error = 1;
+      return;
+    }
+    histogram->buckets[bucket] = (uint32_t)count;
+    previous = bucket;
+  }
+  histogram->count = (uint32_t)total;
+}
+
+//
+// Determine if a session identifier can be packed, and if so, pack
+// it. Return 1 if it can, otherwise 0. A session identifier is packed
+// only if it is written back exactly the same way, so that for
+// instance leading zeroes in numbers or uppercase hex digits in
+// connection IDs are not lost.
+//
+
+static int
+spindump_event_parser_binary_packsession(const char* session,
+                                         struct spindump_event_parser_binary_session* packed) {
+
+  memset(packed,0,sizeof(*packed));
+  if (session[0] == 0) {
+    packed->kind = spindump_event_parser_binary_session_empty;
+    return(1);
+  }
+
+  //
+  // Determine the form of the identifier
+  //
+
+  const char* ports = session;
+  const char* paren = strstr(session," (");
+  if (paren != 0) {
+    const char* dash = strchr(session,'-');
+    if (dash == 0 || dash > paren) return(0);
+    if (!spindump_event_parser_binary_packcid(session,(size_t)(dash - session),
+                                              &packed->cidLength[0],packed->cid[0]) ||
+        !spindump_event_parser_binary_packcid(dash + 1,(size_t)(paren - dash - 1),
+                                              &packed->cidLength[1],packed->cid[1])) {
+      return(0);
+    }
+    packed->kind = spindump_event_parser_binary_session_cids;
+    ports = paren + 2;
+  }
+  char* end;
+  if (*ports < '0' || *ports > '9') return(0);
+  packed->numbers[0] = strtoull(ports,&end,10);
+  if (*end == ':') {
+    if (end[1] < '0' || end[1] > '9') return(0);
+    packed->numbers[1] = strtoull(end + 1,&end,10);
+    if (packed->kind != spindump_event_parser_binary_session_cids) {
+      packed->kind = spindump_event_parser_binary_session_ports;
+    }
+  } else if (packed->kind != spindump_event_parser_binary_session_cids) {
+    packed->kind = spindump_event_parser_binary_session_number;
+  } else {
+    return(0);
+  }
+
+  //
+  // Check that the identifier would be written back as it was
+  //
+
+  char rendered[spindump_event_parser_binary_maxsessionstring];
+  spindump_event_parser_binary_sessiontostring(packed,rendered,sizeof(rendered));
+  return(strcmp(rendered,session) == 0);
+}
+
+//
+// Pack a connection ID in hex, or "null", to bytes
+//
+
+static int
+spindump_event_parser_binary_packcid(const char* string,
+                                     size_t length,
+                                     uint8_t* cidLength,
+                                     uint8_t* cid) {
+  if (length == 4 && strncmp(string,"null",4) == 0) {
+    *cidLength = spindump_event_parser_binary_nullcid;
+    return(1);
+  }
+  if (length % 2 != 0 || length / 2 > spindump_event_parser_binary_maxcidlength) return(0);
+  for (size_t i = 0; i < length; i++) {
+    char c = string[i];
+    unsigned int nibble;
+    if (c >= '0' && c <= '9') nibble = (unsigned int)(c - '0');
+    else if (c >= 'a' && c <= 'f') nibble = (unsigned int)(c - 'a' + 10);
+    else return(0);
+    if (i % 2 == 0) cid[i / 2] = (uint8_t)(nibble << 4);
+    else cid[i / 2] |= (uint8_t)nibble;
+  }
+  *cidLength = (uint8_t)(length / 2);
+  return(1);
+}
+
+//
+// Write a packed session identifier out as a string, to a buffer of
+// "size" bytes
+//
+
+static void
+spindump_event_parser_binary_sessiontostring(const struct spindump_event_parser_binary_session* packed,
+                                             char* session,
+                                             size_t size) {
+  spindump_assert(size > 0);
+  session[0] = 0;
+  switch (packed->kind) {
+  case spindump_event_parser_binary_session_number:
+    snprintf(session,size,"%llu",packed->numbers[0]);
+    break;
+  case spindump_event_parser_binary_session_ports:
+    snprintf(session,size,"%llu:%llu",packed->numbers[0],packed->numbers[1]);
+    break;
+  case spindump_event_parser_binary_session_cids:
+    for (unsigned int i = 0; i < 2; i++) {
+      if (i > 0) snprintf(session + strlen(session),size - strlen(session),"-");
+      if (packed->cidLength[i] == spindump_event_parser_binary_nullcid) {
+        snprintf(session + strlen(session),size - strlen(session),"null");
+      } else {
+        for (unsigned int j = 0; j < packed->cidLength[i]; j++) {
+          snprintf(session + strlen(session),size - strlen(session),"%02x",packed->cid[i][j]);
+        }
+      }
+    }
+    snprintf(session + strlen(session),size - strlen(session)," (%llu:%llu)",
+             packed->numbers[0],packed->numbers[1]);
+    break;
+  default:
+    break;
+  }
+}
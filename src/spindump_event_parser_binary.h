@@ -0,0 +1,74 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+// 
+
+#ifndef SPINDUMP_EVENT_PARSER_BINARY_H
+#define SPINDUMP_EVENT_PARSER_BINARY_H
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdio.h>
+#include "spindump_event.h"
+
+//
+// Data types ---------------------------------------------------------------------------------
+//
+
+typedef void (*spindump_event_parser_binary_callback)(const struct spindump_event* event,
+                                                      void* data);
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+//
+// A binary event stream may start with a header, consisting of a
+// zero byte, the letters "SPD", and a version number. A record never
+// starts with a zero byte, so the header can be told apart from the
+// records, and can also be omitted, as it is when events are sent
+// one at a time.
+//
+
+#define spindump_event_parser_binary_headerlength    5
+#define spindump_event_parser_binary_version         1
+#define spindump_event_parser_binary_maxlength    1024 // bytes, for one record, including its length
+
+//
+// External API interface to this module ------------------------------------------------------
+//
+
+const uint8_t*
+spindump_event_parser_binary_header(void);
+int
+spindump_event_parser_binary_parse(const uint8_t* buffer,
+                                   size_t length,
+                                   struct spindump_event* event,
+                                   size_t* consumed);
+int
+spindump_event_parser_binary_streamparse(const uint8_t* buffer,
+                                         size_t length,
+                                         spindump_event_parser_binary_callback callback,
+                                         void* data);
+int
+spindump_event_parser_binary_print(const struct spindump_event* event,
+                                   uint8_t* buffer,
+                                   size_t length,
+                                   size_t* consumed);
+
+#endif // SPINDUMP_EVENT_PARSER_BINARY_H
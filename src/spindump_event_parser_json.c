@@ -26,6 +26,144 @@
 #include "spindump_json.h"
 #include "spindump_json_value.h"
 
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_event_parser_json_maxstring   100
+
+//
+// Data types ---------------------------------------------------------------------------------
+//
+
+//
+// The fields of an event record, in the order of the record
+// schema. The field index is also the bit position of the field in
+// the present mask of the record.
+//
+
+enum spindump_event_parser_json_field {
+  spindump_event_parser_json_field_event = 0,
+  spindump_event_parser_json_field_type,
+  spindump_event_parser_json_field_state,
+  spindump_event_parser_json_field_addrs,
+  spindump_event_parser_json_field_session,
+  spindump_event_parser_json_field_ts,
+  spindump_event_parser_json_field_left_rtt,
+  spindump_event_parser_json_field_right_rtt,
+  spindump_event_parser_json_field_full_rtt_initiator,
+  spindump_event_parser_json_field_full_rtt_responder,
+  spindump_event_parser_json_field_avg_left_rtt,
+  spindump_event_parser_json_field_avg_right_rtt,
+  spindump_event_parser_json_field_avg_full_rtt_initiator,
+  spindump_event_parser_json_field_avg_full_rtt_responder,
+  spindump_event_parser_json_field_filt_avg_left_rtt,
+  spindump_event_parser_json_field_filt_avg_right_rtt,
+  spindump_event_parser_json_field_filt_avg_full_rtt_initiator,
+  spindump_event_parser_json_field_filt_avg_full_rtt_responder,
+  spindump_event_parser_json_field_dev_left_rtt,
+  spindump_event_parser_json_field_dev_right_rtt,
+  spindump_event_parser_json_field_dev_full_rtt_initiator,
+  spindump_event_parser_json_field_dev_full_rtt_responder,
+  spindump_event_parser_json_field_min_left_rtt,
+  spindump_event_parser_json_field_min_right_rtt,
+  spindump_event_parser_json_field_min_full_rtt_initiator,
+  spindump_event_parser_json_field_min_full_rtt_responder,
+  spindump_event_parser_json_field_smoothed_left_rtt,
+  spindump_event_parser_json_field_smoothed_right_rtt,
+  spindump_event_parser_json_field_smoothed_full_rtt_initiator,
+  spindump_event_parser_json_field_smoothed_full_rtt_responder,
+  spindump_event_parser_json_field_var_left_rtt,
+  spindump_event_parser_json_field_var_right_rtt,
+  spindump_event_parser_json_field_var_full_rtt_initiator,
+  spindump_event_parser_json_field_var_full_rtt_responder,
+  spindump_event_parser_json_field_value,
+  spindump_event_parser_json_field_transition,
+  spindump_event_parser_json_field_who,
+  spindump_event_parser_json_field_packets1,
+  spindump_event_parser_json_field_packets2,
+  spindump_event_parser_json_field_bytes1,
+  spindump_event_parser_json_field_bytes2,
+  spindump_event_parser_json_field_bandwidth1,
+  spindump_event_parser_json_field_bandwidth2,
+  spindump_event_parser_json_field_ecn0,
+  spindump_event_parser_json_field_ecn1,
+  spindump_event_parser_json_field_ce,
+  spindump_event_parser_json_field_avg_loss,
+  spindump_event_parser_json_field_tot_loss,
+  spindump_event_parser_json_field_q_loss,
+  spindump_event_parser_json_field_l_loss,
+  spindump_event_parser_json_field_p50_right_rtt,
+  spindump_event_parser_json_field_p90_right_rtt,
+  spindump_event_parser_json_field_p99_right_rtt,
+  spindump_event_parser_json_field_hist_right_rtt,
+  spindump_event_parser_json_field_length,
+  spindump_event_parser_json_field_dir,
+  spindump_event_parser_json_field_tags,
+  spindump_event_parser_json_field_notes,
+  spindump_event_parser_json_nfields
+};
+
+//
+// The value of one field. Strings are not zero-terminated, and point
+// to either the input text or a JSON value object.
+//
+
+struct spindump_event_parser_json_fieldvalue {
+  unsigned long long integer;
+  const char* string;
+  size_t length;
+};
+
+//
+// The fields of one event record, collected either from a JSON value
+// object or directly from the input text. The two addresses and the
+// histogram are collected from their array elements.
+//
+
+struct spindump_event_parser_json_fields {
+  uint64_t present;
+  unsigned int nAddrs;
+  unsigned int nHistElements;
+  struct spindump_event_parser_json_fieldvalue addrs[2];
+  struct spindump_event_parser_json_fieldvalue values[spindump_event_parser_json_nfields];
+  unsigned long long histBucket;
+  unsigned long long histErrorBucket;
+  unsigned long long histErrorCount;
+  int histError;
+  struct spindump_histogram hist;
+};
+
+//
+// The fields that hold the different variants of an RTT measurement
+//
+
+struct spindump_event_parser_json_rttfields {
+  enum spindump_event_parser_json_field rtt;
+  enum spindump_event_parser_json_field avg;
+  enum spindump_event_parser_json_field dev;
+  enum spindump_event_parser_json_field min;
+  enum spindump_event_parser_json_field filtAvg;
+  enum spindump_event_parser_json_field smoothed;
+  enum spindump_event_parser_json_field var;
+  enum spindump_measurement_type measurement;
+  enum spindump_direction direction;
+};
+
+struct spindump_event_parser_json_parsingcontext {
+  spindump_event_parser_json_callback callback;
+  void* data;
+  int success;
+};
+
+struct spindump_event_parser_json_streamcontext {
+  spindump_event_parser_json_callback callback;
+  void* data;
+  int success;
+  unsigned int padding;
+  struct spindump_event_parser_json_fields fields;
+};
+
 //
 // Function prototypes ------------------------------------------------------------------------
 //
@@ -33,56 +171,85 @@
 static int
 spindump_event_parser_json_converteventtype(const char* string,
                                             enum spindump_event_type* type);
+static void
+spindump_event_parser_json_textparse_callback(const struct spindump_json_value* value,
+                                              const struct spindump_json_schema* type,
+                                              void* data);
+static int
+spindump_event_parser_json_streamparse_callback(const struct spindump_json_scan_item* item,
+                                                void* data);
+static void
+spindump_event_parser_json_fields_initialize(struct spindump_event_parser_json_fields* fields);
+static void
+spindump_event_parser_json_fields_setinteger(struct spindump_event_parser_json_fields* fields,
+                                             enum spindump_event_parser_json_field field,
+                                             unsigned long long value);
+static void
+spindump_event_parser_json_fields_setstring(struct spindump_event_parser_json_fields* fields,
+                                            enum spindump_event_parser_json_field field,
+                                            const char* string,
+                                            size_t length);
+static unsigned long long
+spindump_event_parser_json_fields_stringtointeger(const char* string,
+                                                  size_t length);
+static int
+spindump_event_parser_json_fields_addvalue(struct spindump_event_parser_json_fields* fields,
+                                           enum spindump_event_parser_json_field field,
+                                           const struct spindump_json_schema* schema,
+                                           const struct spindump_json_value* value);
+static int
+spindump_event_parser_json_fields_has(const struct spindump_event_parser_json_fields* fields,
+                                      enum spindump_event_parser_json_field field);
+static unsigned long long
+spindump_event_parser_json_fields_getinteger(const struct spindump_event_parser_json_fields* fields,
+                                             enum spindump_event_parser_json_field field);
+static int
+spindump_event_parser_json_fields_copy(const struct spindump_event_parser_json_fieldvalue* value,
+                                       char* buffer,
+                                       size_t size);
+static void
+spindump_event_parser_json_escape(const char* string,
+                                  char* buffer,
+                                  size_t size);
 static int
-spindump_event_parser_json_parse_aux_new_connection(const struct spindump_json_value* json,
-                                                    struct spindump_event* event);
+spindump_event_parser_json_fields_getstring(const struct spindump_event_parser_json_fields* fields,
+                                            enum spindump_event_parser_json_field field,
+                                            char* buffer,
+                                            size_t size);
 static int
-spindump_event_parser_json_parse_aux_change_connection(const struct spindump_json_value* json,
-                                                       struct spindump_event* event);
+spindump_event_parser_json_fields_getdirection(const struct spindump_event_parser_json_fields* fields,
+                                               enum spindump_event_parser_json_field field,
+                                               const char* what,
+                                               enum spindump_direction* direction);
 static int
-spindump_event_parser_json_parse_aux_connection_delete(const struct spindump_json_value* json,
-                                                       struct spindump_event* event);
+spindump_event_parser_json_fields_toevent(const struct spindump_event_parser_json_fields* fields,
+                                          struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_new_rtt_measurement(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_new_rtt_measurement(const struct spindump_event_parser_json_fields* fields,
                                                          struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_periodic(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_periodic(const struct spindump_event_parser_json_fields* fields,
                                               struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_event_parser_json_fields* fields,
                                                struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_spin_value(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_spin_value(const struct spindump_event_parser_json_fields* fields,
                                                 struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_ecn_congestion_event(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_ecn_congestion_event(const struct spindump_event_parser_json_fields* fields,
                                                           struct spindump_event* event);
 static int
-spindump_event_parser_json_parse_aux_rtloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event);
-static int
-spindump_event_parser_json_parse_aux_qrloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event);
+spindump_event_parser_json_parse_aux_loss_measurement(const struct spindump_event_parser_json_fields* fields,
+                                                      const char* what,
+                                                      enum spindump_event_parser_json_field field1,
+                                                      enum spindump_event_parser_json_field field2,
+                                                      char* value1,
+                                                      char* value2,
+                                                      enum spindump_direction* direction);
 static int
-spindump_event_parser_json_parse_aux_qlloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event);
-static int
-spindump_event_parser_json_parse_aux_packet(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_packet(const struct spindump_event_parser_json_fields* fields,
                                             struct spindump_event* event);
-static void
-spindump_event_parser_json_textparse_callback(const struct spindump_json_value* value,
-                                              const struct spindump_json_schema* type,
-                                              void* data);
-
-//
-// Data types ---------------------------------------------------------------------------------
-//
-
-struct spindump_event_parser_json_parsingcontext {
-  spindump_event_parser_json_callback callback;
-  void* data;
-  int success;
-};
 
 //
 // Variables and constants --------------------------------------------------------------------
@@ -179,17 +346,17 @@ static struct spindump_json_schema fieldbandwidth2schema = {
 };
 
 static struct spindump_json_schema fieldecn0schema = {
-  .type = spindump_json_schema_type_integer,
+  .type = spindump_json_schema_type_literal,
   .callback = 0
 };
 
 static struct spindump_json_schema fieldecn1schema = {
-  .type = spindump_json_schema_type_integer,
+  .type = spindump_json_schema_type_literal,
   .callback = 0
 };
 
 static struct spindump_json_schema fieldceschema = {
-  .type = spindump_json_schema_type_integer,
+  .type = spindump_json_schema_type_literal,
   .callback = 0
 };
 
@@ -218,59 +385,86 @@ static struct spindump_json_schema fieldnotesschema = {
   .callback = 0
 };
 
+static struct spindump_json_schema fieldhistelemschema = {
+  .type = spindump_json_schema_type_integer,
+  .callback = 0
+};
+
+static struct spindump_json_schema fieldhistschema = {
+  .type = spindump_json_schema_type_array,
+  .callback = 0,
+  .u = {
+    .array = {
+      .schema = &fieldhistelemschema
+    }
+  }
+};
+
 static struct spindump_json_schema recordschema = {
   .type = spindump_json_schema_type_record,
   .callback = 0,
   .u = {
     .record = {
-      .nFields = 43,
+      .nFields = spindump_event_parser_json_nfields,
       .fields = {
-        { .required = 1, .name = "Event", .schema = &fieldeventschema },
-        { .required = 1, .name = "Type", .schema = &fieldtypeschema },
-        { .required = 1, .name = "State", .schema = &fieldstateschema },
-        { .required = 1, .name = "Addrs", .schema = &fieldaddrsschema },
-        { .required = 1, .name = "Session", .schema = &fieldsessionschema },
-        { .required = 1, .name = "Ts", .schema = &fieldtsschema },
-        { .required = 0, .name = "Left_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Right_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Full_rtt_initiator", .schema = &fieldrttschema },
-        { .required = 0, .name = "Full_rtt_responder", .schema = &fieldrttschema },
-        { .required = 0, .name = "Avg_left_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Avg_right_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Avg_full_rtt_initiator", .schema = &fieldrttschema },
-        { .required = 0, .name = "Avg_full_rtt_responder", .schema = &fieldrttschema },
-        { .required = 0, .name = "Filt_avg_left_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Filt_avg_right_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Filt_avg_full_rtt_initiator", .schema = &fieldrttschema },
-        { .required = 0, .name = "Filt_avg_full_rtt_responder", .schema = &fieldrttschema },
-        { .required = 0, .name = "Dev_left_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Dev_right_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Dev_full_rtt_initiator", .schema = &fieldrttschema },
-        { .required = 0, .name = "Dev_full_rtt_responder", .schema = &fieldrttschema },
-        { .required = 0, .name = "Min_left_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Min_right_rtt", .schema = &fieldrttschema },
-        { .required = 0, .name = "Min_full_rtt_initiator", .schema = &fieldrttschema },
-        { .required = 0, .name = "Min_full_rtt_responder", .schema = &fieldrttschema },
-        { .required = 0, .name = "Value", .schema = &fieldvalueschema },
-        { .required = 0, .name = "Transition", .schema = &fieldtransitionschema },
-        { .required = 0, .name = "Who", .schema = &fieldwhoschema },
-        { .required = 1, .name = "Packets1", .schema = &fieldpackets1schema },
-        { .required = 1, .name = "Packets2", .schema = &fieldpackets2schema },
-        { .required = 1, .name = "Bytes1", .schema = &fieldbytes1schema },
-        { .required = 1, .name = "Bytes2", .schema = &fieldbytes2schema },
-        { .required = 0, .name = "Bandwidth1", .schema = &fieldbandwidth1schema },
-        { .required = 0, .name = "Bandwidth2", .schema = &fieldbandwidth2schema },
-        { .required = 0, .name = "Ecn0", .schema = &fieldecn0schema },
-        { .required = 0, .name = "Ecn1", .schema = &fieldecn1schema },
-        { .required = 0, .name = "Ce", .schema = &fieldceschema },
-        { .required = 0, .name = "Avg_loss", .schema = &fieldlossschema },
-        { .required = 0, .name = "Tot_loss", .schema = &fieldlossschema },
-        { .required = 0, .name = "Q_loss", .schema = &fieldlossschema },
-        { .required = 0, .name = "L_loss", .schema = &fieldlossschema },
-        { .required = 0, .name = "Length", .schema = &fieldlengthschema },
-        { .required = 0, .name = "Dir", .schema = &fielddirschema },
-        { .required = 0, .name = "Tags", .schema = &fieldtagsschema },
-        { .required = 0, .name = "Notes", .schema = &fieldnotesschema }
+        [spindump_event_parser_json_field_event] = { .required = 1, .name = "Event", .schema = &fieldeventschema },
+        [spindump_event_parser_json_field_type] = { .required = 1, .name = "Type", .schema = &fieldtypeschema },
+        [spindump_event_parser_json_field_state] = { .required = 1, .name = "State", .schema = &fieldstateschema },
+        [spindump_event_parser_json_field_addrs] = { .required = 1, .name = "Addrs", .schema = &fieldaddrsschema },
+        [spindump_event_parser_json_field_session] = { .required = 1, .name = "Session", .schema = &fieldsessionschema },
+        [spindump_event_parser_json_field_ts] = { .required = 1, .name = "Ts", .schema = &fieldtsschema },
+        [spindump_event_parser_json_field_left_rtt] = { .required = 0, .name = "Left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_right_rtt] = { .required = 0, .name = "Right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_full_rtt_initiator] = { .required = 0, .name = "Full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_full_rtt_responder] = { .required = 0, .name = "Full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_avg_left_rtt] = { .required = 0, .name = "Avg_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_avg_right_rtt] = { .required = 0, .name = "Avg_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_avg_full_rtt_initiator] = { .required = 0, .name = "Avg_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_avg_full_rtt_responder] = { .required = 0, .name = "Avg_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_filt_avg_left_rtt] = { .required = 0, .name = "Filt_avg_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_filt_avg_right_rtt] = { .required = 0, .name = "Filt_avg_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_filt_avg_full_rtt_initiator] = { .required = 0, .name = "Filt_avg_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_filt_avg_full_rtt_responder] = { .required = 0, .name = "Filt_avg_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_dev_left_rtt] = { .required = 0, .name = "Dev_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_dev_right_rtt] = { .required = 0, .name = "Dev_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_dev_full_rtt_initiator] = { .required = 0, .name = "Dev_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_dev_full_rtt_responder] = { .required = 0, .name = "Dev_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_min_left_rtt] = { .required = 0, .name = "Min_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_min_right_rtt] = { .required = 0, .name = "Min_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_min_full_rtt_initiator] = { .required = 0, .name = "Min_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_min_full_rtt_responder] = { .required = 0, .name = "Min_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_smoothed_left_rtt] = { .required = 0, .name = "Smoothed_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_smoothed_right_rtt] = { .required = 0, .name = "Smoothed_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_smoothed_full_rtt_initiator] = { .required = 0, .name = "Smoothed_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_smoothed_full_rtt_responder] = { .required = 0, .name = "Smoothed_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_var_left_rtt] = { .required = 0, .name = "Var_left_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_var_right_rtt] = { .required = 0, .name = "Var_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_var_full_rtt_initiator] = { .required = 0, .name = "Var_full_rtt_initiator", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_var_full_rtt_responder] = { .required = 0, .name = "Var_full_rtt_responder", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_value] = { .required = 0, .name = "Value", .schema = &fieldvalueschema },
+        [spindump_event_parser_json_field_transition] = { .required = 0, .name = "Transition", .schema = &fieldtransitionschema },
+        [spindump_event_parser_json_field_who] = { .required = 0, .name = "Who", .schema = &fieldwhoschema },
+        [spindump_event_parser_json_field_packets1] = { .required = 1, .name = "Packets1", .schema = &fieldpackets1schema },
+        [spindump_event_parser_json_field_packets2] = { .required = 1, .name = "Packets2", .schema = &fieldpackets2schema },
+        [spindump_event_parser_json_field_bytes1] = { .required = 1, .name = "Bytes1", .schema = &fieldbytes1schema },
+        [spindump_event_parser_json_field_bytes2] = { .required = 1, .name = "Bytes2", .schema = &fieldbytes2schema },
+        [spindump_event_parser_json_field_bandwidth1] = { .required = 0, .name = "Bandwidth1", .schema = &fieldbandwidth1schema },
+        [spindump_event_parser_json_field_bandwidth2] = { .required = 0, .name = "Bandwidth2", .schema = &fieldbandwidth2schema },
+        [spindump_event_parser_json_field_ecn0] = { .required = 0, .name = "Ecn0", .schema = &fieldecn0schema },
+        [spindump_event_parser_json_field_ecn1] = { .required = 0, .name = "Ecn1", .schema = &fieldecn1schema },
+        [spindump_event_parser_json_field_ce] = { .required = 0, .name = "Ce", .schema = &fieldceschema },
+        [spindump_event_parser_json_field_avg_loss] = { .required = 0, .name = "Avg_loss", .schema = &fieldlossschema },
+        [spindump_event_parser_json_field_tot_loss] = { .required = 0, .name = "Tot_loss", .schema = &fieldlossschema },
+        [spindump_event_parser_json_field_q_loss] = { .required = 0, .name = "Q_loss", .schema = &fieldlossschema },
+        [spindump_event_parser_json_field_l_loss] = { .required = 0, .name = "L_loss", .schema = &fieldlossschema },
+        [spindump_event_parser_json_field_p50_right_rtt] = { .required = 0, .name = "P50_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_p90_right_rtt] = { .required = 0, .name = "P90_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_p99_right_rtt] = { .required = 0, .name = "P99_right_rtt", .schema = &fieldrttschema },
+        [spindump_event_parser_json_field_hist_right_rtt] = { .required = 0, .name = "Hist_right_rtt", .schema = &fieldhistschema },
+        [spindump_event_parser_json_field_length] = { .required = 0, .name = "Length", .schema = &fieldlengthschema },
+        [spindump_event_parser_json_field_dir] = { .required = 0, .name = "Dir", .schema = &fielddirschema },
+        [spindump_event_parser_json_field_tags] = { .required = 0, .name = "Tags", .schema = &fieldtagsschema },
+        [spindump_event_parser_json_field_notes] = { .required = 0, .name = "Notes", .schema = &fieldnotesschema }
       }
     }
   }
@@ -297,6 +491,49 @@ static struct spindump_json_schema schema = {
   }
 };
 
+//
+// The variants of RTT measurements, in the order they are looked for
+//
+
+static const struct spindump_event_parser_json_rttfields rttfields[] = {
+  { .rtt = spindump_event_parser_json_field_left_rtt,
+    .avg = spindump_event_parser_json_field_avg_left_rtt,
+    .dev = spindump_event_parser_json_field_dev_left_rtt,
+    .min = spindump_event_parser_json_field_min_left_rtt,
+    .filtAvg = spindump_event_parser_json_field_filt_avg_left_rtt,
+    .smoothed = spindump_event_parser_json_field_smoothed_left_rtt,
+    .var = spindump_event_parser_json_field_var_left_rtt,
+    .measurement = spindump_measurement_type_bidirectional,
+    .direction = spindump_direction_frominitiator },
+  { .rtt = spindump_event_parser_json_field_right_rtt,
+    .avg = spindump_event_parser_json_field_avg_right_rtt,
+    .dev = spindump_event_parser_json_field_dev_right_rtt,
+    .min = spindump_event_parser_json_field_min_right_rtt,
+    .filtAvg = spindump_event_parser_json_field_filt_avg_right_rtt,
+    .smoothed = spindump_event_parser_json_field_smoothed_right_rtt,
+    .var = spindump_event_parser_json_field_var_right_rtt,
+    .measurement = spindump_measurement_type_bidirectional,
+    .direction = spindump_direction_fromresponder },
+  { .rtt = spindump_event_parser_json_field_full_rtt_initiator,
+    .avg = spindump_event_parser_json_field_avg_full_rtt_initiator,
+    .dev = spindump_event_parser_json_field_dev_full_rtt_initiator,
+    .min = spindump_event_parser_json_field_min_full_rtt_initiator,
+    .filtAvg = spindump_event_parser_json_field_filt_avg_full_rtt_initiator,
+    .smoothed = spindump_event_parser_json_field_smoothed_full_rtt_initiator,
+    .var = spindump_event_parser_json_field_var_full_rtt_initiator,
+    .measurement = spindump_measurement_type_unidirectional,
+    .direction = spindump_direction_frominitiator },
+  { .rtt = spindump_event_parser_json_field_full_rtt_responder,
+    .avg = spindump_event_parser_json_field_avg_full_rtt_responder,
+    .dev = spindump_event_parser_json_field_dev_full_rtt_responder,
+    .min = spindump_event_parser_json_field_min_full_rtt_responder,
+    .filtAvg = spindump_event_parser_json_field_filt_avg_full_rtt_responder,
+    .smoothed = spindump_event_parser_json_field_smoothed_full_rtt_responder,
+    .var = spindump_event_parser_json_field_var_full_rtt_responder,
+    .measurement = spindump_measurement_type_unidirectional,
+    .direction = spindump_direction_fromresponder }
+};
+
 //
 // Actual code --------------------------------------------------------------------------------
 //
@@ -386,6 +623,84 @@ spindump_event_parser_json_textparse_callback(const struct spindump_json_value*
   }
 }
 
+//
+// Parse text as JSON and call a callback for every Spindump event
+// found from it, like spindump_event_parser_json_textparse, but
+// without building JSON value objects. The fields of each event
+// record are collected as they are read, and the event is delivered
+// as soon as its record ends. No memory is allocated, so the memory
+// use does not depend on the size of the input.
+//
+// As events are delivered while the input is being read, events
+// before a syntax error in an array have already been delivered when
+// the error is found.
+//
+// If successful, return 1, otherwise 0.
+//
+
+int
+spindump_event_parser_json_streamparse(const char** jsonText,
+                                       spindump_event_parser_json_callback callback,
+                                       void* data) {
+  struct spindump_event_parser_json_streamcontext context;
+  context.callback = callback;
+  context.data = data;
+  context.success = 1;
+  context.padding = 0;
+  spindump_event_parser_json_fields_initialize(&context.fields);
+  int ans =
+    spindump_json_scan(spindump_event_parser_json_getschema(),
+                       spindump_event_parser_json_streamparse_callback,
+                       &context,
+                       jsonText);
+  if (ans == 0) context.success = 0;
+  return(context.success);
+}
+
+//
+// Helper function to be called upon every item scanned from the
+// JSON input. Called by spindump_event_parser_json_streamparse and
+// spindump_json_scan.
+//
+
+static int
+spindump_event_parser_json_streamparse_callback(const struct spindump_json_scan_item* item,
+                                                void* data) {
+  spindump_assert(item != 0);
+  spindump_assert(data != 0);
+  struct spindump_event_parser_json_streamcontext* context = (struct spindump_event_parser_json_streamcontext*)data;
+  struct spindump_event event;
+
+  switch (item->type) {
+  case spindump_json_scan_itemtype_recordstart:
+    spindump_event_parser_json_fields_initialize(&context->fields);
+    break;
+  case spindump_json_scan_itemtype_recordend:
+    if (spindump_event_parser_json_fields_toevent(&context->fields,&event)) {
+      (*(context->callback))(&event,context->data);
+    } else {
+      context->success = 0;
+    }
+    break;
+  case spindump_json_scan_itemtype_integer:
+    spindump_assert(item->fieldIndex >= 0 && item->fieldIndex < spindump_event_parser_json_nfields);
+    spindump_event_parser_json_fields_setinteger(&context->fields,
+                                                 (enum spindump_event_parser_json_field)item->fieldIndex,
+                                                 item->integer);
+    break;
+  case spindump_json_scan_itemtype_string:
+    spindump_assert(item->fieldIndex >= 0 && item->fieldIndex < spindump_event_parser_json_nfields);
+    spindump_event_parser_json_fields_setstring(&context->fields,
+                                                (enum spindump_event_parser_json_field)item->fieldIndex,
+                                                item->string,
+                                                item->length);
+    break;
+  default:
+    break;
+  }
+  return(1);
+}
+
 //
 // Take a JSON object and parse it as a JSON-formatted event
 // description from Spindump, placing the result in the output
@@ -406,91 +721,360 @@ spindump_event_parser_json_parse(const struct spindump_json_value* json,
   spindump_assert(json->type == spindump_json_value_type_record);
   spindump_assert(event != 0);
 
+  //
+  // Collect the fields from the JSON object, and convert them
+  //
+
+  struct spindump_event_parser_json_fields fields;
+  spindump_event_parser_json_fields_initialize(&fields);
+  for (unsigned int i = 0; i < spindump_event_parser_json_nfields; i++) {
+    const struct spindump_json_schema_field* schemaField = &recordschema.u.record.fields[i];
+    const struct spindump_json_value* value = spindump_json_value_getfield(schemaField->name,json);
+    if (value == 0) continue;
+    if (!spindump_event_parser_json_fields_addvalue(&fields,
+                                                    (enum spindump_event_parser_json_field)i,
+                                                    schemaField->schema,
+                                                    value)) {
+      spindump_errorf("JSON field %s does not have the expected type", schemaField->name);
+      return(0);
+    }
+  }
+  return(spindump_event_parser_json_fields_toevent(&fields,event));
+}
+
+//
+// Clear the collected fields, for the next record
+//
+
+static void
+spindump_event_parser_json_fields_initialize(struct spindump_event_parser_json_fields* fields) {
+  spindump_assert(fields != 0);
+  fields->present = 0;
+  fields->nAddrs = 0;
+  fields->nHistElements = 0;
+  fields->histBucket = 0;
+  fields->histErrorBucket = 0;
+  fields->histErrorCount = 0;
+  fields->histError = 0;
+  spindump_histogram_initialize(&fields->hist);
+}
+
+//
+// Set an integer field. The histogram is given as a flat array of
+// bucket index and count pairs, and is collected as the elements
+// arrive. Otherwise, if a field appears more than once in a record,
+// its first value is used.
+//
+
+static void
+spindump_event_parser_json_fields_setinteger(struct spindump_event_parser_json_fields* fields,
+                                             enum spindump_event_parser_json_field field,
+                                             unsigned long long value) {
+  if (field == spindump_event_parser_json_field_hist_right_rtt) {
+    if (fields->nHistElements % 2 == 0) {
+      fields->histBucket = value;
+    } else if (fields->histBucket >= spindump_histogram_nbuckets || value > 0xffffffffULL) {
+      if (!fields->histError) {
+        fields->histError = 1;
+        fields->histErrorBucket = fields->histBucket;
+        fields->histErrorCount = value;
+      }
+    } else {
+      fields->hist.buckets[fields->histBucket] += (uint32_t)value;
+      fields->hist.count += (uint32_t)value;
+    }
+    fields->nHistElements++;
+  } else if (!spindump_event_parser_json_fields_has(fields,field)) {
+    fields->values[field].integer = value;
+  }
+  fields->present |= (1ULL << field);
+}
+
+//
+// Set a string field. The two addresses are collected from the
+// elements of their array, and further elements are ignored. Counters
+// that are printed as strings are also read as integers from their
+// leading digits.
+//
+
+static void
+spindump_event_parser_json_fields_setstring(struct spindump_event_parser_json_fields* fields,
+                                            enum spindump_event_parser_json_field field,
+                                            const char* string,
+                                            size_t length) {
+  if (field == spindump_event_parser_json_field_addrs) {
+    if (fields->nAddrs < 2) {
+      fields->addrs[fields->nAddrs].string = string;
+      fields->addrs[fields->nAddrs].length = length;
+      fields->nAddrs++;
+    }
+  } else if (!spindump_event_parser_json_fields_has(fields,field)) {
+    fields->values[field].string = string;
+    fields->values[field].length = length;
+    fields->values[field].integer = spindump_event_parser_json_fields_stringtointeger(string,length);
+  }
+  fields->present |= (1ULL << field);
+}
+
+//
+// Return the value of the decimal digits at the start of a string,
+// or 0 if there are none
+//
+
+static unsigned long long
+spindump_event_parser_json_fields_stringtointeger(const char* string,
+                                                  size_t length) {
+  unsigned long long value = 0;
+  for (size_t i = 0; i < length && string[i] >= '0' && string[i] <= '9'; i++) {
+    value = value * 10 + (unsigned long long)(string[i] - '0');
+  }
+  return(value);
+}
+
+//
+// Set a field from a JSON value object, checking that the value has
+// the type that the schema says it should have. Return 0 if it does
+// not, otherwise 1.
+//
+
+static int
+spindump_event_parser_json_fields_addvalue(struct spindump_event_parser_json_fields* fields,
+                                           enum spindump_event_parser_json_field field,
+                                           const struct spindump_json_schema* schema,
+                                           const struct spindump_json_value* value) {
+  switch (schema->type) {
+  case spindump_json_schema_type_integer:
+    if (value->type != spindump_json_value_type_integer) return(0);
+    spindump_event_parser_json_fields_setinteger(fields,field,value->u.integer.value);
+    return(1);
+  case spindump_json_schema_type_string:
+    if (value->type != spindump_json_value_type_string) return(0);
+    spindump_event_parser_json_fields_setstring(fields,field,value->u.string.value,strlen(value->u.string.value));
+    return(1);
+  case spindump_json_schema_type_literal:
+    if (value->type == spindump_json_value_type_integer) {
+      spindump_event_parser_json_fields_setinteger(fields,field,value->u.integer.value);
+    } else if (value->type == spindump_json_value_type_string) {
+      spindump_event_parser_json_fields_setstring(fields,field,value->u.string.value,strlen(value->u.string.value));
+    } else {
+      return(0);
+    }
+    return(1);
+  case spindump_json_schema_type_array:
+    if (value->type != spindump_json_value_type_array) return(0);
+    fields->present |= (1ULL << field);
+    for (unsigned int i = 0; i < value->u.array.n; i++) {
+      if (!spindump_event_parser_json_fields_addvalue(fields,field,schema->u.array.schema,value->u.array.elements[i])) {
+        return(0);
+      }
+    }
+    return(1);
+  default:
+    return(0);
+  }
+}
+
+//
+// Return 1 if a field was present in the record, otherwise 0
+//
+
+static int
+spindump_event_parser_json_fields_has(const struct spindump_event_parser_json_fields* fields,
+                                      enum spindump_event_parser_json_field field) {
+  return((fields->present & (1ULL << field)) != 0);
+}
+
+//
+// Return the value of an integer field, or 0 if the field was not
+// present
+//
+
+static unsigned long long
+spindump_event_parser_json_fields_getinteger(const struct spindump_event_parser_json_fields* fields,
+                                             enum spindump_event_parser_json_field field) {
+  if (!spindump_event_parser_json_fields_has(fields,field)) return(0);
+  return(fields->values[field].integer);
+}
+
+//
+// Copy a string value to a buffer of a given size, as a
+// zero-terminated string, decoding any escapes in it. Return 1 if the string fit, otherwise 0, in
+// which case a truncated string is placed in the buffer.
+//
+
+static int
+spindump_event_parser_json_fields_copy(const struct spindump_event_parser_json_fieldvalue* value,
+                                       char* buffer,
+                                       size_t size) {
+  spindump_assert(size > 0);
+  size_t i = 0;
+  size_t length = 0;
+  while (i < value->length && length < size - 1) {
+    char c = value->string[i++];
+    if (c == '\\' && i < value->length) {
+      c = value->string[i++];
+      switch (c) {
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      default: break;
+      }
+    }
+    buffer[length++] = c;
+  }
+  buffer[length] = 0;
+  return(i == value->length);
+}
+
+//
+// Copy a string to a buffer of a given size, escaping quotes and
+// backslashes so that the result can be placed inside a JSON
+// string. A string that does not fit is truncated, but never in the
+// middle of an escape.
+//
+
+static void
+spindump_event_parser_json_escape(const char* string,
+                                  char* buffer,
+                                  size_t size) {
+  spindump_assert(size > 0);
+  size_t length = 0;
+  while (*string != 0) {
+    int escape = (*string == '"' || *string == '\\');
+    if (length + (escape ? 2 : 1) >= size) break;
+    if (escape) buffer[length++] = '\\';
+    buffer[length++] = *string++;
+  }
+  buffer[length] = 0;
+}
+
+//
+// Copy the value of a string field to a buffer of a given size. An
+// absent field is copied as an empty string. Return 1 if the string
+// fit, otherwise 0.
+//
+
+static int
+spindump_event_parser_json_fields_getstring(const struct spindump_event_parser_json_fields* fields,
+                                            enum spindump_event_parser_json_field field,
+                                            char* buffer,
+                                            size_t size) {
+  if (!spindump_event_parser_json_fields_has(fields,field)) {
+    buffer[0] = 0;
+    return(1);
+  }
+  return(spindump_event_parser_json_fields_copy(&fields->values[field],buffer,size));
+}
+
+//
+// Get the direction of an event from a field. Return 0 if the field
+// is not "initiator" or "responder", otherwise 1.
+//
+
+static int
+spindump_event_parser_json_fields_getdirection(const struct spindump_event_parser_json_fields* fields,
+                                               enum spindump_event_parser_json_field field,
+                                               const char* what,
+                                               enum spindump_direction* direction) {
+  char buffer[spindump_event_parser_json_maxstring];
+  int fits = spindump_event_parser_json_fields_getstring(fields,field,buffer,sizeof(buffer));
+  if (fits && strcasecmp(buffer,"initiator") == 0) {
+    *direction = spindump_direction_frominitiator;
+    return(1);
+  } else if (fits && strcasecmp(buffer,"responder") == 0) {
+    *direction = spindump_direction_fromresponder;
+    return(1);
+  } else {
+    spindump_errorf("%s direction does not have the right value in JSON: %s", what, buffer);
+    return(0);
+  }
+}
+
+//
+// Convert the collected fields of a record to an event, placing the
+// result in the output parameter "event".
+//
+// If successful, return 1, otherwise 0.
+//
+
+static int
+spindump_event_parser_json_fields_toevent(const struct spindump_event_parser_json_fields* fields,
+                                          struct spindump_event* event) {
+  
+  //
+  // Check that the mandatory fields are there
+  //
+
+  char buffer[spindump_event_parser_json_maxstring];
+  memset(event,0,sizeof(*event));
+  for (unsigned int i = 0; i < spindump_event_parser_json_nfields; i++) {
+    const struct spindump_json_schema_field* schemaField = &recordschema.u.record.fields[i];
+    if (schemaField->required &&
+        !spindump_event_parser_json_fields_has(fields,(enum spindump_event_parser_json_field)i)) {
+      spindump_errorf("field %s is missing from the JSON record", schemaField->name);
+      return(0);
+    }
+  }
+
   //
   // Get the mandatory fields
   //
 
-  const char* eventType = spindump_json_value_getstring(spindump_json_value_getrequiredfield("Event",json));
-  spindump_deepdeepdebugf("spindump_event_parser_json_parse %s", eventType);
-  if (!spindump_event_parser_json_converteventtype(eventType,&event->eventType)) {
-    spindump_errorf("Invalid event type %s", eventType);
+  if (!spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_event,buffer,sizeof(buffer)) ||
+      !spindump_event_parser_json_converteventtype(buffer,&event->eventType)) {
+    spindump_errorf("Invalid event type %s", buffer);
     return(0);
   }
-  const char* connectionType = spindump_json_value_getstring(spindump_json_value_getrequiredfield("Type",json));
-  if (!spindump_connection_string_to_connectiontype(connectionType,&event->connectionType)) {
-    spindump_errorf("Invalid connection type %s", connectionType);
+  spindump_deepdeepdebugf("spindump_event_parser_json_parse %s", buffer);
+  if (!spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_type,buffer,sizeof(buffer)) ||
+      !spindump_connection_string_to_connectiontype(buffer,&event->connectionType)) {
+    spindump_errorf("Invalid connection type %s", buffer);
     return(0);
   }
-  const char* state = spindump_json_value_getstring(spindump_json_value_getrequiredfield("State",json));
-  if (!spindump_connection_statestring_to_state(state,&event->state)) {
-    spindump_errorf("Invalid state %s", state);
+  if (!spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_state,buffer,sizeof(buffer)) ||
+      !spindump_connection_statestring_to_state(buffer,&event->state)) {
+    spindump_errorf("Invalid state %s", buffer);
     return(0);
   }
-  const struct spindump_json_value* addrs = spindump_json_value_getrequiredfield("Addrs",json);
-  const struct spindump_json_value* addr1elem = spindump_json_value_getarrayelem(0,addrs);
-  const struct spindump_json_value* addr2elem = spindump_json_value_getarrayelem(1,addrs);
-  if (addr1elem == 0 || addr2elem == 0) {
+  if (fields->nAddrs < 2) {
     spindump_errorf("Missing addresses in an event");
     return(0);
   }
-  const char* addr1 = spindump_json_value_getstring(addr1elem);
-  if (!spindump_network_fromstringoraddr(&event->initiatorAddress,addr1)) {
+  if (!spindump_event_parser_json_fields_copy(&fields->addrs[0],buffer,sizeof(buffer)) ||
+      !spindump_network_fromstringoraddr(&event->initiatorAddress,buffer)) {
     spindump_errorf("Cannot parse initiator address");
     return(0);
   }
-  const char* addr2 = spindump_json_value_getstring(addr2elem);
-  if (!spindump_network_fromstringoraddr(&event->responderAddress,addr2)) {
+  if (!spindump_event_parser_json_fields_copy(&fields->addrs[1],buffer,sizeof(buffer)) ||
+      !spindump_network_fromstringoraddr(&event->responderAddress,buffer)) {
     spindump_errorf("Cannot parse responder address");
     return(0);
   }
-  const char* session = spindump_json_value_getstring(spindump_json_value_getrequiredfield("Session",json));
-  if (strlen(session) + 1 > sizeof(event->session)) {
+  if (!spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_session,
+                                                   event->session,sizeof(event->session))) {
     spindump_errorf("Session field is too long for the event");
     return(0);
   }
-  strncpy(&event->session[0],session,sizeof(event->session));
-  unsigned long long ts = spindump_json_value_getinteger(spindump_json_value_getrequiredfield("Ts",json));
-  event->timestamp = ts;
+  event->timestamp = spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_ts);
   spindump_deepdeepdebugf("spindump_event_parser_json reading timestamp %llu from JSON", event->timestamp);
-  unsigned long long packets1 = spindump_json_value_getinteger(spindump_json_value_getrequiredfield("Packets1",json));
-  event->packetsFromSide1 = (unsigned int)packets1;
-  unsigned long long packets2 = spindump_json_value_getinteger(spindump_json_value_getrequiredfield("Packets2",json));
-  event->packetsFromSide2 = (unsigned int)packets2;
-  unsigned long long bytes1 = spindump_json_value_getinteger(spindump_json_value_getrequiredfield("Bytes1",json));
-  event->bytesFromSide1 = (unsigned int)bytes1;
-  unsigned long long bytes2 = spindump_json_value_getinteger(spindump_json_value_getrequiredfield("Bytes2",json));
-  event->bytesFromSide2 = (unsigned int)bytes2;
-  const struct spindump_json_value* bandwidth1Elem = spindump_json_value_getfield("Bandwidth1",json);
-  if (bandwidth1Elem != 0) {
-    unsigned long long bandwidth1 = spindump_json_value_getinteger(bandwidth1Elem);
-    event->bandwidthFromSide1 = (unsigned int)bandwidth1;
-  } else {
-    event->bandwidthFromSide1 = 0;
-  }
-  const struct spindump_json_value* bandwidth2Elem = spindump_json_value_getfield("Bandwidth2",json);
-  if (bandwidth2Elem != 0) {
-    unsigned long long bandwidth2 = spindump_json_value_getinteger(bandwidth2Elem);
-    event->bandwidthFromSide2 = (unsigned int)bandwidth2;
-  } else {
-    event->bandwidthFromSide2 = 0;
-  }
+  event->packetsFromSide1 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_packets1);
+  event->packetsFromSide2 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_packets2);
+  event->bytesFromSide1 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_bytes1);
+  event->bytesFromSide2 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_bytes2);
+  event->bandwidthFromSide1 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_bandwidth1);
+  event->bandwidthFromSide2 = (unsigned int)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_bandwidth2);
 
   //
   // Get the optional fields
   //
   
-  const struct spindump_json_value* tags = spindump_json_value_getfield("Tags",json);
   spindump_tags_initialize(&event->tags);
-  if (tags != 0) {
-    const char* tagsString = spindump_json_value_getstring(tags);
-    spindump_tags_addtag(&event->tags,tagsString);
-  }
-  
-  const struct spindump_json_value* notes = spindump_json_value_getfield("Notes",json);
-  if (notes != 0) {
-    const char* notesString = spindump_json_value_getstring(notes);
-    strncpy(event->notes,notesString,sizeof(event->notes)-1);
+  if (spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_tags)) {
+    spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_tags,buffer,sizeof(buffer));
+    spindump_tags_addtag(&event->tags,buffer);
   }
+  spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_notes,
+                                              event->notes,sizeof(event->notes));
   
   //
   // Get the rest of the fields based on the type of event
@@ -499,232 +1083,117 @@ spindump_event_parser_json_parse(const struct spindump_json_value* json,
   switch (event->eventType) {
     
   case spindump_event_type_new_connection:
-    if (!spindump_event_parser_json_parse_aux_new_connection(json,event)) {
-      return(0);
-    }
-    break;
-    
   case spindump_event_type_change_connection:
-    if (!spindump_event_parser_json_parse_aux_change_connection(json,event)) {
-      return(0);
-    }
-    break;
-    
   case spindump_event_type_connection_delete:
-    if (!spindump_event_parser_json_parse_aux_connection_delete(json,event)) {
-      return(0);
-    }
-    break;
+    return(1);
     
   case spindump_event_type_new_rtt_measurement:
-    if (!spindump_event_parser_json_parse_aux_new_rtt_measurement(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_new_rtt_measurement(fields,event));
     
   case spindump_event_type_periodic:
-    if (!spindump_event_parser_json_parse_aux_periodic(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_periodic(fields,event));
     
   case spindump_event_type_spin_flip:
-    if (!spindump_event_parser_json_parse_aux_spin_flip(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_spin_flip(fields,event));
     
   case spindump_event_type_spin_value:
-    if (!spindump_event_parser_json_parse_aux_spin_value(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_spin_value(fields,event));
     
   case spindump_event_type_ecn_congestion_event:
-    if (!spindump_event_parser_json_parse_aux_ecn_congestion_event(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_ecn_congestion_event(fields,event));
 
   case spindump_event_type_rtloss_measurement:
-    if (!spindump_event_parser_json_parse_aux_rtloss_measurement(json, event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_loss_measurement(fields,"rtloss",
+                                                                 spindump_event_parser_json_field_avg_loss,
+                                                                 spindump_event_parser_json_field_tot_loss,
+                                                                 event->u.rtlossMeasurement.avgLoss,
+                                                                 event->u.rtlossMeasurement.totLoss,
+                                                                 &event->u.rtlossMeasurement.direction));
 
   case spindump_event_type_qrloss_measurement:
-    if (!spindump_event_parser_json_parse_aux_qrloss_measurement(json, event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_loss_measurement(fields,"qrloss",
+                                                                 spindump_event_parser_json_field_avg_loss,
+                                                                 spindump_event_parser_json_field_tot_loss,
+                                                                 event->u.qrlossMeasurement.avgLoss,
+                                                                 event->u.qrlossMeasurement.totLoss,
+                                                                 &event->u.qrlossMeasurement.direction));
 
   case spindump_event_type_qlloss_measurement:
-    if (!spindump_event_parser_json_parse_aux_qlloss_measurement(json, event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_loss_measurement(fields,"qlloss",
+                                                                 spindump_event_parser_json_field_q_loss,
+                                                                 spindump_event_parser_json_field_l_loss,
+                                                                 event->u.qllossMeasurement.qLoss,
+                                                                 event->u.qllossMeasurement.lLoss,
+                                                                 &event->u.qllossMeasurement.direction));
     
   case spindump_event_type_packet:
-    if (!spindump_event_parser_json_parse_aux_packet(json,event)) {
-      return(0);
-    }
-    break;
+    return(spindump_event_parser_json_parse_aux_packet(fields,event));
     
   default:
     spindump_errorf("Invalid event type %u", event->eventType);
     return(0);
   }
-  
-  return(1);
-}
-
-//
-// Copy fields from JSON event to the event struct, for events of the
-// type "". Return value is 0 upon error, 1 upon success.
-//
-
-static int
-spindump_event_parser_json_parse_aux_new_connection(const struct spindump_json_value* json,
-                                                    struct spindump_event* event) {
-  //
-  // This always succeeds
-  //
-  
-  return(1);
-}
-
-//
-// Copy fields from JSON event to the event struct, for events of the
-// type "Change Connection". Return value is 0 upon error, 1 upon success.
-//
-
-static int
-spindump_event_parser_json_parse_aux_change_connection(const struct spindump_json_value* json,
-                                                       struct spindump_event* event) {
-  //
-  // This always succeeds
-  //
-  
-  return(1);
 }
 
 //
 // Copy fields from JSON event to the event struct, for events of the
-// type "Connection Delete". Return value is 0 upon error, 1 upon
+// type "Measurement". Exactly one of the RTT fields tells what kind
+// of a measurement this is. Return value is 0 upon error, 1 upon
 // success.
 //
 
 static int
-spindump_event_parser_json_parse_aux_connection_delete(const struct spindump_json_value* json,
-                                                       struct spindump_event* event) {
-  //
-  // This always succeeds
-  //
-  
-  return(1);
-}
-
-//
-// Copy fields from JSON event to the event struct, for events of the
-// type "". Return value is 0 upon error, 1 upon success.
-//
-
-static int
-spindump_event_parser_json_parse_aux_new_rtt_measurement(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_new_rtt_measurement(const struct spindump_event_parser_json_fields* fields,
                                                          struct spindump_event* event) {
-  const struct spindump_json_value* field = 0;
-  const struct spindump_json_value* avgfield = 0;
-  const struct spindump_json_value* devfield = 0;
-  const struct spindump_json_value* minfield = 0;
-  const struct spindump_json_value* filtavgfield = 0;
-  if ((field = spindump_json_value_getfield("Left_rtt",json)) != 0) {
-    event->u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
-    event->u.newRttMeasurement.direction = spindump_direction_frominitiator;
-    avgfield = spindump_json_value_getfield("Avg_left_rtt",json);
-    devfield = spindump_json_value_getfield("Dev_left_rtt",json);
-    minfield = spindump_json_value_getfield("Min_left_rtt",json);
-    filtavgfield = spindump_json_value_getfield("Filt_avg_left_rtt",json);
-  } else if ((field = spindump_json_value_getfield("Right_rtt",json)) != 0) {
-    event->u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
-    event->u.newRttMeasurement.direction = spindump_direction_fromresponder;
-    avgfield = spindump_json_value_getfield("Avg_right_rtt",json);
-    devfield = spindump_json_value_getfield("Dev_right_rtt",json);
-    minfield = spindump_json_value_getfield("Min_right_rtt",json);
-    filtavgfield = spindump_json_value_getfield("Filt_avg_right_rtt",json);
-  } else if ((field = spindump_json_value_getfield("Full_rtt_initiator",json)) != 0) {
-    event->u.newRttMeasurement.measurement = spindump_measurement_type_unidirectional;
-    event->u.newRttMeasurement.direction = spindump_direction_frominitiator;
-    avgfield = spindump_json_value_getfield("Avg_full_rtt_initiator",json);
-    devfield = spindump_json_value_getfield("Dev_full_rtt_initiator",json);
-    minfield = spindump_json_value_getfield("Min_full_rtt_initiator",json);
-    filtavgfield = spindump_json_value_getfield("Filt_avg_full_rtt_initiator",json);
-  } else if ((field = spindump_json_value_getfield("Full_rtt_responder",json)) != 0) {
-    event->u.newRttMeasurement.measurement = spindump_measurement_type_unidirectional;
-    event->u.newRttMeasurement.direction = spindump_direction_fromresponder;
-    avgfield = spindump_json_value_getfield("Avg_full_rtt_responder",json);
-    devfield = spindump_json_value_getfield("Dev_full_rtt_responder",json);
-    minfield = spindump_json_value_getfield("Min_full_rtt_responder",json);
-    filtavgfield = spindump_json_value_getfield("Filt_avg_full_rtt_responder",json);
-  } else {
-    spindump_errorf("new RTT measurement event does not have the necessary JSON fields");
-    return(0);
-  }
-  unsigned long long value = spindump_json_value_getinteger(field);
-  unsigned long long avgValue;
-  unsigned long long devValue;
-  unsigned long long minValue;
-  unsigned long long filtAvgValue;
-  event->u.newRttMeasurement.rtt = (unsigned long)value;
-  if (avgfield != 0 &&
-      (avgValue = spindump_json_value_getinteger(avgfield)) > 0) {
-    event->u.newRttMeasurement.avgRtt = (unsigned long)avgValue;
-  }
-  if (devfield != 0 &&
-      (devValue = spindump_json_value_getinteger(devfield)) > 0) {
-    event->u.newRttMeasurement.devRtt = (unsigned long)devValue;
-  }
-  if (minfield != 0 &&
-      (minValue = spindump_json_value_getinteger(minfield)) > 0) {
-    event->u.newRttMeasurement.minRtt = (unsigned long)minValue;
-  }
-  if (filtavgfield != 0 &&
-      (filtAvgValue = spindump_json_value_getinteger(filtavgfield)) > 0) {
-    event->u.newRttMeasurement.filtAvgRtt = (unsigned long)filtAvgValue;
+  for (unsigned int i = 0; i < sizeof(rttfields) / sizeof(rttfields[0]); i++) {
+    const struct spindump_event_parser_json_rttfields* variant = &rttfields[i];
+    if (spindump_event_parser_json_fields_has(fields,variant->rtt)) {
+      event->u.newRttMeasurement.measurement = variant->measurement;
+      event->u.newRttMeasurement.direction = variant->direction;
+      event->u.newRttMeasurement.rtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->rtt);
+      event->u.newRttMeasurement.avgRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->avg);
+      event->u.newRttMeasurement.devRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->dev);
+      event->u.newRttMeasurement.minRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->min);
+      event->u.newRttMeasurement.filtAvgRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->filtAvg);
+      event->u.newRttMeasurement.smoothedRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->smoothed);
+      event->u.newRttMeasurement.varRtt = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,variant->var);
+      return(1);
+    }
   }
-  return(1);
+  spindump_errorf("new RTT measurement event does not have the necessary JSON fields");
+  return(0);
 }
 
 //
 // Copy fields from JSON event to the event struct, for events of the
-// type "". Return value is 0 upon error, 1 upon success.
+// type "Periodic". The RTT histogram is given as a flat array of
+// bucket index and count pairs, for the non-empty buckets only; the
+// quantiles printed alongside it are not read, as they can be
+// calculated from the histogram. Return value is 0 upon error, 1
+// upon success.
 //
 
 static int
-spindump_event_parser_json_parse_aux_periodic(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_periodic(const struct spindump_event_parser_json_fields* fields,
                                               struct spindump_event* event) {
-  const struct spindump_json_value* field = 0;
-  const struct spindump_json_value* avgfield = 0;
-  const struct spindump_json_value* devfield = 0;
-  if ((field = spindump_json_value_getfield("Right_rtt",json)) != 0) {
-    avgfield = spindump_json_value_getfield("Avg_right_rtt",json);
-    devfield = spindump_json_value_getfield("Dev_right_rtt",json);
+  if (fields->nHistElements % 2 != 0) {
+    spindump_errorf("Hist_right_rtt needs to be an array of bucket and count pairs");
+    return(0);
+  }
+  if (fields->histError) {
+    spindump_errorf("Hist_right_rtt bucket %llu or count %llu out of range",
+                    fields->histErrorBucket, fields->histErrorCount);
+    return(0);
+  }
+  event->u.periodic.histRight = fields->hist;
+  if (spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_right_rtt)) {
+    event->u.periodic.rttRight = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_right_rtt);
+    event->u.periodic.avgRttRight = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_avg_right_rtt);
+    event->u.periodic.devRttRight = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_dev_right_rtt);
   } else {
     event->u.periodic.rttRight = spindump_rtt_infinite;
     event->u.periodic.avgRttRight = spindump_rtt_infinite;
     event->u.periodic.devRttRight = spindump_rtt_infinite;
-    return(1);
-  }
-  unsigned long long value = spindump_json_value_getinteger(field);
-  unsigned long long avgValue;
-  unsigned long long devValue;
-  event->u.periodic.rttRight = (unsigned long)value;
-  if (avgfield != 0 &&
-      (avgValue = spindump_json_value_getinteger(avgfield)) > 0) {
-    event->u.periodic.avgRttRight = (unsigned long)avgValue;
-  }
-  if (devfield != 0 &&
-      (devValue = spindump_json_value_getinteger(devfield)) > 0) {
-    event->u.periodic.devRttRight = (unsigned long)devValue;
   }
   return(1);
 }
@@ -735,16 +1204,16 @@ spindump_event_parser_json_parse_aux_periodic(const struct spindump_json_value*
 //
 
 static int
-spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_event_parser_json_fields* fields,
                                                struct spindump_event* event) {
-  const struct spindump_json_value* transitionField = spindump_json_value_getfield("Transition",json);
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  if (transitionField == 0 || whoField == 0) {
+  if (!spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_transition) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_who)) {
     spindump_errorf("spin flip event does not have the necessary JSON fields");
     return(0);
   }
-  const char* transitionValue = spindump_json_value_getstring(transitionField);
-  const char* whoValue = spindump_json_value_getstring(whoField);
+  char transitionValue[spindump_event_parser_json_maxstring];
+  spindump_event_parser_json_fields_getstring(fields,spindump_event_parser_json_field_transition,
+                                              transitionValue,sizeof(transitionValue));
   if (strcmp(transitionValue,"0-1") == 0) {
     event->u.spinFlip.spin0to1 = 1;
   } else if (strcmp(transitionValue,"1-0") == 0) {
@@ -753,15 +1222,8 @@ spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_json_value*
     spindump_errorf("spin flip transition value does not have the right value in JSON: %s", transitionValue);
     return(0);
   }
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.spinFlip.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.spinFlip.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("spin flip direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
+  return(spindump_event_parser_json_fields_getdirection(fields,spindump_event_parser_json_field_who,
+                                                        "spin flip",&event->u.spinFlip.direction));
 }
 
 //
@@ -770,33 +1232,21 @@ spindump_event_parser_json_parse_aux_spin_flip(const struct spindump_json_value*
 //
 
 static int
-spindump_event_parser_json_parse_aux_spin_value(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_spin_value(const struct spindump_event_parser_json_fields* fields,
                                                 struct spindump_event* event) {
-  const struct spindump_json_value* valueField = spindump_json_value_getfield("Value",json);
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  if (valueField == 0 || whoField == 0) {
+  if (!spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_value) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_who)) {
     spindump_errorf("spin value event does not have the necessary JSON fields");
     return(0);
   }
-  unsigned long long valueValue = spindump_json_value_getinteger(valueField);
-  const char* whoValue = spindump_json_value_getstring(whoField);
-  if (valueValue == 0) {
-    event->u.spinValue.value = 0;
-  } else if (valueValue == 1) {
-    event->u.spinValue.value = 1;
-  } else {
+  unsigned long long valueValue = spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_value);
+  if (valueValue > 1) {
     spindump_errorf("spin value bit value does not have the right value in JSON: %llu", valueValue);
     return(0);
   }
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.spinValue.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.spinValue.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("spin value direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
+  event->u.spinValue.value = (unsigned char)valueValue;
+  return(spindump_event_parser_json_fields_getdirection(fields,spindump_event_parser_json_field_who,
+                                                        "spin value",&event->u.spinValue.direction));
 }
 
 //
@@ -805,164 +1255,67 @@ spindump_event_parser_json_parse_aux_spin_value(const struct spindump_json_value
 //
 
 static int
-spindump_event_parser_json_parse_aux_ecn_congestion_event(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_ecn_congestion_event(const struct spindump_event_parser_json_fields* fields,
                                                           struct spindump_event* event) {
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  const struct spindump_json_value* ecn0Field = spindump_json_value_getfield("Ecn0",json);
-  const struct spindump_json_value* ecn1Field = spindump_json_value_getfield("Ecn1",json);
-  const struct spindump_json_value* ceField = spindump_json_value_getfield("Ce",json);
-  if (whoField == 0 || ecn0Field == 0 || ecn1Field == 0 || ceField == 0) {
+  if (!spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_who) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_ecn0) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_ecn1) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_ce)) {
     spindump_errorf("congestion notification event does not have the necessary JSON fields");
     return(0);
   }
-  const char* whoValue = spindump_json_value_getstring(whoField);
-  unsigned long long ecn0Value = spindump_json_value_getinteger(ecn0Field);
-  unsigned long long ecn1Value = spindump_json_value_getinteger(ecn1Field);
-  unsigned long long ceValue = spindump_json_value_getinteger(ceField);
-  event->u.ecnCongestionEvent.ecn0 = (unsigned int)ecn0Value;
-  event->u.ecnCongestionEvent.ecn1 = (unsigned int)ecn1Value;
-  event->u.ecnCongestionEvent.ce = (unsigned int)ceValue;
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.ecnCongestionEvent.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.ecnCongestionEvent.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("congestion notification event direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
-}
-
-static int
-spindump_event_parser_json_parse_aux_rtloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event) {
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  const struct spindump_json_value* avgField = spindump_json_value_getfield("Avg_loss",json);
-  const struct spindump_json_value* totField = spindump_json_value_getfield("Tot_loss",json);
-  
-  if (whoField == 0 || avgField == 0 || totField == 0) {
-    spindump_errorf("rtloss event does not have the necessary JSON fields");
-    return(0);
-  }
-
-  const char* avgValue = spindump_json_value_getstring(avgField);
-  const char* totValue = spindump_json_value_getstring(totField);
-  const char* whoValue = spindump_json_value_getstring(whoField);
-
-  // Implement validity check
-  memset(event->u.rtlossMeasurement.avgLoss, '\0', sizeof(event->u.rtlossMeasurement.avgLoss));
-  strcpy(event->u.rtlossMeasurement.avgLoss, avgValue);
-
-  memset(event->u.rtlossMeasurement.totLoss, '\0', sizeof(event->u.rtlossMeasurement.totLoss));
-  strcpy(event->u.rtlossMeasurement.totLoss, totValue);
-
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.rtlossMeasurement.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.rtlossMeasurement.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("rtloss value direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
+  event->u.ecnCongestionEvent.ecn0 = spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_ecn0);
+  event->u.ecnCongestionEvent.ecn1 = spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_ecn1);
+  event->u.ecnCongestionEvent.ce = spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_ce);
+  return(spindump_event_parser_json_fields_getdirection(fields,spindump_event_parser_json_field_who,
+                                                        "congestion notification event",
+                                                        &event->u.ecnCongestionEvent.direction));
 }
 
-static int
-spindump_event_parser_json_parse_aux_qrloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event) {
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  const struct spindump_json_value* avgField = spindump_json_value_getfield("Avg_loss",json); // Note that fieldlossschema type in spindump_remote_server is string
-  const struct spindump_json_value* totField = spindump_json_value_getfield("Tot_loss",json);
-
-  if (whoField == 0 || avgField == 0 || totField == 0) {
-    spindump_errorf("qrloss event does not have the necessary JSON fields");
-    return(0);
-  }
-
-  const char* avgValue = spindump_json_value_getstring(avgField);
-  const char* totValue = spindump_json_value_getstring(totField);
-  const char* whoValue = spindump_json_value_getstring(whoField);
-
-  // Implement validity check
-  memset(event->u.qrlossMeasurement.avgLoss, '\0', sizeof(event->u.qrlossMeasurement.avgLoss));
-  strncpy(event->u.qrlossMeasurement.avgLoss, avgValue, sizeof(event->u.qrlossMeasurement.avgLoss)-1);
-
-  memset(event->u.qrlossMeasurement.totLoss, '\0', sizeof(event->u.qrlossMeasurement.totLoss));
-  strncpy(event->u.qrlossMeasurement.totLoss, totValue, sizeof(event->u.qrlossMeasurement.totLoss)-1);
-
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.qrlossMeasurement.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.qrlossMeasurement.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("qrloss value direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
-}
+//
+// Copy fields from JSON event to the event struct, for the loss
+// measurement events "rtloss", "qrloss" and "qlloss". Each has two
+// loss values, given as strings, and a direction. Loss values that
+// are too long are truncated. Return value is 0 upon error, 1 upon
+// success.
+//
 
 static int
-spindump_event_parser_json_parse_aux_qlloss_measurement(const struct spindump_json_value* json,
-                                                        struct spindump_event* event) {
-  const struct spindump_json_value* whoField = spindump_json_value_getfield("Who",json);
-  const struct spindump_json_value* qField = spindump_json_value_getfield("Q_loss",json); // Note that fieldlossschema type in spindump_remote_server is string
-  const struct spindump_json_value* lField = spindump_json_value_getfield("L_loss", json);
-  
-  if (whoField == 0 || qField == 0 || lField == 0) {
-    spindump_errorf("qlloss event does not have the necessary JSON fields");
+spindump_event_parser_json_parse_aux_loss_measurement(const struct spindump_event_parser_json_fields* fields,
+                                                      const char* what,
+                                                      enum spindump_event_parser_json_field field1,
+                                                      enum spindump_event_parser_json_field field2,
+                                                      char* value1,
+                                                      char* value2,
+                                                      enum spindump_direction* direction) {
+  if (!spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_who) ||
+      !spindump_event_parser_json_fields_has(fields,field1) ||
+      !spindump_event_parser_json_fields_has(fields,field2)) {
+    spindump_errorf("%s event does not have the necessary JSON fields", what);
     return(0);
   }
-
-  const char* whoValue = spindump_json_value_getstring(whoField);
-  const char* qValue = spindump_json_value_getstring(qField);
-  const char* lValue = spindump_json_value_getstring(lField);
-
-  // Implement validity check
-  memset(event->u.qllossMeasurement.qLoss, '\0', sizeof(event->u.qllossMeasurement.qLoss));
-  strncpy(event->u.qllossMeasurement.qLoss, qValue, sizeof(event->u.qllossMeasurement.qLoss)-1);
-
-  memset(event->u.qllossMeasurement.lLoss, '\0', sizeof(event->u.qllossMeasurement.lLoss));
-  strncpy(event->u.qllossMeasurement.lLoss, lValue, sizeof(event->u.qllossMeasurement.lLoss)-1);
-
-  if (strcasecmp(whoValue,"initiator") == 0) {
-    event->u.qllossMeasurement.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(whoValue,"responder") == 0) {
-    event->u.qllossMeasurement.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("qlloss value direction does not have the right value in JSON: %s", whoValue);
-    return(0);
-  }
-  return(1);
+  spindump_event_parser_json_fields_getstring(fields,field1,value1,spindump_lossfield_charlength);
+  spindump_event_parser_json_fields_getstring(fields,field2,value2,spindump_lossfield_charlength);
+  return(spindump_event_parser_json_fields_getdirection(fields,spindump_event_parser_json_field_who,
+                                                        what,direction));
 }
 
 //
-// Parse the record about a new packet. It has no extra information.
+// Parse the record about a new packet. It has its length and
+// direction.
 //
 
 static int
-spindump_event_parser_json_parse_aux_packet(const struct spindump_json_value* json,
+spindump_event_parser_json_parse_aux_packet(const struct spindump_event_parser_json_fields* fields,
                                             struct spindump_event* event) {
-  const struct spindump_json_value* dirField = spindump_json_value_getfield("Dir",json);
-  const struct spindump_json_value* lengthField = spindump_json_value_getfield("Length",json);
-  
-  if (dirField == 0 || lengthField == 0) {
+  if (!spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_dir) ||
+      !spindump_event_parser_json_fields_has(fields,spindump_event_parser_json_field_length)) {
     spindump_errorf("packet event does not have the necessary JSON fields");
     return(0);
   }
-
-  const char* dirValue = spindump_json_value_getstring(dirField);
-  unsigned long long lengthValue = spindump_json_value_getinteger(lengthField);
-
-  if (strcasecmp(dirValue,"initiator") == 0) {
-    event->u.packet.direction = spindump_direction_frominitiator;
-  } else if (strcasecmp(dirValue,"responder") == 0) {
-    event->u.packet.direction = spindump_direction_fromresponder;
-  } else {
-    spindump_errorf("Dir value direction does not have the right value in JSON: %s", dirValue);
-    return(0);
-  }
-  event->u.packet.length = (unsigned long)lengthValue;
-  return(1);
+  event->u.packet.length = (unsigned long)spindump_event_parser_json_fields_getinteger(fields,spindump_event_parser_json_field_length);
+  return(spindump_event_parser_json_fields_getdirection(fields,spindump_event_parser_json_field_dir,
+                                                        "Dir value",&event->u.packet.direction));
 }
 
 //
@@ -986,7 +1339,7 @@ spindump_event_parser_json_print(const struct spindump_event* event,
   //
   
   if (length < 2) return(0);
-  memset(buffer,0,length);
+  buffer[0] = 0;
 
   //
   // Some utilities to put strings onto the buffer
@@ -1014,10 +1367,14 @@ spindump_event_parser_json_print(const struct spindump_event* event,
   addtobuffer2("\"State\": \"%s\"",
                spindump_connection_statestring_plain(event->state));
   if (event->tags.string[0] != 0) {
-    addtobuffer2(", \"Tags\": \"%s\"", event->tags.string);
+    char tags[2*sizeof(event->tags.string)];
+    spindump_event_parser_json_escape(event->tags.string,tags,sizeof(tags));
+    addtobuffer2(", \"Tags\": \"%s\"", tags);
   }
   if (event->notes[0] != 0) {
-    addtobuffer2(", \"Notes\": \"%s\"", event->notes);
+    char notes[2*sizeof(event->notes)];
+    spindump_event_parser_json_escape(event->notes,notes,sizeof(notes));
+    addtobuffer2(", \"Notes\": \"%s\"", notes);
   }
   
   //
@@ -1049,6 +1406,10 @@ spindump_event_parser_json_print(const struct spindump_event* event,
        if (event->u.newRttMeasurement.minRtt > 0) {
           addtobuffer2(", \"Min_left_rtt\": %lu", event->u.newRttMeasurement.minRtt);
        }
+        if (event->u.newRttMeasurement.smoothedRtt > 0) {
+          addtobuffer2(", \"Smoothed_left_rtt\": %lu", event->u.newRttMeasurement.smoothedRtt);
+          addtobuffer2(", \"Var_left_rtt\": %lu", event->u.newRttMeasurement.varRtt);
+        }
       } else {
         addtobuffer2(", \"Right_rtt\": %lu", event->u.newRttMeasurement.rtt);
         if (event->u.newRttMeasurement.avgRtt > 0) {
@@ -1061,6 +1422,10 @@ spindump_event_parser_json_print(const struct spindump_event* event,
        if (event->u.newRttMeasurement.minRtt > 0) {
           addtobuffer2(", \"Min_right_rtt\": %lu", event->u.newRttMeasurement.minRtt);
        }
+        if (event->u.newRttMeasurement.smoothedRtt > 0) {
+          addtobuffer2(", \"Smoothed_right_rtt\": %lu", event->u.newRttMeasurement.smoothedRtt);
+          addtobuffer2(", \"Var_right_rtt\": %lu", event->u.newRttMeasurement.varRtt);
+        }
 
       }
     } else {
@@ -1076,6 +1441,10 @@ spindump_event_parser_json_print(const struct spindump_event* event,
        if (event->u.newRttMeasurement.minRtt > 0) {
           addtobuffer2(", \"Min_full_rtt_initiator\": %lu", event->u.newRttMeasurement.minRtt);
        }
+        if (event->u.newRttMeasurement.smoothedRtt > 0) {
+          addtobuffer2(", \"Smoothed_full_rtt_initiator\": %lu", event->u.newRttMeasurement.smoothedRtt);
+          addtobuffer2(", \"Var_full_rtt_initiator\": %lu", event->u.newRttMeasurement.varRtt);
+        }
       } else {
         addtobuffer2(", \"Full_rtt_responder\": %lu", event->u.newRttMeasurement.rtt);
         if (event->u.newRttMeasurement.avgRtt > 0) {
@@ -1088,6 +1457,10 @@ spindump_event_parser_json_print(const struct spindump_event* event,
        if (event->u.newRttMeasurement.minRtt > 0) {
           addtobuffer2(", \"Min_full_rtt_responder\": %lu", event->u.newRttMeasurement.minRtt);
        }
+        if (event->u.newRttMeasurement.smoothedRtt > 0) {
+          addtobuffer2(", \"Smoothed_full_rtt_responder\": %lu", event->u.newRttMeasurement.smoothedRtt);
+          addtobuffer2(", \"Var_full_rtt_responder\": %lu", event->u.newRttMeasurement.varRtt);
+        }
       }
     }
     break;
@@ -1100,6 +1473,20 @@ spindump_event_parser_json_print(const struct spindump_event* event,
         addtobuffer2(", \"Dev_right_rtt\": %lu", event->u.periodic.devRttRight);
       }
     }
+    if (event->u.periodic.histRight.count > 0) {
+      const struct spindump_histogram* histogram = &event->u.periodic.histRight;
+      addtobuffer2(", \"P50_right_rtt\": %lu", spindump_histogram_quantile(histogram,50));
+      addtobuffer2(", \"P90_right_rtt\": %lu", spindump_histogram_quantile(histogram,90));
+      addtobuffer2(", \"P99_right_rtt\": %lu", spindump_histogram_quantile(histogram,99));
+      addtobuffer1(", \"Hist_right_rtt\": [");
+      int first = 1;
+      for (unsigned int i = 0; i < spindump_histogram_nbuckets; i++) {
+        if (histogram->buckets[i] == 0) continue;
+        addtobuffer3(first ? "%u,%u" : ",%u,%u", i, histogram->buckets[i]);
+        first = 0;
+      }
+      addtobuffer1("]");
+    }
     break;
     
   case spindump_event_type_spin_flip:
@@ -1140,7 +1527,7 @@ spindump_event_parser_json_print(const struct spindump_event* event,
     addtobuffer2(", \"Who\": \"%s\"",
                  event->u.ecnCongestionEvent.direction == spindump_direction_frominitiator ? "initiator" : "responder");  
     addtobuffer2(", \"Q_loss\": \"%s\"", event->u.qllossMeasurement.qLoss);
-    addtobuffer2(", \"R_loss\": \"%s\"", event->u.qllossMeasurement.lLoss);
+    addtobuffer2(", \"L_loss\": \"%s\"", event->u.qllossMeasurement.lLoss);
     break;
     
   case spindump_event_type_packet:
@@ -1211,7 +1598,8 @@ spindump_event_parser_json_converteventtype(const char* string,
   } else if (strcasecmp("spinflip",string) == 0) {
     *type = spindump_event_type_spin_flip;
     return(1);
-  } else if (strcasecmp("spin",string) == 0) {
+  } else if (strcasecmp("spinvalue",string) == 0 ||
+             strcasecmp("spin",string) == 0) {
     *type = spindump_event_type_spin_value;
     return(1);
   } else if (strcasecmp("measurement" ,string) == 0) {
@@ -53,6 +53,10 @@ spindump_event_parser_json_textparse(const char** jsonText,
                                      spindump_event_parser_json_callback callback,
                                      void* data);
 int
+spindump_event_parser_json_streamparse(const char** jsonText,
+                                       spindump_event_parser_json_callback callback,
+                                       void* data);
+int
 spindump_event_parser_json_parse(const struct spindump_json_value* json,
                                  struct spindump_event* event);
 int
@@ -142,6 +142,10 @@ spindump_event_parser_text_print(const struct spindump_event* event,
     if (event->u.newRttMeasurement.filtAvgRtt > 0) {
       addtobuffer2("filtavg %lu ", event->u.newRttMeasurement.filtAvgRtt);
     }
+    if (event->u.newRttMeasurement.smoothedRtt > 0) {
+      addtobuffer2("srtt %lu ", event->u.newRttMeasurement.smoothedRtt);
+      addtobuffer2("rttvar %lu ", event->u.newRttMeasurement.varRtt);
+    }
     break;
     
   case spindump_event_type_periodic:
@@ -152,6 +156,11 @@ spindump_event_parser_text_print(const struct spindump_event* event,
         addtobuffer2("dev %lu ", event->u.periodic.devRttRight);
       }
     }
+    if (event->u.periodic.histRight.count > 0) {
+      addtobuffer2("p50 %lu ", spindump_histogram_quantile(&event->u.periodic.histRight,50));
+      addtobuffer2("p90 %lu ", spindump_histogram_quantile(&event->u.periodic.histRight,90));
+      addtobuffer2("p99 %lu ", spindump_histogram_quantile(&event->u.periodic.histRight,99));
+    }
     break;
     
   case spindump_event_type_spin_flip:
@@ -22,6 +22,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include "spindump_util.h"
 #include "spindump_analyze.h"
 #include "spindump_connections.h"
@@ -29,6 +33,7 @@
 #include "spindump_eventformatter.h"
 #include "spindump_eventformatter_text.h"
 #include "spindump_eventformatter_json.h"
+#include "spindump_eventformatter_binary.h"
 #include "spindump_event.h"
 
 //
@@ -53,6 +58,16 @@ static const uint8_t*
 spindump_eventformatter_measurement_endaux(struct spindump_eventformatter* formatter,
                                            unsigned long* length);
 static void
+spindump_eventformatter_measurement_one_locked(struct spindump_analyze* state,
+                                               void* handlerData,
+                                               void** handlerConnectionData,
+                                               spindump_analyze_event event,
+                                               const struct timeval* timestamp,
+                                               const int fromResponder,
+                                               const unsigned int ipPacketLength,
+                                               struct spindump_packet* packet,
+                                               struct spindump_connection* connection);
+static void
 spindump_eventformatter_measurement_one(struct spindump_analyze* state,
                                         void* handlerData,
                                         void** handlerConnectionData,
@@ -78,6 +93,7 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
                                    int aggregatesOnly,
                                    int averageRtts,
                                    int minimumRtts,
+                                   int smoothedRtts,
                                    unsigned int filterExceptionalValuesPercentage);
 static const char*
 spindump_eventformatter_mediatype(enum spindump_eventformatter_outputformat format);
@@ -85,6 +101,18 @@ static void
 spindump_eventformatter_deliverdata_remoteblock(struct spindump_eventformatter* formatter,
                                                 unsigned long length,
                                                 const uint8_t* data);
+static void
+spindump_eventformatter_deliverdata_buffered(struct spindump_eventformatter* formatter,
+                                             unsigned long midLength,
+                                             const uint8_t* mid,
+                                             unsigned long length,
+                                             const uint8_t* data);
+static void
+spindump_eventformatter_writeout(struct spindump_eventformatter* formatter,
+                                 struct iovec* iov,
+                                 int iovcnt);
+static void
+spindump_eventformatter_flush_locked(struct spindump_eventformatter* formatter);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -106,6 +134,7 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
                                    int aggregatesOnly,
                                    int averageRtts,
                                    int minimumRtts,
+                                   int smoothedRtts,
                                    unsigned int filterExceptionalValuesPercentage) {
   
   //
@@ -126,9 +155,16 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
 
   spindump_deepdebugf("eventformatter_initialize pt. 2");
   memset(formatter,0,sizeof(*formatter));
-  formatter->analyzer = analyzer;
+  formatter->nAnalyzers = 0;
+  const pthread_mutex_t mutexEmpty = PTHREAD_MUTEX_INITIALIZER;
+  formatter->lock = mutexEmpty;
   formatter->format = format;
   formatter->file = 0;
+  formatter->fd = -1;
+  formatter->outBuffer = 0;
+  formatter->outBufferSize = 0;
+  formatter->bytesInOutBuffer = 0;
+  formatter->outputFailed = 0;
   formatter->nRemotes = 0;
   formatter->remotes = 0;
   formatter->blockSize = 0;
@@ -145,6 +181,7 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
   formatter->aggregatesOnly = aggregatesOnly;
   formatter->averageRtts = averageRtts;
   formatter->minimumRtts = minimumRtts;
+  formatter->smoothedRtts = smoothedRtts;
   spindump_deepdeepdebugf("spindump_eventformatter_initialize: averageRtts set to %u", formatter->averageRtts);
   formatter->filterExceptionalValuesPercentage = filterExceptionalValuesPercentage;
   spindump_deepdeepdebugf("filter filterExceptionalValuesPercentage = %u", formatter->filterExceptionalValuesPercentage);
@@ -154,11 +191,7 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
   //
 
   spindump_deepdeepdebugf("spindump_eventformatter_initialize registering a handler");
-  spindump_analyze_registerhandler(analyzer,
-                                   spindump_analyze_event_alllegal,
-                                   0,
-                                   spindump_eventformatter_measurement_one,
-                                   formatter);
+  spindump_eventformatter_addanalyzer(formatter,analyzer);
 
   //
   // Done. Return the object.
@@ -168,10 +201,20 @@ spindump_eventformatter_initialize(struct spindump_analyze* analyzer,
   return(formatter);
 }
 
+//
+// Create a formatter that writes events to a file. If bufferSize is
+// non-zero and the file is not a terminal, the events are collected
+// in a buffer of that size, and written out when the buffer fills
+// up, when spindump_eventformatter_periodicflush finds that enough
+// time has passed, or when the formatter is closed. Otherwise each
+// event is written out as soon as it has been formatted.
+//
+
 struct spindump_eventformatter*
 spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
                                         enum spindump_eventformatter_outputformat format,
                                         FILE* file,
+                                        unsigned long bufferSize,
                                         struct spindump_reverse_dns* querier,
                                         int reportSpins,
                                         int reportSpinFlips,
@@ -185,6 +228,7 @@ spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
                                         int aggregatesOnly,
                                         int averageRtts,
                                         int minimumRtts,
+                                        int smoothedRtts,
                                         unsigned int filterExceptionalValuesPercentage) {
   
   //
@@ -206,6 +250,7 @@ spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
                                                                                  aggregatesOnly,
                                                                                  averageRtts,
                                                                                  minimumRtts,
+                                                                                 smoothedRtts,
                                                                                  filterExceptionalValuesPercentage);
   if (formatter == 0) {
     return(0);
@@ -216,6 +261,18 @@ spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
   //
 
   formatter->file = file;
+  formatter->fd = fileno(file);
+  if (bufferSize > 0 && !isatty(formatter->fd)) {
+    formatter->outBuffer = (uint8_t*)spindump_malloc(bufferSize);
+    if (formatter->outBuffer == 0) {
+      spindump_warnf("cannot allocate an output buffer of %lu bytes, writing events one at a time",
+                     bufferSize);
+    } else {
+      formatter->outBufferSize = bufferSize;
+      formatter->bytesInOutBuffer = 0;
+      spindump_zerotime(&formatter->lastFlush);
+    }
+  }
   
   //
   // Start the format by adding whatever prefix is needed in the output stream
@@ -249,6 +306,7 @@ spindump_eventformatter_initialize_remote(struct spindump_analyze* analyzer,
                                           int aggregatesOnly,
                                           int averageRtts,
                                           int minimumRtts,
+                                          int smoothedRtts,
                                           unsigned int filterExceptionalValuesPercentage) {
   
   //
@@ -271,6 +329,7 @@ spindump_eventformatter_initialize_remote(struct spindump_analyze* analyzer,
                                                                                  aggregatesOnly,
                                                                                  averageRtts,
                                                                                  minimumRtts,
+                                                                                 smoothedRtts,
                                                                                  filterExceptionalValuesPercentage);
   if (formatter == 0) {
     return(0);
@@ -335,6 +394,32 @@ spindump_eventformatter_initialize_remote(struct spindump_analyze* analyzer,
   return(formatter);
 }
 
+//
+// Report the events of another analyzer through this formatter. This
+// is used when several worker threads, each with an analyzer of its
+// own, share the same output. Returns 1 upon success, 0 if there
+// are too many analyzers.
+//
+
+int
+spindump_eventformatter_addanalyzer(struct spindump_eventformatter* formatter,
+                                    struct spindump_analyze* analyzer) {
+  spindump_assert(formatter != 0);
+  spindump_assert(analyzer != 0);
+  if (formatter->nAnalyzers >= spindump_eventformatter_maxanalyzers) {
+    spindump_errorf("too many analyzers for the event formatter, can only support %u",
+                    spindump_eventformatter_maxanalyzers);
+    return(0);
+  }
+  formatter->analyzers[formatter->nAnalyzers++] = analyzer;
+  spindump_analyze_registerhandler(analyzer,
+                                   spindump_analyze_event_alllegal,
+                                   0,
+                                   spindump_eventformatter_measurement_one,
+                                   formatter);
+  return(1);
+}
+
 //
 // Close the formatter, and emit any final text that may be needed
 //
@@ -348,7 +433,7 @@ spindump_eventformatter_uninitialize(struct spindump_eventformatter* formatter)
   
   spindump_assert(formatter != 0);
   spindump_assert(formatter->file != 0 || formatter->nRemotes > 0);
-  spindump_assert(formatter->analyzer != 0);
+  spindump_assert(formatter->nAnalyzers > 0);
 
   //
   // Emit whatever post-amble is needed in the output
@@ -356,21 +441,28 @@ spindump_eventformatter_uninitialize(struct spindump_eventformatter* formatter)
   
   spindump_eventformatter_measurement_end(formatter);
   spindump_eventformatter_sendpooled(formatter);
+  spindump_eventformatter_flush(formatter);
   
   //
-  // Unregister whatever we registered as handlers in the analyzer
+  // Unregister whatever we registered as handlers in the analyzers
   //
   
-  spindump_analyze_unregisterhandler(formatter->analyzer,
-                                     spindump_analyze_event_alllegal,
-                                     0,
-                                     spindump_eventformatter_measurement_one,
-                                     formatter);
+  for (unsigned int i = 0; i < formatter->nAnalyzers; i++) {
+    spindump_analyze_unregisterhandler(formatter->analyzers[i],
+                                       spindump_analyze_event_alllegal,
+                                       0,
+                                       spindump_eventformatter_measurement_one,
+                                       formatter);
+  }
+  pthread_mutex_destroy(&formatter->lock);
   
   //
   // Free the memory
   //
   
+  if (formatter->outBuffer != 0) {
+    spindump_free(formatter->outBuffer);
+  }
   spindump_free(formatter);
 }
 
@@ -385,6 +477,8 @@ spindump_eventformatter_measurement_beginlength(struct spindump_eventformatter*
     return(spindump_eventformatter_measurement_beginlength_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_beginlength_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_beginlength_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return(0);
@@ -421,6 +515,8 @@ spindump_eventformatter_measurement_beginaux(struct spindump_eventformatter* for
     return(spindump_eventformatter_measurement_begin_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_begin_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_begin_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return((uint8_t*)"");
@@ -438,6 +534,8 @@ spindump_eventformatter_measurement_midlength(struct spindump_eventformatter* fo
     return(spindump_eventformatter_measurement_midlength_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_midlength_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_midlength_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return(0);
@@ -457,6 +555,8 @@ spindump_eventformatter_measurement_midaux(struct spindump_eventformatter* forma
     return(spindump_eventformatter_measurement_mid_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_mid_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_mid_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return((uint8_t*)"");
@@ -474,6 +574,8 @@ spindump_eventformatter_measurement_endlength(struct spindump_eventformatter* fo
     return(spindump_eventformatter_measurement_endlength_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_endlength_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_endlength_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return(0);
@@ -504,6 +606,8 @@ spindump_eventformatter_measurement_endaux(struct spindump_eventformatter* forma
     return(spindump_eventformatter_measurement_end_text(formatter));
   case spindump_eventformatter_outputformat_json:
     return(spindump_eventformatter_measurement_end_json(formatter));
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_measurement_end_binary(formatter));
   default:
     spindump_errorf("invalid output format in internal variable");
     return((uint8_t*)"");
@@ -525,6 +629,37 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
                                         const unsigned int ipPacketLength,
                                         struct spindump_packet* packet,
                                         struct spindump_connection* connection) {
+  spindump_assert(handlerData != 0);
+  struct spindump_eventformatter* formatter = (struct spindump_eventformatter*)handlerData;
+  pthread_mutex_lock(&formatter->lock);
+  spindump_eventformatter_measurement_one_locked(state,
+                                                 handlerData,
+                                                 handlerConnectionData,
+                                                 event,
+                                                 timestamp,
+                                                 fromResponder,
+                                                 ipPacketLength,
+                                                 packet,
+                                                 connection);
+  pthread_mutex_unlock(&formatter->lock);
+}
+
+//
+// The actual work of spindump_eventformatter_measurement_one, called
+// with the formatter lock held, as the analyzers of several worker
+// threads may be reporting events to the same formatter.
+//
+
+static void
+spindump_eventformatter_measurement_one_locked(struct spindump_analyze* state,
+                                               void* handlerData,
+                                               void** handlerConnectionData,
+                                               spindump_analyze_event event,
+                                               const struct timeval* timestamp,
+                                               const int fromResponder,
+                                               const unsigned int ipPacketLength,
+                                               struct spindump_packet* packet,
+                                               struct spindump_connection* connection) {
 
   //
   // Sanity checks
@@ -730,9 +865,13 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
 
   spindump_deepdeepdebugf("point 6");
   struct spindump_event eventobj;
+  spindump_compactnetwork compactInitiatorAddress;
+  spindump_compactnetwork compactResponderAddress;
   spindump_network initiatorAddress;
   spindump_network responderAddress;
-  spindump_connections_getnetworks(connection,&initiatorAddress,&responderAddress);
+  spindump_connections_getnetworks(connection,&compactInitiatorAddress,&compactResponderAddress);
+  spindump_compactnetwork_tonetwork(&compactInitiatorAddress,&initiatorAddress);
+  spindump_compactnetwork_tonetwork(&compactResponderAddress,&responderAddress);
   const char* notes = 0;
   char notesbuf[sizeof(eventobj.notes)];
   spindump_deepdeepdebugf("reportPackets and -Notes in eventformatter = %u %u", formatter->reportPackets, formatter->reportNotes);
@@ -765,6 +904,7 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
                             &connection->tags,
                             notes,
                             &eventobj);
+  struct spindump_connection_cold* cold = spindump_connections_peekcold(connection);
   switch (event) {
 
   case spindump_analyze_event_newconnection:
@@ -774,13 +914,14 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     break;
 
   case spindump_analyze_event_periodic:
-    eventobj.u.periodic.rttRight = connection->rightRTT.lastRTT;
+    eventobj.u.periodic.rttRight = cold->rightRTT.lastRTT;
     eventobj.u.periodic.avgRttRight = 0;
     eventobj.u.periodic.devRttRight = 0;
+    eventobj.u.periodic.histRight = cold->rightRTTPeriod;
     if (formatter->averageRtts) {
       unsigned long dev;
       unsigned long filtavg = 0;
-      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->rightRTT,
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->rightRTT,
                                                                  formatter->filterExceptionalValuesPercentage > 0,
                                                                  formatter->filterExceptionalValuesPercentage,
                                                                  &dev,
@@ -796,14 +937,14 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
   case spindump_analyze_event_newleftrttmeasurement:
     eventobj.u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
     eventobj.u.newRttMeasurement.direction = spindump_direction_frominitiator;
-    eventobj.u.newRttMeasurement.rtt = connection->leftRTT.lastRTT;
+    eventobj.u.newRttMeasurement.rtt = cold->leftRTT.lastRTT;
     eventobj.u.newRttMeasurement.avgRtt = 0;
     eventobj.u.newRttMeasurement.devRtt = 0;
     eventobj.u.newRttMeasurement.minRtt = 0;
     if (formatter->averageRtts) {
       unsigned long dev;
       unsigned long filtavg = 0;
-      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->leftRTT,
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->leftRTT,
                                                                  formatter->filterExceptionalValuesPercentage > 0,
                                                                  formatter->filterExceptionalValuesPercentage,
                                                                  &dev,
@@ -815,15 +956,23 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     }
     if (formatter->minimumRtts) {
 
-      eventobj.u.newRttMeasurement.minRtt = connection->leftRTT.minimumRTT;
+      eventobj.u.newRttMeasurement.minRtt = cold->leftRTT.minimumRTT;
 
     }
+    if (formatter->smoothedRtts) {
+      unsigned long var;
+      unsigned long srtt = spindump_rtt_smoothed(&cold->leftRTT,&var);
+      if (srtt != spindump_rtt_infinite) {
+        eventobj.u.newRttMeasurement.smoothedRtt = srtt;
+        eventobj.u.newRttMeasurement.varRtt = var;
+      }
+    }
     break;
     
   case spindump_analyze_event_newrightrttmeasurement:
     eventobj.u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
     eventobj.u.newRttMeasurement.direction = spindump_direction_fromresponder;
-    eventobj.u.newRttMeasurement.rtt = connection->rightRTT.lastRTT;
+    eventobj.u.newRttMeasurement.rtt = cold->rightRTT.lastRTT;
     eventobj.u.newRttMeasurement.avgRtt = 0;
     eventobj.u.newRttMeasurement.devRtt = 0;
     eventobj.u.newRttMeasurement.minRtt = 0;
@@ -831,7 +980,7 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     if (formatter->averageRtts) {
       unsigned long dev;
       unsigned long filtavg = 0;
-      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->rightRTT,
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->rightRTT,
                                                                  formatter->filterExceptionalValuesPercentage > 0,
                                                                  formatter->filterExceptionalValuesPercentage,
                                                                  &dev,
@@ -844,9 +993,17 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
 
     if (formatter->minimumRtts) {
 
-      eventobj.u.newRttMeasurement.minRtt = connection->rightRTT.minimumRTT;
+      eventobj.u.newRttMeasurement.minRtt = cold->rightRTT.minimumRTT;
 
   }
+    if (formatter->smoothedRtts) {
+      unsigned long var;
+      unsigned long srtt = spindump_rtt_smoothed(&cold->rightRTT,&var);
+      if (srtt != spindump_rtt_infinite) {
+        eventobj.u.newRttMeasurement.smoothedRtt = srtt;
+        eventobj.u.newRttMeasurement.varRtt = var;
+      }
+    }
     spindump_deepdeepdebugf("eventobj.avgRtt = %lu, averageRtts = %u",
                             eventobj.u.newRttMeasurement.avgRtt,
                             formatter->averageRtts);
@@ -855,7 +1012,7 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
   case spindump_analyze_event_newinitrespfullrttmeasurement:
     eventobj.u.newRttMeasurement.measurement = spindump_measurement_type_unidirectional;
     eventobj.u.newRttMeasurement.direction = spindump_direction_frominitiator;
-    eventobj.u.newRttMeasurement.rtt = connection->initToRespFullRTT.lastRTT;
+    eventobj.u.newRttMeasurement.rtt = cold->initToRespFullRTT.lastRTT;
     eventobj.u.newRttMeasurement.avgRtt = 0;
     eventobj.u.newRttMeasurement.devRtt = 0;
     eventobj.u.newRttMeasurement.minRtt = 0;
@@ -863,7 +1020,7 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     if (formatter->averageRtts) {
       unsigned long dev;
       unsigned long filtavg = 0;
-      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->initToRespFullRTT,
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->initToRespFullRTT,
                                                                  formatter->filterExceptionalValuesPercentage > 0,
                                                                  formatter->filterExceptionalValuesPercentage,
                                                                  &dev,
@@ -876,16 +1033,24 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
 
     if (formatter->minimumRtts) {
 
-      eventobj.u.newRttMeasurement.minRtt = connection->initToRespFullRTT.minimumRTT;
+      eventobj.u.newRttMeasurement.minRtt = cold->initToRespFullRTT.minimumRTT;
 
     }
+    if (formatter->smoothedRtts) {
+      unsigned long var;
+      unsigned long srtt = spindump_rtt_smoothed(&cold->initToRespFullRTT,&var);
+      if (srtt != spindump_rtt_infinite) {
+        eventobj.u.newRttMeasurement.smoothedRtt = srtt;
+        eventobj.u.newRttMeasurement.varRtt = var;
+      }
+    }
 
     break;
 
   case spindump_analyze_event_newrespinitfullrttmeasurement:
     eventobj.u.newRttMeasurement.measurement = spindump_measurement_type_unidirectional;
     eventobj.u.newRttMeasurement.direction = spindump_direction_fromresponder;
-    eventobj.u.newRttMeasurement.rtt = connection->respToInitFullRTT.lastRTT;
+    eventobj.u.newRttMeasurement.rtt = cold->respToInitFullRTT.lastRTT;
     eventobj.u.newRttMeasurement.avgRtt = 0;
     eventobj.u.newRttMeasurement.devRtt = 0;
     eventobj.u.newRttMeasurement.minRtt = 0;
@@ -893,7 +1058,7 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     if (formatter->averageRtts) {
       unsigned long dev;
       unsigned long filtavg = 0;
-      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&connection->respToInitFullRTT,
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&cold->respToInitFullRTT,
                                                                  formatter->filterExceptionalValuesPercentage > 0,
                                                                  formatter->filterExceptionalValuesPercentage,
                                                                  &dev,
@@ -905,33 +1070,41 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
     }
     if (formatter->minimumRtts) {
 
-      eventobj.u.newRttMeasurement.minRtt = connection->respToInitFullRTT.minimumRTT;
+      eventobj.u.newRttMeasurement.minRtt = cold->respToInitFullRTT.minimumRTT;
 
     }
+    if (formatter->smoothedRtts) {
+      unsigned long var;
+      unsigned long srtt = spindump_rtt_smoothed(&cold->respToInitFullRTT,&var);
+      if (srtt != spindump_rtt_infinite) {
+        eventobj.u.newRttMeasurement.smoothedRtt = srtt;
+        eventobj.u.newRttMeasurement.varRtt = var;
+      }
+    }
     break;
 
   case spindump_analyze_event_initiatorspinflip:
     spindump_assert(connection->type == spindump_connection_transport_quic);
     eventobj.u.spinFlip.direction = spindump_direction_frominitiator;
-    eventobj.u.spinFlip.spin0to1 = connection->u.quic.spinFromPeer1to2.lastSpin;
+    eventobj.u.spinFlip.spin0to1 = connection->cold->u.quic.spinFromPeer1to2.lastSpin;
     break;
 
   case spindump_analyze_event_responderspinflip:
     spindump_assert(connection->type == spindump_connection_transport_quic);
     eventobj.u.spinFlip.direction = spindump_direction_fromresponder;
-    eventobj.u.spinFlip.spin0to1 = connection->u.quic.spinFromPeer2to1.lastSpin;
+    eventobj.u.spinFlip.spin0to1 = connection->cold->u.quic.spinFromPeer2to1.lastSpin;
     break;
     
   case spindump_analyze_event_initiatorspinvalue:
     spindump_assert(connection->type == spindump_connection_transport_quic);
     eventobj.u.spinValue.direction = spindump_direction_frominitiator;
-    eventobj.u.spinValue.value = (uint8_t)connection->u.quic.spinFromPeer1to2.lastSpin;
+    eventobj.u.spinValue.value = (uint8_t)connection->cold->u.quic.spinFromPeer1to2.lastSpin;
     break;
 
   case spindump_analyze_event_responderspinvalue:
     spindump_assert(connection->type == spindump_connection_transport_quic);
     eventobj.u.spinValue.direction = spindump_direction_fromresponder;
-    eventobj.u.spinValue.value = (uint8_t)connection->u.quic.spinFromPeer2to1.lastSpin;
+    eventobj.u.spinValue.value = (uint8_t)connection->cold->u.quic.spinFromPeer2to1.lastSpin;
     break;
 
   case spindump_analyze_event_initiatorecnce:
@@ -959,18 +1132,18 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
 
   case spindump_analyze_event_initiatorqrlossmeasurement:
     eventobj.u.qrlossMeasurement.direction = spindump_direction_frominitiator;
-    sprintf(eventobj.u.qrlossMeasurement.avgLoss, "%.3f", connection->u.quic.qrLossesFrom1to2.averageLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.totLoss, "%.3f", connection->u.quic.qrLossesFrom1to2.totalLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.avgRefLoss, "%.3f", connection->u.quic.qrLossesFrom1to2.averageRefLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.totRefLoss, "%.3f", connection->u.quic.qrLossesFrom1to2.totalRefLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.avgLoss, "%.3f", connection->cold->u.quic.qrLossesFrom1to2.averageLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.totLoss, "%.3f", connection->cold->u.quic.qrLossesFrom1to2.totalLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.avgRefLoss, "%.3f", connection->cold->u.quic.qrLossesFrom1to2.averageRefLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.totRefLoss, "%.3f", connection->cold->u.quic.qrLossesFrom1to2.totalRefLossRate * 100);
     break;
 
   case spindump_analyze_event_responderqrlossmeasurement:
     eventobj.u.qrlossMeasurement.direction = spindump_direction_fromresponder;
-    sprintf(eventobj.u.qrlossMeasurement.avgLoss, "%.3f", connection->u.quic.qrLossesFrom2to1.averageLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.totLoss, "%.3f", connection->u.quic.qrLossesFrom2to1.totalLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.avgRefLoss, "%.3f", connection->u.quic.qrLossesFrom2to1.averageRefLossRate * 100);
-    sprintf(eventobj.u.qrlossMeasurement.totRefLoss, "%.3f", connection->u.quic.qrLossesFrom2to1.totalRefLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.avgLoss, "%.3f", connection->cold->u.quic.qrLossesFrom2to1.averageLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.totLoss, "%.3f", connection->cold->u.quic.qrLossesFrom2to1.totalLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.avgRefLoss, "%.3f", connection->cold->u.quic.qrLossesFrom2to1.averageRefLossRate * 100);
+    sprintf(eventobj.u.qrlossMeasurement.totRefLoss, "%.3f", connection->cold->u.quic.qrLossesFrom2to1.totalRefLossRate * 100);
     break;
 
   case spindump_analyze_event_initiatorqllossmeasurement:
@@ -1007,6 +1180,9 @@ spindump_eventformatter_measurement_one(struct spindump_analyze* state,
   case spindump_eventformatter_outputformat_json:
     spindump_eventformatter_measurement_one_json(formatter,event,&eventobj,connection);
     break;
+  case spindump_eventformatter_outputformat_binary:
+    spindump_eventformatter_measurement_one_binary(formatter,event,&eventobj,connection);
+    break;
   default:
     spindump_errorf("invalid output format in internal variable");
     exit(1);
@@ -1024,6 +1200,8 @@ spindump_eventformatter_mediatype(enum spindump_eventformatter_outputformat form
     return("application/text");
   case spindump_eventformatter_outputformat_json:
     return("application/json");
+  case spindump_eventformatter_outputformat_binary:
+    return(spindump_eventformatter_binarymediatype);
   default:
     spindump_errorf("invalid format");
     return("application/text");
@@ -1037,6 +1215,7 @@ spindump_eventformatter_mediatype(enum spindump_eventformatter_outputformat form
 void
 spindump_eventformatter_sendpooled(struct spindump_eventformatter* formatter) {
   spindump_assert(formatter != 0);
+  pthread_mutex_lock(&formatter->lock);
   if (formatter->bytesInBlock > formatter->preambleLength) {
     spindump_deepdebugf("sendpooled bytes %lu", formatter->bytesInBlock);
     unsigned long postambleLength;
@@ -1049,6 +1228,7 @@ spindump_eventformatter_sendpooled(struct spindump_eventformatter* formatter) {
     formatter->bytesInBlock = 0;
     spindump_eventformatter_measurement_begin(formatter);
   }
+  pthread_mutex_unlock(&formatter->lock);
 }
 
 //
@@ -1071,23 +1251,28 @@ spindump_eventformatter_deliverdata(struct spindump_eventformatter* formatter,
 
     spindump_deepdebugf("deliverdata midamble check length %lu postambleLength %lu entries %u",
                         length, formatter->postambleLength, formatter->nEntries);
+    size_t midlength = 0;
+    const uint8_t* mid = 0;
     if (length > spindump_eventformatter_maxamble) {
       if (formatter->nEntries > 0) {
-        size_t midlength;
-        const uint8_t* mid = spindump_eventformatter_measurement_midaux(formatter,&midlength);
-        fwrite(mid,midlength,1,formatter->file);
+        mid = spindump_eventformatter_measurement_midaux(formatter,&midlength);
         spindump_deepdebugf("adding the midamble %s", mid);
       }
       formatter->nEntries++;
     }
 
     //
-    // Write the actual entry out. We're just outputting data to
-    // stdout; print it out
+    // Write the actual entry out, either to the output buffer, or if
+    // there is none, directly to the file
     //
     
-    fwrite(data,length,1,formatter->file);
-    fflush(formatter->file);
+    if (formatter->outBuffer != 0) {
+      spindump_eventformatter_deliverdata_buffered(formatter,midlength,mid,length,data);
+    } else {
+      if (mid != 0) fwrite(mid,midlength,1,formatter->file);
+      fwrite(data,length,1,formatter->file);
+      fflush(formatter->file);
+    }
     
   } else if (formatter->nRemotes > 0) {
     
@@ -1197,3 +1382,135 @@ spindump_eventformatter_deliverdata_remoteblock(struct spindump_eventformatter*
     spindump_remote_client_update_event(client,mediaType,length,data);
   }
 }
+
+//
+// Add an entry, preceded by the midamble if mid is non-zero, to the
+// output buffer. If the entry does not fit, the buffer and the entry
+// are written out together, with one writev call.
+//
+
+static void
+spindump_eventformatter_deliverdata_buffered(struct spindump_eventformatter* formatter,
+                                             unsigned long midLength,
+                                             const uint8_t* mid,
+                                             unsigned long length,
+                                             const uint8_t* data) {
+  if (formatter->bytesInOutBuffer + midLength + length <= formatter->outBufferSize) {
+    if (mid != 0) {
+      memcpy(formatter->outBuffer + formatter->bytesInOutBuffer,mid,midLength);
+      formatter->bytesInOutBuffer += midLength;
+    }
+    memcpy(formatter->outBuffer + formatter->bytesInOutBuffer,data,length);
+    formatter->bytesInOutBuffer += length;
+  } else {
+    struct iovec iov[3];
+    int iovcnt = 0;
+    iov[iovcnt].iov_base = formatter->outBuffer;
+    iov[iovcnt++].iov_len = formatter->bytesInOutBuffer;
+    if (mid != 0) {
+      iov[iovcnt].iov_base = (void*)mid;
+      iov[iovcnt++].iov_len = midLength;
+    }
+    iov[iovcnt].iov_base = (void*)data;
+    iov[iovcnt++].iov_len = length;
+    spindump_eventformatter_writeout(formatter,iov,iovcnt);
+    formatter->bytesInOutBuffer = 0;
+  }
+}
+
+//
+// Write the given pieces of data to the file descriptor, continuing
+// after partial writes and interrupted calls. If the write fails
+// (e.g., the reader of a pipe has gone away), an error is reported
+// once and further output is discarded.
+//
+
+static void
+spindump_eventformatter_writeout(struct spindump_eventformatter* formatter,
+                                 struct iovec* iov,
+                                 int iovcnt) {
+  
+  //
+  // Anything written through the FILE interface needs to go out first
+  //
+  
+  fflush(formatter->file);
+  
+  while (iovcnt > 0 && !formatter->outputFailed) {
+    if (iov->iov_len == 0) {
+      iov++;
+      iovcnt--;
+      continue;
+    }
+    ssize_t written = writev(formatter->fd,iov,iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      spindump_errorf("cannot write events to the output: %s", strerror(errno));
+      formatter->outputFailed = 1;
+      return;
+    }
+    size_t left = (size_t)written;
+    while (iovcnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+}
+
+//
+// Write out whatever is in the output buffer. The caller must hold
+// the formatter's lock.
+//
+
+static void
+spindump_eventformatter_flush_locked(struct spindump_eventformatter* formatter) {
+  if (formatter->bytesInOutBuffer > 0) {
+    spindump_deepdebugf("flushing %lu bytes of output", formatter->bytesInOutBuffer);
+    struct iovec iov;
+    iov.iov_base = formatter->outBuffer;
+    iov.iov_len = formatter->bytesInOutBuffer;
+    spindump_eventformatter_writeout(formatter,&iov,1);
+    formatter->bytesInOutBuffer = 0;
+  }
+}
+
+//
+// Write out whatever is in the output buffer
+//
+
+void
+spindump_eventformatter_flush(struct spindump_eventformatter* formatter) {
+  spindump_assert(formatter != 0);
+  if (formatter->outBuffer == 0) return;
+  pthread_mutex_lock(&formatter->lock);
+  spindump_eventformatter_flush_locked(formatter);
+  pthread_mutex_unlock(&formatter->lock);
+}
+
+//
+// Called from the main loop. If the output is buffered and it has
+// been spindump_eventformatter_flushinterval since the buffer was
+// last written out, write it out now, so that a reader of the output
+// does not wait for events for long.
+//
+
+void
+spindump_eventformatter_periodicflush(struct spindump_eventformatter* formatter,
+                                      const struct timeval* now) {
+  spindump_assert(formatter != 0);
+  spindump_assert(now != 0);
+  if (formatter->outBuffer == 0) return;
+  if (spindump_iszerotime(&formatter->lastFlush) ||
+      spindump_isearliertime(&formatter->lastFlush,now)) {
+    formatter->lastFlush = *now;
+    return;
+  }
+  if (spindump_timediffinusecs(now,&formatter->lastFlush) < spindump_eventformatter_flushinterval) return;
+  formatter->lastFlush = *now;
+  spindump_eventformatter_flush(formatter);
+}
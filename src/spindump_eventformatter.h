@@ -24,6 +24,7 @@
 //
 
 #include <stdio.h>
+#include <pthread.h>
 #include "spindump_util.h"
 
 //
@@ -32,7 +33,8 @@
 
 enum spindump_eventformatter_outputformat {
   spindump_eventformatter_outputformat_text,
-  spindump_eventformatter_outputformat_json
+  spindump_eventformatter_outputformat_json,
+  spindump_eventformatter_outputformat_binary
 };
 
 #define spindump_eventformatter_maxpreamble  5
@@ -46,6 +48,11 @@ enum spindump_eventformatter_outputformat {
 // Parameters ---------------------------------------------------------------------------------
 //
 
+#define spindump_eventformatter_maxanalyzers        64
+#define spindump_eventformatter_defaultbuffersize   (64 * 1024)
+#define spindump_eventformatter_flushinterval       (1000 * 1000) // usecs
+#define spindump_eventformatter_binarymediatype     "application/x-spindump-binary"
+
 //
 // Data structures ----------------------------------------------------------------------------
 //
@@ -56,6 +63,14 @@ struct spindump_remote_client;
 
 struct spindump_eventformatter {
   FILE* file;
+  int fd;               // descriptor of the file, for buffered output
+  uint8_t padding0[4];  // unused padding to align the next field properly
+  uint8_t* outBuffer;   // buffered output to the file, or 0 if written line at a time
+  unsigned long outBufferSize;
+  unsigned long bytesInOutBuffer;
+  struct timeval lastFlush;
+  int outputFailed;
+  uint8_t padding3[4];  // unused padding to align the next field properly
   unsigned long blockSize;
   uint8_t padding1[4]; // unused padding to align the size of the structure correctly
   unsigned int nEntries;
@@ -63,7 +78,10 @@ struct spindump_eventformatter {
   struct spindump_remote_client** remotes;
   uint8_t* block;
   unsigned long bytesInBlock;
-  struct spindump_analyze* analyzer;
+  unsigned int nAnalyzers;
+  uint8_t padding2[4]; // unused padding to align the next field properly
+  struct spindump_analyze* analyzers[spindump_eventformatter_maxanalyzers];
+  pthread_mutex_t lock; // held while formatting an event or sending a block
   struct spindump_reverse_dns* querier;
   int reportSpins;
   int reportSpinFlips;
@@ -77,6 +95,7 @@ struct spindump_eventformatter {
   int aggregatesOnly;
   int averageRtts;
   int minimumRtts;
+  int smoothedRtts;
   unsigned int filterExceptionalValuesPercentage;
   enum spindump_eventformatter_outputformat format;
   size_t preambleLength;
@@ -91,6 +110,7 @@ struct spindump_eventformatter*
 spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
                                         enum spindump_eventformatter_outputformat format,
                                         FILE* file,
+                                        unsigned long bufferSize,
                                         struct spindump_reverse_dns* querier,
                                         int reportSpins,
                                         int reportSpinFlips,
@@ -104,6 +124,7 @@ spindump_eventformatter_initialize_file(struct spindump_analyze* analyzer,
                                         int aggregatesOnly,
                                         int averageRtts,
                                         int minimumRtts,
+                                        int smoothedRtts,
                                         unsigned int filterExceptionalValuesPercentage);
 struct spindump_eventformatter*
 spindump_eventformatter_initialize_remote(struct spindump_analyze* analyzer,
@@ -124,10 +145,19 @@ spindump_eventformatter_initialize_remote(struct spindump_analyze* analyzer,
                                           int aggregatesOnly,
                                           int averageRtts,
                                           int minimumRtts,
+                                          int smoothedRtts,
                                           unsigned int filterExceptionalValuesPercentage);
+int
+spindump_eventformatter_addanalyzer(struct spindump_eventformatter* formatter,
+                                    struct spindump_analyze* analyzer);
 void
 spindump_eventformatter_sendpooled(struct spindump_eventformatter* formatter);
 void
+spindump_eventformatter_flush(struct spindump_eventformatter* formatter);
+void
+spindump_eventformatter_periodicflush(struct spindump_eventformatter* formatter,
+                                      const struct timeval* now);
+void
 spindump_eventformatter_uninitialize(struct spindump_eventformatter* formatter);
 
 //
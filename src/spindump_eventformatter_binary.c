@@ -0,0 +1,116 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2019 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+// 
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_eventformatter.h"
+#include "spindump_eventformatter_binary.h"
+#include "spindump_event.h"
+#include "spindump_event_parser_binary.h"
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Return the length of the preamble
+//
+
+unsigned long
+spindump_eventformatter_measurement_beginlength_binary(struct spindump_eventformatter* formatter) {
+  return(spindump_event_parser_binary_headerlength);
+}
+
+//
+// Print what is needed as a preface to the actual records, the
+// binary stream header
+//
+
+const uint8_t*
+spindump_eventformatter_measurement_begin_binary(struct spindump_eventformatter* formatter) {
+  return(spindump_event_parser_binary_header());
+}
+
+//
+// Return the length of the midamble. Binary records are
+// length-prefixed, and need nothing between them.
+//
+
+unsigned long
+spindump_eventformatter_measurement_midlength_binary(struct spindump_eventformatter* formatter) {
+  return(0);
+}
+
+//
+// Print what is needed between records
+//
+
+const uint8_t*
+spindump_eventformatter_measurement_mid_binary(struct spindump_eventformatter* formatter) {
+  return((uint8_t*)"");
+}
+
+//
+// Return the length of the postamble
+//
+
+unsigned long
+spindump_eventformatter_measurement_endlength_binary(struct spindump_eventformatter* formatter) {
+  return(0);
+}
+
+//
+// Print what is needed as an end after the actual records
+//
+
+const uint8_t*
+spindump_eventformatter_measurement_end_binary(struct spindump_eventformatter* formatter) {
+  return((uint8_t*)"");
+}
+
+//
+// Print out one --textual measurement event, when the format is set
+// to --format binary
+//
+
+void
+spindump_eventformatter_measurement_one_binary(struct spindump_eventformatter* formatter,
+                                               spindump_analyze_event event,
+                                               const struct spindump_event* eventobj,
+                                               struct spindump_connection* connection) {
+  
+  uint8_t buf[spindump_event_parser_binary_maxlength];
+  size_t consumed;
+  if (!spindump_event_parser_binary_print(eventobj,buf,sizeof(buf),&consumed)) {
+    spindump_errorf("cannot encode a binary event");
+    return;
+  }
+    
+  //
+  // Print the buffer out
+  //
+  
+  spindump_eventformatter_deliverdata(formatter,consumed,buf);
+  
+}
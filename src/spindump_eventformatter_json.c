@@ -98,7 +98,7 @@ spindump_eventformatter_measurement_one_json(struct spindump_eventformatter* for
                                              const struct spindump_event* eventobj,
                                              struct spindump_connection* connection) {
   
-  char buf[400];
+  char buf[2048];
   size_t consumed;
   spindump_event_parser_json_print(eventobj,buf,sizeof(buf)-1,&consumed);
   spindump_assert(consumed < sizeof(buf));
@@ -0,0 +1,148 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+// 
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include "spindump_util.h"
+#include "spindump_histogram.h"
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize a histogram to have no values
+//
+
+void
+spindump_histogram_initialize(struct spindump_histogram* histogram) {
+  spindump_assert(histogram != 0);
+  memset(histogram,0,sizeof(*histogram));
+}
+
+//
+// Find the bucket for a value. Small values have a bucket of their
+// own. For larger ones, the position of the highest bit set selects
+// the power of two, and the bits below it the sub-bucket.
+//
+
+unsigned int
+spindump_histogram_bucket(unsigned long value) {
+  if (value < spindump_histogram_subbuckets) return((unsigned int)value);
+  if (value >= (1UL << spindump_histogram_maxbits)) return(spindump_histogram_nbuckets - 1);
+  unsigned int power = (unsigned int)(63 - __builtin_clzll((unsigned long long)value));
+  unsigned int shift = power - spindump_histogram_subbits;
+  unsigned int sub = (unsigned int)(value >> shift) & (spindump_histogram_subbuckets - 1);
+  return((shift + 1) * spindump_histogram_subbuckets + sub);
+}
+
+//
+// Return the smallest value that goes to a given bucket
+//
+
+unsigned long
+spindump_histogram_bucketlow(unsigned int bucket) {
+  spindump_assert(bucket < spindump_histogram_nbuckets);
+  if (bucket < spindump_histogram_subbuckets) return(bucket);
+  unsigned int shift = bucket / spindump_histogram_subbuckets - 1;
+  unsigned long sub = bucket % spindump_histogram_subbuckets;
+  return((spindump_histogram_subbuckets + sub) << shift);
+}
+
+//
+// Return the value that represents the values in a given bucket,
+// i.e., the middle of the bucket. For the last bucket, whose values
+// have no upper limit, this is the lowest value of the bucket.
+//
+
+unsigned long
+spindump_histogram_bucketvalue(unsigned int bucket) {
+  spindump_assert(bucket < spindump_histogram_nbuckets);
+  unsigned long low = spindump_histogram_bucketlow(bucket);
+  if (bucket < spindump_histogram_subbuckets || bucket == spindump_histogram_nbuckets - 1) return(low);
+  unsigned int shift = bucket / spindump_histogram_subbuckets - 1;
+  return(low + ((1UL << shift) - 1) / 2);
+}
+
+//
+// Record a value in the histogram
+//
+
+void
+spindump_histogram_record(struct spindump_histogram* histogram,
+                          unsigned long value) {
+  spindump_assert(histogram != 0);
+  histogram->buckets[spindump_histogram_bucket(value)]++;
+  histogram->count++;
+}
+
+//
+// Add the values of one histogram to another. This is used to
+// combine the histograms of connections or Spindump instances.
+//
+
+void
+spindump_histogram_merge(struct spindump_histogram* target,
+                         const struct spindump_histogram* source) {
+  spindump_assert(target != 0);
+  spindump_assert(source != 0);
+  if (source->count == 0) return;
+  for (unsigned int i = 0; i < spindump_histogram_nbuckets; i++) {
+    target->buckets[i] += source->buckets[i];
+  }
+  target->count += source->count;
+}
+
+//
+// Return the value below which the given percentage of the recorded
+// values are, e.g., the median for 50. The value is the middle of
+// the bucket the value at that rank is in. Returns 0 if the
+// histogram is empty.
+//
+
+unsigned long
+spindump_histogram_quantile(const struct spindump_histogram* histogram,
+                            unsigned int percentage) {
+  spindump_assert(histogram != 0);
+  spindump_assert(percentage <= 100);
+  if (histogram->count == 0) return(0);
+  unsigned long long rank = ((unsigned long long)histogram->count * percentage + 99) / 100;
+  if (rank == 0) rank = 1;
+  unsigned long long seen = 0;
+  for (unsigned int i = 0; i < spindump_histogram_nbuckets; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) return(spindump_histogram_bucketvalue(i));
+  }
+  return(spindump_histogram_bucketvalue(spindump_histogram_nbuckets - 1));
+}
+
+//
+// Are two histograms the same?
+//
+
+int
+spindump_histogram_equal(const struct spindump_histogram* histogram1,
+                         const struct spindump_histogram* histogram2) {
+  spindump_assert(histogram1 != 0);
+  spindump_assert(histogram2 != 0);
+  return(histogram1->count == histogram2->count &&
+         memcmp(histogram1->buckets,histogram2->buckets,sizeof(histogram1->buckets)) == 0);
+}
@@ -0,0 +1,81 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+// 
+
+#ifndef SPINDUMP_HISTOGRAM_H
+#define SPINDUMP_HISTOGRAM_H
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdint.h>
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+//
+// The histogram buckets are logarithmic, with each power of two
+// divided into 2^spindump_histogram_subbits linear sub-buckets, in
+// the style of HDR histograms. With two bits, a bucket is at most 25%
+// wide relative to its values. Values from 2^spindump_histogram_maxbits
+// upwards (about 67 seconds, when the values are RTTs in
+// microseconds) all go to the last bucket.
+//
+
+#define spindump_histogram_subbits                          2
+#define spindump_histogram_subbuckets    (1 << spindump_histogram_subbits)
+#define spindump_histogram_maxbits                         26
+#define spindump_histogram_nbuckets      (spindump_histogram_subbuckets *                       \
+                                          (spindump_histogram_maxbits - spindump_histogram_subbits + 1))
+
+//
+// Data structures ----------------------------------------------------------------------------
+//
+
+struct spindump_histogram {
+  uint32_t count;                                       // total number of values recorded
+  uint32_t buckets[spindump_histogram_nbuckets];        // number of values per bucket
+};
+
+//
+// External API interface to this module ------------------------------------------------------
+//
+
+void
+spindump_histogram_initialize(struct spindump_histogram* histogram);
+void
+spindump_histogram_record(struct spindump_histogram* histogram,
+                          unsigned long value);
+void
+spindump_histogram_merge(struct spindump_histogram* target,
+                         const struct spindump_histogram* source);
+unsigned long
+spindump_histogram_quantile(const struct spindump_histogram* histogram,
+                            unsigned int percentage);
+unsigned int
+spindump_histogram_bucket(unsigned long value);
+unsigned long
+spindump_histogram_bucketlow(unsigned int bucket);
+unsigned long
+spindump_histogram_bucketvalue(unsigned int bucket);
+int
+spindump_histogram_equal(const struct spindump_histogram* histogram1,
+                         const struct spindump_histogram* histogram2);
+
+#endif // SPINDUMP_HISTOGRAM_H
@@ -22,6 +22,7 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "spindump_util.h"
 #include "spindump_json.h"
 #include "spindump_json_value.h"
@@ -30,8 +31,9 @@
 // Parameters ---------------------------------------------------------------------------------
 //
 
-#define maxSchemaFields 20
+#define maxSchemaFields 30
 #define maxOtherFields 20
+#define maxScanFieldName 40
 
 //
 // Function prototypes ------------------------------------------------------------------------
@@ -39,6 +41,8 @@
 
 static void
 spindump_json_parse_seekcurrentchar(const char** input);
+static const char*
+spindump_json_parse_findclosingquote(const char* input);
 static struct spindump_json_value*
 spindump_json_parse_integer(const char* upperFieldName,
                             const char** input);
@@ -101,6 +105,62 @@ spindump_json_parse_record_aux_addtofields(char* fieldName,
                                            unsigned int* nFields,
                                            unsigned int maxNFields,
                                            struct spindump_json_value_field* fields);
+static int
+spindump_json_scan_aux(const struct spindump_json_schema* schema,
+                       int fieldIndex,
+                       const char* upperFieldName,
+                       spindump_json_scan_callback callback,
+                       void* data,
+                       const char** input);
+static int
+spindump_json_scan_report(enum spindump_json_scan_itemtype type,
+                          const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          unsigned long long integer,
+                          const char* string,
+                          size_t length,
+                          spindump_json_scan_callback callback,
+                          void* data);
+static int
+spindump_json_scan_integer(const struct spindump_json_schema* schema,
+                           int fieldIndex,
+                           const char* upperFieldName,
+                           spindump_json_scan_callback callback,
+                           void* data,
+                           const char** input);
+static int
+spindump_json_scan_string(const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          const char* upperFieldName,
+                          spindump_json_scan_callback callback,
+                          void* data,
+                          const char** input);
+static int
+spindump_json_scan_array(const struct spindump_json_schema* schema,
+                         int fieldIndex,
+                         const char* upperFieldName,
+                         spindump_json_scan_callback callback,
+                         void* data,
+                         const char** input);
+static int
+spindump_json_scan_record(const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          const char* upperFieldName,
+                          spindump_json_scan_callback callback,
+                          void* data,
+                          const char** input);
+static int
+spindump_json_scan_record_aux_findfield(const struct spindump_json_schema* schema,
+                                        const char* fieldName,
+                                        size_t length,
+                                        unsigned int* hint);
+static int
+spindump_json_scan_any(const struct spindump_json_schema* schema,
+                       int fieldIndex,
+                       const char* upperFieldName,
+                       spindump_json_scan_callback callback,
+                       void* data,
+                       const char** input);
 
 //
 // Macros -------------------------------------------------------------------------------------
@@ -328,7 +388,7 @@ spindump_json_parse_string(const char* upperFieldName,
     return(0);
   }
   spindump_json_parse_movetonextchar(input);
-  char* closing = index(*input,'\"');
+  const char* closing = spindump_json_parse_findclosingquote(*input);
   if (closing == 0) {
     spindump_errorf("cannot parse JSON string: missing closing quote in field %s",
                     upperFieldName);
@@ -482,7 +542,7 @@ spindump_json_parse_record_aux_field_name(const char** input) {
     return(0);
   }
   spindump_json_parse_movetonextchar(input);
-  char* closing = index(*input,'\"');
+  const char* closing = spindump_json_parse_findclosingquote(*input);
   if (closing == 0) {
     spindump_errorf("cannot parse JSON record field name: missing closing quote");
     return(0);
@@ -940,6 +1000,490 @@ spindump_json_parse_any(const struct spindump_json_schema* schema,
   }
 }
 
+//
+// Scan a given input as JSON of a given type, without building JSON
+// value objects. Instead of the callbacks in the schema, the given
+// callback is called for every integer and string value found and at
+// the start and end of every record, with an item that tells where in
+// the schema the value belongs. Fields that are not in the schema are
+// checked for syntax, but not reported. No memory is allocated, and
+// string values are reported as pointers to the input text.
+//
+// As with spindump_json_parse, the input text pointer moves further
+// as the input is read, and only a single JSON object is read at one
+// time. Unlike with spindump_json_parse, items are reported as soon
+// as they have been read, before the enclosing object is known to be
+// valid.
+//
+// The callback may return 0 to stop the scan, in which case the scan
+// fails. This function returns 1 upon successful parsing, and 0 upon
+// failure.
+//
+
+int
+spindump_json_scan(const struct spindump_json_schema* schema,
+                   spindump_json_scan_callback callback,
+                   void* data,
+                   const char** input) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(schema != 0);
+  spindump_assert(callback != 0);
+  spindump_assert(input != 0);
+  spindump_assert(*input != 0);
+
+  //
+  // Call the auxiliary function that does the actual work
+  //
+
+  return(spindump_json_scan_aux(schema,-1,"top",callback,data,input));
+}
+
+//
+// The internal scanning function, scanning a JSON value per given
+// schema from input given as a string in *input. This function
+// advances the input pointer as it consumes the input. The callback
+// may be 0, in which case the value is only checked, not reported.
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_aux(const struct spindump_json_schema* schema,
+                       int fieldIndex,
+                       const char* upperFieldName,
+                       spindump_json_scan_callback callback,
+                       void* data,
+                       const char** input) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(schema != 0);
+  spindump_assert(upperFieldName != 0);
+  spindump_assert(input != 0);
+  spindump_assert(*input != 0);
+
+  //
+  // Branch based on what schema expects
+  //
+
+  switch (schema->type) {
+
+  case spindump_json_schema_type_integer:
+    return(spindump_json_scan_integer(schema,fieldIndex,upperFieldName,callback,data,input));
+
+  case spindump_json_schema_type_string:
+    return(spindump_json_scan_string(schema,fieldIndex,upperFieldName,callback,data,input));
+
+  case spindump_json_schema_type_literal:
+    spindump_json_parse_seekcurrentchar(input);
+    if (isdigit(**input)) {
+      return(spindump_json_scan_integer(schema,fieldIndex,upperFieldName,callback,data,input));
+    } else {
+      return(spindump_json_scan_string(schema,fieldIndex,upperFieldName,callback,data,input));
+    }
+
+  case spindump_json_schema_type_record:
+    return(spindump_json_scan_record(schema,fieldIndex,upperFieldName,callback,data,input));
+
+  case spindump_json_schema_type_array:
+    return(spindump_json_scan_array(schema,fieldIndex,upperFieldName,callback,data,input));
+
+  case spindump_json_schema_type_recordorarray:
+    spindump_json_parse_seekcurrentchar(input);
+    if (**input == '[') {
+      return(spindump_json_scan_array(schema->u.arrayorrecord.array,fieldIndex,upperFieldName,callback,data,input));
+    } else {
+      return(spindump_json_scan_record(schema->u.arrayorrecord.record,fieldIndex,upperFieldName,callback,data,input));
+    }
+
+  case spindump_json_schema_type_any:
+    return(spindump_json_scan_any(schema,fieldIndex,upperFieldName,callback,data,input));
+
+  default:
+    spindump_errorf("invalid JSON schema type %u for field %s",
+                    schema->type,
+                    upperFieldName);
+    return(0);
+  }
+}
+
+//
+// Report an item to the callback of a scan, if there is a
+// callback. Return what the callback returns, or 1 if there is no
+// callback.
+//
+
+static int
+spindump_json_scan_report(enum spindump_json_scan_itemtype type,
+                          const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          unsigned long long integer,
+                          const char* string,
+                          size_t length,
+                          spindump_json_scan_callback callback,
+                          void* data) {
+  if (callback == 0) return(1);
+  struct spindump_json_scan_item item;
+  item.type = type;
+  item.fieldIndex = fieldIndex;
+  item.schema = schema;
+  item.integer = integer;
+  item.string = string;
+  item.length = length;
+  return((*callback)(&item,data));
+}
+
+//
+// Scan a JSON integer value. The value is accumulated directly, and
+// values that do not fit in an unsigned long long are rejected.
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_integer(const struct spindump_json_schema* schema,
+                           int fieldIndex,
+                           const char* upperFieldName,
+                           spindump_json_scan_callback callback,
+                           void* data,
+                           const char** input) {
+  spindump_json_parse_seekcurrentchar(input);
+  if (!isdigit(**input)) {
+    spindump_errorf("expected a JSON integer for field %s",
+                    upperFieldName);
+    return(0);
+  }
+  unsigned long long value = 0;
+  while (isdigit(**input)) {
+    unsigned int digit = (unsigned int)(**input - '0');
+    if (value > (ULLONG_MAX - digit) / 10) {
+      spindump_errorf("JSON integer number is too large in field %s",
+                      upperFieldName);
+      return(0);
+    }
+    value = value * 10 + digit;
+    spindump_json_parse_movetonextchar(input);
+  }
+  return(spindump_json_scan_report(spindump_json_scan_itemtype_integer,schema,fieldIndex,
+                                   value,0,0,
+                                   callback,data));
+}
+
+//
+// Scan a JSON string value. The reported string points to the input.
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_string(const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          const char* upperFieldName,
+                          spindump_json_scan_callback callback,
+                          void* data,
+                          const char** input) {
+  spindump_json_parse_seekcurrentchar(input);
+  if (**input != '\"') {
+    spindump_errorf("cannot parse JSON string: missing opening quote in field %s",
+                    upperFieldName);
+    return(0);
+  }
+  spindump_json_parse_movetonextchar(input);
+  const char* closing = spindump_json_parse_findclosingquote(*input);
+  if (closing == 0) {
+    spindump_errorf("cannot parse JSON string: missing closing quote in field %s",
+                    upperFieldName);
+    return(0);
+  }
+  const char* string = *input;
+  size_t length = (size_t)(closing - string);
+  *input = closing+1;
+  return(spindump_json_scan_report(spindump_json_scan_itemtype_string,schema,fieldIndex,
+                                   0,string,length,
+                                   callback,data));
+}
+
+//
+// Scan a JSON array value. The elements are reported with the field
+// index of the array itself.
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_array(const struct spindump_json_schema* schema,
+                         int fieldIndex,
+                         const char* upperFieldName,
+                         spindump_json_scan_callback callback,
+                         void* data,
+                         const char** input) {
+  spindump_assert(schema != 0);
+  spindump_assert(schema->type == spindump_json_schema_type_array);
+  spindump_json_parse_seekcurrentchar(input);
+  if (**input != '[') {
+    spindump_errorf("cannot parse JSON array: missing opening bracket in field %s",
+                    upperFieldName);
+    return(0);
+  }
+  spindump_json_parse_movetonextchar(input);
+  spindump_json_parse_seekcurrentchar(input);
+  while (**input != ']') {
+    if (**input == 0) {
+      spindump_errorf("cannot parse JSON array: missing closing bracket in field %s",
+                      upperFieldName);
+      return(0);
+    }
+    if (!spindump_json_scan_aux(schema->u.array.schema,fieldIndex,"array",callback,data,input)) {
+      return(0);
+    }
+    spindump_json_parse_seekcurrentchar(input);
+    if (**input == ',') {
+      spindump_json_parse_movetonextchar(input);
+      spindump_json_parse_seekcurrentchar(input);
+      if (**input == ']') {
+        spindump_errorf("cannot parse JSON array: closing bracket after comma in field %s",
+                        upperFieldName);
+        return(0);
+      }
+    } else if (**input != ']') {
+      spindump_errorf("cannot parse JSON array: syntax error after element in field %s",
+                      upperFieldName);
+      return(0);
+    }
+  }
+  spindump_json_parse_movetonextchar(input);
+  return(1);
+}
+
+//
+// Look for a field in a schema description of a record, by a name
+// that is not zero-terminated. The search starts from the field
+// after the one found previously, as fields usually appear in schema
+// order. Return the index of the field if found, or -1 otherwise.
+//
+
+static int
+spindump_json_scan_record_aux_findfield(const struct spindump_json_schema* schema,
+                                        const char* fieldName,
+                                        size_t length,
+                                        unsigned int* hint) {
+  spindump_assert(schema != 0);
+  spindump_assert(schema->type == spindump_json_schema_type_record);
+  spindump_assert(fieldName != 0);
+  spindump_assert(hint != 0);
+  unsigned int nFields = schema->u.record.nFields;
+  for (unsigned int i = 0; i < nFields; i++) {
+    unsigned int index = (*hint + i) % nFields;
+    const char* name = schema->u.record.fields[index].name;
+    if (strncmp(name,fieldName,length) == 0 && name[length] == 0) {
+      *hint = index + 1;
+      return((int)index);
+    }
+  }
+  return(-1);
+}
+
+//
+// Scan a JSON record value {...} per given schema. The start and end
+// of the record are reported with the field index of the record
+// itself, and the fields inside it with their index in the schema.
+// The record is checked to have all the mandatory fields.
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_record(const struct spindump_json_schema* schema,
+                          int fieldIndex,
+                          const char* upperFieldName,
+                          spindump_json_scan_callback callback,
+                          void* data,
+                          const char** input) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(schema != 0);
+  spindump_assert(schema->type == spindump_json_schema_type_record);
+  spindump_assert(schema->u.record.nFields <= 64);
+  spindump_assert(input != 0);
+  spindump_assert(*input != 0);
+
+  //
+  // Parse the opening brace
+  //
+
+  spindump_json_parse_seekcurrentchar(input);
+  if (**input != '{') {
+    spindump_errorf("cannot parse JSON record: missing opening brace in field %s",
+                    upperFieldName);
+    return(0);
+  }
+  spindump_json_parse_movetonextchar(input);
+  spindump_json_parse_seekcurrentchar(input);
+  if (!spindump_json_scan_report(spindump_json_scan_itemtype_recordstart,schema,fieldIndex,
+                                 0,0,0,
+                                 callback,data)) {
+    return(0);
+  }
+
+  //
+  // Loop while there are fields and we haven't hit the closing brace
+  // yet. Remember which schema fields have been seen.
+  //
+
+  uint64_t seen = 0;
+  unsigned int hint = 0;
+  struct spindump_json_schema any;
+  any.type = spindump_json_schema_type_any;
+  any.callback = 0;
+
+  while (**input != '}') {
+
+    if (**input == 0) {
+      spindump_errorf("cannot parse JSON record: missing closing brace in field %s",
+                      upperFieldName);
+      return(0);
+    }
+
+    //
+    // Parse the field name
+    //
+
+    if (**input != '\"') {
+      spindump_errorf("cannot parse JSON record field name: missing opening quote");
+      return(0);
+    }
+    spindump_json_parse_movetonextchar(input);
+    const char* closing = spindump_json_parse_findclosingquote(*input);
+    if (closing == 0) {
+      spindump_errorf("cannot parse JSON record field name: missing closing quote");
+      return(0);
+    }
+    const char* name = *input;
+    size_t length = (size_t)(closing - name);
+    *input = closing+1;
+    if (length == 0) {
+      spindump_errorf("cannot parse JSON record: field name cannot be empty string");
+      return(0);
+    }
+    char fieldName[maxScanFieldName+1];
+    size_t copyLength = length < maxScanFieldName ? length : maxScanFieldName;
+    memcpy(fieldName,name,copyLength);
+    fieldName[copyLength] = 0;
+
+    //
+    // Skip the colon
+    //
+
+    spindump_json_parse_seekcurrentchar(input);
+    if (**input != ':') {
+      spindump_errorf("cannot parse JSON record: missing colon after field name");
+      return(0);
+    }
+    spindump_json_parse_movetonextchar(input);
+
+    //
+    // Scan the value, reporting it only if the field is in the schema
+    //
+
+    int index = spindump_json_scan_record_aux_findfield(schema,name,length,&hint);
+    int ans;
+    if (index >= 0) {
+      seen |= (1ULL << index);
+      ans = spindump_json_scan_aux(schema->u.record.fields[index].schema,index,fieldName,callback,data,input);
+    } else {
+      ans = spindump_json_scan_aux(&any,-1,fieldName,0,data,input);
+    }
+    if (!ans) return(0);
+
+    //
+    // Move to the next field
+    //
+
+    spindump_json_parse_seekcurrentchar(input);
+    if (**input == ',') {
+      spindump_json_parse_movetonextchar(input);
+      spindump_json_parse_seekcurrentchar(input);
+      if (**input == '}') {
+        spindump_errorf("cannot parse JSON record: closing brace after comma in field %s",
+                        upperFieldName);
+        return(0);
+      }
+    } else if (**input != '}') {
+      spindump_errorf("cannot parse JSON record: syntax error on char %c after field in field %s",
+                      **input,
+                      upperFieldName);
+      return(0);
+    }
+  }
+  spindump_json_parse_movetonextchar(input);
+
+  //
+  // Check that no mandatory fields are missing
+  //
+
+  for (unsigned int q = 0; q < schema->u.record.nFields; q++) {
+    const struct spindump_json_schema_field* schemaField = &schema->u.record.fields[q];
+    if (schemaField->required && (seen & (1ULL << q)) == 0) {
+      spindump_errorf("field %s is missing from the JSON record", schemaField->name);
+      return(0);
+    }
+  }
+
+  //
+  // Done
+  //
+
+  return(spindump_json_scan_report(spindump_json_scan_itemtype_recordend,schema,fieldIndex,
+                                   0,0,0,
+                                   callback,data));
+}
+
+//
+// Scan either a record or array or a literal, depending on what
+// first character tells us it is ("[", "{", "\"", or "0" to "9").
+//
+// Return 1 upon success, and 0 upon failure.
+//
+
+static int
+spindump_json_scan_any(const struct spindump_json_schema* schema,
+                       int fieldIndex,
+                       const char* upperFieldName,
+                       spindump_json_scan_callback callback,
+                       void* data,
+                       const char** input) {
+  spindump_assert(schema != 0);
+  spindump_assert(schema->type == spindump_json_schema_type_any);
+  spindump_json_parse_seekcurrentchar(input);
+  if (isdigit(**input)) {
+    return(spindump_json_scan_integer(schema,fieldIndex,upperFieldName,callback,data,input));
+  } else if (**input == '\"') {
+    return(spindump_json_scan_string(schema,fieldIndex,upperFieldName,callback,data,input));
+  } else if (**input == '[') {
+    struct spindump_json_schema array;
+    struct spindump_json_schema any = *schema;
+    array.type = spindump_json_schema_type_array;
+    array.callback = 0;
+    array.u.array.schema = &any;
+    return(spindump_json_scan_array(&array,fieldIndex,upperFieldName,callback,data,input));
+  } else {
+    struct spindump_json_schema record;
+    record.type = spindump_json_schema_type_record;
+    record.callback = 0;
+    record.u.record.nFields = 0;
+    return(spindump_json_scan_record(&record,fieldIndex,upperFieldName,callback,data,input));
+  }
+}
+
 //
 // Seek forward in the input (the textual input is in *input, this
 // function will move the pointer forward as needed e.g. to skip
@@ -952,3 +1496,26 @@ spindump_json_parse_seekcurrentchar(const char** input) {
     spindump_json_parse_movetonextchar(input);
   }
 }
+
+//
+// Find the quote that closes a string, given the input just after
+// the opening quote. The character after a backslash is part of the
+// string, so escaped quotes do not close it. The escapes themselves
+// are left in the string value for the caller to decode.
+//
+// Returns a pointer to the closing quote, or 0 if there is none.
+//
+
+static const char*
+spindump_json_parse_findclosingquote(const char* input) {
+  while (*input != 0) {
+    if (*input == '\\') {
+      input++;
+      if (*input == 0) return(0);
+    } else if (*input == '\"') {
+      return(input);
+    }
+    input++;
+  }
+  return(0);
+}
@@ -30,7 +30,7 @@
 // Parameters ---------------------------------------------------------------------------------
 //
 
-#define spindump_json_maxfields 46
+#define spindump_json_maxfields 64
 
 //
 // Data types ---------------------------------------------------------------------------------
@@ -43,6 +43,18 @@ typedef void (*spindump_json_callback)(const struct spindump_json_value* value,
                                        const struct spindump_json_schema* type,
                                        void* data);
 
+enum spindump_json_scan_itemtype {
+  spindump_json_scan_itemtype_recordstart = 0,
+  spindump_json_scan_itemtype_recordend = 1,
+  spindump_json_scan_itemtype_integer = 2,
+  spindump_json_scan_itemtype_string = 3
+};
+
+struct spindump_json_scan_item;
+
+typedef int (*spindump_json_scan_callback)(const struct spindump_json_scan_item* item,
+                                           void* data);
+
 enum spindump_json_schema_type {
   spindump_json_schema_type_integer = 0,
   spindump_json_schema_type_string = 1,
@@ -87,6 +99,23 @@ struct spindump_json_schema {
   } u;
 };
 
+//
+// An item reported by spindump_json_scan. Strings point to the input
+// text and are not zero-terminated; they stay valid only as long as
+// the input does. The field index refers to the schema of the
+// innermost record that the item is in, and array elements are
+// reported with the index of the field holding the array.
+//
+
+struct spindump_json_scan_item {
+  enum spindump_json_scan_itemtype type;
+  int fieldIndex;                                     // index in the record schema, or -1
+  const struct spindump_json_schema* schema;          // schema of the item itself
+  unsigned long long integer;                         // value, for integers
+  const char* string;                                 // value, for strings
+  size_t length;                                      // string length
+};
+
 //
 // External API interface to this module ------------------------------------------------------
 //
@@ -95,5 +124,10 @@ int
 spindump_json_parse(const struct spindump_json_schema* schema,
                     void* data,
                     const char** input);
+int
+spindump_json_scan(const struct spindump_json_schema* schema,
+                   spindump_json_scan_callback callback,
+                   void* data,
+                   const char** input);
 
 #endif // SPINDUMP_JSON_H
@@ -36,7 +36,9 @@
 #include "spindump_report.h"
 #include "spindump_remote_client.h"
 #include "spindump_remote_server.h"
+#include "spindump_remote_file.h"
 #include "spindump_eventformatter.h"
+#include "spindump_pipeline.h"
 #include "spindump_main.h"
 #include "spindump_main_lib.h"
 #include "spindump_bandwidth.h"
@@ -123,6 +125,9 @@ spindump_main_uninitialize(struct spindump_main_state* state) {
     spindump_free(state->config.filter);
   }
   spindump_tags_uninitialize(&state->config.defaultTags);
+  for (unsigned int i = 0; i < state->config.nRemotes; i++) {
+    if (state->config.remotes[i] != 0) spindump_remote_client_close(state->config.remotes[i]);
+  }
   
   //
   // Reset contents, just in case
@@ -150,9 +155,14 @@ spindump_main_configuration_defaultvalues(struct spindump_main_configuration* co
   config->jsonInputFile = 0;
   config->filter = 0;
   config->snaplen = spindump_capture_snaplen;
+  config->captureBackend = spindump_capture_backend_pcap;
+  config->fanoutGroup = 0;
   config->toolmode = spindump_toolmode_visual;
   config->format = spindump_eventformatter_outputformat_text;
+  config->outputFd = -1;
+  config->outputBufferSize = spindump_eventformatter_defaultbuffersize;
   config->maxReceive = 0;
+  config->threads = 1;
   config->showRelativeTime = 0;
   config->showStats = 0;
   config->reverseDns = 0;
@@ -164,17 +174,24 @@ spindump_main_configuration_defaultvalues(struct spindump_main_configuration* co
   config->reportPackets = 0;
   config->reportNotes = 1;
   config->reportMinimumRtt = 0;
+  config->reportSmoothedRtt = 0;
   config->anonymizeLeft = 0;
   config->anonymizeRight = 0;
   config->filterExceptionalValuesPercentage = 0; // no filtering of RTT values
   config->updatePeriod = 500 * 1000; // 0.5s
   config->bandwidthMeasurementPeriod = spindump_bandwidth_period_default;
   config->periodicReportPeriod = 0; // not enabled, values in seconds
+  config->deferredAggregates = 0; // aggregates updated on every packet
+  config->adoptMidstream = 0; // mid-stream TCP flows are not tracked
+  config->halfOpenEntries = 0; // a full connection is created for every SYN
   config->nAggregates = 0;
   config->remoteBlockSize = 16 * 1024;
+  config->remoteQueueSize = spindump_remote_client_defaultqueuesize;
+  config->remoteBlockWhenFull = 0;
   config->nRemotes = 0;
   config->collector = 0;
   config->collectorPort = SPINDUMP_PORT_NUMBER;
+  config->collectorThreads = SPINDUMP_REMOTE_SERVER_DEFAULTTHREADS;
   spindump_tags_initialize(&config->defaultTags);
 }
 
@@ -264,6 +281,14 @@ spindump_main_processargs(int argc,
 
       config->aggregateMode = 0;
 
+    } else if (strcmp(argv[0],"--deferred-aggregates") == 0) {
+
+      config->deferredAggregates = 1;
+
+    } else if (strcmp(argv[0],"--no-deferred-aggregates") == 0) {
+
+      config->deferredAggregates = 0;
+
     } else if (strcmp(argv[0],"--names") == 0) {
 
       config->reverseDns = 1;
@@ -332,6 +357,10 @@ spindump_main_processargs(int argc,
 
       config->reportMinimumRtt = 1;
 
+    } else if (strcmp(argv[0],"--report-smoothed-rtt") == 0) {
+
+      config->reportSmoothedRtt = 1;
+
     } else if (strcmp(argv[0],"--anonymize") == 0) {
 
       config->anonymizeLeft = 1;
@@ -429,6 +458,46 @@ spindump_main_processargs(int argc,
       config->format = spindump_main_parseformat(argv[1]);
       argc--; argv++;
 
+    } else if (strcmp(argv[0],"--output-fd") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1]))) {
+        spindump_errorf("expected a numeric argument for --output-fd, got %s", argv[1]);
+        exit(1);
+      }
+      config->outputFd = atoi(argv[1]);
+      argc--; argv++;
+
+    } else if (strcmp(argv[0],"--output-buffer") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1]))) {
+        spindump_errorf("expected a numeric argument for --output-buffer, got %s", argv[1]);
+        exit(1);
+      }
+      config->outputBufferSize = 1024 * (unsigned long)atoi(argv[1]);
+      argc--; argv++;
+
+    } else if (strcmp(argv[0],"--capture") == 0 && argc > 1) {
+
+      if (strcmp(argv[1],"pcap") == 0) {
+        config->captureBackend = spindump_capture_backend_pcap;
+      } else if (strcmp(argv[1],"afpacket") == 0) {
+        config->captureBackend = spindump_capture_backend_afpacket;
+      } else {
+        spindump_errorf("expected pcap or afpacket for --capture, got %s", argv[1]);
+        exit(1);
+      }
+      argc--; argv++;
+
+    } else if (strcmp(argv[0],"--fanout") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1])) || atoi(argv[1]) <= 0 || atoi(argv[1]) > 65535) {
+        spindump_errorf("expected a number between 1 and 65535 for --fanout, got %s", argv[1]);
+        exit(1);
+      }
+      config->fanoutGroup = (unsigned int)atoi(argv[1]);
+      config->captureBackend = spindump_capture_backend_afpacket;
+      argc--; argv++;
+
     } else if (strcmp(argv[0],"--input-file") == 0 && argc > 1) {
 
       config->inputFile = argv[1];
@@ -471,6 +540,21 @@ spindump_main_processargs(int argc,
       config->collectorPort = (spindump_port)input;
       argc--; argv++;
       
+    } else if (strcmp(argv[0],"--collector-threads") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1]))) {
+        spindump_errorf("expected a numeric argument for --collector-threads, got %s", argv[1]);
+        exit(1);
+      }
+      int input = atoi(argv[1]);
+      if (input < 1 || input > SPINDUMP_REMOTE_SERVER_MAXTHREADS) {
+        spindump_errorf("expected argument for --collector-threads to be between 1 and %u, got %s",
+                        SPINDUMP_REMOTE_SERVER_MAXTHREADS, argv[1]);
+        exit(1);
+      }
+      config->collectorThreads = (unsigned int)input;
+      argc--; argv++;
+      
     } else if (strcmp(argv[0],"--remote-block-size") == 0 && argc > 1) {
 
       if (!isdigit(*(argv[1]))) {
@@ -480,6 +564,27 @@ spindump_main_processargs(int argc,
       config->remoteBlockSize = 1024 * (unsigned long)atoi(argv[1]);
       argc--; argv++;
       
+    } else if (strcmp(argv[0],"--remote-queue") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1])) || atoi(argv[1]) <= 0) {
+        spindump_errorf("expected a positive numeric argument for --remote-queue, got %s", argv[1]);
+        exit(1);
+      }
+      config->remoteQueueSize = (unsigned int)atoi(argv[1]);
+      argc--; argv++;
+      
+    } else if (strcmp(argv[0],"--remote-queue-full") == 0 && argc > 1) {
+
+      if (strcmp(argv[1],"drop") == 0) {
+        config->remoteBlockWhenFull = 0;
+      } else if (strcmp(argv[1],"block") == 0) {
+        config->remoteBlockWhenFull = 1;
+      } else {
+        spindump_errorf("expected drop or block for --remote-queue-full, got %s", argv[1]);
+        exit(1);
+      }
+      argc--; argv++;
+      
     } else if (strcmp(argv[0],"--max-receive") == 0 && argc > 1) {
 
       if (!isdigit(*(argv[1]))) {
@@ -489,6 +594,21 @@ spindump_main_processargs(int argc,
       config->maxReceive = (unsigned int)atoi(argv[1]);
       argc--; argv++;
       
+    } else if (strcmp(argv[0],"--threads") == 0 && argc > 1) {
+
+      if (!isdigit(*(argv[1]))) {
+        spindump_errorf("expected a numeric argument for --threads, got %s", argv[1]);
+        exit(1);
+      }
+      int input = atoi(argv[1]);
+      if (input < 1 || input > spindump_pipeline_maxthreads) {
+        spindump_errorf("expected argument for --threads to be between 1 and %u, got %s",
+                        spindump_pipeline_maxthreads, argv[1]);
+        exit(1);
+      }
+      config->threads = (unsigned int)input;
+      argc--; argv++;
+      
     } else if (strcmp(argv[0],"--bandwidth-period") == 0 && argc > 1) {
 
       if (!isdigit(argv[1][0])) {
@@ -525,6 +645,42 @@ spindump_main_processargs(int argc,
       
       argc--; argv++;
       
+    } else if (strcmp(argv[0],"--adopt-midstream") == 0 && argc > 1) {
+
+      if (!isdigit(argv[1][0])) {
+        spindump_errorf("the --adopt-midstream argument needs to be numeric");
+        exit(1);
+      }
+
+      int arg = atoi(argv[1]);
+      
+      if (arg < 0 || arg > 0xFFFF) {
+        spindump_errorf("the --adopt-midstream argument needs to be between 0 and %u", 0xFFFF);
+        exit(1);
+      }
+      
+      config->adoptMidstream = (unsigned int)arg;
+      
+      argc--; argv++;
+      
+    } else if (strcmp(argv[0],"--half-open") == 0 && argc > 1) {
+
+      if (!isdigit(argv[1][0])) {
+        spindump_errorf("the --half-open argument needs to be numeric");
+        exit(1);
+      }
+
+      int arg = atoi(argv[1]);
+      
+      if (arg < 0 || arg > spindump_main_maxhalfopen) {
+        spindump_errorf("the --half-open argument needs to be between 0 and %u", spindump_main_maxhalfopen);
+        exit(1);
+      }
+      
+      config->halfOpenEntries = (unsigned int)arg;
+      
+      argc--; argv++;
+      
     } else if (strcmp(argv[0],"--aggregate") == 0 && argc > 1) {
 
       //
@@ -763,6 +919,19 @@ spindump_main_processargs(int argc,
 
   }
 
+  //
+  // The worker threads are only used when reading packets, and the
+  // visual mode reads the connection tables from the main thread
+  //
+
+  if (config->threads > 1 &&
+      (config->toolmode == spindump_toolmode_visual ||
+       config->jsonInputFile != 0 ||
+       config->collector)) {
+    spindump_errorf("--threads can not be used with the visual mode, --json-input-file, or --collector");
+    exit(1);
+  }
+
   //
   // Sort all networks of aggregates of 'multinet' type and ensure
   // there are no ovelapping networks.
@@ -836,8 +1005,10 @@ spindump_main_parseformat(const char* string) {
     return(spindump_eventformatter_outputformat_text);
   } else if (strcmp(string,"json") == 0) {
     return(spindump_eventformatter_outputformat_json);
+  } else if (strcmp(string,"binary") == 0) {
+    return(spindump_eventformatter_outputformat_binary);
   } else {
-    spindump_errorf("invalid output format (%s) specified, expected text or json", string);
+    spindump_errorf("invalid output format (%s) specified, expected text, json, or binary", string);
     return(spindump_eventformatter_outputformat_text);
   }
 }
@@ -939,6 +1110,8 @@ spindump_main_help(void) {
   printf("    --silent                Sets the tool to be either silent, list RTT measurements\n");
   printf("    --textual               as they occur, or have a continuously updating visual\n");
   printf("    --visual                interface. The visual interface is the default.\n");
+  printf("    --format f              Set the format of the events in --textual mode, or sent with\n");
+  printf("                            --remote, to text (the default), json, or binary.\n");
   printf("\n");
   printf("    --names                 Use DNS names or addresses in the output. (The default is\n");
   printf("    --addresses             using names.)\n");
@@ -962,6 +1135,13 @@ spindump_main_help(void) {
   printf("    --report-notes          Report additional textual notes in events (default is not).\n");
   printf("    --not-report-notes      Do not report additional textual notes.\n");
   printf("\n");
+  printf("    --output-fd n           Write the events in --textual mode to the already open file\n");
+  printf("                            descriptor n (such as a pipe), instead of the standard output.\n");
+  printf("    --output-buffer n       Collect up to n kilobytes of events before writing them out. The\n");
+  printf("                            default is %u; 0 writes each event out as it occurs, which is\n",
+         spindump_eventformatter_defaultbuffersize / 1024);
+  printf("                            also done when the output is a terminal.\n");
+  printf("\n");
   printf("    --anonymize             Anonymization control.\n");
   printf("    --not-anonymize\n");
   printf("    --anonymize-left\n");
@@ -971,8 +1151,12 @@ spindump_main_help(void) {
   printf("\n");
   printf("    --average-mode          Display (or report in output or HTTP-delivered update) average\n");
   printf("    --no-average-mode       values instead of specific instantaneous values. Default is not.\n");
+  printf("    --report-smoothed-rtt   Report also the smoothed RTT and its variation, as in TCP\n");
+  printf("                            (RFC 6298), with each RTT measurement. Default is not.\n");
   printf("    --aggregate-mode        Display (or report) aggregates only, not individal connections.\n");
   printf("    --no-aggregate-mode     Default is to report individual connections.\n");
+  printf("    --deferred-aggregates   Update aggregates in batches rather than on every packet. RTT\n");
+  printf("    --no-deferred-aggregates events of aggregates are then also reported in batches. Default is not.\n");
   printf("\n");
   printf("    --filter-exceptional-values n\n");
   printf("                            Filter exceptional RTT values beyond given %% of standard deviation.\n");
@@ -989,6 +1173,9 @@ spindump_main_help(void) {
   printf("\n");
   printf("    --max-receive n         Sets a limit of how many packets the tool accepts.\n");
   printf("\n");
+  printf("    --threads n             Analyze packets in n worker threads, each tracking its own share of\n");
+  printf("                            the connections. The default is 1. Only for textual and silent modes.\n");
+  printf("\n");
   printf("    --bandwidth-period n    Sets the length of bandwidth measurement period, in\n");
   printf("                            microseconds. The default is %llu or %.2f.\n",
          (unsigned long long)spindump_bandwidth_period_default,
@@ -996,16 +1183,37 @@ spindump_main_help(void) {
   printf("    --report-only-periodically n\n");
   printf("                            Make only periodic reports every n seconds. The default is 0,\n");
    printf("                            which disables the periodic mode.\n");
+  printf("    --adopt-midstream n     Start tracking a TCP connection whose beginning was not seen after\n");
+  printf("                            n packets. The default is 0, which never tracks such connections.\n");
+  printf("    --half-open n           Keep up to n TCP connections that have only sent a SYN in a compact\n");
+  printf("                            table, until the other side answers. The default is 0, which creates\n");
+  printf("                            a full connection for every SYN.\n");
   printf("\n");
   printf("    --interface i           Set the interface to listen on, or the capture\n");
   printf("    --snaplen n             How many bytes of the packet is captured (default is %u)\n", spindump_capture_snaplen);
+  printf("    --capture b             Capture packets from the interface with PCAP (b is pcap, the default),\n");
+  printf("                            or from a shared memory ring of an AF_PACKET socket (b is afpacket,\n");
+  printf("                            only on Linux).\n");
+  printf("    --fanout g              Share the interface's packets with other AF_PACKET captures in fanout\n");
+  printf("                            group g, each capture seeing a part of the flows. Implies --capture\n");
+  printf("                            afpacket.\n");
   printf("    --input-file f          Give a PCAP file to read from.\n");
   printf("    --json-input-file f     Give a JSON file (produced by Spindump) to read from.\n");
+  if (*spindump_remote_file_compressions() != 0) {
+    printf("                            Files compressed with %s can also be read.\n",
+           spindump_remote_file_compressions());
+  }
   printf("    --remote u              Send connections information to spindump running elsewhere, at URL u\n");
   printf("    --remote-block-size n   When sending information, collect as much as n bytes of information\n");
   printf("                            in each batch\n");
+  printf("    --remote-queue n        Queue at most n batches per remote while they are being sent in the\n");
+  printf("                            background. The default is %u.\n", spindump_remote_client_defaultqueuesize);
+  printf("    --remote-queue-full p   When the queue is full, either drop new batches (p is drop, the\n");
+  printf("                            default) or wait for space (p is block)\n");
   printf("    --collector-port p      Use the port p for listening for other spindump instances sending this\n");
   printf("                            instance information\n");
+  printf("    --collector-threads n   Receive and parse information from other spindump instances in n\n");
+  printf("                            threads. The default is %u.\n", SPINDUMP_REMOTE_SERVER_DEFAULTTHREADS);
   printf("    --collector             Listen for other spindump instances for information.\n");
   printf("    --no-collector          Do not listen.\n");
   printf("  \n");
@@ -33,6 +33,7 @@
 
 #define spindump_main_maxnaggregates    50
 #define spindump_main_maxnaggrnetws 100000
+#define spindump_main_maxhalfopen   (16*1024*1024)
 
 //
 // Data types ---------------------------------------------------------------------------------
@@ -79,9 +80,14 @@ struct spindump_main_configuration {
   const char* jsonInputFile;
   char* filter;
   unsigned int snaplen;
+  enum spindump_capture_backend captureBackend;
+  unsigned int fanoutGroup;
   enum spindump_toolmode toolmode;
   enum spindump_eventformatter_outputformat format;
+  int outputFd;
+  unsigned long outputBufferSize;
   unsigned int maxReceive;
+  unsigned int threads;
   int showRelativeTime;
   int showStats;
   int reverseDns;
@@ -93,23 +99,30 @@ struct spindump_main_configuration {
   int reportQlLoss;
   int reportNotes;
   int reportMinimumRtt;
+  int reportSmoothedRtt;
   int averageMode;
   int aggregateMode;
+  int deferredAggregates;
   int anonymizeLeft;
   int anonymizeRight;
   unsigned int filterExceptionalValuesPercentage;
   unsigned long long updatePeriod;
   unsigned long long bandwidthMeasurementPeriod;
   unsigned int periodicReportPeriod;
+  unsigned int adoptMidstream;
+  unsigned int halfOpenEntries;
   unsigned int nAggregates;
   struct spindump_main_aggregate aggregates[spindump_main_maxnaggregates];
   unsigned int nAggrnetws;
   struct spindump_main_aggrnetw aggrnetws[spindump_main_maxnaggrnetws];
   unsigned long remoteBlockSize;
+  unsigned int remoteQueueSize;
+  int remoteBlockWhenFull;
   unsigned int nRemotes;
   struct spindump_remote_client* remotes[SPINDUMP_REMOTE_CLIENT_MAX_CONNECTIONS];
   int collector;
   spindump_port collectorPort;
+  unsigned int collectorThreads;
   spindump_tags defaultTags;
 };
 
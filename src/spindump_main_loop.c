@@ -26,6 +26,7 @@
 #include <signal.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "spindump_util.h"
@@ -36,10 +37,17 @@
 #include "spindump_remote_server.h"
 #include "spindump_remote_file.h"
 #include "spindump_eventformatter.h"
+#include "spindump_pipeline.h"
 #include "spindump_main.h"
 #include "spindump_main_lib.h"
 #include "spindump_main_loop.h"
 
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_main_loop_batchsize 64 // packets, at most spindump_capture_maxbatch and spindump_analyze_maxbatch
+
 //
 // Function prototypes ------------------------------------------------------------------------
 //
@@ -50,6 +58,8 @@ spindump_main_loop_initialize_aggregates(struct spindump_main_configuration* con
 static void
 spindump_main_loop_packetloop(struct spindump_main_state* state,
                               struct spindump_analyze* analyzer,
+                              struct spindump_pipeline* pipeline,
+                              struct spindump_stats* captureStats,
                               struct spindump_capture_state* capturer,
                               struct spindump_report_state* reporter,
                               struct spindump_eventformatter* formatter,
@@ -105,6 +115,28 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
                                                                   &config->defaultTags);
   if (analyzer == 0) exit(1);
 
+  //
+  // If running multiple worker threads, each needs an analyzer of its
+  // own. The first one is the analyzer created above.
+  //
+
+  struct spindump_analyze* analyzers[spindump_pipeline_maxthreads];
+  spindump_assert(config->threads >= 1 && config->threads <= spindump_pipeline_maxthreads);
+  analyzers[0] = analyzer;
+  for (unsigned int i = 1; i < config->threads; i++) {
+    analyzers[i] = spindump_analyze_initialize(config->showRelativeTime,
+                                               config->filterExceptionalValuesPercentage,
+                                               config->bandwidthMeasurementPeriod,
+                                               config->periodicReportPeriod,
+                                               &config->defaultTags);
+    if (analyzers[i] == 0) exit(1);
+  }
+  for (unsigned int i = 0; i < config->threads; i++) {
+    analyzers[i]->table->rollup.deferred = config->deferredAggregates;
+    analyzers[i]->table->negative.adoptAfter = config->adoptMidstream;
+    analyzers[i]->table->halfOpen.maxEntries = config->halfOpenEntries;
+  }
+
   //
   // Initialize the capture interface
   //
@@ -118,6 +150,11 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
     capturer = spindump_capture_initialize_null();
   } else if (config->collector) {
     capturer = spindump_capture_initialize_null();
+  } else if (config->captureBackend == spindump_capture_backend_afpacket) {
+    capturer = spindump_capture_initialize_afpacket(config->interface,
+                                                    config->filter,
+                                                    config->snaplen,
+                                                    config->fanoutGroup);
   } else {
     capturer = spindump_capture_initialize_live(config->interface,config->filter,config->snaplen);
   }
@@ -188,7 +225,7 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
   spindump_deepdeepdebugf("main loop operation, server init");
   struct spindump_remote_server* server = 0;
   if (config->collector) {
-    server = spindump_remote_server_init(config->collectorPort);
+    server = spindump_remote_server_init(config->collectorPort,config->collectorThreads);
     if (server == 0) {
       exit(1);
     }
@@ -229,10 +266,19 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
   spindump_deepdeepdebugf("main loop, entering eventformatter initialization");
   struct spindump_eventformatter* formatter = 0;
   struct spindump_eventformatter* remoteFormatter = 0;
+  FILE* output = stdout;
   if (config->toolmode == spindump_toolmode_textual) {
+    if (config->outputFd >= 0) {
+      output = fdopen(config->outputFd,"w");
+      if (output == 0) {
+        spindump_errorf("cannot write to file descriptor %d: %s", config->outputFd, strerror(errno));
+        exit(1);
+      }
+    }
     formatter = spindump_eventformatter_initialize_file(analyzer,
                                                         config->format,
-                                                        stdout,
+                                                        output,
+                                                        config->outputBufferSize,
                                                         querier,
                                                         config->reportSpins,
                                                         config->reportSpinFlips,
@@ -246,10 +292,16 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
                                                         config->aggregateMode,
                                                         config->averageMode,
                                                         config->reportMinimumRtt,
+                                                        config->reportSmoothedRtt,
                                                         config->filterExceptionalValuesPercentage);
   }
   
   if (config->nRemotes > 0) {
+    for (unsigned int i = 0; i < config->nRemotes; i++) {
+      spindump_remote_client_setqueue(config->remotes[i],
+                                      config->remoteQueueSize,
+                                      config->remoteBlockWhenFull);
+    }
     remoteFormatter = spindump_eventformatter_initialize_remote(analyzer,
                                                                 config->format,
                                                                 config->nRemotes,
@@ -268,15 +320,47 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
                                                                 config->aggregateMode,
                                                                 config->averageMode,
                                                                 config->reportMinimumRtt,
+                                                                config->reportSmoothedRtt,
                                                                 config->filterExceptionalValuesPercentage);
   }
 
+  for (unsigned int i = 1; i < config->threads; i++) {
+    if (formatter != 0 && !spindump_eventformatter_addanalyzer(formatter,analyzers[i])) exit(1);
+    if (remoteFormatter != 0 && !spindump_eventformatter_addanalyzer(remoteFormatter,analyzers[i])) exit(1);
+  }
+  
   //
-  // Initialize aggregate collection, as specified earlier
+  // Initialize aggregate collection, as specified earlier. With
+  // multiple worker threads, the aggregates are created in the first
+  // worker's table, and shared with the other workers' tables, so
+  // that each aggregate collects the connections of all workers and
+  // is reported once.
   //
 
   spindump_deepdeepdebugf("main loop operation, entering aggregate creation");
   spindump_main_loop_initialize_aggregates(config,analyzer);
+  for (unsigned int i = 1; i < config->threads && config->nAggregates > 0; i++) {
+    if (!spindump_connectionstable_shared_attach(analyzers[i]->table,analyzer->table)) exit(1);
+  }
+  
+  //
+  // Start the worker threads, if any. From now on, the analyzers
+  // belong to the workers, until the pipeline is uninitialized.
+  //
+
+  struct spindump_pipeline* pipeline = 0;
+  struct spindump_stats* captureStats = spindump_analyze_getstats(analyzer);
+  if (config->threads > 1) {
+    captureStats = spindump_stats_initialize();
+    if (captureStats == 0) exit(1);
+    pipeline = spindump_pipeline_initialize(config->threads,
+                                            analyzers,
+                                            spindump_capture_getlinktype(capturer),
+                                            config->toolmode == spindump_toolmode_connection,
+                                            (config->remoteBlockSize > 0 && config->nRemotes > 0) ?
+                                            remoteFormatter : 0);
+    if (pipeline == 0) exit(1);
+  }
   
   //
   // Enter the main packet-waiting-loop
@@ -285,6 +369,8 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
   spindump_deepdeepdebugf("main loop operation, entering packetloop");
   spindump_main_loop_packetloop(state,
                                 analyzer,
+                                pipeline,
+                                captureStats,
                                 capturer,
                                 reporter,
                                 formatter,
@@ -299,31 +385,57 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
                                 reverseDnsMode);
   
   //
-  // Done
+  // Done. Let the workers finish what they have been given before
+  // closing the output.
   //
 
+  if (pipeline != 0) {
+    spindump_pipeline_uninitialize(pipeline);
+  }
+  
   if (formatter != 0) {
     spindump_eventformatter_uninitialize(formatter);
   }
   
+  if (output != stdout) {
+    fclose(output);
+  }
+  
   if (remoteFormatter != 0) {
     spindump_eventformatter_uninitialize(remoteFormatter);
   }
   
   if (config->showStats) {
-    spindump_stats_report(spindump_analyze_getstats(analyzer),
+    if (config->threads > 1) {
+      for (unsigned int i = 0; i < config->threads; i++) {
+        spindump_stats_merge(captureStats,spindump_analyze_getstats(analyzers[i]));
+      }
+    }
+    for (unsigned int i = 0; i < config->nRemotes; i++) {
+      spindump_remote_client_flush(config->remotes[i]);
+      spindump_remote_client_getstats(config->remotes[i],captureStats);
+    }
+    spindump_stats_report(captureStats,
                           stdout);
-    spindump_connectionstable_report(analyzer->table,
-                                     stdout,
-                                     config->anonymizeLeft,
-                                     querier);
+    for (unsigned int i = 0; i < config->threads; i++) {
+      spindump_connectionstable_rollup_fold(analyzers[i]->table,analyzers[i]);
+      spindump_connectionstable_report(analyzers[i]->table,
+                                       stdout,
+                                       config->anonymizeLeft,
+                                       querier);
+    }
+  }
+  if (config->threads > 1) {
+    spindump_stats_uninitialize(captureStats);
   }
   // Only free interface string if it was allocated by us
   if (interface_allocated) {
     spindump_free(config->interface);
   }
   spindump_report_uninitialize(reporter);
-  spindump_analyze_uninitialize(analyzer);
+  for (unsigned int i = config->threads; i > 0; i--) {
+    spindump_analyze_uninitialize(analyzers[i - 1]);
+  }
   spindump_capture_uninitialize(capturer);
   spindump_reverse_dns_uninitialize(querier);
   if (server != 0) spindump_remote_server_close(server);
@@ -337,6 +449,8 @@ spindump_main_loop_operation(struct spindump_main_state* state) {
 static void
 spindump_main_loop_packetloop(struct spindump_main_state* state,
                               struct spindump_analyze* analyzer,
+                              struct spindump_pipeline* pipeline,
+                              struct spindump_stats* captureStats,
                               struct spindump_capture_state* capturer,
                               struct spindump_report_state* reporter,
                               struct spindump_eventformatter* formatter,
@@ -359,31 +473,61 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
   struct timeval previousupdate;
   spindump_zerotime(&previousPacketTimestamp);
   spindump_zerotime(&previousupdate);
-  struct spindump_packet* packet = 0;
+  struct spindump_packet packets[spindump_main_loop_batchsize];
+  unsigned int nPackets = 0;
+  unsigned int nextPacket = 0;
   struct spindump_main_configuration* config = &state->config;
+  int captureMore = 1;
   int more = 1;
   int seenEof = 0;
   int firstEof = 1;
   
   spindump_deepdebugf("main packet loop");
   while (!state->interrupt &&
-         more &&
+         (more || nextPacket < nPackets) &&
          (config->maxReceive == 0 ||
-          spindump_analyze_getstats(analyzer)->receivedFrames < config->maxReceive)) {
+          captureStats->receivedFrames < config->maxReceive ||
+          nextPacket < nPackets)) {
     
     //
-    // Get a packet, if any. Analyze it.
+    // Get a batch of packets, if the previous one has been processed
     //
 
-    spindump_capture_nextpacket(capturer,&packet,&more,spindump_analyze_getstats(analyzer));
-    spindump_assert(spindump_isbool(more));
+    if (nextPacket == nPackets) {
+      spindump_capture_releasebatch(capturer);
+      unsigned int maxPackets = spindump_main_loop_batchsize;
+      if (config->maxReceive != 0) {
+        maxPackets = spindump_min(maxPackets,config->maxReceive - captureStats->receivedFrames);
+      }
+      spindump_capture_nextbatch(capturer,packets,maxPackets,&nPackets,&captureMore,captureStats);
+      spindump_assert(spindump_isbool(captureMore));
+      nextPacket = 0;
+    }
+
+    //
+    // Take the packets up to the first one that starts a new second,
+    // as that packet is followed by the periodic check, and analyze
+    // them. The housekeeping below is then done once for all of
+    // them, with the same results as if it was done after each
+    // packet.
+    //
     
-    if (packet != 0) {
-      struct spindump_connection* connection = 0;
-      spindump_analyze_process(analyzer,
-                               spindump_capture_getlinktype(capturer),
-                               packet,
-                               &connection);
+    unsigned int first = nextPacket;
+    while (nextPacket < nPackets) {
+      int newSecond = (packets[nextPacket].timestamp.tv_sec != previousPacketTimestamp.tv_sec);
+      previousPacketTimestamp = packets[nextPacket].timestamp;
+      nextPacket++;
+      if (newSecond) break;
+    }
+    unsigned int nRun = nextPacket - first;
+    more = captureMore || nextPacket < nPackets;
+    
+    if (nRun > 0 && pipeline == 0) {
+      spindump_analyze_process_batch(analyzer,
+                                     spindump_capture_getlinktype(capturer),
+                                     &packets[first],
+                                     nRun,
+                                     0);
     }
 
     //
@@ -407,11 +551,7 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
     //
 
     if (config->inputFile != 0) {
-      if (packet != 0) {
-        now = previousPacketTimestamp = packet->timestamp;
-      } else {
-        now = previousPacketTimestamp;
-      }
+      now = previousPacketTimestamp;
     } else if (config->jsonInputFile != 0) {
       if (!spindump_iszerotime(&previousPacketTimestamp)) {
         spindump_deepdeepdebugf("time set 1");
@@ -428,6 +568,23 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
     spindump_assert(now.tv_sec > 0 || seenEof);
     spindump_assert(now.tv_usec <= 1000 * 1000);
 
+    //
+    // With worker threads, the packets are analyzed by the workers
+    // that own their flows, and the workers do their own periodic
+    // maintenance. When reading a file, each packet carries its own
+    // time to the worker, as the packets in a batch are from
+    // different times.
+    //
+
+    if (pipeline != 0) {
+      for (unsigned int i = first; i < nextPacket; i++) {
+        spindump_pipeline_dispatch(pipeline,
+                                   &packets[i],
+                                   config->inputFile != 0 ? &packets[i].timestamp : &now);
+      }
+      spindump_pipeline_tick(pipeline,&now);
+    }
+
     //
     // Check if there's any report from clients to our server, and
     // take those updates into account in our connection/analyzer
@@ -448,6 +605,9 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
     if (jsonFileReader != 0) {
       while (spindump_remote_file_getupdate(jsonFileReader,analyzer,&previousPacketTimestamp)) {
       }
+      if (jsonFileReader->error) {
+        exit(1);
+      }
       more = 0;
     }
     
@@ -456,7 +616,8 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
     // the set of connections we have.
     //
     
-    if (now.tv_sec > 0 &&
+    if (pipeline == 0 &&
+        now.tv_sec > 0 &&
         spindump_connectionstable_periodiccheck(analyzer->table,
                                                 &now,
                                                 analyzer,
@@ -466,6 +627,14 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
         spindump_eventformatter_sendpooled(remoteFormatter);
       }
     }
+    
+    //
+    // Write out buffered events, if they have waited long enough
+    //
+    
+    if (formatter != 0 && now.tv_sec > 0) {
+      spindump_eventformatter_periodicflush(formatter,&now);
+    }
 
     //
     // See if it is time to update the screen periodically
@@ -476,6 +645,7 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
          spindump_timediffinusecs(&now,&previousupdate) >= config->updatePeriod ||
          (seenEof && firstEof))) {
       
+      spindump_connectionstable_rollup_fold(analyzer->table,analyzer);
       spindump_report_update(reporter,
                              averageMode,
                              aggregateMode,
@@ -544,6 +714,7 @@ spindump_main_loop_packetloop(struct spindump_main_state* state,
     }
     
     if (command != spindump_report_command_none) {
+      spindump_connectionstable_rollup_fold(analyzer->table,analyzer);
       spindump_report_update(reporter,
                              averageMode,
                              aggregateMode,
@@ -568,19 +739,6 @@ spindump_main_loop_initialize_aggregates(struct spindump_main_configuration* con
   struct timeval startTime;
   struct spindump_connectionstable* table = analyzer->table;
   spindump_getcurrenttime(&startTime);
-  spindump_deepdeepdebugf("spindump_main_loop_initialize_aggregate network %u", config->nAggrnetws);
-  if (config->nAggrnetws <= 0)
-    table->networks = 0;
-  else if (!(table->networks = spindump_malloc(config->nAggrnetws * sizeof table->networks[0])))
-    spindump_errorf("cannot allocate aggregate networks");
-  else {
-    memset(table->networks, 0, config->nAggrnetws * sizeof table->networks);
-    for (unsigned int i = 0; i < config->nAggrnetws; i++) {
-      table->networks[i].side2Network = config->aggrnetws[i].network;
-      table->networks[i].connection = 0;
-    }
-    table->nNetworks = config->nAggrnetws;
-  }
   spindump_deepdeepdebugf("spindump_main_loop_initialize_aggregate %u", config->nAggregates);
   for (unsigned int i = 0; i < config->nAggregates; i++) {
     struct spindump_main_aggregate* aggregate = &config->aggregates[i];
@@ -640,6 +798,8 @@ spindump_main_loop_initialize_aggregates(struct spindump_main_configuration* con
       spindump_deepdebugf("created a manually configured aggregate connection %u tags = %s",
                           aggregateConnection->id,
                           aggregateConnection->tags.string);
+    }
+    if (aggregateConnection != 0) {
       struct timeval now;
       spindump_getcurrenttime(&now);
       spindump_analyze_process_handlers(analyzer,
@@ -650,9 +810,11 @@ spindump_main_loop_initialize_aggregates(struct spindump_main_configuration* con
                                         0, // no connection
                                         aggregateConnection);
     }
-    for (unsigned int j = 0; j < config->nAggrnetws; j++) {
+    for (unsigned int j = 0; j < config->nAggrnetws && aggregateConnection != 0; j++) {
       if (config->aggrnetws[j].aggregate == aggregate)
-        table->networks[j].connection = aggregateConnection;
+        spindump_connections_newconnection_aggregate_addnetwork(aggregateConnection,
+                                                                &config->aggrnetws[j].network,
+                                                                table);
     }
   }
 }
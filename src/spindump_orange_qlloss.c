@@ -33,9 +33,9 @@ spindump_qllosstracker_observeandcalculateloss(struct spindump_analyze* state,
                                                int ql) {
   struct spindump_qllosstracker* tracker;
   if (fromResponder)
-    tracker = &connection->u.quic.qlFromPeer2to1;
+    tracker = &connection->cold->u.quic.qlFromPeer2to1;
   else
-    tracker = &connection->u.quic.qlFromPeer1to2;
+    tracker = &connection->cold->u.quic.qlFromPeer1to2;
   
   // 
   // Let's extract the sQuare and Retransmit bits
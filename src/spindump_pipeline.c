@@ -0,0 +1,749 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "spindump_util.h"
+#include "spindump_protocols.h"
+#include "spindump_stats.h"
+#include "spindump_analyze.h"
+#include "spindump_analyze_dns.h"
+#include "spindump_analyze_coap.h"
+#include "spindump_analyze_quic_parser.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+#include "spindump_eventformatter.h"
+#include "spindump_pipeline.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static void*
+spindump_pipeline_workerfunction(void* data);
+static struct spindump_pipeline_entry*
+spindump_pipeline_reserve(struct spindump_pipeline_ring* ring);
+static void
+spindump_pipeline_publish(struct spindump_pipeline_ring* ring);
+static void
+spindump_pipeline_copypacket(struct spindump_pipeline_entry* entry,
+                             const struct spindump_packet* packet);
+static void
+spindump_pipeline_sendcontrol(struct spindump_pipeline* pipeline,
+                              enum spindump_pipeline_entrytype type,
+                              const struct timeval* now);
+static void
+spindump_pipeline_drain(struct spindump_pipeline* pipeline);
+static void
+spindump_pipeline_updateaggregates(struct spindump_pipeline* pipeline,
+                                   const struct timeval* now,
+                                   int force);
+static unsigned int
+spindump_pipeline_selectworker(struct spindump_pipeline* pipeline,
+                               const struct spindump_packet* packet);
+static uint32_t
+spindump_pipeline_hashside(const unsigned char* address,
+                           unsigned int addressLength,
+                           const unsigned char* port);
+static unsigned int
+spindump_pipeline_routeindex(const unsigned char* id,
+                             unsigned int length);
+static struct spindump_pipeline_cidroute*
+spindump_pipeline_findroute(struct spindump_pipeline* pipeline,
+                            const unsigned char* id,
+                            unsigned int length);
+static void
+spindump_pipeline_addroute(struct spindump_pipeline* pipeline,
+                           const struct spindump_quic_connectionid* id,
+                           unsigned int worker);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Create a pipeline of nWorkers worker threads, each of which owns
+// one of the given analyzers (and the connection table within
+// it). The calling thread becomes the capture thread, and hands
+// packets to the workers with spindump_pipeline_dispatch.
+//
+// The analyzers must not be used by the calling thread until the
+// pipeline has been uninitialized.
+//
+
+struct spindump_pipeline*
+spindump_pipeline_initialize(unsigned int nWorkers,
+                             struct spindump_analyze** analyzers,
+                             enum spindump_capture_linktype linktype,
+                             int printInfo,
+                             struct spindump_eventformatter* remoteFormatter) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(nWorkers > 0);
+  spindump_assert(nWorkers <= spindump_pipeline_maxthreads);
+  spindump_assert(analyzers != 0);
+  spindump_assert(spindump_isbool(printInfo));
+
+  //
+  // Allocate the object
+  //
+
+  unsigned int size = sizeof(struct spindump_pipeline);
+  struct spindump_pipeline* pipeline = (struct spindump_pipeline*)spindump_malloc(size);
+  if (pipeline == 0) {
+    spindump_errorf("cannot allocate pipeline of %u bytes", size);
+    return(0);
+  }
+  memset(pipeline,0,size);
+  pipeline->nWorkers = nWorkers;
+  pipeline->linktype = linktype;
+  pipeline->printInfo = printInfo;
+  pipeline->remoteFormatter = remoteFormatter;
+  pipeline->firstEventTime = 0;
+  pipeline->sequence = 0;
+  pipeline->nUnapplied = 0;
+  pipeline->sharedAggregates = 0;
+  spindump_zerotime(&pipeline->lastTick);
+  spindump_zerotime(&pipeline->lastApply);
+
+  //
+  // Allocate the QUIC CID routes
+  //
+
+  pipeline->quicStats = spindump_stats_initialize();
+  if (pipeline->quicStats == 0) {
+    spindump_pipeline_uninitialize(pipeline);
+    return(0);
+  }
+  unsigned int routesSize = spindump_pipeline_cidroutes * sizeof(struct spindump_pipeline_cidroute);
+  pipeline->routes = (struct spindump_pipeline_cidroute*)spindump_malloc(routesSize);
+  if (pipeline->routes == 0) {
+    spindump_errorf("cannot allocate QUIC CID routes of %u bytes", routesSize);
+    spindump_pipeline_uninitialize(pipeline);
+    return(0);
+  }
+  memset(pipeline->routes,0,routesSize);
+
+  //
+  // Allocate the rings and start the workers
+  //
+
+  for (unsigned int i = 0; i < nWorkers; i++) {
+    struct spindump_pipeline_worker* worker = &pipeline->workers[i];
+    spindump_assert(analyzers[i] != 0);
+    worker->pipeline = pipeline;
+    worker->analyzer = analyzers[i];
+    unsigned int ringSize = sizeof(struct spindump_pipeline_ring);
+    worker->ring = (struct spindump_pipeline_ring*)spindump_malloc(ringSize);
+    if (worker->ring == 0) {
+      spindump_errorf("cannot allocate pipeline ring of %u bytes", ringSize);
+      spindump_pipeline_uninitialize(pipeline);
+      return(0);
+    }
+    memset(worker->ring,0,ringSize);
+    atomic_init(&worker->ring->head,0);
+    atomic_init(&worker->ring->tail,0);
+    if (pthread_create(&worker->thread,0,spindump_pipeline_workerfunction,(void*)worker) != 0) {
+      spindump_errorf("cannot create a thread for pipeline worker %u", i);
+      spindump_pipeline_uninitialize(pipeline);
+      return(0);
+    }
+    worker->started = 1;
+  }
+  pipeline->sharedAggregates = (analyzers[0]->table->shared.lock != 0);
+
+  //
+  // Done. Return the object.
+  //
+
+  spindump_deepdebugf("pipeline initialized with %u workers", nWorkers);
+  return(pipeline);
+}
+
+//
+// Hand a packet to the worker that owns its flow. The packet is
+// copied, so the caller may reuse its buffer immediately. The now
+// parameter is the time that the worker uses for its periodic
+// maintenance after analyzing the packet, as the single-threaded loop
+// does.
+//
+// If the worker's ring is full, this function waits until there is
+// space.
+//
+
+void
+spindump_pipeline_dispatch(struct spindump_pipeline* pipeline,
+                           const struct spindump_packet* packet,
+                           const struct timeval* now) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(pipeline != 0);
+  spindump_assert(packet != 0);
+  spindump_assert(now != 0);
+
+  //
+  // All workers report relative time from the first packet seen by
+  // the capture thread, not from the first packet that each of them
+  // happens to see.
+  //
+
+  if (pipeline->firstEventTime == 0) {
+    pipeline->firstEventTime = (((unsigned long long)(packet->timestamp.tv_sec)) * 1000 * 1000 +
+                                (unsigned long long)packet->timestamp.tv_usec);
+  }
+
+  //
+  // Select the worker, and fill in an entry in its ring
+  //
+
+  struct spindump_pipeline_worker* worker = &pipeline->workers[spindump_pipeline_selectworker(pipeline,packet)];
+  struct spindump_pipeline_entry* entry = spindump_pipeline_reserve(worker->ring);
+  entry->type = spindump_pipeline_entrytype_packet;
+  entry->now = *now;
+  entry->firstEventTime = pipeline->firstEventTime;
+  entry->sequence = pipeline->sequence++;
+  spindump_pipeline_copypacket(entry,packet);
+  spindump_pipeline_publish(worker->ring);
+  pipeline->nUnapplied++;
+  spindump_pipeline_updateaggregates(pipeline,now,0);
+}
+
+//
+// Let all workers know about the passage of time, so that workers
+// that have not received packets in a while still time out their
+// connections and make their periodic reports. Ticks are only sent
+// when the second changes, as the periodic checks do nothing more
+// often than that.
+//
+
+void
+spindump_pipeline_tick(struct spindump_pipeline* pipeline,
+                       const struct timeval* now) {
+  spindump_assert(pipeline != 0);
+  spindump_assert(now != 0);
+  if (now->tv_sec == 0 || now->tv_sec == pipeline->lastTick.tv_sec) return;
+  pipeline->lastTick = *now;
+  spindump_pipeline_sendcontrol(pipeline,spindump_pipeline_entrytype_tick,now);
+  spindump_pipeline_updateaggregates(pipeline,now,0);
+}
+
+//
+// Stop the workers, wait for them to finish processing the packets
+// that they have already been given, and release the pipeline. The
+// analyzers are not released; they belong to the caller again once
+// this function returns.
+//
+
+void
+spindump_pipeline_uninitialize(struct spindump_pipeline* pipeline) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(pipeline != 0);
+
+  //
+  // Tell the workers to stop, and wait for them
+  //
+
+  struct timeval now;
+  spindump_zerotime(&now);
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    struct spindump_pipeline_worker* worker = &pipeline->workers[i];
+    if (!worker->started) continue;
+    struct spindump_pipeline_entry* entry = spindump_pipeline_reserve(worker->ring);
+    entry->type = spindump_pipeline_entrytype_stop;
+    entry->now = now;
+    spindump_pipeline_publish(worker->ring);
+  }
+
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    struct spindump_pipeline_worker* worker = &pipeline->workers[i];
+    if (worker->started) pthread_join(worker->thread,0);
+  }
+
+  //
+  // Bring the shared aggregates up to date
+  //
+
+  spindump_pipeline_updateaggregates(pipeline,&now,1);
+
+  //
+  // Release the memory
+  //
+
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    struct spindump_pipeline_worker* worker = &pipeline->workers[i];
+    if (worker->ring == 0) continue;
+    for (unsigned int j = 0; j < spindump_pipeline_ringsize; j++) {
+      if (worker->ring->entries[j].buffer != 0) {
+        spindump_free(worker->ring->entries[j].buffer);
+      }
+    }
+    spindump_free(worker->ring);
+  }
+  if (pipeline->routes != 0) spindump_free(pipeline->routes);
+  if (pipeline->quicStats != 0) spindump_stats_uninitialize(pipeline->quicStats);
+  spindump_free(pipeline);
+}
+
+//
+// Choose the worker for a packet. Packets are given to workers by
+// their flow key, except that QUIC packets are given by their
+// destination CID when it is known to belong to a connection that
+// some worker already has. Each direction of a QUIC connection uses
+// a different destination CID, so the CIDs are not hashed. Instead,
+// both CIDs of each long header are remembered, together with the
+// worker that got the packet, and the later packets with those CIDs
+// follow them to the same worker, even if the addresses or ports
+// change.
+//
+
+static unsigned int
+spindump_pipeline_selectworker(struct spindump_pipeline* pipeline,
+                               const struct spindump_packet* packet) {
+
+  //
+  // By default, the worker is chosen by the flow key
+  //
+
+  unsigned int worker = spindump_pipeline_flowkey(pipeline->linktype,packet) % pipeline->nWorkers;
+  if (pipeline->nWorkers == 1) return(worker);
+
+  //
+  // Is the packet QUIC? The checks are the same as in the UDP
+  // analyzer, so that DNS and COAP packets are not taken for QUIC.
+  //
+
+  struct spindump_analyze_flow flow;
+  if (!spindump_analyze_decodeflow(pipeline->linktype,packet,&flow) ||
+      flow.protocol != IPPROTO_UDP ||
+      flow.transport == 0 ||
+      flow.transportLength <= spindump_udp_header_size) {
+    return(worker);
+  }
+  const unsigned char* payload = flow.transport + spindump_udp_header_size;
+  unsigned int payloadLength = flow.transportLength - spindump_udp_header_size;
+  uint16_t sourcePort = (uint16_t)((flow.sourcePort[0] << 8) | flow.sourcePort[1]);
+  uint16_t destinationPort = (uint16_t)((flow.destinationPort[0] << 8) | flow.destinationPort[1]);
+  int dtls;
+  if (spindump_analyze_dns_isprobablednspacket(payload,payloadLength,sourcePort,destinationPort) ||
+      spindump_analyze_coap_isprobablecoappacket(payload,payloadLength,sourcePort,destinationPort,&dtls) ||
+      !spindump_analyze_quic_parser_isprobablequickpacket(payload,payloadLength,sourcePort,destinationPort)) {
+    return(worker);
+  }
+
+  //
+  // Find the CIDs
+  //
+
+  int hasVersion;
+  uint32_t version;
+  int mayHaveSpinBit;
+  int attempted0Rtt;
+  int destinationCidLengthKnown;
+  struct spindump_quic_connectionid destinationCid;
+  int sourceCidPresent;
+  struct spindump_quic_connectionid sourceCid;
+  enum spindump_quic_message_type type;
+  memset(&destinationCid,0,sizeof(destinationCid));
+  memset(&sourceCid,0,sizeof(sourceCid));
+  if (!spindump_analyze_quic_parser_parse(payload,
+                                          payloadLength,
+                                          payloadLength,
+                                          &hasVersion,
+                                          &version,
+                                          &mayHaveSpinBit,
+                                          &attempted0Rtt,
+                                          &destinationCidLengthKnown,
+                                          &destinationCid,
+                                          &sourceCidPresent,
+                                          &sourceCid,
+                                          &type,
+                                          pipeline->quicStats)) {
+    return(worker);
+  }
+
+  //
+  // A short header does not tell the length of its destination CID,
+  // so each length that some route has is tried, the longest first.
+  //
+
+  if (!destinationCidLengthKnown) {
+    unsigned int available = spindump_min(payloadLength - 1,spindump_connection_quic_cid_maxlen);
+    for (unsigned int length = available; length > 0; length--) {
+      if (pipeline->routeLengths[length] == 0) continue;
+      struct spindump_pipeline_cidroute* route = spindump_pipeline_findroute(pipeline,destinationCid.id,length);
+      if (route != 0) return(route->worker);
+    }
+    return(worker);
+  }
+
+  //
+  // A long header goes where its destination CID, or failing that,
+  // its source CID has gone before. The first packet from a client
+  // has neither, and stays with its flow key. Both CIDs are then
+  // routed to the chosen worker, so that the responses, and the short
+  // headers that follow the handshake, go there as well.
+  //
+
+  struct spindump_pipeline_cidroute* route = spindump_pipeline_findroute(pipeline,destinationCid.id,destinationCid.len);
+  if (route == 0 && sourceCidPresent) {
+    route = spindump_pipeline_findroute(pipeline,sourceCid.id,sourceCid.len);
+  }
+  if (route != 0) worker = route->worker;
+  spindump_pipeline_addroute(pipeline,&destinationCid,worker);
+  if (sourceCidPresent) spindump_pipeline_addroute(pipeline,&sourceCid,worker);
+  return(worker);
+}
+
+//
+// Calculate a flow key for a packet. The key is symmetric, i.e., the
+// packets in both directions of a flow get the same key, so that a
+// flow is always analyzed by the same worker. The key covers the
+// addresses, the protocol, and for TCP, UDP, and SCTP, the ports.
+//
+// Non-first fragments are keyed by addresses and protocol only, as
+// only the first fragment carries the ports. Packets that cannot be
+// parsed get the key 0.
+//
+
+uint32_t
+spindump_pipeline_flowkey(enum spindump_capture_linktype linktype,
+                          const struct spindump_packet* packet) {
+
+  //
+  // Find the addresses, protocol, and ports
+  //
+
+  spindump_assert(packet != 0);
+  struct spindump_analyze_flow flow;
+  if (!spindump_analyze_decodeflow(linktype,packet,&flow)) return(0);
+
+  //
+  // Hash the two sides separately, and combine them in a way that
+  // does not depend on the order of the sides
+  //
+
+  uint32_t key =
+    spindump_pipeline_hashside(flow.source,flow.addressLength,flow.sourcePort) +
+    spindump_pipeline_hashside(flow.destination,flow.addressLength,flow.destinationPort);
+  key ^= flow.protocol;
+  key ^= key >> 16;
+  key *= 0x85ebca6bU;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35U;
+  key ^= key >> 16;
+  return(key);
+}
+
+//
+// FNV-1a over an address and an optional port
+//
+
+static uint32_t
+spindump_pipeline_hashside(const unsigned char* address,
+                           unsigned int addressLength,
+                           const unsigned char* port) {
+  uint32_t hash = 2166136261U;
+  for (unsigned int i = 0; i < addressLength; i++) {
+    hash ^= address[i];
+    hash *= 16777619U;
+  }
+  if (port != 0) {
+    for (unsigned int i = 0; i < 2; i++) {
+      hash ^= port[i];
+      hash *= 16777619U;
+    }
+  }
+  return(hash);
+}
+
+//
+// FNV-1a over a QUIC CID, giving its position in the routes
+//
+
+static unsigned int
+spindump_pipeline_routeindex(const unsigned char* id,
+                             unsigned int length) {
+  uint32_t hash = 2166136261U;
+  for (unsigned int i = 0; i < length; i++) {
+    hash ^= id[i];
+    hash *= 16777619U;
+  }
+  hash ^= length;
+  hash *= 16777619U;
+  return(hash & (spindump_pipeline_cidroutes - 1));
+}
+
+//
+// Find the route of a QUIC CID of the given length, or return 0 if
+// the CID has no route
+//
+
+static struct spindump_pipeline_cidroute*
+spindump_pipeline_findroute(struct spindump_pipeline* pipeline,
+                            const unsigned char* id,
+                            unsigned int length) {
+  if (length == 0 || length > spindump_connection_quic_cid_maxlen) return(0);
+  struct spindump_pipeline_cidroute* route = &pipeline->routes[spindump_pipeline_routeindex(id,length)];
+  if (!route->used || route->id.len != length || memcmp(route->id.id,id,length) != 0) return(0);
+  return(route);
+}
+
+//
+// Route a QUIC CID to a worker, replacing any route that was in the
+// same position. Empty CIDs are not routed, as they would match
+// every short header.
+//
+
+static void
+spindump_pipeline_addroute(struct spindump_pipeline* pipeline,
+                           const struct spindump_quic_connectionid* id,
+                           unsigned int worker) {
+  if (id->len == 0 || id->len > spindump_connection_quic_cid_maxlen) return;
+  struct spindump_pipeline_cidroute* route = &pipeline->routes[spindump_pipeline_routeindex(id->id,id->len)];
+  if (route->used) {
+    spindump_assert(pipeline->routeLengths[route->id.len] > 0);
+    pipeline->routeLengths[route->id.len]--;
+  }
+  route->id = *id;
+  route->worker = worker;
+  route->used = 1;
+  pipeline->routeLengths[id->len]++;
+}
+
+//
+// Wait until there is a free entry in the ring, and return it. Only
+// the capture thread calls this. The entry becomes visible to the
+// worker only when spindump_pipeline_publish is called.
+//
+
+static struct spindump_pipeline_entry*
+spindump_pipeline_reserve(struct spindump_pipeline_ring* ring) {
+  unsigned int head = atomic_load_explicit(&ring->head,memory_order_relaxed);
+  while (head - atomic_load_explicit(&ring->tail,memory_order_acquire) >= spindump_pipeline_ringsize) {
+    sched_yield();
+  }
+  return(&ring->entries[head & (spindump_pipeline_ringsize - 1)]);
+}
+
+//
+// Make the entry most recently returned by spindump_pipeline_reserve
+// visible to the worker
+//
+
+static void
+spindump_pipeline_publish(struct spindump_pipeline_ring* ring) {
+  unsigned int head = atomic_load_explicit(&ring->head,memory_order_relaxed);
+  atomic_store_explicit(&ring->head,head + 1,memory_order_release);
+}
+
+//
+// Copy a packet to a ring entry, growing the entry's buffer if needed
+//
+
+static void
+spindump_pipeline_copypacket(struct spindump_pipeline_entry* entry,
+                             const struct spindump_packet* packet) {
+  entry->packet = *packet;
+  if (packet->caplen == 0 || packet->contents == 0) {
+    entry->packet.contents = 0;
+    return;
+  }
+  if (entry->bufferSize < packet->caplen) {
+    if (entry->buffer != 0) spindump_free(entry->buffer);
+    entry->bufferSize = spindump_max(packet->caplen,spindump_pipeline_minbuffersize);
+    entry->buffer = (unsigned char*)spindump_malloc(entry->bufferSize);
+    if (entry->buffer == 0) {
+      spindump_fatalf("cannot allocate pipeline packet buffer of %u bytes", entry->bufferSize);
+    }
+  }
+  memcpy(entry->buffer,packet->contents,packet->caplen);
+  entry->packet.contents = entry->buffer;
+}
+
+//
+// Wait until all workers have processed all the entries given to
+// them. The workers do not touch their analyzers again until they
+// are given new entries.
+//
+
+static void
+spindump_pipeline_drain(struct spindump_pipeline* pipeline) {
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    struct spindump_pipeline_ring* ring = pipeline->workers[i].ring;
+    unsigned int head = atomic_load_explicit(&ring->head,memory_order_relaxed);
+    while (atomic_load_explicit(&ring->tail,memory_order_acquire) != head) {
+      sched_yield();
+    }
+  }
+}
+
+//
+// Apply the updates that the workers have logged for the shared
+// aggregates, and make the periodic report of the aggregates if one
+// is due. The aggregates are owned by the first worker's table, but
+// they are updated and reported here rather than by the workers,
+// once all the packets up to this point have been analyzed, so that
+// the aggregates see the packets in order and each report is one
+// consistent view of all the flows. This is done when the second
+// changes, after a number of packets to keep the logs short, and when
+// forced.
+//
+
+static void
+spindump_pipeline_updateaggregates(struct spindump_pipeline* pipeline,
+                                   const struct timeval* now,
+                                   int force) {
+  if (!pipeline->sharedAggregates) return;
+  if (!force &&
+      now->tv_sec == pipeline->lastApply.tv_sec &&
+      pipeline->nUnapplied < spindump_pipeline_maxunapplied) {
+    return;
+  }
+  pipeline->lastApply = *now;
+  pipeline->nUnapplied = 0;
+  spindump_pipeline_drain(pipeline);
+  struct spindump_connectionstable* tables[spindump_pipeline_maxthreads];
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    tables[i] = pipeline->workers[i].analyzer->table;
+  }
+  struct spindump_analyze* owner = pipeline->workers[0].analyzer;
+  spindump_connectionstable_shared_apply(tables,pipeline->nWorkers,owner);
+  if (now->tv_sec > 0) spindump_connectionstable_aggregatereport(owner->table,now,owner);
+  if (pipeline->remoteFormatter != 0) {
+    spindump_eventformatter_sendpooled(pipeline->remoteFormatter);
+  }
+}
+
+//
+// Send a control entry (tick or stop) to all workers
+//
+
+static void
+spindump_pipeline_sendcontrol(struct spindump_pipeline* pipeline,
+                              enum spindump_pipeline_entrytype type,
+                              const struct timeval* now) {
+  for (unsigned int i = 0; i < pipeline->nWorkers; i++) {
+    struct spindump_pipeline_worker* worker = &pipeline->workers[i];
+    struct spindump_pipeline_entry* entry = spindump_pipeline_reserve(worker->ring);
+    entry->type = type;
+    entry->now = *now;
+    spindump_pipeline_publish(worker->ring);
+  }
+}
+
+//
+// The worker thread main loop. Take entries from the ring, and
+// analyze packets and perform periodic checks as the single-threaded
+// main loop would.
+//
+
+static void*
+spindump_pipeline_workerfunction(void* data) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(data != 0);
+  struct spindump_pipeline_worker* worker = (struct spindump_pipeline_worker*)data;
+  struct spindump_pipeline* pipeline = worker->pipeline;
+  struct spindump_pipeline_ring* ring = worker->ring;
+  struct spindump_analyze* analyzer = worker->analyzer;
+  unsigned int idle = 0;
+
+  //
+  // Main loop
+  //
+
+  while (1) {
+
+    //
+    // Wait for an entry. Spin briefly first, then back off to sleeping
+    // so that an idle worker does not keep a core busy.
+    //
+
+    unsigned int tail = atomic_load_explicit(&ring->tail,memory_order_relaxed);
+    if (atomic_load_explicit(&ring->head,memory_order_acquire) == tail) {
+      if (idle++ < spindump_pipeline_spinsbeforesleep) {
+        sched_yield();
+      } else {
+        usleep(spindump_pipeline_idlesleep);
+      }
+      continue;
+    }
+    idle = 0;
+
+    //
+    // Process the entry
+    //
+
+    struct spindump_pipeline_entry* entry = &ring->entries[tail & (spindump_pipeline_ringsize - 1)];
+    if (entry->type == spindump_pipeline_entrytype_stop) {
+      atomic_store_explicit(&ring->tail,tail + 1,memory_order_release);
+      break;
+    }
+
+    if (entry->type == spindump_pipeline_entrytype_packet) {
+      if (analyzer->firstEventTime == 0) {
+        analyzer->firstEventTime = entry->firstEventTime;
+      }
+      struct spindump_connection* connection = 0;
+      analyzer->table->shared.sequence = entry->sequence;
+      spindump_analyze_process(analyzer,pipeline->linktype,&entry->packet,&connection);
+    }
+
+    if (entry->now.tv_sec > 0 &&
+        spindump_connectionstable_periodiccheck(analyzer->table,
+                                                &entry->now,
+                                                analyzer,
+                                                pipeline->printInfo)) {
+      if (pipeline->remoteFormatter != 0) {
+        spindump_eventformatter_sendpooled(pipeline->remoteFormatter);
+      }
+    }
+
+    //
+    // Release the entry back to the capture thread
+    //
+
+    atomic_store_explicit(&ring->tail,tail + 1,memory_order_release);
+  }
+
+  //
+  // Done.
+  //
+
+  return(0);
+}
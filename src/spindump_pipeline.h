@@ -0,0 +1,161 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+#ifndef SPINDUMP_PIPELINE_H
+#define SPINDUMP_PIPELINE_H
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "spindump_util.h"
+#include "spindump_packet.h"
+#include "spindump_capture.h"
+#include "spindump_connections_structs.h"
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_pipeline_maxthreads        64
+#define spindump_pipeline_ringsize        1024 // entries, must be a power of two
+#define spindump_pipeline_cachelinesize     64 // bytes
+#define spindump_pipeline_minbuffersize    256 // bytes
+#define spindump_pipeline_spinsbeforesleep 100
+#define spindump_pipeline_idlesleep        100 // usec
+#define spindump_pipeline_maxunapplied   65536 // packets between applying aggregate updates
+#define spindump_pipeline_cidroutes       4096 // QUIC CIDs remembered, must be a power of two
+
+//
+// Data structures ----------------------------------------------------------------------------
+//
+
+struct spindump_analyze;
+struct spindump_eventformatter;
+struct spindump_stats;
+
+enum spindump_pipeline_entrytype {
+  spindump_pipeline_entrytype_packet,
+  spindump_pipeline_entrytype_tick,
+  spindump_pipeline_entrytype_stop
+};
+
+//
+// One slot in a ring. The packet contents are copied to a buffer
+// owned by the slot, as the capture module reuses its own buffer for
+// the next packet. The buffer is grown when needed, and reused for
+// later packets in the same slot.
+//
+
+struct spindump_pipeline_entry {
+  enum spindump_pipeline_entrytype type;       // written by capture thread, read by worker thread
+  unsigned int bufferSize;                     // written and read by capture thread only
+  struct timeval now;                          // written by capture thread, read by worker thread
+  unsigned long long firstEventTime;           // written by capture thread, read by worker thread
+  unsigned long long sequence;                 // written by capture thread, read by worker thread
+  struct spindump_packet packet;               // written by capture thread, read by worker thread
+  unsigned char* buffer;                       // written by capture thread, read by worker thread
+};
+
+//
+// A single-producer, single-consumer ring. The capture thread is the
+// only writer of head and the worker thread is the only writer of
+// tail, so no locks are needed. The two indexes are on separate cache
+// lines so that the threads do not keep invalidating each others'
+// caches.
+//
+
+struct spindump_pipeline_ring {
+  atomic_uint head;                            // written by capture thread, read by worker thread
+  uint8_t padding1[spindump_pipeline_cachelinesize - sizeof(atomic_uint)];
+  atomic_uint tail;                            // written by worker thread, read by capture thread
+  uint8_t padding2[spindump_pipeline_cachelinesize - sizeof(atomic_uint)];
+  struct spindump_pipeline_entry entries[spindump_pipeline_ringsize];
+};
+
+//
+// A QUIC connection ID seen in a long header, and the worker that
+// its connection was given to. Short headers carry only the
+// destination CID, and when a client moves to a new address or port,
+// the CID is all that ties its packets to the connection. The routes
+// are a cache indexed by a hash of the CID; a CID that is pushed out
+// by another one is again routed by the addresses and ports.
+//
+
+struct spindump_pipeline_cidroute {
+  struct spindump_quic_connectionid id;        // written and read by capture thread only
+  unsigned int worker;                         // written and read by capture thread only
+  int used;                                    // written and read by capture thread only
+};
+
+struct spindump_pipeline;
+
+struct spindump_pipeline_worker {
+  struct spindump_pipeline* pipeline;          // written and read by capture thread only
+  struct spindump_analyze* analyzer;           // owned by the worker thread once started
+  struct spindump_pipeline_ring* ring;
+  pthread_t thread;                            // written and read by capture thread only
+  int started;                                 // written and read by capture thread only
+  uint8_t padding[4];                          // unused padding to align the size of the structure
+};
+
+struct spindump_pipeline {
+  unsigned int nWorkers;
+  enum spindump_capture_linktype linktype;
+  int printInfo;
+  int sharedAggregates;                        // do the workers share aggregates?
+  struct spindump_eventformatter* remoteFormatter;
+  unsigned long long firstEventTime;           // written and read by capture thread only
+  unsigned long long sequence;                 // written and read by capture thread only
+  unsigned int nUnapplied;                     // written and read by capture thread only
+  uint8_t padding[4];                          // unused padding to align the next field properly
+  struct timeval lastTick;                     // written and read by capture thread only
+  struct timeval lastApply;                    // written and read by capture thread only
+  struct spindump_stats* quicStats;            // QUIC parser statistics of the capture thread, not reported
+  struct spindump_pipeline_cidroute* routes;   // written and read by capture thread only
+  unsigned int routeLengths[spindump_connection_quic_cid_maxlen+1]; // number of routes by CID length
+  uint8_t padding2[4];                         // unused padding to align the next field properly
+  struct spindump_pipeline_worker workers[spindump_pipeline_maxthreads];
+};
+
+//
+// External API interface to this module ------------------------------------------------------
+//
+
+struct spindump_pipeline*
+spindump_pipeline_initialize(unsigned int nWorkers,
+                             struct spindump_analyze** analyzers,
+                             enum spindump_capture_linktype linktype,
+                             int printInfo,
+                             struct spindump_eventformatter* remoteFormatter);
+void
+spindump_pipeline_dispatch(struct spindump_pipeline* pipeline,
+                           const struct spindump_packet* packet,
+                           const struct timeval* now);
+void
+spindump_pipeline_tick(struct spindump_pipeline* pipeline,
+                       const struct timeval* now);
+void
+spindump_pipeline_uninitialize(struct spindump_pipeline* pipeline);
+uint32_t
+spindump_pipeline_flowkey(enum spindump_capture_linktype linktype,
+                          const struct spindump_packet* packet);
+
+#endif // SPINDUMP_PIPELINE_H
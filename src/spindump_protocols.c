@@ -38,13 +38,13 @@
 // This helper function converts a TCP flags field to a set of
 // printable option names, useful for debugs etc.
 // 
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_protocols_tcp_flagstostring(uint8_t flags) {
   
-  static char buf[50];
+  static _Thread_local char buf[50];
   buf[0] = 0;
   
 # define spindump_checkflag(flag,string,val)                    \
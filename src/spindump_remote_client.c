@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include "spindump_util.h"
 #include "spindump_remote_client.h"
 
@@ -36,6 +37,20 @@
 
 static size_t
 spindump_remote_client_answer(void *buffer, size_t size, size_t nmemb, void *userp);
+static int
+spindump_remote_client_startsender(struct spindump_remote_client* client,
+                                   const char* mediaType);
+static void*
+spindump_remote_client_sender(void* arg);
+static void
+spindump_remote_client_sendblock(struct spindump_remote_client* client,
+                                 CURL* curl,
+                                 const struct spindump_remote_client_block* block);
+static int
+spindump_remote_client_sent(struct spindump_remote_client* client,
+                            CURL* curl,
+                            struct spindump_remote_client_block* block,
+                            CURLcode res);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -47,7 +62,8 @@ spindump_remote_client_answer(void *buffer, size_t size, size_t nmemb, void *use
 
 //
 // Create an object to present a client that wants to access Spindump
-// data from a server somewhere in the network.
+// data from a server somewhere in the network. The sender thread is
+// started when the first block is sent.
 //
 
 struct spindump_remote_client*
@@ -69,8 +85,13 @@ spindump_remote_client_init(const char* url) {
   //
   
   memset(client,0,sizeof(*client));
+  curl_global_init(CURL_GLOBAL_DEFAULT);
   client->url = url;
-  client->curl = curl_easy_init();
+  client->queueSize = spindump_remote_client_defaultqueuesize;
+  client->blockWhenFull = 0;
+  pthread_mutex_init(&client->lock,0);
+  pthread_cond_init(&client->queued,0);
+  pthread_cond_init(&client->dequeued,0);
 
   //
   // Done
@@ -79,6 +100,84 @@ spindump_remote_client_init(const char* url) {
   return(client);
 }
 
+//
+// Set the size of the queue of blocks waiting to be sent, and what to
+// do when the queue is full. This needs to be done before the first
+// block is sent.
+//
+
+void
+spindump_remote_client_setqueue(struct spindump_remote_client* client,
+                                unsigned int queueSize,
+                                int blockWhenFull) {
+  spindump_assert(client != 0);
+  spindump_assert(queueSize > 0);
+  spindump_assert(spindump_isbool(blockWhenFull));
+  spindump_assert(!client->started);
+  client->queueSize = queueSize;
+  client->blockWhenFull = blockWhenFull;
+}
+
+//
+// Allocate the ring and start the sender thread. The blocks are sent
+// with the media type of the first block. Returns 1 upon success, 0
+// upon failure. Called with the lock held.
+//
+
+static int
+spindump_remote_client_startsender(struct spindump_remote_client* client,
+                                   const char* mediaType) {
+
+  //
+  // Allocate the ring
+  //
+  
+  unsigned int size = client->queueSize * sizeof(struct spindump_remote_client_block);
+  client->ring = (struct spindump_remote_client_block*)spindump_malloc(size);
+  if (client->ring == 0) {
+    spindump_errorf("cannot allocate the remote client queue of %u bytes", size);
+    return(0);
+  }
+  memset(client->ring,0,size);
+  
+  //
+  // Setup curl. The multi handle keeps the connections to the
+  // collector open between requests, and multiplexes requests on them
+  // if the collector supports it.
+  //
+
+  client->multi = curl_multi_init();
+  if (client->multi == 0) {
+    spindump_errorf("cannot initialize the remote client for %s", client->url);
+    spindump_free(client->ring);
+    client->ring = 0;
+    return(0);
+  }
+  curl_multi_setopt(client->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(client->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)spindump_remote_client_maxinflight);
+  char contentType[100];
+  snprintf(contentType,sizeof(contentType),"Content-Type: %s",mediaType);
+  client->headers = curl_slist_append(client->headers, contentType);
+  client->headers = curl_slist_append(client->headers, "Expect:");
+
+  //
+  // Start the thread
+  //
+  
+  if (pthread_create(&client->sender,0,spindump_remote_client_sender,client) != 0) {
+    spindump_errorf("cannot create the sender thread for %s", client->url);
+    curl_slist_free_all(client->headers);
+    client->headers = 0;
+    curl_multi_cleanup(client->multi);
+    client->multi = 0;
+    spindump_free(client->ring);
+    client->ring = 0;
+    return(0);
+  }
+  client->started = 1;
+  return(1);
+}
+
 //
 // Send a periodic update to the server
 //
@@ -93,7 +192,9 @@ spindump_remote_client_update_periodic(struct spindump_remote_client* client,
 
 //
 // Send an update for a specific event to the server (or pool updates,
-// if so requested).
+// if so requested). The data is copied to the client's queue, and
+// sent in the background. If the queue is full, the update is either
+// dropped or this function waits until there is space.
 //
 
 void
@@ -102,51 +203,296 @@ spindump_remote_client_update_event(struct spindump_remote_client* client,
                                     unsigned long length,
                                     const uint8_t* data) {
 
-  //
-  // Configure the request
-  //
-
-  curl_easy_setopt(client->curl, CURLOPT_URL, client->url);
-  curl_easy_setopt(client->curl, CURLOPT_POSTFIELDS, data);
-  curl_easy_setopt(client->curl, CURLOPT_POSTFIELDSIZE, length);
-  curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, spindump_remote_client_answer);
-  struct curl_slist *headers=0;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-  curl_easy_setopt(client->curl, CURLOPT_HTTPHEADER, headers);
-
-  spindump_debugf("performing a post on %s...", client->url);
+  spindump_assert(client != 0);
+  spindump_debugf("queueing a post of %lu bytes on %s...", length, client->url);
   if (length > 0 && (data[0] == '[' || data[0] == '{')) {
-    spindump_deepdebugf("data: %s", data);
+    spindump_deepdebugf("data: %.*s", (int)length, data);
   }
 
   //
-  // Perform the request, res will get the return code
+  // Copy the data
   //
-  
-  CURLcode res = curl_easy_perform(client->curl);
-  
+
+  struct spindump_remote_client_block block;
+  block.length = length;
+  block.data = (uint8_t*)spindump_malloc(length > 0 ? length : 1);
+  if (block.data == 0) {
+    spindump_errorf("cannot allocate a remote update block of %lu bytes", length);
+    return;
+  }
+  memcpy(block.data,data,length);
+  spindump_getcurrenttime(&block.queued);
+  spindump_zerotime(&block.retryAt);
+  block.retries = 0;
+
   //
-  // Check for errors
+  // Put it in the queue
   //
+
+  pthread_mutex_lock(&client->lock);
+  client->blocksQueued++;
+  if (!client->started && !spindump_remote_client_startsender(client,mediaType)) {
+    client->blocksFailed++;
+    pthread_mutex_unlock(&client->lock);
+    spindump_free(block.data);
+    return;
+  }
+  if (client->nQueued == client->queueSize && !client->blockWhenFull) {
+    client->blocksDropped++;
+    pthread_mutex_unlock(&client->lock);
+    spindump_debugf("remote queue to %s is full, dropped a block", client->url);
+    spindump_free(block.data);
+    return;
+  }
+  while (client->nQueued == client->queueSize) {
+    pthread_cond_wait(&client->dequeued,&client->lock);
+  }
+  client->ring[client->head] = block;
+  client->head = (client->head + 1) % client->queueSize;
+  client->nQueued++;
+  if (client->nQueued + client->nInFlight > client->maxQueueDepth) {
+    client->maxQueueDepth = client->nQueued + client->nInFlight;
+  }
+  pthread_cond_signal(&client->queued);
+  pthread_mutex_unlock(&client->lock);
+  curl_multi_wakeup(client->multi);
+}
+
+//
+// Start sending one block on a given curl handle
+//
+
+static void
+spindump_remote_client_sendblock(struct spindump_remote_client* client,
+                                 CURL* curl,
+                                 const struct spindump_remote_client_block* block) {
+  curl_easy_setopt(curl, CURLOPT_URL, client->url);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, block->data);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)block->length);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, spindump_remote_client_answer);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, client->headers);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)spindump_remote_client_sendtimeout);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_multi_add_handle(client->multi, curl);
+  spindump_debugf("performing a post on %s...", client->url);
+}
+
+//
+// Record the result of sending a block, and free the block. A block
+// that the collector answers with an error status has failed just as
+// if it could not be sent at all, except that when the collector is
+// busy, the block is kept and its resending time is set. Returns 1
+// if the block is done, and 0 if it is to be resent.
+//
+
+static int
+spindump_remote_client_sent(struct spindump_remote_client* client,
+                            CURL* curl,
+                            struct spindump_remote_client_block* block,
+                            CURLcode res) {
   
+  struct timeval now;
+  spindump_getcurrenttime(&now);
+  unsigned long long latency = spindump_timediffinusecs(&now,&block->queued);
+  long status = 0;
+  if (res == CURLE_OK) {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  }
+  if (status == 503 && block->retries < spindump_remote_client_maxretries) {
+    curl_off_t wait = 0;
+    curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &wait);
+    if (wait <= 0) wait = spindump_remote_client_defaultretryafter;
+    if (wait > spindump_remote_client_maxretryafter) wait = spindump_remote_client_maxretryafter;
+    spindump_debugf("remote collector at %s is busy, resending a block in %lus",
+                    client->url,
+                    (unsigned long)wait);
+    block->retryAt = now;
+    block->retryAt.tv_sec += (time_t)wait;
+    block->retries++;
+    return(0);
+  }
+  int ok = (res == CURLE_OK && status < 400);
   if (res != CURLE_OK) {
-    spindump_debugf("failed");
     spindump_errorf("remote request to %s failed: %s",
                     client->url,
                     curl_easy_strerror(res));
+  } else if (!ok) {
+    spindump_errorf("remote request to %s failed: HTTP status %ld",
+                    client->url,
+                    status);
+  }
+  spindump_free(block->data);
+  block->data = 0;
+
+  pthread_mutex_lock(&client->lock);
+  client->nInFlight--;
+  if (ok) {
+    client->blocksSent++;
+    client->sendLatency += latency;
+  } else {
+    client->blocksFailed++;
+  }
+  pthread_cond_broadcast(&client->dequeued);
+  pthread_mutex_unlock(&client->lock);
+  return(1);
+}
+
+//
+// The sender thread. Take blocks from the ring as long as there are
+// free curl handles, and drive the transfers until they complete.
+// Blocks refused by a busy collector stay with their handles until
+// it is time to resend them. The thread exits when asked to close,
+// after sending all queued blocks.
+//
+
+static void*
+spindump_remote_client_sender(void* arg) {
+  
+  struct spindump_remote_client* client = (struct spindump_remote_client*)arg;
+  CURL* handles[spindump_remote_client_maxinflight];
+  struct spindump_remote_client_block blocks[spindump_remote_client_maxinflight];
+  int waiting[spindump_remote_client_maxinflight];
+  unsigned int nActive = 0;
+  for (unsigned int i = 0; i < spindump_remote_client_maxinflight; i++) {
+    handles[i] = curl_easy_init();
+    blocks[i].data = 0;
+    waiting[i] = 0;
+  }
+  
+  while (1) {
+
+    //
+    // Take new blocks from the ring, waiting for them if there is
+    // nothing else to do
+    //
+    
+    pthread_mutex_lock(&client->lock);
+    while (client->nQueued == 0 && nActive == 0 && !client->closing) {
+      pthread_cond_wait(&client->queued,&client->lock);
+    }
+    if (client->nQueued == 0 && nActive == 0) {
+      pthread_mutex_unlock(&client->lock);
+      break;
+    }
+    for (unsigned int i = 0; i < spindump_remote_client_maxinflight && client->nQueued > 0; i++) {
+      if (blocks[i].data != 0 || handles[i] == 0) continue;
+      blocks[i] = client->ring[client->tail];
+      client->tail = (client->tail + 1) % client->queueSize;
+      client->nQueued--;
+      client->nInFlight++;
+      spindump_remote_client_sendblock(client,handles[i],&blocks[i]);
+      nActive++;
+    }
+    pthread_cond_broadcast(&client->dequeued);
+    pthread_mutex_unlock(&client->lock);
+
+    //
+    // Resend the blocks whose waiting time is over
+    //
+
+    struct timeval now;
+    spindump_getcurrenttime(&now);
+    for (unsigned int i = 0; i < spindump_remote_client_maxinflight; i++) {
+      if (!waiting[i] || spindump_isearliertime(&blocks[i].retryAt,&now)) continue;
+      waiting[i] = 0;
+      spindump_remote_client_sendblock(client,handles[i],&blocks[i]);
+    }
+
+    //
+    // Drive the transfers, and collect the completed ones
+    //
+    
+    int running;
+    curl_multi_perform(client->multi,&running);
+    CURLMsg* msg;
+    int left;
+    while ((msg = curl_multi_info_read(client->multi,&left)) != 0) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      for (unsigned int i = 0; i < spindump_remote_client_maxinflight; i++) {
+        if (handles[i] != msg->easy_handle) continue;
+        CURLcode res = msg->data.result;
+        curl_multi_remove_handle(client->multi,handles[i]);
+        if (spindump_remote_client_sent(client,handles[i],&blocks[i],res)) {
+          nActive--;
+        } else {
+          waiting[i] = 1;
+        }
+        break;
+      }
+    }
+    if (nActive > 0) {
+      curl_multi_poll(client->multi,0,0,spindump_remote_client_polltimeout,0);
+    }
+  }
+  
+  for (unsigned int i = 0; i < spindump_remote_client_maxinflight; i++) {
+    if (handles[i] != 0) curl_easy_cleanup(handles[i]);
+  }
+  return(0);
+}
+
+//
+// Wait until all queued blocks have been sent (or failed)
+//
+
+void
+spindump_remote_client_flush(struct spindump_remote_client* client) {
+  spindump_assert(client != 0);
+  pthread_mutex_lock(&client->lock);
+  while (client->started && (client->nQueued > 0 || client->nInFlight > 0)) {
+    pthread_cond_wait(&client->dequeued,&client->lock);
+  }
+  pthread_mutex_unlock(&client->lock);
+}
+
+//
+// Add the client's counters to a statistics object
+//
+
+void
+spindump_remote_client_getstats(struct spindump_remote_client* client,
+                                struct spindump_stats* stats) {
+  spindump_assert(client != 0);
+  spindump_assert(stats != 0);
+  pthread_mutex_lock(&client->lock);
+  stats->remoteQueueDepth += client->nQueued + client->nInFlight;
+  if (client->maxQueueDepth > stats->remoteMaxQueueDepth) {
+    stats->remoteMaxQueueDepth = client->maxQueueDepth;
   }
-  spindump_debugf("Ok");
+  stats->remoteBlocksQueued += client->blocksQueued;
+  stats->remoteBlocksSent += client->blocksSent;
+  stats->remoteBlocksFailed += client->blocksFailed;
+  stats->remoteBlocksDropped += client->blocksDropped;
+  stats->remoteSendLatency += client->sendLatency;
+  pthread_mutex_unlock(&client->lock);
 }
 
 //
-// Close the client, i.e., no longer send updates to the server.
+// Close the client, i.e., no longer send updates to the server. The
+// blocks already queued are sent first.
 //
 
 void
 spindump_remote_client_close(struct spindump_remote_client* client) {
   spindump_assert(client != 0);
-  curl_easy_cleanup(client->curl);
+  pthread_mutex_lock(&client->lock);
+  client->closing = 1;
+  pthread_cond_signal(&client->queued);
+  int started = client->started;
+  pthread_mutex_unlock(&client->lock);
+  if (started) {
+    curl_multi_wakeup(client->multi);
+    pthread_join(client->sender,0);
+    curl_multi_cleanup(client->multi);
+    curl_slist_free_all(client->headers);
+    spindump_free(client->ring);
+  }
+  pthread_cond_destroy(&client->dequeued);
+  pthread_cond_destroy(&client->queued);
+  pthread_mutex_destroy(&client->lock);
   spindump_free(client);
+  curl_global_cleanup();
 }
 
 //
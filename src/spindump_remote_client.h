@@ -23,26 +23,90 @@
 // Includes -----------------------------------------------------------------------------------
 //
 
+#include <pthread.h>
 #include <curl/curl.h>
 #include <microhttpd.h>
 #include "spindump_util.h"
 #include "spindump_protocols.h"
 #include "spindump_table.h"
 #include "spindump_eventformatter.h"
+#include "spindump_stats.h"
 
 //
 // Parameters ---------------------------------------------------------------------------------
 //
 
 #define SPINDUMP_REMOTE_CLIENT_MAX_CONNECTIONS 5
+#define spindump_remote_client_defaultqueuesize   64 // blocks waiting to be sent, per remote
+#define spindump_remote_client_maxinflight         4 // requests being sent at the same time, per remote
+#define spindump_remote_client_polltimeout       100 // ms
+#define spindump_remote_client_sendtimeout        30 // s
+#define spindump_remote_client_maxretries          5 // times a block is resent to a busy collector
+#define spindump_remote_client_defaultretryafter   1 // s, if a busy collector does not say
+#define spindump_remote_client_maxretryafter      60 // s
 
 //
 // Data structures ----------------------------------------------------------------------------
 //
 
+//
+// A block of serialized events waiting to be sent. The data is a copy
+// owned by the block, so that the caller can reuse its own buffer
+// right away.
+//
+
+struct spindump_remote_client_block {
+  uint8_t* data;                                    // the serialized events
+  unsigned long length;                             // length of the data, in bytes
+  struct timeval queued;                            // when the block was given to the client
+  struct timeval retryAt;                           // when to resend the block to a busy collector
+  unsigned int retries;                             // number of times the block has been resent
+  uint8_t padding[4];                               // unused padding to align the size of the structure
+};
+
+//
+// A client that sends blocks to one remote collector. The blocks are
+// put in a bounded ring, and sent by a background thread, so that
+// the analyzer does not wait for the network. The sender thread keeps
+// its HTTP connections open between requests, and has a few requests
+// outstanding at the same time. When the ring is full, new blocks are
+// either dropped or the caller waits until there is space, as
+// configured.
+//
+// A block that a busy collector refuses with status 503 is kept, and
+// sent again after the time given in the Retry-After header. The
+// block holds on to its place among the outstanding requests in the
+// meantime, so the ring fills up more quickly, and the configured
+// policy for a full ring applies to the new blocks.
+//
+// The lock protects everything from the ring onwards. The sender
+// thread waits on the queued condition, and callers that wait for
+// space or for all blocks to be sent wait on the dequeued condition.
+//
+
 struct spindump_remote_client {
-  const char* url;
-  CURL* curl;
+  const char* url;                                  // where to send the blocks
+  unsigned int queueSize;                           // size of the ring, in blocks
+  int blockWhenFull;                                // wait for space (1) or drop new blocks (0)
+  int started;                                      // has the sender thread been started?
+  int closing;                                      // is the sender thread asked to stop?
+  pthread_t sender;                                 // the sender thread
+  CURLM* multi;                                     // the curl multi handle used by the sender
+  struct curl_slist* headers;                       // HTTP headers for all requests
+  pthread_mutex_t lock;                             // protects the fields below
+  pthread_cond_t queued;                            // signaled when a block is put in the ring
+  pthread_cond_t dequeued;                          // signaled when blocks are taken out or sent
+  struct spindump_remote_client_block* ring;        // the ring of blocks waiting to be sent
+  unsigned int head;                                // next position to put a block in
+  unsigned int tail;                                // next position to take a block from
+  unsigned int nQueued;                             // number of blocks in the ring
+  unsigned int nInFlight;                           // number of blocks being sent
+  spindump_counter_32bit maxQueueDepth;             // largest number of blocks queued or being sent
+  spindump_counter_32bit blocksQueued;              // number of blocks given to the client
+  spindump_counter_32bit blocksSent;                // number of blocks successfully sent
+  spindump_counter_32bit blocksFailed;              // number of blocks whose sending failed
+  spindump_counter_32bit blocksDropped;             // number of blocks dropped because the ring was full
+  spindump_counter_64bit sendLatency;               // sum of the times from queueing to sent, in usecs
 };
 
 //
@@ -52,6 +116,10 @@ struct spindump_remote_client {
 struct spindump_remote_client*
 spindump_remote_client_init(const char* url);
 void
+spindump_remote_client_setqueue(struct spindump_remote_client* client,
+                                unsigned int queueSize,
+                                int blockWhenFull);
+void
 spindump_remote_client_update_periodic(struct spindump_remote_client* client,
                                        struct spindump_connectionstable* table);
 void
@@ -60,6 +128,11 @@ spindump_remote_client_update_event(struct spindump_remote_client* client,
                                     unsigned long length,
                                     const uint8_t* data);
 void
+spindump_remote_client_flush(struct spindump_remote_client* client);
+void
+spindump_remote_client_getstats(struct spindump_remote_client* client,
+                                struct spindump_stats* stats);
+void
 spindump_remote_client_close(struct spindump_remote_client* client);
 
 #endif // SPINDUMP_REMOTE_CLIENT_H
@@ -1,4 +1,3 @@
-
 //
 //
 //  ////////////////////////////////////////////////////////////////////////////////////
@@ -26,9 +25,19 @@
 #include <unistd.h>
 #include <limits.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#ifdef SPINDUMP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SPINDUMP_HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "spindump_util.h"
 #include "spindump_remote_file.h"
 #include "spindump_json.h"
@@ -42,17 +51,66 @@
 //
 
 static void
-spindump_remote_file_init_callback(const struct spindump_event* event,
-                                   void* data);
+spindump_remote_file_recordcallback(const struct spindump_event* event,
+                                    void* data);
+static int
+spindump_remote_file_next(struct spindump_remote_file* object);
+static int
+spindump_remote_file_parserecord(struct spindump_remote_file* object);
+static int
+spindump_remote_file_framerecord(struct spindump_remote_file* object,
+                                 size_t* length);
+static int
+spindump_remote_file_peek(struct spindump_remote_file* object);
+static int
+spindump_remote_file_fill(struct spindump_remote_file* object);
+static void
+spindump_remote_file_advise(struct spindump_remote_file* object);
+static int
+spindump_remote_file_readraw(struct spindump_remote_file* object);
+static int
+spindump_remote_file_getraw(struct spindump_remote_file* object,
+                            const uint8_t** data,
+                            size_t* length);
+static void
+spindump_remote_file_consumeraw(struct spindump_remote_file* object,
+                                size_t length);
+static int
+spindump_remote_file_detect(struct spindump_remote_file* object);
+static int
+spindump_remote_file_decode(struct spindump_remote_file* object,
+                            char* output,
+                            size_t space,
+                            size_t* produced);
+#ifdef SPINDUMP_HAVE_ZLIB
+static int
+spindump_remote_file_decode_gzip(struct spindump_remote_file* object,
+                                 char* output,
+                                 size_t space,
+                                 size_t* produced);
+#endif
+#ifdef SPINDUMP_HAVE_ZSTD
+static int
+spindump_remote_file_decode_zstd(struct spindump_remote_file* object,
+                                 char* output,
+                                 size_t space,
+                                 size_t* produced);
+#endif
 
 //
 // Actual code --------------------------------------------------------------------------------
 //
 
 //
-// Create an object to represent perform a server function to listen
-// for requests for Spindump data. Use the "Microhttpd" library to do
-// the actual HTTP/HTTPS server work here.
+// Create an object to represent a JSON file from which events are
+// read. The file is not read here, except for the first event, so
+// that errors at the start of the file are reported right away. The
+// rest of the events are parsed one by one as
+// spindump_remote_file_getupdate asks for them.
+//
+// Files compressed with gzip or zstd are recognised by their magic
+// numbers, and decompressed as they are read, if the necessary
+// library support was available at build time.
 //
 
 struct spindump_remote_file*
@@ -64,11 +122,11 @@ spindump_remote_file_init(const char* filename) {
 
   spindump_assert(filename != 0);
   spindump_deepdebugf("spindump_remote_file_init %s", filename);
-  
+
   //
   // Allocate the object
   //
-  
+
   size_t size = sizeof(struct spindump_remote_file);
   struct spindump_remote_file* object = (struct spindump_remote_file*)spindump_malloc(size);
   if (object == 0) {
@@ -79,154 +137,202 @@ spindump_remote_file_init(const char* filename) {
   //
   // Initialize the object
   //
-  
+
   memset(object,0,sizeof(*object));
-  object->maxEvents = 1000;
-  size = object->maxEvents * sizeof(struct spindump_event);
-  object->events = (struct spindump_event*)spindump_malloc(size);
-  if (object->events == 0) {
-    spindump_errorf("cannot allocate file object of %u bytes", size);
-    return(0);
-  }
-  
+  object->filename = filename;
+  object->fd = -1;
+  long pageSize = sysconf(_SC_PAGESIZE);
+  object->pageSize = pageSize > 0 ? (size_t)pageSize : 4096;
+
   //
   // Open the file
   //
-  
-  object->file = fopen(filename,"r");
-  if (object->file == 0) {
+
+  object->fd = open(filename,O_RDONLY);
+  if (object->fd < 0) {
     spindump_errorf("cannot open JSON file %s", filename);
-    spindump_free(object->events);
-    spindump_free(object);
+    spindump_remote_file_close(object);
     return(0);
   }
 
-  fseek(object->file,0,SEEK_END);
-  size_t fileSize =  (size_t)ftell(object->file);
-  spindump_deepdebugf("spindump_remote_file_init file size = %u", fileSize);
-  fseek(object->file,0,SEEK_SET);
-  
   //
-  // Read the file
+  // Map the file if it is a regular file, and tell the system that
+  // we will read it sequentially
   //
 
-  size = fileSize+1;
-  char* readBuffer  = spindump_malloc(size);
-  if (object->events == 0) {
-    spindump_errorf("cannot allocate file object of %u bytes", size);
-    fclose(object->file);
-    spindump_free(object->events);
-    spindump_free(object);
-    return(0);
-  }
-  memset(readBuffer,0,size);
-  size_t res = fread(readBuffer,1,fileSize,object->file);
-  spindump_deepdeepdebugf("read %u of %u bytes", res, fileSize);
-  if (res != fileSize) {
-    spindump_errorf("cannot read %u bytes of file %s contents", fileSize,filename);
-    fclose(object->file);
-    spindump_free(readBuffer);
-    spindump_free(object->events);
-    spindump_free(object);
-    return(0);
+  struct stat status;
+  if (fstat(object->fd,&status) == 0 &&
+      S_ISREG(status.st_mode) &&
+      status.st_size > 0) {
+    void* map = mmap(0,(size_t)status.st_size,PROT_READ,MAP_PRIVATE,object->fd,0);
+    if (map != MAP_FAILED) {
+      object->map = (uint8_t*)map;
+      object->mapSize = (size_t)status.st_size;
+      madvise(object->map,object->mapSize,MADV_SEQUENTIAL);
+      madvise(object->map,
+              object->mapSize < spindump_remote_file_mapchunk ? object->mapSize : spindump_remote_file_mapchunk,
+              MADV_WILLNEED);
+    } else {
+      spindump_deepdebugf("cannot map JSON file %s: %s, reading it instead", filename, strerror(errno));
+    }
   }
-  spindump_deepdebugf("spindump_remote_file_init read, %u bytes", fileSize);
-  
-  //
-  // Process the read text
-  //
-  
-  const char* readPointer = readBuffer;
-  size_t sizeLeft = fileSize;
-  while (isspace(*readPointer) && sizeLeft > 0) { sizeLeft--; readPointer++; }
-  while (sizeLeft > 0) {
-    spindump_deepdebugf("spindump_remote_file_init reading input from index %u, %u left",
-                        readPointer - readBuffer, sizeLeft);
-    if (spindump_event_parser_json_textparse(&readPointer,
-                                             spindump_remote_file_init_callback,
-                                             object) == 0) {
-      spindump_errorf("parsing error on JSON file %s position %u", filename, fileSize-sizeLeft);
-      fclose(object->file);
-      spindump_free(readBuffer);
-      spindump_free(object->events);
-      spindump_free(object);
+  spindump_deepdebugf("spindump_remote_file_init mapped %u bytes", object->mapSize);
+
+  if (object->map == 0) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(object->fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+    size = spindump_remote_file_rawbuffersize;
+    object->raw = (uint8_t*)spindump_malloc(size);
+    if (object->raw == 0) {
+      spindump_errorf("cannot allocate file buffer of %u bytes", size);
+      spindump_remote_file_close(object);
       return(0);
     }
-    sizeLeft = fileSize - ((size_t)(readPointer - readBuffer));
-    spindump_deepdebugf("spindump_remote_file_init read input, now index %u, %u left, next char %c",
-                        readPointer - readBuffer, sizeLeft, *readPointer);
-    while (isspace(*readPointer) && sizeLeft > 0) { sizeLeft--; readPointer++; }
-    spindump_deepdebugf("spindump_remote_file_init skipped whitespace, now index %u, %u left, next char %c",
-                        readPointer - readBuffer, sizeLeft, *readPointer);
   }
-  
+
   //
-  // Done!
+  // Determine whether the file is compressed
   //
-  
-  spindump_free(readBuffer);
-  spindump_deepdebugf("spindump_remote_file_init done, events %u max %u",
-                      object->nEvents, object->maxEvents);
-  return(object);
-}
-
-//
-// Helper function to receive one JSON / event object
-//
 
-static void
-spindump_remote_file_init_callback(const struct spindump_event* event,
-                                   void* data) {
+  if (!spindump_remote_file_detect(object)) {
+    spindump_remote_file_close(object);
+    return(0);
+  }
 
   //
-  // Sanity checks
+  // Set up the text window. An uncompressed mapped file is parsed
+  // directly from the mapping, otherwise text is placed in a buffer.
   //
-  
-  spindump_deepdebugf("spindump_remote_file_init_callback");
-  spindump_assert(event != 0);
-  spindump_assert(data != 0);
+
+  if (object->compression == spindump_remote_file_compression_none && object->map != 0) {
+    object->text = (const char*)object->map;
+    object->textLength = object->mapSize;
+    object->eof = 1;
+  } else {
+    size = spindump_remote_file_buffersize;
+    object->buffer = (char*)spindump_malloc(size);
+    if (object->buffer == 0) {
+      spindump_errorf("cannot allocate file buffer of %u bytes", size);
+      spindump_remote_file_close(object);
+      return(0);
+    }
+    object->text = object->buffer;
+  }
+
+  size = 4096;
+  object->record = (char*)spindump_malloc(size);
+  if (object->record == 0) {
+    spindump_errorf("cannot allocate record buffer of %u bytes", size);
+    spindump_remote_file_close(object);
+    return(0);
+  }
+  object->recordSize = size;
 
   //
-  // Acquire the necessary objects
+  // Read the first event
   //
 
-  struct spindump_remote_file* object = (struct spindump_remote_file*)data;
+  object->hasEvent = spindump_remote_file_next(object);
+  if (object->error) {
+    spindump_remote_file_close(object);
+    return(0);
+  }
 
   //
-  // More sanity checks
+  // Done!
   //
 
-  spindump_assert(object->events != 0);
-  spindump_assert(object->maxEvents > 0);
-  spindump_assert(object->nEvents <= object->maxEvents);
+  spindump_deepdebugf("spindump_remote_file_init done, compression %u, first event %u",
+                      object->compression, object->hasEvent);
+  return(object);
+}
+
+//
+// Look at the first bytes of the file to see if it is compressed,
+// and set up a decompressor if so.
+//
+
+static int
+spindump_remote_file_detect(struct spindump_remote_file* object) {
 
   //
-  // Do we need more space in the events table?
+  // Get the first bytes
   //
 
-  if (object->nEvents == object->maxEvents) {
-    unsigned int newMaxEvents = object->maxEvents * 2;
-    size_t size = newMaxEvents * sizeof(struct spindump_event);
-    struct spindump_event* newEvents = (struct spindump_event*)spindump_malloc(size);
-    if (newEvents == 0) {
-      spindump_errorf("cannot allocate %u bytes for events from a JSON file", size);
-      return;
+  static const uint8_t gzipMagic[2] = { 0x1f, 0x8b };
+  static const uint8_t zstdMagic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+  const uint8_t* data;
+  size_t length;
+  if (object->map == 0) {
+    while (object->rawLength - object->rawOffset < sizeof(zstdMagic) && !object->rawEof) {
+      if (!spindump_remote_file_readraw(object)) return(0);
     }
-    memcpy(newEvents,object->events,object->maxEvents  * sizeof(struct spindump_event));
-    spindump_free(object->events);
-    object->events = newEvents;
-    object->maxEvents = newMaxEvents;
   }
+  if (!spindump_remote_file_getraw(object,&data,&length)) return(0);
 
   //
-  // Add the event to the table
+  // Check for the compression formats
   //
 
-  spindump_deepdeepdebugf("adding a new event (%uth) to the event table of JSON file events for timestamp %llu",
-                          object->nEvents+1,
-                          event->timestamp);
-  spindump_assert(object->nEvents < object->maxEvents);
-  object->events[object->nEvents++] = *event;
+  if (length >= sizeof(gzipMagic) && memcmp(data,gzipMagic,sizeof(gzipMagic)) == 0) {
+    object->compression = spindump_remote_file_compression_gzip;
+#ifdef SPINDUMP_HAVE_ZLIB
+    z_stream* stream = (z_stream*)spindump_malloc(sizeof(z_stream));
+    if (stream == 0) {
+      spindump_errorf("cannot allocate a decompressor of %lu bytes", (unsigned long)sizeof(z_stream));
+      return(0);
+    }
+    memset(stream,0,sizeof(*stream));
+    if (inflateInit2(stream,15 + 32) != Z_OK) {
+      spindump_errorf("cannot initialize decompression for JSON file %s", object->filename);
+      spindump_free(stream);
+      return(0);
+    }
+    object->decompressor = stream;
+#else
+    spindump_errorf("JSON file %s is gzip-compressed, but gzip support is not available",
+                    object->filename);
+    return(0);
+#endif
+  } else if (length >= sizeof(zstdMagic) && memcmp(data,zstdMagic,sizeof(zstdMagic)) == 0) {
+    object->compression = spindump_remote_file_compression_zstd;
+#ifdef SPINDUMP_HAVE_ZSTD
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    if (stream == 0 || ZSTD_isError(ZSTD_initDStream(stream))) {
+      spindump_errorf("cannot initialize decompression for JSON file %s", object->filename);
+      if (stream != 0) ZSTD_freeDStream(stream);
+      return(0);
+    }
+    object->decompressor = stream;
+#else
+    spindump_errorf("JSON file %s is zstd-compressed, but zstd support is not available",
+                    object->filename);
+    return(0);
+#endif
+  } else {
+    object->compression = spindump_remote_file_compression_none;
+  }
+
+  return(1);
+}
+
+//
+// Return the compression formats that this build can read, for
+// telling the user, or an empty string if there are none
+//
+
+const char*
+spindump_remote_file_compressions(void) {
+#if defined(SPINDUMP_HAVE_ZLIB) && defined(SPINDUMP_HAVE_ZSTD)
+  return("gzip or zstd");
+#elif defined(SPINDUMP_HAVE_ZLIB)
+  return("gzip");
+#elif defined(SPINDUMP_HAVE_ZSTD)
+  return("zstd");
+#else
+  return("");
+#endif
 }
 
 //
@@ -236,16 +342,33 @@ spindump_remote_file_init_callback(const struct spindump_event* event,
 void
 spindump_remote_file_close(struct spindump_remote_file* object) {
   spindump_assert(object != 0);
-  if (object->file != 0) fclose(object->file);
-  if (object->events != 0) spindump_free(object->events);
+#ifdef SPINDUMP_HAVE_ZLIB
+  if (object->compression == spindump_remote_file_compression_gzip &&
+      object->decompressor != 0) {
+    inflateEnd((z_stream*)object->decompressor);
+    spindump_free(object->decompressor);
+  }
+#endif
+#ifdef SPINDUMP_HAVE_ZSTD
+  if (object->compression == spindump_remote_file_compression_zstd &&
+      object->decompressor != 0) {
+    ZSTD_freeDStream((ZSTD_DStream*)object->decompressor);
+  }
+#endif
+  if (object->map != 0) munmap(object->map,object->mapSize);
+  if (object->fd >= 0) close(object->fd);
+  if (object->raw != 0) spindump_free(object->raw);
+  if (object->buffer != 0) spindump_free(object->buffer);
+  if (object->record != 0) spindump_free(object->record);
   spindump_free(object);
 }
 
 //
-// The file object queues up events reported by others in an
-// internal data structure.
-// The spindump_remote_file_getupdate function pulls one such
-// reported event from the server queue and lets the caller handle it.
+// The file object holds the next event from the file. The
+// spindump_remote_file_getupdate function lets the caller handle
+// that event, and then parses the one after it. Returns 1 if an
+// event was handled, and 0 if the file has ended or an error has
+// occurred. In the latter case, object->error is set.
 //
 
 int
@@ -260,22 +383,474 @@ spindump_remote_file_getupdate(struct spindump_remote_file* object,
   spindump_deepdebugf("spindump_remote_file_getupdate");
   spindump_assert(object != 0);
   spindump_assert(analyzer != 0);
-  
+
+  //
+  // Check if there is an event for us to take
   //
-  // Check if there is items for us to take
+
+  if (!object->hasEvent) return(0);
+
+  struct spindump_connection* connection = 0;
+  spindump_timestamp_to_timeval(object->event.timestamp,timestamp);
+  spindump_deepdeepdebugf("spindump_remote_file_getupdate reading timestamp %llu from file",
+                          object->event.timestamp);
+  spindump_analyze_processevent(analyzer,&object->event,&connection);
+
   //
+  // Get the next one
+  //
+
+  object->hasEvent = spindump_remote_file_next(object);
+  return(1);
+}
+
+//
+// Parse the next event from the file into object->event. The file
+// may hold an array of records, records without an array, or several
+// arrays. Returns 1 if an event was read, and 0 at the end of the
+// file or upon error.
+//
 
-  if (object->nEvents > 0) {
-    for (unsigned int i = 0; i < object->nEvents; i++) {
-      const struct spindump_event* event = &object->events[i];
-      struct spindump_connection* connection = 0;
-      spindump_timestamp_to_timeval(event->timestamp,timestamp);
-      spindump_deepdeepdebugf("spindump_remote_file_getupdate reading timestamp %llu from callback", event->timestamp);
-      spindump_analyze_processevent(analyzer,event,&connection);
+static int
+spindump_remote_file_next(struct spindump_remote_file* object) {
+  for (;;) {
+    int c = spindump_remote_file_peek(object);
+    if (object->error) return(0);
+    if (c < 0) {
+      if (object->inArray) {
+        spindump_errorf("JSON file %s ends without a closing bracket", object->filename);
+        object->error = 1;
+      }
+      return(0);
+    }
+    if (object->inArray) {
+      if (c == ']' && !object->afterComma) {
+        object->textOffset++;
+        object->inArray = 0;
+        object->afterElement = 0;
+        continue;
+      }
+      if (object->afterElement) {
+        if (c != ',') {
+          spindump_errorf("expected a comma or a closing bracket in JSON file %s position %llu",
+                          object->filename, object->position + object->textOffset);
+          object->error = 1;
+          return(0);
+        }
+        object->textOffset++;
+        object->afterElement = 0;
+        object->afterComma = 1;
+        continue;
+      }
+    } else if (c == '[') {
+      object->textOffset++;
+      object->inArray = 1;
+      continue;
+    }
+    if (!spindump_remote_file_parserecord(object)) {
+      object->error = 1;
+      return(0);
+    }
+    object->afterComma = 0;
+    if (object->inArray) object->afterElement = 1;
+    if (object->gotEvent) return(1);
+  }
+}
+
+//
+// Parse one record at the current position of the file
+//
+
+static int
+spindump_remote_file_parserecord(struct spindump_remote_file* object) {
+
+  //
+  // Find where the record ends
+  //
+
+  size_t length;
+  unsigned long long position = object->position + object->textOffset;
+  if (!spindump_remote_file_framerecord(object,&length)) return(0);
+  spindump_assert(length > 0);
+  spindump_assert(object->textOffset + length <= object->textLength);
+
+  //
+  // Copy it to the NUL-terminated record buffer
+  //
+
+  if (length >= object->recordSize) {
+    size_t newSize = object->recordSize;
+    while (newSize <= length) newSize *= 2;
+    char* newRecord = (char*)spindump_malloc(newSize);
+    if (newRecord == 0) {
+      spindump_errorf("cannot allocate record buffer of %u bytes", newSize);
+      return(0);
     }
-    object->nEvents = 0;
+    spindump_free(object->record);
+    object->record = newRecord;
+    object->recordSize = newSize;
+  }
+  memcpy(object->record,object->text + object->textOffset,length);
+  object->record[length] = 0;
+
+  //
+  // Parse it
+  //
+
+  const char* input = object->record;
+  object->gotEvent = 0;
+  if (spindump_event_parser_json_streamparse(&input,
+                                             spindump_remote_file_recordcallback,
+                                             object) == 0) {
+    spindump_errorf("parsing error on JSON file %s position %llu", object->filename, position);
+    return(0);
+  }
+  object->textOffset += length;
+  spindump_remote_file_advise(object);
+  return(1);
+}
+
+//
+// Helper function to receive one JSON / event object
+//
+
+static void
+spindump_remote_file_recordcallback(const struct spindump_event* event,
+                                    void* data) {
+  spindump_assert(event != 0);
+  spindump_assert(data != 0);
+  struct spindump_remote_file* object = (struct spindump_remote_file*)data;
+  spindump_deepdeepdebugf("read an event from JSON file for timestamp %llu", event->timestamp);
+  object->event = *event;
+  object->gotEvent = 1;
+}
+
+//
+// Find the length of the record that starts at the current
+// position, by matching braces outside strings (a backslash escapes
+// the next character within a string). Reads more of the
+// file as needed. If the position does not start a record, or the
+// file ends in the middle of one, the returned text is passed to the
+// parser anyway, for it to report the error.
+//
+
+static int
+spindump_remote_file_framerecord(struct spindump_remote_file* object,
+                                 size_t* length) {
+  spindump_assert(object->textOffset < object->textLength);
+  if (object->text[object->textOffset] != '{') {
+    *length = 1;
     return(1);
+  }
+  size_t scanned = 0;
+  unsigned int depth = 0;
+  int inString = 0;
+  int escaped = 0;
+  for (;;) {
+    const char* start = object->text + object->textOffset;
+    size_t available = object->textLength - object->textOffset;
+    while (scanned < available && scanned <= spindump_remote_file_maxrecord) {
+      char c = start[scanned++];
+      if (escaped) {
+        escaped = 0;
+      } else if (inString) {
+        if (c == '\\') escaped = 1;
+        else if (c == '"') inString = 0;
+      } else if (c == '"') {
+        inString = 1;
+      } else if (c == '{') {
+        depth++;
+      } else if (c == '}' && --depth == 0) {
+        *length = scanned;
+        return(1);
+      }
+    }
+    if (scanned > spindump_remote_file_maxrecord) {
+      spindump_errorf("JSON record too long in file %s position %llu",
+                      object->filename, object->position + object->textOffset);
+      return(0);
+    }
+    if (!spindump_remote_file_fill(object)) {
+      if (object->error) return(0);
+      *length = scanned;
+      return(1);
+    }
+  }
+}
+
+//
+// Skip whitespace and return the next character without consuming
+// it. Returns -1 at the end of the file or upon error.
+//
+
+static int
+spindump_remote_file_peek(struct spindump_remote_file* object) {
+  for (;;) {
+    while (object->textOffset < object->textLength) {
+      unsigned char c = (unsigned char)object->text[object->textOffset];
+      if (!isspace(c)) return(c);
+      object->textOffset++;
+    }
+    if (!spindump_remote_file_fill(object)) return(-1);
+  }
+}
+
+//
+// Add more text to the window buffer, moving the unconsumed text to
+// the beginning of the buffer first. Returns 1 if text was added, and
+// 0 at the end of the file, when the buffer is full, or upon error.
+//
+
+static int
+spindump_remote_file_fill(struct spindump_remote_file* object) {
+  if (object->eof || object->error) return(0);
+  spindump_assert(object->buffer != 0);
+  if (object->textOffset > 0) {
+    memmove(object->buffer,
+            object->buffer + object->textOffset,
+            object->textLength - object->textOffset);
+    object->textLength -= object->textOffset;
+    object->position += object->textOffset;
+    object->textOffset = 0;
+  }
+  if (object->textLength == spindump_remote_file_buffersize) return(0);
+  size_t produced = 0;
+  if (!spindump_remote_file_decode(object,
+                                   object->buffer + object->textLength,
+                                   spindump_remote_file_buffersize - object->textLength,
+                                   &produced)) {
+    object->error = 1;
+    return(0);
+  }
+  if (produced == 0) {
+    object->eof = 1;
+    return(0);
+  }
+  object->textLength += produced;
+  return(1);
+}
+
+//
+// As the reading progresses through a mapped file, release the pages
+// already read, and ask for the next ones to be read ahead. This
+// keeps the memory use flat for large files.
+//
+
+static void
+spindump_remote_file_advise(struct spindump_remote_file* object) {
+  if (object->map == 0) return;
+  size_t consumed =
+    object->compression == spindump_remote_file_compression_none ?
+    object->textOffset :
+    object->mapOffset;
+  if (consumed < object->mapReleased + spindump_remote_file_mapchunk) return;
+  size_t release = consumed - consumed % object->pageSize;
+  madvise(object->map + object->mapReleased,release - object->mapReleased,MADV_DONTNEED);
+  object->mapReleased = release;
+  size_t ahead = object->mapSize - release;
+  if (ahead > spindump_remote_file_mapchunk) ahead = spindump_remote_file_mapchunk;
+  if (ahead > 0) madvise(object->map + release,ahead,MADV_WILLNEED);
+  spindump_deepdebugf("released JSON file mapping up to %u", release);
+}
+
+//
+// Read more of an unmapped file to the raw input buffer
+//
+
+static int
+spindump_remote_file_readraw(struct spindump_remote_file* object) {
+  spindump_assert(object->raw != 0);
+  if (object->rawOffset > 0) {
+    memmove(object->raw,
+            object->raw + object->rawOffset,
+            object->rawLength - object->rawOffset);
+    object->rawLength -= object->rawOffset;
+    object->rawOffset = 0;
+  }
+  ssize_t result;
+  do {
+    result = read(object->fd,
+                  object->raw + object->rawLength,
+                  spindump_remote_file_rawbuffersize - object->rawLength);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) {
+    spindump_errorf("cannot read JSON file %s: %s", object->filename, strerror(errno));
+    return(0);
+  }
+  if (result == 0) object->rawEof = 1;
+  object->rawLength += (size_t)result;
+  return(1);
+}
+
+//
+// Get the input that has not yet been decoded, either from the
+// mapping or the raw input buffer. A zero length means the end of the
+// file.
+//
+
+static int
+spindump_remote_file_getraw(struct spindump_remote_file* object,
+                            const uint8_t** data,
+                            size_t* length) {
+  if (object->map != 0) {
+    *data = object->map + object->mapOffset;
+    *length = object->mapSize - object->mapOffset;
+    return(1);
+  }
+  if (object->rawOffset == object->rawLength && !object->rawEof) {
+    if (!spindump_remote_file_readraw(object)) return(0);
+  }
+  *data = object->raw + object->rawOffset;
+  *length = object->rawLength - object->rawOffset;
+  return(1);
+}
+
+//
+// Mark input as decoded
+//
+
+static void
+spindump_remote_file_consumeraw(struct spindump_remote_file* object,
+                                size_t length) {
+  if (object->map != 0) {
+    spindump_assert(object->mapOffset + length <= object->mapSize);
+    object->mapOffset += length;
   } else {
+    spindump_assert(object->rawOffset + length <= object->rawLength);
+    object->rawOffset += length;
+  }
+}
+
+//
+// Decode at most space bytes of text from the file. Sets produced to
+// zero at the end of the file.
+//
+
+static int
+spindump_remote_file_decode(struct spindump_remote_file* object,
+                            char* output,
+                            size_t space,
+                            size_t* produced) {
+  switch (object->compression) {
+
+  case spindump_remote_file_compression_none:
+    {
+      const uint8_t* data;
+      size_t length;
+      if (!spindump_remote_file_getraw(object,&data,&length)) return(0);
+      if (length > space) length = space;
+      memcpy(output,data,length);
+      spindump_remote_file_consumeraw(object,length);
+      *produced = length;
+      return(1);
+    }
+
+#ifdef SPINDUMP_HAVE_ZLIB
+  case spindump_remote_file_compression_gzip:
+    return(spindump_remote_file_decode_gzip(object,output,space,produced));
+#endif
+
+#ifdef SPINDUMP_HAVE_ZSTD
+  case spindump_remote_file_compression_zstd:
+    return(spindump_remote_file_decode_zstd(object,output,space,produced));
+#endif
+
+  default:
+    spindump_errorf("invalid internal compression type %u", object->compression);
     return(0);
   }
 }
+
+#ifdef SPINDUMP_HAVE_ZLIB
+
+//
+// Decompress gzip input. Several concatenated gzip members are
+// decompressed one after another.
+//
+
+static int
+spindump_remote_file_decode_gzip(struct spindump_remote_file* object,
+                                 char* output,
+                                 size_t space,
+                                 size_t* produced) {
+  z_stream* stream = (z_stream*)object->decompressor;
+  spindump_assert(stream != 0);
+  if (space > UINT_MAX) space = UINT_MAX;
+  for (;;) {
+    const uint8_t* data;
+    size_t length;
+    if (!spindump_remote_file_getraw(object,&data,&length)) return(0);
+    if (length == 0 && !object->midFrame) {
+      *produced = 0;
+      return(1);
+    }
+    if (length > UINT_MAX) length = UINT_MAX;
+    stream->next_in = (Bytef*)data;
+    stream->avail_in = (uInt)length;
+    stream->next_out = (Bytef*)output;
+    stream->avail_out = (uInt)space;
+    int result = inflate(stream,Z_NO_FLUSH);
+    spindump_remote_file_consumeraw(object,length - stream->avail_in);
+    *produced = space - stream->avail_out;
+    if (result == Z_STREAM_END) {
+      inflateReset(stream);
+      object->midFrame = 0;
+    } else if (result == Z_OK || result == Z_BUF_ERROR) {
+      object->midFrame = 1;
+    } else {
+      spindump_errorf("cannot decompress JSON file %s: %s",
+                      object->filename, stream->msg != 0 ? stream->msg : "unknown error");
+      return(0);
+    }
+    if (*produced > 0) return(1);
+    if (length == 0) {
+      spindump_errorf("compressed JSON file %s is truncated", object->filename);
+      return(0);
+    }
+  }
+}
+
+#endif
+
+#ifdef SPINDUMP_HAVE_ZSTD
+
+//
+// Decompress zstd input. Several concatenated zstd frames are
+// decompressed one after another.
+//
+
+static int
+spindump_remote_file_decode_zstd(struct spindump_remote_file* object,
+                                 char* output,
+                                 size_t space,
+                                 size_t* produced) {
+  ZSTD_DStream* stream = (ZSTD_DStream*)object->decompressor;
+  spindump_assert(stream != 0);
+  for (;;) {
+    const uint8_t* data;
+    size_t length;
+    if (!spindump_remote_file_getraw(object,&data,&length)) return(0);
+    if (length == 0 && !object->midFrame) {
+      *produced = 0;
+      return(1);
+    }
+    ZSTD_inBuffer in = { data, length, 0 };
+    ZSTD_outBuffer out = { output, space, 0 };
+    size_t result = ZSTD_decompressStream(stream,&out,&in);
+    if (ZSTD_isError(result)) {
+      spindump_errorf("cannot decompress JSON file %s: %s",
+                      object->filename, ZSTD_getErrorName(result));
+      return(0);
+    }
+    spindump_remote_file_consumeraw(object,in.pos);
+    *produced = out.pos;
+    object->midFrame = (result != 0);
+    if (*produced > 0) return(1);
+    if (length == 0) {
+      spindump_errorf("compressed JSON file %s is truncated", object->filename);
+      return(0);
+    }
+  }
+}
+
+#endif
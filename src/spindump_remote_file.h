@@ -27,6 +27,7 @@
 #include "spindump_util.h"
 #include "spindump_protocols.h"
 #include "spindump_table.h"
+#include "spindump_event.h"
 #include "spindump_eventformatter.h"
 #include "spindump_json.h"
 
@@ -34,15 +35,62 @@
 // Parameters ---------------------------------------------------------------------------------
 //
 
+#define spindump_remote_file_buffersize    (1024*1024)
+#define spindump_remote_file_rawbuffersize (64*1024)
+#define spindump_remote_file_maxrecord     (256*1024)
+#define spindump_remote_file_mapchunk      (8*1024*1024)
+
 //
 // Data structures ----------------------------------------------------------------------------
 //
 
+enum spindump_remote_file_compression {
+  spindump_remote_file_compression_none = 0,
+  spindump_remote_file_compression_gzip = 1,
+  spindump_remote_file_compression_zstd = 2
+};
+
+//
+// The file object reads events lazily, one record at a time. A
+// regular file is mapped to memory, and if it is not compressed,
+// the records are parsed directly from the mapping. Compressed files
+// and files that can not be mapped (such as pipes) are decompressed
+// or read into a window buffer of spindump_remote_file_buffersize
+// bytes. Either way, the memory used does not depend on the size of
+// the file.
+//
+
 struct spindump_remote_file {
-  FILE* file;
-  unsigned int nEvents;
-  unsigned int maxEvents;
-  struct spindump_event* events;
+  const char* filename;
+  int fd;
+  enum spindump_remote_file_compression compression;
+  uint8_t* map;                      // the mapped file, or 0 if read with read()
+  size_t mapSize;
+  size_t mapOffset;                  // compressed input consumed from the mapping
+  size_t mapReleased;                // pages before this have been released
+  size_t pageSize;
+  uint8_t* raw;                      // input read with read(), if not mapped
+  size_t rawLength;
+  size_t rawOffset;
+  int rawEof;
+  int eof;
+  void* decompressor;                // z_stream or ZSTD_DStream
+  int midFrame;
+  int error;
+  char* buffer;                      // window of decompressed or read text
+  const char* text;                  // the current text, buffer or map
+  size_t textLength;
+  size_t textOffset;
+  unsigned long long position;       // position of text[0] in the (decompressed) file
+  char* record;                      // copy of the record being parsed
+  size_t recordSize;
+  int inArray;
+  int afterElement;
+  int afterComma;
+  int hasEvent;
+  int gotEvent;
+  unsigned int padding;              // unused
+  struct spindump_event event;       // the next event to hand out
 };
 
 //
@@ -57,5 +105,7 @@ spindump_remote_file_getupdate(struct spindump_remote_file* file,
                                struct timeval* timestamp);
 void
 spindump_remote_file_close(struct spindump_remote_file* file);
+const char*
+spindump_remote_file_compressions(void);
 
 #endif // SPINDUMP_REMOTE_FILE_H
@@ -0,0 +1,164 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "spindump_util.h"
+#include "spindump_event.h"
+#include "spindump_remote_queue.h"
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Create a queue with room for size events. The size must be a power
+// of two.
+//
+
+struct spindump_remote_queue*
+spindump_remote_queue_initialize(unsigned int size) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(size >= 2);
+  spindump_assert((size & (size - 1)) == 0);
+
+  //
+  // Allocate the queue and its slots
+  //
+
+  struct spindump_remote_queue* queue =
+    (struct spindump_remote_queue*)spindump_malloc(sizeof(struct spindump_remote_queue));
+  if (queue == 0) {
+    spindump_errorf("cannot allocate an event queue of %lu bytes", (unsigned long)sizeof(struct spindump_remote_queue));
+    return(0);
+  }
+  memset(queue,0,sizeof(*queue));
+  unsigned long slotsSize = size * sizeof(struct spindump_remote_queue_slot);
+  queue->slots = (struct spindump_remote_queue_slot*)spindump_malloc(slotsSize);
+  if (queue->slots == 0) {
+    spindump_errorf("cannot allocate event queue slots of %lu bytes", slotsSize);
+    spindump_free(queue);
+    return(0);
+  }
+
+  //
+  // Initialize
+  //
+
+  queue->size = size;
+  atomic_init(&queue->tail,0);
+  atomic_init(&queue->head,0);
+  for (unsigned int i = 0; i < size; i++) {
+    atomic_init(&queue->slots[i].sequence,i);
+  }
+  return(queue);
+}
+
+//
+// Claim count consecutive positions in the queue, for the caller to
+// fill with spindump_remote_queue_put. Returns 0 if there is not
+// enough space for all of them, and 1 and the first position
+// otherwise. Every claimed position must be filled, as the consumer
+// takes events in order.
+//
+
+int
+spindump_remote_queue_reserve(struct spindump_remote_queue* queue,
+                              unsigned int count,
+                              unsigned int* position) {
+  spindump_assert(queue != 0);
+  spindump_assert(position != 0);
+  if (count > queue->size) return(0);
+  unsigned int tail = atomic_load_explicit(&queue->tail,memory_order_relaxed);
+  while (1) {
+    unsigned int head = atomic_load_explicit(&queue->head,memory_order_acquire);
+    if (tail - head > queue->size - count) return(0);
+    if (atomic_compare_exchange_weak_explicit(&queue->tail,&tail,tail + count,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed)) {
+      *position = tail;
+      return(1);
+    }
+  }
+}
+
+//
+// Fill a claimed position with an event, and make it available to
+// the consumer
+//
+
+void
+spindump_remote_queue_put(struct spindump_remote_queue* queue,
+                          unsigned int position,
+                          const struct spindump_event* event) {
+  spindump_assert(queue != 0);
+  spindump_assert(event != 0);
+  struct spindump_remote_queue_slot* slot = &queue->slots[position & (queue->size - 1)];
+  spindump_assert(atomic_load_explicit(&slot->sequence,memory_order_acquire) == position);
+  slot->event = *event;
+  atomic_store_explicit(&slot->sequence,position + 1,memory_order_release);
+}
+
+//
+// Look at the next event in the queue, without taking it out. Returns
+// 0 if the queue is empty, or the next position has been claimed but
+// not yet filled. Called by the consumer only.
+//
+
+const struct spindump_event*
+spindump_remote_queue_peek(struct spindump_remote_queue* queue) {
+  spindump_assert(queue != 0);
+  unsigned int head = atomic_load_explicit(&queue->head,memory_order_relaxed);
+  struct spindump_remote_queue_slot* slot = &queue->slots[head & (queue->size - 1)];
+  if (atomic_load_explicit(&slot->sequence,memory_order_acquire) != head + 1) return(0);
+  return(&slot->event);
+}
+
+//
+// Take out the event returned by spindump_remote_queue_peek, and free
+// its slot for producers. Called by the consumer only.
+//
+
+void
+spindump_remote_queue_pop(struct spindump_remote_queue* queue) {
+  spindump_assert(queue != 0);
+  unsigned int head = atomic_load_explicit(&queue->head,memory_order_relaxed);
+  struct spindump_remote_queue_slot* slot = &queue->slots[head & (queue->size - 1)];
+  spindump_assert(atomic_load_explicit(&slot->sequence,memory_order_relaxed) == head + 1);
+  atomic_store_explicit(&slot->sequence,head + queue->size,memory_order_release);
+  atomic_store_explicit(&queue->head,head + 1,memory_order_release);
+}
+
+//
+// Free the queue. Any events still in it are lost.
+//
+
+void
+spindump_remote_queue_uninitialize(struct spindump_remote_queue* queue) {
+  spindump_assert(queue != 0);
+  spindump_free(queue->slots);
+  spindump_free(queue);
+}
@@ -0,0 +1,96 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+#ifndef SPINDUMP_REMOTE_QUEUE_H
+#define SPINDUMP_REMOTE_QUEUE_H
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <stdatomic.h>
+#include "spindump_util.h"
+#include "spindump_event.h"
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_remote_queue_cachelinesize 64 // bytes
+
+//
+// Data structures ----------------------------------------------------------------------------
+//
+
+//
+// One slot in the queue. The sequence number tells whether the slot
+// is free for the producer that claimed position p (sequence is p),
+// or holds an event for the consumer at position p (sequence is p+1).
+//
+
+struct spindump_remote_queue_slot {
+  atomic_uint sequence;                        // written by producers and the consumer
+  uint8_t padding[4];                          // unused padding to align the next field properly
+  struct spindump_event event;                 // written by a producer, read by the consumer
+};
+
+//
+// A bounded multi-producer, single-consumer queue of events. The
+// producers claim a run of positions by advancing the tail with a
+// compare-and-swap, fill the slots, and then publish each slot by
+// setting its sequence number. The consumer is the only writer of the
+// head. No locks are used. A producer that can not claim all the
+// positions it needs gets nothing, so that a batch of events is
+// either queued as a whole or not at all.
+//
+// The positions are free-running unsigned counters, and only their
+// differences are used, so they can wrap around.
+//
+
+struct spindump_remote_queue {
+  unsigned int size;                           // number of slots, a power of two
+  uint8_t padding1[spindump_remote_queue_cachelinesize - sizeof(unsigned int)];
+  atomic_uint tail;                            // written by producers, read by all
+  uint8_t padding2[spindump_remote_queue_cachelinesize - sizeof(atomic_uint)];
+  atomic_uint head;                            // written by the consumer, read by producers
+  uint8_t padding3[spindump_remote_queue_cachelinesize - sizeof(atomic_uint)];
+  struct spindump_remote_queue_slot* slots;
+};
+
+//
+// External API interface to this module ------------------------------------------------------
+//
+
+struct spindump_remote_queue*
+spindump_remote_queue_initialize(unsigned int size);
+int
+spindump_remote_queue_reserve(struct spindump_remote_queue* queue,
+                              unsigned int count,
+                              unsigned int* position);
+void
+spindump_remote_queue_put(struct spindump_remote_queue* queue,
+                          unsigned int position,
+                          const struct spindump_event* event);
+const struct spindump_event*
+spindump_remote_queue_peek(struct spindump_remote_queue* queue);
+void
+spindump_remote_queue_pop(struct spindump_remote_queue* queue);
+void
+spindump_remote_queue_uninitialize(struct spindump_remote_queue* queue);
+
+#endif // SPINDUMP_REMOTE_QUEUE_H
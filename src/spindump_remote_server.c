@@ -35,6 +35,7 @@
 #include "spindump_json_value.h"
 #include "spindump_event.h"
 #include "spindump_event_parser_json.h"
+#include "spindump_event_parser_binary.h"
 #include "spindump_analyze.h"
 
 //
@@ -51,6 +52,17 @@
 #define MHDRESULT int
 #endif
 
+//
+// Let the library pick the best available polling method (epoll on
+// Linux) for its internal threads, if it is recent enough to do so
+//
+
+#if (MHD_VERSION >= 0x00095300)
+#define MHDFLAGS MHD_USE_AUTO_INTERNAL_THREAD
+#else
+#define MHDFLAGS MHD_USE_SELECT_INTERNALLY
+#endif
+
 //
 // Function prototypes ------------------------------------------------------------------------
 //
@@ -70,10 +82,15 @@ spindump_remote_server_getconnectionobject(struct spindump_remote_server* server
 static void
 spindump_remote_server_releaseconnectionobject(struct spindump_remote_server* server,
                                                struct spindump_remote_connection* connection);
+static unsigned int
+spindump_remote_server_getshard(struct spindump_remote_server* server,
+                                const char* identifier);
 static MHDRESULT
 spindump_remote_server_answer_error(struct MHD_Connection *connection,
                                     unsigned int code,
                                     char* why);
+static MHDRESULT
+spindump_remote_server_answer_busy(struct MHD_Connection *connection);
 static void
 spindump_remote_server_printparameters(struct MHD_Connection *connection);
 static MHDRESULT
@@ -104,9 +121,11 @@ spindump_remote_server_adddata(struct spindump_remote_connection* connectionObje
                                const char* data,
                                size_t length);
 static void
-spindump_remote_server_jsonrecordorarraycallback(const struct spindump_json_value* value,
-                                                 const struct spindump_json_schema* type,
-                                                 void* data);
+spindump_remote_server_eventcallback(const struct spindump_event* event,
+                                     void* data);
+static int
+spindump_remote_server_queueevents(struct spindump_remote_server* server,
+                                   struct spindump_remote_connection* connectionObject);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -115,11 +134,20 @@ spindump_remote_server_jsonrecordorarraycallback(const struct spindump_json_valu
 //
 // Create an object to represent perform a server function to listen
 // for requests for Spindump data. Use the "Microhttpd" library to do
-// the actual HTTP/HTTPS server work here.
+// the actual HTTP/HTTPS server work here, in a pool of the given
+// number of threads. Each thread parses the submissions it receives.
 //
 
 struct spindump_remote_server*
-spindump_remote_server_init(spindump_port port) {
+spindump_remote_server_init(spindump_port port,
+                            unsigned int threads) {
+
+  //
+  // Sanity checks
+  //
+
+  spindump_assert(threads >= 1);
+  spindump_assert(threads <= SPINDUMP_REMOTE_SERVER_MAXTHREADS);
 
   //
   // Allocate the object
@@ -138,25 +166,30 @@ spindump_remote_server_init(spindump_port port) {
   
   memset(server,0,sizeof(*server));
   server->listenport = port;
-  server->schema = *spindump_event_parser_json_getschema();
-  server->schema.callback = spindump_remote_server_jsonrecordorarraycallback;
   server->exit = 0;
-  server->nextAddItemIndex = 0;
-  server->nextConsumeItemIndex = 0;
-  memset(&server->items[0],0,sizeof(server->items));
+  server->nShards = threads;
+  server->nextShard = 0;
+  for (unsigned int i = 0; i < server->nShards; i++) {
+    server->shards[i] = spindump_remote_queue_initialize(SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS);
+    if (server->shards[i] == 0) {
+      spindump_remote_server_close(server);
+      return(0);
+    }
+  }
 
   //
   // Kick the server going
   //
 
-  server->daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, server->listenport,
+  server->daemon = MHD_start_daemon(MHDFLAGS, server->listenport,
                                     NULL, NULL,
                                     spindump_remote_server_answer, server,
                                     MHD_OPTION_NOTIFY_COMPLETED, &spindump_remote_server_requestcompleted, server,
+                                    MHD_OPTION_THREAD_POOL_SIZE, threads,
                                     MHD_OPTION_END);
   if (server->daemon == 0) {
     spindump_errorf("cannot open a server daemon on port %u", server->listenport);
-    spindump_free(server);
+    spindump_remote_server_close(server);
     return(0);
   }
   
@@ -176,28 +209,22 @@ spindump_remote_server_close(struct spindump_remote_server* server) {
   spindump_assert(server != 0);
   spindump_assert(server->exit == 0);
   server->exit = 1;
-  for (unsigned int i = 0; i < SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONS; i++) {
-    struct spindump_remote_connection* client = &server->clients[i];
-    if (client->active) {
-      client->active = 0;
-    }
-  }
   if (server->daemon != 0) {
     MHD_stop_daemon(server->daemon);
   }
-  for (unsigned i = 0; i < SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS; i++) {
-    if (server->items[i] != 0) {
-      spindump_json_value_free(server->items[i]);
-    }
+  for (unsigned int i = 0; i < server->nShards; i++) {
+    if (server->shards[i] != 0) spindump_remote_queue_uninitialize(server->shards[i]);
   }
   spindump_free(server);
 }
 
 //
 // The server object queues up events reported by others in an
-// internal data structure, as the web events come in another thread.
+// internal data structure, as the web events come in other threads.
 // The spindump_remote_server_getupdate function pulls one such
-// reported event from the server queue and lets the caller handle it.
+// reported event from the server queues and lets the caller handle
+// it. The shards are taken in turns, so that a busy shard does not
+// hold back the others.
 //
 
 int
@@ -211,39 +238,34 @@ spindump_remote_server_getupdate(struct spindump_remote_server* server,
   spindump_assert(server != 0);
   spindump_assert(analyzer != 0);
   spindump_assert(server->exit == 0);
-  //spindump_deepdeepdebugf("spindump_remote_server_getupdate %u %u", server->nextConsumeItemIndex, server->nextAddItemIndex);
   
   //
   // Check if there is items for us to take
   //
   
-  if (server->nextConsumeItemIndex < server->nextAddItemIndex) {
-    unsigned int index = server->nextConsumeItemIndex++ % SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS;
-    spindump_deepdeepdebugf("spindump_remote_server_getupdate took an item %u", index);
-    struct spindump_json_value* value = server->items[index];
-    struct spindump_event event;
-    int ans = spindump_event_parser_json_parse(value,&event);
-    if (ans) {
-      struct spindump_connection* connection = 0;
-      spindump_analyze_processevent(analyzer,&event,&connection);
-    } else {
-      spindump_errorf("Cannot convert JSON value into an event");
-    }
+  for (unsigned int i = 0; i < server->nShards; i++) {
+    unsigned int shard = (server->nextShard + i) % server->nShards;
+    struct spindump_remote_queue* queue = server->shards[shard];
+    const struct spindump_event* event = spindump_remote_queue_peek(queue);
+    if (event == 0) continue;
+    spindump_deepdeepdebugf("spindump_remote_server_getupdate took an item from shard %u", shard);
+    struct spindump_connection* connection = 0;
+    spindump_analyze_processevent(analyzer,event,&connection);
+    spindump_remote_queue_pop(queue);
+    server->nextShard = (shard + 1) % server->nShards;
     return(1);
-  } else {
-    return(0);
   }
+  return(0);
 }
 
 //
-// Find or allocate a connection object that can be used to store
-// information belonging to a particular client.
+// Allocate a connection object that can be used to store information
+// belonging to one request from a client.
 //
-// A connection object is connection to one client, identified by the
-// clients identity that it itself gives when connecting to this
-// server, by POSTing to example.net/data/id where "id" is the
-// identity of the client. Each client can have at most one
-// transaction going on at any one time.
+// The client identifies itself when connecting to this server, by
+// POSTing to example.net/data/id where "id" is the identity of the
+// client. The identity determines the shard that the client's events
+// are queued in.
 //
 
 static struct spindump_remote_connection* 
@@ -260,49 +282,31 @@ spindump_remote_server_getconnectionobject(struct spindump_remote_server* server
   if (server->exit) return(0);
   
   //
-  // Look for an exiting connection object for that identifier
+  // Allocate
   //
 
-  struct spindump_remote_connection* firstFreeConnection = 0;
-  for (unsigned int i = 0; i < SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONS; i++) {
-    struct spindump_remote_connection* connection = &server->clients[i];
-    if (connection->active) {
-      if (strcmp(identifier,connection->identifier) == 0) {
-        spindump_deepdebugf("spindump_remote_server_getconnectionobject finds an existing connection object in index %u", i);
-        return(connection);
-      }
-    } else if (firstFreeConnection == 0) {
-      firstFreeConnection = connection;
-    }
-  }
-  
-  //
-  // Not found and no space
-  //
-  
-  if (firstFreeConnection == 0) {
-    spindump_deepdebugf("spindump_remote_server_getconnectionobject cannot find space for a new connection object");
-    spindump_errorf("cannot find space for a new connection table object for %s -- too many clients?", identifier);
+  struct spindump_remote_connection* connection =
+    (struct spindump_remote_connection*)spindump_malloc(sizeof(struct spindump_remote_connection));
+  if (connection == 0) {
+    spindump_errorf("cannot allocate a connection object for %s", identifier);
     return(0);
   }
-
+  
   //
-  // Not found but we can allocate a new one
+  // Initialize
   //
   
-  memset(firstFreeConnection,0,sizeof(*firstFreeConnection));
-  firstFreeConnection->active = 1;
-  firstFreeConnection->ongoingTransaction = 0;
-  strncpy(firstFreeConnection->identifier,identifier,sizeof(firstFreeConnection->identifier)-1);
-  firstFreeConnection->submissionLength = 0;
-  spindump_deepdebugf("spindump_remote_server_getconnectionobject found space for a new connection object");
-  return(firstFreeConnection);
+  memset(connection,0,sizeof(*connection));
+  strncpy(connection->identifier,identifier,sizeof(connection->identifier)-1);
+  connection->shard = spindump_remote_server_getshard(server,identifier);
+  spindump_deepdebugf("spindump_remote_server_getconnectionobject allocated a connection object for shard %u",
+                      connection->shard);
+  return(connection);
 }
 
 //
-// Release a connection object that is no longer needed. It does not
-// get deallocated; the memory is part of the server object. But it
-// does get marked inactive and any other resources released
+// Release a connection object that is no longer needed, and any
+// resources associated with it
 //
 
 static void
@@ -316,9 +320,6 @@ spindump_remote_server_releaseconnectionobject(struct spindump_remote_server* se
   spindump_deepdebugf("spindump_remote_server_releaseconnectionobject");
   spindump_assert(server != 0);
   spindump_assert(connection != 0);
-  spindump_assert(connection->active);
-  spindump_assert(connection >= &server->clients[0]);
-  spindump_assert(connection < &server->clients[SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONS]);
   
   //
   // Release resources
@@ -328,7 +329,23 @@ spindump_remote_server_releaseconnectionobject(struct spindump_remote_server* se
     MHD_destroy_post_processor(connection->postprocessor);
     connection->postprocessor = 0;
   }
-  connection->active = 0;
+  if (connection->submission != 0) spindump_free(connection->submission);
+  if (connection->events != 0) spindump_free(connection->events);
+  spindump_free(connection);
+}
+
+//
+// Map a client identifier to a shard
+//
+
+static unsigned int
+spindump_remote_server_getshard(struct spindump_remote_server* server,
+                                const char* identifier) {
+  unsigned int hash = 5381;
+  while (*identifier != 0) {
+    hash = hash * 33 + (unsigned char)*identifier++;
+  }
+  return(hash % server->nShards);
 }
 
 //
@@ -349,6 +366,24 @@ spindump_remote_server_answer_error(struct MHD_Connection *connection,
   return(ret);
 }
 
+//
+// Tell the client that there is no space for its submission right
+// now, and that it should try again later
+//
+
+static MHDRESULT
+spindump_remote_server_answer_busy(struct MHD_Connection *connection) {
+  static char* why = "<html><p>too many events waiting, try again later</p></html>\n";
+  spindump_debugf("HTTP response %u because the event queue is full", MHD_HTTP_SERVICE_UNAVAILABLE);
+  struct MHD_Response *response = MHD_create_response_from_buffer (strlen(why),
+                                                                   (void*)why,
+                                                                   MHD_RESPMEM_PERSISTENT);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_RETRY_AFTER,SPINDUMP_REMOTE_SERVER_RETRYAFTER);
+  MHDRESULT ret = MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, response);
+  MHD_destroy_response(response);
+  return(ret);
+}
+
 //
 // Print a HTTP paremeter (for debugging purposes).
 //
@@ -442,15 +477,43 @@ spindump_remote_server_answertopost(struct spindump_remote_server* server,
   // Parse received content
   //
 
-  const char* input = &connectionObject->submission[0];
-  spindump_deepdeepdebugf("spindump_remote_server going to parse %s", input);
-  if (!spindump_json_parse(&server->schema,server,&input)) {
-    spindump_debugf("failed to parse JSON");
+  if (connectionObject->isBinary) {
+    if (!spindump_event_parser_binary_streamparse((const uint8_t*)&connectionObject->submission[0],
+                                                  connectionObject->submissionLength,
+                                                  spindump_remote_server_eventcallback,
+                                                  connectionObject)) {
+      spindump_debugf("failed to parse binary events");
+      return(spindump_remote_server_answer_error(connection,
+                                                 MHD_HTTP_BAD_REQUEST,
+                                                 "<html><p>parse error on received binary events</p></html>\n"));
+    }
+  } else {
+    const char* input = &connectionObject->submission[0];
+    spindump_deepdeepdebugf("spindump_remote_server going to parse %s", input);
+    if (!spindump_event_parser_json_streamparse(&input,spindump_remote_server_eventcallback,connectionObject)) {
+      spindump_debugf("failed to parse JSON");
+      return(spindump_remote_server_answer_error(connection,
+                                                 MHD_HTTP_BAD_REQUEST,
+                                                 "<html><p>parse error on received JSON</p></html>\n"));
+    }
+  }
+  spindump_deepdeepdebugf("done parsing, %u events", connectionObject->nEvents);
+
+  //
+  // Queue the events, all or none of them
+  //
+
+  if (connectionObject->isOutOfMemory) {
+    return(spindump_remote_server_answer_busy(connection));
+  }
+  if (connectionObject->nEvents > SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS) {
     return(spindump_remote_server_answer_error(connection,
                                                MHD_HTTP_BAD_REQUEST,
-                                               "<html><p>parse error on received JSON</p></html>\n"));
+                                               "<html><p>too many events in one submission</p></html>\n"));
+  }
+  if (!spindump_remote_server_queueevents(server,connectionObject)) {
+    return(spindump_remote_server_answer_busy(connection));
   }
-  spindump_deepdeepdebugf("done parsing");
   
   //
   // Send the final answer
@@ -463,7 +526,6 @@ spindump_remote_server_answertopost(struct spindump_remote_server* server,
   spindump_debugf("HTTP successful response %u", code);
   MHDRESULT ret = MHD_queue_response(connection, code, response);
   MHD_destroy_response(response);
-  connectionObject->ongoingTransaction = 0;
   return(ret);
 }  
 
@@ -482,12 +544,38 @@ spindump_remote_server_adddata(struct spindump_remote_connection* connectionObje
   if (connectionObject->isBufferOverrun) {
     spindump_deepdebugf("already seen an error, ignoring data");
     return(MHD_NO);
-  } else if (connectionObject->submissionLength + length <=
-      sizeof(connectionObject->submission)) {
+  } else if (connectionObject->submissionLength + length <
+             SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE) {
+
+    //
+    // Grow the buffer if needed, leaving space for a terminating NUL
+    //
+
+    if (connectionObject->submissionLength + length >= connectionObject->submissionSize) {
+      size_t newSize =
+        connectionObject->submissionSize > 0 ?
+        connectionObject->submissionSize :
+        SPINDUMP_REMOTE_SERVER_INITIAL_CONNECTIONDATASIZE;
+      while (connectionObject->submissionLength + length >= newSize) newSize *= 2;
+      if (newSize > SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE) newSize = SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE;
+      char* newSubmission = (char*)spindump_malloc(newSize);
+      if (newSubmission == 0) {
+        spindump_errorf("cannot allocate %lu bytes for a request from %s", newSize, connectionObject->identifier);
+        connectionObject->isBufferOverrun = 1;
+        return(MHD_NO);
+      }
+      if (connectionObject->submissionLength > 0) {
+        memcpy(newSubmission,connectionObject->submission,connectionObject->submissionLength);
+      }
+      if (connectionObject->submission != 0) spindump_free(connectionObject->submission);
+      connectionObject->submission = newSubmission;
+      connectionObject->submissionSize = newSize;
+    }
     memcpy(&connectionObject->submission[connectionObject->submissionLength],
            data,
            length);
     connectionObject->submissionLength += length;
+    connectionObject->submission[connectionObject->submissionLength] = 0;
     spindump_deepdebugf("submission from %s grew to %lu bytes by %lu bytes",
                         connectionObject->identifier,
                         connectionObject->submissionLength,
@@ -603,25 +691,8 @@ spindump_remote_server_answer(void *cls,
     struct spindump_remote_connection* connectionObject =
       spindump_remote_server_getconnectionobject(server,identifier);
     if (connectionObject == 0) return(MHD_NO);
-
-    //
-    // If the connection object is already processing something,
-    // refuse to add another transaction
-    //
-
-    if (connectionObject->ongoingTransaction) {
-      return(spindump_remote_server_answer_error(connection,
-                                                 MHD_HTTP_BAD_REQUEST,
-                                                 "<html><p>only one transaction per client allowed</p></html>\n"));
-    }
-    
-    //
-    // Otherwise, initialize the connection object properly.
-    //
-    
     *con_cls = connectionObject;
     connectionObject->isPost = 0;
-    connectionObject->ongoingTransaction = 1;
     
     //
     // Setup a post processor for any submitted post data, also in
@@ -631,6 +702,18 @@ spindump_remote_server_answer(void *cls,
     if (strcmp(method,"POST") == 0) {
       
       connectionObject->isPost = 1;
+      const char* contentType = MHD_lookup_connection_value(connection,
+                                                            MHD_HEADER_KIND,
+                                                            MHD_HTTP_HEADER_CONTENT_TYPE);
+      connectionObject->isBinary =
+        contentType != 0 &&
+        strncasecmp(contentType,
+                    spindump_eventformatter_binarymediatype,
+                    strlen(spindump_eventformatter_binarymediatype)) == 0;
+      if (connectionObject->isBinary) {
+        *con_cls = connectionObject;
+        return(MHD_YES);
+      }
       spindump_assert(connectionObject->postprocessor == 0);
       connectionObject->postprocessor = MHD_create_post_processor(connection,
                                                                   SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE, 
@@ -638,7 +721,6 @@ spindump_remote_server_answer(void *cls,
                                                                   (void*)connectionObject);
       spindump_deepdebugf("post processor created for max %u bytes", SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE);
       if (connectionObject->postprocessor == 0) {
-        spindump_remote_server_releaseconnectionobject(server,connectionObject);
         return(MHD_NO);
       }
       
@@ -679,10 +761,12 @@ spindump_remote_server_answer(void *cls,
         spindump_deepdebugf("saw an error, we've already flagged it but need to continue processing");
         spindump_assert(existingConnectionObject->isBufferOverrun);
       }
-      spindump_deepdebugf("calling MHD_post_process");
-      MHD_post_process(existingConnectionObject->postprocessor, upload_data,    
-                       *upload_data_size);
-      spindump_deepdebugf("MHD_post_process call returned");
+      if (existingConnectionObject->postprocessor != 0) {
+        spindump_deepdebugf("calling MHD_post_process");
+        MHD_post_process(existingConnectionObject->postprocessor, upload_data,    
+                         *upload_data_size);
+        spindump_deepdebugf("MHD_post_process call returned");
+      }
       *upload_data_size = 0;
       return(MHD_YES);
       
@@ -731,101 +815,75 @@ spindump_remote_server_requestcompleted(void *cls,
   spindump_assert(con_cls != 0);
   
   //
-  // If the server is exiting, don't do anything
-  //
-
-  if (server->exit) return;
-
-  //
-  // Otherwise, answer
+  // Release the connection object, also when the server is exiting
   //
   
   if (connectionObject == 0) return;
-  //spindump_remote_server_answertopost(server,connectionObject,connection);
   spindump_remote_server_releaseconnectionobject(server,connectionObject);
   *con_cls = 0;   
 }
 
-static void
-spindump_remote_server_jsonrecordorarraycallback(const struct spindump_json_value* value,
-                                                 const struct spindump_json_schema* type,
-                                                 void* data) {
-
-  //
-  // Sanity checks
-  //
+//
+// Callback for each event parsed from a submission, either JSON or
+// binary. The events are collected in the connection object, and
+// queued only when the whole submission has been parsed.
+//
 
-  spindump_deepdeepdebugf("spindump_remote_server_jsonrecordorarraycallback");
+static void
+spindump_remote_server_eventcallback(const struct spindump_event* event,
+                                     void* data) {
+  spindump_assert(event != 0);
   spindump_assert(data != 0);
-  struct spindump_remote_server* server = (struct spindump_remote_server*)data;
-  spindump_assert(value != 0);
-  spindump_assert(type != 0);
-  spindump_assert(server != 0);
-  
-  //
-  // If the server is exiting, don't do anything
-  //
-
-  if (server->exit) return;
+  struct spindump_remote_connection* connectionObject = (struct spindump_remote_connection*)data;
+  if (connectionObject->isOutOfMemory) return;
+  if (connectionObject->nEvents == connectionObject->maxEvents) {
+    unsigned int newMaxEvents = connectionObject->maxEvents > 0 ? connectionObject->maxEvents * 2 : 16;
+    size_t size = newMaxEvents * sizeof(struct spindump_event);
+    struct spindump_event* newEvents = (struct spindump_event*)spindump_malloc(size);
+    if (newEvents == 0) {
+      spindump_errorf("cannot allocate %lu bytes for events from %s", size, connectionObject->identifier);
+      connectionObject->isOutOfMemory = 1;
+      return;
+    }
+    if (connectionObject->nEvents > 0) {
+      memcpy(newEvents,connectionObject->events,connectionObject->nEvents * sizeof(struct spindump_event));
+    }
+    if (connectionObject->events != 0) spindump_free(connectionObject->events);
+    connectionObject->events = newEvents;
+    connectionObject->maxEvents = newMaxEvents;
+  }
+  connectionObject->events[connectionObject->nEvents++] = *event;
+}
 
-  //
-  // Debugs
-  //
-  
-#ifdef SPINDUMP_DEBUG
-  spindump_deepdeepdebugf("spindump_remote_server_jsonrecordorarraycallback");
-  char* string = spindump_json_value_tostring(value);
-  spindump_deepdeepdebugf("spindump_remote_server_jsonrecordorarraycallback got the value %s", string);
-  spindump_free(string);
-#endif
+//
+// Put the events collected from a submission to the client's shard,
+// from where the main thread takes them in
+// spindump_remote_server_getupdate. Returns 0 if there is no space
+// for all of them, in which case none are queued.
+//
 
-  //
-  // Add the value to a ringbuffer in the server
-  //
+static int
+spindump_remote_server_queueevents(struct spindump_remote_server* server,
+                                   struct spindump_remote_connection* connectionObject) {
   
-  if (server->nextConsumeItemIndex < server->nextAddItemIndex &&
-      server->nextAddItemIndex - server->nextConsumeItemIndex >= SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS - 1) {
-
-    //
-    // There's too many unread items, doesn't fit. Lose the item!
-    //
-
-    spindump_errorf("Cannot add an item to the remote server ring buffer due to lack of space");
-
-  } else if (server->nextAddItemIndex == UINT_MAX) {
-    
-    //
-    // We do not support the pointers wrapping around, the spindump instance has run too long!
-    //
-    
-    spindump_errorf("Ring buffer indexes would wrap -- cannot process any more updates");
-    
-  } else {
-    
-    //
-    // Take a copy of the value so that we can store it
-    //
-    
-    struct spindump_json_value* copy = spindump_json_value_copy(value);
-    
-    //
-    // Calculate where to put it in the ringbuffer
-    //
-    
-    unsigned int index = server->nextAddItemIndex % SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS;
-    
-    //
-    // Put it in
-    //
-    
-    if (server->items[index] != 0) {
-      spindump_json_value_free(server->items[index]);
-    }
-    server->items[index] = copy;
-    server->nextAddItemIndex++;
-    spindump_deepdeepdebugf("added an item to the main thread's queue of events to index %u number %u",
-                            index,
-                            server->nextAddItemIndex);
-    
+  spindump_assert(server != 0);
+  spindump_assert(connectionObject != 0);
+  spindump_assert(connectionObject->shard < server->nShards);
+  if (connectionObject->nEvents == 0) return(1);
+  struct spindump_remote_queue* queue = server->shards[connectionObject->shard];
+  unsigned int position;
+  if (!spindump_remote_queue_reserve(queue,connectionObject->nEvents,&position)) {
+    spindump_debugf("no space for %u events from %s in shard %u",
+                    connectionObject->nEvents,
+                    connectionObject->identifier,
+                    connectionObject->shard);
+    return(0);
+  }
+  for (unsigned int i = 0; i < connectionObject->nEvents; i++) {
+    spindump_remote_queue_put(queue,position + i,&connectionObject->events[i]);
   }
+  spindump_deepdeepdebugf("added %u items to the main thread's queue of events in shard %u",
+                          connectionObject->nEvents,
+                          connectionObject->shard);
+  return(1);
 }
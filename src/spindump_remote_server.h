@@ -29,45 +29,69 @@
 #include "spindump_table.h"
 #include "spindump_eventformatter.h"
 #include "spindump_json.h"
+#include "spindump_event.h"
+#include "spindump_remote_queue.h"
 
 //
 // Parameters ---------------------------------------------------------------------------------
 //
 
 #define SPINDUMP_PORT_NUMBER 5040
-#define SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONS 5
 #define SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE (50*1024)
+#define SPINDUMP_REMOTE_SERVER_INITIAL_CONNECTIONDATASIZE 4096
 #define SPINDUMP_REMOTE_MAXPATHCOMPONENTLENGTH 20
 #define SPINDUMP_REMOTE_PATHSTART "/data/"
-#define SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS  1000
+#define SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS  2048 // events queued per shard, a power of two
+#define SPINDUMP_REMOTE_SERVER_DEFAULTTHREADS  4
+#define SPINDUMP_REMOTE_SERVER_MAXTHREADS      64
+#define SPINDUMP_REMOTE_SERVER_RETRYAFTER      "1" // seconds
 
 //
 // Data structures ----------------------------------------------------------------------------
 //
 
+//
+// The state of one HTTP request. These are allocated as requests come
+// in, and freed when they complete, so there is no limit on the
+// number of clients. The submission is collected and parsed by the
+// daemon thread serving the request, and the resulting events are
+// queued together once the whole submission has been parsed.
+//
+
 struct spindump_remote_connection {
-  int active;
-  int ongoingTransaction;
   int isPost;
   int isBufferOverrun;
+  int isBinary;
+  int isOutOfMemory;
+  unsigned int shard;
   char identifier[SPINDUMP_REMOTE_MAXPATHCOMPONENTLENGTH+1];
+  uint8_t padding[7];                                 // unused padding to align the next field properly
   struct MHD_PostProcessor* postprocessor;
   size_t submissionLength;
-  char submission[SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONDATASIZE];
+  size_t submissionSize;
+  char* submission;
+  unsigned int nEvents;
+  unsigned int maxEvents;
+  struct spindump_event* events;
 };
 
+//
+// The server runs the HTTP daemon in a pool of threads. The events
+// are passed to the main thread through one queue per shard, and
+// each client is mapped to a shard by its identifier, so that the
+// events from one client stay in order. If there is no space in the
+// shard for a submission, the client is asked to try again later.
+//
+
 struct spindump_remote_server {
   spindump_port listenport;                           // used by main thread only
   uint8_t padding[2];                                 // unused padding to align the next field properly
+  unsigned int nShards;                               // written by main thread before daemon threads start
   struct MHD_Daemon* daemon;                          // used by main thread only
-  struct spindump_remote_connection
-   clients[SPINDUMP_REMOTE_SERVER_MAX_CONNECTIONS];   // used by main thread only
-  struct spindump_json_schema schema;                 // written by main thread only, read by daemon thread
-  atomic_bool exit;                                   // written by main thread, read by daemon thread
-  atomic_uint nextAddItemIndex;                       // written by daemon thread, read by main thread
-  atomic_uint nextConsumeItemIndex;                   // written by main thread, read by daemon thread
-  struct spindump_json_value*
-      items[SPINDUMP_REMOTE_SERVER_MAXSUBMISSIONS];   // written by daemon thread, read by the main thread
+  atomic_bool exit;                                   // written by main thread, read by daemon threads
+  unsigned int nextShard;                             // used by main thread only
+  struct spindump_remote_queue*
+      shards[SPINDUMP_REMOTE_SERVER_MAXTHREADS];      // written by daemon threads, read by the main thread
 };
 
 //
@@ -75,7 +99,8 @@ struct spindump_remote_server {
 //
 
 struct spindump_remote_server*
-spindump_remote_server_init(spindump_port port);
+spindump_remote_server_init(spindump_port port,
+                            unsigned int threads);
 int
 spindump_remote_server_getupdate(struct spindump_remote_server* server,
                                  struct spindump_analyze* analyzer);
@@ -32,10 +32,11 @@
 //
 
 static int
-spindump_rtt_valuewithinlimits(unsigned long val,
-                               unsigned int n,
-                               struct spindump_rtt* rtt,
-                               unsigned int filterLimitPercentage);
+spindump_rtt_filterlimits(struct spindump_rtt* rtt,
+                          unsigned int n,
+                          unsigned int filterLimitPercentage,
+                          unsigned long* lowerlimit,
+                          unsigned long* upperlimit);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -52,10 +53,17 @@ spindump_rtt_initialize(struct spindump_rtt* rtt) {
   rtt->lastMovingAvgRTT = spindump_rtt_infinite;
   rtt->lastStandardDeviation = spindump_rtt_infinite;
   rtt->minimumRTT = spindump_rtt_infinite;
+  rtt->smoothedRTT = spindump_rtt_infinite;
+  rtt->rttVariation = 0;
+  rtt->recentSum = 0;
+  rtt->recentSquares = 0;
   rtt->recentTableIndex = 0;
+  rtt->recentUnset = spindump_rtt_nrecent;
+  rtt->recentLarge = 0;
   for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
     rtt->recentRTTs[i] = spindump_rtt_infinite;
   }
+  spindump_histogram_initialize(&rtt->histogram);
 }
 
 //
@@ -89,10 +97,30 @@ spindump_rtt_newmeasurement(struct spindump_rtt* rtt,
   spindump_rtt_update_histogram(rtt);
 
   //
-  // Update the table for moving average
+  // Update the table for moving average, and the running sums over
+  // it. The sums of squares would overflow for values that are
+  // not legal RTTs, so those are only counted.
   // 
   
   spindump_assert(rtt->recentTableIndex < spindump_rtt_nrecent);
+  unsigned long old = rtt->recentRTTs[rtt->recentTableIndex];
+  if (old == spindump_rtt_infinite) {
+    spindump_assert(rtt->recentUnset > 0);
+    rtt->recentUnset--;
+  } else {
+    rtt->recentSum -= (unsigned long long)old;
+    if (old > spindump_rtt_maxlegal) {
+      rtt->recentLarge--;
+    } else {
+      rtt->recentSquares -= (unsigned long long)old * (unsigned long long)old;
+    }
+  }
+  rtt->recentSum += (unsigned long long)rtt->lastRTT;
+  if (rtt->lastRTT > spindump_rtt_maxlegal) {
+    rtt->recentLarge++;
+  } else {
+    rtt->recentSquares += (unsigned long long)rtt->lastRTT * (unsigned long long)rtt->lastRTT;
+  }
   rtt->recentRTTs[rtt->recentTableIndex] = rtt->lastRTT;
   rtt->recentTableIndex++;
   rtt->recentTableIndex %= spindump_rtt_nrecent;
@@ -106,6 +134,22 @@ spindump_rtt_newmeasurement(struct spindump_rtt* rtt,
     rtt->minimumRTT = rtt->lastRTT;
   }
 
+  //
+  // Update the smoothed RTT and its variation as in RFC 6298,
+  // with alpha = 1/8 and beta = 1/4
+  //
+
+  if (rtt->smoothedRTT == spindump_rtt_infinite) {
+    rtt->smoothedRTT = rtt->lastRTT;
+    rtt->rttVariation = rtt->lastRTT / 2;
+  } else {
+    unsigned long long srtt = rtt->smoothedRTT;
+    unsigned long long sample = rtt->lastRTT;
+    unsigned long long diff = srtt > sample ? srtt - sample : sample - srtt;
+    rtt->rttVariation = (unsigned long)((3 * (unsigned long long)rtt->rttVariation + diff) / 4);
+    rtt->smoothedRTT = (unsigned long)((7 * srtt + sample) / 8);
+  }
+
   return(rtt->lastRTT);
 }
 
@@ -119,44 +163,43 @@ spindump_rtt_uninitialize(struct spindump_rtt* rtt) {
   // No-op// 
 }
 
+//
+// Determine the range of values that are not exceptional, for the
+// filtered moving average. The range is the earlier moving average
+// plus or minus the given percentage of the earlier standard
+// deviation. Returns 0 if no values are to be filtered away yet.
+//
+
 static int
-spindump_rtt_valuewithinlimits(unsigned long val,
-                               unsigned int n,
-                               struct spindump_rtt* rtt,
-                               unsigned int filterLimitPercentage) {
-  spindump_deepdeepdebugf("filter check val %lu percentage = %u avg %lu dev %lu n %u",
-                          val,
+spindump_rtt_filterlimits(struct spindump_rtt* rtt,
+                          unsigned int n,
+                          unsigned int filterLimitPercentage,
+                          unsigned long* lowerlimit,
+                          unsigned long* upperlimit) {
+  spindump_deepdeepdebugf("filter check percentage = %u avg %lu dev %lu n %u",
                           filterLimitPercentage,
                           rtt->lastMovingAvgRTT,
                           rtt->lastStandardDeviation,
                           n);
   if (rtt->lastMovingAvgRTT == spindump_rtt_infinite) {
     spindump_deepdeepdebugf("filter exception 1");
-    return(1);
+    return(0);
   }
   if (rtt->lastStandardDeviation == spindump_rtt_infinite) {
     spindump_deepdeepdebugf("filter exception 2");
-    return(1);
+    return(0);
   }
   if (n < spindump_rtt_nminfilter) {
     spindump_deepdeepdebugf("filter exception 3: %u", n);
-    return(1);
+    return(0);
   }
   unsigned long limitdiff =
     (filterLimitPercentage * rtt->lastStandardDeviation) / 100;
-  unsigned long lowerlimit =
+  *lowerlimit =
     rtt->lastMovingAvgRTT > limitdiff ? rtt->lastMovingAvgRTT - limitdiff : 0;
-  unsigned long upperlimit =
+  *upperlimit =
     (rtt->lastMovingAvgRTT + limitdiff >= rtt->lastMovingAvgRTT) ? rtt->lastMovingAvgRTT + limitdiff : spindump_rtt_max;
-  spindump_deepdeepdebugf("filter value %lu limitdiff %lu to within %lu..%lu", val, limitdiff, lowerlimit, upperlimit);
-  if (val < lowerlimit) {
-    spindump_deepdeepdebugf("filter away, too low");
-    return(0);
-  }
-  if (val > upperlimit) {
-    spindump_deepdeepdebugf("filter away, too high");
-    return(0);
-  }
+  spindump_deepdeepdebugf("filter limitdiff %lu to within %lu..%lu", limitdiff, *lowerlimit, *upperlimit);
   return(1);
 }
 
@@ -175,9 +218,6 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
                                        unsigned long* standardDeviation,
                                        unsigned long* filteredAvg) {
   
-  unsigned long long sum = 0;
-  unsigned long long devSum = 0;
-  unsigned int n = 0;
   unsigned int i;
 
   //
@@ -188,18 +228,14 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
   spindump_assert(spindump_isbool(filter));
   spindump_assert(standardDeviation != 0);
   spindump_assert(filteredAvg != 0);
+  spindump_assert(rtt->recentUnset <= spindump_rtt_nrecent);
   
   //
-  // Calculate basic moving average
+  // Calculate basic moving average, from the running sum
   //
   
-  for (i = 0; i < spindump_rtt_nrecent; i++) {
-    unsigned long val = rtt->recentRTTs[i];
-    if (val != spindump_rtt_infinite) {
-      sum += (unsigned long long)val;
-      n++;
-    }
-  }
+  unsigned long long sum = rtt->recentSum;
+  unsigned int n = spindump_rtt_nrecent - rtt->recentUnset;
   
   if (n == 0) {
     *standardDeviation = 0;
@@ -213,18 +249,25 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
   unsigned long long avg = sum / (unsigned long long)n;
   
   //
-  // Calculate standard deviation
+  // Calculate standard deviation. The sum of squared differences
+  // from the average is sum(val^2) - 2 * avg * sum(val) + n * avg^2,
+  // which is exact in modulo arithmetic as the result fits. Only if
+  // some value was too large for the running sum of squares do we
+  // need to go through the values.
   //
 
   unsigned long dev = 0;
   if (n > 1) {
-    for (i = 0; i < spindump_rtt_nrecent; i++) {
-      unsigned long long val = (unsigned long long)(rtt->recentRTTs[i]);
-      if (val != spindump_rtt_infinite) {
-        unsigned long long diff = val > avg ? val - avg : avg - val;
-        devSum += (diff * diff);
-        spindump_deepdeepdebugf("standard deviation val %llu avg %llu diff %llu sqrt %llu",
-                                val, avg, diff, diff * diff);
+    unsigned long long devSum = 0;
+    if (rtt->recentLarge == 0) {
+      devSum = rtt->recentSquares - 2 * avg * sum + (unsigned long long)n * avg * avg;
+    } else {
+      for (i = 0; i < spindump_rtt_nrecent; i++) {
+        unsigned long long val = (unsigned long long)(rtt->recentRTTs[i]);
+        if (val != spindump_rtt_infinite) {
+          unsigned long long diff = val > avg ? val - avg : avg - val;
+          devSum += (diff * diff);
+        }
       }
     }
     double realResult = floor(sqrt((1.0/(n-1))*(double)devSum));
@@ -235,27 +278,30 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
   }
   
   //
-  // Calculate filtered moving average
+  // Calculate filtered moving average. This needs to look at the
+  // values only if some of them may be exceptional.
   //
 
-  unsigned int fn = 0;
-  unsigned long long fsum = 0;
+  unsigned int fn = n;
+  unsigned long long fsum = sum;
+  unsigned long lowerlimit;
+  unsigned long upperlimit;
   
-  if (filter) {
+  if (filter &&
+      spindump_rtt_filterlimits(rtt,n,filterLimitPercentage,&lowerlimit,&upperlimit)) {
 
+    fn = 0;
+    fsum = 0;
     for (i = 0; i < spindump_rtt_nrecent; i++) {
       unsigned long val = rtt->recentRTTs[i];
       if (val != spindump_rtt_infinite &&
-          (filter == 0 ||
-           spindump_rtt_valuewithinlimits(val,n,rtt,filterLimitPercentage))) {
+          val >= lowerlimit &&
+          val <= upperlimit) {
         fsum += (unsigned long long)val;
         fn++;
       }
     }
     
-  } else {
-    fsum = sum;
-    fn = n;
   }
   
   unsigned long long favg = fn > 0 ? fsum / (unsigned long long)fn : 0;
@@ -292,17 +338,33 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
   return((unsigned long)avg);
 }
 
+//
+// Get the smoothed RTT, in the style of RFC 6298. Returns the
+// smoothed RTT, or spindump_rtt_infinite if there have been no
+// measurements. The RTT variation is placed in the output parameter
+// variation.
+//
+
+unsigned long
+spindump_rtt_smoothed(const struct spindump_rtt* rtt,
+                      unsigned long* variation) {
+  spindump_assert(rtt != 0);
+  spindump_assert(variation != 0);
+  *variation = rtt->smoothedRTT == spindump_rtt_infinite ? 0 : rtt->rttVariation;
+  return(rtt->smoothedRTT);
+}
+
 //
 // Create a printable string representation of an RTT value. E.g., "10
 // ms". The returned buffer need not be deallocated, but it will not
 // survive the next call to this same function.
 //
-// Note: not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_rtt_tostring(unsigned long rttval) {
-  static char buf[50];
+  static _Thread_local char buf[50];
 
   if (rttval == spindump_rtt_infinite) {
     snprintf(buf,sizeof(buf)-1,"n/a");
@@ -321,41 +383,11 @@ spindump_rtt_tostring(unsigned long rttval) {
 
 
 //
-// This function update the RTT histogram
+// This function updates the RTT histogram
 // based on the rtt->lastRTT value
 //
-// There are 6 levels of delay intervals in this histogram
-// level 0: 0, 100, 200 ... 900us
-// level 1: 1, 2, 3 ... 9ms
-// level 2: 10, 20, 30 ... 90ms
-// level 3: 100, 200, 300 .. 900ms
-// level 4: 1, 2, 3 ... 9s
-// level 5: 10, 20, 30 ... 60s
-//
+
 void
 spindump_rtt_update_histogram(struct spindump_rtt* rtt) {
-  unsigned long long rttval = rtt->lastRTT;
-  unsigned int bin_idx = 6;
-  unsigned int level = 5;
-
-  if (rttval < 1000) { //1ms
-    level = 0;
-    bin_idx = (unsigned  int)((double) rttval / 100.0);
-  } else if (rttval < 10 * 1000) { //10ms
-    level = 1;
-    bin_idx = (unsigned  int)((double) rttval / 1000.0);
-  } else if (rttval < 100 * 1000) { //100ms
-    level = 2;
-    bin_idx = (unsigned int)((double) rttval / (10.0 * 1000.0));
-  } else if (rttval < 1000 * 1000) { //1s
-    level = 3;
-    bin_idx = (unsigned int)((double) rttval / (100.0 * 1000.0));
-  } else if (rttval < 10 * 1000 * 1000) { //10s
-    level = 4;
-    bin_idx = (unsigned int)((double) rttval / (1000.0 * 1000.0));
-  } else {
-    bin_idx = (unsigned int)((double) rttval / (10.0 * 1000.0 * 1000.0));
-  }
-
-  rtt->rttHisto[level][bin_idx]++;
+  spindump_histogram_record(&rtt->histogram,rtt->lastRTT);
 }
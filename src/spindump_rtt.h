@@ -19,6 +19,12 @@
 #ifndef SPINDUMP_RTT_H
 #define SPINDUMP_RTT_H
 
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include "spindump_histogram.h"
+
 //
 // Parameters ---------------------------------------------------------------------------------
 //
@@ -39,13 +45,20 @@ struct spindump_rtt {
   unsigned long lastMovingAvgRTT;            // in usecs, spindump_rtt_infinite if not set
   unsigned long lastStandardDeviation;       // in usecs, spindump_rtt_infinite if not set
   unsigned long minimumRTT;                  // in usecs, spindump_rtt_infinite if not set
+  unsigned long smoothedRTT;                 // RFC 6298 style SRTT, in usecs, spindump_rtt_infinite if not set
+  unsigned long rttVariation;                // RFC 6298 style RTTVAR, in usecs
+  unsigned long long recentSum;              // sum of the set recent RTT measurements
+  unsigned long long recentSquares;          // sum of squares of the set recent RTT measurements,
+                                             // excluding those over spindump_rtt_maxlegal
   unsigned int recentTableIndex;             // where the next recent RTT measurement will
                                              // be placed in
+  unsigned int recentUnset;                  // number of recent RTT measurements not set
+  unsigned int recentLarge;                  // number of recent RTT measurements over spindump_rtt_maxlegal
   unsigned int padding;                      // unused padding to align the next field properly
   unsigned long
     recentRTTs[spindump_rtt_nrecent];        // recent RTT measurements, in usec. Value 
                                              // positions via above index.
-  unsigned long rttHisto[6][10];             // RTT histograms 100us-1ms-10ms-100ms-1s-10s resolution
+  struct spindump_histogram histogram;       // RTT histogram, in usec
 };
 
 //
@@ -63,6 +76,9 @@ spindump_rtt_calculateLastMovingAvgRTT(struct spindump_rtt* rtt,
                                        unsigned int filterLimitPercentage,
                                        unsigned long* standardDeviation,
                                        unsigned long* filteredAvg);
+unsigned long
+spindump_rtt_smoothed(const struct spindump_rtt* rtt,
+                      unsigned long* variation);
 const char*
 spindump_rtt_tostring(unsigned long rttval);
 void
@@ -15,7 +15,6 @@
 //  AUTHOR: JARI ARKKO
 //
 // 
-
 //
 // Includes -----------------------------------------------------------------------------------
 //
@@ -25,6 +24,31 @@
 #include "spindump_util.h"
 #include "spindump_seq.h"
 
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static struct spindump_seqstore*
+spindump_seqtracker_get(const struct spindump_seqtracker* tracker,
+                        unsigned int index);
+static tcp_seq
+spindump_seqtracker_end(const struct spindump_seqstore* store);
+static int
+spindump_seqtracker_grow(struct spindump_seqtracker* tracker);
+static unsigned int
+spindump_seqtracker_search(const struct spindump_seqtracker* tracker,
+                           tcp_seq seq,
+                           unsigned int len);
+static void
+spindump_seqtracker_insert(struct spindump_seqtracker* tracker,
+                           unsigned int index);
+static void
+spindump_seqtracker_marksacked(struct spindump_seqtracker* tracker,
+                               const struct spindump_tcp_sack_block* block);
+static void
+spindump_seqtracker_prune(struct spindump_seqtracker* tracker,
+                          tcp_seq seq);
+
 //
 // Actual code --------------------------------------------------------------------------------
 //
@@ -36,12 +60,101 @@
 // that sequence number These trackers are used in the TCP protocol
 // analyzer. There's two trackers, one for each direction.
 //
+// No storage is allocated until the first segment is added.
+//
 
 void
 spindump_seqtracker_initialize(struct spindump_seqtracker* tracker) {
   spindump_assert(tracker != 0);
   memset(tracker,0,sizeof(*tracker));
-  tracker->seqindex = 0;
+}
+
+//
+// Return the segment at a given position in sequence number order
+//
+
+static struct spindump_seqstore*
+spindump_seqtracker_get(const struct spindump_seqtracker* tracker,
+                        unsigned int index) {
+  spindump_assert(index < tracker->count);
+  return(&tracker->stored[(tracker->first + index) & (tracker->size - 1)]);
+}
+
+//
+// Return the sequence number after the segment. Segments without
+// payload are treated as one byte long, so that an acknowledgment of
+// exactly their sequence number (a keepalive) still matches them.
+//
+
+static tcp_seq
+spindump_seqtracker_end(const struct spindump_seqstore* store) {
+  return(store->seq + (store->len > 0 ? store->len : 1));
+}
+
+//
+// Make room for more segments, by doubling the size of the ring
+// buffer, up to spindump_seqtracker_maxdepth. Return 0 if the ring
+// is already at its maximum size or the allocation fails.
+//
+
+static int
+spindump_seqtracker_grow(struct spindump_seqtracker* tracker) {
+  unsigned int newSize = tracker->size == 0 ? spindump_seqtracker_initialsize : tracker->size * 2;
+  if (newSize > spindump_seqtracker_maxdepth) return(0);
+  struct spindump_seqstore* newStored =
+    (struct spindump_seqstore*)spindump_malloc(newSize * sizeof(struct spindump_seqstore));
+  if (newStored == 0) return(0);
+  for (unsigned int i = 0; i < tracker->count; i++) {
+    newStored[i] = *spindump_seqtracker_get(tracker,i);
+  }
+  if (tracker->stored != 0) spindump_free(tracker->stored);
+  tracker->stored = newStored;
+  tracker->size = newSize;
+  tracker->first = 0;
+  return(1);
+}
+
+//
+// Find the position of the first segment that is not before the
+// given sequence number and length, in sequence number order. Returns
+// tracker->count if all segments are before it.
+//
+
+static unsigned int
+spindump_seqtracker_search(const struct spindump_seqtracker* tracker,
+                           tcp_seq seq,
+                           unsigned int len) {
+  unsigned int low = 0;
+  unsigned int high = tracker->count;
+  while (low < high) {
+    unsigned int middle = low + (high - low) / 2;
+    const struct spindump_seqstore* store = spindump_seqtracker_get(tracker,middle);
+    if (spindump_seq_lt(store->seq,seq) ||
+        (store->seq == seq && store->len < len)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return(low);
+}
+
+//
+// Open a gap for a new segment at the given position, by moving the
+// segments after it one position further in the ring. The ring must
+// have space for the new segment.
+//
+
+static void
+spindump_seqtracker_insert(struct spindump_seqtracker* tracker,
+                           unsigned int index) {
+  spindump_assert(tracker->count < tracker->size);
+  spindump_assert(index <= tracker->count);
+  unsigned int mask = tracker->size - 1;
+  for (unsigned int i = tracker->count; i > index; i--) {
+    tracker->stored[(tracker->first + i) & mask] = tracker->stored[(tracker->first + i - 1) & mask];
+  }
+  tracker->count++;
 }
 
 //
@@ -55,19 +168,95 @@ spindump_seqtracker_add(struct spindump_seqtracker* tracker,
                         tcp_seq seq,
                         unsigned int payloadlen,
                         int finset) {
+  
   spindump_assert(tracker != 0);
-  spindump_assert(tracker->seqindex < spindump_seqtracker_nstored);
+  spindump_assert(ts != 0);
   spindump_assert(finset == 0 || finset == 1);
-  tracker->stored[tracker->seqindex].valid = 1;
-  tracker->stored[tracker->seqindex].acked = 0;
-  tracker->stored[tracker->seqindex].received = *ts;
-  tracker->stored[tracker->seqindex].ts_val = ts_val;
-  tracker->stored[tracker->seqindex].seq = seq;
-  tracker->stored[tracker->seqindex].len = payloadlen;
-  tracker->stored[tracker->seqindex].finset = finset;
-  tracker->seqindex++;
-  tracker->seqindex %= spindump_seqtracker_nstored;
-  spindump_assert(tracker->seqindex < spindump_seqtracker_nstored);
+  
+  //
+  // Find the place for the segment. Usually that is after all others,
+  // and otherwise a binary search finds it. A retransmission of a
+  // segment already in the tracker just updates the segment.
+  //
+
+  unsigned int index;
+  if (tracker->count == 0) {
+    index = 0;
+  } else {
+    const struct spindump_seqstore* last = spindump_seqtracker_get(tracker,tracker->count - 1);
+    if (spindump_seq_lt(last->seq,seq) ||
+        (last->seq == seq && last->len < payloadlen)) {
+      index = tracker->count;
+    } else {
+      index = spindump_seqtracker_search(tracker,seq,payloadlen);
+    }
+  }
+  
+  if (index == tracker->count ||
+      spindump_seqtracker_get(tracker,index)->seq != seq ||
+      spindump_seqtracker_get(tracker,index)->len != payloadlen) {
+
+    //
+    // A new segment. If the tracker is full, forget the segment with
+    // the lowest sequence number.
+    //
+    
+    if (tracker->count == tracker->size && !spindump_seqtracker_grow(tracker)) {
+      if (tracker->count == 0) return;
+      tracker->first = (tracker->first + 1) & (tracker->size - 1);
+      tracker->count--;
+      if (index > 0) index--;
+    }
+    spindump_seqtracker_insert(tracker,index);
+  }
+  
+  if (payloadlen > tracker->maxLen) tracker->maxLen = payloadlen;
+  struct spindump_seqstore* store = spindump_seqtracker_get(tracker,index);
+  store->received = *ts;
+  store->seq = seq;
+  store->len = payloadlen;
+  store->ts_val = ts_val;
+  store->acked = 0;
+  store->finset = (uint8_t)finset;
+}
+
+//
+// Mark the segments wholly within a SACK block as acknowledged. An
+// acknowledgment covering them later on can not tell how long they
+// took to arrive.
+//
+
+static void
+spindump_seqtracker_marksacked(struct spindump_seqtracker* tracker,
+                               const struct spindump_tcp_sack_block* block) {
+  if (!spindump_seq_lt(block->left,block->right)) return;
+  for (unsigned int i = spindump_seqtracker_search(tracker,block->left,0);
+       i < tracker->count;
+       i++) {
+    struct spindump_seqstore* store = spindump_seqtracker_get(tracker,i);
+    if (!spindump_seq_leq(spindump_seqtracker_end(store),block->right)) break;
+    store->acked = 1;
+  }
+}
+
+//
+// Forget the segments that end before a given sequence number, as
+// they are cumulatively acknowledged. This is only done when the
+// acknowledgment is for data that has actually been seen sent, so
+// that an unrelated acknowledgment field does not empty the tracker.
+//
+
+static void
+spindump_seqtracker_prune(struct spindump_seqtracker* tracker,
+                          tcp_seq seq) {
+  if (tracker->count == 0) return;
+  const struct spindump_seqstore* last = spindump_seqtracker_get(tracker,tracker->count - 1);
+  if (!spindump_seq_leq(seq,spindump_seqtracker_end(last))) return;
+  while (tracker->count > 0 &&
+         spindump_seq_lt(spindump_seqtracker_end(spindump_seqtracker_get(tracker,0)),seq)) {
+    tracker->first = (tracker->first + 1) & (tracker->size - 1);
+    tracker->count--;
+  }
 }
 
 //
@@ -75,111 +264,95 @@ spindump_seqtracker_add(struct spindump_seqtracker* tracker,
 // sequence number. Return a pointer to that time, or 0 if no such
 // sequence number has been seen.
 //
+// The sample is taken from the segment holding the highest
+// acknowledged byte: the one before the cumulative acknowledgment
+// "seq", or before the right edge of the first SACK block, if that
+// is higher. The first SACK block is the one that the latest arrived
+// segment belongs to. All segments within the SACK blocks are marked
+// acknowledged, and all segments before the cumulative
+// acknowledgment are forgotten.
+//
 
 struct timeval*
 spindump_seqtracker_ackto(struct spindump_seqtracker* tracker,
                           tcp_seq seq,
-                          tcp_seq sack,
+                          const struct spindump_tcp_sack* sack,
+                          unsigned int nSackBlocks,
                           tcp_ts ts_ecr,
                           struct timeval* t,
                           tcp_seq* sentSeq,
                           int* sentFin) {
   
+  spindump_assert(tracker != 0);
+  spindump_assert(nSackBlocks == 0 || sack != 0);
+  spindump_assert(nSackBlocks <= SPINDUMP_MAX_SACK_BLOCKS);
+  spindump_assert(sentSeq != 0);
+  spindump_assert(sentFin != 0);
+  
   //
   // The highest acked sequence number is either given by the cumulative acknowledgement
   // field in the TCP header, or by the right edge of the first sack block.
   //
 
-  tcp_seq highestacked = sack > seq ? sack : seq;
+  tcp_seq highestacked = seq;
+  if (nSackBlocks > 0 && spindump_seq_lt(seq,sack->blocks[0].right)) {
+    highestacked = sack->blocks[0].right;
+  }
   highestacked -= 1;
 
-  spindump_deepdebugf("compare cumulative ack %u to largest selective ack %u. highest ack = %u",
-                        seq, sack, highestacked);
-
-  spindump_assert(sentSeq != 0);
+  spindump_deepdebugf("compare cumulative ack %u to %u selective acks. highest ack = %u",
+                      seq, nSackBlocks, highestacked);
   
   //
-  // Find the earliest sent packet that this could be an
-  // acknowledgment for.
+  // Find the segment that this could be an acknowledgment for. The
+  // candidates start at most maxLen bytes before the acked byte, and
+  // are found by going backwards from the last segment that starts
+  // at or before it. If there are several, the latest sent one is
+  // chosen, and the others are marked acked.
   // 
   
   struct spindump_seqstore* chosen = 0;
-  for (unsigned int i = 0; i < spindump_seqtracker_nstored; i++) {
-    
-    struct spindump_seqstore* candidate = &tracker->stored[i];
-
-    //
-    // Is this entry in use? If not, go to next
-     // 
-
-    if (!candidate->valid) continue;
-    
-    //
-    // Is this previously seen TCP segment the one
-    // acked by sequence number "seq"?
-    // 
-    
-    spindump_deepdebugf("compare received ACK %u (%u) to candidate earlier sent SEQ %u..%u at -%llu ago len %u valid %u acked %u",
+  tcp_seq lowestStart = highestacked - tracker->maxLen;
+  for (unsigned int index = spindump_seqtracker_search(tracker,highestacked + 1,0);
+       index > 0;
+       index--) {
+    struct spindump_seqstore* candidate = spindump_seqtracker_get(tracker,index - 1);
+    if (spindump_seq_lt(candidate->seq,lowestStart)) break;
+    spindump_deepdebugf("compare received ACK %u (%u) to candidate earlier sent SEQ %u..%u at -%llu ago len %u acked %u",
                         highestacked, seq,
                         candidate->seq, candidate->seq + candidate->len,
                         spindump_timediffinusecs(t,
                                                  &candidate->received),
                         candidate->len,
-                        candidate->valid,
                         candidate->acked);
-    
     if (candidate->seq == highestacked ||
-        (candidate->seq <= highestacked &&
-         highestacked < candidate->seq + candidate->len)) {
-      
-      //
-      // It is. Now see if this is the earliest one.
-      // 
-      
+        spindump_seq_lt(highestacked,candidate->seq + candidate->len)) {
       if (chosen == 0) {
-        spindump_deepdebugf("first matching candidate chosen");
         chosen = candidate;
-     } else if (spindump_isearliertime(&candidate->received,&chosen->received)) {
-        spindump_deepdebugf("earlier matching candidate chosen");
+      } else if (spindump_isearliertime(&candidate->received,&chosen->received)) {
+        chosen->acked = 1;
         chosen = candidate;
+      } else {
+        candidate->acked = 1;
       }
     }
   }
   
+  struct timeval* result = 0;
   if (chosen != 0) {
-    
-    //
-    // Found. Return the time when that packet was sent.
-    // But first, clear the sequence stores from all entries
-    // sent earlier than the one that we found. And clear this
-    // entry too.
-    // 
-
-    for (unsigned int j = 0; j < spindump_seqtracker_nstored; j++) {
-      struct spindump_seqstore* other = &tracker->stored[j];
-      if (other->valid && !other->acked && spindump_isearliertime(&chosen->received,&other->received)) {
-        other->acked = 1;
-      }
-    }
 
     //
-    // Did we already ack this earlier? If yes, we can't say anything about RTT.
-    //
-
-    if (chosen->acked) {
-      *sentSeq = chosen->seq;
-      *sentFin = chosen->finset;
-      return(0);
-    }
-
-    //
-    // Previously unseen ack, report the time.
+    // Found. Report the time when that packet was sent, unless
+    // the segment has already been acked, in which case we can't
+    // say anything about RTT.
     //
     
-    chosen->acked = 1;
     *sentSeq = chosen->seq;
     *sentFin = chosen->finset;
-    return(&chosen->received);
+    if (!chosen->acked) {
+      chosen->acked = 1;
+      result = &chosen->received;
+    }
     
   } else {
     
@@ -189,9 +362,21 @@ spindump_seqtracker_ackto(struct spindump_seqtracker* tracker,
     
     *sentSeq = 0;
     *sentFin = 0;
-    return(0);
     
   }
+
+  //
+  // Remember which segments have now been acknowledged. The chosen
+  // segment is not forgotten even if it is before the cumulative
+  // acknowledgment, as it ends after the highest acked byte; the
+  // returned pointer stays valid until the tracker is next modified.
+  //
+  
+  for (unsigned int i = 0; i < nSackBlocks; i++) {
+    spindump_seqtracker_marksacked(tracker,&sack->blocks[i]);
+  }
+  spindump_seqtracker_prune(tracker,seq);
+  return(result);
 }
 
 //
@@ -201,5 +386,10 @@ spindump_seqtracker_ackto(struct spindump_seqtracker* tracker,
 void
 spindump_seqtracker_uninitialize(struct spindump_seqtracker* tracker) {
   spindump_assert(tracker != 0);
-  // no-op
+  if (tracker->stored != 0) {
+    spindump_free(tracker->stored);
+    tracker->stored = 0;
+  }
+  tracker->count = 0;
+  tracker->size = 0;
 }
@@ -25,35 +25,60 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
 #include "spindump_protocols.h"
 
 //
 // Parameters ---------------------------------------------------------------------------------
 //
 
-#ifndef spindump_seqtracker_nstored
-#define spindump_seqtracker_nstored             50
+//
+// The maximum number of sent segments remembered per direction. The
+// storage grows on demand from spindump_seqtracker_initialsize
+// entries, so idle connections do not pay for the full depth.
+//
+
+#ifndef spindump_seqtracker_maxdepth
+#define spindump_seqtracker_maxdepth          1024
 #endif
+#define spindump_seqtracker_initialsize          8
+
+//
+// Comparisons of 32-bit sequence numbers that may wrap around
+//
+
+#define spindump_seq_lt(a,b)                ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+#define spindump_seq_leq(a,b)               ((int32_t)((uint32_t)(a) - (uint32_t)(b)) <= 0)
 
 //
 // Data structures ----------------------------------------------------------------------------
 //
 
 struct spindump_seqstore {
-  struct timeval received;
-  int valid;
-  int acked;
-  unsigned int len;
-  int finset;
-  tcp_ts ts_val;
-  tcp_seq seq;
-  //char padding[2]; // unused
+  struct timeval received;                // when was the segment sent
+  tcp_seq seq;                            // first sequence number of the segment
+  unsigned int len;                       // payload length of the segment
+  tcp_ts ts_val;                          // timestamp option value of the segment
+  uint8_t acked;                          // has the segment been acknowledged already?
+  uint8_t finset;                         // did the segment carry a FIN?
+  uint8_t padding[2];                     // unused padding to align the next field properly
 };
 
+//
+// The segments are kept in a ring buffer ordered by sequence number,
+// starting at index "first". Segments with the same sequence number
+// are ordered by length, and there is only one segment for each
+// sequence number and length pair; a retransmission replaces the
+// earlier copy. A retransmission may also cover the range of
+// earlier segments differently, so segments may overlap.
+//
+
 struct spindump_seqtracker {
-  struct spindump_seqstore stored[spindump_seqtracker_nstored];
-  unsigned int seqindex;
-  //char padding[4]; // unused
+  struct spindump_seqstore* stored;       // the ring buffer, or 0 if nothing has been stored yet
+  unsigned int first;                     // index of the lowest sequence number in the ring
+  unsigned int count;                     // number of segments in the ring
+  unsigned int size;                      // allocated size of the ring, a power of two
+  unsigned int maxLen;                    // longest segment seen, bounds the overlap between segments
 };
 
 //
@@ -72,7 +97,8 @@ spindump_seqtracker_add(struct spindump_seqtracker* tracker,
 struct timeval*
 spindump_seqtracker_ackto(struct spindump_seqtracker* tracker,
                           tcp_seq seq,
-                          tcp_seq sack,
+                          const struct spindump_tcp_sack* sack,
+                          unsigned int nSackBlocks,
                           tcp_ts ts_ecr,
                           struct timeval* t,
                           tcp_seq* sentSeq,
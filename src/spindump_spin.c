@@ -161,11 +161,11 @@ spindump_spintracker_observespinandcalculatertt(struct spindump_analyze* state,
   struct spindump_spintracker* tracker;
   struct spindump_spintracker* otherDirectionTracker;
   if (fromResponder) {
-    tracker = &connection->u.quic.spinFromPeer2to1;
-    otherDirectionTracker = &connection->u.quic.spinFromPeer1to2;
+    tracker = &connection->cold->u.quic.spinFromPeer2to1;
+    otherDirectionTracker = &connection->cold->u.quic.spinFromPeer1to2;
   } else {
-    tracker = &connection->u.quic.spinFromPeer1to2;
-    otherDirectionTracker = &connection->u.quic.spinFromPeer2to1;
+    tracker = &connection->cold->u.quic.spinFromPeer1to2;
+    otherDirectionTracker = &connection->cold->u.quic.spinFromPeer2to1;
   }
   
   int spin0to1;
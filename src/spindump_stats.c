@@ -70,6 +70,8 @@ spindump_stats_report(struct spindump_stats* stats,
                       FILE* file) {
   fprintf(file,"received frames:                        %8u\n", stats->receivedFrames);
   fprintf(file,"analyzer handler calls:                 %8u\n", stats->analyzerHandlerCalls);
+  fprintf(file,"analyzer events:                        %8u\n", stats->analyzerEvents);
+  fprintf(file,"analyzer events with handlers:          %8u\n", stats->analyzerEventsDelivered);
   fprintf(file,"frame not long enough for Ethernet hdr: %8u\n", stats->notEnoughPacketForEthernetHdr);
   fprintf(file,"received IPv4 packets:                  %8u\n", stats->receivedIp);
   fprintf(file,"received IPv4 bytes:                    %8sB\n",
@@ -121,6 +123,112 @@ spindump_stats_report(struct spindump_stats* stats,
   fprintf(file,"connections, QUIC:                      %8u\n", stats->connectionsQuic);
   fprintf(file,"connections, deleted after closing:     %8u\n", stats->connectionsDeletedClosed);
   fprintf(file,"connections, deleted after inactive:    %8u\n", stats->connectionsDeletedInactive);
+  if (stats->unknownConnectionCached > 0 || stats->connectionsAdopted > 0) {
+    fprintf(file,"unknown connection, in negative cache:  %8u\n", stats->unknownConnectionCached);
+    fprintf(file,"connections, adopted mid-stream:        %8u\n", stats->connectionsAdopted);
+  }
+  if (stats->halfOpenConnections > 0) {
+    fprintf(file,"half-open connections:                  %8u\n", stats->halfOpenConnections);
+    fprintf(file,"half-open connections, promoted:        %8u\n", stats->halfOpenPromoted);
+    fprintf(file,"half-open connections, expired:         %8u\n", stats->halfOpenExpired);
+    fprintf(file,"half-open connections, evicted:         %8u\n", stats->halfOpenEvicted);
+  }
+  if (stats->remoteBlocksQueued > 0) {
+    fprintf(file,"remote blocks queued:                   %8u\n", stats->remoteBlocksQueued);
+    fprintf(file,"remote blocks sent:                     %8u\n", stats->remoteBlocksSent);
+    fprintf(file,"remote blocks failed:                   %8u\n", stats->remoteBlocksFailed);
+    fprintf(file,"remote blocks dropped, queue full:      %8u\n", stats->remoteBlocksDropped);
+    fprintf(file,"remote queue depth:                     %8u\n", stats->remoteQueueDepth);
+    fprintf(file,"remote queue depth, max:                %8u\n", stats->remoteMaxQueueDepth);
+    fprintf(file,"remote send latency, average:           %8lluus\n",
+            stats->remoteBlocksSent > 0 ? stats->remoteSendLatency / stats->remoteBlocksSent : 0);
+  }
+}
+
+//
+// Add the counters of one statistics object to another. This is used
+// to combine the statistics of several worker threads for reporting.
+//
+
+void
+spindump_stats_merge(struct spindump_stats* target,
+                     const struct spindump_stats* source) {
+  spindump_assert(target != 0);
+  spindump_assert(source != 0);
+  target->receivedFrames += source->receivedFrames;
+  target->analyzerHandlerCalls += source->analyzerHandlerCalls;
+  target->analyzerEvents += source->analyzerEvents;
+  target->analyzerEventsDelivered += source->analyzerEventsDelivered;
+  target->notEnoughPacketForEthernetHdr += source->notEnoughPacketForEthernetHdr;
+  target->receivedIp += source->receivedIp;
+  target->receivedIpv6 += source->receivedIpv6;
+  target->receivedIpBytes += source->receivedIpBytes;
+  target->receivedIpv6Bytes += source->receivedIpv6Bytes;
+  target->invalidIpHdrSize += source->invalidIpHdrSize;
+  target->notEnoughPacketForIpHdr += source->notEnoughPacketForIpHdr;
+  target->versionMismatch += source->versionMismatch;
+  target->invalidIpLength += source->invalidIpLength;
+  target->unhandledFragment += source->unhandledFragment;
+  target->fragmentTooShort += source->fragmentTooShort;
+  target->receivedIcmp += source->receivedIcmp;
+  target->invalidIcmpHdrSize += source->invalidIcmpHdrSize;
+  target->notEnoughPacketForIcmpHdr += source->notEnoughPacketForIcmpHdr;
+  target->unsupportedIcmpType += source->unsupportedIcmpType;
+  target->invalidIcmpCode += source->invalidIcmpCode;
+  target->receivedIcmpEcho += source->receivedIcmpEcho;
+  target->receivedUdp += source->receivedUdp;
+  target->notEnoughPacketForUdpHdr += source->notEnoughPacketForUdpHdr;
+  target->notEnoughPacketForDnsHdr += source->notEnoughPacketForDnsHdr;
+  target->notEnoughPacketForCoapHdr += source->notEnoughPacketForCoapHdr;
+  target->unrecognisedCoapVersion += source->unrecognisedCoapVersion;
+  target->untrackableCoapMessage += source->untrackableCoapMessage;
+  target->invalidTlsPacket += source->invalidTlsPacket;
+  target->receivedQuic += source->receivedQuic;
+  target->notEnoughPacketForQuicHdr += source->notEnoughPacketForQuicHdr;
+  target->notEnoughPacketForQuicHdrToken += source->notEnoughPacketForQuicHdrToken;
+  target->notEnoughPacketForQuicHdrLength += source->notEnoughPacketForQuicHdrLength;
+  target->notAbleToHandleGoogleQuicCoalescing += source->notAbleToHandleGoogleQuicCoalescing;
+  target->unrecognisedQuicVersion += source->unrecognisedQuicVersion;
+  target->unsupportedQuicVersion += source->unsupportedQuicVersion;
+  target->unrecognisedQuicType += source->unrecognisedQuicType;
+  target->unsupportedQuicType += source->unsupportedQuicType;
+  target->receivedTcp += source->receivedTcp;
+  target->notEnoughPacketForTcpHdr += source->notEnoughPacketForTcpHdr;
+  target->invalidTcpHdrSize += source->invalidTcpHdrSize;
+  target->invalidTcpOptSize += source->invalidTcpOptSize;
+  target->unknownTcpConnection += source->unknownTcpConnection;
+  target->unknownSctpConnection += source->unknownSctpConnection;
+  target->unknownConnectionCached += source->unknownConnectionCached;
+  target->receivedSctp += source->receivedSctp;
+  target->notEnoughPacketForSctpHdr += source->notEnoughPacketForSctpHdr;
+  target->protocolNotSupported += source->protocolNotSupported;
+  target->unsupportedEthertype += source->unsupportedEthertype;
+  target->unsupportedNulltype += source->unsupportedNulltype;
+  target->invalidRtt += source->invalidRtt;
+  target->connections += source->connections;
+  target->connectionsIcmp += source->connectionsIcmp;
+  target->connectionsTcp += source->connectionsTcp;
+  target->connectionsSctp += source->connectionsSctp;
+  target->connectionsUdp += source->connectionsUdp;
+  target->connectionsDns += source->connectionsDns;
+  target->connectionsCoap += source->connectionsCoap;
+  target->connectionsQuic += source->connectionsQuic;
+  target->connectionsDeletedClosed += source->connectionsDeletedClosed;
+  target->connectionsDeletedInactive += source->connectionsDeletedInactive;
+  target->connectionsAdopted += source->connectionsAdopted;
+  target->halfOpenConnections += source->halfOpenConnections;
+  target->halfOpenPromoted += source->halfOpenPromoted;
+  target->halfOpenExpired += source->halfOpenExpired;
+  target->halfOpenEvicted += source->halfOpenEvicted;
+  target->remoteQueueDepth += source->remoteQueueDepth;
+  if (source->remoteMaxQueueDepth > target->remoteMaxQueueDepth) {
+    target->remoteMaxQueueDepth = source->remoteMaxQueueDepth;
+  }
+  target->remoteBlocksQueued += source->remoteBlocksQueued;
+  target->remoteBlocksSent += source->remoteBlocksSent;
+  target->remoteBlocksFailed += source->remoteBlocksFailed;
+  target->remoteBlocksDropped += source->remoteBlocksDropped;
+  target->remoteSendLatency += source->remoteSendLatency;
 }
 
 //
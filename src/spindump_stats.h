@@ -33,6 +33,8 @@
 struct spindump_stats {
   spindump_counter_32bit receivedFrames;
   spindump_counter_32bit analyzerHandlerCalls;
+  spindump_counter_32bit analyzerEvents;
+  spindump_counter_32bit analyzerEventsDelivered;
   spindump_counter_32bit notEnoughPacketForEthernetHdr;
   spindump_counter_32bit receivedIp;
   spindump_counter_32bit receivedIpv6;
@@ -72,6 +74,7 @@ struct spindump_stats {
   spindump_counter_32bit invalidTcpOptSize;
   spindump_counter_32bit unknownTcpConnection;
   spindump_counter_32bit unknownSctpConnection;
+  spindump_counter_32bit unknownConnectionCached;
   spindump_counter_32bit receivedSctp;
   spindump_counter_32bit notEnoughPacketForSctpHdr;
   spindump_counter_32bit protocolNotSupported;
@@ -88,6 +91,18 @@ struct spindump_stats {
   spindump_counter_32bit connectionsQuic;
   spindump_counter_32bit connectionsDeletedClosed;
   spindump_counter_32bit connectionsDeletedInactive;
+  spindump_counter_32bit connectionsAdopted;
+  spindump_counter_32bit halfOpenConnections;
+  spindump_counter_32bit halfOpenPromoted;
+  spindump_counter_32bit halfOpenExpired;
+  spindump_counter_32bit halfOpenEvicted;
+  spindump_counter_32bit remoteQueueDepth;
+  spindump_counter_32bit remoteMaxQueueDepth;
+  spindump_counter_32bit remoteBlocksQueued;
+  spindump_counter_32bit remoteBlocksSent;
+  spindump_counter_32bit remoteBlocksFailed;
+  spindump_counter_32bit remoteBlocksDropped;
+  spindump_counter_64bit remoteSendLatency;
   // uint8_t padding2[4]; // unused padding to align the next field properly
 };
 
@@ -101,6 +116,9 @@ void
 spindump_stats_report(struct spindump_stats* stats,
                       FILE* file);
 void
+spindump_stats_merge(struct spindump_stats* target,
+                     const struct spindump_stats* source);
+void
 spindump_stats_uninitialize(struct spindump_stats* state);
 
 #endif // SPINDUMP_STATS_H
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "spindump_table_structs.h"
 #include "spindump_connections_structs.h"
 #include "spindump_table.h"
@@ -33,18 +34,23 @@
 // Function prototypes ------------------------------------------------------------------------
 //
 
-static void
+static unsigned long long
+spindump_connectionstable_nextcheck(const struct spindump_connection* connection,
+                                    const struct spindump_connectionstable* table);
+static int
 spindump_connectionstable_periodiccheck_aux(struct spindump_connection* connection,
                                             const struct timeval* now,
                                             struct spindump_connectionstable* table,
                                             struct spindump_analyze* analyzer,
                                             int print_info);
 static void
-spindump_connectionstable_compresstable(struct spindump_connectionstable* table);
+spindump_connectionstable_removeconnection(struct spindump_connection* connection,
+                                           struct spindump_connectionstable* table);
 static void
 spindump_connectionstable_periodicreport(struct spindump_connectionstable* table,
                                          const struct timeval* now,
-                                         struct spindump_analyze* analyzer);
+                                         struct spindump_analyze* analyzer,
+                                         int sharedAggregates);
 
 //
 // Actual code --------------------------------------------------------------------------------
@@ -93,6 +99,13 @@ spindump_connectionstable_initialize(unsigned long long bandwidthMeasurementPeri
   }
   table->nConnections = 0;
   table->maxNConnections = variabletabelements;
+  spindump_connectionstable_pool_initialize(&table->pool);
+  spindump_connectionstable_timers_initialize(&table->timers);
+  spindump_connectionstable_prefixes_initialize(&table->prefixes);
+  spindump_connectionstable_rollup_initialize(&table->rollup);
+  spindump_connectionstable_negative_initialize(&table->negative);
+  spindump_connectionstable_halfopen_initialize(&table->halfOpen);
+  spindump_connectionstable_shared_initialize(&table->shared);
   
   //
   // Allocate the actual table of connections
@@ -114,6 +127,29 @@ spindump_connectionstable_initialize(unsigned long long bandwidthMeasurementPeri
   for (i = 0; i < table->maxNConnections; i++) {
     table->connections[i] = 0;
   }
+  if (!spindump_connectionstable_slots_initialize(&table->slots,table->maxNConnections)) {
+    spindump_free(table->connections);
+    spindump_free(table);
+    return(0);
+  }
+  
+  //
+  // Allocate the indexes used for searching connections
+  // 
+  
+  if (!spindump_connectionstable_index_initialize(&table->tupleIndex)) {
+    spindump_connectionstable_slots_uninitialize(&table->slots);
+    spindump_free(table->connections);
+    spindump_free(table);
+    return(0);
+  }
+  if (!spindump_connectionstable_index_initialize(&table->cidIndex)) {
+    spindump_connectionstable_index_uninitialize(&table->tupleIndex);
+    spindump_connectionstable_slots_uninitialize(&table->slots);
+    spindump_free(table->connections);
+    spindump_free(table);
+    return(0);
+  }
   
   //
   // Done. Return the table.
@@ -141,10 +177,11 @@ spindump_connectionstable_uninitialize(struct spindump_connectionstable* table)
   // Go through all connections and delete them
   //
   
+  spindump_connectionstable_rollup_uninitialize(&table->rollup);
   for (unsigned int i = 0; i < table->nConnections; i++) {
     struct spindump_connection* connection = table->connections[i];
     if (connection != 0) {
-      spindump_connections_delete(connection);
+      spindump_connections_delete(connection,table);
       table->connections[i] = 0;
     }
   }
@@ -156,6 +193,15 @@ spindump_connectionstable_uninitialize(struct spindump_connectionstable* table)
   memset(table->connections,0xFF,table->maxNConnections * sizeof(struct spindump_connection*));
   spindump_deepdebugf("free table->connections in spindump_connections_freetable");
   spindump_free(table->connections);
+  spindump_connectionstable_slots_uninitialize(&table->slots);
+  spindump_connectionstable_index_uninitialize(&table->tupleIndex);
+  spindump_connectionstable_index_uninitialize(&table->cidIndex);
+  spindump_connectionstable_pool_uninitialize(&table->pool);
+  spindump_connectionstable_timers_uninitialize(&table->timers);
+  spindump_connectionstable_prefixes_uninitialize(&table->prefixes);
+  spindump_connectionstable_negative_uninitialize(&table->negative);
+  spindump_connectionstable_halfopen_uninitialize(&table->halfOpen);
+  spindump_connectionstable_shared_uninitialize(&table->shared);
   memset(table,0xFF,sizeof(*table));
   spindump_tags_uninitialize(&table->defaultTags);
   spindump_deepdebugf("free table in spindump_connections_freetable");
@@ -167,12 +213,179 @@ spindump_connectionstable_uninitialize(struct spindump_connectionstable* table)
 }
 
 //
-// Perform a check if a given connection needs idle timeout or some
-// other action. This function gets called every few seconds to scan
-// through a connection.
+// Grow the connections table to hold the given number of
+// connections. Returns 1 upon success, and 0 if memory could not be
+// allocated (in which case the table is unchanged).
+//
+
+int
+spindump_connectionstable_grow(struct spindump_connectionstable* table,
+                               unsigned int maxNConnections) {
+  spindump_assert(table != 0);
+  spindump_assert(maxNConnections >= table->maxNConnections);
+  size_t newtabsize = maxNConnections * sizeof(struct spindump_connection*);
+  struct spindump_connection** newtable = (struct spindump_connection**)spindump_malloc(newtabsize);
+  if (newtable == 0) {
+    spindump_errorf("cannot allocate memory for a connection table of size %lu", (unsigned long)newtabsize);
+    return(0);
+  }
+  if (!spindump_connectionstable_slots_resize(&table->slots,maxNConnections)) {
+    spindump_free(newtable);
+    return(0);
+  }
+  memset(newtable,0,newtabsize);
+  memcpy(newtable,table->connections,table->nConnections * sizeof(struct spindump_connection*));
+  spindump_deepdebugf("free oldtable after a growth");
+  spindump_free(table->connections);
+  table->connections = newtable;
+  table->maxNConnections = maxNConnections;
+  return(1);
+}
+
+//
+// Put a new connection in the connections table, at the lowest free
+// position, or at the end if there is none. Returns 1 upon success,
+// and 0 if the table was full and could not be grown.
+//
+
+int
+spindump_connectionstable_addconnection(struct spindump_connectionstable* table,
+                                        struct spindump_connection* connection) {
+  spindump_assert(table != 0);
+  spindump_assert(connection != 0);
+  unsigned int position = spindump_connectionstable_slots_lowest(&table->slots);
+  if (position != UINT_MAX) {
+    spindump_assert(position < table->nConnections);
+    spindump_assert(table->connections[position] == 0);
+    spindump_connectionstable_slots_take(&table->slots,position);
+  } else {
+    if (table->nConnections == table->maxNConnections &&
+        !spindump_connectionstable_grow(table,2 * table->maxNConnections)) {
+      return(0);
+    }
+    position = table->nConnections++;
+  }
+  table->connections[position] = connection;
+  connection->tableIndex = position;
+  connection->tableGeneration = spindump_connectionstable_slots_generation(&table->slots);
+  return(1);
+}
+
+//
+// Take a connection out of the connections table. Its position
+// becomes free, and if it was at the end of the table, the table
+// shrinks to the last position still in use.
 //
 
 static void
+spindump_connectionstable_removeconnection(struct spindump_connection* connection,
+                                           struct spindump_connectionstable* table) {
+  spindump_assert(connection->tableIndex < table->nConnections);
+  spindump_assert(table->connections[connection->tableIndex] == connection);
+  table->connections[connection->tableIndex] = 0;
+  spindump_connectionstable_slots_release(&table->slots,connection->tableIndex);
+  while (table->nConnections > 0 && table->connections[table->nConnections - 1] == 0) {
+    spindump_connectionstable_slots_take(&table->slots,--table->nConnections);
+  }
+}
+
+//
+// Get a handle for a connection in the table. The handle can be kept
+// instead of a pointer to the connection, and resolved when needed.
+//
+
+struct spindump_connectionstable_handle
+spindump_connectionstable_gethandle(const struct spindump_connection* connection) {
+  spindump_assert(connection != 0);
+  struct spindump_connectionstable_handle handle;
+  handle.index = connection->tableIndex;
+  handle.generation = connection->tableGeneration;
+  return(handle);
+}
+
+//
+// Find the connection that a handle refers to. Returns 0 if the
+// connection has been deleted from the table since the handle was
+// taken.
+//
+
+struct spindump_connection*
+spindump_connectionstable_resolvehandle(const struct spindump_connectionstable* table,
+                                        struct spindump_connectionstable_handle handle) {
+  spindump_assert(table != 0);
+  if (handle.index >= table->nConnections) return(0);
+  struct spindump_connection* connection = table->connections[handle.index];
+  if (connection == 0 || connection->tableGeneration != handle.generation) return(0);
+  return(connection);
+}
+
+//
+// Determine the second at which a connection needs to be checked for
+// timeouts next. This is a lower bound: the connection may turn out
+// to have seen more packets by then, in which case it is just
+// scheduled again. Aggregates are counted as establishing when all
+// their member connections are, which can change at any time, so
+// they are always checked at the (shorter) establishing timeout.
+//
+
+static unsigned long long
+spindump_connectionstable_nextcheck(const struct spindump_connection* connection,
+                                    const struct spindump_connectionstable* table) {
+
+  //
+  // Connections that have not seen packets do not time out, but
+  // check them again a bit later
+  //
+
+  if (spindump_iszerotime(&connection->latestPacketFromSide1)) {
+    return(table->timers.now + spindump_connection_deleted_timeout / (1000 * 1000));
+  }
+
+  //
+  // Otherwise, the shortest applicable timeout after the latest packet
+  //
+
+  const struct timeval* latest = &connection->latestPacketFromSide1;
+  if (!spindump_iszerotime(&connection->latestPacketFromSide2) &&
+      spindump_isearliertime(&connection->latestPacketFromSide2,latest)) {
+    latest = &connection->latestPacketFromSide2;
+  }
+  unsigned long timeout = spindump_connection_inactive_timeout;
+  if (connection->deleted) {
+    timeout = spindump_connection_deleted_timeout;
+  } else if (spindump_connections_isaggregate(connection) ||
+             connection->state == spindump_connection_state_establishing) {
+    timeout = spindump_connection_establishing_timeout;
+  }
+  return((unsigned long long)latest->tv_sec + timeout / (1000 * 1000));
+}
+
+//
+// Put a new connection in the timer wheel, or move it to an earlier
+// time when its state changes so that it may time out sooner (e.g.,
+// when it gets closed). Manually created connections do not time out,
+// and are not in the wheel.
+//
+
+void
+spindump_connectionstable_scheduleconnection(struct spindump_connection* connection,
+                                             struct spindump_connectionstable* table) {
+  spindump_assert(connection != 0);
+  spindump_assert(table != 0);
+  if (connection->manuallyCreated) return;
+  spindump_connectionstable_timers_schedule(&table->timers,
+                                            connection,
+                                            spindump_connectionstable_nextcheck(connection,table));
+}
+
+//
+// Perform a check if a given connection needs idle timeout or some
+// other action. This function gets called for the connections whose
+// time has come in the timer wheel. Returns 1 if the connection was
+// deleted.
+//
+
+static int
 spindump_connectionstable_periodiccheck_aux(struct spindump_connection* connection,
                                             const struct timeval* now,
                                             struct spindump_connectionstable* table,
@@ -197,7 +410,7 @@ spindump_connectionstable_periodiccheck_aux(struct spindump_connection* connecti
   // periodic cleanup.
   //
 
-  if (connection->manuallyCreated) return;
+  if (connection->manuallyCreated) return(0);
   
   //
   // See when the last event related to this connection was
@@ -234,49 +447,82 @@ spindump_connectionstable_periodiccheck_aux(struct spindump_connection* connecti
     spindump_connectionstable_deleteconnection(connection,table,analyzer,"inactive",print_info);
     stats->connectionsDeletedInactive++;
     
+  } else {
+    
+    return(0);
+    
   }
+  
+  return(1);
 }
 
 //
-// Compress the connections table by moving connections in the table
-// closer to the beginning of the table. This makes allocation easier,
-// as new entries can be added to the end.
+// Make a periodic report of the connections in the table. If the
+// aggregates are shared with other tables, either only the shared
+// aggregates or only the other connections are reported, depending
+// on the sharedAggregates parameter.
 //
 
-static void
-spindump_connectionstable_compresstable(struct spindump_connectionstable* table) {
-  unsigned int shiftdown = 0;
-  for (unsigned int i = 0; i < table->nConnections; i++) {
-    if (table->connections[i] == 0) {
-      shiftdown++;
-    } else if (shiftdown > 0) {
-      table->connections[i-shiftdown] = table->connections[i];
-      table->connections[i] = 0;
-    }
-  }
-  table->nConnections -= shiftdown;
-  if (shiftdown > 0) spindump_debugf("spindump_connectionstable_compresstable freed %u positions", shiftdown);
-}
-
 static void
 spindump_connectionstable_periodicreport(struct spindump_connectionstable* table,
                                          const struct timeval* now,
-                                         struct spindump_analyze* analyzer) {
+                                         struct spindump_analyze* analyzer,
+                                         int sharedAggregates) {
   spindump_deepdeepdebugf("spindump_connectionstable_periodicreport");
+  if (!spindump_analyze_hashandlers(analyzer,spindump_analyze_event_periodic)) return;
   table->performingPeriodicReport = 1;
   for (unsigned int i = 0; i < table->nConnections; i++) {
-    if (table->connections[i] != 0) {
-      spindump_connection_periodicreport(table->connections[i],table,now,analyzer);
-    }
+    struct spindump_connection* connection = table->connections[i];
+    if (connection == 0) continue;
+    int shared = table->shared.lock != 0 && spindump_connections_isaggregate(connection);
+    if (shared != sharedAggregates) continue;
+    spindump_connection_periodicreport(connection,table,now,analyzer);
   }
   table->performingPeriodicReport = 0;
 }
 
 //
-// This function gets called every few seconds to scan through a
-// connection. It performs periodic maintenance, compression, checking
-// if idle timeout or some other action is needed on a connection,
-// etc.
+// Is a periodic report of the shared aggregates of a table due? This
+// is 0 for tables that do not share their aggregates, as their
+// aggregates are reported in spindump_connectionstable_periodiccheck.
+//
+
+int
+spindump_connectionstable_aggregatereportdue(const struct spindump_connectionstable* table,
+                                             const struct timeval* now) {
+  spindump_assert(table != 0);
+  spindump_assert(now != 0);
+  return(table->shared.lock == &table->shared.ownLock &&
+         table->periodicReportPeriod != 0 &&
+         now->tv_sec - table->shared.lastReport.tv_sec >= table->periodicReportPeriod);
+}
+
+//
+// Make a periodic report of the shared aggregates owned by a table,
+// if one is due. The caller must make sure that none of the tables
+// sharing the aggregates is in use, and that their logged updates
+// have been applied, so that the report shows one consistent view of
+// all the workers' connections.
+//
+
+void
+spindump_connectionstable_aggregatereport(struct spindump_connectionstable* table,
+                                          const struct timeval* now,
+                                          struct spindump_analyze* analyzer) {
+  spindump_assert(table != 0);
+  spindump_assert(now != 0);
+  spindump_assert(analyzer != 0);
+  if (!spindump_connectionstable_aggregatereportdue(table,now)) return;
+  spindump_connectionstable_periodicreport(table,now,analyzer,1);
+  table->shared.lastReport = *now;
+}
+
+//
+// This function gets called every few seconds. It performs periodic
+// maintenance, checking if idle timeout or some other action is
+// needed on a connection, etc. Only the connections that
+// are due in the timer wheel are checked, so the work is proportional
+// to the number of connections that may time out.
 //
 
 int
@@ -290,23 +536,51 @@ spindump_connectionstable_periodiccheck(struct spindump_connectionstable* table,
   if (table->lastPeriodicCheck.tv_sec != now->tv_sec) {
 
     //
-    // Do the check
+    // Bring the aggregates up to date, before they are checked or
+    // reported
     //
+
+    spindump_connectionstable_rollup_fold(table,analyzer);
     
-    for (unsigned int i = 0; i < table->nConnections; i++) {
-      struct spindump_connection* connection = table->connections[i];
-      if (connection != 0) spindump_connectionstable_periodiccheck_aux(connection,now,table,analyzer,print_info);
+    //
+    // Do the check for the connections whose time has come in the
+    // timer wheel. Those that did not time out after all are
+    // scheduled again.
+    //
+    
+    unsigned int nDue = spindump_connectionstable_timers_advance(&table->timers,
+                                                                 (unsigned long long)now->tv_sec);
+    for (unsigned int i = 0; i < nDue; i++) {
+      struct spindump_connection* connection = table->timers.due[i];
+      if (!spindump_connectionstable_periodiccheck_aux(connection,now,table,analyzer,print_info)) {
+        spindump_connectionstable_scheduleconnection(connection,table);
+      }
     }
-    spindump_connectionstable_compresstable(table);
     table->lastPeriodicCheck = *now;
 
+    //
+    // Let the flows that have not been seen for a while age out of
+    // the negative cache
+    //
+
+    spindump_connectionstable_negative_advance(&table->negative,(unsigned long long)now->tv_sec);
+
+    //
+    // Drop the half-open connections whose SYNs were never answered
+    //
+
+    if (table->halfOpen.nPositions > 0) {
+      struct spindump_stats* stats = spindump_analyze_getstats(analyzer);
+      stats->halfOpenExpired += spindump_connectionstable_halfopen_expire(&table->halfOpen,now);
+    }
+
     //
     // Do the reports, if needed
     //
     
     if (table->periodicReportPeriod != 0 &&
         now->tv_sec - table->lastPeriodicReport.tv_sec >=  table->periodicReportPeriod) {
-      spindump_connectionstable_periodicreport(table,now,analyzer);
+      spindump_connectionstable_periodicreport(table,now,analyzer,0);
       table->lastPeriodicReport = *now;
     }
     
@@ -340,6 +614,13 @@ spindump_connectionstable_deleteconnection(struct spindump_connection* connectio
                   connection->id,
                   reason);
   
+  //
+  // Fold any pending updates of the connection, or updates for it
+  // from its members, before it goes away
+  //
+
+  spindump_connectionstable_rollup_fold(table,analyzer);
+  
   //
   // Print connection statistics
   // TODO: calculate connection statistics before that
@@ -370,21 +651,15 @@ spindump_connectionstable_deleteconnection(struct spindump_connection* connectio
   // Delete the connection from the table
   // 
 
-  int found = 0;
-  for (unsigned int i = 0; i < table->nConnections; i++) {
-    if (table->connections[i] == connection) {
-      found = 1;
-      table->connections[i] = 0;
-    }
-  }
-  
-  spindump_assert(found);
+  spindump_connectionstable_removeconnection(connection,table);
+  spindump_connectionstable_unindexconnection(connection,table);
+  spindump_connectionstable_timers_cancel(&table->timers,connection);
   
   //
   // Delete the object
   // 
 
-  spindump_connections_delete(connection);
+  spindump_connections_delete(connection,table);
 }
 
 //
@@ -416,4 +691,10 @@ spindump_connectionstable_report(struct spindump_connectionstable* table,
     struct spindump_connection* connection = table->connections[i];
     if (connection != 0) spindump_connection_report(connection,file,anonymize,querier);
   }
+
+  //
+  // Report on the connection object pool occupancy
+  //
+
+  spindump_connectionstable_pool_report(&table->pool,file);
 }
@@ -53,16 +53,261 @@ spindump_connectionstable_periodiccheck(struct spindump_connectionstable* table,
                                         const struct timeval* now,
                                         struct spindump_analyze* analyzer,
                                         int print_info);
+int
+spindump_connectionstable_aggregatereportdue(const struct spindump_connectionstable* table,
+                                             const struct timeval* now);
+void
+spindump_connectionstable_aggregatereport(struct spindump_connectionstable* table,
+                                          const struct timeval* now,
+                                          struct spindump_analyze* analyzer);
 void
 spindump_connectionstable_deleteconnection(struct spindump_connection* connection,
                                            struct spindump_connectionstable* table,
                                            struct spindump_analyze* analyzer,
                                            const char* reason,
                                            int print_info);
+int
+spindump_connectionstable_grow(struct spindump_connectionstable* table,
+                               unsigned int maxNConnections);
+int
+spindump_connectionstable_addconnection(struct spindump_connectionstable* table,
+                                        struct spindump_connection* connection);
+struct spindump_connectionstable_handle
+spindump_connectionstable_gethandle(const struct spindump_connection* connection);
+struct spindump_connection*
+spindump_connectionstable_resolvehandle(const struct spindump_connectionstable* table,
+                                        struct spindump_connectionstable_handle handle);
+void
+spindump_connectionstable_scheduleconnection(struct spindump_connection* connection,
+                                             struct spindump_connectionstable* table);
 void
 spindump_connectionstable_report(struct spindump_connectionstable* table,
                                  FILE* file,
                                  int anonymize,
                                  struct spindump_reverse_dns* querier);
+int
+spindump_connectionstable_index_initialize(struct spindump_connectionstable_index* index);
+void
+spindump_connectionstable_index_uninitialize(struct spindump_connectionstable_index* index);
+int
+spindump_connectionstable_index_criteriakey(const struct spindump_connection_searchcriteria* criteria,
+                                            uint32_t* key);
+uint32_t
+spindump_connectionstable_index_hostkey(enum spindump_connection_type type,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port);
+uint32_t
+spindump_connectionstable_index_cidkey(const unsigned char* id,
+                                       unsigned int length);
+struct spindump_connection_hashentry*
+spindump_connectionstable_index_bucket(const struct spindump_connectionstable_index* index,
+                                       uint32_t key);
+void
+spindump_connectionstable_index_prefetch(const struct spindump_connectionstable_index* index,
+                                         uint32_t key);
+void
+spindump_connectionstable_indexconnection(struct spindump_connection* connection,
+                                          struct spindump_connectionstable* table);
+void
+spindump_connectionstable_reindexconnection(struct spindump_connection* connection,
+                                            struct spindump_connectionstable* table);
+void
+spindump_connectionstable_unindexconnection(struct spindump_connection* connection,
+                                            struct spindump_connectionstable* table);
+void
+spindump_connectionstable_pool_initialize(struct spindump_connectionstable_pool* pool);
+void
+spindump_connectionstable_pool_uninitialize(struct spindump_connectionstable_pool* pool);
+unsigned int
+spindump_connectionstable_pool_objectsize(enum spindump_connection_type type);
+struct spindump_connection*
+spindump_connectionstable_pool_allocate(struct spindump_connectionstable_pool* pool,
+                                        enum spindump_connection_type type);
+void
+spindump_connectionstable_pool_release(struct spindump_connectionstable_pool* pool,
+                                       struct spindump_connection* connection);
+unsigned int
+spindump_connectionstable_pool_coldobjectsize(enum spindump_connection_type type);
+struct spindump_connection_cold*
+spindump_connectionstable_pool_allocatecold(struct spindump_connectionstable_pool* pool,
+                                            enum spindump_connection_type type);
+void
+spindump_connectionstable_pool_releasecold(struct spindump_connectionstable_pool* pool,
+                                           enum spindump_connection_type type,
+                                           struct spindump_connection_cold* cold);
+void
+spindump_connectionstable_pool_report(const struct spindump_connectionstable_pool* pool,
+                                      FILE* file);
+int
+spindump_connectionstable_slots_initialize(struct spindump_connectionstable_slots* slots,
+                                           unsigned int maxPositions);
+void
+spindump_connectionstable_slots_uninitialize(struct spindump_connectionstable_slots* slots);
+int
+spindump_connectionstable_slots_resize(struct spindump_connectionstable_slots* slots,
+                                       unsigned int maxPositions);
+void
+spindump_connectionstable_slots_release(struct spindump_connectionstable_slots* slots,
+                                        unsigned int position);
+void
+spindump_connectionstable_slots_take(struct spindump_connectionstable_slots* slots,
+                                     unsigned int position);
+unsigned int
+spindump_connectionstable_slots_lowest(struct spindump_connectionstable_slots* slots);
+unsigned int
+spindump_connectionstable_slots_generation(struct spindump_connectionstable_slots* slots);
+void
+spindump_connectionstable_rollup_initialize(struct spindump_connectionstable_rollup* rollup);
+void
+spindump_connectionstable_rollup_uninitialize(struct spindump_connectionstable_rollup* rollup);
+int
+spindump_connectionstable_rollup_defer(struct spindump_connectionstable* table,
+                                       struct spindump_connection* connection,
+                                       const struct timeval* timestamp,
+                                       const int fromResponder,
+                                       unsigned int ipPacketLength,
+                                       uint8_t ecnFlags);
+int
+spindump_connectionstable_rollup_deferevent(struct spindump_connectionstable* table,
+                                            struct spindump_connection* connection,
+                                            uint32_t event,
+                                            const struct timeval* timestamp,
+                                            unsigned int ipPacketLength);
+void
+spindump_connectionstable_rollup_fold(struct spindump_connectionstable* table,
+                                      struct spindump_analyze* analyzer);
+void
+spindump_connectionstable_rollup_release(struct spindump_connection* connection);
+void
+spindump_connectionstable_negative_initialize(struct spindump_connectionstable_negative* negative);
+void
+spindump_connectionstable_negative_uninitialize(struct spindump_connectionstable_negative* negative);
+uint64_t
+spindump_connectionstable_negative_key(enum spindump_connection_type type,
+                                       const spindump_compactaddress* side1address,
+                                       spindump_port side1port,
+                                       const spindump_compactaddress* side2address,
+                                       spindump_port side2port);
+uint64_t
+spindump_connectionstable_negative_addresskey(enum spindump_connection_type type,
+                                              const spindump_address* side1address,
+                                              spindump_port side1port,
+                                              const spindump_address* side2address,
+                                              spindump_port side2port);
+unsigned int
+spindump_connectionstable_negative_lookup(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key);
+void
+spindump_connectionstable_negative_insert(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key);
+void
+spindump_connectionstable_negative_remove(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key);
+void
+spindump_connectionstable_negative_advance(struct spindump_connectionstable_negative* negative,
+                                           unsigned long long now);
+void
+spindump_connectionstable_halfopen_initialize(struct spindump_connectionstable_halfopen* halfOpen);
+void
+spindump_connectionstable_halfopen_uninitialize(struct spindump_connectionstable_halfopen* halfOpen);
+int
+spindump_connectionstable_halfopen_add(struct spindump_connectionstable_halfopen* halfOpen,
+                                       const spindump_compactaddress* side1address,
+                                       spindump_port side1port,
+                                       const spindump_compactaddress* side2address,
+                                       spindump_port side2port,
+                                       const struct timeval* when,
+                                       uint32_t isn,
+                                       uint32_t tsVal,
+                                       unsigned int ipPacketLength,
+                                       uint8_t ecnFlags,
+                                       unsigned int* p_nEvicted);
+int
+spindump_connectionstable_halfopen_take(struct spindump_connectionstable_halfopen* halfOpen,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port,
+                                        int allowReverse,
+                                        struct spindump_connectionstable_halfopenentry* entry,
+                                        int* fromResponder);
+unsigned int
+spindump_connectionstable_halfopen_expire(struct spindump_connectionstable_halfopen* halfOpen,
+                                          const struct timeval* now);
+void
+spindump_connectionstable_timers_initialize(struct spindump_connectionstable_timers* timers);
+void
+spindump_connectionstable_timers_uninitialize(struct spindump_connectionstable_timers* timers);
+void
+spindump_connectionstable_timers_schedule(struct spindump_connectionstable_timers* timers,
+                                          struct spindump_connection* connection,
+                                          unsigned long long expiry);
+void
+spindump_connectionstable_timers_cancel(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection);
+unsigned int
+spindump_connectionstable_timers_advance(struct spindump_connectionstable_timers* timers,
+                                         unsigned long long now);
+void
+spindump_connectionstable_prefixes_initialize(struct spindump_connectionstable_prefixes* prefixes);
+void
+spindump_connectionstable_prefixes_uninitialize(struct spindump_connectionstable_prefixes* prefixes);
+void
+spindump_connectionstable_prefixes_add(struct spindump_connectionstable_prefixes* prefixes,
+                                       const spindump_compactnetwork* network,
+                                       struct spindump_connection* aggregate);
+void
+spindump_connectionstable_prefixes_addaggregate(struct spindump_connectionstable_prefixes* prefixes,
+                                                struct spindump_connection* aggregate);
+void
+spindump_connectionstable_prefixes_copy(struct spindump_connectionstable_prefixes* prefixes,
+                                        const struct spindump_connectionstable_prefixes* from);
+void
+spindump_connectionstable_prefixes_remove(struct spindump_connectionstable_prefixes* prefixes,
+                                          struct spindump_connection* aggregate);
+unsigned int
+spindump_connectionstable_prefixes_candidates(struct spindump_connectionstable_prefixes* prefixes,
+                                              const spindump_compactaddress* address1,
+                                              const spindump_compactaddress* address2);
+struct spindump_connection*
+spindump_connectionstable_prefixes_multinet(struct spindump_connectionstable_prefixes* prefixes,
+                                            const spindump_compactaddress* address,
+                                            const spindump_compactaddress* otherAddress);
+void
+spindump_connectionstable_shared_initialize(struct spindump_connectionstable_shared* shared);
+void
+spindump_connectionstable_shared_uninitialize(struct spindump_connectionstable_shared* shared);
+int
+spindump_connectionstable_shared_attach(struct spindump_connectionstable* table,
+                                        struct spindump_connectionstable* owner);
+void
+spindump_connectionstable_shared_lock(struct spindump_connectionstable* table);
+void
+spindump_connectionstable_shared_unlock(struct spindump_connectionstable* table);
+void
+spindump_connectionstable_shared_packet(struct spindump_connectionstable* table,
+                                        struct spindump_connection* aggregate,
+                                        const struct timeval* timestamp,
+                                        const struct timeval* packetTimestamp,
+                                        int fromResponder,
+                                        unsigned int ipPacketLength,
+                                        uint8_t ecnFlags,
+                                        int handled);
+void
+spindump_connectionstable_shared_rtt(struct spindump_connectionstable* table,
+                                     struct spindump_connection* aggregate,
+                                     unsigned int ipPacketLength,
+                                     int right,
+                                     int unidirectional,
+                                     const struct timeval* sent,
+                                     const struct timeval* rcvd,
+                                     const char* why,
+                                     int handled);
+void
+spindump_connectionstable_shared_apply(struct spindump_connectionstable** tables,
+                                       unsigned int nTables,
+                                       struct spindump_analyze* analyzer);
 
 #endif // SPINDUMP_TABLE_H
@@ -0,0 +1,337 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static int
+spindump_connectionstable_halfopen_allocate(struct spindump_connectionstable_halfopen* halfOpen);
+static uint32_t
+spindump_connectionstable_halfopen_find(struct spindump_connectionstable_halfopen* halfOpen,
+                                        uint32_t key,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port,
+                                        int allowReverse,
+                                        int* fromResponder);
+static void
+spindump_connectionstable_halfopen_unlink(struct spindump_connectionstable_halfopen* halfOpen,
+                                          uint32_t position);
+static int
+spindump_connectionstable_halfopen_pop(struct spindump_connectionstable_halfopen* halfOpen);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize the half-open connections of a table. They are not used
+// until maxEntries is set, and the ring and the buckets are only
+// allocated when the first entry is added.
+//
+
+void
+spindump_connectionstable_halfopen_initialize(struct spindump_connectionstable_halfopen* halfOpen) {
+  spindump_assert(halfOpen != 0);
+  memset(halfOpen,0,sizeof(*halfOpen));
+}
+
+//
+// Free the resources associated with the half-open connections
+//
+
+void
+spindump_connectionstable_halfopen_uninitialize(struct spindump_connectionstable_halfopen* halfOpen) {
+  spindump_assert(halfOpen != 0);
+  if (halfOpen->entries != 0) {
+    spindump_deepdebugf("free halfOpen->entries in spindump_connectionstable_halfopen_uninitialize");
+    spindump_free(halfOpen->entries);
+  }
+  if (halfOpen->buckets != 0) {
+    spindump_deepdebugf("free halfOpen->buckets in spindump_connectionstable_halfopen_uninitialize");
+    spindump_free(halfOpen->buckets);
+  }
+  memset(halfOpen,0xFF,sizeof(*halfOpen));
+}
+
+//
+// Allocate the ring and the buckets, with at least as many buckets as
+// there are positions in the ring. Returns 1 upon success, 0 if
+// memory could not be allocated.
+//
+
+static int
+spindump_connectionstable_halfopen_allocate(struct spindump_connectionstable_halfopen* halfOpen) {
+  spindump_assert(halfOpen->maxEntries > 0);
+  unsigned int nBuckets = 1;
+  while (nBuckets < halfOpen->maxEntries) nBuckets *= 2;
+  unsigned int entriesSize = halfOpen->maxEntries * sizeof(struct spindump_connectionstable_halfopenentry);
+  unsigned int bucketsSize = nBuckets * sizeof(uint32_t);
+  halfOpen->entries = (struct spindump_connectionstable_halfopenentry*)spindump_malloc(entriesSize);
+  halfOpen->buckets = (uint32_t*)spindump_malloc(bucketsSize);
+  if (halfOpen->entries == 0 || halfOpen->buckets == 0) {
+    spindump_errorf("cannot allocate %u half-open connections for %u bytes",
+                    halfOpen->maxEntries, entriesSize + bucketsSize);
+    if (halfOpen->entries != 0) spindump_free(halfOpen->entries);
+    if (halfOpen->buckets != 0) spindump_free(halfOpen->buckets);
+    halfOpen->entries = 0;
+    halfOpen->buckets = 0;
+    return(0);
+  }
+  memset(halfOpen->entries,0,entriesSize);
+  memset(halfOpen->buckets,0xFF,bucketsSize);
+  halfOpen->nBuckets = nBuckets;
+  return(1);
+}
+
+//
+// Find the entry for a given SYN sender and receiver, or, if reverse
+// order is allowed, also the other way around. Returns the position
+// of the entry, or spindump_connectionstable_halfopen_none.
+//
+
+static uint32_t
+spindump_connectionstable_halfopen_find(struct spindump_connectionstable_halfopen* halfOpen,
+                                        uint32_t key,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port,
+                                        int allowReverse,
+                                        int* fromResponder) {
+  uint32_t position = halfOpen->buckets[key & (halfOpen->nBuckets - 1)];
+  while (position != spindump_connectionstable_halfopen_none) {
+    struct spindump_connectionstable_halfopenentry* entry = &halfOpen->entries[position];
+    if (entry->key == key) {
+      if (entry->side1port == side1port &&
+          entry->side2port == side2port &&
+          spindump_compactaddress_equal(&entry->side1address,side1address) &&
+          spindump_compactaddress_equal(&entry->side2address,side2address)) {
+        *fromResponder = 0;
+        return(position);
+      }
+      if (allowReverse &&
+          entry->side1port == side2port &&
+          entry->side2port == side1port &&
+          spindump_compactaddress_equal(&entry->side1address,side2address) &&
+          spindump_compactaddress_equal(&entry->side2address,side1address)) {
+        *fromResponder = 1;
+        return(position);
+      }
+    }
+    position = entry->next;
+  }
+  return(spindump_connectionstable_halfopen_none);
+}
+
+//
+// Remove an entry from its bucket and mark its position as a hole
+//
+
+static void
+spindump_connectionstable_halfopen_unlink(struct spindump_connectionstable_halfopen* halfOpen,
+                                          uint32_t position) {
+  struct spindump_connectionstable_halfopenentry* entry = &halfOpen->entries[position];
+  spindump_assert(entry->used);
+  uint32_t* link = &halfOpen->buckets[entry->key & (halfOpen->nBuckets - 1)];
+  while (*link != position) {
+    spindump_assert(*link != spindump_connectionstable_halfopen_none);
+    link = &halfOpen->entries[*link].next;
+  }
+  *link = entry->next;
+  entry->next = spindump_connectionstable_halfopen_none;
+  entry->used = 0;
+  halfOpen->nEntries--;
+}
+
+//
+// Remove the oldest position from the ring. Returns 1 if it held an
+// entry, which is then evicted, or 0 if it was a hole.
+//
+
+static int
+spindump_connectionstable_halfopen_pop(struct spindump_connectionstable_halfopen* halfOpen) {
+  spindump_assert(halfOpen->nPositions > 0);
+  uint32_t position = halfOpen->head;
+  int evicted = halfOpen->entries[position].used;
+  if (evicted) spindump_connectionstable_halfopen_unlink(halfOpen,position);
+  halfOpen->head = (halfOpen->head + 1) % halfOpen->maxEntries;
+  halfOpen->nPositions--;
+  return(evicted);
+}
+
+//
+// Record a SYN in the half-open connections. A retransmitted SYN
+// updates the existing entry, otherwise a new entry is added, and
+// the oldest entry is evicted if the ring is full. The number of
+// evicted entries is returned in p_nEvicted.
+//
+// Returns 1 upon success, or 0 if memory could not be allocated.
+//
+
+int
+spindump_connectionstable_halfopen_add(struct spindump_connectionstable_halfopen* halfOpen,
+                                       const spindump_compactaddress* side1address,
+                                       spindump_port side1port,
+                                       const spindump_compactaddress* side2address,
+                                       spindump_port side2port,
+                                       const struct timeval* when,
+                                       uint32_t isn,
+                                       uint32_t tsVal,
+                                       unsigned int ipPacketLength,
+                                       uint8_t ecnFlags,
+                                       unsigned int* p_nEvicted) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(halfOpen != 0);
+  spindump_assert(halfOpen->maxEntries > 0);
+  spindump_assert(side1address != 0);
+  spindump_assert(side2address != 0);
+  spindump_assert(when != 0);
+  spindump_assert(p_nEvicted != 0);
+  *p_nEvicted = 0;
+  if (halfOpen->entries == 0 && !spindump_connectionstable_halfopen_allocate(halfOpen)) return(0);
+
+  //
+  // Is this a retransmission?
+  //
+
+  uint32_t key = spindump_connectionstable_index_hostkey(spindump_connection_transport_tcp,
+                                                         side1address,side1port,
+                                                         side2address,side2port);
+  int fromResponder;
+  uint32_t position = spindump_connectionstable_halfopen_find(halfOpen,key,
+                                                              side1address,side1port,
+                                                              side2address,side2port,
+                                                              0,&fromResponder);
+  struct spindump_connectionstable_halfopenentry* entry;
+  if (position != spindump_connectionstable_halfopen_none) {
+    entry = &halfOpen->entries[position];
+    if (entry->nSyns < 0xFFFF) entry->nSyns++;
+    entry->latestSyn = *when;
+    entry->isn = isn;
+    entry->tsVal = tsVal;
+    return(1);
+  }
+
+  //
+  // Make room at the end of the ring, and add the new entry there
+  //
+
+  while (halfOpen->nPositions == halfOpen->maxEntries) {
+    if (spindump_connectionstable_halfopen_pop(halfOpen)) (*p_nEvicted)++;
+  }
+  position = (halfOpen->head + halfOpen->nPositions) % halfOpen->maxEntries;
+  halfOpen->nPositions++;
+  entry = &halfOpen->entries[position];
+  spindump_assert(!entry->used);
+  memset(entry,0,sizeof(*entry));
+  entry->side1address = *side1address;
+  entry->side2address = *side2address;
+  entry->side1port = side1port;
+  entry->side2port = side2port;
+  entry->key = key;
+  entry->firstSyn = *when;
+  entry->latestSyn = *when;
+  entry->isn = isn;
+  entry->tsVal = tsVal;
+  entry->length = (uint16_t)(ipPacketLength < 0xFFFF ? ipPacketLength : 0xFFFF);
+  entry->nSyns = 1;
+  entry->ecnFlags = ecnFlags;
+  entry->used = 1;
+  uint32_t* bucket = &halfOpen->buckets[key & (halfOpen->nBuckets - 1)];
+  entry->next = *bucket;
+  *bucket = position;
+  halfOpen->nEntries++;
+  return(1);
+}
+
+//
+// Take the entry of a flow out of the half-open connections, e.g.,
+// when a SYN ACK is seen for it. If allowReverse is set, the given
+// sides may be in either order, and fromResponder tells which order
+// the entry was found in. Returns 1 and copies the entry if one was
+// found, otherwise returns 0.
+//
+
+int
+spindump_connectionstable_halfopen_take(struct spindump_connectionstable_halfopen* halfOpen,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port,
+                                        int allowReverse,
+                                        struct spindump_connectionstable_halfopenentry* entry,
+                                        int* fromResponder) {
+  spindump_assert(halfOpen != 0);
+  spindump_assert(side1address != 0);
+  spindump_assert(side2address != 0);
+  spindump_assert(spindump_isbool(allowReverse));
+  spindump_assert(entry != 0);
+  spindump_assert(fromResponder != 0);
+  if (halfOpen->nEntries == 0) return(0);
+  uint32_t key = spindump_connectionstable_index_hostkey(spindump_connection_transport_tcp,
+                                                         side1address,side1port,
+                                                         side2address,side2port);
+  uint32_t position = spindump_connectionstable_halfopen_find(halfOpen,key,
+                                                              side1address,side1port,
+                                                              side2address,side2port,
+                                                              allowReverse,fromResponder);
+  if (position == spindump_connectionstable_halfopen_none) return(0);
+  *entry = halfOpen->entries[position];
+  spindump_connectionstable_halfopen_unlink(halfOpen,position);
+  return(1);
+}
+
+//
+// Remove the entries that have not seen a SYN within the
+// establishing timeout, from the start of the ring. Returns the
+// number of entries removed.
+//
+
+unsigned int
+spindump_connectionstable_halfopen_expire(struct spindump_connectionstable_halfopen* halfOpen,
+                                          const struct timeval* now) {
+  spindump_assert(halfOpen != 0);
+  spindump_assert(now != 0);
+  unsigned int nExpired = 0;
+  while (halfOpen->nPositions > 0) {
+    struct spindump_connectionstable_halfopenentry* entry = &halfOpen->entries[halfOpen->head];
+    if (entry->used &&
+        spindump_timediffinusecs(now,&entry->latestSyn) < spindump_connection_establishing_timeout) {
+      break;
+    }
+    nExpired += (unsigned int)spindump_connectionstable_halfopen_pop(halfOpen);
+  }
+  return(nExpired);
+}
@@ -0,0 +1,562 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static uint32_t
+spindump_connectionstable_index_hashbytes(uint32_t hash,
+                                          const unsigned char* data,
+                                          unsigned int length);
+static uint32_t
+spindump_connectionstable_index_finalize(uint32_t hash);
+static uint32_t
+spindump_connectionstable_index_hashside(const spindump_compactaddress* address,
+                                         unsigned int length,
+                                         spindump_port port);
+static uint32_t
+spindump_connectionstable_index_tuplekey(enum spindump_connection_type type,
+                                         const spindump_compactaddress* side1address,
+                                         unsigned int side1length,
+                                         spindump_port side1port,
+                                         const spindump_compactaddress* side2address,
+                                         unsigned int side2length,
+                                         spindump_port side2port);
+static uint32_t
+spindump_connectionstable_index_connectionkey(struct spindump_connection* connection);
+static void
+spindump_connectionstable_index_grow(struct spindump_connectionstable_index* index);
+static void
+spindump_connectionstable_index_link(struct spindump_connectionstable_index* index,
+                                     struct spindump_connection_hashentry* entry,
+                                     uint32_t key);
+static void
+spindump_connectionstable_index_unlink(struct spindump_connectionstable_index* index,
+                                       struct spindump_connection_hashentry* entry);
+static void
+spindump_connectionstable_index_relink(struct spindump_connectionstable_index* index,
+                                       struct spindump_connection_hashentry* entry,
+                                       struct spindump_connection* connection,
+                                       uint32_t key);
+static void
+spindump_connectionstable_index_relinkcid(struct spindump_connectionstable* table,
+                                          struct spindump_connection_hashentry* entry,
+                                          struct spindump_connection* connection,
+                                          const struct spindump_quic_connectionid* cid);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize an index, i.e., a hash table that maps keys calculated
+// from connection identifiers to the connections themselves. Returns
+// 1 upon success, 0 if memory could not be allocated.
+//
+
+int
+spindump_connectionstable_index_initialize(struct spindump_connectionstable_index* index) {
+  spindump_assert(index != 0);
+  unsigned int size = spindump_connectionstable_index_defaultsize * sizeof(struct spindump_connection_hashentry*);
+  index->buckets = (struct spindump_connection_hashentry**)spindump_malloc(size);
+  if (index->buckets == 0) {
+    spindump_errorf("cannot allocate a connection index of %u bytes", size);
+    return(0);
+  }
+  memset(index->buckets,0,size);
+  index->nBuckets = spindump_connectionstable_index_defaultsize;
+  index->nEntries = 0;
+  return(1);
+}
+
+//
+// Free the resources associated with an index. The connections linked
+// to the index are not affected.
+//
+
+void
+spindump_connectionstable_index_uninitialize(struct spindump_connectionstable_index* index) {
+  spindump_assert(index != 0);
+  spindump_assert(index->buckets != 0);
+  spindump_deepdebugf("free index->buckets in spindump_connectionstable_index_uninitialize");
+  spindump_free(index->buckets);
+  index->buckets = 0;
+  index->nBuckets = 0;
+  index->nEntries = 0;
+}
+
+//
+// FNV-1a over a byte string, continuing from a given hash value
+//
+
+static uint32_t
+spindump_connectionstable_index_hashbytes(uint32_t hash,
+                                          const unsigned char* data,
+                                          unsigned int length) {
+  for (unsigned int i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+  return(hash);
+}
+
+//
+// Mix the bits of a hash value so that the low bits used for bucket
+// selection depend on all the input bits
+//
+
+static uint32_t
+spindump_connectionstable_index_finalize(uint32_t hash) {
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+  return(hash);
+}
+
+//
+// Hash one side of a connection: an address, its prefix length
+// (full length for hosts), and a port.
+//
+
+static uint32_t
+spindump_connectionstable_index_hashside(const spindump_compactaddress* address,
+                                         unsigned int length,
+                                         spindump_port port) {
+  unsigned char header[4];
+  header[0] = address->family;
+  header[1] = (unsigned char)length;
+  header[2] = (unsigned char)(port >> 8);
+  header[3] = (unsigned char)(port & 0xFF);
+  uint32_t hash = spindump_connectionstable_index_hashbytes(2166136261U,header,sizeof(header));
+  hash = spindump_connectionstable_index_hashbytes(hash,
+                                                   (const unsigned char*)address->words,
+                                                   sizeof(address->words));
+
+  return(spindump_connectionstable_index_finalize(hash));
+}
+
+//
+// Calculate the key for the address/port index. The two sides are
+// combined in a commutative manner, so that a connection is found
+// regardless of which direction a packet is flowing to.
+//
+
+static uint32_t
+spindump_connectionstable_index_tuplekey(enum spindump_connection_type type,
+                                         const spindump_compactaddress* side1address,
+                                         unsigned int side1length,
+                                         spindump_port side1port,
+                                         const spindump_compactaddress* side2address,
+                                         unsigned int side2length,
+                                         spindump_port side2port) {
+  uint32_t hash = ((uint32_t)type + 1) * 0x9e3779b9U;
+  hash += spindump_connectionstable_index_hashside(side1address,side1length,side1port);
+  hash += spindump_connectionstable_index_hashside(side2address,side2length,side2port);
+  return(spindump_connectionstable_index_finalize(hash));
+}
+
+//
+// Calculate the address/port index key for a connection
+//
+
+static uint32_t
+spindump_connectionstable_index_connectionkey(struct spindump_connection* connection) {
+  spindump_compactnetwork side1network;
+  spindump_compactnetwork side2network;
+  spindump_port side1port;
+  spindump_port side2port;
+  spindump_connections_getnetworks(connection,&side1network,&side2network);
+  spindump_connections_getports(connection,&side1port,&side2port);
+  if (connection->type == spindump_connection_transport_icmp) {
+    side1port = side2port = connection->u.icmp.side1peerId;
+  }
+  return(spindump_connectionstable_index_tuplekey(connection->type,
+                                                  &side1network.address,
+                                                  side1network.length,
+                                                  side1port,
+                                                  &side2network.address,
+                                                  side2network.length,
+                                                  side2port));
+}
+
+//
+// Calculate the address/port index key for a set of search
+// criteria. Returns 1 if the criteria are specific enough for the
+// index to be used, and 0 otherwise. Any connection that matches the
+// criteria is guaranteed to be linked under the returned key.
+//
+
+int
+spindump_connectionstable_index_criteriakey(const struct spindump_connection_searchcriteria* criteria,
+                                            uint32_t* key) {
+  spindump_assert(criteria != 0);
+  spindump_assert(key != 0);
+
+  if (!criteria->matchType) return(0);
+
+  const spindump_compactaddress* side1address = 0;
+  const spindump_compactaddress* side2address = 0;
+  unsigned int side1length = 0;
+  unsigned int side2length = 0;
+  spindump_port side1port = 0;
+  spindump_port side2port = 0;
+  spindump_compactnetwork empty;
+
+  switch (criteria->type) {
+
+  case spindump_connection_transport_tcp:
+  case spindump_connection_transport_udp:
+  case spindump_connection_transport_dns:
+  case spindump_connection_transport_coap:
+  case spindump_connection_transport_quic:
+  case spindump_connection_transport_sctp:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both &&
+        criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both_allowreverse) return(0);
+    if (criteria->matchPorts != spindump_connection_searchcriteria_srcdst_both &&
+        criteria->matchPorts != spindump_connection_searchcriteria_srcdst_both_allowreverse) return(0);
+    side1address = &criteria->side1address;
+    side2address = &criteria->side2address;
+    side1length = spindump_compactaddress_length(side1address);
+    side2length = spindump_compactaddress_length(side2address);
+    side1port = criteria->side1port;
+    side2port = criteria->side2port;
+    break;
+
+  case spindump_connection_transport_icmp:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both) return(0);
+    if (!criteria->matchIcmpId) return(0);
+    side1address = &criteria->side1address;
+    side2address = &criteria->side2address;
+    side1length = spindump_compactaddress_length(side1address);
+    side2length = spindump_compactaddress_length(side2address);
+    side1port = side2port = criteria->icmpId;
+    break;
+
+  case spindump_connection_aggregate_hostpair:
+  case spindump_connection_aggregate_hostmultinet:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both) return(0);
+    side1address = &criteria->side1address;
+    side2address = &criteria->side2address;
+    side1length = spindump_compactaddress_length(side1address);
+    side2length = spindump_compactaddress_length(side2address);
+    break;
+
+  case spindump_connection_aggregate_hostnetwork:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both_hostnetwork) return(0);
+    side1address = &criteria->side1address;
+    side1length = spindump_compactaddress_length(side1address);
+    side2address = &criteria->side2network.address;
+    side2length = criteria->side2network.length;
+    break;
+
+  case spindump_connection_aggregate_networknetwork:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both_networknetwork) return(0);
+    side1address = &criteria->side1network.address;
+    side1length = criteria->side1network.length;
+    side2address = &criteria->side2network.address;
+    side2length = criteria->side2network.length;
+    break;
+
+  case spindump_connection_aggregate_networkmultinet:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_both_networkhost) return(0);
+    side1address = &criteria->side1network.address;
+    side1length = criteria->side1network.length;
+    side2address = &criteria->side2address;
+    side2length = spindump_compactaddress_length(side2address);
+    break;
+
+  case spindump_connection_aggregate_multicastgroup:
+    if (criteria->matchAddresses != spindump_connection_searchcriteria_srcdst_sourceonly) return(0);
+    spindump_compactnetwork_fromempty(AF_INET,&empty);
+    side1address = &empty.address;
+    side1length = empty.length;
+    side2address = &criteria->side1address;
+    side2length = spindump_compactaddress_length(side2address);
+    break;
+
+  default:
+    return(0);
+
+  }
+
+  *key = spindump_connectionstable_index_tuplekey(criteria->type,
+                                                  side1address,
+                                                  side1length,
+                                                  side1port,
+                                                  side2address,
+                                                  side2length,
+                                                  side2port);
+  return(1);
+}
+
+//
+// Calculate the address/port index key for a connection of a given
+// type between two hosts, e.g., from the addresses and ports of a
+// packet. The order of the sides does not matter.
+//
+
+uint32_t
+spindump_connectionstable_index_hostkey(enum spindump_connection_type type,
+                                        const spindump_compactaddress* side1address,
+                                        spindump_port side1port,
+                                        const spindump_compactaddress* side2address,
+                                        spindump_port side2port) {
+  spindump_assert(side1address != 0);
+  spindump_assert(side2address != 0);
+  return(spindump_connectionstable_index_tuplekey(type,
+                                                  side1address,
+                                                  spindump_compactaddress_length(side1address),
+                                                  side1port,
+                                                  side2address,
+                                                  spindump_compactaddress_length(side2address),
+                                                  side2port));
+}
+
+//
+// Calculate the QUIC CID index key for a given connection ID (or a
+// prefix of one, given its length). Identifiers longer than
+// spindump_connection_quic_cid_maxlen are keyed by their first
+// spindump_connection_quic_cid_maxlen bytes, so that a search with a
+// CID of unknown length never needs to try longer lengths.
+//
+
+uint32_t
+spindump_connectionstable_index_cidkey(const unsigned char* id,
+                                       unsigned int length) {
+  spindump_assert(id != 0);
+  if (length > spindump_connection_quic_cid_maxlen) length = spindump_connection_quic_cid_maxlen;
+  unsigned char lengthbyte = (unsigned char)length;
+  uint32_t hash = spindump_connectionstable_index_hashbytes(2166136261U,&lengthbyte,1);
+  hash = spindump_connectionstable_index_hashbytes(hash,id,length);
+  return(spindump_connectionstable_index_finalize(hash));
+}
+
+//
+// Return the chain of entries that may hold entries linked under a
+// given key. The caller needs to check the key of each entry.
+//
+
+struct spindump_connection_hashentry*
+spindump_connectionstable_index_bucket(const struct spindump_connectionstable_index* index,
+                                       uint32_t key) {
+  spindump_assert(index != 0);
+  spindump_assert(index->buckets != 0);
+  return(index->buckets[key & (index->nBuckets - 1)]);
+}
+
+//
+// Start fetching the bucket for a given key into the cache, ahead of
+// a search with the key
+//
+
+void
+spindump_connectionstable_index_prefetch(const struct spindump_connectionstable_index* index,
+                                         uint32_t key) {
+  spindump_assert(index != 0);
+  spindump_assert(index->buckets != 0);
+  spindump_prefetch(&index->buckets[key & (index->nBuckets - 1)]);
+}
+
+//
+// Double the number of buckets in an index. If memory is not
+// available, the index continues to work with its current size.
+//
+
+static void
+spindump_connectionstable_index_grow(struct spindump_connectionstable_index* index) {
+  unsigned int newBuckets = index->nBuckets * 2;
+  unsigned int size = newBuckets * sizeof(struct spindump_connection_hashentry*);
+  struct spindump_connection_hashentry** buckets = (struct spindump_connection_hashentry**)spindump_malloc(size);
+  if (buckets == 0) {
+    spindump_debugf("cannot grow a connection index to %u bytes, continuing with %u buckets", size, index->nBuckets);
+    return;
+  }
+  memset(buckets,0,size);
+  for (unsigned int i = 0; i < index->nBuckets; i++) {
+    struct spindump_connection_hashentry* entry = index->buckets[i];
+    while (entry != 0) {
+      struct spindump_connection_hashentry* next = entry->next;
+      unsigned int bucket = entry->key & (newBuckets - 1);
+      entry->next = buckets[bucket];
+      buckets[bucket] = entry;
+      entry = next;
+    }
+  }
+  spindump_deepdebugf("free old buckets after an index growth");
+  spindump_free(index->buckets);
+  index->buckets = buckets;
+  index->nBuckets = newBuckets;
+}
+
+//
+// Link an entry to an index under a given key
+//
+
+static void
+spindump_connectionstable_index_link(struct spindump_connectionstable_index* index,
+                                     struct spindump_connection_hashentry* entry,
+                                     uint32_t key) {
+  spindump_assert(!entry->linked);
+  if (index->nEntries >= index->nBuckets) {
+    spindump_connectionstable_index_grow(index);
+  }
+  unsigned int bucket = key & (index->nBuckets - 1);
+  entry->key = key;
+  entry->next = index->buckets[bucket];
+  index->buckets[bucket] = entry;
+  entry->linked = 1;
+  index->nEntries++;
+}
+
+//
+// Remove an entry from an index
+//
+
+static void
+spindump_connectionstable_index_unlink(struct spindump_connectionstable_index* index,
+                                       struct spindump_connection_hashentry* entry) {
+  spindump_assert(entry->linked);
+  struct spindump_connection_hashentry** p = &index->buckets[entry->key & (index->nBuckets - 1)];
+  while (*p != 0 && *p != entry) p = &(*p)->next;
+  spindump_assert(*p == entry);
+  *p = entry->next;
+  entry->next = 0;
+  entry->linked = 0;
+  index->nEntries--;
+}
+
+//
+// Ensure that an entry is linked to an index under a given key,
+// moving it from another key if needed
+//
+
+static void
+spindump_connectionstable_index_relink(struct spindump_connectionstable_index* index,
+                                       struct spindump_connection_hashentry* entry,
+                                       struct spindump_connection* connection,
+                                       uint32_t key) {
+  entry->connection = connection;
+  if (entry->linked && entry->key == key) return;
+  if (entry->linked) spindump_connectionstable_index_unlink(index,entry);
+  spindump_connectionstable_index_link(index,entry,key);
+}
+
+//
+// Ensure that an entry is linked to the CID index of a table under a
+// given CID, and keep count of the CID lengths in the index, so that
+// searches with a CID of unknown length only need to try the lengths
+// that are in use
+//
+
+static void
+spindump_connectionstable_index_relinkcid(struct spindump_connectionstable* table,
+                                          struct spindump_connection_hashentry* entry,
+                                          struct spindump_connection* connection,
+                                          const struct spindump_quic_connectionid* cid) {
+  unsigned int length = cid->len;
+  if (length > spindump_connection_quic_cid_maxlen) length = spindump_connection_quic_cid_maxlen;
+  if (entry->linked) table->cidLengths[entry->length]--;
+  spindump_connectionstable_index_relink(&table->cidIndex,
+                                         entry,
+                                         connection,
+                                         spindump_connectionstable_index_cidkey(cid->id,length));
+  entry->length = (uint16_t)length;
+  table->cidLengths[length]++;
+}
+
+//
+// Add a connection to the indexes of a table. This needs to be done
+// after the identifiers (addresses, ports, CIDs, etc) of the
+// connection have been set.
+//
+
+void
+spindump_connectionstable_indexconnection(struct spindump_connection* connection,
+                                          struct spindump_connectionstable* table) {
+  spindump_assert(connection != 0);
+  spindump_assert(table != 0);
+
+  spindump_connectionstable_index_relink(&table->tupleIndex,
+                                         &connection->tupleEntry,
+                                         connection,
+                                         spindump_connectionstable_index_connectionkey(connection));
+
+  if (connection->type == spindump_connection_transport_quic) {
+    spindump_connectionstable_index_relinkcid(table,
+                                              &connection->cidEntries[0],
+                                              connection,
+                                              &connection->u.quic.peer1ConnectionID);
+    spindump_connectionstable_index_relinkcid(table,
+                                              &connection->cidEntries[1],
+                                              connection,
+                                              &connection->u.quic.peer2ConnectionID);
+  }
+
+  if (spindump_connections_isaggregate_simple(connection)) {
+    spindump_connectionstable_prefixes_addaggregate(&table->prefixes,connection);
+  }
+}
+
+//
+// Update the indexes of a table after a connection's identifiers
+// (e.g., QUIC CIDs) have changed
+//
+
+void
+spindump_connectionstable_reindexconnection(struct spindump_connection* connection,
+                                            struct spindump_connectionstable* table) {
+  spindump_deepdeepdebugf("spindump_connectionstable_reindexconnection %u", connection->id);
+  spindump_connectionstable_indexconnection(connection,table);
+}
+
+//
+// Remove a connection from the indexes of a table
+//
+
+void
+spindump_connectionstable_unindexconnection(struct spindump_connection* connection,
+                                            struct spindump_connectionstable* table) {
+  spindump_assert(connection != 0);
+  spindump_assert(table != 0);
+  if (connection->tupleEntry.linked) {
+    spindump_connectionstable_index_unlink(&table->tupleIndex,&connection->tupleEntry);
+  }
+  for (unsigned int i = 0; i < 2; i++) {
+    if (connection->cidEntries[i].linked) {
+      table->cidLengths[connection->cidEntries[i].length]--;
+      spindump_connectionstable_index_unlink(&table->cidIndex,&connection->cidEntries[i]);
+    }
+  }
+  if (spindump_connections_isaggregate(connection)) {
+    spindump_connectionstable_prefixes_remove(&table->prefixes,connection);
+  }
+}
@@ -0,0 +1,395 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static uint64_t
+spindump_connectionstable_negative_finalize(uint64_t hash);
+static uint64_t
+spindump_connectionstable_negative_hashside(const spindump_compactaddress* address,
+                                            spindump_port port);
+static uint32_t
+spindump_connectionstable_negative_fingerprint(uint64_t key);
+static unsigned int
+spindump_connectionstable_negative_alternate(unsigned int index,
+                                             uint32_t fingerprint);
+static int
+spindump_connectionstable_negative_find(struct spindump_connectionstable_negativegeneration* generation,
+                                        uint32_t fingerprint,
+                                        unsigned int index,
+                                        struct spindump_connectionstable_negativebucket** p_bucket,
+                                        unsigned int* p_slot);
+static void
+spindump_connectionstable_negative_place(struct spindump_connectionstable_negative* negative,
+                                         uint32_t fingerprint,
+                                         unsigned int index,
+                                         uint16_t packets);
+static void
+spindump_connectionstable_negative_rotate(struct spindump_connectionstable_negative* negative);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize the negative cache of a table. The buckets are only
+// allocated when the first flow is added.
+//
+
+void
+spindump_connectionstable_negative_initialize(struct spindump_connectionstable_negative* negative) {
+  spindump_assert(negative != 0);
+  memset(negative,0,sizeof(*negative));
+}
+
+//
+// Free the resources associated with the negative cache
+//
+
+void
+spindump_connectionstable_negative_uninitialize(struct spindump_connectionstable_negative* negative) {
+  spindump_assert(negative != 0);
+  for (unsigned int i = 0; i < 2; i++) {
+    if (negative->generations[i].buckets != 0) {
+      spindump_deepdebugf("free negative->generations[%u].buckets in spindump_connectionstable_negative_uninitialize", i);
+      spindump_free(negative->generations[i].buckets);
+    }
+  }
+  memset(negative,0xFF,sizeof(*negative));
+}
+
+//
+// Mix the bits of a hash value, so that both the bucket index (low
+// bits) and the fingerprint (high bits) depend on all the input bits
+//
+
+static uint64_t
+spindump_connectionstable_negative_finalize(uint64_t hash) {
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return(hash);
+}
+
+//
+// Hash one side of a flow: an address and a port. The address is
+// taken a word at a time, as this is done for every TCP and SCTP
+// packet.
+//
+
+static uint64_t
+spindump_connectionstable_negative_hashside(const spindump_compactaddress* address,
+                                            spindump_port port) {
+  uint64_t hash = ((uint64_t)address->family << 16) | port;
+  for (unsigned int i = 0; i < 4; i++) {
+    hash = (hash ^ address->words[i]) * 0x9fb21c651e98df25ULL;
+    hash ^= hash >> 29;
+  }
+  return(spindump_connectionstable_negative_finalize(hash));
+}
+
+//
+// Calculate the key of a flow for the negative cache. The two sides
+// are combined in a commutative manner, so that the flow has the
+// same key in both directions.
+//
+
+uint64_t
+spindump_connectionstable_negative_key(enum spindump_connection_type type,
+                                       const spindump_compactaddress* side1address,
+                                       spindump_port side1port,
+                                       const spindump_compactaddress* side2address,
+                                       spindump_port side2port) {
+  spindump_assert(side1address != 0);
+  spindump_assert(side2address != 0);
+  uint64_t hash = ((uint64_t)type + 1) * 0x9e3779b97f4a7c15ULL;
+  hash += spindump_connectionstable_negative_hashside(side1address,side1port);
+  hash += spindump_connectionstable_negative_hashside(side2address,side2port);
+  return(spindump_connectionstable_negative_finalize(hash));
+}
+
+//
+// Calculate the key of a flow for the negative cache, e.g., from the
+// addresses and ports of a packet
+//
+
+uint64_t
+spindump_connectionstable_negative_addresskey(enum spindump_connection_type type,
+                                              const spindump_address* side1address,
+                                              spindump_port side1port,
+                                              const spindump_address* side2address,
+                                              spindump_port side2port) {
+  spindump_assert(side1address != 0);
+  spindump_assert(side2address != 0);
+  spindump_compactaddress side1compact;
+  spindump_compactaddress side2compact;
+  spindump_compactaddress_fromaddress(side1address,&side1compact);
+  spindump_compactaddress_fromaddress(side2address,&side2compact);
+  return(spindump_connectionstable_negative_key(type,&side1compact,side1port,&side2compact,side2port));
+}
+
+//
+// The fingerprint of a key is its high 32 bits, but never zero, as
+// zero marks an empty slot
+//
+
+static uint32_t
+spindump_connectionstable_negative_fingerprint(uint64_t key) {
+  uint32_t fingerprint = (uint32_t)(key >> 32);
+  return(fingerprint != 0 ? fingerprint : 1);
+}
+
+//
+// Given one of the two buckets of an entry and its fingerprint,
+// calculate the other bucket. The calculation is its own inverse.
+//
+
+static unsigned int
+spindump_connectionstable_negative_alternate(unsigned int index,
+                                             uint32_t fingerprint) {
+  return((index ^ (fingerprint * 0x5bd1e995U)) & (spindump_connectionstable_negative_buckets - 1));
+}
+
+//
+// Find a fingerprint in one generation, in the given bucket or its
+// alternate. Returns 1 and sets the bucket and slot if found,
+// otherwise returns 0.
+//
+
+static int
+spindump_connectionstable_negative_find(struct spindump_connectionstable_negativegeneration* generation,
+                                        uint32_t fingerprint,
+                                        unsigned int index,
+                                        struct spindump_connectionstable_negativebucket** p_bucket,
+                                        unsigned int* p_slot) {
+  if (generation->nEntries == 0) return(0);
+  spindump_assert(generation->buckets != 0);
+  struct spindump_connectionstable_negativebucket* bucket = &generation->buckets[index];
+  for (unsigned int round = 0; round < 2; round++) {
+    for (unsigned int slot = 0; slot < spindump_connectionstable_negative_slots; slot++) {
+      if (bucket->fingerprints[slot] == fingerprint) {
+        *p_bucket = bucket;
+        *p_slot = slot;
+        return(1);
+      }
+    }
+    bucket = &generation->buckets[spindump_connectionstable_negative_alternate(index,fingerprint)];
+  }
+  return(0);
+}
+
+//
+// Look up a flow from the negative cache. If found, count a packet
+// for the flow and return the number of packets seen from it so far,
+// including this one. Otherwise return 0.
+//
+
+unsigned int
+spindump_connectionstable_negative_lookup(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key) {
+  spindump_assert(negative != 0);
+  uint32_t fingerprint = spindump_connectionstable_negative_fingerprint(key);
+  unsigned int index = (unsigned int)(key & (spindump_connectionstable_negative_buckets - 1));
+  struct spindump_connectionstable_negativebucket* bucket;
+  unsigned int slot;
+
+  //
+  // Entries in the current generation are just counted
+  //
+
+  if (spindump_connectionstable_negative_find(&negative->generations[negative->current],
+                                              fingerprint,index,&bucket,&slot)) {
+    if (bucket->packets[slot] < 0xFFFF) bucket->packets[slot]++;
+    return(bucket->packets[slot]);
+  }
+
+  //
+  // Entries in the old generation are moved to the current one
+  //
+
+  struct spindump_connectionstable_negativegeneration* old = &negative->generations[1 - negative->current];
+  if (spindump_connectionstable_negative_find(old,fingerprint,index,&bucket,&slot)) {
+    uint16_t packets = bucket->packets[slot];
+    if (packets < 0xFFFF) packets++;
+    bucket->fingerprints[slot] = 0;
+    bucket->packets[slot] = 0;
+    old->nEntries--;
+    spindump_connectionstable_negative_place(negative,fingerprint,index,packets);
+    return(packets);
+  }
+
+  return(0);
+}
+
+//
+// Add a flow to the negative cache, with its first packet counted.
+// The caller should have looked the flow up first, so that it is not
+// added twice.
+//
+
+void
+spindump_connectionstable_negative_insert(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key) {
+  spindump_assert(negative != 0);
+  spindump_connectionstable_negative_place(negative,
+                                           spindump_connectionstable_negative_fingerprint(key),
+                                           (unsigned int)(key & (spindump_connectionstable_negative_buckets - 1)),
+                                           1);
+}
+
+//
+// Place a fingerprint in the current generation. If both of its
+// buckets are full, entries are relocated to their alternate buckets
+// to make room, and if that does not succeed either, the last entry
+// relocated is dropped. A dropped entry just means that the next
+// packet of that flow is searched from the table again.
+//
+
+static void
+spindump_connectionstable_negative_place(struct spindump_connectionstable_negative* negative,
+                                         uint32_t fingerprint,
+                                         unsigned int index,
+                                         uint16_t packets) {
+
+  //
+  // Rotate the generations, if the current one is getting full
+  //
+
+  struct spindump_connectionstable_negativegeneration* generation = &negative->generations[negative->current];
+  if (generation->nEntries >= (spindump_connectionstable_negative_buckets * spindump_connectionstable_negative_slots * 3) / 4) {
+    spindump_connectionstable_negative_rotate(negative);
+    generation = &negative->generations[negative->current];
+  }
+
+  //
+  // Allocate the buckets, if this is the first entry
+  //
+
+  if (generation->buckets == 0) {
+    unsigned int size = spindump_connectionstable_negative_buckets * sizeof(struct spindump_connectionstable_negativebucket);
+    generation->buckets = (struct spindump_connectionstable_negativebucket*)spindump_malloc(size);
+    if (generation->buckets == 0) {
+      spindump_errorf("cannot allocate a negative cache of %u bytes", size);
+      return;
+    }
+    memset(generation->buckets,0,size);
+  }
+
+  //
+  // Find a free slot, relocating entries if needed
+  //
+
+  for (unsigned int kick = 0; kick <= spindump_connectionstable_negative_maxkicks; kick++) {
+    for (unsigned int round = 0; round < 2; round++) {
+      struct spindump_connectionstable_negativebucket* bucket = &generation->buckets[index];
+      for (unsigned int slot = 0; slot < spindump_connectionstable_negative_slots; slot++) {
+        if (bucket->fingerprints[slot] == 0) {
+          bucket->fingerprints[slot] = fingerprint;
+          bucket->packets[slot] = packets;
+          generation->nEntries++;
+          return;
+        }
+      }
+      index = spindump_connectionstable_negative_alternate(index,fingerprint);
+    }
+    struct spindump_connectionstable_negativebucket* bucket = &generation->buckets[index];
+    unsigned int slot = kick % spindump_connectionstable_negative_slots;
+    uint32_t victimFingerprint = bucket->fingerprints[slot];
+    uint16_t victimPackets = bucket->packets[slot];
+    bucket->fingerprints[slot] = fingerprint;
+    bucket->packets[slot] = packets;
+    fingerprint = victimFingerprint;
+    packets = victimPackets;
+    index = spindump_connectionstable_negative_alternate(index,fingerprint);
+  }
+
+  spindump_deepdebugf("negative cache dropped an entry after %u relocations",
+                      spindump_connectionstable_negative_maxkicks);
+}
+
+//
+// Remove a flow from the negative cache, e.g., when a connection is
+// created for it. Nothing happens if the flow is not in the cache.
+//
+
+void
+spindump_connectionstable_negative_remove(struct spindump_connectionstable_negative* negative,
+                                          uint64_t key) {
+  spindump_assert(negative != 0);
+  uint32_t fingerprint = spindump_connectionstable_negative_fingerprint(key);
+  unsigned int index = (unsigned int)(key & (spindump_connectionstable_negative_buckets - 1));
+  for (unsigned int i = 0; i < 2; i++) {
+    struct spindump_connectionstable_negativegeneration* generation = &negative->generations[i];
+    struct spindump_connectionstable_negativebucket* bucket;
+    unsigned int slot;
+    while (spindump_connectionstable_negative_find(generation,fingerprint,index,&bucket,&slot)) {
+      bucket->fingerprints[slot] = 0;
+      bucket->packets[slot] = 0;
+      generation->nEntries--;
+    }
+  }
+}
+
+//
+// Make the current generation the old one, forgetting the entries
+// in the previous old generation
+//
+
+static void
+spindump_connectionstable_negative_rotate(struct spindump_connectionstable_negative* negative) {
+  negative->current = 1 - negative->current;
+  struct spindump_connectionstable_negativegeneration* generation = &negative->generations[negative->current];
+  if (generation->nEntries > 0) {
+    spindump_assert(generation->buckets != 0);
+    memset(generation->buckets,
+           0,
+           spindump_connectionstable_negative_buckets * sizeof(struct spindump_connectionstable_negativebucket));
+    generation->nEntries = 0;
+  }
+}
+
+//
+// Advance the time of the negative cache to a given second, rotating
+// the generations if a period has passed since the last rotation
+//
+
+void
+spindump_connectionstable_negative_advance(struct spindump_connectionstable_negative* negative,
+                                           unsigned long long now) {
+  spindump_assert(negative != 0);
+  if (negative->rotated == 0) {
+    negative->rotated = now;
+  } else if (now >= negative->rotated + spindump_connectionstable_negative_period) {
+    spindump_connectionstable_negative_rotate(negative);
+    negative->rotated = now;
+  }
+}
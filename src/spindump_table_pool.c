@@ -0,0 +1,381 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static void
+spindump_connectionstable_pool_class_uninitialize(struct spindump_connectionstable_pool_class* class);
+static int
+spindump_connectionstable_pool_grow(struct spindump_connectionstable_pool_class* class);
+static void*
+spindump_connectionstable_pool_class_allocate(struct spindump_connectionstable_pool_class* class);
+static void
+spindump_connectionstable_pool_class_release(struct spindump_connectionstable_pool_class* class,
+                                             void* object);
+static void
+spindump_connectionstable_pool_class_report(const struct spindump_connectionstable_pool_class* class,
+                                            const char* pool,
+                                            const char* name,
+                                            FILE* file);
+
+//
+// Macros -------------------------------------------------------------------------------------
+//
+
+#define spindump_connectionstable_pool_armsize(arm)                   \
+  (offsetof(struct spindump_connection,u) +                           \
+   sizeof(((struct spindump_connection*)0)->u.arm))
+#define spindump_connectionstable_pool_coldarmsize(arm)               \
+  (offsetof(struct spindump_connection_cold,u) +                      \
+   sizeof(((struct spindump_connection_cold*)0)->u.arm))
+#define spindump_connectionstable_pool_roundup(size)                  \
+  ((((size) + _Alignof(struct spindump_connection) - 1) /             \
+    _Alignof(struct spindump_connection)) *                           \
+   _Alignof(struct spindump_connection))
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Return the size of a connection object of a given type. This covers
+// the common fields and the union arm for that type, but not the
+// other, possibly larger union arms. Code that handles a connection
+// must therefore only touch the union arm matching connection->type.
+//
+
+unsigned int
+spindump_connectionstable_pool_objectsize(enum spindump_connection_type type) {
+  size_t size;
+  switch (type) {
+  case spindump_connection_transport_tcp:
+    size = spindump_connectionstable_pool_armsize(tcp);
+    break;
+  case spindump_connection_transport_sctp:
+    size = spindump_connectionstable_pool_armsize(sctp);
+    break;
+  case spindump_connection_transport_udp:
+    size = spindump_connectionstable_pool_armsize(udp);
+    break;
+  case spindump_connection_transport_dns:
+    size = spindump_connectionstable_pool_armsize(dns);
+    break;
+  case spindump_connection_transport_coap:
+    size = spindump_connectionstable_pool_armsize(coap);
+    break;
+  case spindump_connection_transport_quic:
+    size = spindump_connectionstable_pool_armsize(quic);
+    break;
+  case spindump_connection_transport_icmp:
+    size = spindump_connectionstable_pool_armsize(icmp);
+    break;
+  case spindump_connection_aggregate_hostpair:
+    size = spindump_connectionstable_pool_armsize(aggregatehostpair);
+    break;
+  case spindump_connection_aggregate_hostnetwork:
+    size = spindump_connectionstable_pool_armsize(aggregatehostnetwork);
+    break;
+  case spindump_connection_aggregate_networknetwork:
+    size = spindump_connectionstable_pool_armsize(aggregatenetworknetwork);
+    break;
+  case spindump_connection_aggregate_multicastgroup:
+    size = spindump_connectionstable_pool_armsize(aggregatemulticastgroup);
+    break;
+  case spindump_connection_aggregate_hostmultinet:
+    size = spindump_connectionstable_pool_armsize(aggregatehostmultinet);
+    break;
+  case spindump_connection_aggregate_networkmultinet:
+    size = spindump_connectionstable_pool_armsize(aggregatenetworkmultinet);
+    break;
+  default:
+    spindump_errorf("invalid connection type %u in spindump_connectionstable_pool_objectsize",
+                    type);
+    size = sizeof(struct spindump_connection);
+    break;
+  }
+  return((unsigned int)spindump_connectionstable_pool_roundup(size));
+}
+
+//
+// Return the size of the cold part of a connection of a given
+// type. This covers the RTT and handler data, and the union arm with
+// the protocol trackers for that type. UDP and aggregate connections
+// have no trackers.
+//
+
+unsigned int
+spindump_connectionstable_pool_coldobjectsize(enum spindump_connection_type type) {
+  size_t size;
+  switch (type) {
+  case spindump_connection_transport_tcp:
+    size = spindump_connectionstable_pool_coldarmsize(tcp);
+    break;
+  case spindump_connection_transport_sctp:
+    size = spindump_connectionstable_pool_coldarmsize(sctp);
+    break;
+  case spindump_connection_transport_dns:
+    size = spindump_connectionstable_pool_coldarmsize(dns);
+    break;
+  case spindump_connection_transport_coap:
+    size = spindump_connectionstable_pool_coldarmsize(coap);
+    break;
+  case spindump_connection_transport_quic:
+    size = spindump_connectionstable_pool_coldarmsize(quic);
+    break;
+  case spindump_connection_transport_icmp:
+    size = spindump_connectionstable_pool_coldarmsize(icmp);
+    break;
+  default:
+    size = offsetof(struct spindump_connection_cold,u);
+    break;
+  }
+  return((unsigned int)spindump_connectionstable_pool_roundup(size));
+}
+
+//
+// Initialize a connection object pool. No memory is allocated until
+// the first connection of a given type is needed.
+//
+
+void
+spindump_connectionstable_pool_initialize(struct spindump_connectionstable_pool* pool) {
+  spindump_assert(pool != 0);
+  memset(pool,0,sizeof(*pool));
+  for (unsigned int type = 0; type < spindump_connectionstable_pool_nclasses; type++) {
+    pool->classes[type].objectSize =
+      spindump_connectionstable_pool_objectsize((enum spindump_connection_type)type);
+    pool->coldClasses[type].objectSize =
+      spindump_connectionstable_pool_coldobjectsize((enum spindump_connection_type)type);
+    spindump_assert(pool->classes[type].objectSize >= sizeof(struct spindump_connectionstable_pool_freeobject));
+    spindump_assert(pool->coldClasses[type].objectSize >= sizeof(struct spindump_connectionstable_pool_freeobject));
+  }
+}
+
+//
+// Release all slabs of a pool at once. Any connection objects that
+// are still in use become invalid.
+//
+
+void
+spindump_connectionstable_pool_uninitialize(struct spindump_connectionstable_pool* pool) {
+  spindump_assert(pool != 0);
+  for (unsigned int type = 0; type < spindump_connectionstable_pool_nclasses; type++) {
+    spindump_connectionstable_pool_class_uninitialize(&pool->classes[type]);
+    spindump_connectionstable_pool_class_uninitialize(&pool->coldClasses[type]);
+  }
+}
+
+//
+// Release all slabs of one size class
+//
+
+static void
+spindump_connectionstable_pool_class_uninitialize(struct spindump_connectionstable_pool_class* class) {
+  struct spindump_connectionstable_pool_slab* slab = class->slabs;
+  while (slab != 0) {
+    struct spindump_connectionstable_pool_slab* next = slab->next;
+    spindump_deepdebugf("free slab in spindump_connectionstable_pool_class_uninitialize");
+    spindump_free(slab);
+    slab = next;
+  }
+  class->slabs = 0;
+  class->freeList = 0;
+  class->nSlabs = 0;
+  class->nInUse = 0;
+  class->nFree = 0;
+}
+
+//
+// Allocate a new slab for a size class, and put all of its objects
+// on the free list. Returns 1 upon success, 0 if memory could not be
+// allocated.
+//
+
+static int
+spindump_connectionstable_pool_grow(struct spindump_connectionstable_pool_class* class) {
+
+  //
+  // Allocate the slab
+  //
+
+  unsigned int size =
+    sizeof(struct spindump_connectionstable_pool_slab) +
+    spindump_connectionstable_pool_slabobjects * class->objectSize;
+  struct spindump_connectionstable_pool_slab* slab =
+    (struct spindump_connectionstable_pool_slab*)spindump_malloc(size);
+  if (slab == 0) {
+    spindump_errorf("cannot allocate a connection slab of size %u", size);
+    return(0);
+  }
+  slab->next = class->slabs;
+  class->slabs = slab;
+  class->nSlabs++;
+
+  //
+  // Put the objects on the free list, in reverse order so that they
+  // are handed out in address order
+  //
+
+  unsigned char* objects = (unsigned char*)(slab + 1);
+  for (unsigned int i = spindump_connectionstable_pool_slabobjects; i > 0; i--) {
+    struct spindump_connectionstable_pool_freeobject* object =
+      (struct spindump_connectionstable_pool_freeobject*)(objects + (i - 1) * class->objectSize);
+    object->next = class->freeList;
+    class->freeList = object;
+    class->nFree++;
+  }
+
+  return(1);
+}
+
+//
+// Take an object from a size class, growing the class if there are
+// no free objects. Returns 0 if memory could not be allocated.
+//
+
+static void*
+spindump_connectionstable_pool_class_allocate(struct spindump_connectionstable_pool_class* class) {
+  if (class->freeList == 0 && !spindump_connectionstable_pool_grow(class)) {
+    return(0);
+  }
+  struct spindump_connectionstable_pool_freeobject* object = class->freeList;
+  class->freeList = object->next;
+  class->nFree--;
+  class->nInUse++;
+  return(object);
+}
+
+//
+// Return an object to the free list of a size class. The object
+// contents are overwritten.
+//
+
+static void
+spindump_connectionstable_pool_class_release(struct spindump_connectionstable_pool_class* class,
+                                             void* object) {
+  spindump_assert(object != 0);
+  spindump_assert(class->nInUse > 0);
+  memset(object,0x93,class->objectSize);
+  struct spindump_connectionstable_pool_freeobject* freeObject =
+    (struct spindump_connectionstable_pool_freeobject*)object;
+  freeObject->next = class->freeList;
+  class->freeList = freeObject;
+  class->nInUse--;
+  class->nFree++;
+}
+
+//
+// Take a connection object of a given type from the pool. The object
+// is not initialized. Returns 0 if memory could not be allocated.
+//
+
+struct spindump_connection*
+spindump_connectionstable_pool_allocate(struct spindump_connectionstable_pool* pool,
+                                        enum spindump_connection_type type) {
+  spindump_assert(pool != 0);
+  spindump_assert(type < spindump_connectionstable_pool_nclasses);
+  return((struct spindump_connection*)spindump_connectionstable_pool_class_allocate(&pool->classes[type]));
+}
+
+//
+// Return a connection object to the pool, for reuse by the next
+// connection of the same type. The object contents are overwritten.
+//
+
+void
+spindump_connectionstable_pool_release(struct spindump_connectionstable_pool* pool,
+                                       struct spindump_connection* connection) {
+  spindump_assert(pool != 0);
+  spindump_assert(connection != 0);
+  spindump_assert(connection->type < spindump_connectionstable_pool_nclasses);
+  spindump_connectionstable_pool_class_release(&pool->classes[connection->type],connection);
+}
+
+//
+// Take the cold part of a connection of a given type from the
+// pool. The object is not initialized. Returns 0 if memory could not
+// be allocated.
+//
+
+struct spindump_connection_cold*
+spindump_connectionstable_pool_allocatecold(struct spindump_connectionstable_pool* pool,
+                                            enum spindump_connection_type type) {
+  spindump_assert(pool != 0);
+  spindump_assert(type < spindump_connectionstable_pool_nclasses);
+  return((struct spindump_connection_cold*)spindump_connectionstable_pool_class_allocate(&pool->coldClasses[type]));
+}
+
+//
+// Return the cold part of a connection of a given type to the pool.
+//
+
+void
+spindump_connectionstable_pool_releasecold(struct spindump_connectionstable_pool* pool,
+                                           enum spindump_connection_type type,
+                                           struct spindump_connection_cold* cold) {
+  spindump_assert(pool != 0);
+  spindump_assert(cold != 0);
+  spindump_assert(type < spindump_connectionstable_pool_nclasses);
+  spindump_connectionstable_pool_class_release(&pool->coldClasses[type],cold);
+}
+
+//
+// Print a report of the pool occupancy, for those size classes that
+// have been used
+//
+
+void
+spindump_connectionstable_pool_report(const struct spindump_connectionstable_pool* pool,
+                                      FILE* file) {
+  spindump_assert(pool != 0);
+  spindump_assert(file != 0);
+  for (unsigned int type = 0; type < spindump_connectionstable_pool_nclasses; type++) {
+    const char* name = spindump_connection_type_to_string((enum spindump_connection_type)type);
+    spindump_connectionstable_pool_class_report(&pool->classes[type],"connection pool",name,file);
+    spindump_connectionstable_pool_class_report(&pool->coldClasses[type],"cold pool",name,file);
+  }
+}
+
+//
+// Print the occupancy of one size class, if it has been used
+//
+
+static void
+spindump_connectionstable_pool_class_report(const struct spindump_connectionstable_pool_class* class,
+                                            const char* pool,
+                                            const char* name,
+                                            FILE* file) {
+  if (class->nSlabs == 0) return;
+  int width = 40 - (int)strlen(pool) - 2 - 7 - 1;
+  fprintf(file,"%s, %-7s %-*s%8u\n", pool, name, width, "in use:", class->nInUse);
+  fprintf(file,"%s, %-7s %-*s%8u\n", pool, name, width, "free:", class->nFree);
+  fprintf(file,"%s, %-7s %-*s%8u\n", pool, name, width, "slabs:", class->nSlabs);
+}
@@ -0,0 +1,724 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Parameters ---------------------------------------------------------------------------------
+//
+
+#define spindump_connectionstable_prefixes_initialsize  8
+#define spindump_connectionstable_prefixes_maxdepth   129
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static int
+spindump_connectionstable_prefixes_root(const spindump_compactaddress* address);
+static unsigned int
+spindump_connectionstable_prefixes_slot(const spindump_compactaddress* address);
+static struct spindump_connectionstable_prefixnode**
+spindump_connectionstable_prefixes_place(struct spindump_connectionstable_prefixes* prefixes,
+                                         int root,
+                                         const spindump_compactnetwork* network);
+static unsigned int
+spindump_connectionstable_prefixes_bit(const spindump_compactaddress* address,
+                                       unsigned int position);
+static unsigned int
+spindump_connectionstable_prefixes_common(const spindump_compactaddress* address1,
+                                          const spindump_compactaddress* address2,
+                                          unsigned int maxLength);
+static void
+spindump_connectionstable_prefixes_mask(spindump_compactnetwork* network,
+                                        unsigned int length);
+static struct spindump_connectionstable_prefixnode*
+spindump_connectionstable_prefixes_newnode(struct spindump_connectionstable_prefixes* prefixes,
+                                           const spindump_compactnetwork* network,
+                                           unsigned int length);
+static int
+spindump_connectionstable_prefixes_addtolist(struct spindump_connectionstable_prefixlist* list,
+                                             struct spindump_connection* aggregate);
+static int
+spindump_connectionstable_prefixes_removefromlist(struct spindump_connectionstable_prefixlist* list,
+                                                  struct spindump_connection* aggregate);
+static void
+spindump_connectionstable_prefixes_freenode(struct spindump_connectionstable_prefixnode* node);
+static void
+spindump_connectionstable_prefixes_removefromnode(struct spindump_connectionstable_prefixes* prefixes,
+                                                  struct spindump_connectionstable_prefixnode* node,
+                                                  struct spindump_connection* aggregate);
+static void
+spindump_connectionstable_prefixes_copynode(struct spindump_connectionstable_prefixes* prefixes,
+                                            const struct spindump_connectionstable_prefixnode* node);
+static int
+spindump_connectionstable_prefixes_innode(const spindump_compactaddress* address,
+                                          const struct spindump_connectionstable_prefixnode* node);
+static unsigned int
+spindump_connectionstable_prefixes_walk(struct spindump_connectionstable_prefixnode* node,
+                                        const spindump_compactaddress* address,
+                                        struct spindump_connectionstable_prefixnode** path,
+                                        unsigned int depth);
+static unsigned int
+spindump_connectionstable_prefixes_path(struct spindump_connectionstable_prefixes* prefixes,
+                                        const spindump_compactaddress* address,
+                                        struct spindump_connectionstable_prefixnode** path);
+static void
+spindump_connectionstable_prefixes_collect(struct spindump_connectionstable_prefixes* prefixes,
+                                           const spindump_compactaddress* address);
+static int
+spindump_connectionstable_prefixes_compare(const void* a,
+                                           const void* b);
+static int
+spindump_connectionstable_prefixes_multinetmatches(struct spindump_connection* aggregate,
+                                                   const spindump_compactaddress* otherAddress);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize an empty set of prefix tries
+//
+
+void
+spindump_connectionstable_prefixes_initialize(struct spindump_connectionstable_prefixes* prefixes) {
+  spindump_assert(prefixes != 0);
+  memset(prefixes,0,sizeof(*prefixes));
+}
+
+//
+// Free all the nodes of the prefix tries. The aggregates themselves
+// are owned by the connections table and are not freed here.
+//
+
+void
+spindump_connectionstable_prefixes_uninitialize(struct spindump_connectionstable_prefixes* prefixes) {
+  spindump_assert(prefixes != 0);
+  for (unsigned int i = 0; i < 2; i++) {
+    if (prefixes->roots[i] != 0) spindump_connectionstable_prefixes_freenode(prefixes->roots[i]);
+    if (prefixes->slots[i] == 0) continue;
+    for (unsigned int j = 0; j < spindump_connectionstable_prefixes_slots; j++) {
+      if (prefixes->slots[i][j] != 0) spindump_connectionstable_prefixes_freenode(prefixes->slots[i][j]);
+    }
+    spindump_free(prefixes->slots[i]);
+  }
+  if (prefixes->candidates != 0) spindump_free(prefixes->candidates);
+  memset(prefixes,0,sizeof(*prefixes));
+}
+
+//
+// Which trie an address belongs to, or -1 if neither
+//
+
+static int
+spindump_connectionstable_prefixes_root(const spindump_compactaddress* address) {
+  switch (address->family) {
+  case AF_INET: return(0);
+  case AF_INET6: return(1);
+  default: return(-1);
+  }
+}
+
+//
+// Which of the tries of long prefixes an address belongs to. For
+// IPv4, the slot is the leading 16 bits of the address. IPv6
+// addresses share more of their leading bits, and their leading 32
+// bits are hashed to a slot. Prefixes that do not share their leading
+// bits may then end up in the same trie, but that only makes the trie
+// deeper.
+//
+
+static unsigned int
+spindump_connectionstable_prefixes_slot(const spindump_compactaddress* address) {
+  uint32_t leading = ntohl(address->words[0]);
+  if (address->family == AF_INET6) leading *= 0x9e3779b1U;
+  return(leading >> (32 - spindump_connectionstable_prefixes_slotbits));
+}
+
+//
+// Find the trie that a network belongs to, allocating the table of
+// tries of long prefixes if needed. Returns the place of the root of
+// the trie.
+//
+
+static struct spindump_connectionstable_prefixnode**
+spindump_connectionstable_prefixes_place(struct spindump_connectionstable_prefixes* prefixes,
+                                         int root,
+                                         const spindump_compactnetwork* network) {
+  unsigned int shortest =
+    root == 0 ? spindump_connectionstable_prefixes_long4 : spindump_connectionstable_prefixes_long6;
+  if (network->length < shortest) {
+    return(&prefixes->roots[root]);
+  }
+  if (prefixes->slots[root] == 0) {
+    unsigned int size = spindump_connectionstable_prefixes_slots * sizeof(struct spindump_connectionstable_prefixnode*);
+    prefixes->slots[root] = (struct spindump_connectionstable_prefixnode**)spindump_malloc(size);
+    if (prefixes->slots[root] == 0) {
+      spindump_fatalf("cannot allocate a prefix table of %u bytes", size);
+    }
+    memset(prefixes->slots[root],0,size);
+  }
+  return(&prefixes->slots[root][spindump_connectionstable_prefixes_slot(&network->address)]);
+}
+
+//
+// Get the bit at a given position of an address, counting from the
+// most significant bit
+//
+
+static unsigned int
+spindump_connectionstable_prefixes_bit(const spindump_compactaddress* address,
+                                       unsigned int position) {
+  spindump_assert(position < 128);
+  return((ntohl(address->words[position / 32]) >> (31 - position % 32)) & 1);
+}
+
+//
+// Determine how many leading bits two addresses have in common, up
+// to a maximum length
+//
+
+static unsigned int
+spindump_connectionstable_prefixes_common(const spindump_compactaddress* address1,
+                                          const spindump_compactaddress* address2,
+                                          unsigned int maxLength) {
+  unsigned int length = 0;
+  for (unsigned int i = 0; i < 4 && length < maxLength; i++) {
+    uint32_t difference = ntohl(address1->words[i]) ^ ntohl(address2->words[i]);
+    if (difference == 0) {
+      length += 32;
+      continue;
+    }
+    while ((difference & 0x80000000U) == 0) {
+      difference <<= 1;
+      length++;
+    }
+    break;
+  }
+  return(length < maxLength ? length : maxLength);
+}
+
+//
+// Shorten a network to a given length, clearing the bits after it
+//
+
+static void
+spindump_connectionstable_prefixes_mask(spindump_compactnetwork* network,
+                                        unsigned int length) {
+  unsigned int remaining = length;
+  for (unsigned int i = 0; i < 4; i++) {
+    uint32_t mask = (remaining >= 32) ? 0xFFFFFFFFU : (remaining == 0 ? 0 : ~(0xFFFFFFFFU >> remaining));
+    network->address.words[i] = htonl(ntohl(network->address.words[i]) & mask);
+    remaining = (remaining >= 32) ? remaining - 32 : 0;
+  }
+  network->length = length;
+}
+
+//
+// Allocate a node for a given network, shortened to a given length
+//
+
+static struct spindump_connectionstable_prefixnode*
+spindump_connectionstable_prefixes_newnode(struct spindump_connectionstable_prefixes* prefixes,
+                                           const spindump_compactnetwork* network,
+                                           unsigned int length) {
+  struct spindump_connectionstable_prefixnode* node =
+    (struct spindump_connectionstable_prefixnode*)spindump_malloc(sizeof(*node));
+  if (node == 0) {
+    spindump_fatalf("cannot allocate a prefix node of %u bytes", (unsigned int)sizeof(*node));
+  }
+  memset(node,0,sizeof(*node));
+  node->prefix = *network;
+  spindump_connectionstable_prefixes_mask(&node->prefix,length);
+  prefixes->nNodes++;
+  return(node);
+}
+
+//
+// Add an aggregate to a node's list, unless it is already there.
+// Returns 1 if the aggregate was added.
+//
+
+static int
+spindump_connectionstable_prefixes_addtolist(struct spindump_connectionstable_prefixlist* list,
+                                             struct spindump_connection* aggregate) {
+  for (unsigned int i = 0; i < list->nAggregates; i++) {
+    if (list->aggregates[i] == aggregate) return(0);
+  }
+  if (list->maxAggregates == 0) {
+    list->aggregates = &list->single;
+    list->maxAggregates = 1;
+  } else if (list->nAggregates == list->maxAggregates) {
+    unsigned int newMax = list->maxAggregates * 2;
+    struct spindump_connection** newAggregates =
+      (struct spindump_connection**)spindump_malloc(newMax * sizeof(struct spindump_connection*));
+    if (newAggregates == 0) {
+      spindump_fatalf("cannot allocate an aggregate list of %u entries", newMax);
+    }
+    memcpy(newAggregates,list->aggregates,list->nAggregates * sizeof(struct spindump_connection*));
+    if (list->aggregates != &list->single) spindump_free(list->aggregates);
+    list->aggregates = newAggregates;
+    list->maxAggregates = newMax;
+  }
+  list->aggregates[list->nAggregates++] = aggregate;
+  return(1);
+}
+
+//
+// Remove an aggregate from a node's list, keeping the order of the
+// others. Returns 1 if the aggregate was in the list.
+//
+
+static int
+spindump_connectionstable_prefixes_removefromlist(struct spindump_connectionstable_prefixlist* list,
+                                                  struct spindump_connection* aggregate) {
+  for (unsigned int i = 0; i < list->nAggregates; i++) {
+    if (list->aggregates[i] == aggregate) {
+      memmove(&list->aggregates[i],
+              &list->aggregates[i+1],
+              (list->nAggregates - i - 1) * sizeof(struct spindump_connection*));
+      list->nAggregates--;
+      return(1);
+    }
+  }
+  return(0);
+}
+
+//
+// Add an aggregate under a given network. The same aggregate may be
+// added under any number of networks, and adding it again under the
+// same network has no effect.
+//
+
+void
+spindump_connectionstable_prefixes_add(struct spindump_connectionstable_prefixes* prefixes,
+                                       const spindump_compactnetwork* network,
+                                       struct spindump_connection* aggregate) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(network != 0);
+  spindump_assert(aggregate != 0);
+
+  int root = spindump_connectionstable_prefixes_root(&network->address);
+  if (root < 0) {
+    spindump_errorf("invalid address family %u in an aggregate network", network->address.family);
+    return;
+  }
+  unsigned int length = network->length;
+  spindump_assert(length <= spindump_compactaddress_length(&network->address));
+
+  //
+  // Walk down the trie until the network is found, until a node that
+  // the network does not fall under is found, or until there are no
+  // more nodes
+  //
+
+  struct spindump_connectionstable_prefixnode** place =
+    spindump_connectionstable_prefixes_place(prefixes,root,network);
+  while (*place != 0) {
+
+    struct spindump_connectionstable_prefixnode* node = *place;
+    unsigned int common =
+      spindump_connectionstable_prefixes_common(&network->address,
+                                                &node->prefix.address,
+                                                length < node->prefix.length ? length : node->prefix.length);
+
+    if (common == node->prefix.length && common == length) {
+
+      //
+      // The network already has a node
+      //
+
+      break;
+
+    } else if (common == node->prefix.length) {
+
+      //
+      // The network is under this node
+      //
+
+      place = &node->children[spindump_connectionstable_prefixes_bit(&network->address,common)];
+
+    } else if (common == length) {
+
+      //
+      // The node is under the network, put a new node above it
+      //
+
+      struct spindump_connectionstable_prefixnode* parent =
+        spindump_connectionstable_prefixes_newnode(prefixes,network,length);
+      parent->children[spindump_connectionstable_prefixes_bit(&node->prefix.address,common)] = node;
+      *place = parent;
+
+    } else {
+
+      //
+      // The network and the node differ before either ends, and
+      // need a node for their common part above them
+      //
+
+      struct spindump_connectionstable_prefixnode* parent =
+        spindump_connectionstable_prefixes_newnode(prefixes,network,common);
+      unsigned int bit = spindump_connectionstable_prefixes_bit(&network->address,common);
+      parent->children[bit] = spindump_connectionstable_prefixes_newnode(prefixes,network,length);
+      parent->children[1 - bit] = node;
+      *place = parent;
+      place = &parent->children[bit];
+
+    }
+  }
+
+  if (*place == 0) {
+    *place = spindump_connectionstable_prefixes_newnode(prefixes,network,length);
+  }
+
+  //
+  // Add the aggregate to the node
+  //
+
+  struct spindump_connectionstable_prefixlist* list =
+    spindump_connections_isaggregate_simple(aggregate) ? &(*place)->simple : &(*place)->multinet;
+  prefixes->nEntries += (unsigned int)spindump_connectionstable_prefixes_addtolist(list,aggregate);
+}
+
+//
+// Add a simple (not multinet) aggregate to the tries. The aggregate
+// is added under one of the addresses or networks that a connection
+// has to match to belong to the aggregate: the side 1 host or
+// network, or the multicast group.
+//
+
+void
+spindump_connectionstable_prefixes_addaggregate(struct spindump_connectionstable_prefixes* prefixes,
+                                                struct spindump_connection* aggregate) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(aggregate != 0);
+  spindump_assert(spindump_connections_isaggregate_simple(aggregate));
+
+  spindump_compactnetwork network;
+  spindump_compactnetwork side2network;
+  if (aggregate->type == spindump_connection_aggregate_multicastgroup) {
+    spindump_compactnetwork_fromaddress(&aggregate->u.aggregatemulticastgroup.group,&network);
+  } else {
+    spindump_connections_getnetworks(aggregate,&network,&side2network);
+  }
+  spindump_connectionstable_prefixes_add(prefixes,&network,aggregate);
+}
+
+//
+// Add the aggregates of a node and all nodes under it to another set
+// of tries, under the same networks
+//
+
+static void
+spindump_connectionstable_prefixes_copynode(struct spindump_connectionstable_prefixes* prefixes,
+                                            const struct spindump_connectionstable_prefixnode* node) {
+  for (unsigned int i = 0; i < node->simple.nAggregates; i++) {
+    spindump_connectionstable_prefixes_add(prefixes,&node->prefix,node->simple.aggregates[i]);
+  }
+  for (unsigned int i = 0; i < node->multinet.nAggregates; i++) {
+    spindump_connectionstable_prefixes_add(prefixes,&node->prefix,node->multinet.aggregates[i]);
+  }
+  for (unsigned int i = 0; i < 2; i++) {
+    if (node->children[i] != 0) spindump_connectionstable_prefixes_copynode(prefixes,node->children[i]);
+  }
+}
+
+//
+// Add all the aggregates in another set of tries, under the same
+// networks. This lets the tables of several worker threads find the
+// same aggregates.
+//
+
+void
+spindump_connectionstable_prefixes_copy(struct spindump_connectionstable_prefixes* prefixes,
+                                        const struct spindump_connectionstable_prefixes* from) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(from != 0);
+  for (unsigned int i = 0; i < 2; i++) {
+    if (from->roots[i] != 0) spindump_connectionstable_prefixes_copynode(prefixes,from->roots[i]);
+    if (from->slots[i] == 0) continue;
+    for (unsigned int j = 0; j < spindump_connectionstable_prefixes_slots; j++) {
+      if (from->slots[i][j] != 0) spindump_connectionstable_prefixes_copynode(prefixes,from->slots[i][j]);
+    }
+  }
+}
+
+//
+// Free a node and all nodes under it
+//
+
+static void
+spindump_connectionstable_prefixes_freenode(struct spindump_connectionstable_prefixnode* node) {
+  for (unsigned int i = 0; i < 2; i++) {
+    if (node->children[i] != 0) spindump_connectionstable_prefixes_freenode(node->children[i]);
+  }
+  if (node->simple.maxAggregates > 1) spindump_free(node->simple.aggregates);
+  if (node->multinet.maxAggregates > 1) spindump_free(node->multinet.aggregates);
+  spindump_free(node);
+}
+
+//
+// Remove an aggregate from a node and all nodes under it
+//
+
+static void
+spindump_connectionstable_prefixes_removefromnode(struct spindump_connectionstable_prefixes* prefixes,
+                                                  struct spindump_connectionstable_prefixnode* node,
+                                                  struct spindump_connection* aggregate) {
+  prefixes->nEntries -= (unsigned int)spindump_connectionstable_prefixes_removefromlist(&node->simple,aggregate);
+  prefixes->nEntries -= (unsigned int)spindump_connectionstable_prefixes_removefromlist(&node->multinet,aggregate);
+  for (unsigned int i = 0; i < 2; i++) {
+    if (node->children[i] != 0) {
+      spindump_connectionstable_prefixes_removefromnode(prefixes,node->children[i],aggregate);
+    }
+  }
+}
+
+//
+// Remove an aggregate from all networks it was added under. This
+// goes through the whole tries, but aggregates are rarely deleted.
+// Nodes that become empty are left in place.
+//
+
+void
+spindump_connectionstable_prefixes_remove(struct spindump_connectionstable_prefixes* prefixes,
+                                          struct spindump_connection* aggregate) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(aggregate != 0);
+  for (unsigned int i = 0; i < 2; i++) {
+    if (prefixes->roots[i] != 0) {
+      spindump_connectionstable_prefixes_removefromnode(prefixes,prefixes->roots[i],aggregate);
+    }
+    if (prefixes->slots[i] == 0) continue;
+    for (unsigned int j = 0; j < spindump_connectionstable_prefixes_slots; j++) {
+      if (prefixes->slots[i][j] != 0) {
+        spindump_connectionstable_prefixes_removefromnode(prefixes,prefixes->slots[i][j],aggregate);
+      }
+    }
+  }
+}
+
+//
+// Does an address fall under a node's prefix? This is
+// spindump_compactaddress_innetwork, for an address known to be of
+// the right family and a prefix known to have its remaining bits zero.
+//
+
+static int
+spindump_connectionstable_prefixes_innode(const spindump_compactaddress* address,
+                                          const struct spindump_connectionstable_prefixnode* node) {
+  unsigned int remaining = node->prefix.length;
+  for (unsigned int i = 0; remaining > 0; i++) {
+    uint32_t mask = (remaining >= 32) ? 0xFFFFFFFFU : htonl(~(0xFFFFFFFFU >> remaining));
+    if ((address->words[i] & mask) != node->prefix.address.words[i]) return(0);
+    remaining = (remaining >= 32) ? remaining - 32 : 0;
+  }
+  return(1);
+}
+
+//
+// Walk down one trie, adding the nodes whose networks an address
+// falls under to a path. Returns the new length of the path.
+//
+
+static unsigned int
+spindump_connectionstable_prefixes_walk(struct spindump_connectionstable_prefixnode* node,
+                                        const spindump_compactaddress* address,
+                                        struct spindump_connectionstable_prefixnode** path,
+                                        unsigned int depth) {
+  unsigned int maxLength = spindump_compactaddress_length(address);
+  while (node != 0 && spindump_connectionstable_prefixes_innode(address,node)) {
+    spindump_assert(depth < spindump_connectionstable_prefixes_maxdepth);
+    path[depth++] = node;
+    if (node->prefix.length >= maxLength) break;
+    node = node->children[spindump_connectionstable_prefixes_bit(address,node->prefix.length)];
+  }
+  return(depth);
+}
+
+//
+// Find the nodes whose networks an address falls under, from the
+// shortest network to the longest. Returns the number of nodes placed
+// in the path array, which must have room for
+// spindump_connectionstable_prefixes_maxdepth nodes.
+//
+
+static unsigned int
+spindump_connectionstable_prefixes_path(struct spindump_connectionstable_prefixes* prefixes,
+                                        const spindump_compactaddress* address,
+                                        struct spindump_connectionstable_prefixnode** path) {
+  int root = spindump_connectionstable_prefixes_root(address);
+  if (root < 0) return(0);
+  unsigned int depth = spindump_connectionstable_prefixes_walk(prefixes->roots[root],address,path,0);
+  if (prefixes->slots[root] != 0) {
+    depth = spindump_connectionstable_prefixes_walk(prefixes->slots[root][spindump_connectionstable_prefixes_slot(address)],
+                                                    address,
+                                                    path,
+                                                    depth);
+  }
+  return(depth);
+}
+
+//
+// Add the simple aggregates from the nodes an address falls under to
+// the candidates array
+//
+
+static void
+spindump_connectionstable_prefixes_collect(struct spindump_connectionstable_prefixes* prefixes,
+                                           const spindump_compactaddress* address) {
+  struct spindump_connectionstable_prefixnode* path[spindump_connectionstable_prefixes_maxdepth];
+  unsigned int depth = spindump_connectionstable_prefixes_path(prefixes,address,path);
+  for (unsigned int i = 0; i < depth; i++) {
+    struct spindump_connectionstable_prefixlist* list = &path[i]->simple;
+    for (unsigned int j = 0; j < list->nAggregates; j++) {
+      struct spindump_connection* aggregate = list->aggregates[j];
+      if (prefixes->nCandidates == prefixes->maxCandidates) {
+        unsigned int newMax =
+          prefixes->maxCandidates == 0 ?
+          spindump_connectionstable_prefixes_initialsize :
+          prefixes->maxCandidates * 2;
+        struct spindump_connection** newCandidates =
+          (struct spindump_connection**)spindump_malloc(newMax * sizeof(struct spindump_connection*));
+        if (newCandidates == 0) {
+          spindump_fatalf("cannot allocate a candidate list of %u entries", newMax);
+        }
+        if (prefixes->candidates != 0) {
+          memcpy(newCandidates,prefixes->candidates,prefixes->nCandidates * sizeof(struct spindump_connection*));
+          spindump_free(prefixes->candidates);
+        }
+        prefixes->candidates = newCandidates;
+        prefixes->maxCandidates = newMax;
+      }
+      prefixes->candidates[prefixes->nCandidates++] = aggregate;
+    }
+  }
+}
+
+//
+// Comparison function to sort aggregates to their order in the
+// connections table
+//
+
+static int
+spindump_connectionstable_prefixes_compare(const void* a,
+                                           const void* b) {
+  const struct spindump_connection* connection1 = *(struct spindump_connection* const*)a;
+  const struct spindump_connection* connection2 = *(struct spindump_connection* const*)b;
+  if (connection1->tableIndex < connection2->tableIndex) return(-1);
+  else if (connection1->tableIndex > connection2->tableIndex) return(1);
+  else return(0);
+}
+
+//
+// Find the simple aggregates that a connection or packet between two
+// addresses may belong to. Every aggregate that the addresses match
+// is among the candidates, but the candidates still need to be
+// checked, e.g., with spindump_connections_matches_aggregate_srcdst.
+//
+// The candidates are placed in prefixes->candidates, in the order of
+// the connections table, the same order in which a search through
+// the whole table would find them. Returns the number of candidates.
+// The candidates remain valid until the next call.
+//
+
+unsigned int
+spindump_connectionstable_prefixes_candidates(struct spindump_connectionstable_prefixes* prefixes,
+                                              const spindump_compactaddress* address1,
+                                              const spindump_compactaddress* address2) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(address1 != 0);
+  spindump_assert(address2 != 0);
+
+  prefixes->nCandidates = 0;
+  if (prefixes->nEntries == 0) return(0);
+  spindump_connectionstable_prefixes_collect(prefixes,address1);
+  spindump_connectionstable_prefixes_collect(prefixes,address2);
+  if (prefixes->nCandidates <= 1) return(prefixes->nCandidates);
+
+  //
+  // Sort, and remove the aggregates that were found on both paths
+  //
+
+  qsort(prefixes->candidates,
+        prefixes->nCandidates,
+        sizeof(struct spindump_connection*),
+        spindump_connectionstable_prefixes_compare);
+  unsigned int n = 1;
+  for (unsigned int i = 1; i < prefixes->nCandidates; i++) {
+    if (prefixes->candidates[i] != prefixes->candidates[n - 1]) {
+      prefixes->candidates[n++] = prefixes->candidates[i];
+    }
+  }
+  prefixes->nCandidates = n;
+  return(n);
+}
+
+//
+// Does the side 1 of a multinet aggregate match an address?
+//
+
+static int
+spindump_connectionstable_prefixes_multinetmatches(struct spindump_connection* aggregate,
+                                                   const spindump_compactaddress* otherAddress) {
+  switch (aggregate->type) {
+  case spindump_connection_aggregate_hostmultinet:
+    return(spindump_compactaddress_equal(otherAddress,&aggregate->u.aggregatehostmultinet.side1peerAddress));
+  case spindump_connection_aggregate_networkmultinet:
+    return(spindump_compactaddress_innetwork(otherAddress,&aggregate->u.aggregatenetworkmultinet.side1Network));
+  default:
+    return(0);
+  }
+}
+
+//
+// Find a multinet aggregate that has a side 2 network that an address
+// falls under, and whose side 1 matches another address. The longest
+// matching network wins.
+//
+
+struct spindump_connection*
+spindump_connectionstable_prefixes_multinet(struct spindump_connectionstable_prefixes* prefixes,
+                                            const spindump_compactaddress* address,
+                                            const spindump_compactaddress* otherAddress) {
+  spindump_assert(prefixes != 0);
+  spindump_assert(address != 0);
+  spindump_assert(otherAddress != 0);
+
+  if (prefixes->nEntries == 0) return(0);
+  struct spindump_connectionstable_prefixnode* path[spindump_connectionstable_prefixes_maxdepth];
+  unsigned int depth = spindump_connectionstable_prefixes_path(prefixes,address,path);
+  while (depth > 0) {
+    struct spindump_connectionstable_prefixlist* list = &path[--depth]->multinet;
+    for (unsigned int j = 0; j < list->nAggregates; j++) {
+      if (spindump_connectionstable_prefixes_multinetmatches(list->aggregates[j],otherAddress)) {
+        return(list->aggregates[j]);
+      }
+    }
+  }
+  return(0);
+}
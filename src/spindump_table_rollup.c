@@ -0,0 +1,417 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_connections_set_iterator.h"
+#include "spindump_table.h"
+#include "spindump_analyze.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static int
+spindump_connectionstable_rollup_eventindex(spindump_analyze_event event);
+static struct spindump_connection_rollup*
+spindump_connectionstable_rollup_get(struct spindump_connection* connection);
+static int
+spindump_connectionstable_rollup_window(struct spindump_connection* connection,
+                                        struct spindump_connection_rollup* deltas);
+static void
+spindump_connectionstable_rollup_append(struct spindump_connectionstable_rollup* rollup,
+                                        struct spindump_connection* connection,
+                                        struct spindump_connection_rollup* deltas);
+static void
+spindump_connectionstable_rollup_apply(struct spindump_connection* connection,
+                                       const struct spindump_connection_rollup* deltas);
+
+//
+// Variables ----------------------------------------------------------------------------------
+//
+
+//
+// The RTT measurement events that are delivered in batches for
+// aggregates, and the fromResponder argument used for each
+//
+
+static const spindump_analyze_event spindump_connectionstable_rollup_events[spindump_connection_rollup_nevents] = {
+  spindump_analyze_event_newleftrttmeasurement,
+  spindump_analyze_event_newrightrttmeasurement,
+  spindump_analyze_event_newinitrespfullrttmeasurement,
+  spindump_analyze_event_newrespinitfullrttmeasurement
+};
+
+static const int spindump_connectionstable_rollup_eventright[spindump_connection_rollup_nevents] = {
+  0, 1, 0, 1
+};
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize the deferred aggregate updates of a table. Updates are
+// not deferred until the deferred flag is set.
+//
+
+void
+spindump_connectionstable_rollup_initialize(struct spindump_connectionstable_rollup* rollup) {
+  spindump_assert(rollup != 0);
+  memset(rollup,0,sizeof(*rollup));
+}
+
+//
+// Uninitialize the deferred aggregate updates. Any updates that have
+// not been folded are dropped, as the table is going away.
+//
+
+void
+spindump_connectionstable_rollup_uninitialize(struct spindump_connectionstable_rollup* rollup) {
+  spindump_assert(rollup != 0);
+  struct spindump_connection* connection = rollup->first;
+  while (connection != 0) {
+    struct spindump_connection_rollup* deltas = connection->rollup;
+    spindump_assert(deltas != 0 && deltas->pending);
+    connection = deltas->nextPending;
+    deltas->nextPending = 0;
+    deltas->pending = 0;
+  }
+  memset(rollup,0xFF,sizeof(*rollup));
+}
+
+//
+// Map an event to its index in the per-connection event arrays, or
+// return -1 if the event is not delivered in batches.
+//
+
+static int
+spindump_connectionstable_rollup_eventindex(spindump_analyze_event event) {
+  for (int i = 0; i < spindump_connection_rollup_nevents; i++) {
+    if (spindump_connectionstable_rollup_events[i] == event) return(i);
+  }
+  return(-1);
+}
+
+//
+// Get the record of pending updates of a connection, allocating it
+// if needed. Returns 0 if memory could not be allocated.
+//
+
+static struct spindump_connection_rollup*
+spindump_connectionstable_rollup_get(struct spindump_connection* connection) {
+  if (connection->rollup == 0) {
+    struct spindump_connection_rollup* deltas =
+      (struct spindump_connection_rollup*)spindump_malloc(sizeof(struct spindump_connection_rollup));
+    if (deltas == 0) {
+      spindump_errorf("cannot allocate deferred aggregate updates of %lu bytes",
+                      sizeof(struct spindump_connection_rollup));
+      return(0);
+    }
+    memset(deltas,0,sizeof(*deltas));
+    connection->rollup = deltas;
+  }
+  return(connection->rollup);
+}
+
+//
+// Determine the times within which packets of a member connection
+// can be counted locally, i.e., the times within which the packets
+// fall in the current bandwidth measurement periods of all of the
+// connection's aggregates. The periods only ever move forward, so the
+// window stays valid until the next fold. Returns 0 if there is no
+// such window, because an aggregate has not yet seen any packets.
+//
+
+static int
+spindump_connectionstable_rollup_window(struct spindump_connection* connection,
+                                        struct spindump_connection_rollup* deltas) {
+  deltas->responded = 1;
+  deltas->earliest = 0;
+  deltas->deadline = ULLONG_MAX;
+  struct spindump_connection_set_iterator iter;
+  for (spindump_connection_set_iterator_initialize(&connection->aggregates,&iter);
+       !spindump_connection_set_iterator_end(&iter);
+       ) {
+    struct spindump_connection* aggregate = spindump_connection_set_iterator_next(&iter);
+    spindump_assert(aggregate != 0);
+    if (aggregate->packetsFromSide2 == 0) deltas->responded = 0;
+    const struct spindump_bandwidth* sides[2] = { &aggregate->bytesFromSide1, &aggregate->bytesFromSide2 };
+    for (unsigned int i = 0; i < 2; i++) {
+      if (spindump_iszerotime(&sides[i]->thisPeriodStart)) return(0);
+      unsigned long long start;
+      spindump_timeval_to_timestamp(&sides[i]->thisPeriodStart,&start);
+      if (start > deltas->earliest) deltas->earliest = start;
+      if (start + sides[i]->period < deltas->deadline) deltas->deadline = start + sides[i]->period;
+    }
+  }
+  return(1);
+}
+
+//
+// Put a connection at the end of the pending list
+//
+
+static void
+spindump_connectionstable_rollup_append(struct spindump_connectionstable_rollup* rollup,
+                                        struct spindump_connection* connection,
+                                        struct spindump_connection_rollup* deltas) {
+  spindump_assert(!deltas->pending);
+  deltas->pending = 1;
+  deltas->nextPending = 0;
+  if (rollup->last != 0) {
+    rollup->last->rollup->nextPending = connection;
+  } else {
+    rollup->first = connection;
+  }
+  rollup->last = connection;
+  rollup->nPending++;
+}
+
+//
+// Count a packet of a member connection locally, instead of updating
+// all the aggregates the connection belongs to. Returns 1 if the
+// packet was counted, and 0 if the aggregates need to be updated
+// right away. That is the case when updates are not deferred, when
+// the packet ends a bandwidth measurement period of an aggregate,
+// or when the packet causes an event for an aggregate: the first
+// response packet, or an ECN CE mark. In the latter cases the caller
+// must fold all pending updates before updating the aggregates, so
+// that the aggregates see the packets in order.
+//
+
+int
+spindump_connectionstable_rollup_defer(struct spindump_connectionstable* table,
+                                       struct spindump_connection* connection,
+                                       const struct timeval* timestamp,
+                                       const int fromResponder,
+                                       unsigned int ipPacketLength,
+                                       uint8_t ecnFlags) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(table != 0);
+  spindump_assert(connection != 0);
+  spindump_assert(timestamp != 0);
+  spindump_assert(spindump_isbool(fromResponder));
+  spindump_assert(ecnFlags <= 3);
+  if (!table->rollup.deferred || ecnFlags == 0x3) return(0);
+
+  //
+  // Find out if the packet falls in the current periods of the
+  // aggregates
+  //
+
+  struct spindump_connection_rollup* deltas = spindump_connectionstable_rollup_get(connection);
+  if (deltas == 0) return(0);
+  if (!deltas->pending && !spindump_connectionstable_rollup_window(connection,deltas)) return(0);
+  if (fromResponder && !deltas->responded) return(0);
+  unsigned long long now;
+  spindump_timeval_to_timestamp(timestamp,&now);
+  if (now < deltas->earliest || now >= deltas->deadline) return(0);
+  unsigned int* bytes = fromResponder ? &deltas->bytesFromSide2 : &deltas->bytesFromSide1;
+  if (*bytes > UINT_MAX - ipPacketLength) return(0);
+
+  //
+  // Count the packet
+  //
+
+  if (fromResponder) {
+    if (deltas->packetsFromSide2 == 0) deltas->firstPacketFromSide2 = *timestamp;
+    deltas->latestPacketFromSide2 = *timestamp;
+    deltas->packetsFromSide2++;
+  } else {
+    if (deltas->packetsFromSide1 == 0) deltas->firstPacketFromSide1 = *timestamp;
+    deltas->latestPacketFromSide1 = *timestamp;
+    deltas->packetsFromSide1++;
+  }
+  *bytes += ipPacketLength;
+
+  switch (ecnFlags) {
+  case 0x1:
+    if (fromResponder) deltas->ect0FromResponder++; else deltas->ect0FromInitiator++;
+    break;
+  case 0x2:
+    if (fromResponder) deltas->ect1FromResponder++; else deltas->ect1FromInitiator++;
+    break;
+  default:
+    break;
+  }
+
+  if (!deltas->pending) spindump_connectionstable_rollup_append(&table->rollup,connection,deltas);
+  return(1);
+}
+
+//
+// Hold an RTT measurement event of an aggregate until the next fold,
+// instead of delivering it right away. Only the latest event of each
+// kind is delivered, with the aggregate's RTT statistics at the
+// time of the fold. Returns 1 if the event was held, and 0 if it
+// needs to be delivered right away.
+//
+
+int
+spindump_connectionstable_rollup_deferevent(struct spindump_connectionstable* table,
+                                            struct spindump_connection* connection,
+                                            spindump_analyze_event event,
+                                            const struct timeval* timestamp,
+                                            unsigned int ipPacketLength) {
+  spindump_assert(table != 0);
+  spindump_assert(connection != 0);
+  spindump_assert(timestamp != 0);
+  if (!table->rollup.deferred) return(0);
+  if (!spindump_connections_isaggregate(connection)) return(0);
+  int index = spindump_connectionstable_rollup_eventindex(event);
+  if (index < 0) return(0);
+  struct spindump_connection_rollup* deltas = spindump_connectionstable_rollup_get(connection);
+  if (deltas == 0) return(0);
+  deltas->events |= (1U << index);
+  deltas->eventTimes[index] = *timestamp;
+  deltas->eventLengths[index] = ipPacketLength;
+  if (!deltas->pending) spindump_connectionstable_rollup_append(&table->rollup,connection,deltas);
+  return(1);
+}
+
+//
+// Add the pending packet counts of a member connection to each of
+// its aggregates. All of the packets fall in the current bandwidth
+// measurement periods of the aggregates, so they can be counted as
+// if they all arrived at the time of the first one.
+//
+
+static void
+spindump_connectionstable_rollup_apply(struct spindump_connection* connection,
+                                       const struct spindump_connection_rollup* deltas) {
+  struct spindump_connection_set_iterator iter;
+  for (spindump_connection_set_iterator_initialize(&connection->aggregates,&iter);
+       !spindump_connection_set_iterator_end(&iter);
+       ) {
+    struct spindump_connection* aggregate = spindump_connection_set_iterator_next(&iter);
+    spindump_assert(aggregate != 0);
+    if (deltas->packetsFromSide1 > 0) {
+      if (spindump_isearliertime(&deltas->latestPacketFromSide1,&aggregate->latestPacketFromSide1)) {
+        aggregate->latestPacketFromSide1 = deltas->latestPacketFromSide1;
+      }
+      aggregate->packetsFromSide1 += deltas->packetsFromSide1;
+      spindump_bandwidth_newpacket(&aggregate->bytesFromSide1,
+                                   deltas->bytesFromSide1,
+                                   &deltas->firstPacketFromSide1);
+    }
+    if (deltas->packetsFromSide2 > 0) {
+      if (spindump_isearliertime(&deltas->latestPacketFromSide2,&aggregate->latestPacketFromSide2)) {
+        aggregate->latestPacketFromSide2 = deltas->latestPacketFromSide2;
+      }
+      aggregate->packetsFromSide2 += deltas->packetsFromSide2;
+      spindump_bandwidth_newpacket(&aggregate->bytesFromSide2,
+                                   deltas->bytesFromSide2,
+                                   &deltas->firstPacketFromSide2);
+    }
+    aggregate->ect0FromInitiator += deltas->ect0FromInitiator;
+    aggregate->ect0FromResponder += deltas->ect0FromResponder;
+    aggregate->ect1FromInitiator += deltas->ect1FromInitiator;
+    aggregate->ect1FromResponder += deltas->ect1FromResponder;
+  }
+}
+
+//
+// Fold all pending updates into the aggregates: first the packet
+// counts of all members, and then the held RTT events of the
+// aggregates, so that the event handlers see the aggregates fully
+// updated. This needs to be called before anything reads the
+// aggregates.
+//
+
+void
+spindump_connectionstable_rollup_fold(struct spindump_connectionstable* table,
+                                      struct spindump_analyze* analyzer) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(table != 0);
+  spindump_assert(analyzer != 0);
+  struct spindump_connection* first = table->rollup.first;
+  if (first == 0) return;
+  spindump_deepdebugf("folding the pending updates of %u connections", table->rollup.nPending);
+
+  //
+  // Take the list, so that handlers called below see no pending
+  // updates
+  //
+
+  table->rollup.first = 0;
+  table->rollup.last = 0;
+  table->rollup.nPending = 0;
+
+  //
+  // Update the aggregates
+  //
+
+  for (struct spindump_connection* connection = first;
+       connection != 0;
+       connection = connection->rollup->nextPending) {
+    spindump_connectionstable_rollup_apply(connection,connection->rollup);
+  }
+
+  //
+  // Deliver the events and reset the records
+  //
+
+  struct spindump_connection* connection = first;
+  while (connection != 0) {
+    struct spindump_connection_rollup* deltas = connection->rollup;
+    struct spindump_connection* next = deltas->nextPending;
+    struct spindump_connection_rollup events = *deltas;
+    memset(deltas,0,sizeof(*deltas));
+    for (int i = 0; i < spindump_connection_rollup_nevents; i++) {
+      if ((events.events & (1U << i)) == 0) continue;
+      spindump_analyze_process_handlers(analyzer,
+                                        spindump_connectionstable_rollup_events[i],
+                                        &events.eventTimes[i],
+                                        spindump_connectionstable_rollup_eventright[i],
+                                        events.eventLengths[i],
+                                        0,
+                                        connection);
+    }
+    connection = next;
+  }
+}
+
+//
+// Free the record of pending updates of a connection that is being
+// deleted. The updates must have been folded before.
+//
+
+void
+spindump_connectionstable_rollup_release(struct spindump_connection* connection) {
+  spindump_assert(connection != 0);
+  if (connection->rollup == 0) return;
+  spindump_assert(!connection->rollup->pending);
+  spindump_free(connection->rollup);
+  connection->rollup = 0;
+}
@@ -0,0 +1,339 @@
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+#include "spindump_analyze.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static struct spindump_connectionstable_sharedupdate*
+spindump_connectionstable_shared_append(struct spindump_connectionstable_shared* shared,
+                                        struct spindump_connection* aggregate,
+                                        enum spindump_connectionstable_sharedtype type);
+static void
+spindump_connectionstable_shared_applyupdate(const struct spindump_connectionstable_sharedupdate* update,
+                                             struct spindump_packet* packet,
+                                             struct spindump_analyze* analyzer);
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize the shared aggregates of a table. The aggregates are not
+// shared until spindump_connectionstable_shared_attach is called.
+//
+
+void
+spindump_connectionstable_shared_initialize(struct spindump_connectionstable_shared* shared) {
+  spindump_assert(shared != 0);
+  memset(shared,0,sizeof(*shared));
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_settype(&attributes,PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&shared->ownLock,&attributes);
+  pthread_mutexattr_destroy(&attributes);
+}
+
+//
+// Free the log of a table. Any updates not yet applied are lost.
+//
+
+void
+spindump_connectionstable_shared_uninitialize(struct spindump_connectionstable_shared* shared) {
+  spindump_assert(shared != 0);
+  if (shared->updates != 0) spindump_free(shared->updates);
+  pthread_mutex_destroy(&shared->ownLock);
+  memset(shared,0,sizeof(*shared));
+}
+
+//
+// Let a table use the aggregates of another table, the owner, when
+// the tables belong to different worker threads. This needs to be
+// called after the aggregates have been created, and before the
+// workers start. The cold parts of the aggregates are allocated here,
+// from the owner's pool, as the workers would otherwise allocate them
+// from their own pools.
+//
+// Deferred aggregate updates are turned off in both tables, as the
+// logs already keep the updates until they can be applied.
+//
+// Returns 1 upon success, and 0 if memory could not be allocated.
+//
+
+int
+spindump_connectionstable_shared_attach(struct spindump_connectionstable* table,
+                                        struct spindump_connectionstable* owner) {
+  spindump_assert(table != 0);
+  spindump_assert(owner != 0);
+  spindump_assert(table != owner);
+  for (unsigned int i = 0; i < owner->nConnections; i++) {
+    struct spindump_connection* connection = owner->connections[i];
+    if (connection != 0 &&
+        spindump_connections_isaggregate(connection) &&
+        spindump_connections_getcold(connection,owner) == 0) {
+      return(0);
+    }
+  }
+  owner->shared.lock = &owner->shared.ownLock;
+  owner->rollup.deferred = 0;
+  table->shared.lock = owner->shared.lock;
+  table->rollup.deferred = 0;
+  spindump_connectionstable_prefixes_copy(&table->prefixes,&owner->prefixes);
+  return(1);
+}
+
+//
+// Take the lock of the aggregates, before changing their sets of
+// connections. This does nothing unless the aggregates are shared.
+//
+
+void
+spindump_connectionstable_shared_lock(struct spindump_connectionstable* table) {
+  spindump_assert(table != 0);
+  if (table->shared.lock != 0) pthread_mutex_lock(table->shared.lock);
+}
+
+//
+// Release the lock of the aggregates
+//
+
+void
+spindump_connectionstable_shared_unlock(struct spindump_connectionstable* table) {
+  spindump_assert(table != 0);
+  if (table->shared.lock != 0) pthread_mutex_unlock(table->shared.lock);
+}
+
+//
+// Add an update to the end of the log of a table, growing the log if
+// needed, and return it for the caller to fill in
+//
+
+static struct spindump_connectionstable_sharedupdate*
+spindump_connectionstable_shared_append(struct spindump_connectionstable_shared* shared,
+                                        struct spindump_connection* aggregate,
+                                        enum spindump_connectionstable_sharedtype type) {
+  if (shared->nUpdates == shared->maxUpdates) {
+    unsigned int newMax =
+      shared->maxUpdates == 0 ?
+      spindump_connectionstable_shared_initialsize :
+      shared->maxUpdates * 2;
+    struct spindump_connectionstable_sharedupdate* newUpdates =
+      (struct spindump_connectionstable_sharedupdate*)spindump_malloc(newMax * sizeof(struct spindump_connectionstable_sharedupdate));
+    if (newUpdates == 0) {
+      spindump_fatalf("cannot allocate a log of %u aggregate updates", newMax);
+    }
+    if (shared->updates != 0) {
+      memcpy(newUpdates,shared->updates,shared->nUpdates * sizeof(struct spindump_connectionstable_sharedupdate));
+      spindump_free(shared->updates);
+    }
+    shared->updates = newUpdates;
+    shared->maxUpdates = newMax;
+  }
+  struct spindump_connectionstable_sharedupdate* update = &shared->updates[shared->nUpdates++];
+  memset(update,0,sizeof(*update));
+  update->sequence = shared->sequence;
+  update->aggregate = aggregate;
+  update->type = type;
+  return(update);
+}
+
+//
+// Log a packet of a member connection for an aggregate, instead of
+// calling spindump_analyze_process_pakstats for the aggregate. The
+// handled parameter tells if the packet has already caused events, in
+// which case the aggregate does not get a new packet event for it.
+//
+
+void
+spindump_connectionstable_shared_packet(struct spindump_connectionstable* table,
+                                        struct spindump_connection* aggregate,
+                                        const struct timeval* timestamp,
+                                        const struct timeval* packetTimestamp,
+                                        int fromResponder,
+                                        unsigned int ipPacketLength,
+                                        uint8_t ecnFlags,
+                                        int handled) {
+  spindump_assert(table != 0);
+  spindump_assert(aggregate != 0);
+  spindump_assert(timestamp != 0);
+  spindump_assert(packetTimestamp != 0);
+  spindump_assert(spindump_isbool(fromResponder));
+  spindump_assert(spindump_isbool(handled));
+  struct spindump_connectionstable_sharedupdate* update =
+    spindump_connectionstable_shared_append(&table->shared,aggregate,spindump_connectionstable_sharedtype_packet);
+  update->timestamp = *timestamp;
+  update->packetTimestamp = *packetTimestamp;
+  update->fromResponder = fromResponder;
+  update->ipPacketLength = ipPacketLength;
+  update->ecnFlags = ecnFlags;
+  update->handled = handled;
+}
+
+//
+// Log an RTT measurement of a member connection for an aggregate,
+// instead of calling spindump_connections_newrttmeasurement for the
+// aggregate
+//
+
+void
+spindump_connectionstable_shared_rtt(struct spindump_connectionstable* table,
+                                     struct spindump_connection* aggregate,
+                                     unsigned int ipPacketLength,
+                                     int right,
+                                     int unidirectional,
+                                     const struct timeval* sent,
+                                     const struct timeval* rcvd,
+                                     const char* why,
+                                     int handled) {
+  spindump_assert(table != 0);
+  spindump_assert(aggregate != 0);
+  spindump_assert(spindump_isbool(right));
+  spindump_assert(spindump_isbool(unidirectional));
+  spindump_assert(sent != 0);
+  spindump_assert(rcvd != 0);
+  spindump_assert(why != 0);
+  spindump_assert(spindump_isbool(handled));
+  struct spindump_connectionstable_sharedupdate* update =
+    spindump_connectionstable_shared_append(&table->shared,aggregate,spindump_connectionstable_sharedtype_rtt);
+  update->timestamp = *rcvd;
+  update->packetTimestamp = *sent;
+  update->why = why;
+  update->fromResponder = right;
+  update->unidirectional = unidirectional;
+  update->ipPacketLength = ipPacketLength;
+  update->handled = handled;
+}
+
+//
+// Apply one logged update to its aggregate. The packet stands in for
+// the packet that caused the update; only its time and the count of
+// handler calls matter for an aggregate.
+//
+
+static void
+spindump_connectionstable_shared_applyupdate(const struct spindump_connectionstable_sharedupdate* update,
+                                             struct spindump_packet* packet,
+                                             struct spindump_analyze* analyzer) {
+  packet->timestamp = update->packetTimestamp;
+  switch (update->type) {
+  case spindump_connectionstable_sharedtype_packet:
+    spindump_analyze_process_pakstats(analyzer,
+                                      update->aggregate,
+                                      &update->timestamp,
+                                      update->fromResponder,
+                                      packet,
+                                      update->ipPacketLength,
+                                      update->ecnFlags);
+    break;
+  case spindump_connectionstable_sharedtype_rtt:
+    spindump_connections_newrttmeasurement(analyzer,
+                                           packet,
+                                           update->aggregate,
+                                           update->ipPacketLength,
+                                           update->fromResponder,
+                                           update->unidirectional,
+                                           &update->packetTimestamp,
+                                           &update->timestamp,
+                                           update->why);
+    break;
+  default:
+    spindump_errorf("invalid aggregate update type %u", update->type);
+    break;
+  }
+}
+
+//
+// Apply the logged updates of all the tables sharing the aggregates,
+// in the order of the packets that caused them, and empty the
+// logs. The analyzer is the one of the table that owns the
+// aggregates. None of the tables may be in use by their workers while
+// this is done.
+//
+
+void
+spindump_connectionstable_shared_apply(struct spindump_connectionstable** tables,
+                                       unsigned int nTables,
+                                       struct spindump_analyze* analyzer) {
+
+  //
+  // Checks
+  //
+
+  spindump_assert(tables != 0);
+  spindump_assert(analyzer != 0);
+  spindump_assert(analyzer->table->shared.lock == &analyzer->table->shared.ownLock);
+
+  //
+  // Each log is in the order of its packets, so merge them by always
+  // taking the update with the lowest packet sequence number. The
+  // updates of one packet are all in the same log, and stay in the
+  // order they were made.
+  //
+
+  struct spindump_packet packet;
+  memset(&packet,0,sizeof(packet));
+  unsigned long long packetSequence = 0;
+  int first = 1;
+  while (1) {
+    struct spindump_connectionstable_shared* next = 0;
+    for (unsigned int i = 0; i < nTables; i++) {
+      struct spindump_connectionstable_shared* shared = &tables[i]->shared;
+      if (shared->nApplied < shared->nUpdates &&
+          (next == 0 ||
+           shared->updates[shared->nApplied].sequence < next->updates[next->nApplied].sequence)) {
+        next = shared;
+      }
+    }
+    if (next == 0) break;
+    const struct spindump_connectionstable_sharedupdate* update = &next->updates[next->nApplied++];
+
+    //
+    // For each packet, the aggregates get a new packet event only if
+    // there was no other event for the packet, as without worker
+    // threads
+    //
+
+    if (first || update->sequence != packetSequence) {
+      first = 0;
+      packetSequence = update->sequence;
+      packet.analyzerHandlerCalls = analyzer->stats->analyzerHandlerCalls;
+      if (update->handled) packet.analyzerHandlerCalls--;
+    }
+    spindump_connectionstable_shared_applyupdate(update,&packet,analyzer);
+  }
+
+  //
+  // Empty the logs
+  //
+
+  for (unsigned int i = 0; i < nTables; i++) {
+    tables[i]->shared.nUpdates = 0;
+    tables[i]->shared.nApplied = 0;
+  }
+}
@@ -0,0 +1,207 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static unsigned int
+spindump_connectionstable_slots_nwords(unsigned int nBits);
+
+//
+// Macros -------------------------------------------------------------------------------------
+//
+
+#define spindump_connectionstable_slots_wordbits 64
+#define spindump_connectionstable_slots_bit(n)   (1ULL << ((n) % spindump_connectionstable_slots_wordbits))
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Number of bitmap words needed for a given number of bits
+//
+
+static unsigned int
+spindump_connectionstable_slots_nwords(unsigned int nBits) {
+  return((nBits + spindump_connectionstable_slots_wordbits - 1) / spindump_connectionstable_slots_wordbits);
+}
+
+//
+// Initialize the free positions of a connections table with the
+// given number of positions, none of which are free. Returns 1 upon
+// success, and 0 if memory could not be allocated.
+//
+
+int
+spindump_connectionstable_slots_initialize(struct spindump_connectionstable_slots* slots,
+                                           unsigned int maxPositions) {
+  spindump_assert(slots != 0);
+  memset(slots,0,sizeof(*slots));
+  slots->nextGeneration = 1;
+  return(spindump_connectionstable_slots_resize(slots,maxPositions));
+}
+
+//
+// Uninitialize the free positions, i.e., free the bitmaps
+//
+
+void
+spindump_connectionstable_slots_uninitialize(struct spindump_connectionstable_slots* slots) {
+  spindump_assert(slots != 0);
+  if (slots->freeWords != 0) spindump_free(slots->freeWords);
+  if (slots->summaryWords != 0) spindump_free(slots->summaryWords);
+  memset(slots,0xFF,sizeof(*slots));
+}
+
+//
+// Grow the bitmaps to cover the given number of positions, when the
+// connections table grows. The new positions are not free; they
+// become used as the table is filled from its end. Returns 1 upon
+// success, and 0 if memory could not be allocated (in which case
+// the bitmaps are unchanged).
+//
+
+int
+spindump_connectionstable_slots_resize(struct spindump_connectionstable_slots* slots,
+                                       unsigned int maxPositions) {
+  spindump_assert(slots != 0);
+  spindump_assert(maxPositions >= slots->maxPositions);
+  unsigned int oldNWords = spindump_connectionstable_slots_nwords(slots->maxPositions);
+  unsigned int newNWords = spindump_connectionstable_slots_nwords(maxPositions);
+  unsigned int oldNSummary = spindump_connectionstable_slots_nwords(oldNWords);
+  unsigned int newNSummary = spindump_connectionstable_slots_nwords(newNWords);
+  if (newNWords > oldNWords || slots->freeWords == 0) {
+    size_t wordsSize = (newNWords > 0 ? newNWords : 1) * sizeof(uint64_t);
+    size_t summarySize = (newNSummary > 0 ? newNSummary : 1) * sizeof(uint64_t);
+    uint64_t* freeWords = (uint64_t*)spindump_malloc(wordsSize);
+    uint64_t* summaryWords = (uint64_t*)spindump_malloc(summarySize);
+    if (freeWords == 0 || summaryWords == 0) {
+      spindump_errorf("cannot allocate the free position bitmaps for %u positions", maxPositions);
+      if (freeWords != 0) spindump_free(freeWords);
+      if (summaryWords != 0) spindump_free(summaryWords);
+      return(0);
+    }
+    memset(freeWords,0,wordsSize);
+    memset(summaryWords,0,summarySize);
+    if (slots->freeWords != 0) {
+      memcpy(freeWords,slots->freeWords,oldNWords * sizeof(uint64_t));
+      memcpy(summaryWords,slots->summaryWords,oldNSummary * sizeof(uint64_t));
+      spindump_free(slots->freeWords);
+      spindump_free(slots->summaryWords);
+    }
+    slots->freeWords = freeWords;
+    slots->summaryWords = summaryWords;
+  }
+  slots->maxPositions = maxPositions;
+  return(1);
+}
+
+//
+// Mark a position free
+//
+
+void
+spindump_connectionstable_slots_release(struct spindump_connectionstable_slots* slots,
+                                        unsigned int position) {
+  spindump_assert(slots != 0);
+  spindump_assert(position < slots->maxPositions);
+  unsigned int word = position / spindump_connectionstable_slots_wordbits;
+  unsigned int summary = word / spindump_connectionstable_slots_wordbits;
+  spindump_assert((slots->freeWords[word] & spindump_connectionstable_slots_bit(position)) == 0);
+  slots->freeWords[word] |= spindump_connectionstable_slots_bit(position);
+  slots->summaryWords[summary] |= spindump_connectionstable_slots_bit(word);
+  if (summary < slots->firstSummaryWord) slots->firstSummaryWord = summary;
+  slots->nFree++;
+}
+
+//
+// Mark a free position used again. This is done for the free
+// position that spindump_connectionstable_slots_lowest returned, as
+// well as for free positions at the end of the table when the table
+// shrinks.
+//
+
+void
+spindump_connectionstable_slots_take(struct spindump_connectionstable_slots* slots,
+                                     unsigned int position) {
+  spindump_assert(slots != 0);
+  spindump_assert(position < slots->maxPositions);
+  unsigned int word = position / spindump_connectionstable_slots_wordbits;
+  unsigned int summary = word / spindump_connectionstable_slots_wordbits;
+  spindump_assert((slots->freeWords[word] & spindump_connectionstable_slots_bit(position)) != 0);
+  slots->freeWords[word] &= ~spindump_connectionstable_slots_bit(position);
+  if (slots->freeWords[word] == 0) {
+    slots->summaryWords[summary] &= ~spindump_connectionstable_slots_bit(word);
+  }
+  spindump_assert(slots->nFree > 0);
+  slots->nFree--;
+}
+
+//
+// Find the lowest free position, or return UINT_MAX if there are no
+// free positions. The summary words before firstSummaryWord are known
+// to be zero, so the search usually finds the position with two
+// find-first-set operations.
+//
+
+unsigned int
+spindump_connectionstable_slots_lowest(struct spindump_connectionstable_slots* slots) {
+  spindump_assert(slots != 0);
+  if (slots->nFree == 0) return(UINT_MAX);
+  unsigned int nSummary =
+    spindump_connectionstable_slots_nwords(spindump_connectionstable_slots_nwords(slots->maxPositions));
+  while (slots->firstSummaryWord < nSummary &&
+         slots->summaryWords[slots->firstSummaryWord] == 0) {
+    slots->firstSummaryWord++;
+  }
+  spindump_assert(slots->firstSummaryWord < nSummary);
+  unsigned int summary = slots->firstSummaryWord;
+  unsigned int word =
+    summary * spindump_connectionstable_slots_wordbits +
+    (unsigned int)__builtin_ctzll(slots->summaryWords[summary]);
+  spindump_assert(slots->freeWords[word] != 0);
+  return(word * spindump_connectionstable_slots_wordbits +
+         (unsigned int)__builtin_ctzll(slots->freeWords[word]));
+}
+
+//
+// Allocate the generation for a connection that gets a position in
+// the table. Generations are never zero, so a zeroed handle does not
+// refer to any connection.
+//
+
+unsigned int
+spindump_connectionstable_slots_generation(struct spindump_connectionstable_slots* slots) {
+  spindump_assert(slots != 0);
+  unsigned int generation = slots->nextGeneration++;
+  if (slots->nextGeneration == 0) slots->nextGeneration = 1;
+  return(generation);
+}
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include "spindump_tags.h"
 #include "spindump_connections_structs.h"
 
@@ -34,11 +35,310 @@
 //
 
 #define spindump_connectionstable_defaultsize 1024
+#define spindump_connectionstable_index_defaultsize 1024
+#define spindump_connectionstable_pool_nclasses     (spindump_connection_aggregate_networkmultinet+1)
+#define spindump_connectionstable_pool_slabobjects  64 // connection objects per slab
+#define spindump_connectionstable_timers_levels     4  // levels in the timer wheel
+#define spindump_connectionstable_timers_slotbits   6  // log2 of the number of slots per level
+#define spindump_connectionstable_timers_slots      (1 << spindump_connectionstable_timers_slotbits)
+#define spindump_connectionstable_prefixes_slotbits 16 // log2 of the number of tries of long prefixes
+#define spindump_connectionstable_prefixes_slots    (1 << spindump_connectionstable_prefixes_slotbits)
+#define spindump_connectionstable_prefixes_long4    16 // shortest long IPv4 prefix
+#define spindump_connectionstable_prefixes_long6    32 // shortest long IPv6 prefix
+#define spindump_connectionstable_negative_bucketbits 12 // log2 of the number of buckets per generation
+#define spindump_connectionstable_negative_buckets  (1 << spindump_connectionstable_negative_bucketbits)
+#define spindump_connectionstable_negative_slots    4  // fingerprints per bucket
+#define spindump_connectionstable_negative_maxkicks 32 // relocations tried before an entry is dropped
+#define spindump_connectionstable_negative_period   30 // seconds between generations
+#define spindump_connectionstable_halfopen_none     0xFFFFFFFFU // no half-open entry
+#define spindump_connectionstable_shared_initialsize 256 // initial size of a log of aggregate updates
 
 //
 // Data structures ----------------------------------------------------------------------------
 //
 
+struct spindump_connectionstable_index {
+  unsigned int nBuckets;                              // number of buckets, always a power of two
+  unsigned int nEntries;                              // number of entries linked to the buckets
+  struct spindump_connection_hashentry** buckets;     // the bucket chains
+};
+
+//
+// The connection object pool. Connection objects are carved out of
+// slabs, each holding a number of objects of one size class. There is
+// one size class per connection type, sized to hold only the union
+// arm for that type, so that e.g. a UDP or DNS connection does not
+// pay for the QUIC state. The cold parts of connections have size
+// classes of their own, in the same way. Released objects go to a
+// per-class free list and are reused for the next connection of the
+// same type. The slabs themselves are only freed when the table is
+// uninitialized.
+//
+
+struct spindump_connectionstable_pool_slab {
+  struct spindump_connectionstable_pool_slab* next; // next slab in the same size class
+  uint64_t padding;                                 // unused padding to align the objects that follow
+};
+
+struct spindump_connectionstable_pool_freeobject {
+  struct spindump_connectionstable_pool_freeobject* next; // next free object in the same size class
+};
+
+struct spindump_connectionstable_pool_class {
+  unsigned int objectSize;                          // size of one object in this class, in bytes
+  unsigned int nSlabs;                              // number of slabs allocated for this class
+  unsigned int nInUse;                              // number of objects currently handed out
+  unsigned int nFree;                               // number of objects on the free list
+  struct spindump_connectionstable_pool_slab* slabs; // all slabs allocated for this class
+  struct spindump_connectionstable_pool_freeobject* freeList; // objects available for reuse
+};
+
+struct spindump_connectionstable_pool {
+  struct spindump_connectionstable_pool_class classes[spindump_connectionstable_pool_nclasses]; // connection objects
+  struct spindump_connectionstable_pool_class coldClasses[spindump_connectionstable_pool_nclasses]; // their cold parts
+};
+
+//
+// The free positions in the connections array. Positions below
+// nConnections that do not hold a connection have their bit set in
+// the free bitmap, and each word of the free bitmap that has bits set
+// has its own bit set in the summary bitmap. New connections take the
+// lowest free position, or are added at the end if there is none.
+// Connections are never moved, and a position freed at the end of
+// the array shrinks it.
+//
+// Each connection is given a generation when it is put in the
+// table. A handle, i.e., a position and a generation, refers to the
+// connection as long as it stays in the table, and to nothing after
+// that, even if the position has been taken by another connection.
+//
+
+struct spindump_connectionstable_slots {
+  unsigned int nFree;                               // number of free positions below nConnections
+  unsigned int maxPositions;                        // number of positions covered by the bitmaps
+  unsigned int firstSummaryWord;                    // summary words before this one are all zero
+  unsigned int nextGeneration;                      // generation for the next connection, never zero
+  uint64_t* freeWords;                              // one bit per free position
+  uint64_t* summaryWords;                           // one bit per free bitmap word with bits set
+};
+
+struct spindump_connectionstable_handle {
+  unsigned int index;                               // position of the connection in the table
+  unsigned int generation;                          // generation of the connection, zero for no connection
+};
+
+//
+// The timer wheel for connection timeouts. Each automatically
+// created connection is in exactly one slot, determined by the second
+// at which its timeouts need to be checked next. Level 0 has one slot
+// per second, and each higher level has one slot for a whole
+// revolution of the level below it. Entries in a higher level slot
+// are moved (cascaded) to lower levels as the time approaches. A time
+// beyond the reach of the top level is checked at the end of the
+// reach, and then scheduled again.
+//
+// The scheduled times only need to be lower bounds for the actual
+// timeouts. New packets on a connection only extend its timeouts,
+// so they do not need to touch the wheel at all. A connection that
+// turns out not to have expired yet when its time comes is simply
+// scheduled again.
+//
+
+struct spindump_connectionstable_timers {
+  unsigned long long now;                           // the last second processed by the wheel
+  unsigned int nTimers;                             // number of connections in the wheel
+  unsigned int nDue;                                // number of connections in the due array
+  unsigned int maxNDue;                             // allocated size of the due array
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  struct spindump_connection** due;                 // connections whose time has come, in table order
+  struct spindump_connection* slots[spindump_connectionstable_timers_levels][spindump_connectionstable_timers_slots];
+};
+
+//
+// The prefix trie of aggregate connections. Each simple aggregate is
+// in the trie under one of its sides (the host, or the first network
+// for a network-to-network aggregate), and each multinet aggregate
+// under every network configured for it. A connection can then only
+// belong to aggregates found along the trie paths of its two
+// addresses, and there are at most as many nodes along a path as
+// there are bits in the address.
+//
+// The tries are path compressed, so that each node either holds
+// aggregates or has two children. For both IPv4 and IPv6, there is
+// one trie for short prefixes, and a table of tries for long
+// prefixes, indexed by their leading 16 (IPv4) or 32 (IPv6) bits.
+// This replaces the top levels of the tries with a table lookup.
+//
+
+struct spindump_connectionstable_prefixlist {
+  unsigned int nAggregates;                         // number of aggregates in the list
+  unsigned int maxAggregates;                       // allocated size of the aggregates array
+  struct spindump_connection** aggregates;          // the aggregates, in the order they were added
+  struct spindump_connection* single;               // the aggregates array, while it has only one entry
+};
+
+struct spindump_connectionstable_prefixnode {
+  spindump_compactnetwork prefix;                   // the prefix, with the bits after its length zero
+  struct spindump_connectionstable_prefixlist simple; // simple aggregates under exactly this prefix
+  struct spindump_connectionstable_prefixlist multinet; // multinet aggregates under exactly this prefix
+  struct spindump_connectionstable_prefixnode* children[2]; // longer prefixes, by the next bit
+};
+
+struct spindump_connectionstable_prefixes {
+  struct spindump_connectionstable_prefixnode* roots[2]; // IPv4 and IPv6 tries of short prefixes
+  struct spindump_connectionstable_prefixnode** slots[2]; // IPv4 and IPv6 tries of long prefixes, or null
+  unsigned int nNodes;                              // number of nodes in both tries
+  unsigned int nEntries;                            // number of aggregates in all nodes
+  unsigned int nCandidates;                         // number of aggregates in the candidates array
+  unsigned int maxCandidates;                       // allocated size of the candidates array
+  struct spindump_connection** candidates;          // result of the latest candidate search
+};
+
+//
+// Deferred aggregate updates. When enabled, packets of member
+// connections are counted in the members, and the counts are folded
+// into the aggregates in batches: before a bandwidth measurement
+// period of an aggregate could end, and before anything reads the
+// aggregates. The pending list holds the connections that have
+// updates not yet folded, in the order they got them.
+//
+
+struct spindump_connectionstable_rollup {
+  int deferred;                                     // are aggregate updates deferred?
+  unsigned int nPending;                            // number of connections on the pending list
+  struct spindump_connection* first;                // the first connection with pending updates
+  struct spindump_connection* last;                 // the last connection with pending updates
+};
+
+//
+// The negative cache, i.e., the TCP and SCTP flows that have been
+// seen but are not tracked, because their beginning was not
+// seen. Packets of these flows can be ignored without searching the
+// table. The cache is a cuckoo filter: each flow is represented by a
+// 32-bit fingerprint, stored in one of two buckets determined by the
+// flow and the fingerprint. Unlike in a Bloom filter, entries can be
+// removed, so a flow leaves the cache as soon as a connection is
+// created for it.
+//
+// There are two generations of the filter. New entries go to the
+// current generation, and entries found in the old one are moved to
+// the current one. The generations are rotated every
+// spindump_connectionstable_negative_period seconds, or when the
+// current one gets too full, and the entries left in the old
+// generation are then forgotten.
+//
+
+struct spindump_connectionstable_negativebucket {
+  uint32_t fingerprints[spindump_connectionstable_negative_slots]; // the fingerprints, zero for an empty slot
+  uint16_t packets[spindump_connectionstable_negative_slots]; // packets seen from each flow, saturating
+};
+
+struct spindump_connectionstable_negativegeneration {
+  unsigned int nEntries;                            // number of fingerprints in the buckets
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  struct spindump_connectionstable_negativebucket* buckets; // the buckets, or null until the first entry
+};
+
+struct spindump_connectionstable_negative {
+  unsigned int adoptAfter;                          // packets after which TCP flows are tracked, zero for never
+  unsigned int current;                             // the index of the current generation
+  unsigned long long rotated;                       // the second the generations were last rotated
+  struct spindump_connectionstable_negativegeneration generations[2]; // the current and old generation
+};
+
+//
+// The half-open TCP connections, i.e., those for which only SYNs
+// have been seen. When enabled, a SYN creates only a compact entry
+// here instead of a full connection, and the full connection is
+// created when the next packet of the flow, typically a SYN ACK, is
+// seen. A flood of SYNs then only fills this table, which has a
+// bounded size.
+//
+// The entries are kept in a ring, in the order they were created.
+// The oldest entry is evicted when the ring is full, and entries that
+// have not seen a SYN in spindump_connection_establishing_timeout
+// expire from the start of the ring. Entries that are promoted to
+// connections leave holes in the ring, which are skipped when the
+// start of the ring gets to them. The entries are also linked to
+// hash buckets by their addresses and ports.
+//
+
+struct spindump_connectionstable_halfopenentry {
+  spindump_compactaddress side1address;             // address of the sender of the SYN
+  spindump_compactaddress side2address;             // address of the receiver of the SYN
+  spindump_port side1port;                          // port of the sender of the SYN
+  spindump_port side2port;                          // port of the receiver of the SYN
+  uint32_t key;                                     // hash of the addresses and ports
+  struct timeval firstSyn;                          // time of the first SYN
+  struct timeval latestSyn;                         // time of the latest SYN
+  uint32_t isn;                                     // initial sequence number from the latest SYN
+  uint32_t tsVal;                                   // TCP timestamp value from the latest SYN
+  uint32_t next;                                    // next entry in the same bucket
+  uint16_t length;                                  // IP packet length of the SYNs
+  uint16_t nSyns;                                   // number of SYNs seen
+  uint8_t ecnFlags;                                 // ECN flags of the SYNs
+  uint8_t used;                                     // does this position hold an entry?
+  uint8_t padding[6];                               // unused padding to align the next entry properly
+};
+
+struct spindump_connectionstable_halfopen {
+  unsigned int maxEntries;                          // size of the ring, zero if half-open entries are not used
+  unsigned int nEntries;                            // number of entries in the ring
+  unsigned int head;                                // position of the oldest entry or hole in the ring
+  unsigned int nPositions;                          // number of entries and holes in the ring
+  unsigned int nBuckets;                            // number of buckets, always a power of two
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  uint32_t* buckets;                                // first entry in each bucket, or spindump_connectionstable_halfopen_none
+  struct spindump_connectionstable_halfopenentry* entries; // the ring, or null until the first entry
+};
+
+//
+// Shared aggregates. With worker threads, the aggregates are owned by
+// the table of the first worker, and the tables of the other workers
+// find them for their connections, so that each aggregate collects
+// the connections of all workers. The sets of connections in the
+// aggregates are changed under a lock that all the tables share.
+//
+// The workers do not update the aggregates directly. Each worker logs
+// the updates that its packets cause, tagged with the sequence
+// number of the packet, and the logs of all workers are applied
+// together, in the order of the packets, while the workers are
+// stopped. The aggregates see the packets in the same order as
+// without worker threads.
+//
+
+enum spindump_connectionstable_sharedtype {
+  spindump_connectionstable_sharedtype_packet,
+  spindump_connectionstable_sharedtype_rtt
+};
+
+struct spindump_connectionstable_sharedupdate {
+  unsigned long long sequence;                      // the packet that caused the update
+  struct spindump_connection* aggregate;            // the aggregate to update
+  struct timeval timestamp;                         // the time of the event, or when an RTT response was received
+  struct timeval packetTimestamp;                   // the time of the packet, or when an RTT packet was sent
+  const char* why;                                  // what measured an RTT
+  enum spindump_connectionstable_sharedtype type;   // packet or RTT
+  unsigned int ipPacketLength;                      // the length of the packet
+  int fromResponder;                                // from the responder, or for an RTT, is it the right RTT?
+  int unidirectional;                               // for an RTT, is it a full RTT in one direction?
+  int handled;                                      // has the packet already caused events?
+  uint8_t ecnFlags;                                 // the ECN bits of the packet
+  uint8_t padding[3];                               // unused padding to align the size of the structure
+};
+
+struct spindump_connectionstable_shared {
+  pthread_mutex_t ownLock;                          // the lock of the aggregates owned by this table
+  pthread_mutex_t* lock;                            // the lock of the shared aggregates, or null if not shared
+  struct timeval lastReport;                        // when the shared aggregates were last reported
+  unsigned long long sequence;                      // the packet being analyzed
+  unsigned int nUpdates;                            // number of updates in the log
+  unsigned int maxUpdates;                          // allocated size of the log
+  unsigned int nApplied;                            // number of updates applied so far, while applying
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  struct spindump_connectionstable_sharedupdate* updates; // the updates not yet applied, in order
+};
+
 struct spindump_connectionstable {
   unsigned long long bandwidthMeasurementPeriod;
   unsigned int periodicReportPeriod;
@@ -49,8 +349,18 @@ struct spindump_connectionstable {
   unsigned int nConnections;
   unsigned int maxNConnections;
   struct spindump_connection** connections;
-  unsigned int nNetworks;
-  struct spindump_connection_network *networks;
+  struct spindump_connectionstable_index tupleIndex;
+  struct spindump_connectionstable_index cidIndex;
+  struct spindump_connectionstable_pool pool;
+  struct spindump_connectionstable_timers timers;
+  struct spindump_connectionstable_slots slots;     // the free positions in the connections array
+  struct spindump_connectionstable_rollup rollup;   // the deferred aggregate updates
+  struct spindump_connectionstable_negative negative; // the flows that are seen but not tracked
+  struct spindump_connectionstable_halfopen halfOpen; // the TCP connections that have only seen SYNs
+  unsigned int cidLengths[spindump_connection_quic_cid_maxlen+1]; // CID index entries by identifier length
+  uint8_t padding[4];                               // unused padding to align the next field properly
+  struct spindump_connectionstable_prefixes prefixes; // the aggregates, by their addresses and networks
+  struct spindump_connectionstable_shared shared;  // the aggregates shared with other tables, if any
 };
 
 #endif // SPINDUMP_TABLE_STRUCTS_H
@@ -0,0 +1,360 @@
+
+//
+//
+//  ////////////////////////////////////////////////////////////////////////////////////
+//  /////////                                                                ///////////
+//  //////       SSS    PPPP    I   N    N   DDDD    U   U   M   M   PPPP         //////
+//  //          S       P   P   I   NN   N   D   D   U   U   MM MM   P   P            //
+//  /            SSS    PPPP    I   N NN N   D   D   U   U   M M M   PPPP              /
+//  //              S   P       I   N   NN   D   D   U   U   M   M   P                //
+//  ////         SSS    P       I   N    N   DDDD     UUU    M   M   P            //////
+//  /////////                                                                ///////////
+//  ////////////////////////////////////////////////////////////////////////////////////
+//
+//  SPINDUMP (C) 2018-2020 BY ERICSSON RESEARCH
+//  AUTHOR: JARI ARKKO
+//
+//
+
+//
+// Includes -----------------------------------------------------------------------------------
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include "spindump_util.h"
+#include "spindump_connections.h"
+#include "spindump_table.h"
+
+//
+// Function prototypes ------------------------------------------------------------------------
+//
+
+static void
+spindump_connectionstable_timers_insert(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection,
+                                        unsigned long long earliest);
+static void
+spindump_connectionstable_timers_unlink(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection);
+static struct spindump_connection*
+spindump_connectionstable_timers_takeslot(struct spindump_connectionstable_timers* timers,
+                                          unsigned int level,
+                                          unsigned int slot);
+static int
+spindump_connectionstable_timers_adddue(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection);
+static void
+spindump_connectionstable_timers_tick(struct spindump_connectionstable_timers* timers);
+static void
+spindump_connectionstable_timers_jump(struct spindump_connectionstable_timers* timers,
+                                      unsigned long long now);
+static int
+spindump_connectionstable_timers_comparedue(const void* a,
+                                            const void* b);
+
+//
+// Macros -------------------------------------------------------------------------------------
+//
+
+#define spindump_connectionstable_timers_reachbits                    \
+  (spindump_connectionstable_timers_levels *                          \
+   spindump_connectionstable_timers_slotbits)
+#define spindump_connectionstable_timers_reach                        \
+  (1ULL << spindump_connectionstable_timers_reachbits)
+#define spindump_connectionstable_timers_slotmask                     \
+  ((unsigned long long)(spindump_connectionstable_timers_slots - 1))
+
+//
+// Actual code --------------------------------------------------------------------------------
+//
+
+//
+// Initialize the timer wheel. The wheel's time starts from zero, and
+// jumps to the current time on the first call to
+// spindump_connectionstable_timers_advance.
+//
+
+void
+spindump_connectionstable_timers_initialize(struct spindump_connectionstable_timers* timers) {
+  spindump_assert(timers != 0);
+  memset(timers,0,sizeof(*timers));
+}
+
+//
+// Uninitialize the timer wheel. The connections in it are not
+// touched, they are freed separately by the table.
+//
+
+void
+spindump_connectionstable_timers_uninitialize(struct spindump_connectionstable_timers* timers) {
+  spindump_assert(timers != 0);
+  if (timers->due != 0) {
+    spindump_free(timers->due);
+  }
+  memset(timers,0xFF,sizeof(*timers));
+}
+
+//
+// Put a connection in the slot determined by its timerExpiry
+// time. The level is the lowest one in which the expiry time falls
+// within the current revolution of the slots. Times before the given
+// earliest second are put at the earliest second, and times beyond
+// the reach of the wheel at the last second within its reach.
+//
+
+static void
+spindump_connectionstable_timers_insert(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection,
+                                        unsigned long long earliest) {
+
+  unsigned long long expiry = connection->timerExpiry;
+  if (expiry < earliest) expiry = earliest;
+  if ((expiry >> spindump_connectionstable_timers_reachbits) !=
+      (timers->now >> spindump_connectionstable_timers_reachbits)) {
+    expiry = timers->now | (spindump_connectionstable_timers_reach - 1);
+    if (expiry < earliest) expiry = earliest;
+  }
+
+  unsigned int level = 0;
+  unsigned int shift = 0;
+  while (level < spindump_connectionstable_timers_levels - 1 &&
+         (expiry >> (shift + spindump_connectionstable_timers_slotbits)) !=
+         (timers->now >> (shift + spindump_connectionstable_timers_slotbits))) {
+    level++;
+    shift += spindump_connectionstable_timers_slotbits;
+  }
+
+  unsigned int slot = (unsigned int)((expiry >> shift) & spindump_connectionstable_timers_slotmask);
+  struct spindump_connection** head = &timers->slots[level][slot];
+  connection->timerNext = *head;
+  if (*head != 0) (*head)->timerPrev = &connection->timerNext;
+  connection->timerPrev = head;
+  *head = connection;
+}
+
+//
+// Remove a connection from its slot
+//
+
+static void
+spindump_connectionstable_timers_unlink(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection) {
+  spindump_assert(timers->nTimers > 0);
+  *(connection->timerPrev) = connection->timerNext;
+  if (connection->timerNext != 0) connection->timerNext->timerPrev = connection->timerPrev;
+  connection->timerNext = 0;
+  connection->timerPrev = 0;
+}
+
+//
+// Schedule a connection to be checked for timeouts at a given second,
+// or reschedule it if it was already in the wheel.
+//
+
+void
+spindump_connectionstable_timers_schedule(struct spindump_connectionstable_timers* timers,
+                                          struct spindump_connection* connection,
+                                          unsigned long long expiry) {
+  spindump_assert(timers != 0);
+  spindump_assert(connection != 0);
+  if (connection->timerPrev != 0) {
+    spindump_connectionstable_timers_unlink(timers,connection);
+  } else {
+    timers->nTimers++;
+  }
+  connection->timerExpiry = expiry;
+  spindump_connectionstable_timers_insert(timers,connection,timers->now + 1);
+}
+
+//
+// Take a connection out of the wheel, if it is there
+//
+
+void
+spindump_connectionstable_timers_cancel(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection) {
+  spindump_assert(timers != 0);
+  spindump_assert(connection != 0);
+  if (connection->timerPrev == 0) return;
+  spindump_connectionstable_timers_unlink(timers,connection);
+  timers->nTimers--;
+}
+
+//
+// Detach the list of connections in one slot, and return it
+//
+
+static struct spindump_connection*
+spindump_connectionstable_timers_takeslot(struct spindump_connectionstable_timers* timers,
+                                          unsigned int level,
+                                          unsigned int slot) {
+  struct spindump_connection* list = timers->slots[level][slot];
+  timers->slots[level][slot] = 0;
+  return(list);
+}
+
+//
+// Add a connection to the array of connections that are due to be
+// checked. The connection is no longer in the wheel.
+//
+
+static int
+spindump_connectionstable_timers_adddue(struct spindump_connectionstable_timers* timers,
+                                        struct spindump_connection* connection) {
+  if (timers->nDue == timers->maxNDue) {
+    unsigned int newMax = timers->maxNDue == 0 ? 64 : timers->maxNDue * 2;
+    unsigned int newSize = newMax * sizeof(struct spindump_connection*);
+    struct spindump_connection** newDue = (struct spindump_connection**)spindump_malloc(newSize);
+    if (newDue == 0) {
+      spindump_errorf("cannot allocate the timer due array of %u bytes", newSize);
+      return(0);
+    }
+    if (timers->due != 0) {
+      memcpy(newDue,timers->due,timers->nDue * sizeof(struct spindump_connection*));
+      spindump_free(timers->due);
+    }
+    timers->due = newDue;
+    timers->maxNDue = newMax;
+  }
+  timers->due[timers->nDue++] = connection;
+  timers->nTimers--;
+  return(1);
+}
+
+//
+// Move the wheel forward by one second. Slots in higher levels whose
+// time has come are cascaded to the levels below, and then the level
+// 0 slot for the new second is emptied. Connections scheduled for
+// this second are moved to the due array, and others (only those
+// whose time was beyond the reach of the wheel) are inserted again.
+//
+
+static void
+spindump_connectionstable_timers_tick(struct spindump_connectionstable_timers* timers) {
+
+  timers->now++;
+
+  //
+  // Cascade, starting from the highest level whose slot changes
+  //
+
+  unsigned int top = 0;
+  while (top < spindump_connectionstable_timers_levels - 1 &&
+         (timers->now & ((1ULL << ((top + 1) * spindump_connectionstable_timers_slotbits)) - 1)) == 0) {
+    top++;
+  }
+  for (unsigned int level = top; level > 0; level--) {
+    unsigned int shift = level * spindump_connectionstable_timers_slotbits;
+    unsigned int slot = (unsigned int)((timers->now >> shift) & spindump_connectionstable_timers_slotmask);
+    struct spindump_connection* list = spindump_connectionstable_timers_takeslot(timers,level,slot);
+    while (list != 0) {
+      struct spindump_connection* connection = list;
+      list = connection->timerNext;
+      spindump_connectionstable_timers_insert(timers,connection,timers->now);
+    }
+  }
+
+  //
+  // Take the connections whose time has come
+  //
+
+  unsigned int slot = (unsigned int)(timers->now & spindump_connectionstable_timers_slotmask);
+  struct spindump_connection* list = spindump_connectionstable_timers_takeslot(timers,0,slot);
+  while (list != 0) {
+    struct spindump_connection* connection = list;
+    list = connection->timerNext;
+    if (connection->timerExpiry <= timers->now) {
+      connection->timerNext = 0;
+      connection->timerPrev = 0;
+      if (!spindump_connectionstable_timers_adddue(timers,connection)) {
+        connection->timerExpiry = timers->now + 1;
+        timers->nTimers++;
+        spindump_connectionstable_timers_insert(timers,connection,timers->now + 1);
+      }
+    } else {
+      spindump_connectionstable_timers_insert(timers,connection,timers->now + 1);
+    }
+  }
+}
+
+//
+// Move the wheel directly to a given time, without going through the
+// seconds in between. This is used when the time moves more than the
+// reach of the wheel at once (such as on the first call), and all
+// connections need to be placed again.
+//
+
+static void
+spindump_connectionstable_timers_jump(struct spindump_connectionstable_timers* timers,
+                                      unsigned long long now) {
+  struct spindump_connection* all = 0;
+  for (unsigned int level = 0; level < spindump_connectionstable_timers_levels; level++) {
+    for (unsigned int slot = 0; slot < spindump_connectionstable_timers_slots; slot++) {
+      struct spindump_connection* list = spindump_connectionstable_timers_takeslot(timers,level,slot);
+      while (list != 0) {
+        struct spindump_connection* connection = list;
+        list = connection->timerNext;
+        connection->timerNext = all;
+        all = connection;
+      }
+    }
+  }
+  timers->now = now;
+  while (all != 0) {
+    struct spindump_connection* connection = all;
+    all = connection->timerNext;
+    spindump_connectionstable_timers_insert(timers,connection,timers->now + 1);
+  }
+}
+
+//
+// Order due connections by their position in the table
+//
+
+static int
+spindump_connectionstable_timers_comparedue(const void* a,
+                                            const void* b) {
+  const struct spindump_connection* connectionA = *(const struct spindump_connection* const*)a;
+  const struct spindump_connection* connectionB = *(const struct spindump_connection* const*)b;
+  if (connectionA->tableIndex < connectionB->tableIndex) return(-1);
+  else if (connectionA->tableIndex > connectionB->tableIndex) return(1);
+  else return(0);
+}
+
+//
+// Move the wheel forward to the given second. All connections
+// scheduled at or before that second are taken out of the wheel and
+// placed in timers->due, sorted by their position in the connections
+// table, so that they are processed in the same order as a full scan
+// of the table would do. The return value is the number of due
+// connections.
+//
+// The caller is expected to either delete or schedule again each of
+// the due connections.
+//
+
+unsigned int
+spindump_connectionstable_timers_advance(struct spindump_connectionstable_timers* timers,
+                                         unsigned long long now) {
+  spindump_assert(timers != 0);
+  timers->nDue = 0;
+  if (now <= timers->now) return(0);
+  if (timers->nTimers == 0) {
+    timers->now = now;
+    return(0);
+  }
+  if (now - timers->now >= spindump_connectionstable_timers_reach) {
+    spindump_connectionstable_timers_jump(timers,now - 1);
+  }
+  while (timers->now < now) {
+    spindump_connectionstable_timers_tick(timers);
+  }
+  if (timers->nDue > 1) {
+    qsort(timers->due,
+          timers->nDue,
+          sizeof(struct spindump_connection*),
+          spindump_connectionstable_timers_comparedue);
+  }
+  return(timers->nDue);
+}
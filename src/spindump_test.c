@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -31,17 +33,69 @@
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
 #include "spindump_util.h"
 #include "spindump_test.h"
 #include "spindump_protocols.h"
 #include "spindump_connections.h"
+#include "spindump_connections_set.h"
+#include "spindump_connections_set_iterator.h"
 #include "spindump_event.h"
 #include "spindump_event_parser_json.h"
 #include "spindump_event_parser_text.h"
+#include "spindump_event_parser_binary.h"
 #include "spindump_analyze.h"
 #include "spindump_json_value.h"
 #include "spindump_json.h"
 #include "spindump_analyze_quic_parser_util.h"
+#include "spindump_pipeline.h"
+#include "spindump_remote_client.h"
+#include "spindump_eventformatter.h"
+#include "spindump_remote_file.h"
+#include "spindump_remote_queue.h"
+#include "spindump_eventformatter_text.h"
+#include "spindump_eventformatter_json.h"
+#include "spindump_capture.h"
+#include "spindump_rtt.h"
+#include "spindump_histogram.h"
+#include "spindump_seq.h"
+
+//
+// Data structures ----------------------------------------------------------------------------
+//
+
+//
+// A minimal HTTP server used as the collector in the remote client
+// tests. It answers every POST with an empty 200 response, and keeps
+// connections open. When stalled, it does not read any requests.
+//
+
+#define unittests_httpstub_maxconnections 16
+#define unittests_httpstub_buffersize     4096
+
+struct unittests_httpstub_connection {
+  int fd;
+  unsigned int length;
+  char buffer[unittests_httpstub_buffersize];
+};
+
+struct unittests_httpstub {
+  int listenfd;
+  spindump_port port;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int stalled;
+  int stopping;
+  unsigned int nRequests;
+  unsigned int nConnections;
+  const char* response;
+  unsigned int nBusy;
+  struct unittests_httpstub_connection connections[unittests_httpstub_maxconnections];
+};
 
 //
 // Function prototypes ------------------------------------------------------------------------
@@ -50,12 +104,71 @@
 static void unittests(void);
 static void unittests_util(void);
 static void unittests_quicparser(void);
+static void unittests_rtt(void);
+static void unittests_histogram(void);
+static void unittests_seqtracker(void);
+static unsigned long
+unittests_rtt_reference(const struct spindump_rtt* rtt,
+                        int filter,
+                        unsigned int filterLimitPercentage,
+                        unsigned long* standardDeviation,
+                        unsigned long* filteredAvg);
 static void unittests_table(void);
+static void unittests_pipeline(void);
+static void unittests_batch(void);
+static void unittests_handlers(void);
+static void
+unittests_handlers_count(struct spindump_analyze* state,
+                         void* handlerData,
+                         void** handlerConnectionData,
+                         spindump_analyze_event event,
+                         const struct timeval* timestamp,
+                         const int fromResponder,
+                         const unsigned int ipPacketLength,
+                         struct spindump_packet* packet,
+                         struct spindump_connection* connection);
+static void unittests_remoteclient(void);
+static void unittests_eventformatter(void);
+static void unittests_capture(void);
+static unsigned int
+unittests_capture_count(struct spindump_capture_state* capture,
+                        spindump_port port,
+                        struct spindump_stats* stats);
+static int unittests_httpstub_start(struct unittests_httpstub* stub);
+static void unittests_httpstub_stop(struct unittests_httpstub* stub);
+static void* unittests_httpstub_serve(void* arg);
+static int unittests_httpstub_request(struct unittests_httpstub* stub,
+                                      struct unittests_httpstub_connection* connection);
 static void unittests_eventtextparser(void);
 static void unittests_eventjsonparser(void);
+static void unittests_eventjsonstreamparser(void);
+static void
+unittests_eventjsonstreamparser_callback(const struct spindump_event* event,
+                                         void* data);
+static void unittests_remotefile(void);
+static void unittests_remotequeue(void);
+static void* unittests_remotequeue_producer(void* data);
+static void
+unittests_remotefile_write(const char* text,
+                           char* filename);
+static int
+unittests_remotefile_replay(const char* filename,
+                            struct spindump_analyze* analyzer,
+                            unsigned long long* lastTimestamp,
+                            int* error);
+static void unittests_eventbinaryparser(void);
+static void
+unittests_eventbinaryparser_roundtrip(const struct spindump_event* event);
+static void
+unittests_eventbinaryparser_callback(const struct spindump_event* event,
+                                     void* data);
 static void unittests_jsonparser(void);
 static void unittests_jsonvalue(void);
 static void systemtests(void);
+static int decodebinary(const char* format);
+static void
+decodebinary_callback(const struct spindump_event* event,
+                      void* data);
 static void
 unittests_jsonparse_callback(const struct spindump_json_value* value,
                              const struct spindump_json_schema* type,
@@ -77,11 +190,24 @@ static void
 unittests(void) {
   unittests_util();
   unittests_quicparser();
+  unittests_rtt();
+  unittests_histogram();
+  unittests_seqtracker();
   unittests_table();
+  unittests_pipeline();
+  unittests_batch();
+  unittests_handlers();
+  unittests_remoteclient();
+  unittests_eventformatter();
+  unittests_capture();
   unittests_jsonvalue();
   unittests_jsonparser();
   unittests_eventtextparser();
   unittests_eventjsonparser();
+  unittests_eventjsonstreamparser();
+  unittests_remotefile();
+  unittests_remotequeue();
+  unittests_eventbinaryparser();
 }
 
 //
@@ -146,7 +272,52 @@ unittests_util(void) {
   spindump_checktest(spindump_address_innetwork(&a5,&n3));
   spindump_checktest(!spindump_address_innetwork(&a6,&n3));
   spindump_checktest(n4.length == 128);
-  
+
+  //
+  // Compact address and network tests
+  //
+
+  spindump_compactaddress c1;
+  spindump_compactaddress c2;
+  spindump_compactaddress c3;
+  spindump_compactaddress c4;
+  spindump_compactaddress c6;
+  spindump_address back;
+  spindump_compactaddress_fromaddress(&a1,&c1);
+  spindump_compactaddress_fromaddress(&a2,&c2);
+  spindump_compactaddress_fromaddress(&a3,&c3);
+  spindump_compactaddress_fromaddress(&a4,&c4);
+  spindump_compactaddress_fromaddress(&a6,&c6);
+  spindump_checktest(sizeof(spindump_compactaddress) == 20);
+  spindump_checktest(spindump_compactaddress_equal(&c1,&c1));
+  spindump_checktest(!spindump_compactaddress_equal(&c1,&c2));
+  spindump_checktest(!spindump_compactaddress_equal(&c3,&c4));
+  spindump_checktest(spindump_compactaddress_compare(&c1,&c2) < 0);
+  spindump_checktest(spindump_compactaddress_compare(&c1,&c3) > 0);
+  spindump_checktest(spindump_compactaddress_compare(&c4,&c6) < 0);
+  spindump_checktest(spindump_compactaddress_compare(&c6,&c6) == 0);
+  spindump_checktest(spindump_compactaddress_compare(&c1,&c4) ==
+                     (spindump_address_compare(&a1,&a4) < 0 ? -1 : 1));
+  spindump_compactaddress_toaddress(&c4,&back);
+  spindump_checktest(spindump_address_equal(&back,&a4));
+  spindump_checktest(strcmp(spindump_compactaddress_tostring(&c1),"10.30.0.1") == 0);
+  spindump_compactnetwork cn1;
+  spindump_compactnetwork cn2;
+  spindump_compactnetwork cn3;
+  spindump_compactnetwork_fromnetwork(&n1,&cn1);
+  spindump_compactnetwork_fromnetwork(&n2,&cn2);
+  spindump_compactnetwork_fromnetwork(&n3,&cn3);
+  spindump_checktest(spindump_compactaddress_innetwork(&c1,&cn1));
+  spindump_checktest(spindump_compactaddress_innetwork(&c1,&cn2));
+  spindump_checktest(!spindump_compactaddress_innetwork(&c1,&cn3));
+  spindump_checktest(!spindump_compactaddress_innetwork(&c3,&cn1));
+  spindump_checktest(spindump_compactaddress_innetwork(&c3,&cn2));
+  spindump_checktest(spindump_compactaddress_innetwork(&c4,&cn3));
+  spindump_checktest(!spindump_compactaddress_innetwork(&c6,&cn3));
+  spindump_checktest(!spindump_compactnetwork_equal(&cn1,&cn2));
+  spindump_checktest(strcmp(spindump_compactnetwork_tostring(&cn3),"2001:14bb:150:4979::/64") == 0);
+
+
   //
   // QUIC CID tests
   // 
@@ -206,6 +377,1102 @@ unittests_quicparser(void) {
   checkint(0xC3,0x85,0x00,0x00,2,2,0,0,0);
 }
 
+//
+// Start the HTTP stub server on a free local port. Returns 1 upon
+// success.
+//
+
+static int
+unittests_httpstub_start(struct unittests_httpstub* stub) {
+  memset(stub,0,sizeof(*stub));
+  for (unsigned int i = 0; i < unittests_httpstub_maxconnections; i++) stub->connections[i].fd = -1;
+  stub->response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+  stub->listenfd = socket(AF_INET,SOCK_STREAM,0);
+  if (stub->listenfd < 0) return(0);
+  struct sockaddr_in address;
+  memset(&address,0,sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t addressLength = sizeof(address);
+  if (bind(stub->listenfd,(struct sockaddr*)&address,sizeof(address)) != 0 ||
+      listen(stub->listenfd,16) != 0 ||
+      getsockname(stub->listenfd,(struct sockaddr*)&address,&addressLength) != 0) {
+    close(stub->listenfd);
+    return(0);
+  }
+  stub->port = ntohs(address.sin_port);
+  pthread_mutex_init(&stub->lock,0);
+  if (pthread_create(&stub->thread,0,unittests_httpstub_serve,stub) != 0) {
+    close(stub->listenfd);
+    return(0);
+  }
+  return(1);
+}
+
+//
+// Stop the HTTP stub server
+//
+
+static void
+unittests_httpstub_stop(struct unittests_httpstub* stub) {
+  pthread_mutex_lock(&stub->lock);
+  stub->stopping = 1;
+  pthread_mutex_unlock(&stub->lock);
+  pthread_join(stub->thread,0);
+  for (unsigned int i = 0; i < unittests_httpstub_maxconnections; i++) {
+    if (stub->connections[i].fd >= 0) close(stub->connections[i].fd);
+  }
+  close(stub->listenfd);
+  pthread_mutex_destroy(&stub->lock);
+}
+
+//
+// If the buffer of a connection holds a complete request, remove it
+// from the buffer and answer it. The stub answers that it is busy as
+// many times as it has been asked to, and then with its set
+// response. Returns 1 if a request was answered.
+//
+
+static int
+unittests_httpstub_request(struct unittests_httpstub* stub,
+                           struct unittests_httpstub_connection* connection) {
+  connection->buffer[connection->length] = 0;
+  char* end = strstr(connection->buffer,"\r\n\r\n");
+  if (end == 0) return(0);
+  unsigned int headerLength = (unsigned int)(end + 4 - connection->buffer);
+  unsigned int contentLength = 0;
+  char* field = strstr(connection->buffer,"Content-Length:");
+  if (field != 0 && field < end) contentLength = (unsigned int)atoi(field + strlen("Content-Length:"));
+  if (connection->length < headerLength + contentLength) return(0);
+  memmove(connection->buffer,
+          connection->buffer + headerLength + contentLength,
+          connection->length - headerLength - contentLength);
+  connection->length -= headerLength + contentLength;
+  pthread_mutex_lock(&stub->lock);
+  const char* response = stub->response;
+  if (stub->nBusy > 0) {
+    response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n";
+    stub->nBusy--;
+  }
+  pthread_mutex_unlock(&stub->lock);
+  if (write(connection->fd,response,strlen(response)) < 0) return(0);
+  return(1);
+}
+
+//
+// The HTTP stub server thread
+//
+
+static void*
+unittests_httpstub_serve(void* arg) {
+  struct unittests_httpstub* stub = (struct unittests_httpstub*)arg;
+  while (1) {
+    pthread_mutex_lock(&stub->lock);
+    int stopping = stub->stopping;
+    int stalled = stub->stalled;
+    pthread_mutex_unlock(&stub->lock);
+    if (stopping) break;
+    struct pollfd fds[unittests_httpstub_maxconnections + 1];
+    fds[0].fd = stub->listenfd;
+    fds[0].events = POLLIN;
+    for (unsigned int i = 0; i < unittests_httpstub_maxconnections; i++) {
+      fds[i+1].fd = stalled ? -1 : stub->connections[i].fd;
+      fds[i+1].events = POLLIN;
+      fds[i+1].revents = 0;
+    }
+    if (poll(fds,unittests_httpstub_maxconnections + 1,10) <= 0) continue;
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(stub->listenfd,0,0);
+      for (unsigned int i = 0; fd >= 0 && i < unittests_httpstub_maxconnections; i++) {
+        if (stub->connections[i].fd < 0) {
+          stub->connections[i].fd = fd;
+          stub->connections[i].length = 0;
+          fd = -1;
+          pthread_mutex_lock(&stub->lock);
+          stub->nConnections++;
+          pthread_mutex_unlock(&stub->lock);
+        }
+      }
+      if (fd >= 0) close(fd);
+    }
+    for (unsigned int i = 0; i < unittests_httpstub_maxconnections; i++) {
+      struct unittests_httpstub_connection* connection = &stub->connections[i];
+      if (connection->fd < 0 || (fds[i+1].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+      ssize_t n = read(connection->fd,
+                       connection->buffer + connection->length,
+                       unittests_httpstub_buffersize - 1 - connection->length);
+      if (n <= 0) {
+        close(connection->fd);
+        connection->fd = -1;
+        continue;
+      }
+      connection->length += (unsigned int)n;
+      while (unittests_httpstub_request(stub,connection)) {
+        pthread_mutex_lock(&stub->lock);
+        stub->nRequests++;
+        pthread_mutex_unlock(&stub->lock);
+      }
+    }
+  }
+  return(0);
+}
+
+//
+// Unit tests for the remote client, against the HTTP stub server
+//
+
+static void
+unittests_remoteclient(void) {
+
+  printf("unit tests: remote client...\n");
+  struct unittests_httpstub stub;
+  if (!unittests_httpstub_start(&stub)) {
+    printf("cannot start the HTTP stub server, skipping the remote client tests\n");
+    return;
+  }
+  char url[100];
+  snprintf(url,sizeof(url),"http://127.0.0.1:%u/data/test",stub.port);
+  char data[100];
+
+  //
+  // All blocks get sent when the caller waits for space, and the
+  // connections are kept open between requests
+  //
+
+  struct spindump_remote_client* client = spindump_remote_client_init(url);
+  spindump_checktest(client != 0);
+  spindump_remote_client_setqueue(client,2,1);
+  for (unsigned int i = 0; i < 50; i++) {
+    snprintf(data,sizeof(data),"[{\"block\": %u}]",i);
+    spindump_remote_client_update_event(client,"application/json",strlen(data),(const uint8_t*)data);
+  }
+  spindump_remote_client_flush(client);
+  struct spindump_stats stats;
+  memset(&stats,0,sizeof(stats));
+  spindump_remote_client_getstats(client,&stats);
+  spindump_checktest(stats.remoteBlocksQueued == 50);
+  spindump_checktest(stats.remoteBlocksSent == 50);
+  spindump_checktest(stats.remoteBlocksFailed == 0);
+  spindump_checktest(stats.remoteBlocksDropped == 0);
+  spindump_checktest(stats.remoteQueueDepth == 0);
+  spindump_checktest(stats.remoteMaxQueueDepth >= 1);
+  spindump_checktest(stats.remoteMaxQueueDepth <= 2 + spindump_remote_client_maxinflight);
+  spindump_remote_client_close(client);
+  pthread_mutex_lock(&stub.lock);
+  spindump_checktest(stub.nRequests == 50);
+  spindump_checktest(stub.nConnections <= spindump_remote_client_maxinflight);
+  pthread_mutex_unlock(&stub.lock);
+
+  //
+  // Blocks are dropped when the queue is full and the collector does
+  // not answer, and the rest are sent when it does again
+  //
+
+  pthread_mutex_lock(&stub.lock);
+  stub.stalled = 1;
+  stub.nRequests = 0;
+  pthread_mutex_unlock(&stub.lock);
+  client = spindump_remote_client_init(url);
+  spindump_checktest(client != 0);
+  spindump_remote_client_setqueue(client,2,0);
+  for (unsigned int i = 0; i < 20; i++) {
+    snprintf(data,sizeof(data),"[{\"block\": %u}]",i);
+    spindump_remote_client_update_event(client,"application/json",strlen(data),(const uint8_t*)data);
+  }
+  pthread_mutex_lock(&stub.lock);
+  stub.stalled = 0;
+  pthread_mutex_unlock(&stub.lock);
+  spindump_remote_client_flush(client);
+  memset(&stats,0,sizeof(stats));
+  spindump_remote_client_getstats(client,&stats);
+  spindump_checktest(stats.remoteBlocksDropped >= 20 - 2 - spindump_remote_client_maxinflight);
+  spindump_checktest(stats.remoteBlocksSent + stats.remoteBlocksDropped == 20);
+  spindump_checktest(stats.remoteBlocksFailed == 0);
+  spindump_remote_client_close(client);
+  pthread_mutex_lock(&stub.lock);
+  spindump_checktest(stub.nRequests == 20 - stats.remoteBlocksDropped);
+  pthread_mutex_unlock(&stub.lock);
+
+  //
+  // Blocks that a busy collector refuses are sent again after the
+  // time that it asks for
+  //
+
+  pthread_mutex_lock(&stub.lock);
+  stub.nBusy = 2;
+  stub.nRequests = 0;
+  pthread_mutex_unlock(&stub.lock);
+  client = spindump_remote_client_init(url);
+  spindump_checktest(client != 0);
+  struct timeval start;
+  spindump_getcurrenttime(&start);
+  for (unsigned int i = 0; i < 3; i++) {
+    snprintf(data,sizeof(data),"[{\"block\": %u}]",i);
+    spindump_remote_client_update_event(client,"application/json",strlen(data),(const uint8_t*)data);
+  }
+  spindump_remote_client_flush(client);
+  struct timeval end;
+  spindump_getcurrenttime(&end);
+  memset(&stats,0,sizeof(stats));
+  spindump_remote_client_getstats(client,&stats);
+  spindump_checktest(stats.remoteBlocksSent == 3);
+  spindump_checktest(stats.remoteBlocksFailed == 0);
+  spindump_checktest(spindump_timediffinusecs(&end,&start) >= 1000 * 1000);
+  spindump_remote_client_close(client);
+  pthread_mutex_lock(&stub.lock);
+  spindump_checktest(stub.nRequests == 3 + 2);
+  pthread_mutex_unlock(&stub.lock);
+
+  //
+  // Blocks that the collector answers with an error status fail
+  //
+
+  pthread_mutex_lock(&stub.lock);
+  stub.response = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+  pthread_mutex_unlock(&stub.lock);
+  client = spindump_remote_client_init(url);
+  spindump_checktest(client != 0);
+  for (unsigned int i = 0; i < 3; i++) {
+    snprintf(data,sizeof(data),"[{\"block\": %u}]",i);
+    spindump_remote_client_update_event(client,"application/json",strlen(data),(const uint8_t*)data);
+  }
+  spindump_remote_client_flush(client);
+  memset(&stats,0,sizeof(stats));
+  spindump_remote_client_getstats(client,&stats);
+  spindump_checktest(stats.remoteBlocksFailed == 3);
+  spindump_checktest(stats.remoteBlocksSent == 0);
+  spindump_checktest(stats.remoteSendLatency == 0);
+  spindump_remote_client_close(client);
+  unittests_httpstub_stop(&stub);
+
+  //
+  // Sending to a collector that is not there fails, but does not
+  // hold up the caller
+  //
+
+  client = spindump_remote_client_init(url);
+  spindump_checktest(client != 0);
+  for (unsigned int i = 0; i < 3; i++) {
+    snprintf(data,sizeof(data),"[{\"block\": %u}]",i);
+    spindump_remote_client_update_event(client,"application/json",strlen(data),(const uint8_t*)data);
+  }
+  spindump_remote_client_flush(client);
+  memset(&stats,0,sizeof(stats));
+  spindump_remote_client_getstats(client,&stats);
+  spindump_checktest(stats.remoteBlocksFailed == 3);
+  spindump_checktest(stats.remoteBlocksSent == 0);
+  spindump_remote_client_close(client);
+}
+
+//
+// Unit tests for buffered event output
+//
+
+static void
+unittests_eventformatter(void) {
+
+  printf("unit tests: event formatter...\n");
+
+  //
+  // Set up a formatter with a small buffer, writing to a pipe
+  //
+
+  int fds[2];
+  spindump_checktest(pipe(fds) == 0);
+  spindump_checktest(fcntl(fds[0],F_SETFL,O_NONBLOCK) == 0);
+  FILE* file = fdopen(fds[1],"w");
+  spindump_checktest(file != 0);
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  struct spindump_eventformatter* formatter =
+    spindump_eventformatter_initialize_file(analyzer,
+                                            spindump_eventformatter_outputformat_json,
+                                            file,
+                                            64,
+                                            0,
+                                            0,0,0,0,0,0,0,0,0,0,0,0,0,
+                                            0);
+  spindump_checktest(formatter != 0);
+  spindump_checktest(formatter->outBuffer != 0);
+  char buf[200];
+  spindump_checktest(read(fds[0],buf,sizeof(buf)) < 0 && errno == EAGAIN);
+
+  //
+  // Entries stay in the buffer until it is flushed
+  //
+
+  const char* small = "{ \"a\": 1 }";
+  spindump_eventformatter_deliverdata(formatter,strlen(small),(const uint8_t*)small);
+  spindump_checktest(read(fds[0],buf,sizeof(buf)) < 0 && errno == EAGAIN);
+  spindump_eventformatter_flush(formatter);
+  ssize_t n = read(fds[0],buf,sizeof(buf));
+  spindump_checktest(n == 2 + (ssize_t)strlen(small));
+  spindump_checktest(n > 0 && memcmp(buf,"[\n{ \"a\": 1 }",(size_t)n) == 0);
+
+  //
+  // An entry that does not fit is written out with the buffered ones
+  //
+
+  char large[61];
+  memset(large,'x',sizeof(large) - 1);
+  large[sizeof(large) - 1] = 0;
+  spindump_eventformatter_deliverdata(formatter,strlen(small),(const uint8_t*)small);
+  spindump_eventformatter_deliverdata(formatter,strlen(large),(const uint8_t*)large);
+  n = read(fds[0],buf,sizeof(buf));
+  spindump_checktest(n == 2 + (ssize_t)strlen(small) + 2 + (ssize_t)strlen(large));
+  spindump_checktest(n > 14 && memcmp(buf,",\n{ \"a\": 1 },\n",14) == 0);
+  spindump_checktest(n > 14 && memcmp(buf + 14,large,strlen(large)) == 0);
+  spindump_checktest(formatter->bytesInOutBuffer == 0);
+
+  //
+  // Periodic flushes happen once the flush interval has passed
+  //
+
+  struct timeval now;
+  now.tv_sec = 1;
+  now.tv_usec = 0;
+  spindump_eventformatter_periodicflush(formatter,&now);
+  spindump_eventformatter_deliverdata(formatter,strlen(small),(const uint8_t*)small);
+  now.tv_usec = 500 * 1000;
+  spindump_eventformatter_periodicflush(formatter,&now);
+  spindump_checktest(read(fds[0],buf,sizeof(buf)) < 0 && errno == EAGAIN);
+  now.tv_sec = 2;
+  spindump_eventformatter_periodicflush(formatter,&now);
+  n = read(fds[0],buf,sizeof(buf));
+  spindump_checktest(n == 2 + (ssize_t)strlen(small));
+
+  //
+  // Closing the formatter writes out the rest
+  //
+
+  spindump_eventformatter_deliverdata(formatter,strlen(small),(const uint8_t*)small);
+  spindump_eventformatter_uninitialize(formatter);
+  n = read(fds[0],buf,sizeof(buf));
+  spindump_checktest(n == 2 + (ssize_t)strlen(small) + 3);
+  spindump_checktest(n > 3 && memcmp(buf + n - 3,"\n]\n",3) == 0);
+  fclose(file);
+  close(fds[0]);
+  spindump_analyze_uninitialize(analyzer);
+}
+
+//
+// Read batches from a capture until no packets arrive, and count the
+// UDP packets sent to a given port on loopback. Also check that the
+// packets are in the ring, and that a batch stays within a block.
+//
+
+static unsigned int
+unittests_capture_count(struct spindump_capture_state* capture,
+                        spindump_port port,
+                        struct spindump_stats* stats) {
+  struct spindump_packet packets[16];
+  unsigned int count = 0;
+  unsigned int idle = 0;
+  while (idle < 20) {
+    unsigned int nPackets = 0;
+    int more = 0;
+    spindump_capture_nextbatch(capture,packets,16,&nPackets,&more,stats);
+    spindump_checktest(more);
+    if (nPackets == 0) {
+      idle++;
+      continue;
+    }
+    idle = 0;
+    const uint8_t* block =
+      capture->ring.map + (size_t)capture->ring.currentBlock * capture->ring.blockSize;
+    for (unsigned int i = 0; i < nPackets; i++) {
+      struct spindump_packet* packet = &packets[i];
+      spindump_checktest(packet->contents >= block &&
+                         packet->contents + packet->caplen <= block + capture->ring.blockSize);
+      spindump_checktest(packet->caplen <= spindump_capture_snaplen);
+      if (packet->caplen >= spindump_ethernet_header_size + 20 + 8 &&
+          packet->contents[12] == 0x08 && packet->contents[13] == 0x00 &&
+          packet->contents[spindump_ethernet_header_size + 9] == IPPROTO_UDP &&
+          packet->contents[spindump_ethernet_header_size + 22] == (port >> 8) &&
+          packet->contents[spindump_ethernet_header_size + 23] == (port & 0xff)) {
+        count++;
+      }
+    }
+    spindump_capture_releasebatch(capture);
+  }
+  return(count);
+}
+
+//
+// Unit tests for the AF_PACKET capture, on the loopback interface.
+// These need the privileges to open packet sockets, and are skipped
+// if there are none.
+//
+
+static void
+unittests_capture(void) {
+
+  printf("unit tests: capture...\n");
+  struct spindump_capture_state* capture1 = spindump_capture_initialize_afpacket("lo",0,spindump_capture_snaplen,4711);
+  if (capture1 == 0) {
+    printf("cannot open an AF_PACKET capture on loopback, skipping the capture tests\n");
+    return;
+  }
+  struct spindump_capture_state* capture2 = spindump_capture_initialize_afpacket("lo",0,spindump_capture_snaplen,4711);
+  spindump_checktest(capture2 != 0);
+  spindump_checktest(spindump_capture_getlinktype(capture1) == spindump_capture_linktype_ethernet);
+  struct spindump_stats* stats = spindump_stats_initialize();
+  spindump_checktest(stats != 0);
+
+  //
+  // Send packets in one flow. Each is seen once (not again as the
+  // outgoing copy), and by only one of the captures in the fanout
+  // group.
+  //
+
+  int receiver = socket(AF_INET,SOCK_DGRAM,0);
+  int sender = socket(AF_INET,SOCK_DGRAM,0);
+  spindump_checktest(receiver >= 0 && sender >= 0);
+  struct sockaddr_in address;
+  memset(&address,0,sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  spindump_checktest(bind(receiver,(struct sockaddr*)&address,sizeof(address)) == 0);
+  socklen_t addressLength = sizeof(address);
+  spindump_checktest(getsockname(receiver,(struct sockaddr*)&address,&addressLength) == 0);
+  spindump_port port = ntohs(address.sin_port);
+  const unsigned int nSent = 50;
+  char payload[200];
+  memset(payload,'x',sizeof(payload));
+  for (unsigned int i = 0; i < nSent; i++) {
+    spindump_checktest(sendto(sender,payload,sizeof(payload),0,
+                              (struct sockaddr*)&address,sizeof(address)) == sizeof(payload));
+  }
+  unsigned int count1 = unittests_capture_count(capture1,port,stats);
+  unsigned int count2 = unittests_capture_count(capture2,port,stats);
+  spindump_checktest((count1 == nSent && count2 == 0) || (count1 == 0 && count2 == nSent));
+  spindump_checktest(stats->receivedFrames >= nSent);
+
+  //
+  // Clean up
+  //
+
+  close(sender);
+  close(receiver);
+  spindump_stats_uninitialize(stats);
+  spindump_capture_uninitialize(capture1);
+  spindump_capture_uninitialize(capture2);
+}
+
+//
+// Unit tests for the multi-threaded pipeline
+//
+
+static void
+unittests_pipeline(void) {
+
+  printf("unit tests: pipeline...\n");
+
+  //
+  // Flow keys are the same in both directions of a flow
+  //
+
+  unsigned char forward[] = {
+    // IPv4 header
+    0x45, 0x00, 0x00, 0x24, 0x00, 0x01, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00,
+    // IPv4 source and destination address
+    0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+    // UDP header: ports, length, csum
+    0x30, 0x39, 0x01, 0xbb, 0x00, 0x10, 0x00, 0x00,
+    // UDP payload
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07
+  };
+  unsigned char reverse[sizeof(forward)];
+  memcpy(reverse,forward,sizeof(forward));
+  memcpy(&reverse[12],&forward[16],4);
+  memcpy(&reverse[16],&forward[12],4);
+  memcpy(&reverse[20],&forward[22],2);
+  memcpy(&reverse[22],&forward[20],2);
+
+  struct spindump_packet packet;
+  memset(&packet,0,sizeof(packet));
+  packet.timestamp.tv_sec = 1;
+  packet.etherlen = sizeof(forward);
+  packet.caplen = sizeof(forward);
+  packet.contents = forward;
+  uint32_t key1 = spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet);
+  packet.contents = reverse;
+  uint32_t key2 = spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet);
+  spindump_checktest(key1 == key2);
+
+  //
+  // Other flows between the same hosts get different keys
+  //
+
+  unsigned char other[sizeof(forward)];
+  memcpy(other,forward,sizeof(forward));
+  other[21] ^= 0x01;
+  packet.contents = other;
+  uint32_t key3 = spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet);
+  spindump_checktest(key3 != key1);
+
+  //
+  // Non-first fragments carry no ports, so only the addresses count
+  //
+
+  forward[7] = 0x10;
+  other[7] = 0x10;
+  packet.contents = forward;
+  key1 = spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet);
+  packet.contents = other;
+  key3 = spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet);
+  spindump_checktest(key1 == key3);
+  forward[7] = 0x00;
+
+  //
+  // Unparseable packets go to the first worker
+  //
+
+  packet.contents = forward;
+  packet.caplen = 4;
+  packet.etherlen = 4;
+  spindump_checktest(spindump_pipeline_flowkey(spindump_capture_linktype_raw,&packet) == 0);
+  packet.caplen = sizeof(forward);
+  packet.etherlen = sizeof(forward);
+
+  //
+  // Both directions of a flow are analyzed by the same worker
+  //
+
+  struct spindump_analyze* analyzers[2];
+  analyzers[0] = spindump_analyze_initialize(0,0,1000000,0,0);
+  analyzers[1] = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzers[0] != 0 && analyzers[1] != 0);
+  struct spindump_pipeline* pipeline =
+    spindump_pipeline_initialize(2,analyzers,spindump_capture_linktype_raw,0,0);
+  spindump_checktest(pipeline != 0);
+  struct timeval now;
+  now.tv_sec = 1;
+  now.tv_usec = 0;
+  for (unsigned int i = 0; i < 10; i++) {
+    packet.timestamp.tv_usec = (int)(2 * i);
+    packet.contents = forward;
+    spindump_pipeline_dispatch(pipeline,&packet,&now);
+    packet.timestamp.tv_usec = (int)(2 * i + 1);
+    packet.contents = reverse;
+    spindump_pipeline_dispatch(pipeline,&packet,&now);
+    spindump_pipeline_tick(pipeline,&now);
+  }
+  spindump_pipeline_uninitialize(pipeline);
+  unsigned int udp0 = spindump_analyze_getstats(analyzers[0])->receivedUdp;
+  unsigned int udp1 = spindump_analyze_getstats(analyzers[1])->receivedUdp;
+  spindump_checktest((udp0 == 20 && udp1 == 0) || (udp0 == 0 && udp1 == 20));
+  spindump_checktest(analyzers[0]->firstEventTime == 1000 * 1000 ||
+                     analyzers[1]->firstEventTime == 1000 * 1000);
+  spindump_analyze_uninitialize(analyzers[0]);
+  spindump_analyze_uninitialize(analyzers[1]);
+}
+
+//
+// Unit tests for batch processing of packets
+//
+
+static void
+unittests_batch(void) {
+
+  printf("unit tests: batch...\n");
+
+  //
+  // Decode the flow of a packet
+  //
+
+  unsigned char forward[] = {
+    // IPv4 header
+    0x45, 0x00, 0x00, 0x24, 0x00, 0x01, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00,
+    // IPv4 source and destination address
+    0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+    // UDP header: ports, length, csum
+    0x13, 0x88, 0x17, 0x70, 0x00, 0x10, 0x00, 0x00,
+    // UDP payload
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07
+  };
+  unsigned char reverse[sizeof(forward)];
+  memcpy(reverse,forward,sizeof(forward));
+  memcpy(&reverse[12],&forward[16],4);
+  memcpy(&reverse[16],&forward[12],4);
+  memcpy(&reverse[20],&forward[22],2);
+  memcpy(&reverse[22],&forward[20],2);
+
+  struct spindump_packet packets[spindump_analyze_maxbatch];
+  memset(packets,0,sizeof(packets));
+  for (unsigned int i = 0; i < spindump_analyze_maxbatch; i++) {
+    packets[i].timestamp.tv_sec = 1;
+    packets[i].timestamp.tv_usec = (int)i;
+    packets[i].etherlen = sizeof(forward);
+    packets[i].caplen = sizeof(forward);
+  }
+  packets[0].contents = forward;
+  packets[1].contents = reverse;
+  struct spindump_analyze_flow flow;
+  spindump_checktest(spindump_analyze_decodeflow(spindump_capture_linktype_raw,&packets[0],&flow));
+  spindump_checktest(flow.protocol == IPPROTO_UDP);
+  spindump_checktest(flow.addressLength == 4);
+  spindump_checktest(flow.source == &forward[12] && flow.destination == &forward[16]);
+  spindump_checktest(flow.sourcePort == &forward[20] && flow.destinationPort == &forward[22]);
+  packets[0].caplen = 10;
+  spindump_checktest(!spindump_analyze_decodeflow(spindump_capture_linktype_raw,&packets[0],&flow));
+  packets[0].caplen = sizeof(forward);
+
+  //
+  // Both directions of a flow in a batch belong to the same
+  // connection, which is indexed under the key that the batch
+  // prefetches
+  //
+
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  struct spindump_connection* connections[spindump_analyze_maxbatch];
+  spindump_analyze_process_batch(analyzer,spindump_capture_linktype_raw,packets,2,connections);
+  spindump_checktest(connections[0] != 0 && connections[0] == connections[1]);
+  spindump_checktest(connections[0]->type == spindump_connection_transport_udp);
+  spindump_compactaddress source;
+  spindump_compactaddress destination;
+  memset(&source,0,sizeof(source));
+  memset(&destination,0,sizeof(destination));
+  source.family = destination.family = AF_INET;
+  memcpy(source.words,&forward[12],4);
+  memcpy(destination.words,&forward[16],4);
+  uint32_t key = spindump_connectionstable_index_hostkey(spindump_connection_transport_udp,
+                                                         &destination,6000,
+                                                         &source,5000);
+  spindump_checktest(connections[0]->tupleEntry.key == key);
+
+  //
+  // With enough connections for the prefetching to be used, the
+  // results are the same as without
+  //
+
+  unsigned int nFlows = spindump_analyze_prefetchmin + 2 * spindump_analyze_maxbatch;
+  unsigned char* flows = (unsigned char*)spindump_malloc(nFlows * sizeof(forward));
+  spindump_checktest(flows != 0);
+  for (unsigned int i = 0; i < nFlows; i++) {
+    unsigned char* contents = &flows[i * sizeof(forward)];
+    memcpy(contents,forward,sizeof(forward));
+    contents[14] = (unsigned char)(i >> 8);
+    contents[15] = (unsigned char)(i & 0xff);
+  }
+  int usec = spindump_analyze_maxbatch;
+  for (unsigned int i = 0; i < nFlows; i += spindump_analyze_maxbatch) {
+    unsigned int n = spindump_min(nFlows - i,spindump_analyze_maxbatch);
+    for (unsigned int j = 0; j < n; j++) {
+      packets[j].contents = &flows[(i + j) * sizeof(forward)];
+      packets[j].timestamp.tv_usec = usec++;
+    }
+    spindump_analyze_process_batch(analyzer,spindump_capture_linktype_raw,packets,n,connections);
+    for (unsigned int j = 0; j < n; j++) spindump_checktest(connections[j] != 0);
+  }
+  unsigned int nEntries = analyzer->table->tupleIndex.nEntries;
+  spindump_checktest(nEntries >= spindump_analyze_prefetchmin);
+  for (unsigned int j = 0; j < spindump_analyze_maxbatch; j++) {
+    packets[j].contents = &flows[(nFlows - 1 - j) * sizeof(forward)];
+    packets[j].timestamp.tv_usec = usec++;
+  }
+  spindump_analyze_process_batch(analyzer,spindump_capture_linktype_raw,packets,spindump_analyze_maxbatch,connections);
+  spindump_checktest(analyzer->table->tupleIndex.nEntries == nEntries);
+  for (unsigned int j = 0; j < spindump_analyze_maxbatch; j++) {
+    struct spindump_connection* connection = 0;
+    packets[j].timestamp.tv_usec = usec++;
+    spindump_analyze_process(analyzer,spindump_capture_linktype_raw,&packets[j],&connection);
+    spindump_checktest(connection != 0 && connection == connections[j]);
+  }
+  spindump_checktest(spindump_analyze_getstats(analyzer)->receivedUdp == 2 + nFlows + 2 * spindump_analyze_maxbatch);
+  spindump_free(flows);
+  spindump_analyze_uninitialize(analyzer);
+}
+
+//
+// Unit tests for running the analyzer's handlers for events
+//
+
+static void
+unittests_handlers_count(struct spindump_analyze* state,
+                         void* handlerData,
+                         void** handlerConnectionData,
+                         spindump_analyze_event event,
+                         const struct timeval* timestamp,
+                         const int fromResponder,
+                         const unsigned int ipPacketLength,
+                         struct spindump_packet* packet,
+                         struct spindump_connection* connection) {
+  unsigned int* counts = (unsigned int*)handlerData;
+  if (event == spindump_analyze_event_newconnection) counts[0]++;
+  if (event == spindump_analyze_event_newpacket) counts[1]++;
+}
+
+static void
+unittests_handlers(void) {
+
+  printf("unit tests: handlers...\n");
+
+  unsigned char contents[] = {
+    // IPv4 header
+    0x45, 0x00, 0x00, 0x20, 0x00, 0x01, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00,
+    // IPv4 source and destination address
+    0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+    // UDP header: ports, length, csum
+    0x13, 0x88, 0x17, 0x70, 0x00, 0x0c, 0x00, 0x00,
+    // UDP payload
+    0x00, 0x00, 0x00, 0x00
+  };
+  struct spindump_packet packet;
+  memset(&packet,0,sizeof(packet));
+  packet.timestamp.tv_sec = 1;
+  packet.etherlen = sizeof(contents);
+  packet.caplen = sizeof(contents);
+  packet.contents = contents;
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  struct spindump_stats* stats = spindump_analyze_getstats(analyzer);
+  spindump_address host1;
+  spindump_address host2;
+  spindump_address_fromstring(&host1,"10.0.0.1");
+  spindump_address_fromstring(&host2,"10.0.0.2");
+  struct spindump_connection* aggregate =
+    spindump_connections_newconnection_aggregate_hostpair(&host1,&host2,&packet.timestamp,1,analyzer->table);
+  spindump_checktest(aggregate != 0);
+
+  //
+  // Without handlers, events are counted but not delivered. An
+  // aggregate gets its counters updated, but no events.
+  //
+
+  struct spindump_connection* connection = 0;
+  spindump_analyze_process(analyzer,spindump_capture_linktype_raw,&packet,&connection);
+  spindump_checktest(connection != 0);
+  spindump_checktest(!spindump_analyze_hashandlers(analyzer,spindump_analyze_event_alllegal));
+  spindump_checktest(aggregate->packetsFromSide1 + aggregate->packetsFromSide2 == 1);
+  spindump_checktest(stats->analyzerEvents == 2);
+  spindump_checktest(stats->analyzerEventsDelivered == 0);
+  spindump_checktest(stats->analyzerHandlerCalls == 0);
+
+  //
+  // Handlers are run only for the events they subscribe to
+  //
+
+  unsigned int both[2] = { 0, 0 };
+  unsigned int packets[2] = { 0, 0 };
+  spindump_analyze_registerhandler(analyzer,
+                                   spindump_analyze_event_newconnection + spindump_analyze_event_newpacket,
+                                   0,unittests_handlers_count,both);
+  spindump_analyze_registerhandler(analyzer,spindump_analyze_event_newpacket,0,unittests_handlers_count,packets);
+  spindump_checktest(spindump_analyze_hashandlers(analyzer,spindump_analyze_event_newconnection));
+  spindump_checktest(!spindump_analyze_hashandlers(analyzer,spindump_analyze_event_periodic));
+  spindump_checktest(analyzer->dispatch[0].nHandlers == 1);
+  spindump_checktest(analyzer->dispatch[11].nHandlers == 2);
+  contents[15] = 2;
+  spindump_analyze_process(analyzer,spindump_capture_linktype_raw,&packet,&connection);
+  spindump_checktest(both[0] == 1 && both[1] == 0);
+  spindump_checktest(packets[0] == 0 && packets[1] == 0);
+  spindump_checktest(stats->analyzerEvents == 3);
+  spindump_checktest(stats->analyzerEventsDelivered == 1);
+  spindump_checktest(stats->analyzerHandlerCalls == 1);
+  spindump_analyze_process(analyzer,spindump_capture_linktype_raw,&packet,&connection);
+  spindump_checktest(both[0] == 1 && both[1] == 1);
+  spindump_checktest(packets[0] == 0 && packets[1] == 1);
+  spindump_checktest(stats->analyzerEvents == 4);
+  spindump_checktest(stats->analyzerEventsDelivered == 2);
+  spindump_checktest(stats->analyzerHandlerCalls == 3);
+
+  //
+  // A handler that is no longer registered is no longer run
+  //
+
+  spindump_analyze_unregisterhandler(analyzer,
+                                     spindump_analyze_event_newconnection + spindump_analyze_event_newpacket,
+                                     0,unittests_handlers_count,both);
+  spindump_checktest(!spindump_analyze_hashandlers(analyzer,spindump_analyze_event_newconnection));
+  spindump_analyze_process(analyzer,spindump_capture_linktype_raw,&packet,&connection);
+  spindump_checktest(both[0] == 1 && both[1] == 1);
+  spindump_checktest(packets[0] == 0 && packets[1] == 2);
+  spindump_checktest(stats->analyzerEvents == 5);
+  spindump_checktest(stats->analyzerEventsDelivered == 3);
+  spindump_analyze_unregisterhandler(analyzer,spindump_analyze_event_newpacket,0,unittests_handlers_count,packets);
+  spindump_checktest(analyzer->nHandlers == 0);
+  spindump_checktest(analyzer->subscribedEvents == 0);
+  spindump_analyze_uninitialize(analyzer);
+}
+
+//
+// Calculate the moving average, standard deviation, and filtered
+// average of an RTT object directly from its recent values, for
+// comparison with the running sums
+//
+
+static unsigned long
+unittests_rtt_reference(const struct spindump_rtt* rtt,
+                        int filter,
+                        unsigned int filterLimitPercentage,
+                        unsigned long* standardDeviation,
+                        unsigned long* filteredAvg) {
+  unsigned long long sum = 0;
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+    if (rtt->recentRTTs[i] != spindump_rtt_infinite) {
+      sum += rtt->recentRTTs[i];
+      n++;
+    }
+  }
+  if (n == 0) {
+    *standardDeviation = 0;
+    return(spindump_rtt_infinite);
+  }
+  unsigned long long avg = sum / n;
+  unsigned long long devSum = 0;
+  for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+    unsigned long long val = rtt->recentRTTs[i];
+    if (val != spindump_rtt_infinite) {
+      unsigned long long diff = val > avg ? val - avg : avg - val;
+      devSum += diff * diff;
+    }
+  }
+  *standardDeviation = n > 1 ? (unsigned long)floor(sqrt((1.0/(n-1))*(double)devSum)) : 0;
+  unsigned long long fsum = 0;
+  unsigned int fn = 0;
+  unsigned long limitdiff = (filterLimitPercentage * rtt->lastStandardDeviation) / 100;
+  int limits =
+    filter &&
+    rtt->lastMovingAvgRTT != spindump_rtt_infinite &&
+    rtt->lastStandardDeviation != spindump_rtt_infinite &&
+    n >= spindump_rtt_nminfilter;
+  for (unsigned int i = 0; i < spindump_rtt_nrecent; i++) {
+    unsigned long val = rtt->recentRTTs[i];
+    if (val != spindump_rtt_infinite &&
+        (!limits ||
+         ((rtt->lastMovingAvgRTT <= limitdiff || val >= rtt->lastMovingAvgRTT - limitdiff) &&
+          val <= rtt->lastMovingAvgRTT + limitdiff))) {
+      fsum += val;
+      fn++;
+    }
+  }
+  *filteredAvg = fn > 0 ? (unsigned long)(fsum / fn) : 0;
+  return((unsigned long)avg);
+}
+
+//
+// Unit tests for the RTT calculations
+//
+
+static void
+unittests_rtt(void) {
+
+  printf("unit tests: rtt...\n");
+
+  //
+  // Averages and deviations from running sums are the same as from
+  // the values, including with values too large for the sums of
+  // squares, and for objects that were only zeroed
+  //
+
+  uint32_t seed = 1;
+  for (unsigned int round = 0; round < 3; round++) {
+    struct spindump_rtt rtt;
+    if (round < 2) {
+      spindump_rtt_initialize(&rtt);
+    } else {
+      memset(&rtt,0,sizeof(rtt));
+    }
+    for (unsigned int i = 0; i < 200; i++) {
+      seed = seed * 1103515245 + 12345;
+      unsigned long long sample = 10000 + (seed >> 8) % 5000;
+      if (i % 17 == 0) sample *= 10;
+      if (round == 1 && i % 23 == 0) sample = 0xfffffffffULL;
+      spindump_rtt_newmeasurement(&rtt,sample);
+      int filter = (i % 3) != 0;
+      unsigned long refDev;
+      unsigned long refFilt;
+      unsigned long refAvg = unittests_rtt_reference(&rtt,filter,200,&refDev,&refFilt);
+      unsigned long dev;
+      unsigned long filt;
+      unsigned long avg = spindump_rtt_calculateLastMovingAvgRTT(&rtt,filter,200,&dev,&filt);
+      spindump_checktest(avg == refAvg);
+      spindump_checktest(dev == refDev);
+      spindump_checktest(filt == refFilt);
+    }
+  }
+
+  //
+  // Smoothed RTT
+  //
+
+  struct spindump_rtt rtt;
+  unsigned long variation;
+  spindump_rtt_initialize(&rtt);
+  spindump_checktest(spindump_rtt_smoothed(&rtt,&variation) == spindump_rtt_infinite);
+  spindump_checktest(variation == 0);
+  spindump_rtt_newmeasurement(&rtt,8000);
+  spindump_checktest(spindump_rtt_smoothed(&rtt,&variation) == 8000);
+  spindump_checktest(variation == 4000);
+  spindump_rtt_newmeasurement(&rtt,16000);
+  spindump_checktest(spindump_rtt_smoothed(&rtt,&variation) == 9000);
+  spindump_checktest(variation == 5000);
+}
+
+//
+// Unit tests for the RTT histograms
+//
+
+static void
+unittests_histogram(void) {
+
+  printf("unit tests: histogram...\n");
+
+  //
+  // Buckets cover all values in order, without gaps, and each value
+  // is in a bucket at most 25% wider than its lower limit
+  //
+
+  spindump_checktest(spindump_histogram_bucket(0) == 0);
+  spindump_checktest(spindump_histogram_bucket(3) == 3);
+  spindump_checktest(spindump_histogram_bucket(4) == 4);
+  spindump_checktest(spindump_histogram_bucket(7) == 7);
+  spindump_checktest(spindump_histogram_bucket(8) == 8);
+  spindump_checktest(spindump_histogram_bucket(10) == 9);
+  spindump_checktest(spindump_histogram_bucket(0xffffffffUL) == spindump_histogram_nbuckets - 1);
+  for (unsigned int bucket = 1; bucket < spindump_histogram_nbuckets; bucket++) {
+    unsigned long low = spindump_histogram_bucketlow(bucket);
+    spindump_checktest(spindump_histogram_bucket(low) == bucket);
+    spindump_checktest(spindump_histogram_bucket(low - 1) == bucket - 1);
+    spindump_checktest(spindump_histogram_bucketvalue(bucket) >= low);
+    spindump_checktest(spindump_histogram_bucket(spindump_histogram_bucketvalue(bucket)) == bucket);
+    if (bucket < spindump_histogram_nbuckets - 1) {
+      unsigned long high = spindump_histogram_bucketlow(bucket + 1);
+      spindump_checktest(high - low <= (low + 3) / 4);
+    }
+  }
+
+  //
+  // Quantiles
+  //
+
+  struct spindump_histogram histogram;
+  spindump_histogram_initialize(&histogram);
+  spindump_checktest(spindump_histogram_quantile(&histogram,50) == 0);
+  for (unsigned long value = 1; value <= 1000; value++) {
+    spindump_histogram_record(&histogram,value * 100);
+  }
+  spindump_checktest(histogram.count == 1000);
+  unsigned long p50 = spindump_histogram_quantile(&histogram,50);
+  unsigned long p90 = spindump_histogram_quantile(&histogram,90);
+  unsigned long p99 = spindump_histogram_quantile(&histogram,99);
+  spindump_checktest(p50 >= 50000 * 7 / 8 && p50 <= 50000 * 9 / 8);
+  spindump_checktest(p90 >= 90000 * 7 / 8 && p90 <= 90000 * 9 / 8);
+  spindump_checktest(p99 >= 99000 * 7 / 8 && p99 <= 99000 * 9 / 8);
+  spindump_checktest(spindump_histogram_quantile(&histogram,0) ==
+                     spindump_histogram_bucketvalue(spindump_histogram_bucket(100)));
+  spindump_checktest(spindump_histogram_quantile(&histogram,100) ==
+                     spindump_histogram_bucketvalue(spindump_histogram_bucket(100000)));
+
+  //
+  // Merging two halves gives the same histogram as recording all
+  //
+
+  struct spindump_histogram half1;
+  struct spindump_histogram half2;
+  spindump_histogram_initialize(&half1);
+  spindump_histogram_initialize(&half2);
+  for (unsigned long value = 1; value <= 1000; value++) {
+    spindump_histogram_record(value % 2 ? &half1 : &half2,value * 100);
+  }
+  spindump_checktest(!spindump_histogram_equal(&half1,&histogram));
+  spindump_histogram_merge(&half1,&half2);
+  spindump_checktest(spindump_histogram_equal(&half1,&histogram));
+}
+
+//
+// Unit tests for the TCP sequence number tracker
+//
+
+static void
+unittests_seqtracker(void) {
+
+  printf("unit tests: seqtracker...\n");
+  
+  struct spindump_seqtracker tracker;
+  struct timeval sent;
+  struct timeval now;
+  struct timeval* ackto;
+  struct spindump_tcp_sack sack;
+  tcp_seq sentSeq;
+  int sentFin;
+  
+  //
+  // More segments in flight than the initial size, across a
+  // sequence number wraparound. Each ACK finds its segment.
+  //
+
+  spindump_seqtracker_initialize(&tracker);
+  tcp_seq start = 0xffffff00;
+  for (unsigned int i = 0; i < 100; i++) {
+    sent.tv_sec = 1;
+    sent.tv_usec = (long)i;
+    spindump_seqtracker_add(&tracker,&sent,0,start + i * 100,100,0);
+  }
+  spindump_checktest(tracker.count == 100);
+  now.tv_sec = 2;
+  now.tv_usec = 0;
+  for (unsigned int i = 0; i < 100; i += 10) {
+    ackto = spindump_seqtracker_ackto(&tracker,start + (i + 1) * 100,0,0,0,&now,&sentSeq,&sentFin);
+    spindump_checktest(ackto != 0);
+    spindump_checktest(ackto != 0 && ackto->tv_usec == (long)i);
+    spindump_checktest(sentSeq == start + i * 100);
+  }
+  spindump_checktest(tracker.count == 10);
+  
+  //
+  // A duplicate ACK gives no new sample, and a retransmission
+  // replaces the original segment
+  //
+  
+  ackto = spindump_seqtracker_ackto(&tracker,start + 91 * 100,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto == 0);
+  spindump_checktest(sentSeq == start + 90 * 100);
+  sent.tv_usec = 500;
+  spindump_seqtracker_add(&tracker,&sent,0,start + 95 * 100,100,0);
+  spindump_checktest(tracker.count == 10);
+  ackto = spindump_seqtracker_ackto(&tracker,start + 96 * 100,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto != 0 && ackto->tv_usec == 500);
+  
+  //
+  // SACK blocks: the first block gives the sample, and the segments
+  // in all blocks can no longer give one
+  //
+
+  sack.blocks[0].left = start + 98 * 100;
+  sack.blocks[0].right = start + 99 * 100;
+  sack.blocks[1].left = start + 97 * 100;
+  sack.blocks[1].right = start + 98 * 100;
+  ackto = spindump_seqtracker_ackto(&tracker,start + 96 * 100,&sack,2,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto != 0 && ackto->tv_usec == 98);
+  ackto = spindump_seqtracker_ackto(&tracker,start + 98 * 100,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto == 0);
+  spindump_checktest(sentSeq == start + 97 * 100);
+  ackto = spindump_seqtracker_ackto(&tracker,start + 100 * 100,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto != 0 && ackto->tv_usec == 99);
+  spindump_checktest(tracker.count == 1);
+  
+  //
+  // The depth is bounded, with the lowest sequence numbers forgotten
+  //
+
+  for (unsigned int i = 0; i < spindump_seqtracker_maxdepth + 10; i++) {
+    spindump_seqtracker_add(&tracker,&sent,0,i * 10,10,i == spindump_seqtracker_maxdepth + 9);
+  }
+  spindump_checktest(tracker.count == spindump_seqtracker_maxdepth);
+  ackto = spindump_seqtracker_ackto(&tracker,10,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto == 0);
+  ackto = spindump_seqtracker_ackto(&tracker,(spindump_seqtracker_maxdepth + 10) * 10,0,0,0,&now,&sentSeq,&sentFin);
+  spindump_checktest(ackto != 0);
+  spindump_checktest(sentFin == 1);
+  spindump_seqtracker_uninitialize(&tracker);
+}
+
 //
 // Unit tests for the connection table
 //
@@ -398,18 +1665,591 @@ unittests_table(void) {
   spindump_checktest(connection7 == connection6);
   
   //
-  // Search for the QUIC connection via CID
+  // Search for the QUIC connection via CID
+  //
+
+  struct spindump_connection* connection8 =
+    spindump_connections_searchconnection_quic_cids_either(&cid1,
+                                                           &cid2,
+                                                           table,
+                                                           &fromResponder);
+  spindump_checktest(connection8 != 0);
+  spindump_checktest(fromResponder == 0);
+  spindump_checktest(connection8 == connection6);
+  
+  //
+  // Search for the QUIC connection via partial CIDs, in both directions
+  //
+
+  unsigned char partial[spindump_connection_quic_cid_maxlen];
+  memset(partial,0xEE,sizeof(partial));
+  memcpy(partial,cid1.id,cid1.len);
+  struct spindump_connection* connection9 =
+    spindump_connections_searchconnection_quic_partialcid_either(partial,
+                                                                 table,
+                                                                 &fromResponder);
+  spindump_checktest(connection9 == connection6);
+  spindump_checktest(fromResponder == 0);
+  memset(partial,0xEE,sizeof(partial));
+  memcpy(partial,cid2.id,cid2.len);
+  connection9 =
+    spindump_connections_searchconnection_quic_partialcid_either(partial,
+                                                                 table,
+                                                                 &fromResponder);
+  spindump_checktest(connection9 == connection6);
+  spindump_checktest(fromResponder == 1);
+  
+  //
+  // Change a CID and check that the connection is found via the new one only
+  //
+
+  struct spindump_quic_connectionid cid3 = cid1;
+  cid3.id[0] = 99;
+  connection6->u.quic.peer2ConnectionID = cid3;
+  spindump_connectionstable_reindexconnection(connection6,table);
+  spindump_checktest(spindump_connections_searchconnection_quic_destcid(&cid1,table) == 0);
+  spindump_checktest(spindump_connections_searchconnection_quic_destcid(&cid3,table) == connection6);
+  spindump_checktest(table->cidLengths[4] == 1 && table->cidLengths[8] == 1);
+  cid3.len = 6;
+  cid3.id[4] = 5;
+  cid3.id[5] = 6;
+  connection6->u.quic.peer2ConnectionID = cid3;
+  spindump_connectionstable_reindexconnection(connection6,table);
+  spindump_checktest(table->cidLengths[4] == 0 && table->cidLengths[6] == 1 && table->cidLengths[8] == 1);
+  memset(partial,0xEE,sizeof(partial));
+  memcpy(partial,cid1.id,cid1.len);
+  spindump_checktest(spindump_connections_searchconnection_quic_partialcid_either(partial,
+                                                                                  table,
+                                                                                  &fromResponder) == 0);
+  memcpy(partial,cid3.id,cid3.len);
+  connection9 =
+    spindump_connections_searchconnection_quic_partialcid_either(partial,
+                                                                 table,
+                                                                 &fromResponder);
+  spindump_checktest(connection9 == connection6);
+  spindump_checktest(fromResponder == 0);
+  spindump_checktest(spindump_connections_searchconnection_quic_partialcid(partial,table) == connection6);
+  spindump_checktest(spindump_connections_searchconnection_quic_partialcid_source(partial,table) == 0);
+
+  //
+  // Add enough TCP connections to make the indexes grow, and look
+  // each of them up in both directions
+  //
+
+  struct spindump_connection* tcpConnections[3000];
+  for (unsigned int i = 0; i < 3000; i++) {
+    tcpConnections[i] =
+      spindump_connections_newconnection_tcp(&address1,
+                                             &address2,
+                                             (spindump_port)(10000 + i),
+                                             80,
+                                             &when1,
+                                             table);
+    spindump_checktest(tcpConnections[i] != 0);
+  }
+  spindump_checktest(table->tupleIndex.nBuckets > spindump_connectionstable_index_defaultsize);
+  for (unsigned int i = 0; i < 3000; i++) {
+    spindump_checktest(spindump_connections_searchconnection_tcp(&address1,
+                                                                 &address2,
+                                                                 (spindump_port)(10000 + i),
+                                                                 80,
+                                                                 table) == tcpConnections[i]);
+    spindump_checktest(spindump_connections_searchconnection_tcp(&address2,
+                                                                 &address1,
+                                                                 80,
+                                                                 (spindump_port)(10000 + i),
+                                                                 table) == 0);
+    spindump_checktest(spindump_connections_searchconnection_tcp_either(&address2,
+                                                                        &address1,
+                                                                        80,
+                                                                        (spindump_port)(10000 + i),
+                                                                        table,
+                                                                        &fromResponder) == tcpConnections[i]);
+    spindump_checktest(fromResponder == 1);
+  }
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,
+                                                               &address2,
+                                                               10000,
+                                                               80,
+                                                               table) == 0);
+
+  spindump_connectionstable_uninitialize(table);
+
+  //
+  // Connection objects come from per-type pools, sized by the union
+  // arm of each type, and deleted objects are reused by the next
+  // connection of the same type. The cold parts are only allocated
+  // when needed.
+  //
+
+  spindump_checktest(spindump_connectionstable_pool_objectsize(spindump_connection_transport_udp) <
+                     spindump_connectionstable_pool_objectsize(spindump_connection_transport_quic));
+  spindump_checktest(spindump_connectionstable_pool_objectsize(spindump_connection_transport_quic) <=
+                     sizeof(struct spindump_connection));
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  table = analyzer->table;
+  struct spindump_connectionstable_pool_class* udpClass =
+    &table->pool.classes[spindump_connection_transport_udp];
+  struct spindump_connectionstable_pool_class* dnsClass =
+    &table->pool.classes[spindump_connection_transport_dns];
+  spindump_checktest(udpClass->nSlabs == 0);
+  struct spindump_connection* udpConnection =
+    spindump_connections_newconnection_udp(&address1,&address2,5000,5001,&when1,table);
+  struct spindump_connection* dnsConnection =
+    spindump_connections_newconnection_dns(&address1,&address2,5000,53,&when1,table);
+  spindump_checktest(udpConnection != 0 && dnsConnection != 0);
+  spindump_checktest(udpConnection->cold == 0);
+  spindump_checktest(dnsConnection->cold != 0);
+  spindump_checktest(table->pool.coldClasses[spindump_connection_transport_dns].nInUse == 1);
+  spindump_checktest(spindump_connections_peekcold(udpConnection)->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(udpConnection->cold == 0);
+  struct spindump_connection_cold* udpCold = spindump_connections_getcold(udpConnection,table);
+  spindump_checktest(udpCold != 0 && udpConnection->cold == udpCold);
+  spindump_checktest(udpCold->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(table->pool.coldClasses[spindump_connection_transport_udp].nInUse == 1);
+  spindump_checktest(udpClass->nSlabs == 1);
+  spindump_checktest(udpClass->nInUse == 1);
+  spindump_checktest(udpClass->nFree == spindump_connectionstable_pool_slabobjects - 1);
+  spindump_checktest(dnsClass->nInUse == 1);
+  spindump_connectionstable_deleteconnection(udpConnection,table,analyzer,"unit test",0);
+  spindump_checktest(udpClass->nInUse == 0);
+  spindump_checktest(udpClass->nFree == spindump_connectionstable_pool_slabobjects);
+  spindump_checktest(dnsClass->nInUse == 1);
+  spindump_checktest(table->pool.coldClasses[spindump_connection_transport_udp].nInUse == 0);
+  struct spindump_connection* udpConnection2 =
+    spindump_connections_newconnection_udp(&address1,&address2,5002,5003,&when1,table);
+  spindump_checktest(udpConnection2 == udpConnection);
+  spindump_checktest(udpConnection2->type == spindump_connection_transport_udp);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,5000,5001,table) == 0);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,5002,5003,table) == udpConnection2);
+  for (unsigned int i = 0; i < spindump_connectionstable_pool_slabobjects; i++) {
+    spindump_checktest(spindump_connections_newconnection_udp(&address1,
+                                                              &address2,
+                                                              (spindump_port)(6000 + i),
+                                                              5001,
+                                                              &when1,
+                                                              table) != 0);
+  }
+  spindump_checktest(udpClass->nSlabs == 2);
+  spindump_checktest(udpClass->nInUse == spindump_connectionstable_pool_slabobjects + 1);
+  spindump_analyze_uninitialize(analyzer);
+
+  //
+  // Connections time out through the timer wheel: closed connections
+  // after the deleted timeout, connection attempts after the
+  // establishing timeout, and others after the inactivity timeout,
+  // counted from their latest packet
+  //
+
+  analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  table = analyzer->table;
+  struct timeval start;
+  start.tv_sec = 100000;
+  start.tv_usec = 500 * 1000;
+  struct spindump_connection* attempt =
+    spindump_connections_newconnection_tcp(&address1,&address2,7000,80,&start,table);
+  struct spindump_connection* inactive =
+    spindump_connections_newconnection_udp(&address1,&address2,7001,5001,&start,table);
+  struct spindump_connection* closed =
+    spindump_connections_newconnection_udp(&address1,&address2,7002,5001,&start,table);
+  spindump_checktest(attempt != 0 && inactive != 0 && closed != 0);
+  inactive->state = spindump_connection_state_established;
+  closed->state = spindump_connection_state_established;
+  spindump_connections_markconnectiondeleted(closed,table);
+  spindump_checktest(table->timers.nTimers == 3);
+  struct timeval now;
+  now.tv_usec = 0;
+  now.tv_sec = start.tv_sec + 10;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,7002,5001,table) == closed);
+  now.tv_sec = start.tv_sec + 11;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,7002,5001,table) == 0);
+  now.tv_sec = start.tv_sec + 30;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_tcp(&address1,&address2,7000,80,table) == attempt);
+  now.tv_sec = start.tv_sec + 31;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_tcp(&address1,&address2,7000,80,table) == 0);
+  inactive->latestPacketFromSide2.tv_sec = start.tv_sec + 100;
+  inactive->latestPacketFromSide2.tv_usec = 0;
+  now.tv_sec = start.tv_sec + 200;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,7001,5001,table) == inactive);
+  spindump_checktest(table->timers.nTimers == 1);
+  now.tv_sec = start.tv_sec + 280;
+  spindump_connectionstable_periodiccheck(table,&now,analyzer,0);
+  spindump_checktest(spindump_connections_searchconnection_udp(&address1,&address2,7001,5001,table) == 0);
+  spindump_checktest(table->timers.nTimers == 0);
+  spindump_checktest(table->nConnections == 0);
+  spindump_analyze_uninitialize(analyzer);
+
+  //
+  // The timer wheel itself, with times in all levels and beyond its
+  // reach
+  //
+
+  struct spindump_connectionstable_timers timers;
+  struct spindump_connection timed[4];
+  unsigned long long expiries[4] = { 5, 70, 5000, 20000000 };
+  spindump_connectionstable_timers_initialize(&timers);
+  memset(timed,0,sizeof(timed));
+  for (unsigned int i = 0; i < 4; i++) {
+    timed[i].tableIndex = i;
+    spindump_connectionstable_timers_schedule(&timers,&timed[i],expiries[i]);
+  }
+  spindump_checktest(timers.nTimers == 4);
+  unsigned long long previous = 0;
+  for (unsigned int i = 0; i < 4; i++) {
+    spindump_checktest(spindump_connectionstable_timers_advance(&timers,expiries[i] - 1) == 0);
+    spindump_checktest(timers.now == expiries[i] - 1);
+    spindump_checktest(spindump_connectionstable_timers_advance(&timers,expiries[i]) == 1);
+    spindump_checktest(timers.due[0] == &timed[i]);
+    spindump_checktest(timed[i].timerPrev == 0);
+    previous = expiries[i];
+  }
+  spindump_checktest(timers.nTimers == 0);
+  spindump_connectionstable_timers_schedule(&timers,&timed[0],previous + 3);
+  spindump_connectionstable_timers_schedule(&timers,&timed[1],previous + 3);
+  spindump_connectionstable_timers_cancel(&timers,&timed[0]);
+  spindump_checktest(spindump_connectionstable_timers_advance(&timers,previous + 1000) == 1);
+  spindump_checktest(timers.due[0] == &timed[1]);
+  spindump_connectionstable_timers_uninitialize(&timers);
+
+  //
+  // Connection sets: a membership is in both sets, and removing it
+  // from either one removes it from the other as well
+  //
+
+  struct spindump_connection members[3];
+  memset(members,0,sizeof(members));
+  struct spindump_connection* setaggregate = &members[0];
+  setaggregate->type = spindump_connection_aggregate_hostnetwork;
+  struct spindump_connection_set* memberset = &setaggregate->u.aggregatehostnetwork.connections;
+  spindump_connections_set_initialize(memberset);
+  for (unsigned int i = 0; i < 3; i++) {
+    members[i].id = i;
+    spindump_connections_set_initialize(&members[i].aggregates);
+  }
+  spindump_connections_set_add(memberset,&members[1],&members[1].aggregates,setaggregate);
+  spindump_connections_set_add(memberset,&members[2],&members[2].aggregates,setaggregate);
+  spindump_checktest(memberset->nConnections == 2);
+  spindump_checktest(strcmp(spindump_connections_set_listids(memberset),"1,2") == 0);
+  spindump_checktest(spindump_connections_set_inset(memberset,&members[2]));
+  spindump_checktest(spindump_connections_set_inset(&members[1].aggregates,setaggregate));
+  spindump_connections_set_uninitialize(&members[1].aggregates,&members[1]);
+  spindump_checktest(memberset->nConnections == 1);
+  spindump_checktest(!spindump_connections_set_inset(memberset,&members[1]));
+  struct spindump_connection_set_iterator setiter;
+  unsigned int nIterated = 0;
+  for (spindump_connection_set_iterator_initialize(memberset,&setiter);
+       !spindump_connection_set_iterator_end(&setiter);
+       nIterated++) {
+    spindump_checktest(spindump_connection_set_iterator_next(&setiter) == &members[2]);
+  }
+  spindump_connection_set_iterator_uninitialize(&setiter);
+  spindump_checktest(nIterated == 1);
+  spindump_connections_set_uninitialize(memberset,setaggregate);
+  spindump_checktest(members[2].aggregates.nConnections == 0);
+  spindump_checktest(members[2].aggregates.first == 0 && members[2].aggregates.last == 0);
+  spindump_connections_set_uninitialize(&members[2].aggregates,&members[2]);
+
+  //
+  // Positions in the table: new connections take the lowest free
+  // position, deleting connections from the end shrinks the table,
+  // and handles stop resolving when their connection is deleted
+  //
+
+  analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  table = analyzer->table;
+#define unittests_table_npositions 3000
+  struct spindump_connection* positioned[unittests_table_npositions];
+  for (unsigned int i = 0; i < unittests_table_npositions; i++) {
+    positioned[i] =
+      spindump_connections_newconnection_udp(&address1,&address2,(spindump_port)(10000 + i),53,&start,table);
+    spindump_checktest(positioned[i] != 0);
+    spindump_checktest(positioned[i]->tableIndex == i);
+  }
+  spindump_checktest(table->nConnections == unittests_table_npositions);
+  spindump_checktest(table->maxNConnections >= unittests_table_npositions);
+  struct spindump_connectionstable_handle handle1 = spindump_connectionstable_gethandle(positioned[1000]);
+  struct spindump_connectionstable_handle handle2 = spindump_connectionstable_gethandle(positioned[2000]);
+  struct spindump_connectionstable_handle nohandle;
+  memset(&nohandle,0,sizeof(nohandle));
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,handle1) == positioned[1000]);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,handle2) == positioned[2000]);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,nohandle) == 0);
+  spindump_connectionstable_deleteconnection(positioned[2000],table,analyzer,"unit test",0);
+  spindump_connectionstable_deleteconnection(positioned[1000],table,analyzer,"unit test",0);
+  spindump_connectionstable_deleteconnection(positioned[5],table,analyzer,"unit test",0);
+  spindump_checktest(table->slots.nFree == 3);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,handle1) == 0);
+  struct spindump_connection* reused =
+    spindump_connections_newconnection_udp(&address1,&address2,9000,53,&start,table);
+  spindump_checktest(reused != 0 && reused->tableIndex == 5);
+  reused = spindump_connections_newconnection_udp(&address1,&address2,9001,53,&start,table);
+  spindump_checktest(reused != 0 && reused->tableIndex == 1000);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,handle1) == 0);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,spindump_connectionstable_gethandle(reused)) == reused);
+  spindump_checktest(positioned[1999]->tableIndex == 1999);
+  for (unsigned int i = 2001; i < unittests_table_npositions; i++) {
+    spindump_connectionstable_deleteconnection(positioned[i],table,analyzer,"unit test",0);
+  }
+  spindump_checktest(table->nConnections == 2000);
+  spindump_checktest(table->slots.nFree == 0);
+  spindump_checktest(spindump_connectionstable_resolvehandle(table,handle2) == 0);
+  reused = spindump_connections_newconnection_udp(&address1,&address2,9002,53,&start,table);
+  spindump_checktest(reused != 0 && reused->tableIndex == 2000);
+  spindump_analyze_uninitialize(analyzer);
+
+  //
+  // Aggregates are found through the prefix tries: simple aggregates
+  // in table order, and multinet aggregates by the longest network
+  //
+
+  table = spindump_connectionstable_initialize(1000000,0,0);
+  spindump_checktest(table != 0);
+  spindump_address host1;
+  spindump_address host2;
+  spindump_address host3;
+  spindump_address host4;
+  spindump_address host6a;
+  spindump_address host6b;
+  spindump_address identifier;
+  spindump_network network1;
+  spindump_network network2;
+  spindump_network network3;
+  spindump_network network4;
+  spindump_network network5;
+  spindump_address_fromstring(&host1,"10.1.1.1");
+  spindump_address_fromstring(&host2,"192.168.1.5");
+  spindump_address_fromstring(&host3,"172.16.5.9");
+  spindump_address_fromstring(&host4,"172.17.0.1");
+  spindump_address_fromstring(&host6a,"2001:db8::1");
+  spindump_address_fromstring(&host6b,"2001:db8::2");
+  spindump_address_fromstring(&identifier,"0.0.0.1");
+  spindump_network_fromstring(&network1,"10.0.0.0/8");
+  spindump_network_fromstring(&network2,"192.168.0.0/16");
+  spindump_network_fromstring(&network3,"192.168.1.0/24");
+  spindump_network_fromstring(&network4,"172.16.5.0/24");
+  spindump_network_fromstring(&network5,"172.16.0.0/12");
+  struct spindump_connection* networknetwork =
+    spindump_connections_newconnection_aggregate_networknetwork(0,&network1,&network2,&when1,1,table);
+  struct spindump_connection* hostnetwork =
+    spindump_connections_newconnection_aggregate_hostnetwork(&host1,&network3,&when1,1,table);
+  struct spindump_connection* hostpair =
+    spindump_connections_newconnection_aggregate_hostpair(&host6a,&host6b,&when1,1,table);
+  struct spindump_connection* multinet1 =
+    spindump_connections_newconnection_aggregate_hostmultinet(&host1,&identifier,&when1,1,table);
+  struct spindump_connection* multinet2 =
+    spindump_connections_newconnection_aggregate_hostmultinet(&host1,&identifier,&when1,1,table);
+  spindump_checktest(networknetwork != 0 && hostnetwork != 0 && hostpair != 0);
+  spindump_checktest(multinet1 != 0 && multinet2 != 0);
+  spindump_connections_newconnection_aggregate_addnetwork(multinet1,&network4,table);
+  spindump_connections_newconnection_aggregate_addnetwork(multinet2,&network5,table);
+  spindump_checktest(table->prefixes.nEntries == 5);
+  spindump_compactaddress compact1;
+  spindump_compactaddress compact2;
+  spindump_compactaddress compact3;
+  spindump_compactaddress compact4;
+  spindump_compactaddress compact6a;
+  spindump_compactaddress compact6b;
+  spindump_compactaddress_fromaddress(&host1,&compact1);
+  spindump_compactaddress_fromaddress(&host2,&compact2);
+  spindump_compactaddress_fromaddress(&host3,&compact3);
+  spindump_compactaddress_fromaddress(&host4,&compact4);
+  spindump_compactaddress_fromaddress(&host6a,&compact6a);
+  spindump_compactaddress_fromaddress(&host6b,&compact6b);
+  spindump_checktest(spindump_connectionstable_prefixes_candidates(&table->prefixes,&compact2,&compact1) == 2);
+  spindump_checktest(table->prefixes.candidates[0] == networknetwork);
+  spindump_checktest(table->prefixes.candidates[1] == hostnetwork);
+  spindump_checktest(spindump_connectionstable_prefixes_candidates(&table->prefixes,&compact6b,&compact6a) == 1);
+  spindump_checktest(table->prefixes.candidates[0] == hostpair);
+  spindump_checktest(spindump_connectionstable_prefixes_candidates(&table->prefixes,&compact6b,&compact6b) == 0);
+  spindump_checktest(spindump_connections_match_multinet(&compact1,&compact3,table) == multinet1);
+  spindump_checktest(spindump_connections_match_multinet(&compact3,&compact1,table) == multinet1);
+  spindump_checktest(spindump_connections_match_multinet(&compact1,&compact4,table) == multinet2);
+  spindump_checktest(spindump_connections_match_multinet(&compact2,&compact3,table) == 0);
+  struct spindump_connection* member =
+    spindump_connections_newconnection_udp(&host2,&host1,5000,53,&when1,table);
+  spindump_checktest(member != 0);
+  spindump_checktest(member->aggregates.nConnections == 2);
+  spindump_checktest(member->aggregates.first->connection == networknetwork);
+  spindump_checktest(member->aggregates.last->connection == hostnetwork);
+  spindump_connectionstable_unindexconnection(hostnetwork,table);
+  spindump_connectionstable_unindexconnection(multinet1,table);
+  spindump_checktest(table->prefixes.nEntries == 3);
+  spindump_checktest(spindump_connectionstable_prefixes_candidates(&table->prefixes,&compact2,&compact1) == 1);
+  spindump_checktest(spindump_connections_match_multinet(&compact1,&compact3,table) == multinet2);
+  spindump_connectionstable_uninitialize(table);
+
+  //
+  // Deferred aggregate updates are counted in the member until an
+  // aggregate bandwidth period would end, and RTT events of the
+  // aggregates are held until the fold
+  //
+
+  analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_checktest(analyzer != 0);
+  table = analyzer->table;
+  table->rollup.deferred = 1;
+  struct spindump_connection* aggregate =
+    spindump_connections_newconnection_aggregate_networknetwork(0,&network1,&network2,&when1,1,table);
+  member = spindump_connections_newconnection_udp(&host2,&host1,5000,53,&when1,table);
+  spindump_checktest(aggregate != 0 && member != 0);
+  spindump_checktest(member->aggregates.nConnections == 1);
+  struct timeval rollupTime = when1;
+  spindump_checktest(!spindump_connectionstable_rollup_defer(table,member,&rollupTime,0,100,0));
+  aggregate->packetsFromSide1++;
+  aggregate->packetsFromSide2++;
+  spindump_bandwidth_newpacket(&aggregate->bytesFromSide1,100,&rollupTime);
+  spindump_bandwidth_newpacket(&aggregate->bytesFromSide2,100,&rollupTime);
+  rollupTime.tv_usec += 10 * 1000;
+  spindump_checktest(spindump_connectionstable_rollup_defer(table,member,&rollupTime,0,200,1));
+  spindump_checktest(spindump_connectionstable_rollup_defer(table,member,&rollupTime,1,300,0));
+  spindump_checktest(!spindump_connectionstable_rollup_defer(table,member,&rollupTime,0,200,3));
+  spindump_checktest(table->rollup.nPending == 1 && table->rollup.first == member);
+  spindump_checktest(aggregate->packetsFromSide1 == 1);
+  rollupTime.tv_sec++;
+  spindump_checktest(!spindump_connectionstable_rollup_defer(table,member,&rollupTime,0,200,0));
+  spindump_connectionstable_rollup_fold(table,analyzer);
+  spindump_checktest(table->rollup.nPending == 0 && table->rollup.first == 0);
+  spindump_checktest(aggregate->packetsFromSide1 == 2 && aggregate->packetsFromSide2 == 2);
+  spindump_checktest(aggregate->bytesFromSide1.bytesInThisPeriod == 300);
+  spindump_checktest(aggregate->bytesFromSide2.bytesInThisPeriod == 400);
+  spindump_checktest(aggregate->bytesFromSide1.periods == 0);
+  spindump_checktest(aggregate->ect0FromInitiator == 1);
+  unsigned int rttCounts[2] = { 0, 0 };
+  spindump_analyze_registerhandler(analyzer,spindump_analyze_event_newrightrttmeasurement,0,
+                                   unittests_handlers_count,rttCounts);
+  spindump_counter_32bit handlerCalls = analyzer->stats->analyzerHandlerCalls;
+  spindump_checktest(!spindump_connectionstable_rollup_deferevent(table,member,
+                                                                  spindump_analyze_event_newrightrttmeasurement,
+                                                                  &rollupTime,100));
+  spindump_checktest(spindump_connectionstable_rollup_deferevent(table,aggregate,
+                                                                 spindump_analyze_event_newrightrttmeasurement,
+                                                                 &rollupTime,100));
+  spindump_checktest(spindump_connectionstable_rollup_deferevent(table,aggregate,
+                                                                 spindump_analyze_event_newrightrttmeasurement,
+                                                                 &rollupTime,100));
+  spindump_checktest(analyzer->stats->analyzerHandlerCalls == handlerCalls);
+  spindump_connectionstable_rollup_fold(table,analyzer);
+  spindump_checktest(analyzer->stats->analyzerHandlerCalls == handlerCalls + 1);
+
+  //
+  // A periodic report empties the right RTT histogram of the period,
+  // but not the cumulative one
+  //
+
+  struct spindump_packet rttPacket;
+  memset(&rttPacket,0,sizeof(rttPacket));
+  rttPacket.timestamp = rollupTime;
+  struct timeval rttSent = rollupTime;
+  rttSent.tv_usec -= 5 * 1000;
+  spindump_connections_newrttmeasurement(analyzer,&rttPacket,member,100,1,0,&rttSent,&rollupTime,"test");
+  struct spindump_connection_cold* rttCold = spindump_connections_peekcold(member);
+  spindump_checktest(rttCold != 0);
+  spindump_checktest(rttCold->rightRTT.histogram.count == 1 && rttCold->rightRTTPeriod.count == 1);
+  spindump_connection_periodicreport(member,table,&rollupTime,analyzer);
+  spindump_checktest(rttCold->rightRTT.histogram.count == 1 && rttCold->rightRTTPeriod.count == 0);
+  spindump_analyze_uninitialize(analyzer);
+
+  //
+  // The negative cache counts the packets of untracked flows in
+  // either direction, forgets flows that are not seen for two
+  // periods, and drops a flow when a connection is created for it
+  //
+
+  table = spindump_connectionstable_initialize(1000000,0,0);
+  spindump_checktest(table != 0);
+  struct spindump_connectionstable_negative* negative = &table->negative;
+  uint64_t negativeKey =
+    spindump_connectionstable_negative_addresskey(spindump_connection_transport_tcp,&address1,1000,&address2,80);
+  spindump_checktest(negativeKey ==
+                     spindump_connectionstable_negative_addresskey(spindump_connection_transport_tcp,
+                                                                   &address2,80,&address1,1000));
+  spindump_checktest(negativeKey !=
+                     spindump_connectionstable_negative_addresskey(spindump_connection_transport_sctp,
+                                                                   &address1,1000,&address2,80));
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 0);
+  spindump_checktest(negative->generations[0].buckets == 0 && negative->generations[1].buckets == 0);
+  spindump_connectionstable_negative_insert(negative,negativeKey);
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 2);
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 3);
+  spindump_connectionstable_negative_advance(negative,100);
+  spindump_connectionstable_negative_advance(negative,100 + spindump_connectionstable_negative_period);
+  spindump_checktest(negative->generations[negative->current].nEntries == 0);
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 4);
+  spindump_checktest(negative->generations[negative->current].nEntries == 1);
+  spindump_connectionstable_negative_advance(negative,100 + 2 * spindump_connectionstable_negative_period);
+  spindump_connectionstable_negative_advance(negative,100 + 3 * spindump_connectionstable_negative_period);
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 0);
+  spindump_connectionstable_negative_insert(negative,negativeKey);
+  struct spindump_connection* tcpConnection =
+    spindump_connections_newconnection_tcp(&address2,&address1,80,1000,&when1,table);
+  spindump_checktest(tcpConnection != 0);
+  spindump_checktest(negative->generations[0].nEntries == 0 && negative->generations[1].nEntries == 0);
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,negativeKey) == 0);
+  unsigned int negativeCapacity = spindump_connectionstable_negative_buckets * spindump_connectionstable_negative_slots;
+  for (uint64_t i = 0; i < 2 * negativeCapacity; i++) {
+    spindump_connectionstable_negative_insert(negative,i * 0x9e3779b97f4a7c15ULL);
+    spindump_checktest(negative->generations[negative->current].nEntries <= negativeCapacity);
+  }
+  spindump_checktest(spindump_connectionstable_negative_lookup(negative,(2 * negativeCapacity - 1) * 0x9e3779b97f4a7c15ULL) == 2);
+
+  //
+  // Half-open connections merge retransmitted SYNs, are found from
+  // either direction only when asked, evict the oldest entry when
+  // full, and expire after the establishing timeout
   //
 
-  struct spindump_connection* connection8 =
-    spindump_connections_searchconnection_quic_cids_either(&cid1,
-                                                           &cid2,
-                                                           table,
-                                                           &fromResponder);
-  spindump_checktest(connection8 != 0);
-  spindump_checktest(fromResponder == 0);
-  spindump_checktest(connection8 == connection6);
-  
+  struct spindump_connectionstable_halfopen* halfOpen = &table->halfOpen;
+  struct spindump_connectionstable_halfopenentry halfOpenEntry;
+  spindump_compactaddress halfOpenAddress1;
+  spindump_compactaddress halfOpenAddress2;
+  spindump_compactaddress_fromaddress(&address1,&halfOpenAddress1);
+  spindump_compactaddress_fromaddress(&address2,&halfOpenAddress2);
+  unsigned int nEvicted = 0;
+  int halfOpenReversed = 0;
+  struct timeval synTime = when1;
+  halfOpen->maxEntries = 3;
+  spindump_checktest(halfOpen->entries == 0);
+  spindump_checktest(spindump_connectionstable_halfopen_add(halfOpen,&halfOpenAddress1,1000,&halfOpenAddress2,80,&synTime,
+                                                            111,5,60,0,&nEvicted));
+  synTime.tv_sec++;
+  spindump_checktest(spindump_connectionstable_halfopen_add(halfOpen,&halfOpenAddress1,1000,&halfOpenAddress2,80,&synTime,
+                                                            222,6,60,0,&nEvicted));
+  spindump_checktest(halfOpen->nEntries == 1 && halfOpen->nPositions == 1 && nEvicted == 0);
+  spindump_checktest(!spindump_connectionstable_halfopen_take(halfOpen,&halfOpenAddress2,80,&halfOpenAddress1,1000,0,
+                                                              &halfOpenEntry,&halfOpenReversed));
+  spindump_checktest(spindump_connectionstable_halfopen_take(halfOpen,&halfOpenAddress2,80,&halfOpenAddress1,1000,1,
+                                                             &halfOpenEntry,&halfOpenReversed));
+  spindump_checktest(halfOpenReversed == 1 && halfOpenEntry.nSyns == 2);
+  spindump_checktest(halfOpenEntry.isn == 222 && halfOpenEntry.tsVal == 6);
+  spindump_checktest(halfOpenEntry.firstSyn.tv_sec == when1.tv_sec);
+  spindump_checktest(halfOpenEntry.latestSyn.tv_sec == when1.tv_sec + 1);
+  spindump_checktest(halfOpen->nEntries == 0 && halfOpen->nPositions == 1);
+  for (spindump_port port = 1; port <= 3; port++) {
+    spindump_checktest(spindump_connectionstable_halfopen_add(halfOpen,&halfOpenAddress1,port,&halfOpenAddress2,80,&synTime,
+                                                              port,0,60,0,&nEvicted));
+    spindump_checktest(nEvicted == 0);
+  }
+  spindump_checktest(spindump_connectionstable_halfopen_add(halfOpen,&halfOpenAddress1,4,&halfOpenAddress2,80,&synTime,
+                                                            4,0,60,0,&nEvicted));
+  spindump_checktest(nEvicted == 1 && halfOpen->nEntries == 3 && halfOpen->nPositions == 3);
+  spindump_checktest(!spindump_connectionstable_halfopen_take(halfOpen,&halfOpenAddress1,1,&halfOpenAddress2,80,0,
+                                                              &halfOpenEntry,&halfOpenReversed));
+  spindump_checktest(spindump_connectionstable_halfopen_take(halfOpen,&halfOpenAddress1,2,&halfOpenAddress2,80,0,
+                                                             &halfOpenEntry,&halfOpenReversed));
+  spindump_checktest(halfOpenReversed == 0 && halfOpenEntry.isn == 2);
+  synTime.tv_sec += spindump_connection_establishing_timeout / (1000 * 1000) - 1;
+  spindump_checktest(spindump_connectionstable_halfopen_expire(halfOpen,&synTime) == 0);
+  synTime.tv_sec++;
+  spindump_checktest(spindump_connectionstable_halfopen_expire(halfOpen,&synTime) == 2);
+  spindump_checktest(halfOpen->nEntries == 0 && halfOpen->nPositions == 0);
   spindump_connectionstable_uninitialize(table);
 }
 
@@ -565,6 +2405,850 @@ unittests_eventjsonparser(void) {
   spindump_assert(json->type == spindump_json_value_type_record);
   ret = spindump_event_parser_json_parse(json,&event2);
   spindump_assert(ret == 1);
+
+  //
+  // Periodic events carry RTT histograms, and they survive a
+  // round trip through JSON
+  //
+
+  struct spindump_event event3;
+  struct spindump_event event4;
+  spindump_event_initialize(spindump_event_type_periodic,
+                            spindump_connection_transport_tcp,
+                            spindump_connection_state_established,
+                            &network1,
+                            &network2,
+                            "123:456",
+                            timestamp,
+                            10,
+                            10,
+                            2000,
+                            3000,
+                            1000,
+                            1000,
+                            0,
+                            0,
+                            &event3);
+  event3.u.periodic.rttRight = 20000;
+  event3.u.periodic.avgRttRight = 0;
+  event3.u.periodic.devRttRight = 0;
+  spindump_histogram_initialize(&event3.u.periodic.histRight);
+  for (unsigned long value = 1; value <= 100; value++) {
+    spindump_histogram_record(&event3.u.periodic.histRight,value * value * 10);
+  }
+  char longbuf[2048];
+  ret = spindump_event_parser_json_print(&event3,longbuf,sizeof(longbuf),&consumed);
+  spindump_checktest(ret == 1);
+  spindump_checktest(strstr(longbuf,"\"P50_right_rtt\": ") != 0);
+  spindump_checktest(strstr(longbuf,"\"Hist_right_rtt\": [") != 0);
+  input = &longbuf[0];
+  ret = spindump_json_parse(spindump_event_parser_json_getschema(),0,&input);
+  spindump_checktest(ret == 1);
+  input = &longbuf[0];
+  ret = spindump_json_parse(&eventschema,0,&input);
+  spindump_assert(ret == 1);
+  json = parsedRecord;
+  spindump_assert(json != 0);
+  memset(&event4,0,sizeof(event4));
+  ret = spindump_event_parser_json_parse(json,&event4);
+  spindump_checktest(ret == 1);
+  spindump_checktest(spindump_histogram_equal(&event3.u.periodic.histRight,&event4.u.periodic.histRight));
+  spindump_checktest(spindump_event_equal(&event3,&event4));
+
+  //
+  // Malformed histograms are rejected
+  //
+
+  const char* jsonInput2 =
+    "{ \"Event\": \"periodic\", \"Type\": \"TCP\", \"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], "
+    "\"Session\": \"123:456\", \"Ts\": 1892188800001234, \"State\": \"Up\", \"Right_rtt\": 20000, "
+    "\"Hist_right_rtt\": [150,1], "
+    "\"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3 }";
+  ret = spindump_json_parse(&eventschema,0,&jsonInput2);
+  spindump_assert(ret == 1);
+  json = parsedRecord;
+  spindump_assert(json != 0);
+  ret = spindump_event_parser_json_parse(json,&event4);
+  spindump_checktest(ret == 0);
+}
+
+//
+// Helper data structure and function for
+// unittests_eventjsonstreamparser; collect the parsed events.
+//
+
+#define unittests_eventjsonstreamparser_maxevents 20
+
+struct unittests_eventjsonstreamparser_events {
+  unsigned int n;
+  struct spindump_event events[unittests_eventjsonstreamparser_maxevents];
+};
+
+static void
+unittests_eventjsonstreamparser_callback(const struct spindump_event* event,
+                                         void* data) {
+  spindump_assert(event != 0);
+  spindump_assert(data != 0);
+  struct unittests_eventjsonstreamparser_events* collected = (struct unittests_eventjsonstreamparser_events*)data;
+  if (collected->n < unittests_eventjsonstreamparser_maxevents) {
+    collected->events[collected->n] = *event;
+  }
+  collected->n++;
+}
+
+//
+// Unittests -- spindump_event_parser_json_streamparse
+//
+
+static void
+unittests_eventjsonstreamparser(void) {
+  printf("unit tests: event json stream parser...\n");
+  unsigned long long timestamp = 1892188800001234ULL;
+  spindump_network network1;
+  spindump_network network2;
+  spindump_network_fromstring(&network1,"1.2.3.4/32");
+  spindump_network_fromstring(&network2,"2001:db8:1::/48");
+  spindump_tags tags;
+  spindump_tags_initialize(&tags);
+  spindump_tags_addtag(&tags,"site=a");
+
+  //
+  // Print events of all types into one array
+  //
+
+  static char text[20000];
+  struct spindump_event original[unittests_eventjsonstreamparser_maxevents];
+  unsigned int nOriginal = 0;
+  size_t textLength = 0;
+  size_t consumed;
+  int ret;
+  text[textLength++] = '[';
+  for (unsigned int type = spindump_event_type_new_connection; type <= spindump_event_type_packet; type++) {
+    if (type == spindump_event_type_qrloss_measurement) continue; // reference losses are not in JSON
+    struct spindump_event* event = &original[nOriginal++];
+    spindump_event_initialize((enum spindump_event_type)type,
+                              spindump_connection_transport_quic,
+                              spindump_connection_state_established,
+                              &network1,
+                              &network2,
+                              "0102030405060708-a1b2c3d4 (49576:4433)",
+                              timestamp + type,
+                              type,
+                              1000000,
+                              128,
+                              0xffffffffULL,
+                              1000,
+                              0,
+                              type % 2 ? &tags : 0,
+                              type % 2 ? 0 : "some \"quoted} notes\\",
+                              event);
+    switch (event->eventType) {
+    case spindump_event_type_new_rtt_measurement:
+      event->u.newRttMeasurement.measurement = spindump_measurement_type_unidirectional;
+      event->u.newRttMeasurement.direction = spindump_direction_fromresponder;
+      event->u.newRttMeasurement.rtt = 12345;
+      event->u.newRttMeasurement.avgRtt = 12000;
+      event->u.newRttMeasurement.devRtt = 300;
+      event->u.newRttMeasurement.filtAvgRtt = 11900;
+      event->u.newRttMeasurement.minRtt = 10000;
+      event->u.newRttMeasurement.smoothedRtt = 12100;
+      event->u.newRttMeasurement.varRtt = 250;
+      break;
+    case spindump_event_type_periodic:
+      event->u.periodic.rttRight = 20000;
+      event->u.periodic.avgRttRight = 21000;
+      event->u.periodic.devRttRight = 500;
+      spindump_histogram_initialize(&event->u.periodic.histRight);
+      for (unsigned long value = 1; value <= 100; value++) {
+        spindump_histogram_record(&event->u.periodic.histRight,value * value * 10);
+      }
+      break;
+    case spindump_event_type_spin_flip:
+      event->u.spinFlip.direction = spindump_direction_fromresponder;
+      event->u.spinFlip.spin0to1 = 1;
+      break;
+    case spindump_event_type_spin_value:
+      event->u.spinValue.direction = spindump_direction_frominitiator;
+      event->u.spinValue.value = 1;
+      break;
+    case spindump_event_type_ecn_congestion_event:
+      event->u.ecnCongestionEvent.direction = spindump_direction_fromresponder;
+      event->u.ecnCongestionEvent.ecn0 = 100;
+      event->u.ecnCongestionEvent.ecn1 = 0;
+      event->u.ecnCongestionEvent.ce = 3;
+      break;
+    case spindump_event_type_rtloss_measurement:
+      event->u.rtlossMeasurement.direction = spindump_direction_frominitiator;
+      strcpy(event->u.rtlossMeasurement.avgLoss,"1.25%");
+      strcpy(event->u.rtlossMeasurement.totLoss,"0%");
+      break;
+    case spindump_event_type_qlloss_measurement:
+      event->u.qllossMeasurement.direction = spindump_direction_frominitiator;
+      strcpy(event->u.qllossMeasurement.qLoss,"0.5%");
+      strcpy(event->u.qllossMeasurement.lLoss,"1%");
+      break;
+    case spindump_event_type_packet:
+      event->u.packet.direction = spindump_direction_fromresponder;
+      event->u.packet.length = 1500;
+      break;
+    default:
+      break;
+    }
+    if (textLength > 1) text[textLength++] = ',';
+    ret = spindump_event_parser_json_print(event,&text[textLength],sizeof(text) - textLength - 2,&consumed);
+    spindump_checktest(ret == 1);
+    textLength += strlen(&text[textLength]);
+  }
+  text[textLength++] = ']';
+  text[textLength] = 0;
+
+  //
+  // Parse it with both parsers, and see that the same events come
+  // out, and that they print the same as the originals
+  //
+
+  struct unittests_eventjsonstreamparser_events streamed;
+  struct unittests_eventjsonstreamparser_events parsed;
+  const char* input = &text[0];
+  streamed.n = 0;
+  ret = spindump_event_parser_json_streamparse(&input,unittests_eventjsonstreamparser_callback,&streamed);
+  spindump_checktest(ret == 1);
+  spindump_checktest(*input == 0);
+  spindump_checktest(streamed.n == nOriginal);
+  input = &text[0];
+  parsed.n = 0;
+  ret = spindump_event_parser_json_textparse(&input,unittests_eventjsonstreamparser_callback,&parsed);
+  spindump_checktest(ret == 1);
+  spindump_checktest(parsed.n == nOriginal);
+  for (unsigned int i = 0; i < nOriginal && i < streamed.n && i < parsed.n; i++) {
+    char json1[2048];
+    char json2[2048];
+    spindump_checktest(spindump_event_equal(&streamed.events[i],&parsed.events[i]));
+    spindump_checktest(strcmp(streamed.events[i].notes,original[i].notes) == 0);
+    spindump_checktest(strcmp(parsed.events[i].notes,original[i].notes) == 0);
+    spindump_event_parser_json_print(&original[i],json1,sizeof(json1),&consumed);
+    spindump_event_parser_json_print(&streamed.events[i],json2,sizeof(json2),&consumed);
+    spindump_checktest(strcmp(json1,json2) == 0);
+  }
+  spindump_checktest(spindump_event_equal(&streamed.events[4],&original[4]));
+  
+  //
+  // A single record is also accepted, as are fields that are not in
+  // the schema, in any order
+  //
+
+  const char* jsonInput1 =
+    "{ \"Extra\": { \"a\": [1, \"b\", {}] }, \"Ts\": 1892188800001234, \"Type\": \"QUIC\", \"Event\": \"new\", "
+    "\"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], \"Session\": \"aabb\", \"State\": \"Starting\", "
+    "\"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3, \"Bandwidth\": 2 } [";
+  input = jsonInput1;
+  streamed.n = 0;
+  ret = spindump_event_parser_json_streamparse(&input,unittests_eventjsonstreamparser_callback,&streamed);
+  spindump_checktest(ret == 1);
+  spindump_checktest(streamed.n == 1);
+  spindump_checktest(streamed.events[0].timestamp == timestamp);
+  spindump_checktest(streamed.events[0].bytesFromSide2 == 3);
+  spindump_checktest(strcmp(streamed.events[0].session,"aabb") == 0);
+  spindump_checktest(strcmp(input," [") == 0);
+
+  //
+  // Errors in the syntax, in the schema, and in the event contents are
+  // detected. Events that are already read are delivered.
+  //
+
+  static const char* badInputs[] = {
+    "{ \"Event\": \"new\" ",
+    "{ \"Event\": \"new\", }",
+    "{ \"Event\": 1 }",
+    "{ \"Ts\": 99999999999999999999 }",
+    "{ \"Event\": \"new\", \"Type\": \"QUIC\", \"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], \"Session\": \"aabb\", "
+    "\"State\": \"Starting\", \"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2 }",
+    "{ \"Event\": \"old\", \"Type\": \"QUIC\", \"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], \"Session\": \"aabb\", "
+    "\"Ts\": 1, \"State\": \"Starting\", \"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3 }",
+    "{ \"Event\": \"new\", \"Type\": \"QUIC\", \"Addrs\": [\"1.2.3.4\"], \"Session\": \"aabb\", "
+    "\"Ts\": 1, \"State\": \"Starting\", \"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3 }",
+    "{ \"Event\": \"spinflip\", \"Type\": \"QUIC\", \"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], \"Session\": \"aabb\", "
+    "\"Ts\": 1, \"State\": \"Starting\", \"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3, "
+    "\"Transition\": \"0-1\", \"Who\": \"nobody\" }",
+    "{ \"Event\": \"periodic\", \"Type\": \"QUIC\", \"Addrs\": [\"1.2.3.4\",\"5.6.7.8\"], \"Session\": \"aabb\", "
+    "\"Ts\": 1, \"State\": \"Starting\", \"Packets1\": 1, \"Packets2\": 0, \"Bytes1\": 2, \"Bytes2\": 3, "
+    "\"Hist_right_rtt\": [1,2,3] }"
+  };
+  for (unsigned int i = 0; i < sizeof(badInputs) / sizeof(badInputs[0]); i++) {
+    input = badInputs[i];
+    streamed.n = 0;
+    ret = spindump_event_parser_json_streamparse(&input,unittests_eventjsonstreamparser_callback,&streamed);
+    spindump_checktest(ret == 0);
+    spindump_checktest(streamed.n == 0);
+  }
+  text[textLength - 1] = ',';
+  input = &text[0];
+  streamed.n = 0;
+  ret = spindump_event_parser_json_streamparse(&input,unittests_eventjsonstreamparser_callback,&streamed);
+  spindump_checktest(ret == 0);
+  spindump_checktest(streamed.n == nOriginal);
+}
+
+//
+// Helper functions for unittests_remotefile; write a temporary JSON
+// file, and replay it, returning the number of events read or -1 if
+// the file could not be opened.
+//
+
+static void
+unittests_remotefile_write(const char* text,
+                           char* filename) {
+  strcpy(filename,"/tmp/spindump_test_XXXXXX");
+  int fd = mkstemp(filename);
+  spindump_checktest(fd >= 0);
+  if (fd < 0) return;
+  size_t length = strlen(text);
+  spindump_checktest(write(fd,text,length) == (ssize_t)length);
+  close(fd);
+}
+
+static int
+unittests_remotefile_replay(const char* filename,
+                            struct spindump_analyze* analyzer,
+                            unsigned long long* lastTimestamp,
+                            int* error) {
+  struct spindump_remote_file* file = spindump_remote_file_init(filename);
+  if (file == 0) return(-1);
+  struct timeval timestamp;
+  int n = 0;
+  *lastTimestamp = 0;
+  while (spindump_remote_file_getupdate(file,analyzer,&timestamp)) {
+    unsigned long long eventTimestamp;
+    spindump_timeval_to_timestamp(&timestamp,&eventTimestamp);
+    spindump_checktest(eventTimestamp > *lastTimestamp);
+    *lastTimestamp = eventTimestamp;
+    n++;
+  }
+  *error = file->error;
+  spindump_remote_file_close(file);
+  return(n);
+}
+
+//
+// Unittests -- spindump_remote_file
+//
+
+static void
+unittests_remotefile(void) {
+  printf("unit tests: remote file...\n");
+  struct spindump_analyze* analyzer = spindump_analyze_initialize(0,0,1000000,0,0);
+  spindump_network network1;
+  spindump_network network2;
+  spindump_network_fromstring(&network1,"1.2.3.4/32");
+  spindump_network_fromstring(&network2,"5.6.7.8/32");
+  unsigned long long timestamp = 1892188800000000ULL;
+  unsigned long long lastTimestamp;
+  char filename[100];
+  int error;
+  int n;
+
+  //
+  // Make a file that is larger than the mapping chunk, with records
+  // in two arrays and outside arrays, with varying whitespace, and
+  // with braces and escaped quotes in strings
+  //
+
+  const unsigned int nRecords = 40000;
+  size_t size = nRecords * 512;
+  char* text = (char*)spindump_malloc(size);
+  spindump_checktest(text != 0);
+  if (text == 0) return;
+  size_t textLength = 0;
+  for (unsigned int i = 0; i < nRecords; i++) {
+    struct spindump_event event;
+    spindump_event_initialize(spindump_event_type_new_connection,
+                              spindump_connection_transport_udp,
+                              spindump_connection_state_establishing,
+                              &network1,
+                              &network2,
+                              "1234:5678",
+                              timestamp + i,
+                              1,
+                              0,
+                              100,
+                              0,
+                              100,
+                              0,
+                              0,
+                              i % 3 == 0 ? "} {{ [\\" : i % 3 == 1 ? "a \"} {\" b" : 0,
+                              &event);
+    if (i == 0 || i == nRecords / 2) text[textLength++] = '[';
+    else if (i < nRecords / 4 || (i > nRecords / 2 && i < nRecords * 3 / 4)) text[textLength++] = ',';
+    if (i % 2) text[textLength++] = '\n';
+    size_t consumed;
+    int ret = spindump_event_parser_json_print(&event,&text[textLength],size - textLength - 4,&consumed);
+    spindump_checktest(ret == 1);
+    textLength += strlen(&text[textLength]);
+    if (i == nRecords / 4 - 1 || i == nRecords * 3 / 4 - 1) text[textLength++] = ']';
+    text[textLength++] = ' ';
+  }
+  text[textLength] = 0;
+  spindump_checktest(textLength > spindump_remote_file_mapchunk);
+  unittests_remotefile_write(text,filename);
+  n = unittests_remotefile_replay(filename,analyzer,&lastTimestamp,&error);
+  spindump_checktest(n == (int)nRecords);
+  spindump_checktest(error == 0);
+  spindump_checktest(lastTimestamp == timestamp + nRecords - 1);
+  unlink(filename);
+
+  //
+  // An error in the middle of the file ends the replay, after the
+  // events before it have been handled. An error at the start fails
+  // right away.
+  //
+
+  char* third = text;
+  for (unsigned int i = 0; i < 3 && third != 0; i++) {
+    third = strstr(third + 1,"{ \"Event\"");
+  }
+  spindump_checktest(third != 0);
+  if (third != 0) {
+    third[0] = '<';
+    unittests_remotefile_write(text,filename);
+    n = unittests_remotefile_replay(filename,analyzer,&lastTimestamp,&error);
+    spindump_checktest(n == 2);
+    spindump_checktest(error == 1);
+    unlink(filename);
+  }
+  spindump_free(text);
+
+  static const char* badFiles[] = {
+    "x",
+    "[",
+    "[{",
+    "[ { \"Event\": \"new\" } ]",
+    "[ 1 ]",
+    "[ , ]",
+    "[ [] ]"
+  };
+  for (unsigned int i = 0; i < sizeof(badFiles) / sizeof(badFiles[0]); i++) {
+    unittests_remotefile_write(badFiles[i],filename);
+    n = unittests_remotefile_replay(filename,analyzer,&lastTimestamp,&error);
+    spindump_checktest(n == -1);
+    unlink(filename);
+  }
+
+  //
+  // Empty files and arrays give no events
+  //
+
+  static const char* emptyFiles[] = {
+    "",
+    " \n",
+    "[]",
+    " [ ] [] "
+  };
+  for (unsigned int i = 0; i < sizeof(emptyFiles) / sizeof(emptyFiles[0]); i++) {
+    unittests_remotefile_write(emptyFiles[i],filename);
+    n = unittests_remotefile_replay(filename,analyzer,&lastTimestamp,&error);
+    spindump_checktest(n == 0);
+    spindump_checktest(error == 0);
+    unlink(filename);
+  }
+
+  //
+  // Missing files
+  //
+
+  n = unittests_remotefile_replay("/nonexistent/spindump_test.json",analyzer,&lastTimestamp,&error);
+  spindump_checktest(n == -1);
+  spindump_analyze_uninitialize(analyzer);
+}
+
+//
+// Helper data structure and function for unittests_remotequeue; a
+// producer thread that puts numbered events to the queue in batches
+// of varying sizes, retrying when the queue is full.
+//
+
+#define unittests_remotequeue_producers 4
+#define unittests_remotequeue_events    50000
+
+struct unittests_remotequeue_producer {
+  struct spindump_remote_queue* queue;
+  unsigned int id;
+  unsigned int retries;
+};
+
+static void*
+unittests_remotequeue_producer(void* data) {
+  struct unittests_remotequeue_producer* producer = (struct unittests_remotequeue_producer*)data;
+  struct spindump_event event;
+  memset(&event,0,sizeof(event));
+  event.packetsFromSide1 = producer->id;
+  unsigned int sent = 0;
+  while (sent < unittests_remotequeue_events) {
+    unsigned int count = 1 + sent % 7;
+    if (count > unittests_remotequeue_events - sent) count = unittests_remotequeue_events - sent;
+    unsigned int position;
+    if (!spindump_remote_queue_reserve(producer->queue,count,&position)) {
+      producer->retries++;
+      sched_yield();
+      continue;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+      event.packetsFromSide2 = sent++;
+      spindump_remote_queue_put(producer->queue,position + i,&event);
+    }
+  }
+  return(0);
+}
+
+//
+// Unittests -- spindump_remote_queue
+//
+
+static void
+unittests_remotequeue(void) {
+  printf("unit tests: remote queue...\n");
+
+  //
+  // Batches are queued as a whole or not at all, and events come out
+  // in order
+  //
+
+  struct spindump_remote_queue* queue = spindump_remote_queue_initialize(8);
+  spindump_checktest(queue != 0);
+  if (queue == 0) return;
+  struct spindump_event event;
+  memset(&event,0,sizeof(event));
+  unsigned int position;
+  unsigned int position2;
+  spindump_checktest(spindump_remote_queue_peek(queue) == 0);
+  spindump_checktest(spindump_remote_queue_reserve(queue,9,&position) == 0);
+  spindump_checktest(spindump_remote_queue_reserve(queue,5,&position) == 1);
+  spindump_checktest(position == 0);
+  spindump_checktest(spindump_remote_queue_reserve(queue,4,&position2) == 0);
+  spindump_checktest(spindump_remote_queue_reserve(queue,3,&position2) == 1);
+  spindump_checktest(position2 == 5);
+  spindump_checktest(spindump_remote_queue_reserve(queue,1,&position2) == 0);
+
+  //
+  // A claimed but not yet filled position holds back the consumer
+  //
+
+  event.packetsFromSide1 = 5;
+  spindump_remote_queue_put(queue,5,&event);
+  spindump_checktest(spindump_remote_queue_peek(queue) == 0);
+  for (unsigned int i = 0; i < 5; i++) {
+    event.packetsFromSide1 = i;
+    spindump_remote_queue_put(queue,i,&event);
+  }
+  for (unsigned int i = 0; i < 6; i++) {
+    const struct spindump_event* next = spindump_remote_queue_peek(queue);
+    spindump_checktest(next != 0);
+    spindump_checktest(next != 0 && next->packetsFromSide1 == i);
+    spindump_remote_queue_pop(queue);
+  }
+  spindump_checktest(spindump_remote_queue_peek(queue) == 0);
+  spindump_checktest(spindump_remote_queue_reserve(queue,6,&position) == 1);
+  spindump_checktest(position == 8);
+  spindump_remote_queue_put(queue,6,&event);
+  spindump_remote_queue_put(queue,7,&event);
+  for (unsigned int i = 0; i < 6; i++) spindump_remote_queue_put(queue,position + i,&event);
+  for (unsigned int i = 0; i < 8; i++) {
+    spindump_checktest(spindump_remote_queue_peek(queue) != 0);
+    spindump_remote_queue_pop(queue);
+  }
+  spindump_checktest(spindump_remote_queue_peek(queue) == 0);
+  spindump_remote_queue_uninitialize(queue);
+
+  //
+  // Several producer threads on a small queue. Every event arrives
+  // once, and the events of each producer arrive in order.
+  //
+
+  queue = spindump_remote_queue_initialize(64);
+  spindump_checktest(queue != 0);
+  if (queue == 0) return;
+  struct unittests_remotequeue_producer producers[unittests_remotequeue_producers];
+  pthread_t threads[unittests_remotequeue_producers];
+  unsigned int next[unittests_remotequeue_producers];
+  for (unsigned int i = 0; i < unittests_remotequeue_producers; i++) {
+    producers[i].queue = queue;
+    producers[i].id = i;
+    producers[i].retries = 0;
+    next[i] = 0;
+    spindump_checktest(pthread_create(&threads[i],0,unittests_remotequeue_producer,&producers[i]) == 0);
+  }
+  unsigned int received = 0;
+  int inOrder = 1;
+  while (received < unittests_remotequeue_producers * unittests_remotequeue_events) {
+    const struct spindump_event* next1 = spindump_remote_queue_peek(queue);
+    if (next1 == 0) {
+      sched_yield();
+      continue;
+    }
+    unsigned int id = (unsigned int)next1->packetsFromSide1;
+    if (id >= unittests_remotequeue_producers || next1->packetsFromSide2 != next[id]) {
+      inOrder = 0;
+    } else {
+      next[id]++;
+    }
+    spindump_remote_queue_pop(queue);
+    received++;
+  }
+  for (unsigned int i = 0; i < unittests_remotequeue_producers; i++) {
+    pthread_join(threads[i],0);
+    spindump_checktest(next[i] == unittests_remotequeue_events);
+  }
+  spindump_checktest(inOrder);
+  spindump_checktest(spindump_remote_queue_peek(queue) == 0);
+  spindump_remote_queue_uninitialize(queue);
+}
+
+//
+// Helper function for unittests_eventbinaryparser; encode an event,
+// decode it back, and check that the result is the same, also when
+// printed out as JSON. Check also that truncated records are seen as
+// incomplete.
+//
+
+static void
+unittests_eventbinaryparser_roundtrip(const struct spindump_event* event) {
+  uint8_t buf[spindump_event_parser_binary_maxlength];
+  size_t consumed;
+  int ret = spindump_event_parser_binary_print(event,buf,sizeof(buf),&consumed);
+  spindump_checktest(ret == 1);
+  spindump_deepdebugf("binary event of %lu bytes", consumed);
+  struct spindump_event decoded;
+  size_t decodedLength;
+  ret = spindump_event_parser_binary_parse(buf,consumed,&decoded,&decodedLength);
+  spindump_checktest(ret == 1);
+  spindump_checktest(decodedLength == consumed);
+  spindump_checktest(spindump_event_equal(event,&decoded));
+  spindump_checktest(strcmp(event->notes,decoded.notes) == 0);
+  char json1[2048];
+  char json2[2048];
+  size_t jsonLength;
+  spindump_event_parser_json_print(event,json1,sizeof(json1),&jsonLength);
+  spindump_event_parser_json_print(&decoded,json2,sizeof(json2),&jsonLength);
+  spindump_checktest(strcmp(json1,json2) == 0);
+  for (size_t length = 0; length < consumed; length++) {
+    ret = spindump_event_parser_binary_parse(buf,length,&decoded,&decodedLength);
+    spindump_checktest(ret == 0);
+  }
+  ret = spindump_event_parser_binary_print(event,buf,consumed - 1,&decodedLength);
+  spindump_checktest(ret == 0);
+}
+
+//
+// Helper function for unittests_eventbinaryparser; a callback for
+// parsing binary event streams
+//
+
+static void
+unittests_eventbinaryparser_callback(const struct spindump_event* event,
+                                     void* data) {
+  spindump_assert(event != 0);
+  spindump_assert(data != 0);
+  unsigned int* count = (unsigned int*)data;
+  (*count)++;
+}
+
+//
+// Unittests -- spindump_event_parser_binary
+//
+
+static void
+unittests_eventbinaryparser(void) {
+  printf("unit tests: event binary parser...\n");
+  unsigned long long timestamp = 1892188800001234ULL;
+  spindump_network network1;
+  spindump_network network2;
+  spindump_network network3;
+  spindump_network network4;
+  spindump_network_fromstring(&network1,"1.2.3.4/32");
+  spindump_network_fromstring(&network2,"5.6.7.0/24");
+  spindump_network_fromstring(&network3,"2001:db8::1/128");
+  spindump_network_fromstring(&network4,"2001:db8:1::/48");
+  spindump_tags tags;
+  spindump_tags_initialize(&tags);
+  spindump_tags_addtag(&tags,"site=a");
+
+  //
+  // Events of all types, with different session identifiers, round
+  // trip
+  //
+
+  static const char* sessions[] = {
+    "123:456", "", "45845", "3 sessions", "007:1", "1:2:3",
+    "0102030405060708-a1b2c3d4 (49576:4433)", "null-0a0b (1:2)", "0A0B-0c0d (1:2)", "0a0b-0c0d (1:2"
+  };
+  struct spindump_event event;
+  for (unsigned int i = 0; i < sizeof(sessions) / sizeof(sessions[0]); i++) {
+    for (unsigned int type = spindump_event_type_new_connection; type <= spindump_event_type_packet; type++) {
+      spindump_event_initialize((enum spindump_event_type)type,
+                                i % 2 ? spindump_connection_transport_quic : spindump_connection_aggregate_networkmultinet,
+                                spindump_connection_state_closing,
+                                i % 3 ? &network1 : &network3,
+                                i % 3 ? &network2 : &network4,
+                                sessions[i],
+                                timestamp + i,
+                                i,
+                                1000000,
+                                128,
+                                0xffffffffffffffffULL,
+                                1000,
+                                0,
+                                i % 2 ? &tags : 0,
+                                i % 2 ? 0 : "some notes",
+                                &event);
+      switch (event.eventType) {
+      case spindump_event_type_new_rtt_measurement:
+        event.u.newRttMeasurement.measurement = spindump_measurement_type_bidirectional;
+        event.u.newRttMeasurement.direction = spindump_direction_fromresponder;
+        event.u.newRttMeasurement.rtt = 12345;
+        event.u.newRttMeasurement.avgRtt = 12000;
+        event.u.newRttMeasurement.devRtt = 300;
+        event.u.newRttMeasurement.filtAvgRtt = 11900;
+        event.u.newRttMeasurement.minRtt = 10000;
+        event.u.newRttMeasurement.smoothedRtt = 12100;
+        event.u.newRttMeasurement.varRtt = 250;
+        break;
+      case spindump_event_type_periodic:
+        event.u.periodic.rttRight = spindump_rtt_infinite;
+        event.u.periodic.avgRttRight = 0;
+        event.u.periodic.devRttRight = 0;
+        spindump_histogram_initialize(&event.u.periodic.histRight);
+        for (unsigned long value = 1; value <= 100 * i; value++) {
+          spindump_histogram_record(&event.u.periodic.histRight,value * value * value);
+        }
+        break;
+      case spindump_event_type_spin_flip:
+        event.u.spinFlip.direction = spindump_direction_fromresponder;
+        event.u.spinFlip.spin0to1 = 1;
+        break;
+      case spindump_event_type_spin_value:
+        event.u.spinValue.direction = spindump_direction_frominitiator;
+        event.u.spinValue.value = 1;
+        break;
+      case spindump_event_type_ecn_congestion_event:
+        event.u.ecnCongestionEvent.direction = spindump_direction_fromresponder;
+        event.u.ecnCongestionEvent.ecn0 = 100;
+        event.u.ecnCongestionEvent.ecn1 = 0;
+        event.u.ecnCongestionEvent.ce = 1ULL << 40;
+        break;
+      case spindump_event_type_rtloss_measurement:
+        event.u.rtlossMeasurement.direction = spindump_direction_frominitiator;
+        strcpy(event.u.rtlossMeasurement.avgLoss,"1.25%");
+        strcpy(event.u.rtlossMeasurement.totLoss,"0%");
+        break;
+      case spindump_event_type_qrloss_measurement:
+        event.u.qrlossMeasurement.direction = spindump_direction_fromresponder;
+        strcpy(event.u.qrlossMeasurement.avgLoss,"1%");
+        strcpy(event.u.qrlossMeasurement.totLoss,"2%");
+        strcpy(event.u.qrlossMeasurement.avgRefLoss,"3%");
+        strcpy(event.u.qrlossMeasurement.totRefLoss,"100.00%");
+        break;
+      case spindump_event_type_qlloss_measurement:
+        event.u.qllossMeasurement.direction = spindump_direction_frominitiator;
+        strcpy(event.u.qllossMeasurement.qLoss,"0.5%");
+        strcpy(event.u.qllossMeasurement.lLoss,"");
+        break;
+      case spindump_event_type_packet:
+        event.u.packet.direction = spindump_direction_fromresponder;
+        event.u.packet.length = 1500;
+        break;
+      default:
+        break;
+      }
+      unittests_eventbinaryparser_roundtrip(&event);
+    }
+  }
+
+  //
+  // Common session identifiers are packed
+  //
+  
+  uint8_t buf1[spindump_event_parser_binary_maxlength];
+  uint8_t buf2[spindump_event_parser_binary_maxlength];
+  size_t length1;
+  size_t length2;
+  int ret;
+  spindump_event_initialize(spindump_event_type_new_connection,
+                            spindump_connection_transport_quic,
+                            spindump_connection_state_establishing,
+                            &network1,
+                            &network2,
+                            "0102030405060708-a1b2c3d4 (49576:4433)",
+                            timestamp,
+                            1,
+                            0,
+                            1200,
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                            &event);
+  ret = spindump_event_parser_binary_print(&event,buf1,sizeof(buf1),&length1);
+  spindump_checktest(ret == 1);
+  spindump_checktest(length1 == 1 + 12 + 2 * (1 + 1 + 4) + 1 + 1 + 8 + 1 + 4 + 3 + 2 + 1 + 2 + 1 + 1 + 1 + 1);
+  
+  //
+  // A stream with headers and records parses, but not when it is
+  // truncated or corrupted
+  //
+
+  uint8_t stream[4 * spindump_event_parser_binary_maxlength];
+  size_t streamLength = 0;
+  memcpy(stream,spindump_event_parser_binary_header(),spindump_event_parser_binary_headerlength);
+  streamLength += spindump_event_parser_binary_headerlength;
+  memcpy(stream + streamLength,buf1,length1);
+  streamLength += length1;
+  memcpy(stream + streamLength,buf1,length1);
+  streamLength += length1;
+  memcpy(stream + streamLength,spindump_event_parser_binary_header(),spindump_event_parser_binary_headerlength);
+  streamLength += spindump_event_parser_binary_headerlength;
+  memcpy(stream + streamLength,buf1,length1);
+  streamLength += length1;
+  unsigned int count = 0;
+  ret = spindump_event_parser_binary_streamparse(stream,streamLength,unittests_eventbinaryparser_callback,&count);
+  spindump_checktest(ret == 1);
+  spindump_checktest(count == 3);
+  count = 0;
+  ret = spindump_event_parser_binary_streamparse(stream,streamLength - 1,unittests_eventbinaryparser_callback,&count);
+  spindump_checktest(ret == 0);
+  spindump_checktest(count == 2);
+  stream[1] = 'X';
+  count = 0;
+  ret = spindump_event_parser_binary_streamparse(stream,streamLength,unittests_eventbinaryparser_callback,&count);
+  spindump_checktest(ret == 0);
+  spindump_checktest(count == 0);
+
+  //
+  // Malformed records are rejected
+  //
+
+  struct spindump_event decoded;
+  memcpy(buf2,buf1,length1);
+  buf2[1] = 0;                     // event type
+  ret = spindump_event_parser_binary_parse(buf2,length1,&decoded,&length2);
+  spindump_checktest(ret == -1);
+  memcpy(buf2,buf1,length1);
+  buf2[2] = 100;                   // connection type
+  ret = spindump_event_parser_binary_parse(buf2,length1,&decoded,&length2);
+  spindump_checktest(ret == -1);
+  memcpy(buf2,buf1,length1);
+  buf2[13] = 5;                    // address family
+  ret = spindump_event_parser_binary_parse(buf2,length1,&decoded,&length2);
+  spindump_checktest(ret == -1);
+  memcpy(buf2,buf1,length1);
+  buf2[0] = (uint8_t)length1;      // a byte left over
+  buf2[length1] = 0;
+  ret = spindump_event_parser_binary_parse(buf2,length1 + 1,&decoded,&length2);
+  spindump_checktest(ret == -1);
+  memcpy(buf2,buf1,length1);
+  buf2[0] = 0x80;                  // three-byte length
+  buf2[1] = 0x80;
+  ret = spindump_event_parser_binary_parse(buf2,length1,&decoded,&length2);
+  spindump_checktest(ret == -1);
 }
 
 //
@@ -847,8 +3531,8 @@ systemtests(void) {
   spindump_checktest(connection1->packetsFromSide2 == 1);
   spindump_checktest(connection1->bytesFromSide1.bytes == sizeof(packet1bytes) - spindump_ethernet_header_size);
   spindump_checktest(connection1->bytesFromSide2.bytes == sizeof(packet2bytes) - spindump_ethernet_header_size);
-  spindump_checktest(connection1->leftRTT.lastRTT == spindump_rtt_infinite);
-  spindump_checktest(connection1->rightRTT.lastRTT == 1);
+  spindump_checktest(spindump_connections_peekcold(connection1)->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(spindump_connections_peekcold(connection1)->rightRTT.lastRTT == 1);
   
   //
   // Analyzer tests -- ICMP in the other direction (side 2 being the initiator)
@@ -921,8 +3605,8 @@ systemtests(void) {
   spindump_checktest(connection2->packetsFromSide2 == 1);
   spindump_checktest(connection2->bytesFromSide1.bytes == sizeof(packet3bytes) - spindump_ethernet_header_size);
   spindump_checktest(connection2->bytesFromSide2.bytes == sizeof(packet4bytes) - spindump_ethernet_header_size);
-  spindump_checktest(connection2->leftRTT.lastRTT == spindump_rtt_infinite);
-  spindump_checktest(connection2->rightRTT.lastRTT == 1);
+  spindump_checktest(spindump_connections_peekcold(connection2)->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(spindump_connections_peekcold(connection2)->rightRTT.lastRTT == 1);
   
   //
   // Analyzer tests -- DNS
@@ -993,8 +3677,8 @@ systemtests(void) {
   spindump_checktest(connection3->packetsFromSide2 == 1);
   spindump_checktest(connection3->bytesFromSide1.bytes == sizeof(packet5bytes) - spindump_ethernet_header_size);
   spindump_checktest(connection3->bytesFromSide2.bytes == sizeof(packet6bytes) - spindump_ethernet_header_size);
-  spindump_checktest(connection3->leftRTT.lastRTT == spindump_rtt_infinite);
-  spindump_checktest(connection3->rightRTT.lastRTT == 1);
+  spindump_checktest(spindump_connections_peekcold(connection3)->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(spindump_connections_peekcold(connection3)->rightRTT.lastRTT == 1);
   
   //
   // Analyzer tests -- DNS from the other direction
@@ -1067,8 +3751,8 @@ systemtests(void) {
   spindump_checktest(connection4->packetsFromSide2 == 1);
   spindump_checktest(connection4->bytesFromSide1.bytes == sizeof(packet7bytes) - spindump_ethernet_header_size);
   spindump_checktest(connection4->bytesFromSide2.bytes == sizeof(packet8bytes) - spindump_ethernet_header_size);
-  spindump_checktest(connection4->leftRTT.lastRTT == spindump_rtt_infinite);
-  spindump_checktest(connection4->rightRTT.lastRTT == 1);
+  spindump_checktest(spindump_connections_peekcold(connection4)->leftRTT.lastRTT == spindump_rtt_infinite);
+  spindump_checktest(spindump_connections_peekcold(connection4)->rightRTT.lastRTT == 1);
 
   //
   // Analyzer tests -- capture length being first not the whole packet
@@ -1198,6 +3882,114 @@ systemtests(void) {
   spindump_analyze_uninitialize(analyzer);
 }
 
+//
+// Decode a binary event stream from the standard input, and print the
+// events out in the given format, as the event formatter would print
+// them. This is used by spindump_testtraces.sh to check that the
+// binary format carries everything in the test traces.
+//
+
+struct decodebinary_state {
+  int json;
+  unsigned int nEntries;
+};
+
+static int
+decodebinary(const char* format) {
+
+  struct decodebinary_state state;
+  state.nEntries = 0;
+  if (strcmp(format,"text") == 0) {
+    state.json = 0;
+  } else if (strcmp(format,"json") == 0) {
+    state.json = 1;
+  } else {
+    spindump_errorf("invalid format (%s) to decode to, expected text or json", format);
+    return(1);
+  }
+
+  //
+  // Read the input
+  //
+
+  size_t size = 64 * 1024;
+  size_t length = 0;
+  uint8_t* input = (uint8_t*)spindump_malloc(size);
+  if (input == 0) {
+    spindump_errorf("cannot allocate %lu bytes", size);
+    return(1);
+  }
+  size_t got;
+  while ((got = fread(input + length,1,size - length,stdin)) > 0) {
+    length += got;
+    if (length == size) {
+      uint8_t* bigger = (uint8_t*)spindump_malloc(2 * size);
+      if (bigger == 0) {
+        spindump_errorf("cannot allocate %lu bytes", 2 * size);
+        spindump_free(input);
+        return(1);
+      }
+      memcpy(bigger,input,length);
+      spindump_free(input);
+      input = bigger;
+      size *= 2;
+    }
+  }
+
+  //
+  // Print the events out, with the same preamble and postamble as
+  // the event formatter
+  //
+
+  int ok = 1;
+  if (length > 0) {
+    if (state.json) {
+      fwrite(spindump_eventformatter_measurement_begin_json(0),
+             spindump_eventformatter_measurement_beginlength_json(0),1,stdout);
+    } else {
+      fwrite(spindump_eventformatter_measurement_begin_text(0),
+             spindump_eventformatter_measurement_beginlength_text(0),1,stdout);
+    }
+    ok = spindump_event_parser_binary_streamparse(input,length,decodebinary_callback,&state);
+    if (state.json) {
+      fwrite(spindump_eventformatter_measurement_end_json(0),
+             spindump_eventformatter_measurement_endlength_json(0),1,stdout);
+    } else {
+      fwrite(spindump_eventformatter_measurement_end_text(0),
+             spindump_eventformatter_measurement_endlength_text(0),1,stdout);
+    }
+  }
+  spindump_free(input);
+  return(ok ? 0 : 1);
+}
+
+//
+// Helper function for decodebinary; print one event out
+//
+
+static void
+decodebinary_callback(const struct spindump_event* event,
+                      void* data) {
+  struct decodebinary_state* state = (struct decodebinary_state*)data;
+  char buf[2048];
+  size_t consumed;
+  if (state->json) {
+    if (state->nEntries > 0) {
+      fwrite(spindump_eventformatter_measurement_mid_json(0),
+             spindump_eventformatter_measurement_midlength_json(0),1,stdout);
+    }
+    spindump_event_parser_json_print(event,buf,sizeof(buf)-1,&consumed);
+  } else {
+    if (state->nEntries > 0) {
+      fwrite(spindump_eventformatter_measurement_mid_text(0),
+             spindump_eventformatter_measurement_midlength_text(0),1,stdout);
+    }
+    spindump_event_parser_text_print(event,buf,sizeof(buf)-1,&consumed);
+  }
+  fwrite(buf,strlen(buf),1,stdout);
+  state->nEntries++;
+}
+
 //
 // The main program
 //
@@ -1241,6 +4033,10 @@ int main(int argc,char** argv) {
       
       spindump_deepdeepdebug = 0;
       
+    } else if (strcmp(argv[0],"--decode-binary") == 0 && argc > 1) {
+      
+      exit(decodebinary(argv[1]));
+      
     } else {
 
       spindump_errorf("invalid argument: %s", argv[0]);
@@ -22,6 +22,7 @@ testdir=$srcdir/../test
 tmpdir=/tmp
 debugfile=$tmpdir/spindump.testtraces.dbg
 spindump=$srcdir/spindump
+spindumptest=$srcdir/spindump_test
 rm -f $debugfile
 (echo "cwd:";
  pwd;
@@ -46,6 +47,7 @@ traces="trace_icmpv4_short
         trace_ping_aggregate_average_filt
         trace_ping_aggregate_average_filt_max
         trace_ping_aggregate_average_filt_text
+        trace_ping_aggregate_smoothed
         trace_ping_bandwidthperiods1
         trace_ping_bandwidthperiods2
         trace_ping_bandwidthperiods3
@@ -55,17 +57,24 @@ traces="trace_icmpv4_short
         trace_cmd_jsonfile_syntaxerror
         trace_cmd_jsonfile_empty
         trace_cmd_jsonfile_simple
+        trace_cmd_jsonfile_gzip
         trace_cmd_tags_default
         trace_cmd_tags_aggregate
         trace_cmd_aggregate_regular
         trace_cmd_aggregate_default
         trace_cmd_aggregate_multinet
+        trace_cmd_aggregate_deferred
+        trace_cmd_aggregate_threads
         trace_tcp_short
         trace_tcp_short_json trace_dns
         trace_tcp_short_sack
+        trace_tcp_short_threads
+        trace_tcp_short_midstream
+        trace_tcp_short_synflood
         trace_tcp_tiny1
         trace_quic_v18_short_spin
         trace_quic_v18_short_spin_all
+        trace_quic_v18_migration_threads
         trace_quic_v18_long_spin
         trace_quic_v18_long_spin_all
         trace_quic_v19_short_quant
@@ -156,6 +165,27 @@ traces="trace_icmpv4_short
         trace_sctp_snap128"
         
 
+#
+# Filter results to ensure timestamps in some events do not vary
+# from test run to test run.
+#
+
+filterresults() {
+    sed 's/ at .* delete / at delete /g' |
+    sed 's/ JSON file .*trace_/ JSON file trace_/g' |
+    awk '
+      /Event.: .delete./ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /Event.: .new.*NET2NET.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /Event.: .new.*H2NET.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /Event.: .new.*NET2MUL.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /Event.: .new.*H2MUL.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /Event.: .new.*HOSTS.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
+      /^H2NET.* new .*/ { gsub(/ at [0-9]+ /," "); print $0; next; }
+      /^HOSTS.* new .*/ { gsub(/ at [0-9]+ /," "); print $0; next; }
+      /.*/ { print $0; next; }
+    '
+}
+
 #
 # Check options
 #
@@ -192,6 +222,18 @@ do
     
     echo "Test case $trace... "
 
+    #
+    # Skip the tests of compressed input files, if this build can not
+    # read them
+    #
+
+    if [ -f $testdir/$trace.json.gz ] &&
+       ! $spindump --help | grep -q "compressed with.*gzip"
+    then
+        echo "  skipped, no gzip support..." | tee -a $debugfile
+        continue
+    fi
+
     #
     # Determine the parameters (PCAP files, options etc) of the test case
     #
@@ -202,6 +244,11 @@ do
     outpre=$testdir/$trace.out.pre
     out=$testdir/$trace.out
     outerr=$testdir/$trace.out.err
+    outbin=$testdir/$trace.out.bin
+    outbinerr=$testdir/$trace.out.bin.err
+    outbinpre=$testdir/$trace.out.bin.pre
+    outbinstats=$testdir/$trace.out.bin.stats
+    outbinout=$testdir/$trace.out.bin.out
     cmd=$testdir/$trace.cmd
     corr=$testdir/$trace.expected
     noinputfile=$testdir/$trace.noinput
@@ -261,20 +308,7 @@ do
     # from test run to test run.
     #
 
-    cat $outerr $outpre |
-    sed 's/ at .* delete / at delete /g' |
-    sed 's/ JSON file .*trace_/ JSON file trace_/g' |
-    awk '
-      /Event.: .delete./ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /Event.: .new.*NET2NET.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /Event.: .new.*H2NET.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /Event.: .new.*NET2MUL.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /Event.: .new.*H2MUL.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /Event.: .new.*HOSTS.*/ { gsub(/ .Ts.: [0-9]+,/,""); print $0; next; }
-      /^H2NET.* new .*/ { gsub(/ at [0-9]+ /," "); print $0; next; }
-      /^HOSTS.* new .*/ { gsub(/ at [0-9]+ /," "); print $0; next; }
-      /.*/ { print $0; next; }
-    ' > $out
+    cat $outerr $outpre | filterresults > $out
     
     #
     # Check results
@@ -300,6 +334,31 @@ do
         if [ "x$FAILED" = "x" ]; then FAILED=$trace; else FAILED=$FAILED" "$trace; fi
     fi
     
+    #
+    # Run the test case again with the events in the binary format,
+    # decode them back to the format of the expected results, and
+    # check that the results are still the same.
+    #
+
+    format=`echo --format text $opts | awk '{ for (i = 1; i < NF; i++) if ($i == "--format") f = $(i+1); print f; }'`
+    $spindump $allopts --format binary --output-fd 3 3> $outbin 2> $outbinerr > $outbinstats
+    if $spindumptest --decode-binary $format < $outbin > $outbinpre
+    then
+        nop=nop
+    else
+        echo "**binary decoding failed" | tee -a $debugfile
+    fi
+    cat $outbinerr $outbinpre $outbinstats | filterresults > $outbinout
+    if diff $outbinout $corr > /dev/null
+    then
+        echo "  binary results correct" | tee -a $debugfile
+    else
+        echo "**binary results incorrect" | tee -a $debugfile
+        RESULT=1
+        FAILCTR=`expr $FAILCTR + 1`
+        if [ "x$FAILED" = "x" ]; then FAILED=$trace; else FAILED=$FAILED" "$trace; fi
+    fi
+    
     if [ -f $descr ]
     then
         nop=nop
@@ -52,11 +52,11 @@ spindump_delaybittracker_observeandcalculatertt(struct spindump_analyze* state,
   struct spindump_delaybittracker* tracker;
   struct spindump_delaybittracker* otherTracker;
   if (fromResponder) {
-    tracker = &connection->u.quic.delaybitFromPeer2to1;
-    otherTracker = &connection->u.quic.delaybitFromPeer1to2;
+    tracker = &connection->cold->u.quic.delaybitFromPeer2to1;
+    otherTracker = &connection->cold->u.quic.delaybitFromPeer1to2;
   } else {
-    tracker = &connection->u.quic.delaybitFromPeer1to2;
-    otherTracker = &connection->u.quic.delaybitFromPeer2to1;
+    tracker = &connection->cold->u.quic.delaybitFromPeer1to2;
+    otherTracker = &connection->cold->u.quic.delaybitFromPeer2to1;
   }
 
   //
@@ -49,11 +49,11 @@ spindump_qrlosstracker_observeandcalculateloss(struct spindump_analyze *state,
   struct spindump_qrlosstracker *tracker;
   struct spindump_qrloss *lossRates;
   if (fromResponder) {
-    tracker = &connection->u.quic.qrFromPeer2to1;
-    lossRates = &connection->u.quic.qrLossesFrom2to1;
+    tracker = &connection->cold->u.quic.qrFromPeer2to1;
+    lossRates = &connection->cold->u.quic.qrLossesFrom2to1;
   } else {
-    tracker = &connection->u.quic.qrFromPeer1to2;
-    lossRates = &connection->u.quic.qrLossesFrom1to2;
+    tracker = &connection->cold->u.quic.qrFromPeer1to2;
+    lossRates = &connection->cold->u.quic.qrLossesFrom1to2;
   }
 
   //
@@ -55,8 +55,8 @@ spindump_rtloss1tracker_observeandcalculateloss(struct spindump_analyze* state,
   //
   
   struct spindump_rtloss1tracker* tracker;
-  if (fromResponder) tracker = &connection->u.quic.rtloss1FromPeer2to1;
-  else tracker = &connection->u.quic.rtloss1FromPeer1to2;
+  if (fromResponder) tracker = &connection->cold->u.quic.rtloss1FromPeer2to1;
+  else tracker = &connection->cold->u.quic.rtloss1FromPeer1to2;
 
   //
   // Compute round trip loss
@@ -161,8 +161,8 @@ spindump_rtloss2tracker_observeandcalculateloss(struct spindump_analyze *state,
   //
 
   struct spindump_rtloss2tracker *tracker;
-  if (fromResponder) tracker = &connection->u.quic.rtloss2FromPeer2to1;
-  else tracker = &connection->u.quic.rtloss2FromPeer1to2;
+  if (fromResponder) tracker = &connection->cold->u.quic.rtloss2FromPeer2to1;
+  else tracker = &connection->cold->u.quic.rtloss2FromPeer1to2;
   tracker->markedPktCounter++;
 
   //
@@ -663,14 +663,14 @@ spindump_address_tobytes(const spindump_address* address,
 // Convert an address to a string. Returned string need not be freed,
 // but will not survive the next call to this same function.
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_address_tostring(const spindump_address* address) {
   spindump_assert(address != 0);
   spindump_assert(address->ss_family != 0);
-  static char buf[100];
+  static _Thread_local char buf[100];
   memset(buf,0,sizeof(buf));
   switch (address->ss_family) {
   case AF_INET:
@@ -814,12 +814,12 @@ spindump_network_fromstring(spindump_network* network,
 // need not be freed, but will not survive the next call to this same
 // function.
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_network_tostring(const  spindump_network* network) {
-  static char buf[100];
+  static _Thread_local char buf[100];
   memset(buf,0,sizeof(buf));
   snprintf(buf, sizeof(buf)-1, "%s/%u",
            spindump_address_tostring(&network->address),
@@ -893,16 +893,266 @@ spindump_network_fromempty(sa_family_t af,
   network->length = 0;
 }
 
+//
+// Convert a socket address to the compact address form used inside
+// the connection table. Only the family and the address bytes are
+// retained; ports, scope ids and the like are not.
+//
+
+void
+spindump_compactaddress_fromaddress(const spindump_address* address,
+                                    spindump_compactaddress* compact) {
+  spindump_assert(address != 0);
+  spindump_assert(compact != 0);
+  memset(compact,0,sizeof(*compact));
+  switch (address->ss_family) {
+  case AF_INET:
+    {
+      const struct sockaddr_in* actual = (const struct sockaddr_in*)address;
+      compact->family = AF_INET;
+      compact->words[0] = actual->sin_addr.s_addr;
+    }
+    break;
+  case AF_INET6:
+    {
+      const struct sockaddr_in6* actual = (const struct sockaddr_in6*)address;
+      compact->family = AF_INET6;
+      memcpy(compact->words,actual->sin6_addr.s6_addr,16);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+//
+// Convert a compact address back to a socket address
+//
+
+void
+spindump_compactaddress_toaddress(const spindump_compactaddress* compact,
+                                  spindump_address* address) {
+  spindump_assert(compact != 0);
+  spindump_assert(address != 0);
+  memset(address,0,sizeof(*address));
+  address->ss_family = compact->family;
+  switch (compact->family) {
+  case AF_INET:
+    {
+      struct sockaddr_in* actual = (struct sockaddr_in*)address;
+      actual->sin_addr.s_addr = compact->words[0];
+    }
+    break;
+  case AF_INET6:
+    {
+      struct sockaddr_in6* actual = (struct sockaddr_in6*)address;
+      memcpy(actual->sin6_addr.s6_addr,compact->words,16);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+//
+// How many bits is this compact address? Possible answers are 32 and
+// 128.
+//
+
+unsigned int
+spindump_compactaddress_length(const spindump_compactaddress* compact) {
+  switch (compact->family) {
+  case AF_INET: return(32);
+  case AF_INET6: return(128);
+  default:
+    spindump_errorf("invalid address family");
+    return(0);
+  }
+}
+
+//
+// Convert a compact address to a string. Returned string need not be
+// freed, but will not survive the next call to this same function or
+// spindump_address_tostring.
+//
+// Note: This function is not thread safe.
+//
+
+const char*
+spindump_compactaddress_tostring(const spindump_compactaddress* compact) {
+  spindump_address address;
+  spindump_compactaddress_toaddress(compact,&address);
+  return(spindump_address_tostring(&address));
+}
+
+//
+// Compact address comparison. As unused words are always zero, this
+// is just a comparison of the family and four words.
+//
+
+int
+spindump_compactaddress_equal(const spindump_compactaddress* address1,
+                              const spindump_compactaddress* address2) {
+  return(address1->family != 0 &&
+         address1->family == address2->family &&
+         address1->words[0] == address2->words[0] &&
+         address1->words[1] == address2->words[1] &&
+         address1->words[2] == address2->words[2] &&
+         address1->words[3] == address2->words[3]);
+}
+
+//
+// Compact address ordering. The order is the same as the one
+// spindump_address_compare uses: first by family, then by the address
+// bytes in network byte order.
+//
+
+int
+spindump_compactaddress_compare(const spindump_compactaddress* address1,
+                                const spindump_compactaddress* address2) {
+
+  if (address1->family < address2->family)
+    return(-1);
+  else if (address1->family > address2->family)
+    return(1);
+
+  unsigned int i;
+  for (i = 0; i < 4; i++) {
+    uint32_t word1 = ntohl(address1->words[i]);
+    uint32_t word2 = ntohl(address2->words[i]);
+    if (word1 < word2) return(-1);
+    else if (word1 > word2) return(1);
+  }
+  
+  return(0);
+}
+
+//
+// Compact address comparison to a network prefix
+//
+
+int
+spindump_compactaddress_innetwork(const spindump_compactaddress* address,
+                                  const spindump_compactnetwork* network) {
+  
+  spindump_assert(address != 0);
+  spindump_assert(address->family != 0);
+  spindump_assert(network != 0);
+  spindump_assert(network->address.family != 0);
+  spindump_assert(network->length <= (network->address.family == AF_INET ? 32 : 128));
+  
+  if (address->family != network->address.family) return(0);
+
+  unsigned int remaining = network->length;
+  unsigned int i;
+  for (i = 0; i < 4 && remaining > 0; i++) {
+    uint32_t mask = (remaining >= 32) ? 0xFFFFFFFF : ~(0xFFFFFFFFU >> remaining);
+    if ((ntohl(address->words[i]) & mask) != (ntohl(network->address.words[i]) & mask)) return(0);
+    remaining = (remaining >= 32) ? remaining - 32 : 0;
+  }
+  
+  return(1);
+}
+
+//
+// Convert a network to the compact network form
+//
+
+void
+spindump_compactnetwork_fromnetwork(const spindump_network* network,
+                                    spindump_compactnetwork* compact) {
+  spindump_assert(network != 0);
+  spindump_assert(compact != 0);
+  spindump_compactaddress_fromaddress(&network->address,&compact->address);
+  compact->length = network->length;
+}
+
+//
+// Convert a compact network back to a network
+//
+
+void
+spindump_compactnetwork_tonetwork(const spindump_compactnetwork* compact,
+                                  spindump_network* network) {
+  spindump_assert(compact != 0);
+  spindump_assert(network != 0);
+  spindump_compactaddress_toaddress(&compact->address,&network->address);
+  network->length = compact->length;
+  network->padding = 0;
+}
+
+//
+// Create a compact network based on a compact address, i.e.,
+// a.b.c.d/32 or foo::bar/128.
+//
+
+void
+spindump_compactnetwork_fromaddress(const spindump_compactaddress* address,
+                                    spindump_compactnetwork* network) {
+  spindump_assert(address != 0);
+  spindump_assert(network != 0);
+  network->address = *address;
+  network->length = (address->family == AF_INET6) ? 128 : 32;
+}
+
+//
+// Create an empty compact network (0.0.0.0/0 or ::/0)
+//
+
+void
+spindump_compactnetwork_fromempty(sa_family_t af,
+                                  spindump_compactnetwork* network) {
+  spindump_assert(network != 0);
+  memset(network,0,sizeof(*network));
+  network->address.family = (uint8_t)af;
+}
+
+//
+// Compact network prefix comparison
+//
+
+int
+spindump_compactnetwork_equal(const spindump_compactnetwork* network1,
+                              const spindump_compactnetwork* network2) {
+  return(network1->length == network2->length &&
+         spindump_compactaddress_equal(&network1->address,
+                                       &network2->address));
+}
+
+//
+// Check whether a compact network is a host network (/32 or /128)
+//
+
+int
+spindump_compactnetwork_ishost(const spindump_compactnetwork* network) {
+  return((network->address.family == AF_INET && network->length == 32) ||
+         (network->address.family == AF_INET6 && network->length == 128));
+}
+
+//
+// Print a compact network to a string. Returned string need not be
+// freed, but will not survive the next call to this same function.
+//
+// Note: This function is not thread safe.
+//
+
+const char*
+spindump_compactnetwork_tostring(const spindump_compactnetwork* network) {
+  spindump_network full;
+  spindump_compactnetwork_tonetwork(network,&full);
+  return(spindump_network_tostring(&full));
+}
+
 //
 // Convert a large number to a string, e.g., 1000000 would become
 // "1M".
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_meganumber_tostring(unsigned long x) {
-  static char buf[50];
+  static _Thread_local char buf[50];
   const char* u;
   const unsigned long thou = 1000;
   unsigned long f;
@@ -933,12 +1183,12 @@ spindump_meganumber_tostring(unsigned long x) {
 // Convert a large number to a string, e.g., 1000000 would become
 // "1M". The input is a "long long".
 //
-// Note: This function is not thread safe.
+// Note: This function is not reentrant, but the buffer is per thread.
 //
 
 const char*
 spindump_meganumberll_tostring(unsigned long long x) {
-  static char buf[100];
+  static _Thread_local char buf[100];
   const char* u;
   const unsigned long long thou = 1000;
   unsigned long long f;
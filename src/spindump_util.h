@@ -47,6 +47,11 @@
 #define spindump_min(a,b)       ((a) < (b) ? (a) : (b))
 #define spindump_isbool(x)      ((x) == 0 || (x) == 1)
 #define spindump_iszerotime(x)  ((x)->tv_sec == 0)
+#if defined(__GNUC__) || defined(__clang__)
+#define spindump_prefetch(x)    __builtin_prefetch(x)
+#else
+#define spindump_prefetch(x)
+#endif
 
 #ifdef SPINDUMP_MEMDEBUG
 #define spindump_malloc(x) spindump_memdebug_malloc(x)
@@ -70,6 +75,15 @@ typedef struct {
   unsigned int length;
   unsigned int padding; // unused
 } spindump_network;
+typedef struct {
+  uint8_t family;       // AF_INET, AF_INET6, or 0 if not set
+  uint8_t padding[3];   // unused padding, always zero
+  uint32_t words[4];    // address in network byte order, unused words are zero
+} spindump_compactaddress;
+typedef struct {
+  spindump_compactaddress address;
+  unsigned int length;
+} spindump_compactnetwork;
 
 //
 // Configuration variables --------------------------------------------------------------------
@@ -158,6 +172,44 @@ spindump_network_fromaddress(const spindump_address* address,
 void
 spindump_network_fromempty(sa_family_t af,
                            spindump_network* network);
+void
+spindump_compactaddress_fromaddress(const spindump_address* address,
+                                    spindump_compactaddress* compact);
+void
+spindump_compactaddress_toaddress(const spindump_compactaddress* compact,
+                                  spindump_address* address);
+unsigned int
+spindump_compactaddress_length(const spindump_compactaddress* compact);
+const char*
+spindump_compactaddress_tostring(const spindump_compactaddress* compact);
+int
+spindump_compactaddress_equal(const spindump_compactaddress* address1,
+                              const spindump_compactaddress* address2);
+int
+spindump_compactaddress_compare(const spindump_compactaddress* address1,
+                                const spindump_compactaddress* address2);
+int
+spindump_compactaddress_innetwork(const spindump_compactaddress* address,
+                                  const spindump_compactnetwork* network);
+void
+spindump_compactnetwork_fromnetwork(const spindump_network* network,
+                                    spindump_compactnetwork* compact);
+void
+spindump_compactnetwork_tonetwork(const spindump_compactnetwork* compact,
+                                  spindump_network* network);
+void
+spindump_compactnetwork_fromaddress(const spindump_compactaddress* address,
+                                    spindump_compactnetwork* network);
+void
+spindump_compactnetwork_fromempty(sa_family_t af,
+                                  spindump_compactnetwork* network);
+int
+spindump_compactnetwork_equal(const spindump_compactnetwork* network1,
+                              const spindump_compactnetwork* network2);
+int
+spindump_compactnetwork_ishost(const spindump_compactnetwork* network);
+const char*
+spindump_compactnetwork_tostring(const spindump_compactnetwork* network);
 const char*
 spindump_meganumber_tostring(unsigned long x);
 const char*